@@ -0,0 +1,738 @@
+#include <algorithm>
+#include <string.h>
+#include <wctype.h>
+#include "Benchmark.h"
+#include "EventCursor.h"
+#include "Utf8Encode.h"
+
+
+// Messages and what NormalizeMessage must make of them
+static const struct {
+	LPCWSTR message;
+	LPCWSTR normalized;
+} normalizedMessages[] = {
+	{ L"", L"" },
+	{ L" \t\r\n ", L"" },
+	{ L"  Source Port:\t\t51344\r\n", L"Source Port: #" },
+	{ L"Logon ID:\t\t0x8DCDC", L"Logon ID: #" },
+	{ L"Status:\t\t\t0xC000006D", L"Status: #" },
+	{ L"0xdeadbeef or deadbeef", L"# or deadbeef" },
+	{ L"Source Network Address:\t203.0.113.9", L"Source Network Address: #.#.#.#" },
+	{ L"Logon GUID:\t\t{0d3c2b4a-7f52-6e1c-2a90-4a2b0c1d9e3f}", L"Logon GUID: {#-#-#-#-#}" },
+	{ L"S-1-5-21-3623811015-3361044348", L"S-#-#-#-#-#" },
+	{ L"x64, x86 and build2019", L"x#, x# and build#" },
+	{ L"Jürgen.Müller 42", L"Jürgen.Müller #" },
+	{ L"The Windows Update service entered the running state.", L"The Windows Update service entered the running state." },
+};
+
+// The storm: an hour of one fixture event a second, from STORM_START
+// (2014-03-07T16:00:00Z, around when the fixtures were captured), with
+// storms of some of them on top
+#define STORM_SECONDS 3600
+#define STORM_START 1394208000
+
+// Each storm: the fixture event it repeats, when (seconds into the hour,
+// to before "to"), and how often: "count" events every "every" seconds.
+// Their numbers (ports, addresses, logon IDs) change from event to event
+static const struct {
+	const char *name;
+	DWORD eventId;
+	DWORD from;
+	DWORD to;
+	DWORD count;
+	DWORD every;
+} stormShapes[STORM_SHAPE_COUNT] = {
+	{ "4625 brute force", 4625, 600, 1500, 40, 1 },
+	{ "7036 service flaps", 7036, 1800, 3000, 1, 3 },
+	{ "4624 network logons", 4624, 2400, 2700, 20, 1 },
+};
+
+
+// Accounts the brute force tries, and services that flap
+static const LPCWSTR stormAccounts[] = { L"administrator", L"admin", L"root", L"guest" };
+static const LPCWSTR stormServices[] = { L"Windows Update", L"Print Spooler", L"DHCP Client" };
+
+// Windows (seconds) and table sizes the storm is aggregated with
+static const DWORD aggregateWindows[] = { 10, 60, 300 };
+static const DWORD aggregateTables[] = { 16, 256, AGGREGATE_FLOWS_DEFAULT };
+
+// Window and table of the cursor checks: a day, so that every copy of a
+// fixture event merges, and a minute in a table too small for the corpus
+static const struct {
+	DWORD window;
+	DWORD flows;
+} aggregateCursorChecks[] = {
+	{ AGGREGATE_WINDOW_MAX, AGGREGATE_FLOWS_DEFAULT },
+	{ 60, 4 },
+};
+
+
+// A flow as the reference aggregation works it out, or as a record says
+struct REFERENCE_FLOW {
+	DWORD64 recordId;
+	DWORD64 count;
+	DWORD64 firstSeconds;
+	DWORD64 lastSeconds;
+
+	bool operator<(const REFERENCE_FLOW &other) const { return recordId < other.recordId; }
+	bool operator!=(const REFERENCE_FLOW &other) const
+	{
+		return recordId != other.recordId || count != other.count || firstSeconds != other.firstSeconds || lastSeconds != other.lastSeconds;
+	}
+};
+
+
+// The key EventAggregator merges events on
+static std::wstring FlowKey(DWORD64 eventId, const std::wstring &channel, const std::wstring &provider, const std::wstring &message)
+{
+	WCHAR number[24];
+	std::wstring key = FormatUnsigned(eventId, number);
+
+	key.push_back(L'\0');
+	key += channel;
+	key.push_back(L'\0');
+	key += provider;
+	key.push_back(L'\0');
+	NormalizeMessage(message.c_str(), &key);
+
+	return key;
+}
+
+
+/****
+ * ReferenceFlows
+ *
+ * DESC:
+ *     Aggregates events the plain way, for events in TimeCreated order and
+ *     a table that never fills: an event joins its key's flow if that
+ *     started less than the window before it, and starts the next one if
+ *     not
+ *
+ * ARGS:
+ *     keys - the key of each event
+ *     recordIds, seconds - its record ID and TimeCreated
+ *     flows - receives the flows, by record ID
+ */
+static void ReferenceFlows(const std::vector<std::wstring> &keys, const std::vector<DWORD64> &recordIds, const std::vector<DWORD64> &seconds,
+	DWORD window, std::vector<REFERENCE_FLOW> *flows)
+{
+	std::map<std::wstring, size_t> current;
+
+	flows->clear();
+
+	for( size_t i = 0; i < keys.size(); i++ ) {
+		std::map<std::wstring, size_t>::iterator found = current.find(keys[i]);
+
+		if( found != current.end() && seconds[i] - (*flows)[found->second].firstSeconds < window ) {
+			(*flows)[found->second].count++;
+			(*flows)[found->second].lastSeconds = seconds[i];
+			continue;
+		}
+
+		REFERENCE_FLOW flow = { recordIds[i], 1, seconds[i], seconds[i] };
+
+		current[keys[i]] = flows->size();
+		flows->push_back(flow);
+	}
+
+	std::sort(flows->begin(), flows->end());
+}
+
+
+// The flows records say, by record ID
+static void FlowsOf(const std::vector<IPFIX_FIELDS> &records, std::vector<REFERENCE_FLOW> *flows)
+{
+	flows->clear();
+
+	for( size_t r = 0; r < records.size(); r++ ) {
+		REFERENCE_FLOW flow = { records[r].recordId, records[r].count, records[r].firstSeconds, records[r].lastSeconds };
+
+		flows->push_back(flow);
+	}
+
+	std::sort(flows->begin(), flows->end());
+}
+
+
+/****
+ * CheckFlowRecords
+ *
+ * DESC:
+ *     Checks what every flow record must be: an EpEventLogFlow record,
+ *     its time that of its first event, its events no more than the window apart, and all of them
+ *     together the events there were
+ *
+ * RETURNS:
+ *     The number of records that are wrong, plus one if the counts do not
+ *     add up
+ */
+static DWORD CheckFlowRecords(const std::vector<IPFIX_FIELDS> &records, DWORD window, DWORD64 events)
+{
+	DWORD64 counted = 0;
+	DWORD wrong = 0;
+
+	for( size_t r = 0; r < records.size(); r++ ) {
+		const IPFIX_FIELDS &record = records[r];
+
+		if( !record.merged || record.count == 0 || record.seconds != record.firstSeconds || record.lastSeconds < record.firstSeconds
+			|| record.lastSeconds - record.firstSeconds >= window || record.rollable != IPFIX_ROLLABLE )
+			wrong++;
+
+		counted += record.count;
+	}
+
+	return wrong + (counted != events ? 1 : 0);
+}
+
+
+// Replaces every number in a message (as NormalizeMessage has them) with
+// another of as many digits
+static void VaryNumbers(std::wstring *message, DWORD *state)
+{
+	static const WCHAR hex[] = L"0123456789ABCDEF";
+
+	for( size_t at = 0; at < message->size(); ) {
+		WCHAR c = (*message)[at];
+
+		if( !iswalnum(c) && c != L'_' ) {
+			at++;
+			continue;
+		}
+
+		size_t end = at;
+
+		while( end < message->size() && (iswalnum((*message)[end]) || (*message)[end] == L'_') )
+			end++;
+
+		BOOL prefixed = end - at > 2 && c == L'0' && ((*message)[at + 1] == L'x' || (*message)[at + 1] == L'X');
+		BOOL digits = TRUE;
+
+		for( size_t i = at; i < end && !prefixed; i++ )
+			digits = digits && iswdigit((*message)[i]);
+
+		for( size_t i = prefixed ? at + 2 : at; (prefixed || digits) && i < end; i++ )
+			(*message)[i] = prefixed ? hex[NextRandom(state) % 16] : (WCHAR)(L'0' + (i == at && end - at > 1 ? 1 + NextRandom(state) % 9 : NextRandom(state) % 10));
+
+		at = end;
+	}
+}
+
+
+// Replaces the first of one string in a message with another
+static void ReplaceFirst(std::wstring *message, LPCWSTR from, LPCWSTR to)
+{
+	size_t at = message->find(from);
+
+	if( at != std::wstring::npos )
+		message->replace(at, wcslen(from), to);
+}
+
+
+// The fixture events the storm is made of, as JSON records tell them.
+// FALSE if there are none
+BOOL LoadStormProtos(BENCH_OPTIONS *options, std::vector<STORM_PROTO> *protos)
+{
+	FixtureSource corpus(1);
+
+	if( !LoadFixtures(&corpus, options, 0) )
+		return FALSE;
+
+	EVENT_SESSION session(&corpus);
+	COLLECTOR collector;
+	CallbackSink sink(CollectRecord, &collector);
+	EVT_HANDLE hResults = corpus.Query(NULL, NULL, EvtQueryChannelPath | EvtQueryForwardDirection);
+	EVT_HANDLE hEvents[BATCH_SIZE_MAX];
+	DWORD dwReturned;
+
+	collector.calls = 0;
+	collector.refuse = 0;
+
+	while( corpus.Next(hResults, BATCH_SIZE_MAX, hEvents, INFINITE, &dwReturned) && dwReturned > 0 ) {
+		for( DWORD i = 0; i < dwReturned; i++ ) {
+			DumpEventInfo(&session, hEvents[i], &sink, OUTPUT_FORMAT_JSON, options->mode, DEBUG_NONE);
+			corpus.Close(hEvents[i]);
+		}
+	}
+	corpus.Close(hResults);
+	session.publishers.Clear();
+
+	for( size_t r = 0; r < collector.records.size(); r++ ) {
+		std::map<std::wstring, std::wstring> json;
+		STORM_PROTO proto;
+
+		if( !ReadJsonRecord(collector.records[r], &json) )
+			continue;
+
+		proto.channel = json[L"logname"];
+		proto.provider = json[L"source"];
+		proto.message = json[L"message"];
+		proto.eventId = (DWORD)_wcstoui64(json[L"event_id"].c_str(), NULL, 10);
+		protos->push_back(proto);
+	}
+
+	return !protos->empty();
+}
+
+
+/****
+ * MakeStorm
+ *
+ * DESC:
+ *     Lays out an hour of events made of the fixture events: one a second
+ *     round the corpus, and the stormShapes on top, in time order
+ *
+ * ARGS:
+ *     shapeEvents - receives how many events each storm has (0 for one
+ *                   whose fixture event is not in the corpus)
+ */
+void MakeStorm(const std::vector<STORM_PROTO> &protos, std::vector<STORM_EVENT> *storm, DWORD64 *shapeEvents)
+{
+	size_t shapeProtos[STORM_SHAPE_COUNT];
+	DWORD state = 2463534242U;
+
+	for( size_t k = 0; k < STORM_SHAPE_COUNT; k++ ) {
+		shapeProtos[k] = protos.size();
+		shapeEvents[k] = 0;
+
+		for( size_t p = 0; p < protos.size() && shapeProtos[k] == protos.size(); p++ ) {
+			if( protos[p].eventId == stormShapes[k].eventId )
+				shapeProtos[k] = p;
+		}
+	}
+
+	for( DWORD s = 0; s < STORM_SECONDS; s++ ) {
+		STORM_EVENT event;
+
+		event.proto = s % protos.size();
+		event.seconds = STORM_START + s;
+		event.message = protos[event.proto].message;
+		storm->push_back(event);
+
+		for( size_t k = 0; k < STORM_SHAPE_COUNT; k++ ) {
+			if( shapeProtos[k] == protos.size() || s < stormShapes[k].from || s >= stormShapes[k].to || (s - stormShapes[k].from) % stormShapes[k].every != 0 )
+				continue;
+
+			for( DWORD n = 0; n < stormShapes[k].count; n++, shapeEvents[k]++ ) {
+				event.proto = shapeProtos[k];
+				event.message = protos[event.proto].message;
+
+				VaryNumbers(&event.message, &state);
+
+				if( stormShapes[k].eventId == 4625 ) {
+					ReplaceFirst(&event.message, L"administrator", stormAccounts[NextRandom(&state) % (sizeof(stormAccounts) / sizeof(stormAccounts[0]))]);
+				} else if( stormShapes[k].eventId == 7036 ) {
+					ReplaceFirst(&event.message, L"Windows Update", stormServices[shapeEvents[k] / 2 % (sizeof(stormServices) / sizeof(stormServices[0]))]);
+					if( shapeEvents[k] % 2 )
+						ReplaceFirst(&event.message, L"running", L"stopped");
+				}
+
+				storm->push_back(event);
+			}
+		}
+	}
+}
+
+
+// The System fields of an event of the storm, as the values path has them
+void StormFields(const STORM_PROTO &proto, const STORM_EVENT &event, DWORD64 recordId, SYSTEM_FIELDS *fields, LPWSTR recordText)
+{
+	memset(fields, 0, sizeof(SYSTEM_FIELDS));
+
+	fields->recordId = FormatUnsigned(recordId, recordText);
+	fields->recordIdValue = recordId;
+	fields->eventId = L"";
+	fields->timeCreated = L"";
+	fields->channel = proto.channel.c_str();
+	fields->provider = proto.provider.c_str();
+	fields->values = RECORD_FIELD_EVENT_ID | RECORD_FIELD_TIME_CREATED;
+	fields->eventIdValue = (WORD)proto.eventId;
+	fields->timeCreatedValue = ((ULONGLONG)event.seconds + (ULONGLONG)FILETIME_EPOCH_DAYS * 86400) * FILETIME_TICKS_PER_SECOND;
+}
+
+
+/****
+ * AggregateStorm
+ *
+ * DESC:
+ *     Writes the storm as EpEventLog records into sets of the default
+ *     size: one an event with a window of 0, or else one a flow, each
+ *     written as soon as it is closed
+ *
+ * ARGS:
+ *     sets - where the sets go, large enough for a record an event
+ *     records - receives the records, taken apart again
+ *     mostOpen - receives the most flows that were open at once
+ *     evicted - receives how many flows were closed to make room
+ *
+ * RETURNS:
+ *     The seconds it took, or a negative number if the sets filled up or
+ *     could not be read back
+ */
+static double AggregateStorm(const std::vector<STORM_PROTO> &protos, const std::vector<STORM_EVENT> &storm, DWORD window, DWORD table,
+	std::vector<BYTE> *sets, std::vector<IPFIX_FIELDS> *records, DWORD *mostOpen, DWORD64 *evicted)
+{
+	EventAggregator flows;
+	IPFIX_EXPORT exporter;
+	GrowBuffer buffer;
+	SYSTEM_FIELDS fields;
+	WCHAR recordText[24];
+	BOOL ok = TRUE;
+
+	SetIpfixMachineId(&exporter, IPFIX_CHECK_MACHINE);
+	exporter.templateId = IPFIX_CHECK_TEMPLATE;
+	exporter.flowTemplateId = IPFIX_CHECK_FLOW_TEMPLATE;
+	flows.Configure(window, table);
+
+	IpfixSetSink sink(sets->data(), (DWORD)sets->size(), IPFIX_CHECK_TEMPLATE, exporter.maxSetBytes);
+
+	*mostOpen = 0;
+
+	std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+
+	for( size_t i = 0; ok && i < storm.size(); i++ ) {
+		StormFields(protos[storm[i].proto], storm[i], i + 1, &fields, recordText);
+
+		if( window == 0 ) {
+			DWORD bytes = 0;
+
+			ok = EncodeIpfixRecord(&buffer, &fields, storm[i].message.c_str(), &exporter, &bytes) && sink.WriteBinary((const BYTE *)buffer.Data(), bytes);
+			continue;
+		}
+
+		flows.Add(&fields, storm[i].message.c_str());
+		ok = flows.Drain(&sink, &buffer, &exporter);
+
+		if( flows.Open() > *mostOpen )
+			*mostOpen = flows.Open();
+	}
+
+	flows.Flush();
+	ok = ok && flows.Drain(&sink, &buffer, &exporter);
+
+	double seconds = Seconds(started);
+	DWORD setCount = 0;
+
+	*evicted = flows.Evicted();
+	records->clear();
+
+	if( !ok || !ReadIpfixSets(sets->data(), sink.Used(), exporter.maxSetBytes, records, NULL, &setCount) )
+		return -1.0;
+
+	sets->resize(sink.Used());
+
+	return seconds;
+}
+
+
+/****
+ * ReadAggregated
+ *
+ * DESC:
+ *     Reads a whole fixture source through a cursor into sets of flows,
+ *     a little at a time, as ReadEventsToIpfixBuffer does: the flows the
+ *     events closed go after them, a read that leaves any stops short, and
+ *     the buffer grows when not even one record fits. The open flows are
+ *     flushed at the end, as FlushIpfixFlows does
+ *
+ * ARGS:
+ *     records - receives the flows, taken apart again
+ *     events - receives the number of events read
+ *
+ * RETURNS:
+ *     FALSE if the sets could not be read back, or the reads did not end
+ */
+static BOOL ReadAggregated(FixtureSource *fixture, DWORD window, DWORD table, BENCH_OPTIONS *options, std::vector<IPFIX_FIELDS> *records,
+	DWORD64 *events, DWORD64 *calls, DWORD64 *grown)
+{
+	EVENT_SESSION session(fixture);
+	EventCursor cursor(&session);
+	std::vector<BYTE> buffer(AGGREGATE_CHECK_BUFFER);
+	BOOL ok = cursor.Start(NULL, NULL, DEBUG_NONE);
+	BOOL flushing = FALSE;
+
+	SetIpfixMachineId(&session.ipfix, IPFIX_CHECK_MACHINE);
+	session.ipfix.templateId = IPFIX_CHECK_TEMPLATE;
+	session.ipfix.flowTemplateId = IPFIX_CHECK_FLOW_TEMPLATE;
+	session.ipfix.maxSetBytes = AGGREGATE_CHECK_SET_BYTES;
+	session.flows.Configure(window, table);
+
+	*events = *calls = *grown = 0;
+	records->clear();
+
+	while( ok && (*calls)++ < 10 * (DWORD64)fixture->Count() )
+	{
+		IpfixSetSink sink(buffer.data(), (DWORD)buffer.size(), session.ipfix.templateId, session.ipfix.maxSetBytes);
+		DWORD read = 0, status = ERROR_SUCCESS, setCount = 0;
+
+		if( flushing ) {
+			session.flows.Flush();
+		} else {
+			read = cursor.Read(options->batch, &sink, OUTPUT_FORMAT_IPFIX, options->mode, DEBUG_NONE);
+			status = cursor.Status();
+		}
+
+		if( !session.flows.Drain(&sink, &session.render.record, &session.ipfix) || status == ERROR_INSUFFICIENT_BUFFER )
+			status = sink.Used() > 0 ? ERROR_MORE_DATA : ERROR_INSUFFICIENT_BUFFER;
+
+		ok = (status == ERROR_SUCCESS || status == ERROR_MORE_DATA || status == ERROR_INSUFFICIENT_BUFFER)
+			&& ReadIpfixSets(buffer.data(), sink.Used(), session.ipfix.maxSetBytes, records, NULL, &setCount) && setCount == sink.Sets();
+
+		*events += read;
+
+		if( status == ERROR_INSUFFICIENT_BUFFER ) {
+			ok = ok && sink.Required() > buffer.size();
+			buffer.resize(buffer.size() < 4 * AGGREGATE_CHECK_SET_BYTES ? 4 * AGGREGATE_CHECK_SET_BYTES : sink.Required());
+			(*grown)++;
+		} else if( status == ERROR_SUCCESS && read == 0 ) {
+			if( flushing ) {
+				session.publishers.Clear();
+				return ok && session.flows.Open() == 0 && session.flows.Pending() == 0;
+			}
+
+			flushing = TRUE;
+		}
+	}
+
+	session.publishers.Clear();
+
+	return FALSE;
+}
+
+
+/****
+ * BenchAggregate
+ *
+ * DESC:
+ *     Checks NormalizeMessage on known messages. Then lays out an hour of
+ *     storm-shaped events made of the fixture events and writes them as
+ *     EpEventLog records one an event, then aggregated with each window
+ *     and table size: every flow within its window, the counts adding up
+ *     to the events, the table never over its size, and, where nothing
+ *     was evicted, the same flows as the plain reference aggregation.
+ *     Reports how many fewer records and bytes that is, and what it costs.
+ *     Then checks that a quiet log's flows are closed by the clock, and
+ *     reads the fixtures and copies of them through a cursor with flows, a little at
+ *     a time, against the reference
+ */
+int BenchAggregate(BENCH_OPTIONS *options)
+{
+	int result = 0;
+
+	for( size_t i = 0; i < sizeof(normalizedMessages) / sizeof(normalizedMessages[0]); i++ ) {
+		std::wstring normalized;
+
+		NormalizeMessage(normalizedMessages[i].message, &normalized);
+
+		if( normalized != normalizedMessages[i].normalized ) {
+			fprintf(report, "aggregate: FAILED, '%ls' normalized as '%ls', not '%ls'\n", normalizedMessages[i].message, normalized.c_str(), normalizedMessages[i].normalized);
+			result = 1;
+		}
+	}
+
+	std::vector<STORM_PROTO> protos;
+
+	if( !LoadStormProtos(options, &protos) ) {
+		fprintf(report, "aggregate: FAILED, no fixture events in %s\n", options->fixtures);
+		return 1;
+	}
+
+	std::vector<STORM_EVENT> storm;
+	DWORD64 shapeEvents[STORM_SHAPE_COUNT];
+
+	MakeStorm(protos, &storm, shapeEvents);
+
+	std::vector<std::wstring> keys;
+	std::vector<DWORD64> recordIds, times;
+
+	for( size_t i = 0; i < storm.size(); i++ ) {
+		const STORM_PROTO &proto = protos[storm[i].proto];
+
+		keys.push_back(FlowKey(proto.eventId, proto.channel, proto.provider, storm[i].message));
+		recordIds.push_back(i + 1);
+		times.push_back(storm[i].seconds);
+	}
+
+	fprintf(report, "aggregate: %llu events over %u s (one a second round the %u fixture events", (unsigned long long)storm.size(), STORM_SECONDS,
+		(DWORD)protos.size());
+	for( size_t k = 0; k < STORM_SHAPE_COUNT; k++ )
+		fprintf(report, ", %llu %s", (unsigned long long)shapeEvents[k], stormShapes[k].name);
+	fprintf(report, ")\n");
+
+	// Room for a record an event, each in a set of its own, with the times
+	// of a flow
+	std::vector<BYTE> sets;
+	std::vector<IPFIX_FIELDS> records;
+	std::vector<REFERENCE_FLOW> expected, got;
+	DWORD mostOpen = 0;
+	DWORD64 evicted = 0, unaggregatedBytes = 0;
+	size_t room = 0;
+
+	for( size_t i = 0; i < storm.size(); i++ )
+		room += IPFIX_SET_HEADER + IPFIX_RECORD_FIXED_BYTES + IPFIX_FLOW_TIMES_BYTES + 3 * IPFIX_LONG_LENGTH_BYTES + UTF8_MAX_GROWTH
+			* (protos[storm[i].proto].channel.size() + protos[storm[i].proto].provider.size() + storm[i].message.size());
+
+	sets.resize(room);
+
+	double unaggregated = AggregateStorm(protos, storm, 0, 0, &sets, &records, &mostOpen, &evicted);
+
+	unaggregatedBytes = sets.size();
+
+	if( unaggregated < 0 || records.size() != storm.size() ) {
+		fprintf(report, "aggregate: FAILED, %llu of %llu events written one a record\n", (unsigned long long)records.size(), (unsigned long long)storm.size());
+		return 1;
+	}
+
+	fprintf(report, "  one record an event          %7llu records %9llu bytes of sets;            %.3f s, %4.0f ns an event\n",
+		(unsigned long long)records.size(), (unsigned long long)unaggregatedBytes, unaggregated, unaggregated * 1e9 / storm.size());
+
+	for( size_t w = 0; w < sizeof(aggregateWindows) / sizeof(aggregateWindows[0]); w++ ) {
+		ReferenceFlows(keys, recordIds, times, aggregateWindows[w], &expected);
+
+		for( size_t t = 0; t < sizeof(aggregateTables) / sizeof(aggregateTables[0]); t++ ) {
+			sets.resize(room);
+
+			double seconds = AggregateStorm(protos, storm, aggregateWindows[w], aggregateTables[t], &sets, &records, &mostOpen, &evicted);
+			DWORD wrong = seconds < 0 ? 1 : CheckFlowRecords(records, aggregateWindows[w], storm.size());
+
+			FlowsOf(records, &got);
+
+			// Nothing evicted, so nothing closed but by the window
+			BOOL same = evicted > 0 || got.size() == expected.size();
+
+			for( size_t f = 0; same && evicted == 0 && f < got.size(); f++ )
+				same = !(got[f] != expected[f]);
+
+			fprintf(report, "  window %3u s, %4u flows     %7llu flows   %9llu bytes (%5.1fx fewer records, %5.1fx fewer bytes), most open %4u, evicted %6llu; %.3f s, %4.0f ns an event\n",
+				aggregateWindows[w], aggregateTables[t], (unsigned long long)records.size(), (unsigned long long)sets.size(),
+				records.size() > 0 ? (double)storm.size() / records.size() : 0.0, sets.size() > 0 ? (double)unaggregatedBytes / sets.size() : 0.0,
+				mostOpen, (unsigned long long)evicted, seconds, seconds * 1e9 / storm.size());
+
+			if( wrong > 0 || !same || mostOpen > aggregateTables[t] ) {
+				fprintf(report, "aggregate: FAILED, window %u s, %u flows: %u records wrong, %s the reference's %llu flows, most open %u\n",
+					aggregateWindows[w], aggregateTables[t], wrong, same ? "same as" : "not", (unsigned long long)expected.size(), mostOpen);
+				result = 1;
+			}
+		}
+	}
+
+	// A log gone quiet: its flows are closed by the clock alone, once the
+	// window has passed since the read that opened them
+	{
+		EventAggregator flows;
+		SYSTEM_FIELDS fields;
+		WCHAR recordText[24];
+		BOOL ok = TRUE;
+
+		flows.Configure(60, 16);
+		flows.Expire(1000);
+
+		StormFields(protos[storm[0].proto], storm[0], 1, &fields, recordText);
+		flows.Add(&fields, storm[0].message.c_str());
+		flows.Expire(1059);
+		ok = ok && flows.Open() == 1 && flows.Pending() == 0;
+
+		flows.Expire(1060);
+		ok = ok && flows.Open() == 0 && flows.Pending() == 1;
+
+		// Configuring again closes what is open
+		flows.Add(&fields, storm[0].message.c_str());
+		flows.Configure(60, 16);
+		ok = ok && flows.Open() == 0 && flows.Pending() == 2 && flows.Flows() == 2 && flows.Events() == 2;
+
+		if( !ok ) {
+			fprintf(report, "aggregate: FAILED, flows of a quiet log were not closed by the clock\n");
+			result = 1;
+		}
+	}
+
+	// The fixtures and --events copies of them read through a cursor,
+	// against the reference over the same events read as JSON. The copies
+	// keep their TimeCreated, so a day's window merges them all
+	FixtureSource fixture(1);
+
+	if( !LoadFixtures(&fixture, options, (DWORD)options->events) )
+		return 1;
+
+	keys.clear();
+	recordIds.clear();
+	times.clear();
+
+	{
+		EVENT_SESSION session(&fixture);
+		EventCursor cursor(&session);
+		COLLECTOR collector;
+		CallbackSink sink(CollectRecord, &collector);
+
+		collector.calls = 0;
+		collector.refuse = 0;
+
+		if( cursor.Start(NULL, NULL, DEBUG_NONE) ) {
+			while( cursor.Read(options->batch, &sink, OUTPUT_FORMAT_JSON, options->mode, DEBUG_NONE) > 0 )
+				;
+		}
+
+		session.publishers.Clear();
+
+		for( size_t r = 0; r < collector.records.size(); r++ ) {
+			std::map<std::wstring, std::wstring> json;
+
+			if( !ReadJsonRecord(collector.records[r], &json) )
+				continue;
+
+			keys.push_back(FlowKey(_wcstoui64(json[L"event_id"].c_str(), NULL, 10), json[L"logname"], json[L"source"], json[L"message"]));
+			recordIds.push_back(_wcstoui64(json[L"record_id"].c_str(), NULL, 10));
+			times.push_back(FileLineSeconds(json[L"time_created"]));
+		}
+	}
+
+	for( size_t c = 0; c < sizeof(aggregateCursorChecks) / sizeof(aggregateCursorChecks[0]); c++ ) {
+		DWORD window = aggregateCursorChecks[c].window;
+		DWORD table = aggregateCursorChecks[c].flows;
+		DWORD64 read = 0, calls = 0, grown = 0;
+		BOOL ok = ReadAggregated(&fixture, window, table, options, &records, &read, &calls, &grown);
+		DWORD wrong = CheckFlowRecords(records, window, keys.size());
+		std::map<std::wstring, DWORD64> expectedCounts, gotCounts;
+		std::map<DWORD64, size_t> byRecordId;
+
+		for( size_t i = 0; i < keys.size(); i++ ) {
+			expectedCounts[keys[i]]++;
+			byRecordId[recordIds[i]] = i;
+		}
+
+		// Every key's events are all there, whatever the flows
+		for( size_t r = 0; r < records.size(); r++ ) {
+			std::map<DWORD64, size_t>::iterator found = byRecordId.find(records[r].recordId);
+
+			if( found == byRecordId.end() )
+				wrong++;
+			else
+				gotCounts[keys[found->second]] += records[r].count;
+		}
+
+		BOOL same = gotCounts == expectedCounts;
+
+		// The window spans the whole corpus, so nothing is closed before
+		// the end and the flows are exactly the reference's
+		if( same && table >= expectedCounts.size() ) {
+			ReferenceFlows(keys, recordIds, times, window, &expected);
+			FlowsOf(records, &got);
+
+			same = got.size() == expected.size();
+
+			for( size_t f = 0; same && f < got.size(); f++ )
+				same = !(got[f] != expected[f]);
+		}
+
+		if( !ok || wrong > 0 || !same || read != keys.size() ) {
+			fprintf(report, "aggregate: FAILED, cursor with a window of %u s and %u flows read %llu of %llu events into %llu flows, %u wrong, %s\n",
+				window, table, (unsigned long long)read, (unsigned long long)keys.size(), (unsigned long long)records.size(), wrong,
+				same ? "counts add up" : "counts do not add up");
+			result = 1;
+		} else {
+			fprintf(report, "aggregate: cursor read %llu fixture events into %llu flows (window %u s, %u flows) in %llu calls, buffer grown %llu times\n",
+				(unsigned long long)read, (unsigned long long)records.size(), window, table, (unsigned long long)calls, (unsigned long long)grown);
+		}
+	}
+
+	return result;
+}
@@ -0,0 +1,704 @@
+#include <string.h>
+#include "Benchmark.h"
+#include "EventCursor.h"
+#include "SyntheticSource.h"
+#include "Utf8Encode.h"
+
+
+// Fields of a binary record the benchmark checks, on the values and the
+// XML path each
+static const PROJECTION binaryProjections[] = {
+	{ "all", NULL },
+	{ "no-message", L"record_id,event_id,logname,source,computer,time_created,task,level" },
+	{ "numbers", L"record_id,time_created,level" },
+};
+
+#define BINARY_PROJECTION_COUNT (sizeof(binaryProjections) / sizeof(binaryProjections[0]))
+
+// Bytes of the buffer the cursor check reads into, a few records at a time
+#define BINARY_CHECK_BUFFER 4096
+
+// Records the truncation check cuts up
+#define BINARY_CHECK_CUT_RECORDS 8
+
+// Times over the records that each decoder is timed, at least
+#define BINARY_DECODE_RECORDS 2000000
+
+
+/****
+ * BinaryMemorySink
+ *
+ * DESC:
+ *     Keeps binary records in memory, back to back, as BinaryBufferSink
+ *     would with a buffer that never fills
+ */
+class BinaryMemorySink : public OutputSink {
+public:
+	BinaryMemorySink(std::vector<BYTE> *bytes) : bytes(bytes) {}
+
+	BOOL Write(LPCWSTR /*record*/, DWORD /*length*/) { return FALSE; }
+
+	BOOL WriteBinary(const BYTE *record, DWORD bytes)
+	{
+		this->bytes->insert(this->bytes->end(), record, record + bytes);
+		records++;
+
+		return TRUE;
+	}
+
+private:
+	std::vector<BYTE> *bytes;
+};
+
+
+/****
+ * SameAsJson
+ *
+ * DESC:
+ *     Checks a binary record against the JSON record of the same event:
+ *     it has the fields the JSON one has a value for, with that value
+ *
+ * REMARKS:
+ *     A message JSON writes as "" may be one the event does not have
+ */
+static BOOL SameAsJson(const BINARY_RECORD *record, std::map<std::wstring, std::wstring> &json, DWORD projection)
+{
+	const BINARY_STRING *strings[] = { &record->channel, &record->provider, &record->computer, &record->message };
+	const DWORD stringFields[] = { RECORD_FIELD_LOGNAME, RECORD_FIELD_SOURCE, RECORD_FIELD_COMPUTER, RECORD_FIELD_MESSAGE };
+	const LPCWSTR stringNames[] = { L"logname", L"source", L"computer", L"message" };
+
+	if( record->fields & ~projection )
+		return FALSE;
+
+	struct {
+		DWORD field;
+		LPCWSTR name;
+		DWORD64 value;
+	} numbers[] = {
+		{ RECORD_FIELD_RECORD_ID, L"record_id", record->recordId },
+		{ RECORD_FIELD_EVENT_ID, L"event_id", record->eventId },
+		{ RECORD_FIELD_TASK, L"task", record->task },
+		{ RECORD_FIELD_LEVEL, L"level", record->level },
+		{ RECORD_FIELD_TIME_CREATED, L"time_created", record->timeCreated },
+	};
+
+	for( size_t i = 0; i < sizeof(numbers) / sizeof(numbers[0]); i++ )
+	{
+		if( !(projection & numbers[i].field) )
+			continue;
+
+		const std::wstring &text = json[numbers[i].name];
+		DWORD64 expected = 0;
+
+		if( text.empty() ) {
+			if( record->fields & numbers[i].field )
+				return FALSE;
+			continue;
+		}
+
+		if( numbers[i].field == RECORD_FIELD_TIME_CREATED ) {
+			if( !ParseSystemTime(text.c_str(), &expected) )
+				return FALSE;
+		} else {
+			expected = _wcstoui64(text.c_str(), NULL, 10);
+		}
+
+		if( !(record->fields & numbers[i].field) || numbers[i].value != expected )
+			return FALSE;
+	}
+
+	for( size_t i = 0; i < sizeof(strings) / sizeof(strings[0]); i++ )
+	{
+		if( !(projection & stringFields[i]) )
+			continue;
+
+		const std::wstring &text = json[stringNames[i]];
+		std::string expected(text.size() * UTF8_MAX_GROWTH, '\0');
+
+		expected.resize(WideToUtf8(text.c_str(), text.size(), &expected[0]));
+
+		if( !(record->fields & stringFields[i]) ) {
+			if( stringFields[i] != RECORD_FIELD_MESSAGE || !text.empty() )
+				return FALSE;
+			continue;
+		}
+
+		if( std::string(strings[i]->text, strings[i]->bytes) != expected )
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+
+/****
+ * CheckCuts
+ *
+ * DESC:
+ *     Reads the first records of a binary stream cut short at every byte,
+ *     and with each string count made too large. The reader must give
+ *     exactly the whole records before the cut, and fail at a part of one
+ *     rather than read past it
+ *
+ * RETURNS:
+ *     The number of cuts it got wrong
+ */
+static DWORD CheckCuts(const std::vector<BYTE> &bytes)
+{
+	std::vector<size_t> ends;
+	BinaryRecordReader whole(bytes.data(), bytes.size());
+	BINARY_RECORD record;
+	DWORD wrong = 0;
+
+	while( ends.size() < BINARY_CHECK_CUT_RECORDS && whole.Next(&record) )
+		ends.push_back(whole.Offset());
+
+	if( ends.empty() )
+		return 1;
+
+	for( size_t cut = 0; cut <= ends.back(); cut++ )
+	{
+		// A copy of just what is before the cut, so anything read past it shows
+		std::vector<BYTE> part(bytes.begin(), bytes.begin() + cut);
+		BinaryRecordReader reader(part.data(), part.size());
+		size_t count = 0, expected = 0;
+
+		while( expected < ends.size() && ends[expected] <= cut )
+			expected++;
+
+		while( reader.Next(&record) )
+			count++;
+
+		BOOL boundary = cut == 0 || (expected > 0 && ends[expected - 1] == cut);
+
+		if( count != expected || reader.Failed() == boundary )
+			wrong++;
+	}
+
+	// Each string count of the first record made far too large, and the
+	// last one a byte too large, so that it ends just past the record
+	std::vector<BYTE> first(bytes.begin(), bytes.begin() + ends[0]);
+	BinaryRecordReader reader(first.data(), first.size());
+
+	if( !reader.Next(&record) )
+		return wrong + 1;
+
+	const BINARY_STRING *strings[] = { &record.channel, &record.provider, &record.computer, &record.message };
+	const DWORD stringFields[] = { RECORD_FIELD_LOGNAME, RECORD_FIELD_SOURCE, RECORD_FIELD_COMPUTER, RECORD_FIELD_MESSAGE };
+	size_t last = 0;
+
+	for( size_t i = 0; i < sizeof(strings) / sizeof(strings[0]); i++ )
+	{
+		if( !(record.fields & stringFields[i]) )
+			continue;
+
+		std::vector<BYTE> broken(first);
+
+		last = (const BYTE *)strings[i]->text - first.data() - BINARY_STRING_LENGTH_BYTES;
+		broken[last + BINARY_STRING_LENGTH_BYTES - 1] = 0x7F;
+
+		BinaryRecordReader check(broken.data(), broken.size());
+		BINARY_RECORD ignored;
+
+		if( check.Next(&ignored) || !check.Failed() )
+			wrong++;
+	}
+
+	if( last > 0 && first[last] < 0xFF ) {
+		BINARY_RECORD ignored;
+
+		first[last]++;
+
+		BinaryRecordReader check(first.data(), first.size());
+
+		if( check.Next(&ignored) || !check.Failed() )
+			wrong++;
+	}
+
+	return wrong;
+}
+
+
+// What a decoder got out of the records, summed, so that the decoders can
+// be checked against each other and none of their work is optimized away.
+// strings counts the bytes of the string fields, as UTF-8
+struct DECODE_SUM {
+	DWORD64 records;
+	DWORD64 numbers;
+	DWORD64 strings;
+};
+
+// The numeric JSON keys, and the time among them
+static const struct {
+	const char *name;
+	size_t length;
+	BOOL time;
+} jsonNumbers[] = {
+	{ "record_id", 9, FALSE },
+	{ "event_id", 8, FALSE },
+	{ "time_created", 12, TRUE },
+	{ "task", 4, FALSE },
+	{ "level", 5, FALSE },
+};
+
+
+// Parses a SystemTime given as UTF-8, as ParseSystemTime does
+static BOOL TimeFromUtf8(const char *text, size_t length, DWORD64 *fileTime)
+{
+	WCHAR wide[40];
+
+	if( length >= sizeof(wide) / sizeof(wide[0]) )
+		return FALSE;
+
+	for( size_t i = 0; i < length; i++ )
+		wide[i] = (BYTE)text[i];
+
+	wide[length] = L'\0';
+
+	return ParseSystemTime(wide, fileTime);
+}
+
+
+// Adds up the value of one field, as a number or as string bytes
+static void SumField(DECODE_SUM *sum, const char *text, size_t length, INT number, BOOL time)
+{
+	DWORD64 value = 0;
+
+	if( number < 0 )
+		sum->strings += length;
+	else if( time )
+		sum->numbers += length > 0 && TimeFromUtf8(text, length, &value) ? value : 0;
+	else
+		sum->numbers += strtoull(text, NULL, 10);
+}
+
+
+/****
+ * DecodeJson
+ *
+ * DESC:
+ *     Decodes JSON records as ReadEventsToUtf8Buffer writes them (UTF-8,
+ *     each followed by a null character) the way a lean consumer would:
+ *     in one pass, unescaping each value into a reused buffer and turning
+ *     the numeric ones into numbers
+ *
+ * RETURNS:
+ *     FALSE at anything that is not a record of that shape
+ */
+static BOOL DecodeJson(const std::vector<char> &text, DECODE_SUM *sum)
+{
+	const char *at = text.data();
+	const char *end = at + text.size();
+	std::string value;
+
+	while( at < end )
+	{
+		if( *at++ != '{' )
+			return FALSE;
+
+		while( at < end && *at == '"' )
+		{
+			const char *key = ++at;
+
+			while( at < end && *at != '"' )
+				at++;
+
+			size_t keyLength = at - key;
+
+			if( end - at < 3 || at[1] != ':' || at[2] != '"' )
+				return FALSE;
+
+			at += 3;
+			value.clear();
+
+			while( at < end && *at != '"' )
+			{
+				const char *run = at;
+
+				while( at < end && *at != '"' && *at != '\\' )
+					at++;
+
+				value.append(run, at - run);
+
+				if( at < end && *at == '\\' )
+				{
+					if( end - at < 2 )
+						return FALSE;
+
+					switch( at[1] )
+					{
+					case 'b': value.push_back('\b'); break;
+					case 'f': value.push_back('\f'); break;
+					case 'n': value.push_back('\n'); break;
+					case 'r': value.push_back('\r'); break;
+					case 't': value.push_back('\t'); break;
+					case 'u':
+						// Only control characters are escaped this way
+						if( end - at < 6 )
+							return FALSE;
+						value.push_back((char)strtoul(std::string(at + 2, 4).c_str(), NULL, 16));
+						at += 4;
+						break;
+					default: value.push_back(at[1]); break;
+					}
+
+					at += 2;
+				}
+			}
+
+			if( at++ >= end )
+				return FALSE;
+
+			INT number = -1;
+
+			for( size_t i = 0; i < sizeof(jsonNumbers) / sizeof(jsonNumbers[0]); i++ ) {
+				if( jsonNumbers[i].length == keyLength && memcmp(jsonNumbers[i].name, key, keyLength) == 0 )
+					number = (INT)i;
+			}
+
+			SumField(sum, value.c_str(), value.size(), number, number >= 0 && jsonNumbers[number].time);
+
+			if( at < end && *at == ',' )
+				at++;
+		}
+
+		if( end - at < 2 || at[0] != '}' || at[1] != '\0' )
+			return FALSE;
+
+		at += 2;
+		sum->records++;
+	}
+
+	return TRUE;
+}
+
+
+/****
+ * DecodeCsv
+ *
+ * DESC:
+ *     Decodes '||' records (UTF-8, each followed by a null character) by
+ *     splitting each at its first eight separators; the message is the
+ *     rest of the line, "||" and all
+ */
+static BOOL DecodeCsv(const std::vector<char> &text, DECODE_SUM *sum)
+{
+	// The columns of CSV_HEADER, and the message after them
+	static const INT columns[] = { 0, 1, -1, -1, -1, 2, 3, 4, -1 };
+	const char *at = text.data();
+	const char *end = at + text.size();
+
+	while( at < end )
+	{
+		const char *line = at;
+		size_t lineLength = strlen(line);
+		const char *lineEnd = line + lineLength;
+
+		for( INT column = 0; column < 9; column++ )
+		{
+			const char *field = at;
+
+			if( column < 8 ) {
+				while( at + 1 < lineEnd && !(at[0] == '|' && at[1] == '|') )
+					at++;
+
+				if( at + 1 >= lineEnd )
+					return FALSE;
+			} else {
+				at = lineEnd > field && lineEnd[-1] == '\n' ? lineEnd - 1 : lineEnd;
+			}
+
+			INT number = columns[column];
+
+			SumField(sum, field, at - field, number, number >= 0 && jsonNumbers[number].time);
+			at += 2;
+		}
+
+		at = lineEnd + 1;
+		sum->records++;
+	}
+
+	return TRUE;
+}
+
+
+// Decodes binary records with BinaryRecordReader: nothing to parse or copy
+static BOOL DecodeBinary(const std::vector<BYTE> &bytes, DECODE_SUM *sum)
+{
+	BinaryRecordReader reader(bytes.data(), bytes.size());
+	BINARY_RECORD record;
+
+	while( reader.Next(&record) ) {
+		sum->numbers += record.recordId + record.eventId + record.timeCreated + record.task + record.level;
+		sum->strings += record.channel.bytes + record.provider.bytes + record.computer.bytes + record.message.bytes;
+		sum->records++;
+	}
+
+	return !reader.Failed() && reader.Offset() == bytes.size();
+}
+
+
+// Encodes records kept by a MemorySink as UTF-8, each followed by a null
+// character, which is what ReadEventsToUtf8Buffer hands over
+static void Utf8Records(const std::vector<WCHAR> &text, const std::vector<size_t> &ends, std::vector<char> *out)
+{
+	size_t begin = 0;
+
+	out->clear();
+
+	for( size_t i = 0; i < ends.size(); i++ ) {
+		size_t used = out->size();
+
+		out->resize(used + (ends[i] - begin) * UTF8_MAX_GROWTH + 1);
+		used += WideToUtf8(&text[begin], ends[i] - begin, &(*out)[used]);
+		(*out)[used++] = '\0';
+		out->resize(used);
+
+		begin = ends[i] + 1;
+	}
+}
+
+
+/****
+ * BenchBinary
+ *
+ * DESC:
+ *     Checks every binary record against the JSON record of the same
+ *     event, for several projections on the values and the XML path, the
+ *     reader on records cut short or with bad counts, and a cursor read
+ *     into a small buffer in binary. Then compares JSON, '||' and binary
+ *     records of the whole log: bytes written, time to write them, and
+ *     time to decode them
+ */
+int BenchBinary(BENCH_OPTIONS *options)
+{
+	int result = 0;
+	DWORD64 events = 0;
+	EventSource *source = OpenSource(options, &events);
+
+	if( source == NULL )
+		return 1;
+
+	EVENT_SESSION *sessions[BINARY_PROJECTION_COUNT][2];
+
+	for( size_t k = 0; k < BINARY_PROJECTION_COUNT; k++ ) {
+		for( int path = 0; path < 2; path++ ) {
+			sessions[k][path] = new EVENT_SESSION(source);
+			ParseRecordFields(binaryProjections[k].fields, &sessions[k][path]->projection);
+		}
+	}
+
+	COLLECTOR collector;
+	CallbackSink jsonSink(CollectRecord, &collector);
+	std::vector<BYTE> bytes, stream;
+	BinaryMemorySink binarySink(&bytes);
+	DWORD64 count = 0, mismatches = 0;
+
+	collector.calls = 0;
+	collector.refuse = 0;
+
+	EVT_HANDLE hResults = source->Query(NULL, NULL, EvtQueryChannelPath | EvtQueryReverseDirection);
+	EVT_HANDLE hEvents[BATCH_SIZE_MAX];
+	DWORD dwReturned;
+
+	while( source->Next(hResults, BATCH_SIZE_MAX, hEvents, INFINITE, &dwReturned) && dwReturned > 0 ) {
+		for( DWORD i = 0; i < dwReturned; i++, count++ ) {
+			for( size_t k = 0; k < BINARY_PROJECTION_COUNT; k++ ) {
+				for( int path = 0; path < 2; path++ ) {
+					EVENT_SESSION *session = sessions[k][path];
+					INT mode = path == 0 ? options->mode & ~MODE_RENDER_XML : options->mode | MODE_RENDER_XML;
+					std::map<std::wstring, std::wstring> json;
+					BINARY_RECORD record;
+
+					collector.records.clear();
+					bytes.clear();
+
+					DumpEventInfo(session, hEvents[i], &jsonSink, OUTPUT_FORMAT_JSON, mode, DEBUG_NONE);
+					DumpEventInfo(session, hEvents[i], &binarySink, OUTPUT_FORMAT_BINARY, mode, DEBUG_NONE);
+
+					BinaryRecordReader reader(bytes.data(), bytes.size());
+
+					BOOL ok = collector.records.size() == 1 && ReadJsonRecord(collector.records[0], &json)
+						&& reader.Next(&record) && reader.Offset() == bytes.size() && SameAsJson(&record, json, session->projection);
+
+					if( !ok && mismatches++ < 10 ) {
+						fprintf(report, "binary: MISMATCH on event %llu (record %ls), %s fields, %s path\n", (unsigned long long)count + 1,
+							json[L"record_id"].c_str(), binaryProjections[k].name, path == 0 ? "values" : "xml");
+					}
+
+					if( k == 0 && path == 0 && count < BINARY_CHECK_CUT_RECORDS )
+						stream.insert(stream.end(), bytes.begin(), bytes.end());
+				}
+			}
+
+			source->Close(hEvents[i]);
+		}
+	}
+	source->Close(hResults);
+
+	for( size_t k = 0; k < BINARY_PROJECTION_COUNT; k++ ) {
+		for( int path = 0; path < 2; path++ ) {
+			sessions[k][path]->publishers.Clear();
+			delete sessions[k][path];
+		}
+	}
+
+	fprintf(report, "binary: %llu events (%s), %u projections on the values and the xml path\n", (unsigned long long)count,
+		options->fixtures != NULL ? "fixtures" : "synthetic", (DWORD)BINARY_PROJECTION_COUNT);
+
+	if( mismatches > 0 || count != events ) {
+		fprintf(report, "binary: FAILED, %llu mismatches, %llu of %llu events read\n",
+			(unsigned long long)mismatches, (unsigned long long)count, (unsigned long long)events);
+		result = 1;
+	}
+
+	DWORD wrongCuts = CheckCuts(stream);
+
+	if( wrongCuts > 0 ) {
+		fprintf(report, "binary: FAILED, the reader got %u cut or broken records wrong\n", wrongCuts);
+		result = 1;
+	}
+
+	// A cursor read a little at a time, as ReadEventsToBinaryBuffer does,
+	// growing the buffer when not even one record fits
+	{
+		SyntheticSource synthetic(options->events);
+		EVENT_SESSION session(&synthetic);
+		EventCursor cursor(&session);
+		std::vector<BYTE> buffer(BINARY_CHECK_BUFFER / 16);
+		DWORD64 read = 0, expected = 1, calls = 0, grown = 0;
+		BOOL ok = cursor.Start(NULL, NULL, DEBUG_NONE);
+
+		while( ok )
+		{
+			BinaryBufferSink sink(buffer.data(), (DWORD)buffer.size());
+			DWORD records = cursor.Read(options->batch, &sink, OUTPUT_FORMAT_BINARY, options->mode, DEBUG_NONE);
+			BinaryRecordReader reader(buffer.data(), sink.Used());
+			BINARY_RECORD record;
+			DWORD decoded = 0;
+
+			calls++;
+
+			while( reader.Next(&record) ) {
+				ok = ok && record.recordId == expected++;
+				decoded++;
+			}
+
+			ok = ok && decoded == records && !reader.Failed();
+
+			if( cursor.Status() == ERROR_INSUFFICIENT_BUFFER ) {
+				ok = ok && sink.Required() > buffer.size();
+				buffer.resize(buffer.size() < BINARY_CHECK_BUFFER ? BINARY_CHECK_BUFFER : sink.Required());
+				grown++;
+			} else if( records == 0 ) {
+				break;
+			}
+
+			read += records;
+		}
+
+		session.publishers.Clear();
+
+		if( !ok || read != options->events ) {
+			fprintf(report, "binary: FAILED, cursor read %llu of %llu events in %llu calls\n",
+				(unsigned long long)read, (unsigned long long)options->events, (unsigned long long)calls);
+			result = 1;
+		} else {
+			fprintf(report, "binary: cursor read %llu events in %llu calls, buffer grown %llu times\n",
+				(unsigned long long)read, (unsigned long long)calls, (unsigned long long)grown);
+		}
+	}
+
+	// Every format of the whole log, kept in memory as a reader would get it
+	static const char *formatNames[] = { "json", "'||'", "binary" };
+	static const INT formats[] = { OUTPUT_FORMAT_JSON, 1, OUTPUT_FORMAT_BINARY };
+	std::vector<char> texts[2];
+	std::vector<BYTE> binary;
+	double writeSeconds[3];
+	size_t sizes[3];
+
+	for( int f = 0; f < 3; f++ )
+	{
+		EVENT_SESSION session(source);
+		std::vector<WCHAR> text;
+		std::vector<size_t> ends;
+		MemorySink textSink(&text, &ends);
+		BinaryMemorySink bytesSink(&binary);
+		OutputSink *sink = formats[f] == OUTPUT_FORMAT_BINARY ? (OutputSink *)&bytesSink : (OutputSink *)&textSink;
+		DWORD64 records = 0;
+
+		std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+
+		hResults = source->Query(NULL, NULL, EvtQueryChannelPath | EvtQueryReverseDirection);
+
+		while( source->Next(hResults, BATCH_SIZE_MAX, hEvents, INFINITE, &dwReturned) && dwReturned > 0 ) {
+			for( DWORD i = 0; i < dwReturned; i++ ) {
+				if( DumpEventInfo(&session, hEvents[i], sink, formats[f], options->mode, DEBUG_NONE) == ERROR_SUCCESS )
+					records++;
+
+				source->Close(hEvents[i]);
+			}
+		}
+		source->Close(hResults);
+
+		writeSeconds[f] = Seconds(started);
+		session.publishers.Clear();
+
+		if( formats[f] != OUTPUT_FORMAT_BINARY )
+			Utf8Records(text, ends, &texts[f]);
+
+		sizes[f] = formats[f] == OUTPUT_FORMAT_BINARY ? binary.size() : texts[f].size();
+
+		if( records != events ) {
+			fprintf(report, "binary: FAILED, %llu %s records written of %llu events\n", (unsigned long long)records, formatNames[f], (unsigned long long)events);
+			result = 1;
+		}
+	}
+
+	// Then each decoded over and over
+	DWORD passes = events > 0 && events < BINARY_DECODE_RECORDS ? (DWORD)(BINARY_DECODE_RECORDS / events) : 1;
+	DECODE_SUM sums[3];
+	double decodeSeconds[3];
+
+	for( int f = 0; f < 3; f++ )
+	{
+		std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+		BOOL ok = TRUE;
+
+		memset(&sums[f], 0, sizeof(DECODE_SUM));
+
+		for( DWORD pass = 0; ok && pass < passes; pass++ )
+			ok = f == 0 ? DecodeJson(texts[0], &sums[f]) : f == 1 ? DecodeCsv(texts[1], &sums[f]) : DecodeBinary(binary, &sums[f]);
+
+		decodeSeconds[f] = Seconds(started);
+
+		if( !ok || sums[f].records != events * passes ) {
+			fprintf(report, "binary: FAILED, %s decoded %llu records of %llu\n", formatNames[f],
+				(unsigned long long)sums[f].records, (unsigned long long)events * passes);
+			result = 1;
+		}
+	}
+
+	// Every decoder must have got the same numbers, and JSON and binary the
+	// same strings ('||' has a text of its own for a missing message)
+	if( sums[0].numbers != sums[2].numbers || sums[1].numbers != sums[2].numbers || sums[0].strings != sums[2].strings ) {
+		fprintf(report, "binary: FAILED, the decoders disagree (numbers %llu, %llu, %llu; strings %llu, %llu)\n",
+			(unsigned long long)sums[0].numbers, (unsigned long long)sums[1].numbers, (unsigned long long)sums[2].numbers,
+			(unsigned long long)sums[0].strings, (unsigned long long)sums[2].strings);
+		result = 1;
+	}
+
+	fprintf(report, "binary: %llu events, each format written once and decoded %u times\n", (unsigned long long)events, passes);
+
+	for( int f = 0; f < 3; f++ ) {
+		DWORD64 decoded = events * passes;
+
+		fprintf(report, "  %-7s %9llu bytes, %6.1f a record (%.2fx); written in %.3f s; decoded at %.0f records/s, %.1f ns a record (%.2fx the time)\n",
+			formatNames[f], (unsigned long long)sizes[f], events > 0 ? (double)sizes[f] / events : 0.0, sizes[0] > 0 ? (double)sizes[f] / sizes[0] : 0.0,
+			writeSeconds[f], decoded / decodeSeconds[f], decodeSeconds[f] * 1e9 / decoded, decodeSeconds[f] / decodeSeconds[0]);
+	}
+
+	delete source;
+
+	return result;
+}
@@ -0,0 +1,255 @@
+#include <set>
+#include "Benchmark.h"
+#include "EventCursor.h"
+#include "ShardedCatchUp.h"
+#include "LatencySource.h"
+
+
+// How many events BenchCatchUp adds to the fixtures for the checks (--events
+// are added for the timing). CATCHUP_CHECK_LATER more are written once each
+// check has caught up, to be read on to
+#define CATCHUP_CHECK_EVENTS 1200
+#define CATCHUP_CHECK_LATER 40
+
+// How each filter is caught up with: sessions, record IDs per shard,
+// records per Read (0 for the default) and how often the sink refuses one
+static const struct {
+	DWORD sessions;
+	DWORD shardRecords;
+	DWORD batch;
+	DWORD refuse;
+} catchUpChecks[] = {
+	{ 1, 1000, 0, 0 },
+	{ 2, 50, 100, 0 },
+	{ 4, 7, 37, 5 },
+	{ 8, 300, 1, 0 },
+	{ 3, 3, 500, 3 },
+};
+
+// Round trip costs, in ms, and session counts the catch-up is timed with
+static const DWORD catchUpLatencies[] = { 0, 2, 10 };
+static const DWORD catchUpSessions[] = { 1, 2, 4, 8 };
+
+#define CATCHUP_MOST_SESSIONS 8
+
+
+/****
+ * ReadCatchUp
+ *
+ * DESC:
+ *     Reads a catch-up until a call finds nothing new, batch records a call
+ *
+ * RETURNS:
+ *     TRUE if no call failed or wrote more than it was asked for
+ */
+static BOOL ReadCatchUp(ShardedCatchUp *catchUp, DWORD batch, OutputSink *sink, DWORD64 *records)
+{
+	DWORD written;
+
+	*records = 0;
+
+	do {
+		written = catchUp->Read(batch, sink, DEBUG_NONE);
+		*records += written;
+
+		if( written > (batch > 0 ? batch : CURSOR_BATCH_DEFAULT) )
+			return FALSE;
+
+		if( catchUp->Status() != ERROR_SUCCESS && catchUp->Status() != ERROR_MORE_DATA && catchUp->Status() != ERROR_INSUFFICIENT_BUFFER )
+			return FALSE;
+	} while( written > 0 || catchUp->Status() != ERROR_SUCCESS );
+
+	return TRUE;
+}
+
+
+/****
+ * BenchCatchUp
+ *
+ * DESC:
+ *     Checks that catching up with sharded reads over several sessions
+ *     writes exactly what one forward query reads, in the same order and
+ *     ending on the same record, for a set of filters, shard sizes and
+ *     session counts, and that it reads on to events written afterwards.
+ *     Then times catching up with --events new events over 1 to 8
+ *     sessions against one cursor reading --batch at a time, as
+ *     eventLogGrab does, at several round trip costs
+ *
+ * REMARKS:
+ *     Needs the fixtures, as only the fixture source applies the record
+ *     range; --fixtures defaults to "fixtures". Each session of the timing
+ *     has its own LatencySource, so round trips on different sessions
+ *     overlap as they would against a real host
+ */
+int BenchCatchUp(BENCH_OPTIONS *options)
+{
+	FixtureSource fixture(1);
+	std::vector<FILTER_EVENT> events;
+
+	DWORD64 first;
+
+	// The fixtures' own record IDs are millions apart, and every shard
+	// costs a query whether it holds records or not (a real log's record
+	// IDs have no gaps), so the checks start with the events added here
+	if( !LoadFixtures(&fixture, options, CATCHUP_CHECK_EVENTS, &first) )
+		return 1;
+
+	if( !ReadFilterEvents(&fixture, &events) )
+		return 1;
+
+	std::set<std::wstring> channels;
+
+	for( size_t i = 0; i < events.size(); i++ )
+		channels.insert(events[i].channel);
+
+	EVENT_SESSION *sessions[CATCHUP_MOST_SESSIONS];
+
+	for( DWORD i = 0; i < CATCHUP_MOST_SESSIONS; i++ )
+		sessions[i] = new EVENT_SESSION(&fixture);
+
+	DWORD state = 0xCA7C4095;
+	DWORD checks = 0, mismatches = 0;
+	DWORD64 shardsRead = 0;
+
+	for( DWORD k = 0; k < 12; k++ ) {
+		std::wstring spec = k < FIXED_FILTER_COUNT ? fixedFilters[k] : RandomFilter(&state, events);
+
+		for( std::set<std::wstring>::iterator channel = channels.begin(); channel != channels.end(); ++channel ) {
+			for( size_t c = 0; c < sizeof(catchUpChecks) / sizeof(catchUpChecks[0]); c++ ) {
+				BOOL readOn = c + 1 == sizeof(catchUpChecks) / sizeof(catchUpChecks[0]);
+				EventFilter filter;
+				COLLECTOR expected, caught;
+				CallbackSink expectedSink(CollectRecord, &expected);
+				CallbackSink caughtSink(CollectRecord, &caught);
+				DWORD64 expectedLast = 0, records = 0;
+
+				filter.Parse(spec.c_str());
+				filter.SetLowRecord(filter.LowRecord() > first ? filter.LowRecord() : first);
+				expected.calls = caught.calls = 0;
+				expected.refuse = 0;
+				caught.refuse = catchUpChecks[c].refuse;
+
+				ShardedCatchUp catchUp(sessions, catchUpChecks[c].sessions, catchUpChecks[c].shardRecords);
+
+				BOOL ok = catchUp.Start(channel->c_str(), &filter, OUTPUT_FORMAT_JSON, options->mode, DEBUG_NONE)
+					&& ReadCatchUp(&catchUp, catchUpChecks[c].batch, &caughtSink, &records);
+
+				// The last check has more written, and reads on to it
+				if( ok && readOn ) {
+					fixture.Append(CATCHUP_CHECK_LATER);
+					ok = ReadCatchUp(&catchUp, catchUpChecks[c].batch, &caughtSink, &records);
+				}
+
+				// What one query reads, oldest first
+				ParseEventSource(&fixture, channel->c_str(), NULL, OUTPUT_FORMAT_JSON, DEBUG_NONE, options->mode | MODE_FORWARD, &expectedSink, RECORD_FIELDS_ALL, &filter, &expectedLast);
+
+				checks++;
+				shardsRead += catchUp.Shards();
+
+				if( (!ok || caught.records != expected.records || catchUp.LastRecordId() != expectedLast) && mismatches++ < 10 ) {
+					fprintf(report, "catchup: MISMATCH on %ls with '%ls', %u sessions, %u records a shard%s: %llu records to %llu, %llu to %llu expected\n",
+						channel->c_str(), spec.c_str(), catchUpChecks[c].sessions, catchUpChecks[c].shardRecords, readOn ? ", reading on" : "",
+						(unsigned long long)caught.records.size(), (unsigned long long)catchUp.LastRecordId(),
+						(unsigned long long)expected.records.size(), (unsigned long long)expectedLast);
+				}
+			}
+		}
+	}
+
+	for( DWORD i = 0; i < CATCHUP_MOST_SESSIONS; i++ ) {
+		sessions[i]->publishers.Clear();
+		delete sessions[i];
+	}
+
+	fprintf(report, "catchup: %u catch-ups checked over %u events in %u logs, %llu shards read\n",
+		checks, (DWORD)events.size(), (DWORD)channels.size(), (unsigned long long)shardsRead);
+
+	if( mismatches > 0 ) {
+		fprintf(report, "catchup: FAILED, %u mismatches\n", mismatches);
+		return 1;
+	}
+
+	// Catching up with --events new events, through round trips
+	FixtureSource timed(1);
+	DWORD64 start;
+
+	LoadFixtures(&timed, options, (DWORD)options->events, &start);
+
+	WCHAR spec[32];
+	EventFilter filter;
+
+	swprintf(spec, sizeof(spec) / sizeof(spec[0]), L"records=%llu-", (unsigned long long)start);
+	filter.Parse(spec);
+
+	for( size_t l = 0; l < sizeof(catchUpLatencies) / sizeof(catchUpLatencies[0]); l++ ) {
+		DWORD nextMs = catchUpLatencies[l];
+
+		// One cursor, as eventLogGrab reads
+		LatencySource one(&timed, nextMs, options->perEventUs);
+		EVENT_SESSION session(&one);
+		EventCursor cursor(&session);
+		std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+
+		cursor.StartFiltered(CATCHUP_CHANNEL, &filter, DEBUG_NONE);
+
+		DWORD64 expected = ReadAll(&cursor, options->batch, options);
+		double cursorSeconds = Seconds(started);
+
+		cursor.Close();
+		session.publishers.Clear();
+
+		if( expected == (DWORD64)-1 || expected == 0 ) {
+			fprintf(report, "catchup: FAILED, reading %ls through one cursor\n", CATCHUP_CHANNEL);
+			return 1;
+		}
+
+		fprintf(report, "catchup: %llu %ls events behind, %u ms per round trip, %u us per event\n",
+			(unsigned long long)expected, CATCHUP_CHANNEL, nextMs, options->perEventUs);
+		fprintf(report, "  one cursor, %u a poll:  %.3f s in %llu queries\n",
+			options->batch, cursorSeconds, (unsigned long long)cursor.Queries());
+
+		for( size_t s = 0; s < sizeof(catchUpSessions) / sizeof(catchUpSessions[0]); s++ ) {
+			std::vector<LatencySource *> sources;
+			std::vector<EVENT_SESSION *> shardSessions;
+			StdoutSink sink;
+			DWORD64 records = 0;
+
+			for( DWORD i = 0; i < catchUpSessions[s]; i++ ) {
+				sources.push_back(new LatencySource(&timed, nextMs, options->perEventUs));
+				shardSessions.push_back(new EVENT_SESSION(sources.back()));
+			}
+
+			started = std::chrono::steady_clock::now();
+
+			ShardedCatchUp *catchUp = new ShardedCatchUp(&shardSessions[0], catchUpSessions[s]);
+
+			BOOL ok = catchUp->Start(CATCHUP_CHANNEL, &filter, options->outputFormat, options->mode, DEBUG_NONE)
+				&& ReadCatchUp(catchUp, options->batch, &sink, &records);
+
+			double seconds = Seconds(started);
+			DWORD64 queries = catchUp->Queries();
+			size_t held = catchUp->MostHeld();
+
+			delete catchUp;
+
+			for( DWORD i = 0; i < catchUpSessions[s]; i++ ) {
+				shardSessions[i]->publishers.Clear();
+				delete shardSessions[i];
+				delete sources[i];
+			}
+
+			if( !ok || records != expected ) {
+				fprintf(report, "catchup: FAILED, %llu records over %u sessions, %llu expected\n",
+					(unsigned long long)records, catchUpSessions[s], (unsigned long long)expected);
+				return 1;
+			}
+
+			// One session is not sharded (see CATCHUP_SESSIONS_SHARDED)
+			fprintf(report, "  %u session%s %.3f s in %llu queries, %.2fx, %llu records held at most\n",
+				catchUpSessions[s], catchUpSessions[s] >= CATCHUP_SESSIONS_SHARDED ? "s, sharded:" : ", unsharded:",
+				seconds, (unsigned long long)queries, cursorSeconds / seconds, (unsigned long long)held);
+		}
+	}
+
+	return 0;
+}
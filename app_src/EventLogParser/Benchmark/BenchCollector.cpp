@@ -0,0 +1,517 @@
+#include <set>
+#include <thread>
+#include "Benchmark.h"
+#include "EventCursor.h"
+#include "HostCollector.h"
+#include "LatencySource.h"
+
+
+// How many hosts BenchCollector checks, the events it adds to the fixtures
+// for the checks, and the events written once every host has caught up,
+// to be read on to. Rounds may take COLLECTOR_CHECK_ROUND_MS, and each
+// host COLLECTOR_CHECK_HOST_MS of one
+#define COLLECTOR_CHECK_HOSTS 24
+#define COLLECTOR_CHECK_EVENTS 1500
+#define COLLECTOR_CHECK_LATER 300
+#define COLLECTOR_CHECK_ROUND_MS 500
+#define COLLECTOR_CHECK_HOST_MS 100
+#define COLLECTOR_CHECK_ROUNDS 200
+
+// How late past its deadline a round may come back: a turn that started
+// before the deadline finishes its records first
+#define COLLECTOR_ROUND_SLACK_MS 400
+
+// Small hosts the fairness check reads alongside one with a big backlog,
+// and the records each small host is behind at most
+#define COLLECTOR_FAIR_HOSTS 15
+#define COLLECTOR_FAIR_RECENT 150
+
+// Worker counts the collector is timed with
+static const DWORD collectorWorkers[] = { 1, 4, 16, 64 };
+
+// How a mock host behaves. Its round trips cost nextMs, plus perEventUs
+// for every event fetched. Its first failConnects connects fail; each of
+// its sources fails every failEvery-th fetch (0 for never); its first
+// fetch hangs for hangMs
+struct MOCK_HOST {
+	DWORD nextMs;
+	DWORD perEventUs;
+	DWORD failConnects;
+	DWORD failEvery;
+	DWORD hangMs;
+	DWORD connects;
+	BOOL hung;
+};
+
+
+/****
+ * MockSource
+ *
+ * DESC:
+ *     A host's source for BenchCollector: the fixtures, with the round
+ *     trips, failures and hang its MOCK_HOST says
+ */
+class MockSource : public LatencySource {
+public:
+	MockSource(EventSource *inner, MOCK_HOST *host) : LatencySource(inner, host->nextMs, host->perEventUs), host(host), calls(0) {}
+
+	BOOL Next(EVT_HANDLE hResults, DWORD count, EVT_HANDLE *events, DWORD timeout, DWORD *returned)
+	{
+		if( host->hangMs > 0 && !host->hung ) {
+			host->hung = TRUE;
+			std::this_thread::sleep_for(std::chrono::milliseconds(host->hangMs));
+		}
+
+		if( host->failEvery > 0 && ++calls % host->failEvery == 0 ) {
+			SetLastError(RPC_S_SERVER_UNAVAILABLE);
+			return FALSE;
+		}
+
+		return LatencySource::Next(hResults, count, events, timeout, returned);
+	}
+
+private:
+	MOCK_HOST *host;
+	DWORD calls;
+};
+
+
+/****
+ * MockConnector
+ *
+ * DESC:
+ *     Connects BenchCollector's hosts to the fixtures. The context of each
+ *     host is its MOCK_HOST
+ */
+class MockConnector : public HostConnector {
+public:
+	MockConnector(EventSource *fixture) : fixture(fixture) {}
+
+	EventSource *Connect(LPCWSTR /*host*/, LPVOID context)
+	{
+		MOCK_HOST *mock = (MOCK_HOST *)context;
+
+		if( ++mock->connects <= mock->failConnects ) {
+			SetLastError(RPC_S_SERVER_UNAVAILABLE);
+			return NULL;
+		}
+
+		return new MockSource(fixture, mock);
+	}
+
+	void Disconnect(EventSource *source)
+	{
+		delete source;
+	}
+
+private:
+	EventSource *fixture;
+};
+
+
+/****
+ * SplitFrames
+ *
+ * DESC:
+ *     Files what a collector wrote by host and channel, checking each
+ *     record is framed as "host TAB channel TAB record"
+ *
+ * RETURNS:
+ *     TRUE if every record was
+ */
+static BOOL SplitFrames(const std::vector<std::wstring> &frames, std::map<std::wstring, std::vector<std::wstring> > *byChannel)
+{
+	for( size_t i = 0; i < frames.size(); i++ ) {
+		size_t host = frames[i].find(COLLECTOR_SEPARATOR);
+		size_t channel = host != std::wstring::npos ? frames[i].find(COLLECTOR_SEPARATOR, host + 1) : std::wstring::npos;
+
+		if( channel == std::wstring::npos || frames[i].compare(channel + 1, 2, L"{\"") != 0 )
+			return FALSE;
+
+		(*byChannel)[frames[i].substr(0, channel)].push_back(frames[i].substr(channel + 1));
+	}
+
+	return TRUE;
+}
+
+
+/****
+ * BenchCollector
+ *
+ * DESC:
+ *     Checks that a collector reading many mock hosts writes, for each
+ *     host and channel, exactly what one forward query reads, tagged with
+ *     both, through hosts that fail to connect, fail part way through
+ *     reads, hang past the round's deadline, are slow, or are never up,
+ *     and that it reads on to events written afterwards. Checks rounds
+ *     end on time, and that a host with a big backlog does not keep the
+ *     others waiting. Then times --hosts hosts read one after another, as
+ *     one poll thread does, against the collector on 1 to 64 workers
+ *
+ * REMARKS:
+ *     Needs the fixtures, as only the fixture source applies queries;
+ *     --fixtures defaults to "fixtures". Every host reads the same
+ *     fixtures, each through sources of its own
+ */
+/****
+ * CountChannel
+ *
+ * DESC:
+ *     Counts the events a source has in a channel
+ */
+static DWORD CountChannel(EventSource *source, LPCWSTR channel)
+{
+	EVT_HANDLE hEvents[BATCH_SIZE_MAX];
+	DWORD dwReturned;
+	DWORD count = 0;
+
+	EVT_HANDLE hResults = source->Query(channel, NULL, EvtQueryChannelPath | EvtQueryForwardDirection);
+
+	if( hResults == NULL )
+		return 0;
+
+	while( source->Next(hResults, BATCH_SIZE_MAX, hEvents, INFINITE, &dwReturned) && dwReturned > 0 ) {
+		for( DWORD i = 0; i < dwReturned; i++ )
+			source->Close(hEvents[i]);
+
+		count += dwReturned;
+	}
+	source->Close(hResults);
+
+	return count;
+}
+
+
+int BenchCollector(BENCH_OPTIONS *options)
+{
+	FixtureSource fixture(1);
+	std::vector<FILTER_EVENT> events;
+
+	if( !LoadFixtures(&fixture, options, COLLECTOR_CHECK_EVENTS) )
+		return 1;
+
+	if( !ReadFilterEvents(&fixture, &events) )
+		return 1;
+
+	std::set<std::wstring> channels;
+
+	for( size_t i = 0; i < events.size(); i++ )
+		channels.insert(events[i].channel);
+
+	// Every sixth host has the same trouble. The last is never up
+	MOCK_HOST mocks[COLLECTOR_CHECK_HOSTS];
+	std::vector<std::wstring> names;
+	std::vector<std::wstring> specs;
+	MockConnector connector(&fixture);
+	HostCollector collector(&connector, 6, 50, COLLECTOR_CHECK_HOST_MS);
+
+	collector.SetMode(options->mode);
+
+	for( DWORD h = 0; h < COLLECTOR_CHECK_HOSTS; h++ ) {
+		WCHAR name[32];
+		MOCK_HOST mock = { h % 3, 0, 0, 0, 0, 0, FALSE };
+
+		switch( h % 6 ) {
+		case 1: mock.failConnects = 2; break;
+		case 2: mock.failEvery = 3; break;
+		case 3: mock.nextMs = 5; break;
+		case 4: mock.hangMs = COLLECTOR_CHECK_ROUND_MS * 3; break;
+		}
+
+		if( h + 1 == COLLECTOR_CHECK_HOSTS )
+			mock.failConnects = (DWORD)-1;
+
+		mocks[h] = mock;
+		swprintf(name, sizeof(name) / sizeof(name[0]), L"host%02u.example", h);
+		names.push_back(name);
+		specs.push_back(fixedFilters[h % FIXED_FILTER_COUNT]);
+
+		DWORD index = collector.AddHost(name, &mocks[h]);
+
+		for( std::set<std::wstring>::iterator channel = channels.begin(); channel != channels.end(); ++channel ) {
+			EventFilter filter;
+
+			filter.Parse(specs[h].c_str());
+			collector.AddChannel(index, channel->c_str(), &filter);
+		}
+	}
+
+	COLLECTOR collected;
+	CallbackSink sink(CollectRecord, &collected);
+	DWORD64 written = 0;
+	DWORD rounds = 0, timeouts = 0, refusals = 0;
+	double slowest = 0;
+	BOOL readOn = FALSE;
+	BOOL ok = TRUE;
+
+	collected.calls = 0;
+	collected.refuse = 0;
+
+	// The records expected of each live host, and how many there are once
+	// the later events are written
+	DWORD64 expectedTotal = 0;
+
+	while( ok && rounds < COLLECTOR_CHECK_ROUNDS )
+	{
+		std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+
+		written += collector.Collect(COLLECTOR_CHECK_ROUND_MS, &sink, DEBUG_NONE);
+		rounds++;
+
+		double seconds = Seconds(started);
+
+		slowest = seconds > slowest ? seconds : slowest;
+		timeouts += collector.Status() == ERROR_TIMEOUT;
+		refusals += collector.Status() == ERROR_MORE_DATA || collector.Status() == ERROR_INSUFFICIENT_BUFFER;
+
+		if( collector.Status() != ERROR_SUCCESS && collector.Status() != ERROR_TIMEOUT && collector.Status() != ERROR_MORE_DATA && collector.Status() != ERROR_INSUFFICIENT_BUFFER )
+			ok = FALSE;
+
+		if( written != collected.records.size() )
+			ok = FALSE;
+
+		if( expectedTotal == 0 ) {
+			for( DWORD h = 0; h + 1 < COLLECTOR_CHECK_HOSTS; h++ ) {
+				for( std::set<std::wstring>::iterator channel = channels.begin(); channel != channels.end(); ++channel ) {
+					EventFilter filter;
+					COLLECTOR expected;
+					CallbackSink expectedSink(CollectRecord, &expected);
+
+					expected.calls = expected.refuse = 0;
+					filter.Parse(specs[h].c_str());
+					ParseEventSource(&fixture, channel->c_str(), NULL, OUTPUT_FORMAT_JSON, DEBUG_NONE, options->mode | MODE_FORWARD, &expectedSink, RECORD_FIELDS_ALL, &filter);
+					expectedTotal += expected.records.size();
+				}
+			}
+		}
+
+		if( written < expectedTotal )
+			continue;
+
+		if( readOn || written > expectedTotal )
+			break;
+
+		// Every live host has caught up: write more, and read on to it
+		// through a sink that refuses some records
+		fixture.Append(COLLECTOR_CHECK_LATER);
+		expectedTotal = 0;
+		collected.refuse = 97;
+		readOn = TRUE;
+	}
+
+	// What each host and channel should have, in order
+	std::map<std::wstring, std::vector<std::wstring> > byChannel;
+	DWORD mismatches = 0;
+
+	if( !SplitFrames(collected.records, &byChannel) ) {
+		fprintf(report, "collector: FAILED, a record was not framed as host, channel and record\n");
+		return 1;
+	}
+
+	for( DWORD h = 0; h < COLLECTOR_CHECK_HOSTS; h++ ) {
+		DWORD c = 0;
+
+		for( std::set<std::wstring>::iterator channel = channels.begin(); channel != channels.end(); ++channel, c++ ) {
+			EventFilter filter;
+			COLLECTOR expected;
+			CallbackSink expectedSink(CollectRecord, &expected);
+			DWORD64 expectedLast = 0, lastRecordId = 0;
+			std::vector<std::wstring> &got = byChannel[names[h] + COLLECTOR_SEPARATOR + *channel];
+
+			expected.calls = expected.refuse = 0;
+			filter.Parse(specs[h].c_str());
+
+			if( h + 1 < COLLECTOR_CHECK_HOSTS )
+				ParseEventSource(&fixture, channel->c_str(), NULL, OUTPUT_FORMAT_JSON, DEBUG_NONE, options->mode | MODE_FORWARD, &expectedSink, RECORD_FIELDS_ALL, &filter, &expectedLast);
+
+			collector.GetLastRecordId(h, c, &lastRecordId);
+
+			if( (got != expected.records || lastRecordId != expectedLast) && mismatches++ < 10 ) {
+				fprintf(report, "collector: MISMATCH on %ls %ls with '%ls': %llu records to %llu, %llu to %llu expected\n",
+					names[h].c_str(), channel->c_str(), specs[h].c_str(), (unsigned long long)got.size(), (unsigned long long)lastRecordId,
+					(unsigned long long)expected.records.size(), (unsigned long long)expectedLast);
+			}
+		}
+	}
+
+	HOST_STATUS dead;
+
+	collector.GetHostStatus(COLLECTOR_CHECK_HOSTS - 1, &dead);
+
+	fprintf(report, "collector: %u hosts, %u logs each, %llu records in %u rounds (%u cut short by the deadline, %u by the sink), slowest round %.3f s\n",
+		COLLECTOR_CHECK_HOSTS, (DWORD)channels.size(), (unsigned long long)written, rounds, timeouts, refusals, slowest);
+	fprintf(report, "  host that is never up: %u failures, status %u\n", dead.failures, dead.status);
+
+	if( !ok || mismatches > 0 || rounds == COLLECTOR_CHECK_ROUNDS ) {
+		fprintf(report, "collector: FAILED, %u mismatches%s%s\n", mismatches, ok ? "" : ", a round failed", rounds == COLLECTOR_CHECK_ROUNDS ? ", never caught up" : "");
+		return 1;
+	}
+
+	if( slowest * 1000 > COLLECTOR_CHECK_ROUND_MS + COLLECTOR_ROUND_SLACK_MS || timeouts == 0 ) {
+		fprintf(report, "collector: FAILED, rounds are to end at %u ms, not wait for hosts that hang\n", COLLECTOR_CHECK_ROUND_MS);
+		return 1;
+	}
+
+	if( dead.failures < 2 || dead.status != RPC_S_SERVER_UNAVAILABLE ) {
+		fprintf(report, "collector: FAILED, the host that is never up is not reported as failing\n");
+		return 1;
+	}
+
+	// Fairness: one host with a big backlog and many small ones, on fewer
+	// workers than hosts. The small ones should be done long before it is.
+	// This is counted in turns, as a turn reads --batch records: each
+	// small host needs at most smallTurns, and takes them turn about with
+	// the big host, so they should all be done within a turn or two more
+	// of it. Its backlog is made twice that, whatever --events says
+	{
+		FixtureSource fair(1);
+
+		LoadFixtures(&fair, options, 0);
+
+		DWORD batch = options->batch > 0 ? (DWORD)options->batch : COLLECTOR_BATCH_DEFAULT;
+		DWORD smallTurns = (COLLECTOR_FAIR_RECENT + batch - 1) / batch;
+		DWORD allowedTurns = smallTurns + 2;
+		DWORD before = CountChannel(&fair, CATCHUP_CHANNEL);
+		DWORD64 start = fair.Append(0) + 1;
+		DWORD64 newest = fair.Append((DWORD)options->events);
+
+		while( CountChannel(&fair, CATCHUP_CHANNEL) - before < allowedTurns * 2 * batch )
+			newest = fair.Append(options->events > 0 ? (DWORD)options->events : batch);
+
+		WCHAR spec[32];
+		EventFilter all, recent;
+
+		swprintf(spec, sizeof(spec) / sizeof(spec[0]), L"records=%llu-", (unsigned long long)start);
+		all.Parse(spec);
+		swprintf(spec, sizeof(spec) / sizeof(spec[0]), L"records=%llu-",
+			(unsigned long long)(newest > COLLECTOR_FAIR_RECENT ? newest - COLLECTOR_FAIR_RECENT : 1));
+		recent.Parse(spec);
+
+		MOCK_HOST fairMocks[COLLECTOR_FAIR_HOSTS + 1];
+		MockConnector fairConnector(&fair);
+		HostCollector fairCollector(&fairConnector, 2, options->batch);
+		COLLECTOR frames;
+		CallbackSink frameSink(CollectRecord, &frames);
+
+		frames.calls = frames.refuse = 0;
+
+		for( DWORD h = 0; h <= COLLECTOR_FAIR_HOSTS; h++ ) {
+			MOCK_HOST mock = { options->nextMs, options->perEventUs, 0, 0, 0, 0, FALSE };
+
+			fairMocks[h] = mock;
+			fairCollector.AddHost(h == 0 ? L"big" : L"small", &fairMocks[h]);
+			fairCollector.AddChannel(h, CATCHUP_CHANNEL, h == 0 ? &all : &recent);
+		}
+
+		fairCollector.Collect(0, &frameSink, DEBUG_NONE);
+
+		size_t big = 0, bigBefore = 0;
+
+		for( size_t i = 0; i < frames.records.size(); i++ ) {
+			if( frames.records[i].compare(0, 4, L"big\t") == 0 )
+				big++;
+			else
+				bigBefore = big;
+		}
+
+		size_t bigTurnsBefore = (bigBefore + batch - 1) / batch;
+		size_t bigTurns = (big + batch - 1) / batch;
+
+		fprintf(report, "  fairness: %u small hosts done after %llu of the big host's %llu turns (%llu of %llu records), on 2 workers\n",
+			COLLECTOR_FAIR_HOSTS, (unsigned long long)bigTurnsBefore, (unsigned long long)bigTurns,
+			(unsigned long long)bigBefore, (unsigned long long)big);
+
+		if( big == 0 || bigTurnsBefore > allowedTurns ) {
+			fprintf(report, "collector: FAILED, the small hosts waited for the big one\n");
+			return 1;
+		}
+	}
+
+	// --hosts hosts, each --events behind, read one after another as one
+	// poll thread does, then by the collector
+	FixtureSource timed(1);
+	DWORD64 start;
+
+	LoadFixtures(&timed, options, (DWORD)options->events, &start);
+
+	WCHAR spec[32];
+	EventFilter filter;
+
+	swprintf(spec, sizeof(spec) / sizeof(spec[0]), L"records=%llu-", (unsigned long long)start);
+	filter.Parse(spec);
+
+	std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+	DWORD64 expected = 0;
+
+	for( DWORD h = 0; h < options->hosts; h++ ) {
+		LatencySource one(&timed, options->nextMs, options->perEventUs);
+		EVENT_SESSION session(&one);
+		EventCursor cursor(&session);
+
+		cursor.StartFiltered(CATCHUP_CHANNEL, &filter, DEBUG_NONE);
+
+		DWORD64 read = ReadAll(&cursor, options->batch, options);
+
+		cursor.Close();
+		session.publishers.Clear();
+
+		if( read == (DWORD64)-1 ) {
+			fprintf(report, "collector: FAILED, reading %ls of host %u\n", CATCHUP_CHANNEL, h);
+			return 1;
+		}
+
+		expected += read;
+	}
+
+	double sequentialSeconds = Seconds(started);
+
+	fprintf(report, "collector: %u hosts, %llu %ls events in all, %u ms per round trip, %u us per event\n",
+		options->hosts, (unsigned long long)expected, CATCHUP_CHANNEL, options->nextMs, options->perEventUs);
+	fprintf(report, "  one host at a time:  %.3f s\n", sequentialSeconds);
+
+	for( size_t w = 0; w < sizeof(collectorWorkers) / sizeof(collectorWorkers[0]); w++ ) {
+		std::vector<MOCK_HOST> timedMocks(options->hosts);
+		MockConnector timedConnector(&timed);
+		StdoutSink out;
+		DWORD64 records = 0;
+
+		for( DWORD h = 0; h < options->hosts; h++ ) {
+			MOCK_HOST mock = { options->nextMs, options->perEventUs, 0, 0, 0, 0, FALSE };
+
+			timedMocks[h] = mock;
+		}
+
+		started = std::chrono::steady_clock::now();
+
+		{
+			HostCollector timedCollector(&timedConnector, collectorWorkers[w], options->batch, INFINITE);
+
+			timedCollector.SetMode(options->mode);
+
+			for( DWORD h = 0; h < options->hosts; h++ ) {
+				WCHAR name[32];
+
+				swprintf(name, sizeof(name) / sizeof(name[0]), L"host%u", h);
+				timedCollector.AddChannel(timedCollector.AddHost(name, &timedMocks[h]), CATCHUP_CHANNEL, &filter);
+			}
+
+			records = timedCollector.Collect(0, &out, DEBUG_NONE);
+
+			if( timedCollector.Status() != ERROR_SUCCESS )
+				records = 0;
+		}
+
+		double seconds = Seconds(started);
+
+		if( records != expected ) {
+			fprintf(report, "collector: FAILED, %llu records on %u workers, %llu expected\n",
+				(unsigned long long)records, collectorWorkers[w], (unsigned long long)expected);
+			return 1;
+		}
+
+		fprintf(report, "  %2u worker%s:%s %.3f s, %.2fx\n",
+			collectorWorkers[w], collectorWorkers[w] > 1 ? "s" : "", collectorWorkers[w] > 1 ? "" : " ", seconds, sequentialSeconds / seconds);
+	}
+
+	return 0;
+}
@@ -0,0 +1,330 @@
+#include <map>
+#include <string>
+#include <stdio.h>
+#include <wchar.h>
+#include "Benchmark.h"
+#include "SyntheticSource.h"
+
+
+FILE *report = NULL;
+
+#if defined(ALLOCATION_COUNTING)
+
+/****
+ * Allocation counting
+ *
+ * DESC:
+ *     The benchmark replaces malloc and friends with wrappers around the
+ *     glibc implementations that count calls while "counting" is set.
+ *     operator new and the C++ containers end up here as well. Left out
+ *     of sanitizer builds
+ */
+extern "C" void *__libc_malloc(size_t);
+extern "C" void *__libc_calloc(size_t, size_t);
+extern "C" void *__libc_realloc(void *, size_t);
+extern "C" void __libc_free(void *);
+
+std::atomic<bool> counting(false);
+std::atomic<unsigned long long> allocations(0);
+
+extern "C" void *malloc(size_t size)
+{
+	if( counting.load(std::memory_order_relaxed) )
+		allocations++;
+	return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t count, size_t size)
+{
+	if( counting.load(std::memory_order_relaxed) )
+		allocations++;
+	return __libc_calloc(count, size);
+}
+
+extern "C" void *realloc(void *data, size_t size)
+{
+	if( counting.load(std::memory_order_relaxed) )
+		allocations++;
+	return __libc_realloc(data, size);
+}
+
+extern "C" void free(void *data)
+{
+	__libc_free(data);
+}
+
+#endif
+
+
+double Seconds(std::chrono::steady_clock::time_point started)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+}
+
+
+/****
+ * OpenSource
+ *
+ * DESC:
+ *     Builds the event source the options ask for: the fixture corpus if
+ *     one was given, the synthetic generator otherwise
+ *
+ * ARGS:
+ *     options - benchmark options
+ *     fixture - receives the fixture source, if that is what was built
+ *     events - receives the number of events one query returns
+ *
+ * RETURNS:
+ *     The source (delete when done), or NULL if the fixtures would not load
+ */
+EventSource *OpenSource(BENCH_OPTIONS *options, DWORD64 *events)
+{
+	if( options->fixtures == NULL ) {
+		*events = options->events;
+		return new SyntheticSource(options->events);
+	}
+
+	FixtureSource *fixture = new FixtureSource(options->repeat);
+
+	if( !fixture->Load(options->fixtures) ) {
+		delete fixture;
+		return NULL;
+	}
+
+	*events = (DWORD64)fixture->Count() * options->repeat;
+
+	return fixture;
+}
+
+
+/****
+ * LoadFixtures
+ *
+ * DESC:
+ *     Loads the --fixtures corpus into a fixture source and appends copies
+ *     of its events, the setup most checks start with
+ *
+ * ARGS:
+ *     fixture - the source to load
+ *     options - benchmark options
+ *     copies - events to append after the corpus
+ *     first - receives the record ID of the first appended event, if given
+ *
+ * RETURNS:
+ *     FALSE if the fixtures would not load
+ */
+BOOL LoadFixtures(FixtureSource *fixture, BENCH_OPTIONS *options, DWORD copies, DWORD64 *first)
+{
+	if( !fixture->Load(options->fixtures) )
+		return FALSE;
+
+	if( first != NULL )
+		*first = fixture->Append(0) + 1;
+
+	if( copies > 0 )
+		fixture->Append(copies);
+
+	return TRUE;
+}
+
+
+// A child's value, or its attribute's, or "" if there is none
+LPCWSTR ChildValue(rapidxml::xml_node<WCHAR> *node, LPCWSTR name)
+{
+	rapidxml::xml_node<WCHAR> *child = node->first_node(name);
+
+	return child != NULL ? child->value() : L"";
+}
+
+
+LPCWSTR ChildAttribute(rapidxml::xml_node<WCHAR> *node, LPCWSTR name, LPCWSTR attributeName)
+{
+	rapidxml::xml_node<WCHAR> *child = node->first_node(name);
+	rapidxml::xml_attribute<WCHAR> *attribute = child != NULL ? child->first_attribute(attributeName) : NULL;
+
+	return attribute != NULL ? attribute->value() : L"";
+}
+
+
+/****
+ * NextRandom
+ *
+ * DESC:
+ *     xorshift32; the escape fuzz must give the same cases on every run
+ */
+DWORD NextRandom(DWORD *state)
+{
+	DWORD x = *state;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+
+	return *state = x;
+}
+
+
+/****
+ * ReadJsonString
+ *
+ * DESC:
+ *     Decodes the JSON string starting at text[*at] (on its opening quote)
+ *
+ * RETURNS:
+ *     FALSE if it is not a valid JSON string: an unescaped control
+ *     character, an unknown escape, or no closing quote
+ */
+BOOL ReadJsonString(const std::wstring &text, size_t *at, std::wstring *value)
+{
+	size_t i = *at;
+
+	value->clear();
+
+	if( i >= text.size() || text[i++] != L'"' )
+		return FALSE;
+
+	while( i < text.size() )
+	{
+		WCHAR c = text[i++];
+
+		if( c == L'"' ) {
+			*at = i;
+			return TRUE;
+		}
+
+		if( (DWORD)c < 0x20 )
+			return FALSE;
+
+		if( c != L'\\' ) {
+			value->push_back(c);
+			continue;
+		}
+
+		if( i >= text.size() )
+			return FALSE;
+
+		switch( text[i++] )
+		{
+		case L'"': value->push_back(L'"'); break;
+		case L'\\': value->push_back(L'\\'); break;
+		case L'/': value->push_back(L'/'); break;
+		case L'b': value->push_back(L'\b'); break;
+		case L'f': value->push_back(L'\f'); break;
+		case L'n': value->push_back(L'\n'); break;
+		case L'r': value->push_back(L'\r'); break;
+		case L't': value->push_back(L'\t'); break;
+		case L'u':
+			{
+				if( i + 4 > text.size() )
+					return FALSE;
+
+				std::wstring hex = text.substr(i, 4);
+				wchar_t *end = NULL;
+
+				value->push_back((WCHAR)wcstoul(hex.c_str(), &end, 16));
+				if( end != hex.c_str() + 4 )
+					return FALSE;
+
+				i += 4;
+				break;
+			}
+		default:
+			return FALSE;
+		}
+	}
+
+	return FALSE;
+}
+
+
+/****
+ * ReadJsonObject
+ *
+ * DESC:
+ *     Parses a JSON object whose values are strings, or objects of them.
+ *     Members of a nested object are keyed "outer/inner"
+ *
+ * RETURNS:
+ *     FALSE if the text at "at" is not valid JSON of that shape
+ */
+static BOOL ReadJsonObject(const std::wstring &text, size_t *at, const std::wstring &prefix, std::map<std::wstring, std::wstring> *values)
+{
+	size_t i = *at;
+
+	if( i >= text.size() || text[i++] != L'{' )
+		return FALSE;
+
+	if( i < text.size() && text[i] == L'}' ) {
+		*at = i + 1;
+		return TRUE;
+	}
+
+	while( TRUE )
+	{
+		std::wstring key, value;
+
+		if( !ReadJsonString(text, &i, &key) || i >= text.size() || text[i++] != L':' )
+			return FALSE;
+
+		if( i < text.size() && text[i] == L'{' ) {
+			if( !ReadJsonObject(text, &i, prefix + key + L"/", values) )
+				return FALSE;
+		} else {
+			if( !ReadJsonString(text, &i, &value) )
+				return FALSE;
+
+			(*values)[prefix + key] = value;
+		}
+
+		if( i >= text.size() )
+			return FALSE;
+
+		if( text[i] == L'}' ) {
+			*at = i + 1;
+			return TRUE;
+		}
+
+		if( text[i++] != L',' )
+			return FALSE;
+	}
+}
+
+
+/****
+ * ReadJsonRecord
+ *
+ * DESC:
+ *     Parses a JSON output record, an object whose values are all strings
+ *     but for "event_data" (see ReadJsonObject)
+ *
+ * RETURNS:
+ *     FALSE if the record is not valid JSON of that shape
+ */
+BOOL ReadJsonRecord(const std::wstring &record, std::map<std::wstring, std::wstring> *values)
+{
+	size_t at = 0;
+
+	values->clear();
+
+	return ReadJsonObject(record, &at, L"", values) && at == record.size();
+}
+
+
+/****
+ * CollectRecord
+ *
+ * DESC:
+ *     Record callback for the callback sink. Keeps every record, and
+ *     refuses every "refuse"th call to exercise the resume path
+ */
+BOOL __stdcall CollectRecord(LPCWSTR record, DWORD length, LPVOID context)
+{
+	COLLECTOR *collector = (COLLECTOR *)context;
+
+	if( collector->refuse > 0 && ++collector->calls % collector->refuse == 0 )
+		return FALSE;
+
+	collector->records.push_back(std::wstring(record, length));
+
+	return TRUE;
+}
@@ -0,0 +1,295 @@
+#include <string.h>
+#include "Benchmark.h"
+
+
+static BOOL IsJsonSpecial(WCHAR c)
+{
+	return c == L'"' || c == L'\\' || (DWORD)c < 0x20;
+}
+
+
+/****
+ * FuzzChar
+ *
+ * DESC:
+ *     Picks a character for the escape fuzz: mostly plain text, with
+ *     specials, other control characters, non-ASCII, and characters that
+ *     only look like specials in their low byte
+ */
+static WCHAR FuzzChar(DWORD *state)
+{
+	static const DWORD LOOKALIKES[] = { 0x0122, 0x015C, 0x0100, 0x011F, 0x2022, 0x7F1F, 0x8000, 0xFF22, 0xFFFF, 0x10022, 0x1001F, 0x10FFFF };
+	DWORD pick = NextRandom(state) % 100;
+
+	if( pick < 55 )
+		return (WCHAR)(0x20 + NextRandom(state) % 0x5F);
+	if( pick < 65 )
+		return NextRandom(state) % 2 ? L'"' : L'\\';
+	if( pick < 75 )
+		return (WCHAR)(NextRandom(state) % 0x20);
+	if( pick < 80 )
+		return (WCHAR)0x7F;
+	if( pick < 90 )
+		return (WCHAR)(0x80 + NextRandom(state) % 0xFF80);
+
+	return (WCHAR)LOOKALIKES[NextRandom(state) % (sizeof(LOOKALIKES) / sizeof(LOOKALIKES[0]))];
+}
+
+
+/****
+ * ReadMessages
+ *
+ * DESC:
+ *     Collects the messages of the first events of a source, as
+ *     GetEventMessageDescription returns them, in the order
+ *     ParseEventSource reads them. Events without one get ""
+ */
+void ReadMessages(EventSource *source, DWORD64 events, INT mode, std::vector<std::wstring> *messages)
+{
+	EVENT_SESSION session(source);
+	EVT_HANDLE hResults = source->Query(NULL, NULL, EvtQueryChannelPath | EvtQueryReverseDirection);
+	EVT_HANDLE hEvents[CURSOR_NEXT_MAX];
+	DWORD returned = 0;
+
+	while( hResults != NULL && messages->size() < events && source->Next(hResults, CURSOR_NEXT_MAX, hEvents, INFINITE, &returned) )
+	{
+		for( DWORD e = 0; e < returned; e++ )
+		{
+			SYSTEM_FIELDS fields;
+			LPCWSTR message = NULL;
+
+			if( ReadEventFields(&session, hEvents[e], &fields, mode, DEBUG_NONE) ) {
+				EVT_HANDLE hMetadata = session.publishers.Open(fields.provider);
+
+				if( hMetadata != NULL )
+					message = GetEventMessageDescription(&session, hMetadata, hEvents[e]);
+			}
+
+			if( messages->size() < events )
+				messages->push_back(message != NULL ? message : L"");
+
+			source->Close(hEvents[e]);
+		}
+	}
+
+	if( hResults != NULL )
+		source->Close(hResults);
+
+	session.publishers.Clear();
+}
+
+
+/****
+ * TimeEscape
+ *
+ * DESC:
+ *     Escapes a corpus over and over with one implementation
+ *
+ * RETURNS:
+ *     Input megabytes escaped per second
+ */
+static double TimeEscape(JSON_ESCAPE_ROUTINE routine, const std::vector<std::wstring> &corpus, std::vector<WCHAR> *out)
+{
+	size_t chars = 0, written = 0;
+
+	for( size_t i = 0; i < corpus.size(); i++ )
+		chars += corpus[i].size();
+
+	// Enough passes for about 64M characters
+	size_t passes = chars > 0 ? 64 * 1024 * 1024 / chars + 1 : 1;
+
+	std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+
+	for( size_t pass = 0; pass < passes; pass++ )
+		for( size_t i = 0; i < corpus.size(); i++ )
+			written += routine(corpus[i].data(), corpus[i].size(), &(*out)[0]);
+
+	double elapsed = Seconds(started);
+
+	// Keep the work from being optimized away
+	if( written == 0 && chars > 0 )
+		fprintf(report, "escape: nothing written\n");
+
+	return passes * chars * sizeof(WCHAR) / elapsed / 1e6;
+}
+
+
+/****
+ * BenchEscape
+ *
+ * DESC:
+ *     Fuzzes every JSON escape implementation this CPU has against the
+ *     scalar reference, checks the records the parser writes are valid
+ *     JSON holding the exact message, then times the implementations on
+ *     real messages, on clean text and on text full of specials
+ */
+int BenchEscape(BENCH_OPTIONS *options)
+{
+	const INT kinds[] = { JSON_ESCAPE_SCALAR, JSON_ESCAPE_SSE2, JSON_ESCAPE_AVX2 };
+	const size_t kindCount = sizeof(kinds) / sizeof(kinds[0]);
+	int result = 0;
+	DWORD state = 0x2545F491;
+	std::vector<WCHAR> text, expected, out;
+	DWORD64 cases = 0, mismatches = 0;
+
+	// Known answers first, so the reference itself is checked
+	{
+		LPCWSTR input = L"a\"b\\c/\r\n\t\b\f\x01\x1f\x7f\u00e9";
+		LPCWSTR answer = L"a\\\"b\\\\c/\\r\\n\\t\\b\\f\\u0001\\u001f\x7f\u00e9";
+		WCHAR escaped[128];
+		size_t length = EscapeJsonScalar(input, wcslen(input), escaped);
+
+		if( std::wstring(escaped, length) != answer ) {
+			fprintf(report, "escape: FAILED, the scalar reference gave %ls\n", std::wstring(escaped, length).c_str());
+			result = 1;
+		}
+	}
+
+	for( DWORD i = 0; i < 200000; i++ )
+	{
+		// Mostly short strings, some past a few vectors, now and then a long clean run
+		DWORD shape = NextRandom(&state) % 10;
+		size_t length = shape < 4 ? NextRandom(&state) % 9 : shape < 9 ? NextRandom(&state) % 300 : 1000 + NextRandom(&state) % 3000;
+		size_t offset = NextRandom(&state) % 8;
+		BOOL clean = shape == 9;
+
+		text.assign(offset + length, L' ');
+		for( size_t c = 0; c < length; c++ ) {
+			WCHAR ch = FuzzChar(&state);
+			text[offset + c] = clean && IsJsonSpecial(ch) ? L'x' : ch;
+		}
+
+		// Start anywhere in the first vector, so loads are unaligned too
+		LPCWSTR input = length > 0 ? &text[offset] : L"";
+
+		expected.assign(length * JSON_ESCAPE_MAX_GROWTH + 1, 0);
+		size_t expectedLength = EscapeJsonScalar(input, length, &expected[0]);
+
+		// Escaping must round trip
+		std::wstring quoted = L"\"" + std::wstring(&expected[0], expectedLength) + L"\"", decoded;
+		size_t at = 0;
+
+		if( !ReadJsonString(quoted, &at, &decoded) || at != quoted.size() || decoded != std::wstring(input, length) )
+			mismatches++;
+
+		for( size_t k = 1; k < kindCount; k++ )
+		{
+			JSON_ESCAPE_ROUTINE routine = GetJsonEscapeRoutine(kinds[k]);
+
+			if( routine == NULL )
+				continue;
+
+			// Guard characters after the worst case catch writes past it
+			out.assign(length * JSON_ESCAPE_MAX_GROWTH + 8, (WCHAR)0xFFFE);
+			size_t outLength = routine(input, length, &out[0]);
+			BOOL same = outLength == expectedLength && memcmp(&out[0], &expected[0], outLength * sizeof(WCHAR)) == 0;
+
+			for( size_t g = length * JSON_ESCAPE_MAX_GROWTH; g < out.size(); g++ )
+				same = same && out[g] == (WCHAR)0xFFFE;
+
+			if( !same )
+				mismatches++;
+		}
+
+		cases++;
+	}
+
+	fprintf(report, "escape: fuzzed %llu strings, %llu mismatches", (unsigned long long)cases, (unsigned long long)mismatches);
+	for( size_t k = 0; k < kindCount; k++ )
+		fprintf(report, "%s%s", k == 0 ? " (" : ", ", GetJsonEscapeName(kinds[k]));
+	fprintf(report, "; default %s)\n", GetJsonEscapeName(JSON_ESCAPE_DEFAULT));
+
+	if( mismatches > 0 )
+		result = 1;
+
+	// The messages of the corpus, as GetEventMessageDescription returns them
+	DWORD64 events = 0;
+	EventSource *source = OpenSource(options, &events);
+	std::vector<std::wstring> messages;
+
+	if( source == NULL )
+		return 1;
+
+	if( events > options->events )
+		events = options->events;
+
+	ReadMessages(source, events, options->mode, &messages);
+
+	// The records must be JSON that holds those exact messages
+	{
+		COLLECTOR collector;
+		CallbackSink sink(CollectRecord, &collector);
+		std::map<std::wstring, std::wstring> values;
+		DWORD64 invalid = 0;
+
+		collector.calls = 0;
+		collector.refuse = 0;
+
+		ParseEventSource(source, NULL, NULL, OUTPUT_FORMAT_JSON, DEBUG_NONE, options->mode, &sink);
+
+		for( size_t r = 0; r < messages.size(); r++ ) {
+			if( r >= collector.records.size() || !ReadJsonRecord(collector.records[r], &values) || values[L"message"] != messages[r] ) {
+				if( invalid++ == 0 && r < collector.records.size() )
+					fprintf(report, "escape: FAILED, record %llu is %ls\n", (unsigned long long)r, collector.records[r].c_str());
+			}
+		}
+
+		fprintf(report, "escape: %llu records checked, %llu invalid\n", (unsigned long long)messages.size(), (unsigned long long)invalid);
+
+		if( invalid > 0 )
+			result = 1;
+	}
+
+	delete source;
+
+	// The same text with nothing to escape, and text that is half specials
+	std::vector<std::wstring> clean(messages), dense;
+	size_t longest = 0;
+
+	for( size_t m = 0; m < clean.size(); m++ )
+	{
+		std::wstring noisy(clean[m].size(), L' ');
+
+		for( size_t c = 0; c < clean[m].size(); c++ ) {
+			if( IsJsonSpecial(clean[m][c]) )
+				clean[m][c] = L' ';
+			noisy[c] = NextRandom(&state) % 2 ? L'\t' : clean[m][c];
+		}
+
+		dense.push_back(noisy);
+		longest = clean[m].size() > longest ? clean[m].size() : longest;
+	}
+
+	const std::vector<std::wstring> *corpora[] = { &messages, &clean, &dense };
+	const char *names[] = { "messages", "clean", "dense" };
+
+	out.assign(longest * JSON_ESCAPE_MAX_GROWTH + 1, 0);
+
+	for( size_t c = 0; c < 3; c++ )
+	{
+		double scalar = 0;
+
+		fprintf(report, "  %-8s:", names[c]);
+
+		for( size_t k = 0; k < kindCount; k++ )
+		{
+			JSON_ESCAPE_ROUTINE routine = GetJsonEscapeRoutine(kinds[k]);
+
+			if( routine == NULL )
+				continue;
+
+			double rate = TimeEscape(routine, *corpora[c], &out);
+
+			if( k == 0 ) {
+				scalar = rate;
+				fprintf(report, " %s %.0f MB/s", GetJsonEscapeName(kinds[k]), rate);
+			} else {
+				fprintf(report, ", %s %.0f MB/s (%.1fx)", GetJsonEscapeName(kinds[k]), rate, rate / scalar);
+			}
+		}
+
+		fprintf(report, "\n");
+	}
+
+	return result;
+}
@@ -0,0 +1,297 @@
+#include <set>
+#include "Benchmark.h"
+#include "EventCursor.h"
+
+
+/****
+ * LookupEventData
+ *
+ * DESC:
+ *     What ExtractEventData should find, the obvious way: every <Data>
+ *     of <EventData> by name (or position), or every child of the element
+ *     in <UserData>
+ *
+ * ARGS:
+ *     doc - the parsed event
+ *     names - the fields wanted, or none for all of them
+ *     values - receives the fields, keyed by name
+ */
+static void LookupEventData(rapidxml::xml_document<WCHAR> *doc, const std::set<std::wstring> &names, std::map<std::wstring, std::wstring> *values)
+{
+	rapidxml::xml_node<WCHAR> *nodeEvent = doc->first_node(L"Event");
+	rapidxml::xml_node<WCHAR> *nodeData = nodeEvent != NULL ? nodeEvent->first_node(L"EventData") : NULL;
+	rapidxml::xml_node<WCHAR> *nodeUser = nodeEvent != NULL ? nodeEvent->first_node(L"UserData") : NULL;
+	std::map<std::wstring, std::wstring> all;
+
+	values->clear();
+
+	if( nodeData != NULL ) {
+		DWORD position = 0;
+
+		for( rapidxml::xml_node<WCHAR> *node = nodeData->first_node(L"Data"); node != NULL; node = node->next_sibling(L"Data") ) {
+			rapidxml::xml_attribute<WCHAR> *name = node->first_attribute(L"Name");
+			WCHAR text[24];
+
+			position++;
+			all[name != NULL && name->value_size() > 0 ? name->value() : FormatUnsigned(position, text)] = node->value();
+		}
+	} else if( nodeUser != NULL && nodeUser->first_node() != NULL ) {
+		for( rapidxml::xml_node<WCHAR> *node = nodeUser->first_node()->first_node(); node != NULL; node = node->next_sibling() )
+			all[node->name()] = node->value();
+	}
+
+	for( std::map<std::wstring, std::wstring>::iterator it = all.begin(); it != all.end(); ++it ) {
+		if( names.empty() || names.count(it->first) > 0 )
+			(*values)[it->first] = it->second;
+	}
+}
+
+
+// ExtractEventData's fields keyed the way records key them
+static void EventDataMap(const std::vector<EVENT_DATA_FIELD> &fields, std::map<std::wstring, std::wstring> *values)
+{
+	values->clear();
+
+	for( size_t i = 0; i < fields.size(); i++ ) {
+		WCHAR text[24];
+
+		(*values)[fields[i].name != NULL ? fields[i].name : FormatUnsigned(fields[i].position, text)] = fields[i].value;
+	}
+}
+
+
+// Moves the "event_data/" members of a parsed record into their own map
+static void SplitEventData(std::map<std::wstring, std::wstring> *record, std::map<std::wstring, std::wstring> *eventData)
+{
+	const std::wstring prefix = L"event_data/";
+
+	eventData->clear();
+
+	for( std::map<std::wstring, std::wstring>::iterator it = record->begin(); it != record->end(); ) {
+		if( it->first.compare(0, prefix.size(), prefix) == 0 ) {
+			(*eventData)[it->first.substr(prefix.size())] = it->second;
+			record->erase(it++);
+		} else {
+			++it;
+		}
+	}
+}
+
+
+/****
+ * TimeDump
+ *
+ * DESC:
+ *     Times writing every event of the source as a JSON record to stdout
+ *
+ * ARGS:
+ *     session - the session to read with
+ *     mode - what to read each event with
+ *     seconds - receives how long it took
+ *
+ * RETURNS:
+ *     The number of events written
+ *
+ * REMARKS:
+ *     Goes through DumpEventInfo rather than an EventCursor, which would
+ *     skip the record IDs of replayed fixtures as already read
+ */
+DWORD64 TimeDump(EVENT_SESSION *session, INT mode, double *seconds)
+{
+	EventSource *source = session->source;
+	StdoutSink sink;
+	EVT_HANDLE hEvents[BATCH_SIZE_MAX];
+	DWORD dwReturned;
+	DWORD64 records = 0;
+
+	std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+
+	EVT_HANDLE hResults = source->Query(NULL, NULL, EvtQueryChannelPath | EvtQueryReverseDirection);
+
+	while( source->Next(hResults, BATCH_SIZE_MAX, hEvents, INFINITE, &dwReturned) && dwReturned > 0 ) {
+		for( DWORD i = 0; i < dwReturned; i++ ) {
+			if( DumpEventInfo(session, hEvents[i], &sink, OUTPUT_FORMAT_JSON, mode, DEBUG_NONE) == ERROR_SUCCESS )
+				records++;
+
+			source->Close(hEvents[i]);
+		}
+	}
+	source->Close(hResults);
+	fflush(stdout);
+
+	*seconds = Seconds(started);
+
+	return records;
+}
+
+
+/****
+ * BenchEventData
+ *
+ * DESC:
+ *     Checks the "event_data" object of every record against the event
+ *     XML, for all fields and for a selection of them, on the values and
+ *     the XML path, and that the rest of the record is what it is without
+ *     it. Then times reading the log with and without event data
+ */
+int BenchEventData(BENCH_OPTIONS *options)
+{
+	// The fields userNameFlow reads from logons, plus unnamed and missing ones
+	const LPCWSTR subsetNames = L"TargetUserName, TargetDomainName,LogonType,,IpAddress,2,param1,LogonType";
+	const LPCWSTR subsetList[] = { L"TargetUserName", L"TargetDomainName", L"LogonType", L"IpAddress", L"2", L"param1" };
+	const std::set<std::wstring> subset(subsetList, subsetList + sizeof(subsetList) / sizeof(subsetList[0])), all;
+
+	// Unnamed fields, <Binary>, an escaped value, <UserData> and no data at all
+	const LPCWSTR samples[] = {
+		L"<Event><System><EventID>1</EventID></System><EventData><Data>a</Data><Data Name='param1'>b &amp; \"c\"</Data>"
+		L"<Binary>00FF</Binary><Data></Data><Data Name=''>e</Data></EventData></Event>",
+		L"<Event><System><EventID>2</EventID></System><UserData><LogFileCleared xmlns='http://manifests.microsoft.com/win/2004/08/windows/eventlog'>"
+		L"<SubjectUserName>alice</SubjectUserName><TargetUserName/><LogonType>3</LogonType></LogFileCleared></UserData></Event>",
+		L"<Event><System><EventID>3</EventID></System></Event>",
+	};
+
+	int result = 0;
+	DWORD64 events = 0;
+	EventSource *source = OpenSource(options, &events);
+
+	if( source == NULL )
+		return 1;
+
+	RenderContext *reference = new RenderContext(source);
+	std::vector<EVENT_DATA_FIELD> fields;
+	std::vector<WCHAR> scratch;
+	std::map<std::wstring, std::wstring> expected[2], found;
+
+	for( size_t i = 0; i < sizeof(samples) / sizeof(samples[0]); i++ ) {
+		scratch.assign(samples[i], samples[i] + wcslen(samples[i]) + 1);
+
+		rapidxml::xml_document<WCHAR> *doc = reference->Parse(&scratch[0]);
+
+		for( int s = 0; s < 2; s++ ) {
+			EventDataSelection selection;
+
+			selection.Select(s == 0 ? EVENT_DATA_ALL : subsetNames);
+			LookupEventData(doc, s == 0 ? all : subset, &expected[s]);
+
+			BOOL ok = ExtractEventData(doc, &selection, &fields);
+
+			EventDataMap(fields, &found);
+
+			if( !ok || found != expected[s] ) {
+				fprintf(report, "eventdata: MISMATCH on sample %u (%s)\n", (DWORD)i + 1, s == 0 ? "all" : "subset");
+				result = 1;
+			}
+		}
+	}
+
+	// One session for the record without event data, and one per selection
+	// and path with it
+	INT modes[] = { options->mode & ~MODE_RENDER_XML, options->mode | MODE_RENDER_XML };
+	EVENT_SESSION *base = new EVENT_SESSION(source);
+	EVENT_SESSION *sessions[4];
+
+	for( int k = 0; k < 4; k++ ) {
+		sessions[k] = new EVENT_SESSION(source);
+		sessions[k]->eventDataSelection.Select(k < 2 ? EVENT_DATA_ALL : subsetNames);
+	}
+
+	COLLECTOR collector;
+	CallbackSink sink(CollectRecord, &collector);
+	DWORD64 count = 0, withData = 0, mismatches = 0;
+
+	collector.calls = 0;
+	collector.refuse = 0;
+
+	EVT_HANDLE hResults = source->Query(NULL, NULL, EvtQueryChannelPath | EvtQueryReverseDirection);
+	EVT_HANDLE hEvents[BATCH_SIZE_MAX];
+	DWORD dwReturned;
+
+	while( source->Next(hResults, BATCH_SIZE_MAX, hEvents, INFINITE, &dwReturned) && dwReturned > 0 ) {
+		for( DWORD i = 0; i < dwReturned; i++, count++ ) {
+			LPWSTR xml = reference->RenderXml(hEvents[i], DEBUG_NONE);
+			std::map<std::wstring, std::wstring> baseRecord, record;
+			BOOL ok = xml != NULL;
+
+			if( ok ) {
+				scratch.assign(xml, xml + wcslen(xml) + 1);
+
+				rapidxml::xml_document<WCHAR> *doc = reference->Parse(&scratch[0]);
+
+				LookupEventData(doc, all, &expected[0]);
+				LookupEventData(doc, subset, &expected[1]);
+
+				if( !expected[0].empty() )
+					withData++;
+			}
+
+			collector.records.clear();
+
+			DumpEventInfo(base, hEvents[i], &sink, OUTPUT_FORMAT_JSON, modes[0], DEBUG_NONE);
+			for( int k = 0; k < 4; k++ )
+				DumpEventInfo(sessions[k], hEvents[i], &sink, OUTPUT_FORMAT_JSON, modes[k % 2] | MODE_EVENT_DATA, DEBUG_NONE);
+
+			ok = ok && collector.records.size() == 5 && ReadJsonRecord(collector.records[0], &baseRecord);
+
+			for( int k = 0; ok && k < 4; k++ ) {
+				ok = ReadJsonRecord(collector.records[k + 1], &record) && collector.records[k + 1].find(L"\"event_data\":{") != std::wstring::npos;
+
+				SplitEventData(&record, &found);
+
+				ok = ok && record == baseRecord && found == expected[k / 2];
+			}
+
+			if( !ok && mismatches++ < 10 )
+				fprintf(report, "eventdata: MISMATCH on event %llu\n", (unsigned long long)count + 1);
+
+			source->Close(hEvents[i]);
+		}
+	}
+	source->Close(hResults);
+
+	base->publishers.Clear();
+	delete base;
+
+	for( int k = 0; k < 4; k++ ) {
+		sessions[k]->publishers.Clear();
+		delete sessions[k];
+	}
+
+	delete reference;
+
+	// Reading the whole log with no event data, all of it, and the selection
+	const LPCWSTR timed[] = { NULL, EVENT_DATA_ALL, subsetNames };
+	const char *timedNames[] = { "none", "all", "subset" };
+	double seconds[3];
+
+	for( int t = 0; t < 3; t++ ) {
+		EVENT_SESSION session(source);
+		INT mode = options->mode;
+
+		if( timed[t] != NULL ) {
+			session.eventDataSelection.Select(timed[t]);
+			mode |= MODE_EVENT_DATA;
+		}
+
+		if( TimeDump(&session, mode, &seconds[t]) != events )
+			result = 1;
+
+		session.publishers.Clear();
+	}
+
+	delete source;
+
+	fprintf(report, "eventdata: %llu events (%s, %s), %llu with event data\n", (unsigned long long)count,
+		options->fixtures != NULL ? "fixtures" : "synthetic", (options->mode & MODE_RENDER_XML) ? "xml" : "values", (unsigned long long)withData);
+
+	for( int t = 0; t < 3; t++ ) {
+		fprintf(report, "  %-7s %.3f s, %.0f events/s (%.2fx the time)\n", timedNames[t], seconds[t], events / seconds[t], seconds[t] / seconds[0]);
+	}
+
+	if( mismatches > 0 || count != events || withData == 0 ) {
+		fprintf(report, "eventdata: FAILED, %llu mismatches, %llu of %llu events read, %llu with event data\n",
+			(unsigned long long)mismatches, (unsigned long long)count, (unsigned long long)events, (unsigned long long)withData);
+		result = 1;
+	}
+
+	return result;
+}
@@ -0,0 +1,362 @@
+#include <string.h>
+#include "Benchmark.h"
+#include "EvtxSource.h"
+#include "EvtxDecoder.h"
+#include "EvtxWriter.h"
+
+
+/****
+ * BenchEvtxWrite
+ *
+ * DESC:
+ *     Writes the fixture events (or the synthetic ones) into an .evtx
+ *     file. With --events the corpus is replayed, renumbered, until that
+ *     many records have been written
+ */
+int BenchEvtxWrite(BENCH_OPTIONS *options)
+{
+	if( options->file == NULL ) {
+		fprintf(report, "evtx-write: --file is required\n");
+		return 2;
+	}
+
+	DWORD64 records = options->events;
+	DWORD64 events = 0;
+
+	// Replay the fixtures for as long as it takes to reach the record count
+	if( options->fixtures != NULL )
+		options->repeat = records == 0 ? 1 : (DWORD)records;
+
+	EventSource *source = OpenSource(options, &events);
+
+	if( source == NULL )
+		return 1;
+
+	EvtxWriter writer;
+	RenderContext *render = new RenderContext(source);
+	BOOL ok = writer.Create(options->file);
+
+	EVT_HANDLE hResults = source->Query(NULL, NULL, EvtQueryChannelPath | EvtQueryForwardDirection);
+	EVT_HANDLE hEvents[BATCH_SIZE_MAX];
+	DWORD dwReturned;
+
+	while( ok && (records == 0 || writer.Records() < records) && source->Next(hResults, BATCH_SIZE_MAX, hEvents, INFINITE, &dwReturned) ) {
+		for( DWORD i = 0; i < dwReturned; i++ ) {
+			if( ok && (records == 0 || writer.Records() < records) ) {
+				LPWSTR xml = render->RenderXml(hEvents[i], DEBUG_NONE);
+
+				// Keep the fixtures' own record IDs unless they are being replayed
+				ok = xml != NULL && writer.Add(xml, records == 0 ? 0 : writer.Records() + 1);
+			}
+			source->Close(hEvents[i]);
+		}
+	}
+	source->Close(hResults);
+
+	ok = writer.Close() && ok;
+
+	delete render;
+	delete source;
+
+	if( !ok ) {
+		fprintf(report, "evtx-write: FAILED\n");
+		return 1;
+	}
+
+	fprintf(report, "evtx-write: %llu records written to %s\n", (unsigned long long)writer.Records(), options->file);
+
+	return 0;
+}
+
+
+/****
+ * ReadEvtx
+ *
+ * DESC:
+ *     Reads every record of an .evtx file without rendering anything, so
+ *     only the decoding is timed
+ *
+ * RETURNS:
+ *     The number of records read
+ */
+static DWORD64 ReadEvtx(EvtxSource *source)
+{
+	EVT_HANDLE hResults = source->Query(NULL, NULL, EvtQueryChannelPath | EvtQueryReverseDirection);
+	EVT_HANDLE hEvents[BATCH_SIZE_MAX];
+	DWORD dwReturned;
+	DWORD64 count = 0;
+
+	while( source->Next(hResults, BATCH_SIZE_MAX, hEvents, INFINITE, &dwReturned) ) {
+		for( DWORD i = 0; i < dwReturned; i++ )
+			source->Close(hEvents[i]);
+		count += dwReturned;
+	}
+	source->Close(hResults);
+
+	return count;
+}
+
+
+/****
+ * CheckEvtx
+ *
+ * DESC:
+ *     Checks that every record of an .evtx file decodes to the XML and
+ *     System fields of the fixture event with the same record ID
+ *
+ * RETURNS:
+ *     The number of mismatches (missing and extra records included)
+ */
+static DWORD64 CheckEvtx(BENCH_OPTIONS *options, EvtxSource *evtx)
+{
+	FixtureSource fixture(1);
+
+	if( !LoadFixtures(&fixture, options, 0) )
+		return 1;
+
+	std::map<DWORD64, std::wstring> expected;
+	std::map<DWORD64, SOURCE_RECORD> expectedRecords;
+	RenderContext *render = new RenderContext(&fixture);
+	EVT_HANDLE hResults = fixture.Query(NULL, NULL, EvtQueryChannelPath | EvtQueryReverseDirection);
+	EVT_HANDLE hEvents[BATCH_SIZE_MAX];
+	DWORD dwReturned;
+
+	while( fixture.Next(hResults, BATCH_SIZE_MAX, hEvents, INFINITE, &dwReturned) ) {
+		for( DWORD i = 0; i < dwReturned; i++ ) {
+			SYSTEM_FIELDS fields;
+
+			if( RenderSystemFields(render, hEvents[i], &fields) )
+				expected[fields.recordIdValue] = render->RenderXml(hEvents[i], DEBUG_NONE);
+			fixture.Close(hEvents[i]);
+		}
+	}
+	fixture.Close(hResults);
+	delete render;
+
+	DWORD64 mismatches = 0, count = 0;
+	RenderContext *evtxRender = new RenderContext(evtx);
+	RenderContext *fixtureRender = new RenderContext(&fixture);
+
+	hResults = evtx->Query(NULL, NULL, EvtQueryChannelPath | EvtQueryReverseDirection);
+
+	while( evtx->Next(hResults, BATCH_SIZE_MAX, hEvents, INFINITE, &dwReturned) ) {
+		for( DWORD i = 0; i < dwReturned; i++, count++ ) {
+			SYSTEM_FIELDS fields, xmlFields;
+			LPWSTR xml = NULL;
+			std::map<DWORD64, std::wstring>::iterator found = expected.end();
+
+			BOOL ok = RenderSystemFields(evtxRender, hEvents[i], &fields);
+
+			if( ok ) {
+				found = expected.find(fields.recordIdValue);
+				xml = evtxRender->RenderXml(hEvents[i], DEBUG_NONE);
+			}
+
+			// The XML must match exactly, and the values read from it must
+			// match the values the source hands out
+			ok = ok && found != expected.end() && xml != NULL && found->second == xml;
+
+			if( ok ) {
+				std::vector<WCHAR> scratch(found->second.begin(), found->second.end());
+				scratch.push_back(L'\0');
+
+				ok = ExtractSystemFields(fixtureRender->Parse(&scratch[0]), &xmlFields) && SameFields(&xmlFields, &fields);
+			}
+
+			if( !ok && mismatches++ < 10 ) {
+				fprintf(report, "evtx: MISMATCH on record %llu\n  expected: %ls\n  decoded:  %ls\n",
+					(unsigned long long)(found != expected.end() ? found->first : 0),
+					found != expected.end() ? found->second.c_str() : L"(no such fixture)", xml != NULL ? xml : L"(none)");
+			}
+
+			if( found != expected.end() )
+				expected.erase(found);
+
+			evtx->Close(hEvents[i]);
+		}
+	}
+	evtx->Close(hResults);
+
+	delete evtxRender;
+	delete fixtureRender;
+
+	fprintf(report, "evtx: %llu records checked against %s, %llu mismatches, %llu fixtures not found\n",
+		(unsigned long long)count, options->fixtures, (unsigned long long)mismatches, (unsigned long long)expected.size());
+
+	return mismatches + expected.size();
+}
+
+
+// Random corruptions CheckCorrupted makes of each chunk, and how many
+// bytes each one overwrites
+#define CORRUPT_CHECK_CASES 500
+#define CORRUPT_CHECK_BYTES 4
+
+
+static void Set32(BYTE *p, DWORD value)
+{
+	p[0] = (BYTE)value;
+	p[1] = (BYTE)(value >> 8);
+	p[2] = (BYTE)(value >> 16);
+	p[3] = (BYTE)(value >> 24);
+}
+
+
+/****
+ * CheckCorrupted
+ *
+ * DESC:
+ *     Decodes corrupted copies of each chunk of an .evtx file: a record
+ *     size, a template definition offset and a template data size set to
+ *     values that wrap when added to, then random bytes overwritten. Each
+ *     copy is exactly a chunk long on the heap, so a sanitizer build
+ *     catches any read outside it; otherwise a bad read crashes
+ *
+ * RETURNS:
+ *     The number of failures: targeted corruptions that still decoded
+ *     every record, or a file that could not be read
+ */
+static DWORD64 CheckCorrupted(BENCH_OPTIONS *options)
+{
+	FILE *file = fopen(options->file, "rb");
+	std::vector<BYTE> data;
+	BYTE block[4096];
+	size_t got;
+
+	if( file == NULL )
+		return 1;
+
+	while( (got = fread(block, 1, sizeof(block), file)) > 0 )
+		data.insert(data.end(), block, block + got);
+	fclose(file);
+
+	DWORD64 failures = 0, cases = 0, chunks = 0;
+	DWORD state = 0x2545F491;
+	EvtxDecoder decoder;
+	std::vector<EVTX_RECORD> records;
+
+	for( size_t offset = EVTX_FILE_HEADER_SIZE; offset + EVTX_CHUNK_SIZE <= data.size(); offset += EVTX_CHUNK_SIZE ) {
+		const BYTE *chunk = &data[offset];
+
+		records.clear();
+		if( !decoder.DecodeChunk(chunk, records) || records.empty() )
+			continue;
+
+		size_t clean = records.size();
+
+		// The first record: its size, its template instance's definition
+		// offset (after the fragment header), and the size of the definition
+		// that follows inline
+		static const struct {
+			const char *name;
+			size_t at;
+		} targets[] = {
+			{ "record size", EVTX_CHUNK_HEADER_SIZE + 4 },
+			{ "definition offset", EVTX_CHUNK_HEADER_SIZE + 24 + 4 + 6 },
+			{ "definition data size", EVTX_CHUNK_HEADER_SIZE + 24 + 4 + 10 + 20 },
+		};
+
+		for( size_t k = 0; k < sizeof(targets) / sizeof(targets[0]); k++ ) {
+			static const DWORD wraps[] = { 0xFFFFFFF0, 0xFFFFFFFF, 0x80000000 };
+
+			for( size_t w = 0; w < sizeof(wraps) / sizeof(wraps[0]); w++, cases++ ) {
+				std::vector<BYTE> copy(chunk, chunk + EVTX_CHUNK_SIZE);
+
+				Set32(&copy[targets[k].at], wraps[w]);
+				records.clear();
+				decoder.DecodeChunk(&copy[0], records);
+
+				if( records.size() >= clean && failures++ < 10 ) {
+					fprintf(report, "evtx: CORRUPT %s 0x%08X at chunk %llu still decoded all %llu records\n",
+						targets[k].name, wraps[w], (unsigned long long)chunks, (unsigned long long)clean);
+				}
+			}
+		}
+
+		// Random bytes anywhere past the chunk signature
+		for( DWORD n = 0; n < CORRUPT_CHECK_CASES; n++, cases++ ) {
+			std::vector<BYTE> copy(chunk, chunk + EVTX_CHUNK_SIZE);
+			size_t at = 8 + NextRandom(&state) % (EVTX_CHUNK_SIZE - 8 - CORRUPT_CHECK_BYTES);
+
+			for( DWORD b = 0; b < CORRUPT_CHECK_BYTES; b++ )
+				copy[at + b] = (BYTE)NextRandom(&state);
+
+			records.clear();
+			decoder.DecodeChunk(&copy[0], records);
+		}
+
+		chunks++;
+	}
+
+	fprintf(report, "evtx: %llu corrupted copies of %llu chunks decoded, %llu failures\n",
+		(unsigned long long)cases, (unsigned long long)chunks, (unsigned long long)failures);
+
+	return chunks == 0 ? 1 : failures;
+}
+
+
+/****
+ * BenchEvtx
+ *
+ * DESC:
+ *     Reads an .evtx file with one decode thread and with --threads, and
+ *     through the whole parser. With --fixtures, first checks the file
+ *     decodes to exactly those events, and that corrupted copies of its
+ *     chunks decode without reading outside them
+ */
+int BenchEvtx(BENCH_OPTIONS *options)
+{
+	if( options->file == NULL ) {
+		fprintf(report, "evtx: --file is required\n");
+		return 2;
+	}
+
+	if( options->fixtures != NULL ) {
+		EvtxSource source(options->threads);
+
+		if( !source.Open(options->file) || CheckEvtx(options, &source) != 0 || CheckCorrupted(options) != 0 ) {
+			fprintf(report, "evtx: FAILED\n");
+			return 1;
+		}
+	}
+
+	DWORD threads[] = { 1, options->threads };
+	double seconds[2];
+	DWORD64 counts[2];
+
+	for( int i = 0; i < 2; i++ ) {
+		EvtxSource source(threads[i]);
+
+		if( !source.Open(options->file) )
+			return 1;
+
+		std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+		counts[i] = ReadEvtx(&source);
+		seconds[i] = Seconds(started);
+	}
+
+	EvtxSource source(options->threads);
+
+	if( !source.Open(options->file) )
+		return 1;
+
+	std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+
+	ParseEventSource(&source, NULL, NULL, options->outputFormat, DEBUG_NONE, options->mode);
+	fflush(stdout);
+
+	double parse = Seconds(started);
+
+	fprintf(report, "evtx: %llu records in %u chunks (%s)\n", (unsigned long long)counts[0], source.Chunks(), options->file);
+	fprintf(report, "  decode, 1 thread:  %.3f s, %.0f records/s\n", seconds[0], counts[0] / seconds[0]);
+	fprintf(report, "  decode, %u threads: %.3f s, %.0f records/s (%.1fx)\n", threads[1], seconds[1], counts[1] / seconds[1], seconds[0] / seconds[1]);
+	fprintf(report, "  parse, %u threads:  %.3f s, %.0f records/s (%s)\n", threads[1], parse, counts[1] / parse,
+		(options->mode & MODE_RENDER_XML) ? "xml" : "values");
+
+	if( counts[0] != counts[1] ) {
+		fprintf(report, "evtx: FAILED, %llu records with one thread but %llu with %u\n", (unsigned long long)counts[0], (unsigned long long)counts[1], threads[1]);
+		return 1;
+	}
+
+	return 0;
+}
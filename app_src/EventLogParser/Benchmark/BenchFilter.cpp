@@ -0,0 +1,470 @@
+#include <algorithm>
+#include <set>
+#include "Benchmark.h"
+#include "EventCursor.h"
+#include "XPathQuery.h"
+
+
+/****
+ * ReadFilterEvents
+ *
+ * DESC:
+ *     Reads the filter fields of every event of a source from its XML,
+ *     oldest first
+ *
+ * RETURNS:
+ *     TRUE if every event was read
+ */
+BOOL ReadFilterEvents(EventSource *source, std::vector<FILTER_EVENT> *events)
+{
+	EVENT_SESSION session(source);
+	EVT_HANDLE hEvents[BATCH_SIZE_MAX];
+	DWORD dwReturned;
+	BOOL ok = TRUE;
+
+	EVT_HANDLE hResults = source->Query(NULL, NULL, EvtQueryChannelPath | EvtQueryForwardDirection);
+
+	while( source->Next(hResults, BATCH_SIZE_MAX, hEvents, INFINITE, &dwReturned) && dwReturned > 0 ) {
+		for( DWORD i = 0; i < dwReturned; i++ ) {
+			LPWSTR xml = session.render.RenderXml(hEvents[i], DEBUG_NONE);
+			std::vector<WCHAR> scratch;
+			rapidxml::xml_document<WCHAR> doc;
+			rapidxml::xml_node<WCHAR> *nodeSystem = NULL;
+
+			if( xml != NULL ) {
+				scratch.assign(xml, xml + wcslen(xml) + 1);
+
+				try {
+					doc.parse<0>(&scratch[0]);
+					nodeSystem = doc.first_node(L"Event") != NULL ? doc.first_node(L"Event")->first_node(L"System") : NULL;
+				} catch( rapidxml::parse_error & ) {
+					nodeSystem = NULL;
+				}
+			}
+
+			if( nodeSystem != NULL ) {
+				FILTER_EVENT event = FILTER_EVENT();
+
+				event.channel = ChildValue(nodeSystem, L"Channel");
+				event.provider = ChildAttribute(nodeSystem, L"Provider", L"Name");
+				event.record.eventId = (DWORD)wcstoul(ChildValue(nodeSystem, L"EventID"), NULL, 10);
+				event.record.level = (DWORD)wcstoul(ChildValue(nodeSystem, L"Level"), NULL, 10);
+				event.record.task = (DWORD)wcstoul(ChildValue(nodeSystem, L"Task"), NULL, 10);
+				event.record.version = (DWORD)wcstoul(ChildValue(nodeSystem, L"Version"), NULL, 10);
+				event.record.recordId = _wcstoui64(ChildValue(nodeSystem, L"EventRecordID"), NULL, 10);
+				event.keywords = _wcstoui64(ChildValue(nodeSystem, L"Keywords"), NULL, 16);
+				events->push_back(event);
+			} else {
+				ok = FALSE;
+			}
+
+			source->Close(hEvents[i]);
+		}
+	}
+	source->Close(hResults);
+
+	for( size_t i = 0; i < events->size(); i++ ) {
+		(*events)[i].record.provider = (*events)[i].provider.c_str();
+		(*events)[i].record.channel = (*events)[i].channel.c_str();
+		(*events)[i].record.computer = L"";
+	}
+
+	return ok && !events->empty();
+}
+
+
+/****
+ * RandomFilter
+ *
+ * DESC:
+ *     Makes up a filter out of the values some events have: event IDs
+ *     (often more than a query holds), levels, keywords, providers and a
+ *     record range, each clause there or not at random
+ */
+std::wstring RandomFilter(DWORD *state, const std::vector<FILTER_EVENT> &events)
+{
+	std::wstring spec;
+	WCHAR first[24], last[24];
+	DWORD clauses = NextRandom(state);
+
+	if( clauses & 1 ) {
+		DWORD count = 1 + NextRandom(state) % 40;
+
+		spec += L"events=";
+
+		for( DWORD i = 0; i < count; i++ ) {
+			DWORD id = events[NextRandom(state) % events.size()].record.eventId + NextRandom(state) % 5;
+
+			spec += i > 0 ? L"," : L"";
+			spec += FormatUnsigned(id, first);
+
+			if( NextRandom(state) % 4 == 0 ) {
+				spec += L"-";
+				spec += FormatUnsigned(id + NextRandom(state) % 4, last);
+			}
+		}
+	}
+
+	if( clauses & 2 ) {
+		DWORD low = NextRandom(state) % 6;
+
+		spec += L";levels=";
+		spec += FormatUnsigned(low, first);
+		spec += L"-";
+		spec += FormatUnsigned(low + NextRandom(state) % 3, last);
+	}
+
+	if( clauses & 4 ) {
+		DWORD64 keywords = events[NextRandom(state) % events.size()].keywords;
+
+		spec += L";keywords=";
+		spec += FormatUnsigned(keywords != 0 ? keywords : 0x8000000000000000ULL, first);
+	}
+
+	if( clauses & 8 ) {
+		DWORD count = 1 + NextRandom(state) % 3;
+
+		spec += L";providers=";
+
+		for( DWORD i = 0; i < count; i++ ) {
+			spec += i > 0 ? L", " : L"";
+			spec += events[NextRandom(state) % events.size()].provider;
+		}
+	}
+
+	if( clauses & 16 ) {
+		DWORD64 low = events[NextRandom(state) % events.size()].record.recordId;
+		DWORD64 high = events[NextRandom(state) % events.size()].record.recordId;
+		DWORD shape = NextRandom(state) % 3;
+
+		if( low > high ) {
+			DWORD64 swap = low;
+			low = high;
+			high = swap;
+		}
+
+		spec += L";records=";
+		spec += shape != 2 ? FormatUnsigned(low, first) : L"";
+		spec += L"-";
+		spec += shape != 1 ? FormatUnsigned(high, last) : L"";
+	}
+
+	return spec;
+}
+
+
+// Record IDs of the JSON records a sink collected, in order
+std::vector<DWORD64> CollectedRecordIds(const std::vector<std::wstring> &records)
+{
+	std::vector<DWORD64> ids;
+
+	for( size_t i = 0; i < records.size(); i++ ) {
+		std::map<std::wstring, std::wstring> values;
+
+		ids.push_back(ReadJsonRecord(records[i], &values) ? _wcstoui64(values[L"record_id"].c_str(), NULL, 10) : 0);
+	}
+
+	return ids;
+}
+
+
+// Occurrences of a field in a query, i.e. how many comparisons it makes on it
+static DWORD CountTerms(const std::wstring &query, LPCWSTR field)
+{
+	DWORD terms = 0;
+
+	for( size_t at = query.find(field); at != std::wstring::npos; at = query.find(field, at + 1) )
+		terms++;
+
+	return terms;
+}
+
+
+// Times testing every event against a query, over and over
+static double TimeQuery(const XPathQuery &query, const std::vector<FILTER_EVENT> &events, DWORD passes, DWORD64 *selected)
+{
+	std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+
+	*selected = 0;
+
+	for( DWORD pass = 0; pass < passes; pass++ ) {
+		for( size_t i = 0; i < events.size(); i++ ) {
+			if( query.Matches(&events[i].record, events[i].keywords) )
+				(*selected)++;
+		}
+	}
+
+	return Seconds(started);
+}
+
+
+// Filters the filter benchmark always checks, ahead of the random ones
+const LPCWSTR fixedFilters[FIXED_FILTER_COUNT] = {
+	L"",
+	L"events=4624,4634",
+	L"events=7036,7040-7045;levels=4",
+	L"providers=Service Control Manager, EventLog",
+	L"keywords=0x8020000000000000",
+	L"levels=0-2",
+	L"records=-3;events=4624-4700",
+	L"events=1,3,5,7,9,11,13,15,17,19,21,23,25,27,29,31,33,35,4624,7036",
+};
+
+// The Security events a logon collector asks for, one comparison each in
+// the query the Perl module used to write
+static const LPCWSTR collectedEvents = L"4624,4625,4634,4647,4648,4672,4720,4721,4722,4723,4724,4725,4726,4727,4728,4729,4730,4731,4732,4733,4734,4735,4736,4737,4738,"
+	L"4740,4756,4767,4768,4769,4770,4771,4776,4778,4779,6272,6273,6274,6275,6276,6277,6278,6279,6280";
+
+
+/****
+ * BenchFilter
+ *
+ * DESC:
+ *     Checks what filters compile to, then that reading with a filter
+ *     (ParseEventSource, and an EventCursor) gives exactly the events the
+ *     filter selects, for a set of filters and random ones made from the
+ *     fixture values. Then compares the query the Perl module used to
+ *     write for a list of event IDs with the compiled one: comparisons,
+ *     and the time to test each event against them
+ *
+ * REMARKS:
+ *     Needs the fixtures (the synthetic source does not apply queries);
+ *     --fixtures defaults to "fixtures" and --repeat to 1
+ */
+int BenchFilter(BENCH_OPTIONS *options)
+{
+	int result = 0;
+
+	// What filters compile to, and what is left to check locally
+	static const struct {
+		LPCWSTR spec;
+		LPCWSTR xpath;
+		BOOL residual;
+		DWORD wanted;
+	} compiled[] = {
+		{ L"", L"", FALSE, 0 },
+		{ L" ; ", L"", FALSE, 0 },
+		{ L"records=1200-", L"*[System[EventRecordID >= 1200]]", FALSE, 0 },
+		{ L"records=-1200", L"*[System[EventRecordID <= 1200]]", FALSE, 0 },
+		{ L"records=7", L"*[System[EventRecordID=7]]", FALSE, 0 },
+		{ L"events=4634, 4624-4626 ,4625;records=10-20", L"*[System[((EventID >= 4624 and EventID <= 4626) or EventID=4634) and EventRecordID >= 10 and EventRecordID <= 20]]", FALSE, 0 },
+		{ L"levels=0,1,2,3", L"*[System[Level <= 3]]", FALSE, 0 },
+		{ L"levels=2,4-5", L"*[System[(Level=2 or (Level >= 4 and Level <= 5))]]", FALSE, 0 },
+		{ L"keywords=0x8020000000000000", L"*[System[band(Keywords,9232379236109516800)]]", FALSE, 0 },
+		{ L"providers=O'Brien, Plain,Plain", L"*[System[Provider[@Name=\"O'Brien\" or @Name='Plain']]]", FALSE, 0 },
+		{ L"providers=Both'\"Quotes;levels=1", L"*[System[Level=1]]", TRUE, RECORD_FIELD_SOURCE },
+		{ L"events=1,3,5,7,9,11,13,15,17,19,21,23,25,27,29,31,33", L"*[System[((EventID >= 1 and EventID <= 5) or EventID=7 or EventID=9 or EventID=11 or EventID=13 or EventID=15 or EventID=17 "
+			L"or EventID=19 or EventID=21 or EventID=23 or EventID=25 or EventID=27 or EventID=29 or EventID=31 or EventID=33)]]", TRUE, RECORD_FIELD_EVENT_ID },
+	};
+
+	for( size_t i = 0; i < sizeof(compiled) / sizeof(compiled[0]); i++ ) {
+		EventFilter filter;
+		std::wstring xpath;
+
+		if( !filter.Parse(compiled[i].spec) ) {
+			fprintf(report, "filter: FAILED, '%ls' not parsed\n", compiled[i].spec);
+			result = 1;
+			continue;
+		}
+
+		filter.Compile(&xpath);
+
+		if( xpath != compiled[i].xpath || filter.Residual() != compiled[i].residual || filter.Wanted() != compiled[i].wanted ) {
+			fprintf(report, "filter: MISMATCH, '%ls' compiled to '%ls'%s\n", compiled[i].spec, xpath.c_str(), filter.Residual() ? " (residual)" : "");
+			result = 1;
+		}
+	}
+
+	// Filters that are not understood are refused, not half read
+	static const LPCWSTR refused[] = { L"events=abc", L"events=5-3", L"events=70000", L"levels=40", L"records=20-10", L"keywords=0", L"colour=red", L"events" };
+
+	for( size_t i = 0; i < sizeof(refused) / sizeof(refused[0]); i++ ) {
+		EventFilter filter;
+
+		SetLastError(ERROR_SUCCESS);
+
+		if( filter.Parse(refused[i]) || GetLastError() != ERROR_INVALID_PARAMETER || !filter.Empty() ) {
+			fprintf(report, "filter: FAILED, '%ls' was not refused\n", refused[i]);
+			result = 1;
+		}
+	}
+
+	// The fixture source reads the queries the Perl module and EventCursor write, and refuses others
+	static const struct {
+		LPCWSTR query;
+		BOOL valid;
+	} queries[] = {
+		{ L"*", TRUE },
+		{ L"*[((System/EventRecordID >= 5) and (System/EventRecordID <= 9)) and ((System/EventID = 4624) or (System/EventID = 4634))]", TRUE },
+		{ L"*[(System/EventRecordID > 12) and (System[Provider[@Name != 'EventLog']])]", TRUE },
+		{ L"*[System/Opcode = 1]", FALSE },
+		{ L"Event/System", FALSE },
+		{ L"*[System[EventID = 4624]", FALSE },
+		{ L"*[System[Provider[@Name = 'EventLog'] or EventIDs = 1]]", FALSE },
+	};
+
+	for( size_t i = 0; i < sizeof(queries) / sizeof(queries[0]); i++ ) {
+		XPathQuery query;
+
+		if( query.Parse(queries[i].query) != queries[i].valid ) {
+			fprintf(report, "filter: FAILED, query '%ls' %s\n", queries[i].query, queries[i].valid ? "refused" : "accepted");
+			result = 1;
+		}
+	}
+
+	FixtureSource values(1);
+	FixtureSource *source = new FixtureSource(options->repeat);
+	std::vector<FILTER_EVENT> events;
+
+	if( !LoadFixtures(&values, options, 0) || !source->Load(options->fixtures) || !ReadFilterEvents(&values, &events) ) {
+		delete source;
+		return 1;
+	}
+
+	std::set<std::wstring> channels;
+
+	for( size_t i = 0; i < events.size(); i++ )
+		channels.insert(events[i].channel);
+
+	// Each filter gives the same events through the query and the local check as checked by hand
+	DWORD state = 0x5EED1E55;
+	DWORD checks = 0, residual = 0, mismatches = 0;
+	DWORD64 read = 0;
+
+	for( DWORD k = 0; k < 200; k++ ) {
+		std::wstring spec = k < FIXED_FILTER_COUNT ? fixedFilters[k] : RandomFilter(&state, events);
+		EventFilter filter;
+		std::wstring xpath;
+		XPathQuery query;
+
+		if( !filter.Parse(spec.c_str()) ) {
+			fprintf(report, "filter: FAILED, '%ls' not parsed\n", spec.c_str());
+			result = 1;
+			continue;
+		}
+
+		filter.Compile(&xpath);
+
+		if( filter.Residual() )
+			residual++;
+
+		// The query selects at least the filter's events, and only those unless there is a residual
+		BOOL ok = query.Parse(xpath.c_str());
+
+		for( size_t i = 0; ok && i < events.size(); i++ ) {
+			BOOL wanted = filter.MatchesEvent(events[i].record.recordId, events[i].record.eventId, events[i].record.level, events[i].keywords, events[i].provider.c_str());
+			BOOL selected = query.Matches(&events[i].record, events[i].keywords);
+
+			ok = filter.Residual() ? (selected || !wanted) : selected == wanted;
+		}
+
+		for( std::set<std::wstring>::iterator channel = channels.begin(); ok && channel != channels.end(); ++channel ) {
+			std::vector<DWORD64> expected, distinct;
+
+			for( size_t i = 0; i < events.size(); i++ ) {
+				if( events[i].channel == *channel && filter.MatchesEvent(events[i].record.recordId, events[i].record.eventId, events[i].record.level, events[i].keywords, events[i].provider.c_str()) ) {
+					expected.insert(expected.end(), options->repeat, events[i].record.recordId);
+					distinct.push_back(events[i].record.recordId);
+				}
+			}
+
+			// Read with nothing but the record ID, so the fields the local check needs are read for it
+			COLLECTOR collector;
+			CallbackSink sink(CollectRecord, &collector);
+
+			collector.calls = 0;
+			collector.refuse = 0;
+
+			ParseEventSource(source, channel->c_str(), NULL, OUTPUT_FORMAT_JSON, DEBUG_NONE, options->mode, &sink, RECORD_FIELD_RECORD_ID, &filter);
+
+			std::vector<DWORD64> got = CollectedRecordIds(collector.records);
+
+			std::sort(expected.begin(), expected.end());
+			std::sort(got.begin(), got.end());
+			ok = got == expected;
+
+			// A cursor reads each once, oldest first, and queries again from past the last
+			EVENT_SESSION *session = new EVENT_SESSION(source);
+			EventCursor *cursor = new EventCursor(session);
+
+			session->projection = RECORD_FIELD_RECORD_ID;
+			collector.records.clear();
+
+			if( cursor->StartFiltered(channel->c_str(), &filter, DEBUG_NONE) ) {
+				while( cursor->Read(options->batch, &sink, OUTPUT_FORMAT_JSON, options->mode, DEBUG_NONE) > 0 )
+					;
+			}
+
+			std::sort(distinct.begin(), distinct.end());
+			ok = ok && cursor->Status() == ERROR_SUCCESS && CollectedRecordIds(collector.records) == distinct;
+
+			delete cursor;
+			session->publishers.Clear();
+			delete session;
+
+			read += got.size();
+		}
+
+		checks++;
+
+		if( !ok && mismatches++ < 10 ) {
+			fprintf(report, "filter: MISMATCH with '%ls' (compiled to '%ls')\n", spec.c_str(), xpath.c_str());
+		}
+	}
+
+	fprintf(report, "filter: %u filters checked over %u events in %u logs, %u with a local check, %llu records read\n",
+		checks, (DWORD)events.size(), (DWORD)channels.size(), residual, (unsigned long long)read);
+
+	if( mismatches > 0 ) {
+		fprintf(report, "filter: FAILED, %u mismatches\n", mismatches);
+		result = 1;
+	}
+
+	// The query the Perl module wrote for a list of event IDs against the compiled one
+	std::wstring legacy = L"*[(";
+	std::wstring xpath;
+	EventFilter filter;
+	XPathQuery legacyQuery, compiledQuery;
+
+	for( LPCWSTR id = collectedEvents; *id != L'\0'; ) {
+		LPCWSTR end = wcschr(id, L',');
+
+		legacy += id != collectedEvents ? L" or " : L"";
+		legacy += L"(System/EventID = ";
+		legacy.append(id, end != NULL ? end - id : wcslen(id));
+		legacy += L")";
+		id = end != NULL ? end + 1 : id + wcslen(id);
+	}
+	legacy += L")]";
+
+	filter.Parse((std::wstring(L"events=") + collectedEvents).c_str());
+	filter.Compile(&xpath);
+
+	if( !legacyQuery.Parse(legacy.c_str()) || !compiledQuery.Parse(xpath.c_str()) ) {
+		fprintf(report, "filter: FAILED, the event ID queries were not read\n");
+		delete source;
+		return 1;
+	}
+
+	DWORD passes = 20000;
+	DWORD64 legacySelected, compiledSelected;
+	double legacySeconds = TimeQuery(legacyQuery, events, passes, &legacySelected);
+	double compiledSeconds = TimeQuery(compiledQuery, events, passes, &compiledSelected);
+	double tests = (double)passes * events.size();
+
+	fprintf(report, "  %u event IDs: %u comparisons one per ID, %u compiled%s\n", CountTerms(legacy, L"EventID"), CountTerms(legacy, L"EventID"),
+		CountTerms(xpath, L"EventID"), filter.Residual() ? " (plus the local check)" : "");
+	fprintf(report, "  per event tested: %.1f ns one comparison each, %.1f ns compiled (%.2fx the time)\n",
+		legacySeconds * 1e9 / tests, compiledSeconds * 1e9 / tests, compiledSeconds / legacySeconds);
+
+	// Over budget, the compiled query may select more, never less
+	if( compiledSelected < legacySelected ) {
+		fprintf(report, "filter: FAILED, the compiled query selected %llu events, the one it replaces %llu\n",
+			(unsigned long long)compiledSelected, (unsigned long long)legacySelected);
+		result = 1;
+	}
+
+	delete source;
+
+	return result;
+}
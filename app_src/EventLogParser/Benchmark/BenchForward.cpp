@@ -0,0 +1,253 @@
+#include <algorithm>
+#include <set>
+#include "Benchmark.h"
+#include "LatencySource.h"
+
+
+// Channel BenchForward times, and how many events it adds to the fixtures
+// for the checks (--events are added for the timing)
+#define FORWARD_CHANNEL L"Security"
+#define FORWARD_CHECK_EVENTS 600
+
+// Record and byte budgets each filter is caught up with (0 is no limit)
+static const struct {
+	DWORD records;
+	DWORD bytes;
+} forwardBudgets[] = {
+	{ 0, 0 },
+	{ 1, 0 },
+	{ 37, 0 },
+	{ 0, 1 },
+	{ 0, 9000 },
+	{ 150, 40000 },
+};
+
+
+/****
+ * CatchUp
+ *
+ * DESC:
+ *     Reads a channel oldest first in chunks, each a forward query that
+ *     starts after the record the one before got to, as a collector
+ *     catching up with a log does
+ *
+ * ARGS:
+ *     source - where the events come from
+ *     channel - the log to read
+ *     spec - the events wanted (see EventFilter::Parse)
+ *     maxRecords, maxBytes - the budget of each chunk (see BudgetSink)
+ *     projection - RECORD_FIELD_* flags of the fields each record has
+ *     mode - MODE_* flags the records are read with
+ *     records - receives the records, if not NULL; each chunk's are only
+ *               kept until the next otherwise
+ *     chunks - receives the number of queries
+ *     held - receives the most records held at once
+ *
+ * RETURNS:
+ *     TRUE if every chunk kept to its budget, was in order and said where
+ *     it got to, and the last one read to the end
+ */
+static BOOL CatchUp(EventSource *source, LPCWSTR channel, LPCWSTR spec, DWORD maxRecords, DWORD maxBytes, DWORD projection, INT mode,
+	std::vector<std::wstring> *records, DWORD *chunks, size_t *held)
+{
+	DWORD64 lastRecordId = 0;
+	COLLECTOR collector;
+
+	collector.calls = 0;
+	collector.refuse = 0;
+	*chunks = 0;
+	*held = 0;
+
+	while( TRUE ) {
+		EventFilter filter;
+
+		if( !filter.Parse(spec) )
+			return FALSE;
+
+		if( lastRecordId > 0 && lastRecordId + 1 > filter.LowRecord() )
+			filter.SetLowRecord(lastRecordId + 1);
+
+		CallbackSink collect(CollectRecord, &collector);
+		BudgetSink sink(&collect, maxRecords, maxBytes);
+		DWORD64 next = 0;
+
+		collector.records.clear();
+
+		DWORD64 status = ParseEventSource(source, channel, NULL, OUTPUT_FORMAT_JSON, DEBUG_NONE, mode | MODE_FORWARD, &sink, projection, &filter, &next);
+
+		(*chunks)++;
+		*held = collector.records.size() > *held ? collector.records.size() : *held;
+
+		if( (maxRecords != 0 && collector.records.size() > maxRecords) || (maxBytes != 0 && collector.records.size() > 1 && sink.Used() > maxBytes) )
+			return FALSE;
+
+		if( records != NULL ) {
+			std::vector<DWORD64> ids = CollectedRecordIds(collector.records);
+
+			for( size_t i = 0; i < ids.size(); i++ ) {
+				if( ids[i] <= (i > 0 ? ids[i - 1] : lastRecordId) )
+					return FALSE;
+			}
+
+			if( !ids.empty() && next < ids.back() )
+				return FALSE;
+
+			records->insert(records->end(), collector.records.begin(), collector.records.end());
+		}
+
+		if( status == ERROR_NO_MORE_ITEMS )
+			return TRUE;
+
+		// Stopped by the budget, and somewhere past where it started
+		if( status != ERROR_MORE_DATA || next <= lastRecordId )
+			return FALSE;
+
+		lastRecordId = next;
+	}
+}
+
+
+/****
+ * BenchForward
+ *
+ * DESC:
+ *     Checks that catching up with a log in forward chunks, each stopped
+ *     by a record or byte budget and resumed after the record the last
+ *     one got to, reads exactly what one query reads newest first, in
+ *     reverse, for a set of filters and budgets. Then times catching up
+ *     with --events new events that way against reading them all newest
+ *     first and scanning the records for the highest record ID, as the
+ *     Perl pollers did
+ *
+ * REMARKS:
+ *     Needs the fixtures, as only the fixture source applies the record
+ *     range; --fixtures defaults to "fixtures". Chunks are --batch records
+ */
+int BenchForward(BENCH_OPTIONS *options)
+{
+	int result = 0;
+	FixtureSource fixture(1);
+	std::vector<FILTER_EVENT> events;
+
+	if( !LoadFixtures(&fixture, options, FORWARD_CHECK_EVENTS) )
+		return 1;
+
+	if( !ReadFilterEvents(&fixture, &events) )
+		return 1;
+
+	std::set<std::wstring> channels;
+
+	for( size_t i = 0; i < events.size(); i++ )
+		channels.insert(events[i].channel);
+
+	DWORD state = 0xF0DA7A11;
+	DWORD checks = 0, mismatches = 0;
+	DWORD64 chunksRead = 0;
+
+	for( DWORD k = 0; k < 24; k++ ) {
+		std::wstring spec = k < FIXED_FILTER_COUNT ? fixedFilters[k] : RandomFilter(&state, events);
+
+		for( std::set<std::wstring>::iterator channel = channels.begin(); channel != channels.end(); ++channel ) {
+			EventFilter filter;
+			COLLECTOR reverse;
+			CallbackSink sink(CollectRecord, &reverse);
+
+			filter.Parse(spec.c_str());
+			reverse.calls = 0;
+			reverse.refuse = 0;
+
+			// What one query reads, oldest first
+			ParseEventSource(&fixture, channel->c_str(), NULL, OUTPUT_FORMAT_JSON, DEBUG_NONE, options->mode, &sink, RECORD_FIELDS_ALL, &filter);
+			std::reverse(reverse.records.begin(), reverse.records.end());
+
+			for( size_t b = 0; b < sizeof(forwardBudgets) / sizeof(forwardBudgets[0]); b++ ) {
+				std::vector<std::wstring> forward;
+				DWORD chunks;
+				size_t held;
+
+				BOOL ok = CatchUp(&fixture, channel->c_str(), spec.c_str(), forwardBudgets[b].records, forwardBudgets[b].bytes, RECORD_FIELDS_ALL, options->mode, &forward, &chunks, &held);
+
+				checks++;
+				chunksRead += chunks;
+
+				if( (!ok || forward != reverse.records) && mismatches++ < 10 ) {
+					fprintf(report, "forward: MISMATCH on %ls with '%ls', %u records and %u bytes a chunk: %llu records in %u chunks, %llu expected\n",
+						channel->c_str(), spec.c_str(), forwardBudgets[b].records, forwardBudgets[b].bytes,
+						(unsigned long long)forward.size(), chunks, (unsigned long long)reverse.records.size());
+				}
+			}
+		}
+	}
+
+	fprintf(report, "forward: %u catch-ups checked over %u events in %u logs, %llu chunks read\n",
+		checks, (DWORD)events.size(), (DWORD)channels.size(), (unsigned long long)chunksRead);
+
+	if( mismatches > 0 ) {
+		fprintf(report, "forward: FAILED, %u mismatches\n", mismatches);
+		return 1;
+	}
+
+	// Catching up with --events new events, through round trips
+	FixtureSource timed(1);
+	DWORD64 start;
+
+	LoadFixtures(&timed, options, (DWORD)options->events, &start);
+
+	LatencySource source(&timed, options->nextMs, options->perEventUs);
+	WCHAR spec[32];
+
+	swprintf(spec, sizeof(spec) / sizeof(spec[0]), L"records=%llu-", (unsigned long long)start);
+
+	// Newest first, all at once, then the highest record ID looked for
+	std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+	EventFilter filter;
+	COLLECTOR all;
+	CallbackSink sink(CollectRecord, &all);
+	DWORD64 highest = 0;
+
+	all.calls = 0;
+	all.refuse = 0;
+	filter.Parse(spec);
+
+	ParseEventSource(&source, FORWARD_CHANNEL, NULL, OUTPUT_FORMAT_JSON, DEBUG_NONE, options->mode, &sink, RECORD_FIELDS_ALL, &filter);
+
+	double reverseSeconds = Seconds(started);
+
+	started = std::chrono::steady_clock::now();
+
+	for( size_t i = 0; i < all.records.size(); i++ ) {
+		std::map<std::wstring, std::wstring> values;
+
+		if( ReadJsonRecord(all.records[i], &values) ) {
+			DWORD64 id = _wcstoui64(values[L"record_id"].c_str(), NULL, 10);
+
+			highest = id > highest ? id : highest;
+		}
+	}
+
+	double scanSeconds = Seconds(started);
+
+	// Oldest first, a chunk at a time
+	DWORD chunks;
+	size_t held;
+
+	started = std::chrono::steady_clock::now();
+
+	BOOL ok = CatchUp(&source, FORWARD_CHANNEL, spec, options->batch, 0, RECORD_FIELDS_ALL, options->mode, NULL, &chunks, &held);
+
+	double forwardSeconds = Seconds(started);
+
+	if( !ok || all.records.empty() ) {
+		fprintf(report, "forward: FAILED, catching up with %llu %ls events\n", (unsigned long long)all.records.size(), FORWARD_CHANNEL);
+		return 1;
+	}
+
+	fprintf(report, "forward: %llu %ls events to catch up with, %u ms per round trip\n",
+		(unsigned long long)all.records.size(), FORWARD_CHANNEL, options->nextMs);
+	fprintf(report, "  newest first:        %.3f s to read, %.3f s to find record %llu, %llu records held\n",
+		reverseSeconds, scanSeconds, (unsigned long long)highest, (unsigned long long)all.records.size());
+	fprintf(report, "  forward, %u a chunk: %.3f s in %u queries, %llu records held at most\n",
+		options->batch, forwardSeconds, chunks, (unsigned long long)held);
+
+	return result;
+}
@@ -0,0 +1,217 @@
+#include "Benchmark.h"
+
+
+/****
+ * IDENTITY_EXPECTED
+ *
+ * DESC:
+ *     The identity each fixture logon, logoff and NPS event should give,
+ *     worked out by hand from its EventData and what userNameFlow sent.
+ *     fixtures/identity has the same events in en-US, fr-FR and de-DE
+ *     (record IDs 2000001, 3000001 and 4000001 on); the 6279s are there
+ *     to give no identity at all
+ */
+struct IDENTITY_EXPECTED {
+	DWORD64 recordId;
+	LPCWSTR user, domain, logonId, logonType, source, workstation, state;
+};
+
+static const IDENTITY_EXPECTED identityExpected[] = {
+	// fixtures
+	{ 1284012, L"alice", L"CORP", L"0x8dcdc", L"3", L"10.1.2.30", L"-", L"0" },
+	{ 1284020, L"J\u00fcrgen.M\u00fcller", L"CORP", L"0x91a2f", L"10", L"192.168.40.17", L"DC01", L"0" },
+	{ 1284040, L"alice", L"CORP", L"0x8dcdc", L"3", L"0.0.0.255", L"", L"2" },
+	{ 1284044, L"J\u00fcrgen.M\u00fcller", L"CORP", L"0x91a2f", L"255", L"0.0.0.255", L"", L"2" },
+	{ 1284051, L"CORP\\bob", L"CORP", L"3930313345303334", L"200", L"a4-5e-60-c1-22-09", L"", L"0" },
+	{ 1284052, L"CORP\\bob", L"CORP", L"3930313345303334", L"200", L"a4-5e-60-c1-22-09", L"", L"3" },
+	{ 1284053, L"CORP\\bob", L"CORP", L"3930313345303334", L"200", L"a4-5e-60-c1-22-09", L"", L"1" },
+
+	// fixtures/identity, en-US (a Windows 2008 4624, version 0)
+	{ 2000001, L"carol", L"CORP", L"0x1a2b3", L"2", L"127.0.0.1", L"WS2008", L"0" },
+	{ 2000002, L"carol", L"CORP", L"0x1a2b3", L"2", L"0.0.0.255", L"", L"2" },
+	{ 2000003, L"carol", L"CORP", L"0x1a2b3", L"255", L"0.0.0.255", L"", L"2" },
+	{ 2000004, L"CORP\\dave", L"CORP", L"3930314130303132", L"201", L"10.30.0.44", L"", L"0" },
+	{ 2000005, L"CORP\\dave", L"CORP", L"3930314130303132", L"201", L"10.30.0.44", L"", L"3" },
+	{ 2000006, L"CORP\\dave", L"CORP", L"3930314130303132", L"201", L"10.30.0.44", L"", L"4" },
+	{ 2000007, L"CORP\\dave", L"CORP", L"3930314130303132", L"201", L"10.30.0.44", L"", L"1" },
+
+	// fr-FR
+	{ 3000001, L"fran\u00e7ois.dupr\u00e9", L"ENTREPRISE", L"0x3c9f1", L"3", L"172.16.8.21", L"PC-COMPTA", L"0" },
+	{ 3000002, L"fran\u00e7ois.dupr\u00e9", L"ENTREPRISE", L"0x3c9f1", L"3", L"0.0.0.255", L"", L"2" },
+	{ 3000003, L"fran\u00e7ois.dupr\u00e9", L"ENTREPRISE", L"0x3c9f1", L"255", L"0.0.0.255", L"", L"2" },
+	{ 3000004, L"ENTREPRISE\\h\u00e9l\u00e8ne", L"ENTREPRISE", L"3841424330303031", L"202", L"d8-cb-8a-10-7e-02", L"", L"0" },
+	{ 3000005, L"ENTREPRISE\\h\u00e9l\u00e8ne", L"ENTREPRISE", L"3841424330303031", L"202", L"d8-cb-8a-10-7e-02", L"", L"3" },
+	{ 3000006, L"ENTREPRISE\\h\u00e9l\u00e8ne", L"ENTREPRISE", L"3841424330303031", L"202", L"d8-cb-8a-10-7e-02", L"", L"4" },
+	{ 3000007, L"ENTREPRISE\\h\u00e9l\u00e8ne", L"ENTREPRISE", L"3841424330303031", L"202", L"d8-cb-8a-10-7e-02", L"", L"1" },
+
+	// de-DE (PAP is not one of the RADIUS types Scrutinizer knows)
+	{ 4000001, L"J\u00f6rg.Wei\u00df", L"FIRMA", L"0x7d0e4", L"11", L"-", L"NB-JWEISS", L"0" },
+	{ 4000002, L"J\u00f6rg.Wei\u00df", L"FIRMA", L"0x7d0e4", L"11", L"0.0.0.255", L"", L"2" },
+	{ 4000003, L"J\u00f6rg.Wei\u00df", L"FIRMA", L"0x7d0e4", L"255", L"0.0.0.255", L"", L"2" },
+	{ 4000004, L"FIRMA\\m\u00fcller", L"FIRMA", L"3130303030303939", L"255", L"3c-52-82-aa-19-f0", L"", L"0" },
+	{ 4000005, L"FIRMA\\m\u00fcller", L"FIRMA", L"3130303030303939", L"255", L"3c-52-82-aa-19-f0", L"", L"3" },
+	{ 4000006, L"FIRMA\\m\u00fcller", L"FIRMA", L"3130303030303939", L"255", L"3c-52-82-aa-19-f0", L"", L"4" },
+	{ 4000007, L"FIRMA\\m\u00fcller", L"FIRMA", L"3130303030303939", L"255", L"3c-52-82-aa-19-f0", L"", L"1" },
+};
+
+
+// The "identity/" members a record should have, keyed the way ReadJsonRecord keys them
+static BOOL ExpectedIdentity(DWORD64 recordId, std::map<std::wstring, std::wstring> *values)
+{
+	values->clear();
+
+	for( size_t i = 0; i < sizeof(identityExpected) / sizeof(identityExpected[0]); i++ ) {
+		const IDENTITY_EXPECTED *expected = &identityExpected[i];
+
+		if( expected->recordId != recordId )
+			continue;
+
+		(*values)[L"identity/user"] = expected->user;
+		(*values)[L"identity/domain"] = expected->domain;
+		(*values)[L"identity/logon_id"] = expected->logonId;
+		(*values)[L"identity/logon_type"] = expected->logonType;
+		(*values)[L"identity/source"] = expected->source;
+		(*values)[L"identity/workstation"] = expected->workstation;
+		(*values)[L"identity/state"] = expected->state;
+
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
+
+// Moves the "identity/" members of a parsed record into their own map
+static void SplitIdentity(std::map<std::wstring, std::wstring> *record, std::map<std::wstring, std::wstring> *identity)
+{
+	const std::wstring prefix = L"identity/";
+
+	identity->clear();
+
+	for( std::map<std::wstring, std::wstring>::iterator it = record->begin(); it != record->end(); ) {
+		if( it->first.compare(0, prefix.size(), prefix) == 0 ) {
+			(*identity)[it->first] = it->second;
+			record->erase(it++);
+		} else {
+			++it;
+		}
+	}
+}
+
+
+/****
+ * BenchIdentity
+ *
+ * DESC:
+ *     Checks the "identity" object of every record, on the values and the
+ *     XML path, and that the rest of the record is what it is without it.
+ *     Then times reading the log with identities, against reading it plain
+ *     and with every EventData field
+ *
+ * REMARKS:
+ *     With --fixtures, every record must have exactly the identity
+ *     identityExpected gives its record ID, or none if it is not listed.
+ *     Synthetic events have no expectations, so only the rest of the
+ *     record is checked
+ */
+int BenchIdentity(BENCH_OPTIONS *options)
+{
+	int result = 0;
+	DWORD64 events = 0;
+	EventSource *source = OpenSource(options, &events);
+
+	if( source == NULL )
+		return 1;
+
+	INT modes[] = { options->mode & ~MODE_RENDER_XML, options->mode | MODE_RENDER_XML };
+	EVENT_SESSION *base = new EVENT_SESSION(source);
+	EVENT_SESSION *sessions[2];
+
+	for( int k = 0; k < 2; k++ )
+		sessions[k] = new EVENT_SESSION(source);
+
+	COLLECTOR collector;
+	CallbackSink sink(CollectRecord, &collector);
+	DWORD64 count = 0, withIdentity = 0, mismatches = 0;
+
+	collector.calls = 0;
+	collector.refuse = 0;
+
+	EVT_HANDLE hResults = source->Query(NULL, NULL, EvtQueryChannelPath | EvtQueryReverseDirection);
+	EVT_HANDLE hEvents[BATCH_SIZE_MAX];
+	DWORD dwReturned;
+
+	while( source->Next(hResults, BATCH_SIZE_MAX, hEvents, INFINITE, &dwReturned) && dwReturned > 0 ) {
+		for( DWORD i = 0; i < dwReturned; i++, count++ ) {
+			std::map<std::wstring, std::wstring> baseRecord, record, expected, found;
+
+			collector.records.clear();
+
+			DumpEventInfo(base, hEvents[i], &sink, OUTPUT_FORMAT_JSON, modes[0], DEBUG_NONE);
+			for( int k = 0; k < 2; k++ )
+				DumpEventInfo(sessions[k], hEvents[i], &sink, OUTPUT_FORMAT_JSON, modes[k] | MODE_IDENTITY, DEBUG_NONE);
+
+			BOOL ok = collector.records.size() == 3 && ReadJsonRecord(collector.records[0], &baseRecord);
+			BOOL listed = ok && ExpectedIdentity(_wcstoui64(baseRecord[L"record_id"].c_str(), NULL, 10), &expected);
+
+			for( int k = 0; ok && k < 2; k++ ) {
+				ok = ReadJsonRecord(collector.records[k + 1], &record);
+
+				SplitIdentity(&record, &found);
+
+				ok = ok && record == baseRecord && (options->fixtures == NULL || found == expected);
+
+				if( k == 0 && !found.empty() )
+					withIdentity++;
+			}
+
+			if( !ok && mismatches++ < 10 ) {
+				fprintf(report, "identity: MISMATCH on event %llu (record %ls%s)\n", (unsigned long long)count + 1,
+					baseRecord[L"record_id"].c_str(), listed ? "" : ", not listed");
+			}
+
+			source->Close(hEvents[i]);
+		}
+	}
+	source->Close(hResults);
+
+	base->publishers.Clear();
+	delete base;
+
+	for( int k = 0; k < 2; k++ ) {
+		sessions[k]->publishers.Clear();
+		delete sessions[k];
+	}
+
+	// Reading the whole log plain, with identities, and with every EventData
+	// field (what userNameFlow had to make do with before)
+	const INT timed[] = { MODE_DEFAULT, MODE_IDENTITY, MODE_EVENT_DATA };
+	const char *timedNames[] = { "none", "identity", "eventdata" };
+	double seconds[3];
+
+	for( int t = 0; t < 3; t++ ) {
+		EVENT_SESSION session(source);
+
+		if( TimeDump(&session, options->mode | timed[t], &seconds[t]) != events )
+			result = 1;
+
+		session.publishers.Clear();
+	}
+
+	delete source;
+
+	fprintf(report, "identity: %llu events (%s, %s), %llu with an identity\n", (unsigned long long)count,
+		options->fixtures != NULL ? "fixtures" : "synthetic", (options->mode & MODE_RENDER_XML) ? "xml" : "values", (unsigned long long)withIdentity);
+
+	for( int t = 0; t < 3; t++ ) {
+		fprintf(report, "  %-9s %.3f s, %.0f events/s (%.2fx the time)\n", timedNames[t], seconds[t], events / seconds[t], seconds[t] / seconds[0]);
+	}
+
+	if( mismatches > 0 || count != events || withIdentity == 0 ) {
+		fprintf(report, "identity: FAILED, %llu mismatches, %llu of %llu events read, %llu with an identity\n",
+			(unsigned long long)mismatches, (unsigned long long)count, (unsigned long long)events, (unsigned long long)withIdentity);
+		result = 1;
+	}
+
+	return result;
+}
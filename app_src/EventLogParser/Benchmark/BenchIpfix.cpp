@@ -0,0 +1,698 @@
+#include <string.h>
+#include "Benchmark.h"
+#include "EventCursor.h"
+#include "SyntheticSource.h"
+#include "Utf8Encode.h"
+
+
+// Set sizes the ipfix bench writes with: sets as large as they go, so that
+// no fixture message is cut, then the default, then the smallest, so that
+// most are
+static const DWORD ipfixSetSizes[] = { IPFIX_SET_BYTES_MAX, IPFIX_SET_BYTES_DEFAULT, IPFIX_SET_BYTES_MIN };
+
+#define IPFIX_SET_SIZE_COUNT (sizeof(ipfixSetSizes) / sizeof(ipfixSetSizes[0]))
+
+// Set size of the cursor check, so that each read packs several sets
+#define IPFIX_CHECK_SET_BYTES 512
+
+// Lengths of the made-up messages the length check writes, around where
+// the length takes three bytes and where it no longer fits in 16 bits
+static const DWORD ipfixMessageLengths[] = { 0, 1, 63, 64, 253, 254, 255, 256, 1000, 65000, 65535, 65536, 70000 };
+
+// Characters the made-up messages are made of: one, two, three and four
+// bytes of UTF-8 each (the last is one WCHAR where the bench builds)
+static const WCHAR ipfixMessageChars[] = { L'x', 0x00E9, 0x20AC, (WCHAR)0x1F600 };
+
+// The EpEventLog fields, in template order, as FDD::IPFIX packs them: the
+// length of each (0xFFFF for variable) and whether it is a string
+static const struct {
+	DWORD length;
+	BOOL text;
+} fileLineFields[] = {
+	{ IPFIX_MACHINE_ID_BYTES, TRUE },
+	{ 0xFFFF, TRUE },
+	{ 4, FALSE },
+	{ 8, FALSE },
+	{ 8, FALSE },
+	{ 0xFFFF, TRUE },
+	{ 0xFFFF, TRUE },
+	{ 8, FALSE },
+	{ 1, FALSE },
+};
+
+#define FILE_LINE_FIELD_COUNT (sizeof(fileLineFields) / sizeof(fileLineFields[0]))
+
+// The longest string FDD::IPFIX sends; it cuts the rest
+#define FDD_STRING_MAX 254
+
+
+BOOL GetIpfixNumber(const BYTE **at, const BYTE *end, size_t n, DWORD64 *number)
+{
+	if( (size_t)(end - *at) < n )
+		return FALSE;
+
+	*number = 0;
+	for( size_t i = 0; i < n; i++ )
+		*number = (*number << 8) | (*at)[i];
+	*at += n;
+
+	return TRUE;
+}
+
+
+BOOL GetIpfixString(const BYTE **at, const BYTE *end, size_t fixed, std::string *text)
+{
+	DWORD64 length = fixed;
+
+	if( fixed == 0 ) {
+		if( !GetIpfixNumber(at, end, 1, &length) )
+			return FALSE;
+		if( length == IPFIX_LONG_LENGTH && (!GetIpfixNumber(at, end, 2, &length) || length <= IPFIX_SHORT_LENGTH_MAX) )
+			return FALSE;
+	}
+
+	if( (DWORD64)(end - *at) < length )
+		return FALSE;
+
+	text->assign((const char *)*at, (size_t)length);
+	*at += length;
+
+	return TRUE;
+}
+
+
+/****
+ * DecodeIpfixRecord
+ *
+ * DESC:
+ *     Takes one EpEventLog record, or EpEventLogFlow record if merged is
+ *     set, apart, as a collector would. A length in three bytes must be
+ *     one that would not have fit in one
+ */
+BOOL DecodeIpfixRecord(const BYTE **at, const BYTE *end, BOOL merged, IPFIX_FIELDS *record)
+{
+	BOOL ok = GetIpfixString(at, end, IPFIX_MACHINE_ID_BYTES, &record->machineId)
+		&& GetIpfixString(at, end, 0, &record->logName)
+		&& GetIpfixNumber(at, end, 4, &record->seconds)
+		&& GetIpfixNumber(at, end, 8, &record->recordId)
+		&& GetIpfixNumber(at, end, 8, &record->eventId)
+		&& GetIpfixString(at, end, 0, &record->source)
+		&& GetIpfixString(at, end, 0, &record->message)
+		&& GetIpfixNumber(at, end, 8, &record->count)
+		&& (!merged || (GetIpfixNumber(at, end, 4, &record->firstSeconds) && GetIpfixNumber(at, end, 4, &record->lastSeconds)))
+		&& GetIpfixNumber(at, end, 1, &record->rollable);
+
+	if( ok && !merged )
+		record->firstSeconds = record->lastSeconds = record->seconds;
+	record->merged = merged;
+
+	return ok;
+}
+
+
+/****
+ * ReadIpfixSets
+ *
+ * DESC:
+ *     Takes the data sets IpfixSetSink packed apart into their records.
+ *     Every set must have the ID of EpEventLog or EpEventLogFlow, be no
+ *     larger than maxSetBytes and hold whole records only
+ *
+ * ARGS:
+ *     sizes - receives the size of each record, if not NULL
+ */
+BOOL ReadIpfixSets(const BYTE *data, size_t bytes, DWORD maxSetBytes, std::vector<IPFIX_FIELDS> *records, std::vector<size_t> *sizes, DWORD *sets)
+{
+	const BYTE *at = data;
+	const BYTE *end = data + bytes;
+
+	*sets = 0;
+
+	while( at < end ) {
+		DWORD64 id = 0, length = 0;
+
+		if( !GetIpfixNumber(&at, end, 2, &id) || !GetIpfixNumber(&at, end, 2, &length)
+			|| (id != IPFIX_CHECK_TEMPLATE && id != IPFIX_CHECK_FLOW_TEMPLATE)
+			|| length <= IPFIX_SET_HEADER || length > maxSetBytes || length - IPFIX_SET_HEADER > (DWORD64)(end - at) )
+			return FALSE;
+
+		const BYTE *setEnd = at + length - IPFIX_SET_HEADER;
+
+		while( at < setEnd ) {
+			const BYTE *start = at;
+			IPFIX_FIELDS record;
+
+			if( !DecodeIpfixRecord(&at, setEnd, id == IPFIX_CHECK_FLOW_TEMPLATE, &record) )
+				return FALSE;
+
+			records->push_back(record);
+			if( sizes != NULL )
+				sizes->push_back(at - start);
+		}
+
+		(*sets)++;
+	}
+
+	return TRUE;
+}
+
+
+// Wide text as UTF-8, with carriage returns and line feeds made spaces as
+// fileLine does
+std::string FileLineText(const std::wstring &text)
+{
+	std::string out(text.size() * UTF8_MAX_GROWTH, '\0');
+
+	out.resize(WideToUtf8(text.c_str(), text.size(), &out[0]));
+
+	for( size_t i = 0; i < out.size(); i++ ) {
+		if( out[i] == '\r' || out[i] == '\n' )
+			out[i] = ' ';
+	}
+
+	return out;
+}
+
+
+// Unix seconds of a SystemTime, as fileLine's timegm gives them
+DWORD64 FileLineSeconds(const std::wstring &text)
+{
+	ULONGLONG fileTime = 0;
+
+	if( !ParseSystemTime(text.c_str(), &fileTime) )
+		return 0;
+
+	return fileTime / FILETIME_TICKS_PER_SECOND - (DWORD64)FILETIME_EPOCH_DAYS * 86400;
+}
+
+
+/****
+ * FileLineOf
+ *
+ * DESC:
+ *     The fields fileLine sends for the JSON record of an event
+ */
+static void FileLineOf(std::map<std::wstring, std::wstring> &json, IPFIX_FIELDS *fields)
+{
+	std::string machine = FileLineText(IPFIX_CHECK_MACHINE);
+
+	machine.resize(IPFIX_MACHINE_ID_BYTES, '\0');
+
+	fields->machineId = machine;
+	fields->logName = FileLineText(json[L"logname"]);
+	fields->seconds = FileLineSeconds(json[L"time_created"]);
+	fields->recordId = _wcstoui64(json[L"record_id"].c_str(), NULL, 10);
+	fields->eventId = _wcstoui64(json[L"event_id"].c_str(), NULL, 10);
+	fields->source = FileLineText(json[L"source"]);
+	fields->message = FileLineText(json[L"message"]);
+	fields->count = IPFIX_MESSAGE_COUNT;
+	fields->firstSeconds = fields->seconds;
+	fields->lastSeconds = fields->seconds;
+	fields->rollable = IPFIX_ROLLABLE;
+	fields->merged = FALSE;
+}
+
+
+/****
+ * CutShort
+ *
+ * DESC:
+ *     Whether a string is the start of another, cut at a whole UTF-8
+ *     character
+ */
+BOOL CutShort(const std::string &text, const std::string &whole)
+{
+	if( text.size() > whole.size() || whole.compare(0, text.size(), text) != 0 )
+		return FALSE;
+
+	return text.size() == whole.size() || ((BYTE)whole[text.size()] & 0xC0) != 0x80;
+}
+
+
+/****
+ * SameAsFileLine
+ *
+ * DESC:
+ *     Checks a record against the fields fileLine would have sent. With
+ *     cut set the strings may be cut short, as long as the record then
+ *     could not have held another character of them
+ */
+static BOOL SameAsFileLine(const IPFIX_FIELDS *record, const IPFIX_FIELDS *expected, size_t size, DWORD maxSetBytes, BOOL cut)
+{
+	if( record->machineId != expected->machineId || record->seconds != expected->seconds || record->recordId != expected->recordId
+		|| record->eventId != expected->eventId || record->count != expected->count || record->firstSeconds != expected->firstSeconds
+		|| record->lastSeconds != expected->lastSeconds || record->rollable != expected->rollable || record->merged )
+		return FALSE;
+
+	if( !cut )
+		return record->logName == expected->logName && record->source == expected->source && record->message == expected->message;
+
+	if( !CutShort(record->logName, expected->logName) || !CutShort(record->source, expected->source) || !CutShort(record->message, expected->message) )
+		return FALSE;
+
+	// Another character is at most 4 bytes, and 2 more if the length then
+	// takes three
+	BOOL shortened = record->logName != expected->logName || record->source != expected->source || record->message != expected->message;
+
+	return !shortened || IPFIX_SET_HEADER + size + UTF8_MAX_GROWTH + 2 > maxSetBytes;
+}
+
+
+/****
+ * PackFileLine
+ *
+ * DESC:
+ *     Packs a fileLine, the ':-:' separated fields of an event, into an
+ *     EpEventLog record as FDD::IPFIX does: split again, numbers packed
+ *     from their text and strings longer than 254 bytes cut. This is the
+ *     way records go out without OUTPUT_FORMAT_IPFIX, less the spool file
+ *     and Perl's own costs
+ *
+ * RETURNS:
+ *     FALSE if the line does not have the template's fields
+ */
+static BOOL PackFileLine(const std::string &line, std::vector<BYTE> *out)
+{
+	size_t start = 0;
+
+	for( size_t f = 0; f < FILE_LINE_FIELD_COUNT; f++ )
+	{
+		size_t end = f + 1 < FILE_LINE_FIELD_COUNT ? line.find(":-:", start) : line.size();
+
+		if( end == std::string::npos )
+			return FALSE;
+
+		const char *text = line.data() + start;
+		size_t length = end - start;
+
+		if( !fileLineFields[f].text ) {
+			DWORD64 number = strtoull(std::string(text, length).c_str(), NULL, 10);
+
+			for( DWORD i = fileLineFields[f].length; i > 0; i-- )
+				out->push_back((BYTE)(number >> (8 * (i - 1))));
+		} else if( fileLineFields[f].length != 0xFFFF ) {
+			for( DWORD i = 0; i < fileLineFields[f].length; i++ )
+				out->push_back(i < length ? (BYTE)text[i] : 0);
+		} else {
+			if( length > FDD_STRING_MAX )
+				length = FDD_STRING_MAX;
+
+			out->push_back((BYTE)length);
+			out->insert(out->end(), (const BYTE *)text, (const BYTE *)text + length);
+		}
+
+		start = end + 3;
+	}
+
+	return TRUE;
+}
+
+
+/****
+ * JoinFileLine
+ *
+ * DESC:
+ *     The fileLine of a JSON record, as ipfixify::parse::fileLine joins it
+ */
+static std::string JoinFileLine(std::map<std::wstring, std::wstring> &json)
+{
+	char number[24];
+	std::string line = FileLineText(IPFIX_CHECK_MACHINE);
+
+	line += ":-:" + FileLineText(json[L"logname"]);
+	snprintf(number, sizeof(number), "%llu", (unsigned long long)FileLineSeconds(json[L"time_created"]));
+	line += ":-:";
+	line += number;
+	line += ":-:" + FileLineText(json[L"record_id"]);
+	line += ":-:" + FileLineText(json[L"event_id"]);
+	line += ":-:" + FileLineText(json[L"source"]);
+	line += ":-:" + FileLineText(json[L"message"]);
+	line += ":-:1:-:1";
+
+	return line;
+}
+
+
+/****
+ * CheckIpfixLengths
+ *
+ * DESC:
+ *     Writes made-up events whose messages are of every length in
+ *     ipfixMessageLengths, in characters of each width, and checks that
+ *     each message comes back whole, with its length in one byte up to
+ *     254 and in three past it, or cut at a whole character where the
+ *     record would not have fit. A message with line breaks has them made
+ *     spaces
+ *
+ * RETURNS:
+ *     The number of messages it got wrong
+ */
+static DWORD CheckIpfixLengths()
+{
+	IPFIX_EXPORT exporter;
+	GrowBuffer buffer;
+	SYSTEM_FIELDS fields;
+	DWORD wrong = 0;
+
+	SetIpfixMachineId(&exporter, IPFIX_CHECK_MACHINE);
+	exporter.templateId = IPFIX_CHECK_TEMPLATE;
+	exporter.maxSetBytes = IPFIX_SET_BYTES_MAX;
+
+	memset(&fields, 0, sizeof(fields));
+	fields.recordId = L"42";
+	fields.recordIdValue = 42;
+	fields.eventId = L"4624";
+	fields.channel = L"Security";
+	fields.provider = L"Microsoft-Windows-Security-Auditing";
+	fields.timeCreated = L"2014-03-07T18:22:10.4801256Z";
+
+	std::map<std::wstring, std::wstring> json;
+
+	json[L"record_id"] = fields.recordId;
+	json[L"event_id"] = fields.eventId;
+	json[L"logname"] = fields.channel;
+	json[L"source"] = fields.provider;
+	json[L"time_created"] = fields.timeCreated;
+
+	for( size_t c = 0; c < sizeof(ipfixMessageChars) / sizeof(ipfixMessageChars[0]); c++ ) {
+		for( size_t l = 0; l <= sizeof(ipfixMessageLengths) / sizeof(ipfixMessageLengths[0]); l++ ) {
+			// The last one has line breaks in it
+			std::wstring message = l < sizeof(ipfixMessageLengths) / sizeof(ipfixMessageLengths[0])
+				? std::wstring(ipfixMessageLengths[l], ipfixMessageChars[c]) : std::wstring(L"one\r\ntwo\nthree") + ipfixMessageChars[c];
+			IPFIX_FIELDS expected, record;
+			DWORD bytes = 0;
+
+			json[L"message"] = message;
+			FileLineOf(json, &expected);
+
+			if( !EncodeIpfixRecord(&buffer, &fields, message.c_str(), &exporter, &bytes) ) {
+				wrong++;
+				continue;
+			}
+
+			const BYTE *at = (const BYTE *)buffer.Data();
+			const BYTE *end = at + bytes;
+			BOOL ok = DecodeIpfixRecord(&at, end, FALSE, &record) && at == end && IPFIX_SET_HEADER + bytes <= exporter.maxSetBytes
+				&& SameAsFileLine(&record, &expected, bytes, exporter.maxSetBytes, TRUE);
+
+			// Only what could not fit is cut
+			if( ok && IPFIX_SET_HEADER + IPFIX_RECORD_FIXED_BYTES + 3 * IPFIX_LONG_LENGTH_BYTES + expected.logName.size()
+					+ expected.source.size() + expected.message.size() <= exporter.maxSetBytes )
+				ok = record.message == expected.message;
+
+			// The message's length is the last but 9 bytes of the record
+			size_t lengthAt = bytes - 9 - record.message.size();
+
+			if( ok )
+				ok = record.message.size() <= IPFIX_SHORT_LENGTH_MAX ? ((const BYTE *)buffer.Data())[lengthAt - 1] == record.message.size()
+					: ((const BYTE *)buffer.Data())[lengthAt - 3] == IPFIX_LONG_LENGTH;
+
+			if( !ok && wrong++ < 10 ) {
+				fprintf(report, "ipfix: MISMATCH on a message of %u characters of %u bytes (%u of %u bytes came back)\n",
+					(DWORD)message.size(), (DWORD)(c + 1), (DWORD)record.message.size(), (DWORD)expected.message.size());
+			}
+		}
+	}
+
+	return wrong;
+}
+
+
+/****
+ * BenchIpfix
+ *
+ * DESC:
+ *     Checks the IPFIX data records of every event, on the values and the
+ *     XML path, against the fields fileLine would have sent for its JSON
+ *     record: whole in sets as large as they go, then cut where a smaller
+ *     set could not hold them. Then messages of every length, and a cursor
+ *     read into a small buffer. Finally times writing the records straight
+ *     away against the way they went before: JSON, taken apart, joined
+ *     into a fileLine, split again and packed
+ */
+int BenchIpfix(BENCH_OPTIONS *options)
+{
+	int result = 0;
+	DWORD64 events = 0;
+	EventSource *source = OpenSource(options, &events);
+
+	if( source == NULL )
+		return 1;
+
+	EVENT_SESSION *sessions[IPFIX_SET_SIZE_COUNT][2];
+
+	for( size_t k = 0; k < IPFIX_SET_SIZE_COUNT; k++ ) {
+		for( int path = 0; path < 2; path++ ) {
+			sessions[k][path] = new EVENT_SESSION(source);
+			SetIpfixMachineId(&sessions[k][path]->ipfix, IPFIX_CHECK_MACHINE);
+			sessions[k][path]->ipfix.templateId = IPFIX_CHECK_TEMPLATE;
+			sessions[k][path]->ipfix.maxSetBytes = ipfixSetSizes[k];
+		}
+	}
+
+	COLLECTOR collector;
+	CallbackSink jsonSink(CollectRecord, &collector);
+	std::vector<BYTE> sets(IPFIX_SET_BYTES_MAX);
+	DWORD64 count = 0, mismatches = 0, cut = 0, longMessages = 0, sameAsFdd = 0, longerThanFdd = 0;
+
+	collector.calls = 0;
+	collector.refuse = 0;
+
+	EVT_HANDLE hResults = source->Query(NULL, NULL, EvtQueryChannelPath | EvtQueryReverseDirection);
+	EVT_HANDLE hEvents[BATCH_SIZE_MAX];
+	DWORD dwReturned;
+
+	while( source->Next(hResults, BATCH_SIZE_MAX, hEvents, INFINITE, &dwReturned) && dwReturned > 0 ) {
+		for( DWORD i = 0; i < dwReturned; i++, count++ ) {
+			for( size_t k = 0; k < IPFIX_SET_SIZE_COUNT; k++ ) {
+				for( int path = 0; path < 2; path++ ) {
+					EVENT_SESSION *session = sessions[k][path];
+					INT mode = path == 0 ? options->mode & ~MODE_RENDER_XML : options->mode | MODE_RENDER_XML;
+					IpfixSetSink setSink(sets.data(), (DWORD)sets.size(), IPFIX_CHECK_TEMPLATE, ipfixSetSizes[k]);
+					std::map<std::wstring, std::wstring> json;
+					std::vector<IPFIX_FIELDS> records;
+					std::vector<size_t> sizes;
+					IPFIX_FIELDS expected;
+					DWORD setCount = 0;
+
+					collector.records.clear();
+
+					DumpEventInfo(session, hEvents[i], &jsonSink, OUTPUT_FORMAT_JSON, mode, DEBUG_NONE);
+					DumpEventInfo(session, hEvents[i], &setSink, OUTPUT_FORMAT_IPFIX, mode, DEBUG_NONE);
+
+					BOOL ok = collector.records.size() == 1 && ReadJsonRecord(collector.records[0], &json)
+						&& ReadIpfixSets(sets.data(), setSink.Used(), ipfixSetSizes[k], &records, &sizes, &setCount)
+						&& records.size() == 1 && setCount == 1;
+
+					if( ok ) {
+						FileLineOf(json, &expected);
+						ok = SameAsFileLine(&records[0], &expected, sizes[0], ipfixSetSizes[k], k > 0);
+					}
+
+					if( ok && k > 0 && path == 0 && records[0].message != expected.message )
+						cut++;
+
+					// Set apart from the check: the record as FDD::IPFIX
+					// would have packed it from the fileLine
+					if( ok && k == 0 && path == 0 ) {
+						std::vector<BYTE> packed;
+						const BYTE *record = sets.data() + IPFIX_SET_HEADER;
+
+						ok = PackFileLine(JoinFileLine(json), &packed);
+
+						if( records[0].message.size() > IPFIX_SHORT_LENGTH_MAX || records[0].source.size() > IPFIX_SHORT_LENGTH_MAX )
+							longerThanFdd++;
+						else if( ok && packed.size() == sizes[0] && memcmp(packed.data(), record, sizes[0]) == 0 )
+							sameAsFdd++;
+						else
+							ok = FALSE;
+
+						if( records[0].message.size() > IPFIX_SHORT_LENGTH_MAX )
+							longMessages++;
+					}
+
+					if( !ok && mismatches++ < 10 ) {
+						fprintf(report, "ipfix: MISMATCH on event %llu (record %ls), sets of %u bytes, %s path\n", (unsigned long long)count + 1,
+							json[L"record_id"].c_str(), ipfixSetSizes[k], path == 0 ? "values" : "xml");
+					}
+				}
+			}
+
+			source->Close(hEvents[i]);
+		}
+	}
+	source->Close(hResults);
+
+	for( size_t k = 0; k < IPFIX_SET_SIZE_COUNT; k++ ) {
+		for( int path = 0; path < 2; path++ ) {
+			sessions[k][path]->publishers.Clear();
+			delete sessions[k][path];
+		}
+	}
+
+	fprintf(report, "ipfix: %llu events (%s), sets of %u, %u and %u bytes on the values and the xml path\n", (unsigned long long)count,
+		options->fixtures != NULL ? "fixtures" : "synthetic", ipfixSetSizes[0], ipfixSetSizes[1], ipfixSetSizes[2]);
+	fprintf(report, "ipfix: %llu records byte for byte as FDD::IPFIX packs them, %llu with strings it would cut at 254 bytes (%llu messages); %llu messages cut to fit the smaller sets\n",
+		(unsigned long long)sameAsFdd, (unsigned long long)longerThanFdd, (unsigned long long)longMessages, (unsigned long long)cut);
+
+	if( mismatches > 0 || count != events ) {
+		fprintf(report, "ipfix: FAILED, %llu mismatches, %llu of %llu events read\n",
+			(unsigned long long)mismatches, (unsigned long long)count, (unsigned long long)events);
+		result = 1;
+	}
+
+	DWORD wrongLengths = CheckIpfixLengths();
+
+	if( wrongLengths > 0 ) {
+		fprintf(report, "ipfix: FAILED, %u made-up messages came back wrong\n", wrongLengths);
+		result = 1;
+	}
+
+	// A cursor read a little at a time, as ReadEventsToIpfixBuffer does,
+	// growing the buffer when not even one record fits
+	{
+		SyntheticSource synthetic(options->events);
+		EVENT_SESSION session(&synthetic);
+		EventCursor cursor(&session);
+		std::vector<BYTE> buffer(IPFIX_CHECK_SET_BYTES / 4);
+		DWORD64 read = 0, expected = 1, calls = 0, grown = 0, setTotal = 0;
+		BOOL ok = cursor.Start(NULL, NULL, DEBUG_NONE);
+
+		SetIpfixMachineId(&session.ipfix, IPFIX_CHECK_MACHINE);
+		session.ipfix.templateId = IPFIX_CHECK_TEMPLATE;
+		session.ipfix.maxSetBytes = IPFIX_CHECK_SET_BYTES;
+
+		while( ok )
+		{
+			IpfixSetSink sink(buffer.data(), (DWORD)buffer.size(), session.ipfix.templateId, session.ipfix.maxSetBytes);
+			DWORD records = cursor.Read(options->batch, &sink, OUTPUT_FORMAT_IPFIX, options->mode, DEBUG_NONE);
+			std::vector<IPFIX_FIELDS> decoded;
+			DWORD setCount = 0;
+
+			calls++;
+
+			ok = ReadIpfixSets(buffer.data(), sink.Used(), session.ipfix.maxSetBytes, &decoded, NULL, &setCount)
+				&& decoded.size() == records && setCount == sink.Sets();
+
+			for( size_t r = 0; ok && r < decoded.size(); r++ )
+				ok = decoded[r].recordId == expected++;
+
+			if( cursor.Status() == ERROR_INSUFFICIENT_BUFFER ) {
+				ok = ok && sink.Required() > buffer.size() - sink.Used();
+				buffer.resize(buffer.size() < 4 * IPFIX_CHECK_SET_BYTES ? 4 * IPFIX_CHECK_SET_BYTES : sink.Required());
+				grown++;
+			} else if( records == 0 ) {
+				break;
+			}
+
+			read += records;
+			setTotal += setCount;
+		}
+
+		session.publishers.Clear();
+
+		if( !ok || read != options->events ) {
+			fprintf(report, "ipfix: FAILED, cursor read %llu of %llu events in %llu calls\n",
+				(unsigned long long)read, (unsigned long long)options->events, (unsigned long long)calls);
+			result = 1;
+		} else {
+			fprintf(report, "ipfix: cursor read %llu events into %llu sets of up to %u bytes in %llu calls, buffer grown %llu times\n",
+				(unsigned long long)read, (unsigned long long)setTotal, IPFIX_CHECK_SET_BYTES, (unsigned long long)calls, (unsigned long long)grown);
+		}
+	}
+
+	// The whole log both ways, in sets of the default size. The way
+	// through JSON is timed from the records being written to the sets
+	// being packed
+	std::vector<WCHAR> text;
+	std::vector<size_t> ends;
+	std::vector<BYTE> viaText, direct;
+	double seconds[2];
+	size_t jsonBytes = 0;
+	DWORD64 written[2] = { 0, 0 };
+
+	for( int way = 0; way < 2; way++ )
+	{
+		EVENT_SESSION session(source);
+		MemorySink textSink(&text, &ends);
+
+		SetIpfixMachineId(&session.ipfix, IPFIX_CHECK_MACHINE);
+		session.ipfix.templateId = IPFIX_CHECK_TEMPLATE;
+
+		// Room for every record in a set of its own
+		direct.resize(way == 1 ? (jsonBytes + events * IPFIX_SET_HEADER) * 2 + IPFIX_SET_BYTES_DEFAULT : 0);
+
+		IpfixSetSink setSink(direct.data(), (DWORD)direct.size(), IPFIX_CHECK_TEMPLATE, IPFIX_SET_BYTES_DEFAULT);
+		OutputSink *sink = way == 0 ? (OutputSink *)&textSink : (OutputSink *)&setSink;
+
+		std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+
+		hResults = source->Query(NULL, NULL, EvtQueryChannelPath | EvtQueryReverseDirection);
+
+		while( source->Next(hResults, BATCH_SIZE_MAX, hEvents, INFINITE, &dwReturned) && dwReturned > 0 ) {
+			for( DWORD i = 0; i < dwReturned; i++ ) {
+				DumpEventInfo(&session, hEvents[i], sink, way == 0 ? OUTPUT_FORMAT_JSON : OUTPUT_FORMAT_IPFIX, options->mode, DEBUG_NONE);
+				source->Close(hEvents[i]);
+			}
+		}
+		source->Close(hResults);
+
+		if( way == 0 ) {
+			std::vector<BYTE> record;
+			size_t begin = 0, setStart = 0;
+
+			for( size_t r = 0; r < ends.size(); r++ ) {
+				std::map<std::wstring, std::wstring> json;
+
+				if( !ReadJsonRecord(std::wstring(&text[begin], ends[r] - begin), &json) )
+					break;
+
+				begin = ends[r] + 1;
+
+				record.clear();
+				if( !PackFileLine(JoinFileLine(json), &record) )
+					break;
+
+				// Into sets, as IpfixSetSink does
+				if( viaText.empty() || viaText.size() - setStart + record.size() > IPFIX_SET_BYTES_DEFAULT ) {
+					setStart = viaText.size();
+					viaText.push_back((BYTE)(IPFIX_CHECK_TEMPLATE >> 8));
+					viaText.push_back((BYTE)IPFIX_CHECK_TEMPLATE);
+					viaText.resize(viaText.size() + 2);
+				}
+
+				viaText.insert(viaText.end(), record.begin(), record.end());
+				viaText[setStart + 2] = (BYTE)((viaText.size() - setStart) >> 8);
+				viaText[setStart + 3] = (BYTE)(viaText.size() - setStart);
+				written[way]++;
+			}
+		} else {
+			direct.resize(setSink.Used());
+			written[way] = setSink.Records();
+		}
+
+		seconds[way] = Seconds(started);
+		session.publishers.Clear();
+
+		for( size_t r = 0, begin = 0; way == 0 && r < ends.size(); begin = ends[r++] + 1 )
+			jsonBytes += Utf8Length(&text[begin], ends[r] - begin) + 1;
+
+		if( written[way] != events ) {
+			fprintf(report, "ipfix: FAILED, %llu records packed %s of %llu events\n", (unsigned long long)written[way],
+				way == 0 ? "through JSON" : "straight away", (unsigned long long)events);
+			result = 1;
+		}
+	}
+
+	fprintf(report, "ipfix: %llu events into sets of up to %u bytes\n", (unsigned long long)events, IPFIX_SET_BYTES_DEFAULT);
+	fprintf(report, "  through json %9llu bytes of JSON, %9llu of sets (%.1f a record, strings cut at 254 bytes); %.3f s, %.0f ns a record\n",
+		(unsigned long long)jsonBytes, (unsigned long long)viaText.size(), events > 0 ? (double)viaText.size() / events : 0.0,
+		seconds[0], events > 0 ? seconds[0] * 1e9 / events : 0.0);
+	fprintf(report, "  straight away %27llu of sets (%.1f a record, strings whole where they fit); %.3f s, %.0f ns a record (%.2fx the time)\n",
+		(unsigned long long)direct.size(), events > 0 ? (double)direct.size() / events : 0.0,
+		seconds[1], events > 0 ? seconds[1] * 1e9 / events : 0.0, seconds[0] > 0 ? seconds[1] / seconds[0] : 0.0);
+
+	delete source;
+
+	return result;
+}
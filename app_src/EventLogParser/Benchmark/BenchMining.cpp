@@ -0,0 +1,686 @@
+#include <string.h>
+#include "Benchmark.h"
+#include "EventCursor.h"
+#include "Utf8Encode.h"
+
+
+// Template IDs the mining bench gives EpEventLogMined and oMessageTemplate
+// records, next to the EpEventLog ones of IPFIX_CHECK_TEMPLATE
+#define MINING_CHECK_MINED 259
+#define MINING_CHECK_ANNOUNCE 260
+#define MINING_CHECK_MINED_FLOW 262
+
+// syslog msg lines the bench makes up, and the templates the table of the
+// small table check keeps
+#define MINING_SYSLOG_LINES 50000
+#define MINING_SMALL_TABLE 4
+
+// Pairs of messages mined one after the other, and what the second must
+// leave: its template's ID, text and version, and its parameters
+static const struct {
+	LPCWSTR first;
+	LPCWSTR second;
+	DWORD id;
+	LPCWSTR text;
+	DWORD version;
+	LPCWSTR parameters;
+} minedMessages[] = {
+	{ L"Accepted password for alice from 10.0.0.1 port 50022 ssh2", L"Accepted password for bob from 10.0.0.2 port 50023 ssh2",
+		1, L"Accepted password for <*> from <*> port <*> <*>", 2, L"bob 10.0.0.2 50023 ssh2" },
+	{ L"Started Session 42 of user root.", L"Started Session 43 of user admin.", 1, L"Started Session <*> of user <*>", 2, L"43 admin." },
+	{ L"  Source Port:\t\t51344\r\n", L"  Source Port:\t\t51345\r\n", 1, L"  Source Port:\t\t<*>\r\n", 1, L"51345" },
+	{ L"session closed for user root", L"session opened for user root by (uid=0)", 2, L"session opened for user root by <*>", 1, L"(uid=0)" },
+	{ L"The Windows Update service entered the running state.", L"The Windows Update service entered the stopped state.",
+		1, L"The Windows Update service entered the <*> state.", 2, L"stopped" },
+	{ L"The Windows Update service entered the running state.", L"The Print Spooler service entered the running state.",
+		2, L"The Print Spooler service entered the running state.", 1, L"" },
+	{ L"Connection closed by 203.0.113.9 port 22", L"Connection  closed by 203.0.113.9 port 22", 2, L"Connection  closed by <*> port <*>", 1, L"203.0.113.9 22" },
+	{ L"user a<*>b logged on", L"user a<*>b logged off", 1, L"user <*> logged <*>", 2, L"a<*>b off" },
+};
+
+// Texts and parameters ExpandTemplate must give a message of, or refuse
+// (message NULL) as not as many parameters as places
+static const struct {
+	LPCWSTR text;
+	LPCWSTR parameters;
+	LPCWSTR message;
+} expandedTemplates[] = {
+	{ L"a <*> b", L"x", L"a x b" },
+	{ L"<*><*>", L"x y", L"xy" },
+	{ L"no places", L"", L"no places" },
+	{ L"a <*> b <*>", L"x", NULL },
+	{ L"a <*>", L"x y", NULL },
+	{ L"no places", L"x", NULL },
+};
+
+// Users, services and the like the syslog lines are made of
+static const LPCWSTR syslogUsers[] = { L"root", L"admin", L"alice", L"bob", L"www-data", L"postgres", L"deploy", L"backup" };
+static const LPCWSTR syslogUnits[] = { L"Daily apt download activities", L"Clean php session files", L"Rotate log files", L"Message of the Day" };
+
+
+// One of the lines a busy Linux host's syslog has, as the msg part of it
+static std::wstring SyslogLine(DWORD *state)
+{
+	WCHAR line[512];
+	DWORD r = NextRandom(state);
+	LPCWSTR user = syslogUsers[NextRandom(state) % (sizeof(syslogUsers) / sizeof(syslogUsers[0]))];
+	DWORD a = NextRandom(state), b = NextRandom(state);
+	DWORD port = 1024 + NextRandom(state) % 64000;
+
+	switch( r % 10 ) {
+	case 0:
+	case 1:
+		swprintf(line, sizeof(line) / sizeof(line[0]), L"Accepted password for %ls from %u.%u.%u.%u port %u ssh2", user, 10, a & 0xFF, (a >> 8) & 0xFF, b & 0xFF, port);
+		break;
+	case 2:
+	case 3:
+		swprintf(line, sizeof(line) / sizeof(line[0]), L"Failed password for invalid user %ls from %u.%u.%u.%u port %u ssh2", user, 203, 0, 113, a & 0xFF, port);
+		break;
+	case 4:
+		swprintf(line, sizeof(line) / sizeof(line[0]), L"Connection closed by %u.%u.%u.%u port %u [preauth]", 198, 51, 100, a & 0xFF, port);
+		break;
+	case 5:
+		swprintf(line, sizeof(line) / sizeof(line[0]), L"pam_unix(cron:session): session opened for user %ls by (uid=0)", user);
+		break;
+	case 6:
+		swprintf(line, sizeof(line) / sizeof(line[0]), L"pam_unix(cron:session): session closed for user %ls", user);
+		break;
+	case 7:
+		swprintf(line, sizeof(line) / sizeof(line[0]),
+			L"[UFW BLOCK] IN=eth0 OUT= MAC=52:54:00:%02x:%02x:%02x SRC=%u.%u.%u.%u DST=192.0.2.10 LEN=%u TOS=0x00 PREC=0x00 TTL=%u ID=%u PROTO=TCP SPT=%u DPT=%u WINDOW=%u RES=0x00 %ls URGP=0",
+			a & 0xFF, (a >> 8) & 0xFF, (a >> 16) & 0xFF, 45, (b >> 8) & 0xFF, (b >> 16) & 0xFF, b & 0xFF, 40 + a % 20, 32 + b % 220, a & 0xFFFF, port,
+			(b & 1) ? 22 : 3389, 1024 + b % 64000, (a & 1) ? L"SYN" : L"ACK");
+		break;
+	case 8:
+		if( a % 3 == 0 )
+			swprintf(line, sizeof(line) / sizeof(line[0]), L"Started %ls.", syslogUnits[b % (sizeof(syslogUnits) / sizeof(syslogUnits[0]))]);
+		else
+			swprintf(line, sizeof(line) / sizeof(line[0]), L"Started Session %u of user %ls.", b % 100000, user);
+		break;
+	default:
+		if( a & 1 )
+			swprintf(line, sizeof(line) / sizeof(line[0]), L"connect from unknown[%u.%u.%u.%u]", 198, 51, 100, b & 0xFF);
+		else
+			swprintf(line, sizeof(line) / sizeof(line[0]), L"disconnect from unknown[%u.%u.%u.%u] ehlo=1 auth=0/1 commands=1/2", 198, 51, 100, b & 0xFF);
+		break;
+	}
+
+	return line;
+}
+
+
+// Bytes of a string as a variable-length IPFIX field
+static DWORD64 IpfixStringBytes(const std::string &text)
+{
+	return (text.size() < IPFIX_LONG_LENGTH ? 1 : IPFIX_LONG_LENGTH_BYTES) + text.size();
+}
+
+
+// ExpandTemplate on UTF-8, as a collector puts a message back together
+static BOOL ExpandUtf8(const std::string &text, const std::string &parameters, std::string *out)
+{
+	std::string place = FileLineText(MINER_PARAMETER);
+	size_t next = 0;
+
+	out->clear();
+
+	for( size_t at = 0; at < text.size(); ) {
+		if( text.compare(at, place.size(), place) != 0 ) {
+			out->push_back(text[at++]);
+			continue;
+		}
+
+		if( next >= parameters.size() )
+			return FALSE;
+
+		size_t end = parameters.find((char)MINER_PARAMETER_SEPARATOR, next);
+
+		if( end == std::string::npos )
+			end = parameters.size();
+
+		out->append(parameters, next, end - next);
+		next = end < parameters.size() ? end + 1 : end;
+		at += place.size();
+	}
+
+	return next >= parameters.size();
+}
+
+
+// How mining a corpus went
+struct MINING_RUN {
+	DWORD64 wrong;
+	DWORD64 same;
+	DWORD64 rawBytes;
+	DWORD64 minedBytes;
+	DWORD64 allocations;
+	double firstSeconds;
+	double secondSeconds;
+};
+
+
+/****
+ * MineCorpus
+ *
+ * DESC:
+ *     Mines a corpus twice with a fresh miner, timing each pass, and checks
+ *     that every mined message expands back to itself with its template's
+ *     text as it was right then. The second pass must find no new
+ *     templates; where it changes none it must allocate nothing
+ *
+ * ARGS:
+ *     miner - the miner, configured; left with the corpus's templates
+ *     run - receives how it went. rawBytes are the messages as strings of
+ *           EpEventLog records, minedBytes the template IDs and parameters
+ *           instead, with each template's text once
+ */
+static void MineCorpus(const std::vector<std::wstring> &messages, TemplateMiner *miner, MINING_RUN *run)
+{
+	std::vector<DWORD> ids(messages.size());
+	std::wstring expanded;
+	LPCWSTR parameters;
+
+	memset(run, 0, sizeof(MINING_RUN));
+
+	std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+
+	for( size_t i = 0; i < messages.size(); i++ )
+		ids[i] = miner->Mine(messages[i].c_str(), &parameters);
+
+	run->firstSeconds = Seconds(started);
+
+	// The same again, checked as it goes, in a miner of its own
+	TemplateMiner checked;
+
+	checked.Configure(miner->MaxTemplates());
+
+	for( size_t i = 0; i < messages.size(); i++ ) {
+		DWORD id = checked.Mine(messages[i].c_str(), &parameters);
+
+		if( id != ids[i] || (id != 0 && (!ExpandTemplate(checked.Text(id), parameters, &expanded) || expanded != messages[i])) )
+			run->wrong++;
+	}
+
+	DWORD templates = miner->Templates();
+	DWORD64 changes = miner->Changes();
+
+#if defined(ALLOCATION_COUNTING)
+	allocations = 0;
+	counting = true;
+#endif
+	started = std::chrono::steady_clock::now();
+
+	for( size_t i = 0; i < messages.size(); i++ )
+		run->same += miner->Mine(messages[i].c_str(), &parameters) == ids[i];
+
+	run->secondSeconds = Seconds(started);
+#if defined(ALLOCATION_COUNTING)
+	counting = false;
+	run->allocations = miner->Changes() == changes ? allocations.load() : 0;
+#endif
+
+	if( miner->Templates() != templates )
+		run->wrong++;
+
+	// What goes out once the templates are settled
+	for( size_t i = 0; i < messages.size(); i++ ) {
+		DWORD id = miner->Mine(messages[i].c_str(), &parameters);
+		DWORD64 raw = IpfixStringBytes(FileLineText(messages[i]));
+
+		run->rawBytes += raw;
+		run->minedBytes += id != 0 ? 4 + IpfixStringBytes(FileLineText(parameters)) : 4 + 1 + raw;
+
+		if( id != 0 && (!ExpandTemplate(miner->Text(id), parameters, &expanded) || expanded != messages[i]) )
+			run->wrong++;
+	}
+
+	for( DWORD id = 1; id <= miner->Templates(); id++ )
+		run->minedBytes += 4 + IpfixStringBytes(FileLineText(miner->Text(id)));
+}
+
+
+/****
+ * ReadMinedSets
+ *
+ * DESC:
+ *     Takes apart sets of EpEventLog, EpEventLogMined and oMessageTemplate
+ *     records, and of the Flow templates of the first two, as a collector
+ *     would: the message of each mined record is
+ *     its template's text, as last announced, expanded with its
+ *     parameters
+ *
+ * ARGS:
+ *     texts - the templates announced so far, by ID; those these sets
+ *             announce are added
+ *     records - receives the records, as EpEventLog or EpEventLogFlow ones
+ *     announced - receives how many templates were announced
+ *     mined - receives how many records were mined
+ *
+ * RETURNS:
+ *     FALSE if a set is not one of the five, a record does not decode,
+ *     or a mined record's template was not announced before it or does
+ *     not take its parameters
+ */
+static BOOL ReadMinedSets(const BYTE *data, size_t bytes, DWORD maxSetBytes, std::map<DWORD64, std::string> *texts, std::vector<IPFIX_FIELDS> *records,
+	DWORD64 *announced, DWORD64 *mined)
+{
+	const BYTE *at = data;
+	const BYTE *end = data + bytes;
+
+	while( at < end ) {
+		DWORD64 id = 0, length = 0;
+
+		if( !GetIpfixNumber(&at, end, 2, &id) || !GetIpfixNumber(&at, end, 2, &length)
+			|| (id != IPFIX_CHECK_TEMPLATE && id != IPFIX_CHECK_FLOW_TEMPLATE && id != MINING_CHECK_MINED && id != MINING_CHECK_MINED_FLOW
+				&& id != MINING_CHECK_ANNOUNCE)
+			|| length <= IPFIX_SET_HEADER || length > maxSetBytes || length - IPFIX_SET_HEADER > (DWORD64)(end - at) )
+			return FALSE;
+
+		const BYTE *setEnd = at + length - IPFIX_SET_HEADER;
+
+		while( at < setEnd ) {
+			IPFIX_FIELDS record;
+			DWORD64 templateId = 0;
+			std::string text, parameters;
+
+			if( id == IPFIX_CHECK_TEMPLATE || id == IPFIX_CHECK_FLOW_TEMPLATE ) {
+				if( !DecodeIpfixRecord(&at, setEnd, id == IPFIX_CHECK_FLOW_TEMPLATE, &record) )
+					return FALSE;
+
+				records->push_back(record);
+				continue;
+			}
+
+			if( id == MINING_CHECK_ANNOUNCE ) {
+				if( !GetIpfixString(&at, setEnd, IPFIX_MACHINE_ID_BYTES, &record.machineId) || !GetIpfixNumber(&at, setEnd, 4, &templateId)
+					|| !GetIpfixString(&at, setEnd, 0, &text) || templateId == 0 )
+					return FALSE;
+
+				(*texts)[templateId] = text;
+				(*announced)++;
+				continue;
+			}
+
+			if( !GetIpfixString(&at, setEnd, IPFIX_MACHINE_ID_BYTES, &record.machineId)
+				|| !GetIpfixString(&at, setEnd, 0, &record.logName)
+				|| !GetIpfixNumber(&at, setEnd, 4, &record.seconds)
+				|| !GetIpfixNumber(&at, setEnd, 8, &record.recordId)
+				|| !GetIpfixNumber(&at, setEnd, 8, &record.eventId)
+				|| !GetIpfixString(&at, setEnd, 0, &record.source)
+				|| !GetIpfixNumber(&at, setEnd, 4, &templateId)
+				|| !GetIpfixString(&at, setEnd, 0, &parameters)
+				|| !GetIpfixNumber(&at, setEnd, 8, &record.count)
+				|| (id == MINING_CHECK_MINED_FLOW && (!GetIpfixNumber(&at, setEnd, 4, &record.firstSeconds)
+					|| !GetIpfixNumber(&at, setEnd, 4, &record.lastSeconds)))
+				|| !GetIpfixNumber(&at, setEnd, 1, &record.rollable) )
+				return FALSE;
+
+			record.merged = id == MINING_CHECK_MINED_FLOW;
+			if( !record.merged )
+				record.firstSeconds = record.lastSeconds = record.seconds;
+
+			std::map<DWORD64, std::string>::iterator found = texts->find(templateId);
+
+			if( found == texts->end() || !ExpandUtf8(found->second, parameters, &record.message) )
+				return FALSE;
+
+			records->push_back(record);
+			(*mined)++;
+		}
+	}
+
+	return TRUE;
+}
+
+
+/****
+ * SameAsPlain
+ *
+ * DESC:
+ *     Checks a record put back together from a mined one against the
+ *     plain EpEventLog record of the same event or flow. The plain one's
+ *     strings may be cut short where the mined one's are whole
+ */
+static BOOL SameAsPlain(const IPFIX_FIELDS *record, const IPFIX_FIELDS *plain)
+{
+	return record->machineId == plain->machineId && record->seconds == plain->seconds && record->recordId == plain->recordId
+		&& record->eventId == plain->eventId && record->count == plain->count && record->firstSeconds == plain->firstSeconds
+		&& record->lastSeconds == plain->lastSeconds && record->rollable == plain->rollable && record->merged == plain->merged
+		&& CutShort(plain->logName, record->logName) && CutShort(plain->source, record->source) && CutShort(plain->message, record->message);
+}
+
+
+/****
+ * MineStorm
+ *
+ * DESC:
+ *     Writes the storm into sets of the default size as AggregateStorm
+ *     does, one record an event with a window of 0 or else one a flow,
+ *     with its messages whole or mined
+ *
+ * ARGS:
+ *     miner - the templates, if the messages are mined
+ *     records - receives the records, taken apart again
+ *     announced - receives how many templates were announced
+ *     mined - receives how many records were mined
+ *
+ * RETURNS:
+ *     The seconds it took, or a negative number if the sets filled up or
+ *     could not be read back
+ */
+static double MineStorm(const std::vector<STORM_PROTO> &protos, const std::vector<STORM_EVENT> &storm, DWORD window, TemplateMiner *miner,
+	std::vector<BYTE> *sets, std::vector<IPFIX_FIELDS> *records, DWORD64 *announced, DWORD64 *mined)
+{
+	EventAggregator flows;
+	IPFIX_EXPORT exporter;
+	GrowBuffer buffer;
+	SYSTEM_FIELDS fields;
+	IPFIX_FLOW flow;
+	WCHAR recordText[24];
+	BOOL ok = TRUE;
+
+	SetIpfixMachineId(&exporter, IPFIX_CHECK_MACHINE);
+	exporter.templateId = IPFIX_CHECK_TEMPLATE;
+	exporter.flowTemplateId = IPFIX_CHECK_FLOW_TEMPLATE;
+	if( miner != NULL ) {
+		exporter.minedTemplateId = MINING_CHECK_MINED;
+		exporter.minedFlowTemplateId = MINING_CHECK_MINED_FLOW;
+		exporter.announceTemplateId = MINING_CHECK_ANNOUNCE;
+	}
+	flows.Configure(window, AGGREGATE_FLOWS_DEFAULT);
+
+	IpfixSetSink sink(sets->data(), (DWORD)sets->size(), IPFIX_CHECK_TEMPLATE, exporter.maxSetBytes);
+
+	std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+
+	for( size_t i = 0; ok && i < storm.size(); i++ ) {
+		StormFields(protos[storm[i].proto], storm[i], i + 1, &fields, recordText);
+
+		if( window == 0 ) {
+			GetIpfixFlow(&fields, storm[i].message.c_str(), &flow);
+			ok = WriteIpfixFlow(&sink, &buffer, &flow, &exporter, miner);
+			continue;
+		}
+
+		flows.Add(&fields, storm[i].message.c_str());
+		ok = flows.Drain(&sink, &buffer, &exporter, miner);
+	}
+
+	flows.Flush();
+	ok = ok && flows.Drain(&sink, &buffer, &exporter, miner);
+
+	double seconds = Seconds(started);
+	std::map<DWORD64, std::string> texts;
+
+	*announced = *mined = 0;
+	records->clear();
+
+	if( !ok || !ReadMinedSets(sets->data(), sink.Used(), exporter.maxSetBytes, &texts, records, announced, mined) )
+		return -1.0;
+
+	sets->resize(sink.Used());
+
+	return seconds;
+}
+
+
+/****
+ * ReadMined
+ *
+ * DESC:
+ *     Reads a whole fixture source through a cursor into sets, a little at
+ *     a time and growing the buffer when not even one record fits, as
+ *     ReadAggregated does, with the messages mined or whole
+ *
+ * ARGS:
+ *     records - receives the records, taken apart again
+ *     announced - receives how many templates were announced
+ *     mined - receives how many records were mined
+ *
+ * RETURNS:
+ *     FALSE if the sets could not be read back, the reads did not end, or
+ *     the miner counted other than one message a record (records the sink
+ *     refused are offered again)
+ */
+static BOOL ReadMined(FixtureSource *fixture, BOOL mine, BENCH_OPTIONS *options, std::vector<IPFIX_FIELDS> *records, DWORD64 *announced,
+	DWORD64 *mined, DWORD64 *calls, DWORD64 *grown)
+{
+	EVENT_SESSION session(fixture);
+	EventCursor cursor(&session);
+	std::vector<BYTE> buffer(AGGREGATE_CHECK_BUFFER);
+	std::map<DWORD64, std::string> texts;
+	BOOL ok = cursor.Start(NULL, NULL, DEBUG_NONE);
+
+	SetIpfixMachineId(&session.ipfix, IPFIX_CHECK_MACHINE);
+	session.ipfix.templateId = IPFIX_CHECK_TEMPLATE;
+	session.ipfix.maxSetBytes = AGGREGATE_CHECK_SET_BYTES;
+	if( mine ) {
+		session.ipfix.minedTemplateId = MINING_CHECK_MINED;
+		session.ipfix.announceTemplateId = MINING_CHECK_ANNOUNCE;
+	}
+
+	*announced = *mined = *calls = *grown = 0;
+	records->clear();
+
+	while( ok && (*calls)++ < 10 * (DWORD64)fixture->Count() )
+	{
+		IpfixSetSink sink(buffer.data(), (DWORD)buffer.size(), session.ipfix.templateId, session.ipfix.maxSetBytes);
+		DWORD read = cursor.Read(options->batch, &sink, OUTPUT_FORMAT_IPFIX, options->mode, DEBUG_NONE);
+		DWORD status = cursor.Status();
+
+		// An announcement taken ahead of an event that did not fit, as
+		// ReadEventsToIpfixBuffer has it
+		if( status == ERROR_INSUFFICIENT_BUFFER && sink.Used() > 0 )
+			status = ERROR_MORE_DATA;
+
+		ok = (status == ERROR_SUCCESS || status == ERROR_MORE_DATA || status == ERROR_INSUFFICIENT_BUFFER)
+			&& ReadMinedSets(buffer.data(), sink.Used(), session.ipfix.maxSetBytes, &texts, records, announced, mined);
+
+		if( status == ERROR_INSUFFICIENT_BUFFER ) {
+			ok = ok && sink.Required() > buffer.size();
+			buffer.resize(buffer.size() < 4 * AGGREGATE_CHECK_SET_BYTES ? 4 * AGGREGATE_CHECK_SET_BYTES : sink.Required());
+			(*grown)++;
+		} else if( status == ERROR_SUCCESS && read == 0 ) {
+			session.publishers.Clear();
+			return ok && (!mine || session.miner.Messages() == records->size());
+		}
+	}
+
+	session.publishers.Clear();
+
+	return FALSE;
+}
+
+
+/****
+ * BenchMining
+ *
+ * DESC:
+ *     Checks TemplateMiner and ExpandTemplate on known messages. Then
+ *     mines the messages of an hour of storms made of the fixture events,
+ *     and made-up syslog msg lines: every message expands back to itself,
+ *     a second pass finds no new templates and allocates nothing, and a
+ *     table too small for them leaves some whole. Reports the time a
+ *     message and how many fewer bytes the template IDs and parameters
+ *     take. Then writes the storm as IPFIX records, one an event and
+ *     aggregated, whole and mined, and checks that the records a collector
+ *     puts back together from the mined ones and the announced templates
+ *     are the whole ones; and does the same reading the fixtures and
+ *     --events copies of them through a cursor, a little at a time
+ */
+int BenchMining(BENCH_OPTIONS *options)
+{
+	int result = 0;
+
+	for( size_t i = 0; i < sizeof(minedMessages) / sizeof(minedMessages[0]); i++ ) {
+		TemplateMiner miner;
+		LPCWSTR parameters = NULL;
+		DWORD first = miner.Mine(minedMessages[i].first, &parameters);
+		DWORD second = miner.Mine(minedMessages[i].second, &parameters);
+
+		if( first != 1 || second != minedMessages[i].id || miner.Version(second) != minedMessages[i].version
+			|| wcscmp(miner.Text(second), minedMessages[i].text) != 0 || wcscmp(parameters, minedMessages[i].parameters) != 0 ) {
+			fprintf(report, "mining: FAILED, '%ls' after '%ls' mined as %u '%ls' (version %u) with '%ls', not %u '%ls' (version %u) with '%ls'\n",
+				minedMessages[i].second, minedMessages[i].first, second, miner.Text(second) != NULL ? miner.Text(second) : L"", miner.Version(second),
+				parameters, minedMessages[i].id, minedMessages[i].text, minedMessages[i].version, minedMessages[i].parameters);
+			result = 1;
+		}
+	}
+
+	for( size_t i = 0; i < sizeof(expandedTemplates) / sizeof(expandedTemplates[0]); i++ ) {
+		std::wstring expanded;
+		BOOL expands = ExpandTemplate(expandedTemplates[i].text, expandedTemplates[i].parameters, &expanded);
+
+		if( expands != (expandedTemplates[i].message != NULL) || (expands && expanded != expandedTemplates[i].message) ) {
+			fprintf(report, "mining: FAILED, '%ls' expanded with '%ls' %s '%ls'\n", expandedTemplates[i].text, expandedTemplates[i].parameters,
+				expands ? "gave" : "refused", expanded.c_str());
+			result = 1;
+		}
+	}
+
+	{
+		TemplateMiner miner;
+		LPCWSTR parameters = NULL;
+
+		if( miner.Mine(L"", &parameters) != 0 || miner.Mine(L" \t\r\n", &parameters) != 0 || miner.Mine(NULL, &parameters) != 0 || miner.Templates() != 0 ) {
+			fprintf(report, "mining: FAILED, an empty message was given a template\n");
+			result = 1;
+		}
+	}
+
+	std::vector<STORM_PROTO> protos;
+
+	if( !LoadStormProtos(options, &protos) ) {
+		fprintf(report, "mining: FAILED, no fixture events in %s\n", options->fixtures);
+		return 1;
+	}
+
+	std::vector<STORM_EVENT> storm;
+	DWORD64 shapeEvents[STORM_SHAPE_COUNT];
+
+	MakeStorm(protos, &storm, shapeEvents);
+
+	std::vector<std::wstring> stormMessages, syslogLines;
+	DWORD state = 88172645U;
+
+	for( size_t i = 0; i < storm.size(); i++ )
+		stormMessages.push_back(storm[i].message);
+
+	for( DWORD i = 0; i < MINING_SYSLOG_LINES; i++ )
+		syslogLines.push_back(SyslogLine(&state));
+
+	const struct {
+		const char *name;
+		const std::vector<std::wstring> *messages;
+	} corpora[] = {
+		{ "storm messages", &stormMessages },
+		{ "syslog lines", &syslogLines },
+	};
+
+	for( size_t c = 0; c < sizeof(corpora) / sizeof(corpora[0]); c++ ) {
+		const std::vector<std::wstring> &messages = *corpora[c].messages;
+		TemplateMiner miner;
+		MINING_RUN run;
+
+		MineCorpus(messages, &miner, &run);
+
+		fprintf(report, "mining: %6llu %-14s %5u templates (%llu changes), %llu unmined; %5.0f ns a message, %5.0f once mined (%5.1f%% the same template); "
+			"%9llu bytes whole, %9llu as templates (%4.1fx fewer)",
+			(unsigned long long)messages.size(), corpora[c].name, miner.Templates(), (unsigned long long)miner.Changes(), (unsigned long long)miner.Unmined(),
+			run.firstSeconds * 1e9 / messages.size(), run.secondSeconds * 1e9 / messages.size(), 100.0 * run.same / messages.size(),
+			(unsigned long long)run.rawBytes, (unsigned long long)run.minedBytes, run.minedBytes > 0 ? (double)run.rawBytes / run.minedBytes : 0.0);
+#if defined(ALLOCATION_COUNTING)
+		fprintf(report, ", %llu allocations once mined", (unsigned long long)run.allocations);
+#endif
+		fprintf(report, "\n");
+
+		if( run.wrong > 0 || run.allocations > 0 || miner.Templates() == 0 ) {
+			fprintf(report, "mining: FAILED, %llu %s did not expand back or were given new templates, %llu allocations once mined\n",
+				(unsigned long long)run.wrong, corpora[c].name, (unsigned long long)run.allocations);
+			result = 1;
+		}
+	}
+
+	// A table too small for the syslog lines: the rest go out whole
+	{
+		TemplateMiner miner;
+		MINING_RUN run;
+
+		miner.Configure(MINING_SMALL_TABLE);
+		MineCorpus(syslogLines, &miner, &run);
+
+		if( run.wrong > 0 || miner.Templates() != MINING_SMALL_TABLE || miner.Unmined() == 0 ) {
+			fprintf(report, "mining: FAILED, a table of %u templates kept %u, left %llu lines unmined and %llu did not expand back\n",
+				MINING_SMALL_TABLE, miner.Templates(), (unsigned long long)miner.Unmined(), (unsigned long long)run.wrong);
+			result = 1;
+		}
+	}
+
+	// The storm as IPFIX records, with room for a record an event with the
+	// times of a flow
+	std::vector<BYTE> sets;
+	std::vector<IPFIX_FIELDS> plain, records;
+	size_t room = 0;
+
+	for( size_t i = 0; i < storm.size(); i++ )
+		room += IPFIX_SET_HEADER + IPFIX_RECORD_FIXED_BYTES + IPFIX_FLOW_TIMES_BYTES + 3 * IPFIX_LONG_LENGTH_BYTES + UTF8_MAX_GROWTH
+			* (protos[storm[i].proto].channel.size() + protos[storm[i].proto].provider.size() + storm[i].message.size());
+
+	DWORD windows[] = { 0, 60 };
+
+	for( size_t w = 0; w < sizeof(windows) / sizeof(windows[0]); w++ ) {
+		TemplateMiner miner;
+		DWORD64 announced = 0, mined = 0;
+
+		sets.resize(room);
+		double wholeSeconds = MineStorm(protos, storm, windows[w], NULL, &sets, &plain, &announced, &mined);
+		DWORD64 wholeBytes = sets.size();
+
+		sets.resize(room);
+		double minedSeconds = MineStorm(protos, storm, windows[w], &miner, &sets, &records, &announced, &mined);
+		DWORD64 wrong = wholeSeconds < 0 || minedSeconds < 0 || records.size() != plain.size() ? 1 : 0;
+
+		for( size_t r = 0; wrong == 0 && r < records.size(); r++ )
+			wrong += !SameAsPlain(&records[r], &plain[r]);
+
+		fprintf(report, "mining: storm %s %7llu records, %9llu bytes whole, %9llu mined (%4.1fx fewer; %llu records mined, %llu templates announced); "
+			"%4.0f ns a record whole, %4.0f mined\n",
+			windows[w] == 0 ? "one an event," : "in 60 s flows,", (unsigned long long)plain.size(), (unsigned long long)wholeBytes,
+			(unsigned long long)sets.size(), sets.size() > 0 ? (double)wholeBytes / sets.size() : 0.0, (unsigned long long)mined,
+			(unsigned long long)announced, wholeSeconds * 1e9 / storm.size(), minedSeconds * 1e9 / storm.size());
+
+		if( wrong > 0 || mined == 0 || announced < miner.Templates() ) {
+			fprintf(report, "mining: FAILED, the storm %s did not come back the same from its mined records\n", windows[w] == 0 ? "one an event" : "in flows");
+			result = 1;
+		}
+	}
+
+	// The fixtures and --events copies of them through a cursor, whole
+	// and mined
+	FixtureSource fixture(1);
+
+	if( !LoadFixtures(&fixture, options, (DWORD)options->events) )
+		return 1;
+
+	{
+		DWORD64 announced = 0, mined = 0, calls = 0, grown = 0;
+		BOOL ok = ReadMined(&fixture, FALSE, options, &plain, &announced, &mined, &calls, &grown)
+			&& ReadMined(&fixture, TRUE, options, &records, &announced, &mined, &calls, &grown);
+		DWORD64 wrong = records.size() != plain.size() ? 1 : 0;
+
+		for( size_t r = 0; wrong == 0 && r < records.size(); r++ )
+			wrong += !SameAsPlain(&records[r], &plain[r]);
+
+		if( !ok || wrong > 0 || mined == 0 || records.size() != fixture.Count() ) {
+			fprintf(report, "mining: FAILED, cursor read %llu of %llu fixture events mined, %llu wrong\n", (unsigned long long)records.size(),
+				(unsigned long long)fixture.Count(), (unsigned long long)wrong);
+			result = 1;
+		} else {
+			fprintf(report, "mining: cursor read %llu fixture events, %llu mined with %llu templates announced, in %llu calls, buffer grown %llu times\n",
+				(unsigned long long)records.size(), (unsigned long long)mined, (unsigned long long)announced, (unsigned long long)calls,
+				(unsigned long long)grown);
+		}
+	}
+
+	return result;
+}
@@ -0,0 +1,625 @@
+#include <string.h>
+#include "Benchmark.h"
+#include "SyntheticSource.h"
+#include "LatencySource.h"
+
+
+/****
+ * BenchThroughput
+ *
+ * DESC:
+ *     Runs a whole query through the parser core, exactly as ParseEventLog
+ *     does, and reports events per second
+ */
+int BenchThroughput(BENCH_OPTIONS *options)
+{
+	DWORD64 events = 0;
+	EventSource *source = OpenSource(options, &events);
+
+	if( source == NULL )
+		return 1;
+
+	std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+
+	// No log name: the fixture source then replays every channel
+	ParseEventSource(source, NULL, NULL, options->outputFormat, DEBUG_NONE, options->mode);
+	fflush(stdout);
+
+	double elapsed = Seconds(started);
+
+	fprintf(report, "throughput: %llu events in %.3f s, %.0f events/s, %.2f us/event (%s, %s)\n",
+		(unsigned long long)events, elapsed, events / elapsed, elapsed * 1e6 / events,
+		options->fixtures != NULL ? "fixtures" : "synthetic",
+		(options->mode & MODE_RENDER_XML) ? "xml" : "values");
+
+	delete source;
+
+	return 0;
+}
+
+
+/****
+ * BenchFetch
+ *
+ * DESC:
+ *     Compares fetching one event per Next call (what the parser did
+ *     before batching) with the batched, pipelined EventFetcher, against
+ *     a source with a fixed cost per round trip
+ */
+int BenchFetch(BENCH_OPTIONS *options)
+{
+	SyntheticSource synthetic(options->events);
+	LatencySource source(&synthetic, options->nextMs, options->perEventUs);
+	double serial, pipelined;
+	DWORD64 serialCount = 0;
+
+	{
+		EVENT_SESSION session(&source);
+		StdoutSink sink;
+		EVT_HANDLE hResults = source.Query(NULL, NULL, EvtQueryChannelPath | EvtQueryReverseDirection);
+		EVT_HANDLE hEvent;
+		DWORD dwReturned;
+
+		std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+
+		while( source.Next(hResults, 1, &hEvent, INFINITE, &dwReturned) && dwReturned > 0 ) {
+			DumpEventInfo(&session, hEvent, &sink, options->outputFormat, options->mode, DEBUG_NONE);
+			source.Close(hEvent);
+			serialCount++;
+		}
+		fflush(stdout);
+
+		serial = Seconds(started);
+		source.Close(hResults);
+	}
+
+	{
+		std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+
+		ParseEventSource(&source, NULL, NULL, options->outputFormat, DEBUG_NONE, options->mode);
+		fflush(stdout);
+
+		pipelined = Seconds(started);
+	}
+
+	fprintf(report, "fetch: %llu events, %u ms per Next call, %u us per event\n", (unsigned long long)options->events, options->nextMs, options->perEventUs);
+	fprintf(report, "  one per call: %.3f s, %.0f events/s\n", serial, serialCount / serial);
+	fprintf(report, "  pipelined:    %.3f s, %.0f events/s (%.1fx)\n", pipelined, options->events / pipelined, serial / pipelined);
+
+	if( serialCount != options->events ) {
+		fprintf(report, "fetch: FAILED, read %llu of %llu events one at a time\n", (unsigned long long)serialCount, (unsigned long long)options->events);
+		return 1;
+	}
+
+	return 0;
+}
+
+
+/****
+ * SameFields
+ *
+ * DESC:
+ *     Compares the System fields read through the two render paths. The
+ *     times are compared by value, as the XML may carry fewer digits
+ */
+BOOL SameFields(SYSTEM_FIELDS *xml, SYSTEM_FIELDS *values)
+{
+	ULONGLONG xmlTime = 0, valuesTime = 0;
+
+	ParseSystemTime(xml->timeCreated, &xmlTime);
+	ParseSystemTime(values->timeCreated, &valuesTime);
+
+	return wcscmp(xml->recordId, values->recordId) == 0
+		&& wcscmp(xml->eventId, values->eventId) == 0
+		&& wcscmp(xml->channel, values->channel) == 0
+		&& wcscmp(xml->provider, values->provider) == 0
+		&& wcscmp(xml->computer, values->computer) == 0
+		&& wcscmp(xml->task, values->task) == 0
+		&& wcscmp(xml->level, values->level) == 0
+		&& wcscmp(xml->version, values->version) == 0
+		&& xml->recordIdValue == values->recordIdValue
+		&& xmlTime == valuesTime;
+}
+
+
+/****
+ * BenchRender
+ *
+ * DESC:
+ *     Times reading the System fields by rendering and parsing XML against
+ *     rendering them as values, and checks both agree on every event
+ */
+int BenchRender(BENCH_OPTIONS *options)
+{
+	DWORD64 events = 0;
+	EventSource *source = OpenSource(options, &events);
+
+	if( source == NULL )
+		return 1;
+
+	double xmlSeconds = 0, valuesSeconds = 0;
+	DWORD64 count = 0, mismatches = 0;
+	// Each path gets its own buffers, as it would in a session of its own
+	RenderContext *xmlRender = new RenderContext(source);
+	RenderContext *valuesRender = new RenderContext(source);
+
+	EVT_HANDLE hResults = source->Query(NULL, NULL, EvtQueryChannelPath | EvtQueryReverseDirection);
+	EVT_HANDLE hEvents[BATCH_SIZE_MAX];
+	DWORD dwReturned;
+
+	while( source->Next(hResults, BATCH_SIZE_MAX, hEvents, INFINITE, &dwReturned) && dwReturned > 0 ) {
+		for( DWORD i = 0; i < dwReturned; i++ ) {
+			SYSTEM_FIELDS xmlFields, valuesFields;
+
+			std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+			LPWSTR xml = xmlRender->RenderXml(hEvents[i], DEBUG_NONE);
+			BOOL xmlOk = xml != NULL && ExtractSystemFields(xmlRender->Parse(xml), &xmlFields);
+			xmlSeconds += Seconds(started);
+
+			started = std::chrono::steady_clock::now();
+			BOOL valuesOk = RenderSystemFields(valuesRender, hEvents[i], &valuesFields);
+			valuesSeconds += Seconds(started);
+
+			if( !xmlOk || !valuesOk || !SameFields(&xmlFields, &valuesFields) ) {
+				if( mismatches++ < 10 ) {
+					fprintf(report, "render: MISMATCH on record %llu: xml '%ls' '%ls' '%ls' / values '%ls' '%ls' '%ls'\n",
+						(unsigned long long)(valuesOk ? valuesFields.recordIdValue : 0),
+						xmlOk ? xmlFields.eventId : L"?", xmlOk ? xmlFields.provider : L"?", xmlOk ? xmlFields.timeCreated : L"?",
+						valuesOk ? valuesFields.eventId : L"?", valuesOk ? valuesFields.provider : L"?", valuesOk ? valuesFields.timeCreated : L"?");
+				}
+			}
+
+			source->Close(hEvents[i]);
+			count++;
+		}
+	}
+	source->Close(hResults);
+
+	delete xmlRender;
+	delete valuesRender;
+
+	fprintf(report, "render: %llu events (%s)\n", (unsigned long long)count, options->fixtures != NULL ? "fixtures" : "synthetic");
+	fprintf(report, "  xml + parse: %.3f s, %.2f us/event\n", xmlSeconds, xmlSeconds * 1e6 / count);
+	fprintf(report, "  values:      %.3f s, %.2f us/event (%.1fx)\n", valuesSeconds, valuesSeconds * 1e6 / count, xmlSeconds / valuesSeconds);
+
+	delete source;
+
+	if( mismatches > 0 || count != events ) {
+		fprintf(report, "render: FAILED, %llu mismatches, %llu of %llu events read\n", (unsigned long long)mismatches, (unsigned long long)count, (unsigned long long)events);
+		return 1;
+	}
+
+	return 0;
+}
+
+
+/****
+ * LookupSystemFields
+ *
+ * DESC:
+ *     The System fields the way ExtractSystemFields used to read them, a
+ *     first_node (a scan of the children) per field. Kept as the baseline
+ *     for BenchFields, with the NULL checks the original lacked
+ */
+static BOOL LookupSystemFields(rapidxml::xml_document<WCHAR> *doc, SYSTEM_FIELDS *fields)
+{
+	rapidxml::xml_node<WCHAR> *nodeEvent = doc->first_node(L"Event");
+	rapidxml::xml_node<WCHAR> *nodeSystem = nodeEvent != NULL ? nodeEvent->first_node(L"System") : NULL;
+
+	if( nodeSystem == NULL )
+		return FALSE;
+
+	fields->eventId = ChildValue(nodeSystem, L"EventID");
+	fields->channel = ChildValue(nodeSystem, L"Channel");
+	fields->recordId = ChildValue(nodeSystem, L"EventRecordID");
+	fields->provider = ChildAttribute(nodeSystem, L"Provider", L"Name");
+	fields->computer = ChildValue(nodeSystem, L"Computer");
+	fields->timeCreated = ChildAttribute(nodeSystem, L"TimeCreated", L"SystemTime");
+	fields->task = ChildValue(nodeSystem, L"Task");
+	fields->level = ChildValue(nodeSystem, L"Level");
+
+	fields->recordIdValue = _wcstoui64(fields->recordId, NULL, 10);
+	fields->values = 0;
+
+	return TRUE;
+}
+
+
+// The same strings in every field, compared as text
+static BOOL SameText(SYSTEM_FIELDS *a, SYSTEM_FIELDS *b)
+{
+	return wcscmp(a->recordId, b->recordId) == 0
+		&& wcscmp(a->eventId, b->eventId) == 0
+		&& wcscmp(a->channel, b->channel) == 0
+		&& wcscmp(a->provider, b->provider) == 0
+		&& wcscmp(a->computer, b->computer) == 0
+		&& wcscmp(a->timeCreated, b->timeCreated) == 0
+		&& wcscmp(a->task, b->task) == 0
+		&& wcscmp(a->level, b->level) == 0
+		&& a->recordIdValue == b->recordIdValue;
+}
+
+
+/****
+ * RemoveElement
+ *
+ * DESC:
+ *     Cuts the first <name ...>...</name> (or <name .../>) out of event XML
+ *
+ * RETURNS:
+ *     FALSE if there is no such element
+ */
+static BOOL RemoveElement(std::wstring *xml, const std::wstring &name)
+{
+	size_t start = 0;
+
+	while( (start = xml->find(L"<" + name, start)) != std::wstring::npos ) {
+		WCHAR next = (*xml)[start + name.size() + 1];
+
+		if( next == L' ' || next == L'>' || next == L'/' )
+			break;
+		start++;
+	}
+
+	if( start == std::wstring::npos )
+		return FALSE;
+
+	size_t close = xml->find(L'>', start);
+
+	if( close == std::wstring::npos )
+		return FALSE;
+
+	size_t end = close + 1;
+
+	if( (*xml)[close - 1] != L'/' ) {
+		end = xml->find(L"</" + name + L">", close);
+
+		if( end == std::wstring::npos )
+			return FALSE;
+		end += name.size() + 3;
+	}
+
+	xml->erase(start, end - start);
+
+	return TRUE;
+}
+
+
+/****
+ * BenchFields
+ *
+ * DESC:
+ *     Times reading the System fields out of parsed event XML with a
+ *     first_node lookup per field against ExtractSystemFields' single walk,
+ *     and checks both agree. Then drops each System child (and <System>
+ *     itself) in turn and checks only that field comes back empty
+ */
+int BenchFields(BENCH_OPTIONS *options)
+{
+	const LPCWSTR children[] = { L"EventID", L"Channel", L"EventRecordID", L"Provider", L"Computer", L"TimeCreated", L"Task", L"Level" };
+	const size_t childCount = sizeof(children) / sizeof(children[0]);
+	const DWORD passes = 50;
+
+	DWORD64 events = 0;
+	EventSource *source = OpenSource(options, &events);
+
+	if( source == NULL )
+		return 1;
+
+	double lookupSeconds = 0, walkSeconds = 0;
+	DWORD64 count = 0, mismatches = 0, removed = 0, wrong = 0;
+	RenderContext *render = new RenderContext(source);
+	rapidxml::xml_document<WCHAR> *doc = new rapidxml::xml_document<WCHAR>();
+	volatile size_t sink = 0;
+
+	EVT_HANDLE hResults = source->Query(NULL, NULL, EvtQueryChannelPath | EvtQueryReverseDirection);
+	EVT_HANDLE hEvents[BATCH_SIZE_MAX];
+	DWORD dwReturned;
+
+	while( source->Next(hResults, BATCH_SIZE_MAX, hEvents, INFINITE, &dwReturned) && dwReturned > 0 ) {
+		for( DWORD i = 0; i < dwReturned; i++ ) {
+			LPWSTR rendered = render->RenderXml(hEvents[i], DEBUG_NONE);
+			std::wstring original(rendered != NULL ? rendered : L"");
+			std::vector<WCHAR> xml(original.begin(), original.end());
+			SYSTEM_FIELDS lookup, walk;
+
+			source->Close(hEvents[i]);
+			count++;
+
+			xml.push_back(L'\0');
+			doc->parse<0>(&xml[0]);
+
+			BOOL lookupOk = LookupSystemFields(doc, &lookup);
+			BOOL walkOk = ExtractSystemFields(doc, &walk);
+
+			if( !lookupOk || !walkOk || !SameText(&lookup, &walk) ) {
+				if( mismatches++ < 10 )
+					fprintf(report, "fields: MISMATCH on record %ls: lookup '%ls' '%ls' / walk '%ls' '%ls'\n",
+						lookupOk ? lookup.recordId : L"?", lookupOk ? lookup.eventId : L"?", lookupOk ? lookup.provider : L"?",
+						walkOk ? walk.eventId : L"?", walkOk ? walk.provider : L"?");
+				continue;
+			}
+
+			// Each extractor a number of times over the same document
+			std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+			for( DWORD pass = 0; pass < passes; pass++ ) {
+				LookupSystemFields(doc, &lookup);
+				sink = sink + (size_t)lookup.level;
+			}
+			lookupSeconds += Seconds(started);
+
+			started = std::chrono::steady_clock::now();
+			for( DWORD pass = 0; pass < passes; pass++ ) {
+				ExtractSystemFields(doc, &walk);
+				sink = sink + (size_t)walk.level;
+			}
+			walkSeconds += Seconds(started);
+
+			// A few hundred events are plenty to check what missing nodes do
+			if( count > 200 )
+				continue;
+
+			SYSTEM_FIELDS full;
+			std::vector<WCHAR> fullXml(original.begin(), original.end());
+
+			fullXml.push_back(L'\0');
+			doc->parse<0>(&fullXml[0]);
+			ExtractSystemFields(doc, &full);
+
+			for( size_t c = 0; c <= childCount; c++ ) {
+				std::wstring cut(original);
+
+				if( !RemoveElement(&cut, c < childCount ? children[c] : L"System") )
+					continue;
+
+				std::vector<WCHAR> cutXml(cut.begin(), cut.end());
+				SYSTEM_FIELDS fields;
+
+				cutXml.push_back(L'\0');
+				doc->parse<0>(&cutXml[0]);
+				removed++;
+
+				if( c == childCount ) {
+					wrong += ExtractSystemFields(doc, &fields) ? 1 : 0;
+					continue;
+				}
+
+				if( !ExtractSystemFields(doc, &fields) ) {
+					wrong++;
+					continue;
+				}
+
+				// Only the field that was cut may differ, and it must be empty
+				LPCWSTR *got[] = { &fields.eventId, &fields.channel, &fields.recordId, &fields.provider, &fields.computer, &fields.timeCreated, &fields.task, &fields.level };
+				LPCWSTR *want[] = { &full.eventId, &full.channel, &full.recordId, &full.provider, &full.computer, &full.timeCreated, &full.task, &full.level };
+				BOOL same = TRUE;
+
+				for( size_t f = 0; f < childCount; f++ )
+					same = same && wcscmp(*got[f], f == c ? L"" : *want[f]) == 0;
+
+				if( !same )
+					wrong++;
+			}
+		}
+	}
+	source->Close(hResults);
+
+	delete doc;
+	delete render;
+	delete source;
+
+	fprintf(report, "fields: %llu events (%s)\n", (unsigned long long)count, options->fixtures != NULL ? "fixtures" : "synthetic");
+	fprintf(report, "  first_node per field: %.1f ns/event\n", lookupSeconds * 1e9 / (count * passes));
+	fprintf(report, "  single walk:          %.1f ns/event (%.1fx)\n", walkSeconds * 1e9 / (count * passes), lookupSeconds / walkSeconds);
+	fprintf(report, "fields: %llu events with a System node cut out, %llu read wrong\n", (unsigned long long)removed, (unsigned long long)wrong);
+
+	if( mismatches > 0 || wrong > 0 || removed == 0 || count != events ) {
+		fprintf(report, "fields: FAILED, %llu mismatches, %llu of %llu events read\n", (unsigned long long)mismatches, (unsigned long long)count, (unsigned long long)events);
+		return 1;
+	}
+
+	return 0;
+}
+
+
+// The field strings, in SYSTEM_FIELDS order from the record ID on
+static std::vector<std::wstring> FieldTexts(SYSTEM_FIELDS *fields)
+{
+	LPCWSTR texts[] = { fields->recordId, fields->eventId, fields->channel, fields->provider, fields->computer, fields->timeCreated, fields->task, fields->level };
+
+	return std::vector<std::wstring>(texts, texts + sizeof(texts) / sizeof(texts[0]));
+}
+
+
+// Parse times of one event type, per pass
+struct PARSE_STATS {
+	DWORD64 events;
+	DWORD64 bytes;
+	double fullSeconds;
+	double systemSeconds;
+};
+
+/****
+ * BenchParse
+ *
+ * DESC:
+ *     Times parsing each event's whole XML against parsing it only up to
+ *     </System> (RenderContext::ParseSystem), per event ID, and checks
+ *     both give the same System fields
+ */
+int BenchParse(BENCH_OPTIONS *options)
+{
+	const DWORD passes = 20;
+
+	DWORD64 events = 0;
+	EventSource *source = OpenSource(options, &events);
+
+	if( source == NULL )
+		return 1;
+
+	RenderContext *render = new RenderContext(source);
+	std::map<std::wstring, PARSE_STATS> types;
+	DWORD64 count = 0, mismatches = 0;
+	std::vector<WCHAR> scratch;
+
+	EVT_HANDLE hResults = source->Query(NULL, NULL, EvtQueryChannelPath | EvtQueryReverseDirection);
+	EVT_HANDLE hEvents[BATCH_SIZE_MAX];
+	DWORD dwReturned;
+
+	while( source->Next(hResults, BATCH_SIZE_MAX, hEvents, INFINITE, &dwReturned) && dwReturned > 0 ) {
+		for( DWORD i = 0; i < dwReturned; i++ ) {
+			LPWSTR rendered = render->RenderXml(hEvents[i], DEBUG_NONE);
+			std::wstring xml(rendered != NULL ? rendered : L"");
+			SYSTEM_FIELDS fields;
+			std::vector<std::wstring> full, system;
+			double fullSeconds = 0, systemSeconds = 0;
+
+			source->Close(hEvents[i]);
+			count++;
+
+			// Both parse in-situ, so every parse gets a fresh copy
+			scratch.resize(xml.size() + 1);
+
+			memcpy(&scratch[0], xml.c_str(), scratch.size() * sizeof(WCHAR));
+			if( ExtractSystemFields(render->Parse(&scratch[0]), &fields) )
+				full = FieldTexts(&fields);
+
+			memcpy(&scratch[0], xml.c_str(), scratch.size() * sizeof(WCHAR));
+			if( ExtractSystemFields(render->ParseSystem(&scratch[0]), &fields) )
+				system = FieldTexts(&fields);
+
+			if( full.empty() || full != system ) {
+				if( mismatches++ < 10 )
+					fprintf(report, "parse: MISMATCH on event %llu\n", (unsigned long long)count);
+				continue;
+			}
+
+			for( DWORD pass = 0; pass < passes; pass++ ) {
+				memcpy(&scratch[0], xml.c_str(), scratch.size() * sizeof(WCHAR));
+
+				std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+				render->Parse(&scratch[0]);
+				fullSeconds += Seconds(started);
+
+				memcpy(&scratch[0], xml.c_str(), scratch.size() * sizeof(WCHAR));
+
+				started = std::chrono::steady_clock::now();
+				render->ParseSystem(&scratch[0]);
+				systemSeconds += Seconds(started);
+			}
+
+			PARSE_STATS &stats = types[full[2] + L" " + full[1]];
+
+			stats.events++;
+			stats.bytes += xml.size() * sizeof(WCHAR);
+			stats.fullSeconds += fullSeconds / passes;
+			stats.systemSeconds += systemSeconds / passes;
+		}
+	}
+	source->Close(hResults);
+
+	delete render;
+	delete source;
+
+	fprintf(report, "parse: %llu events (%s), MB/s of event XML parsed whole / up to </System>\n",
+		(unsigned long long)count, options->fixtures != NULL ? "fixtures" : "synthetic");
+
+	for( std::map<std::wstring, PARSE_STATS>::iterator it = types.begin(); it != types.end(); ++it ) {
+		PARSE_STATS &stats = it->second;
+
+		fprintf(report, "  %-16ls %7llu events, %5llu bytes/event: whole %6.0f MB/s, system %6.0f MB/s (%.1fx)\n",
+			it->first.c_str(), (unsigned long long)stats.events, (unsigned long long)(stats.bytes / stats.events),
+			stats.bytes / stats.fullSeconds / 1e6, stats.bytes / stats.systemSeconds / 1e6, stats.fullSeconds / stats.systemSeconds);
+	}
+
+	if( mismatches > 0 || count != events ) {
+		fprintf(report, "parse: FAILED, %llu mismatches, %llu of %llu events read\n", (unsigned long long)mismatches, (unsigned long long)count, (unsigned long long)events);
+		return 1;
+	}
+
+	return 0;
+}
+
+
+/****
+ * BenchAlloc
+ *
+ * DESC:
+ *     Checks that dumping an event does not allocate once the session has
+ *     warmed up, on both the XML and the values path, with and without
+ *     the EventData fields
+ */
+int BenchAlloc(BENCH_OPTIONS *options)
+{
+#if defined(ALLOCATION_COUNTING)
+	int result = 0;
+	INT modes[] = {
+		options->mode & ~MODE_RENDER_XML, options->mode | MODE_RENDER_XML,
+		(options->mode & ~MODE_RENDER_XML) | MODE_EVENT_DATA, options->mode | MODE_RENDER_XML | MODE_EVENT_DATA,
+		(options->mode & ~MODE_RENDER_XML) | MODE_IDENTITY, options->mode | MODE_RENDER_XML | MODE_IDENTITY,
+		options->mode & ~MODE_RENDER_XML, options->mode | MODE_RENDER_XML
+	};
+
+	// How each run formats its messages
+	DWORD messages[] = {
+		MESSAGES_REMOTE, MESSAGES_REMOTE, MESSAGES_REMOTE, MESSAGES_REMOTE, MESSAGES_REMOTE, MESSAGES_REMOTE,
+		MESSAGES_VERIFY, MESSAGES_VERIFY
+	};
+
+	for( int m = 0; m < (int)(sizeof(modes) / sizeof(modes[0])); m++ ) {
+		DWORD64 events = 0;
+		EventSource *source = OpenSource(options, &events);
+
+		if( source == NULL )
+			return 1;
+
+		{
+			EVENT_SESSION session(source);
+			StdoutSink sink;
+			EVT_HANDLE hResults = source->Query(NULL, NULL, EvtQueryChannelPath | EvtQueryReverseDirection);
+			EVT_HANDLE hEvents[BATCH_SIZE_MAX];
+			DWORD dwReturned;
+			DWORD64 count = 0, measured = 0;
+
+			session.templates.SetMode(messages[m]);
+
+			// The first pass over the providers and the largest events grows
+			// the buffers; only what comes after that is counted
+			DWORD64 warmup = events / 2;
+
+			allocations = 0;
+
+			while( source->Next(hResults, BATCH_SIZE_MAX, hEvents, INFINITE, &dwReturned) && dwReturned > 0 ) {
+				for( DWORD i = 0; i < dwReturned; i++, count++ ) {
+					counting = count >= warmup;
+					DumpEventInfo(&session, hEvents[i], &sink, options->outputFormat, modes[m], DEBUG_NONE);
+					counting = false;
+
+					if( count >= warmup )
+						measured++;
+
+					source->Close(hEvents[i]);
+				}
+			}
+			source->Close(hResults);
+
+			fprintf(report, "alloc: %llu allocations over %llu events (%s%s%s%s)\n", (unsigned long long)allocations.load(), (unsigned long long)measured,
+				(modes[m] & MODE_RENDER_XML) ? "xml" : "values", (modes[m] & MODE_EVENT_DATA) ? ", event data" : "",
+				(modes[m] & MODE_IDENTITY) ? ", identity" : "", messages[m] == MESSAGES_VERIFY ? ", message templates" : "");
+
+			if( allocations.load() != 0 || measured == 0 )
+				result = 1;
+		}
+
+		delete source;
+	}
+
+	if( result != 0 )
+		fprintf(report, "alloc: FAILED, steady state is expected not to allocate\n");
+
+	return result;
+#else
+	fprintf(report, "alloc: allocation counting needs glibc, and no sanitizer\n");
+	return 0;
+#endif
+}
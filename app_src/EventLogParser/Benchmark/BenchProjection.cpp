@@ -0,0 +1,173 @@
+#include "Benchmark.h"
+#include "LatencySource.h"
+
+
+// The JSON key of each record field
+static const struct {
+	LPCWSTR name;
+	DWORD field;
+} recordFieldKeys[] = {
+	{ L"record_id", RECORD_FIELD_RECORD_ID },
+	{ L"event_id", RECORD_FIELD_EVENT_ID },
+	{ L"logname", RECORD_FIELD_LOGNAME },
+	{ L"source", RECORD_FIELD_SOURCE },
+	{ L"computer", RECORD_FIELD_COMPUTER },
+	{ L"time_created", RECORD_FIELD_TIME_CREATED },
+	{ L"task", RECORD_FIELD_TASK },
+	{ L"level", RECORD_FIELD_LEVEL },
+	{ L"message", RECORD_FIELD_MESSAGE },
+};
+
+
+static const PROJECTION projections[] = {
+	{ "all", NULL },
+	{ "no-message", L"record_id,event_id,logname,source,computer,time_created,task,level" },
+	{ "identity", L"record_id, event_id ,computer,time_created,,event_id" },
+	{ "record-id", L"record_id" },
+	{ "message", L"message" },
+};
+
+#define PROJECTION_COUNT (sizeof(projections) / sizeof(projections[0]))
+
+
+/****
+ * BenchProjection
+ *
+ * DESC:
+ *     Checks that a record read with only some of its fields has exactly
+ *     those fields of the full record, that reading without the message
+ *     never opens publisher metadata or formats a message, and that last
+ *     record mode gets the same record IDs. Then times reading the log
+ *     with each projection, as it is and with --format-us the cost of
+ *     each message formatted remotely
+ */
+int BenchProjection(BENCH_OPTIONS *options)
+{
+	int result = 0;
+	DWORD64 events = 0;
+	EventSource *source = OpenSource(options, &events);
+
+	if( source == NULL )
+		return 1;
+
+	// The names are checked on the way in, and blanks and repeats do not count
+	DWORD parsed = 0, unknown = 0;
+
+	if( !ParseRecordFields(L"*", &parsed) || parsed != RECORD_FIELDS_ALL
+		|| !ParseRecordFields(L" , ", &parsed) || parsed != RECORD_FIELDS_ALL
+		|| !ParseRecordFields(L" message,record_id ", &parsed) || parsed != (RECORD_FIELD_MESSAGE | RECORD_FIELD_RECORD_ID)
+		|| ParseRecordFields(L"record_id,version", &unknown) || unknown != 0 ) {
+		fprintf(report, "projection: FAILED, field names not parsed as expected\n");
+		result = 1;
+	}
+
+	EVENT_SESSION *sessions[PROJECTION_COUNT];
+	EVENT_SESSION *last = new EVENT_SESSION(source);
+
+	for( size_t k = 0; k < PROJECTION_COUNT; k++ ) {
+		sessions[k] = new EVENT_SESSION(source);
+		ParseRecordFields(projections[k].fields, &sessions[k]->projection);
+	}
+
+	COLLECTOR collector;
+	CallbackSink sink(CollectRecord, &collector);
+	DWORD64 count = 0, mismatches = 0;
+
+	collector.calls = 0;
+	collector.refuse = 0;
+
+	EVT_HANDLE hResults = source->Query(NULL, NULL, EvtQueryChannelPath | EvtQueryReverseDirection);
+	EVT_HANDLE hEvents[BATCH_SIZE_MAX];
+	DWORD dwReturned;
+
+	while( source->Next(hResults, BATCH_SIZE_MAX, hEvents, INFINITE, &dwReturned) && dwReturned > 0 ) {
+		for( DWORD i = 0; i < dwReturned; i++, count++ ) {
+			std::map<std::wstring, std::wstring> full, record;
+
+			collector.records.clear();
+
+			for( size_t k = 0; k < PROJECTION_COUNT; k++ )
+				DumpEventInfo(sessions[k], hEvents[i], &sink, OUTPUT_FORMAT_JSON, options->mode, DEBUG_NONE);
+
+			DWORD64 lastRecordId = DumpEventInfo(last, hEvents[i], &sink, OUTPUT_FORMAT_JSON, options->mode | MODE_FETCH_LAST_RECORD, DEBUG_NONE);
+
+			BOOL ok = collector.records.size() == PROJECTION_COUNT && ReadJsonRecord(collector.records[0], &full)
+				&& lastRecordId == _wcstoui64(full[L"record_id"].c_str(), NULL, 10);
+
+			for( size_t k = 1; ok && k < PROJECTION_COUNT; k++ ) {
+				std::map<std::wstring, std::wstring> expected;
+				DWORD projection = sessions[k]->projection;
+
+				for( size_t f = 0; f < sizeof(recordFieldKeys) / sizeof(recordFieldKeys[0]); f++ ) {
+					if( projection & recordFieldKeys[f].field )
+						expected[recordFieldKeys[f].name] = full[recordFieldKeys[f].name];
+				}
+
+				ok = ReadJsonRecord(collector.records[k], &record) && record == expected;
+			}
+
+			if( !ok && mismatches++ < 10 ) {
+				fprintf(report, "projection: MISMATCH on event %llu (record %ls)\n", (unsigned long long)count + 1, full[L"record_id"].c_str());
+			}
+
+			source->Close(hEvents[i]);
+		}
+	}
+	source->Close(hResults);
+
+	// Without the message there is nothing to look up a publisher for
+	for( size_t k = 0; k < PROJECTION_COUNT; k++ ) {
+		BOOL message = (sessions[k]->projection & RECORD_FIELD_MESSAGE) != 0;
+		DWORD64 lookups = sessions[k]->publishers.Hits() + sessions[k]->publishers.Misses();
+
+		if( message != (lookups > 0) ) {
+			fprintf(report, "projection: FAILED, %s opened publisher metadata %llu times\n", projections[k].name, (unsigned long long)lookups);
+			result = 1;
+		}
+
+		sessions[k]->publishers.Clear();
+		delete sessions[k];
+	}
+
+	if( last->publishers.Hits() + last->publishers.Misses() > 0 ) {
+		fprintf(report, "projection: FAILED, last record mode opened publisher metadata\n");
+		result = 1;
+	}
+
+	last->publishers.Clear();
+	delete last;
+
+	fprintf(report, "projection: %llu events (%s, %s)\n", (unsigned long long)count,
+		options->fixtures != NULL ? "fixtures" : "synthetic", (options->mode & MODE_RENDER_XML) ? "xml" : "values");
+
+	if( mismatches > 0 || count != events ) {
+		fprintf(report, "projection: FAILED, %llu mismatches, %llu of %llu events read\n",
+			(unsigned long long)mismatches, (unsigned long long)count, (unsigned long long)events);
+		result = 1;
+	}
+
+	// As the core reads them, then with each message a round trip
+	LatencySource latency(source, 0, 0, 0, options->formatUs);
+	double seconds[PROJECTION_COUNT][2];
+
+	for( size_t k = 0; k < PROJECTION_COUNT; k++ ) {
+		for( int l = 0; l < 2; l++ ) {
+			EVENT_SESSION session(l == 0 ? source : (EventSource *)&latency);
+
+			ParseRecordFields(projections[k].fields, &session.projection);
+
+			if( TimeDump(&session, options->mode, &seconds[k][l]) != events )
+				result = 1;
+
+			session.publishers.Clear();
+		}
+
+		fprintf(report, "  %-10s %.3f s, %.0f events/s (%.2fx the time); at %u us a message %.3f s, %.0f events/s (%.2fx the time)\n", projections[k].name,
+			seconds[k][0], events / seconds[k][0], seconds[k][0] / seconds[0][0],
+			options->formatUs, seconds[k][1], events / seconds[k][1], seconds[k][1] / seconds[0][1]);
+	}
+
+	delete source;
+
+	return result;
+}
@@ -0,0 +1,145 @@
+#include "Benchmark.h"
+#include "EventCursor.h"
+#include "SyntheticSource.h"
+#include "LatencySource.h"
+
+
+/****
+ * ReadAll
+ *
+ * DESC:
+ *     Polls a cursor until it has nothing new, checking no poll returns
+ *     more than it asked for
+ *
+ * RETURNS:
+ *     The number of events read, or (DWORD64)-1 if a poll overran
+ */
+DWORD64 ReadAll(EventCursor *cursor, DWORD batch, BENCH_OPTIONS *options)
+{
+	DWORD64 total = 0;
+	DWORD read;
+	StdoutSink sink;
+
+	while( (read = cursor->Read(batch, &sink, options->outputFormat, options->mode, DEBUG_NONE)) > 0 ) {
+		if( read > batch )
+			return (DWORD64)-1;
+		total += read;
+	}
+
+	return total;
+}
+
+
+/****
+ * BenchSession
+ *
+ * DESC:
+ *     Checks that a cursor (what StartSession and ReadNextEvent use) reads
+ *     every event exactly once, including events written after it ran dry.
+ *     Then compares polling through one session and cursor with setting
+ *     up a session and query on every poll, against a source with a fixed
+ *     cost per round trip
+ */
+int BenchSession(BENCH_OPTIONS *options)
+{
+	DWORD batch = options->batch;
+	DWORD64 appended = batch * 2 + 7;
+	int result = 0;
+
+	{
+		SyntheticSource synthetic(options->events);
+		EVENT_SESSION session(&synthetic);
+		EventCursor cursor(&session);
+
+		if( !cursor.Start(NULL, NULL, DEBUG_NONE) )
+			return 1;
+
+		DWORD64 first = ReadAll(&cursor, batch, options);
+
+		synthetic.Append(appended);
+
+		DWORD64 second = ReadAll(&cursor, batch, options);
+		StdoutSink sink;
+		DWORD idle = cursor.Read(batch, &sink, options->outputFormat, options->mode, DEBUG_NONE);
+
+		if( first != options->events || second != appended || idle != 0 || cursor.LastRecordId() != options->events + appended ) {
+			fprintf(report, "session: FAILED, read %llu + %llu + %u events (expected %llu + %llu + 0), last record %llu\n",
+				(unsigned long long)first, (unsigned long long)second, idle, (unsigned long long)options->events,
+				(unsigned long long)appended, (unsigned long long)cursor.LastRecordId());
+			result = 1;
+		}
+
+		session.publishers.Clear();
+	}
+
+	SyntheticSource synthetic(options->events);
+	LatencySource source(&synthetic, options->nextMs, options->perEventUs, options->nextMs);
+	DWORD64 polls = (options->events + batch - 1) / batch;
+	double reconnect, persistent;
+	DWORD64 count = 0;
+	DWORD64 queries[2] = { 0, 0 };
+
+	{
+		std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+
+		// What every poll costs when it starts from scratch: a new session (so
+		// cold publisher metadata) and a new query
+		for( DWORD64 poll = 0; poll < polls; poll++ ) {
+			EVENT_SESSION session(&source);
+			StdoutSink sink;
+			EVT_HANDLE hResults = source.Query(NULL, NULL, EvtQueryChannelPath | EvtQueryForwardDirection);
+			EVT_HANDLE hEvents[CURSOR_NEXT_MAX];
+			DWORD dwReturned = 0;
+			DWORD read = 0;
+
+			queries[0]++;
+
+			while( read < batch && source.Next(hResults, batch - read < CURSOR_NEXT_MAX ? batch - read : CURSOR_NEXT_MAX, hEvents, INFINITE, &dwReturned) ) {
+				for( DWORD i = 0; i < dwReturned; i++ ) {
+					DumpEventInfo(&session, hEvents[i], &sink, options->outputFormat, options->mode, DEBUG_NONE);
+					source.Close(hEvents[i]);
+				}
+				read += dwReturned;
+			}
+
+			source.Close(hResults);
+			session.publishers.Clear();
+		}
+		fflush(stdout);
+
+		reconnect = Seconds(started);
+	}
+
+	{
+		std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+
+		EVENT_SESSION session(&source);
+		EventCursor cursor(&session);
+
+		if( cursor.Start(NULL, NULL, DEBUG_NONE) ) {
+			for( DWORD64 poll = 0; poll < polls; poll++ ) {
+				StdoutSink sink;
+				count += cursor.Read(batch, &sink, options->outputFormat, options->mode, DEBUG_NONE);
+			}
+		}
+		fflush(stdout);
+
+		persistent = Seconds(started);
+		queries[1] = cursor.Queries();
+
+		cursor.Close();
+		session.publishers.Clear();
+	}
+
+	fprintf(report, "session: %llu polls of %u events, %u ms per round trip, %u us per event\n",
+		(unsigned long long)polls, batch, options->nextMs, options->perEventUs);
+	fprintf(report, "  reconnect per poll: %.3f s, %.2f ms/poll, %llu queries\n", reconnect, reconnect * 1e3 / polls, (unsigned long long)queries[0]);
+	fprintf(report, "  persistent cursor:  %.3f s, %.2f ms/poll, %llu queries (%.1fx)\n", persistent, persistent * 1e3 / polls, (unsigned long long)queries[1], reconnect / persistent);
+
+	if( count != options->events ) {
+		fprintf(report, "session: FAILED, the cursor read %llu of %llu events\n", (unsigned long long)count, (unsigned long long)options->events);
+		result = 1;
+	}
+
+	return result;
+}
@@ -0,0 +1,160 @@
+#include "Benchmark.h"
+#include "EventCursor.h"
+#include "SyntheticSource.h"
+
+
+/****
+ * BenchSink
+ *
+ * DESC:
+ *     Checks the buffer and callback sinks hand over exactly the records
+ *     STDOUT gets, in order and each once, however often they push back.
+ *     Then times reading the whole log into STDOUT and into a buffer
+ */
+int BenchSink(BENCH_OPTIONS *options)
+{
+	DWORD batch = options->batch;
+	int result = 0;
+	SyntheticSource source(options->events);
+	std::vector<std::wstring> expected, buffered;
+	COLLECTOR collector;
+
+	collector.calls = 0;
+	collector.refuse = 0;
+
+	{
+		EVENT_SESSION session(&source);
+		EventCursor cursor(&session);
+		CallbackSink sink(CollectRecord, &collector);
+
+		cursor.Start(NULL, NULL, DEBUG_NONE);
+		while( cursor.Read(batch, &sink, options->outputFormat, options->mode, DEBUG_NONE) > 0 )
+			;
+
+		expected.swap(collector.records);
+		session.publishers.Clear();
+	}
+
+	// A callback that refuses now and then
+	collector.refuse = 7;
+
+	{
+		EVENT_SESSION session(&source);
+		EventCursor cursor(&session);
+		DWORD refused = 0;
+
+		cursor.Start(NULL, NULL, DEBUG_NONE);
+
+		while( TRUE ) {
+			CallbackSink sink(CollectRecord, &collector);
+			DWORD read = cursor.Read(batch, &sink, options->outputFormat, options->mode, DEBUG_NONE);
+
+			if( cursor.Status() == ERROR_MORE_DATA || cursor.Status() == ERROR_INSUFFICIENT_BUFFER )
+				refused++;
+			else if( read == 0 )
+				break;
+		}
+
+		if( collector.records != expected || refused == 0 ) {
+			fprintf(report, "sink: FAILED, the callback got %llu records (expected %llu) after refusing %u times\n",
+				(unsigned long long)collector.records.size(), (unsigned long long)expected.size(), refused);
+			result = 1;
+		}
+
+		session.publishers.Clear();
+	}
+
+	// A buffer that starts out too small for any record and grows when told to
+	{
+		EVENT_SESSION session(&source);
+		EventCursor cursor(&session);
+		std::vector<WCHAR> buffer(16);
+		DWORD grown = 0, full = 0;
+
+		cursor.Start(NULL, NULL, DEBUG_NONE);
+
+		while( TRUE ) {
+			BufferSink sink(&buffer[0], (DWORD)buffer.size());
+			DWORD read = cursor.Read(batch, &sink, options->outputFormat, options->mode, DEBUG_NONE);
+
+			// Records are null terminated, back to back
+			for( DWORD used = 0; used < sink.Used(); ) {
+				std::wstring record(&buffer[used]);
+
+				buffered.push_back(record);
+				used += (DWORD)record.size() + 1;
+			}
+
+			if( cursor.Status() == ERROR_INSUFFICIENT_BUFFER ) {
+				if( read != 0 || sink.Required() <= buffer.size() )
+					break;
+
+				// Room for about three records of that size from now on
+				buffer.resize(sink.Required() * 3);
+				grown++;
+			} else if( cursor.Status() == ERROR_MORE_DATA ) {
+				full++;
+			} else if( read == 0 ) {
+				break;
+			}
+		}
+
+		if( buffered != expected || grown == 0 || full == 0 ) {
+			fprintf(report, "sink: FAILED, the buffer got %llu records (expected %llu), grown %u times, full %u times\n",
+				(unsigned long long)buffered.size(), (unsigned long long)expected.size(), grown, full);
+			result = 1;
+		}
+
+		session.publishers.Clear();
+	}
+
+	if( expected.size() != options->events ) {
+		fprintf(report, "sink: FAILED, read %llu of %llu events\n", (unsigned long long)expected.size(), (unsigned long long)options->events);
+		result = 1;
+	}
+
+	// Reading everything into STDOUT (which goes to /dev/null) versus into
+	// one buffer per poll that the caller then walks
+	double seconds[2];
+	std::vector<WCHAR> buffer(1024 * 1024);
+
+	for( int i = 0; i < 2; i++ ) {
+		EVENT_SESSION session(&source);
+		EventCursor cursor(&session);
+		DWORD64 records = 0;
+
+		std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+
+		cursor.Start(NULL, NULL, DEBUG_NONE);
+
+		while( TRUE ) {
+			DWORD read;
+
+			if( i == 0 ) {
+				StdoutSink sink;
+				read = cursor.Read(batch, &sink, options->outputFormat, options->mode, DEBUG_NONE);
+			} else {
+				BufferSink sink(&buffer[0], (DWORD)buffer.size());
+				read = cursor.Read(batch, &sink, options->outputFormat, options->mode, DEBUG_NONE);
+			}
+
+			if( read == 0 && cursor.Status() != ERROR_MORE_DATA )
+				break;
+
+			records += read;
+		}
+		fflush(stdout);
+
+		seconds[i] = Seconds(started);
+		session.publishers.Clear();
+
+		if( records != options->events )
+			result = 1;
+	}
+
+	fprintf(report, "sink: %llu events, %u per read\n", (unsigned long long)options->events, batch);
+	fprintf(report, "  stdout: %.3f s, %.0f events/s\n", seconds[0], options->events / seconds[0]);
+	fprintf(report, "  buffer: %.3f s, %.0f events/s (%.1fx)\n", seconds[1], options->events / seconds[1], seconds[0] / seconds[1]);
+
+	return result;
+}
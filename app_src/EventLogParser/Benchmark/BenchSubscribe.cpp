@@ -0,0 +1,358 @@
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include "Benchmark.h"
+#include "EventCursor.h"
+#include "LatencySource.h"
+
+
+// Channel BenchSubscribe reads, and how the comparison polls and waits
+#define SUBSCRIBE_CHANNEL L"Security"
+#define SUBSCRIBE_POLL_MS 50
+#define SUBSCRIBE_WAIT_MS 100
+
+// Events written at a time by AppendOverTime, and how often
+#define SUBSCRIBE_BURST 10
+#define SUBSCRIBE_BURST_MS 2
+
+// One Append of AppendOverTime: the last record it wrote, and when
+struct APPENDED {
+	DWORD64 lastRecordId;
+	std::chrono::steady_clock::time_point at;
+};
+
+/****
+ * AppendOverTime
+ *
+ * DESC:
+ *     Writes events to the fixture logs a burst at a time, the way a busy
+ *     machine does, while the benchmark reads them
+ */
+static void AppendOverTime(FixtureSource *fixture, DWORD64 events, std::vector<APPENDED> *appended, std::atomic<DWORD64> *written)
+{
+	while( *written < events ) {
+		DWORD burst = events - *written < SUBSCRIBE_BURST ? (DWORD)(events - *written) : SUBSCRIBE_BURST;
+		APPENDED batch;
+
+		std::this_thread::sleep_for(std::chrono::milliseconds(SUBSCRIBE_BURST_MS));
+
+		batch.at = std::chrono::steady_clock::now();
+		batch.lastRecordId = fixture->Append(burst);
+		appended->push_back(batch);
+
+		*written += burst;
+	}
+}
+
+
+/****
+ * ReadCollected
+ *
+ * DESC:
+ *     Reads a cursor once into a collector, noting when each record came
+ *
+ * RETURNS:
+ *     The number of records read
+ */
+static DWORD ReadCollected(EventCursor *cursor, COLLECTOR *collector, std::vector<std::chrono::steady_clock::time_point> *received, BENCH_OPTIONS *options)
+{
+	CallbackSink sink(CollectRecord, collector);
+	DWORD read = cursor->Read(options->batch, &sink, options->outputFormat, options->mode, DEBUG_NONE);
+
+	if( received != NULL )
+		received->resize(collector->records.size(), std::chrono::steady_clock::now());
+
+	return read;
+}
+
+
+// Milliseconds from each record's Append to its being read, for the
+// records written after "before"
+static void AppendLatency(const std::vector<DWORD64> &ids, const std::vector<std::chrono::steady_clock::time_point> &received,
+	const std::vector<APPENDED> &appended, DWORD64 before, double *mean, double *max)
+{
+	DWORD64 count = 0;
+
+	*mean = *max = 0;
+
+	for( size_t i = 0; i < ids.size() && i < received.size(); i++ ) {
+		std::vector<APPENDED>::const_iterator batch = std::lower_bound(appended.begin(), appended.end(), ids[i],
+			[](const APPENDED &a, DWORD64 id) { return a.lastRecordId < id; });
+
+		if( ids[i] <= before || batch == appended.end() )
+			continue;
+
+		double ms = std::chrono::duration<double, std::milli>(received[i] - batch->at).count();
+
+		*mean += ms;
+		*max = ms > *max ? ms : *max;
+		count++;
+	}
+
+	if( count > 0 )
+		*mean /= count;
+}
+
+
+// The RecordId a bookmark points at (0 for none)
+static DWORD64 BookmarkRecordId(LPCWSTR bookmark)
+{
+	LPCWSTR at = bookmark != NULL ? wcsstr(bookmark, L"RecordId='") : NULL;
+
+	return at != NULL ? _wcstoui64(at + 10, NULL, 10) : 0;
+}
+
+
+/****
+ * BenchSubscribe
+ *
+ * DESC:
+ *     Checks that a subscription reads every event of its channel exactly
+ *     once and in order while events are being written, across a restart
+ *     from its bookmark half way through, without querying again. Checks
+ *     a filtered subscription and its bookmark, and strict bookmarks.
+ *     Then compares how long written events take to be read by a cursor
+ *     polling every SUBSCRIBE_POLL_MS and by a subscription, through a
+ *     source with a fixed cost per round trip
+ *
+ * REMARKS:
+ *     Needs the fixtures, as only the fixture source can be written to;
+ *     --fixtures defaults to "fixtures". --events is the number of events
+ *     written (default 2000)
+ */
+int BenchSubscribe(BENCH_OPTIONS *options)
+{
+	int result = 0;
+	FixtureSource fixture(1);
+
+	if( !LoadFixtures(&fixture, options, 0) )
+		return 1;
+
+	std::vector<APPENDED> appended;
+	std::atomic<DWORD64> written(0);
+	COLLECTOR collector;
+	std::vector<std::chrono::steady_clock::time_point> received;
+	std::wstring bookmark;
+	DWORD64 queries = 0;
+	DWORD restarts = 0;
+
+	collector.calls = 0;
+	collector.refuse = 0;
+
+	// No channel can hand out more than that, however it goes wrong
+	DWORD64 most = fixture.Count() + options->events;
+
+	{
+		std::thread writer(AppendOverTime, &fixture, options->events, &appended, &written);
+		EVENT_SESSION *session = new EVENT_SESSION(&fixture);
+		EventCursor *cursor = new EventCursor(session);
+
+		if( !cursor->Subscribe(SUBSCRIBE_CHANNEL, NULL, NULL, SUBSCRIBE_WAIT_MS, DEBUG_NONE) )
+			result = 1;
+
+		while( result == 0 ) {
+			BOOL finished = written == options->events;
+			DWORD read = ReadCollected(cursor, &collector, &received, options);
+
+			if( (read == 0 && cursor->Status() != ERROR_SUCCESS) || collector.records.size() > most )
+				result = 1;
+			else if( read == 0 && finished )
+				break;
+
+			// Half way, start over from the bookmark as a new process would
+			if( restarts == 0 && written >= options->events / 2 ) {
+				LPCWSTR saved = cursor->Bookmark();
+
+				bookmark = saved != NULL ? saved : L"";
+				queries += cursor->Queries();
+
+				delete cursor;
+				session->publishers.Clear();
+				delete session;
+
+				session = new EVENT_SESSION(&fixture);
+				cursor = new EventCursor(session);
+
+				if( !cursor->Subscribe(SUBSCRIBE_CHANNEL, NULL, bookmark.c_str(), SUBSCRIBE_WAIT_MS, DEBUG_NONE) )
+					result = 1;
+
+				restarts++;
+			}
+		}
+
+		writer.join();
+
+		queries += cursor->Queries();
+
+		delete cursor;
+		session->publishers.Clear();
+		delete session;
+	}
+
+	// What a query finds in the channel now that everything is written
+	std::vector<DWORD64> expected;
+	std::vector<std::wstring> expectedRecords;
+
+	{
+		COLLECTOR everything;
+		EVENT_SESSION session(&fixture);
+		EventCursor cursor(&session);
+
+		everything.calls = 0;
+		everything.refuse = 0;
+
+		cursor.Start(SUBSCRIBE_CHANNEL, NULL, DEBUG_NONE);
+		while( ReadCollected(&cursor, &everything, NULL, options) > 0 )
+			;
+
+		expectedRecords.swap(everything.records);
+		expected = CollectedRecordIds(expectedRecords);
+		session.publishers.Clear();
+	}
+
+	std::vector<DWORD64> ids = CollectedRecordIds(collector.records);
+
+	if( ids != expected || queries != 2 || restarts != 1 || BookmarkRecordId(bookmark.c_str()) == 0 ) {
+		fprintf(report, "subscribe: FAILED, read %llu records (expected %llu) with %llu subscriptions, restarting at '%ls'\n",
+			(unsigned long long)ids.size(), (unsigned long long)expected.size(), (unsigned long long)queries, bookmark.c_str());
+		result = 1;
+	}
+
+	// A filtered subscription, and where its bookmark ends up
+	{
+		EventFilter filter;
+		COLLECTOR filtered;
+		std::vector<DWORD64> wanted;
+		EVENT_SESSION session(&fixture);
+		EventCursor cursor(&session);
+
+		filtered.calls = 0;
+		filtered.refuse = 0;
+
+		filter.Parse(L"events=4624,4634");
+
+		for( size_t i = 0; i < expectedRecords.size(); i++ ) {
+			std::map<std::wstring, std::wstring> values;
+
+			if( ReadJsonRecord(expectedRecords[i], &values) && (values[L"event_id"] == L"4624" || values[L"event_id"] == L"4634") )
+				wanted.push_back(expected[i]);
+		}
+
+		cursor.Subscribe(SUBSCRIBE_CHANNEL, &filter, NULL, 0, DEBUG_NONE);
+		while( ReadCollected(&cursor, &filtered, NULL, options) > 0 )
+			;
+
+		LPCWSTR end = cursor.Bookmark();
+		std::wstring endBookmark = end != NULL ? end : L"";
+
+		// Nothing is left after the bookmark, even for a new subscription
+		EventCursor again(&session);
+		DWORD more = 0;
+
+		again.Subscribe(SUBSCRIBE_CHANNEL, &filter, endBookmark.c_str(), 0, DEBUG_NONE);
+		more = ReadCollected(&again, &filtered, NULL, options);
+
+		if( CollectedRecordIds(filtered.records) != wanted || wanted.empty() || BookmarkRecordId(endBookmark.c_str()) != wanted.back() || more != 0 || again.Status() != ERROR_SUCCESS ) {
+			fprintf(report, "subscribe: FAILED, the filtered subscription read %llu records (expected %llu) and stopped at '%ls'\n",
+				(unsigned long long)filtered.records.size() - more, (unsigned long long)wanted.size(), endBookmark.c_str());
+			result = 1;
+		}
+
+		again.Close();
+		cursor.Close();
+		session.publishers.Clear();
+	}
+
+	// A strict subscription fails when the bookmarked record is gone
+	{
+		EVT_HANDLE hBookmark = fixture.CreateBookmark(L"<BookmarkList><Bookmark Channel='Security' RecordId='7' IsCurrent='true'/></BookmarkList>");
+		EVT_HANDLE hLoose = fixture.Subscribe(SUBSCRIBE_CHANNEL, NULL, hBookmark, EvtSubscribeStartAfterBookmark);
+		EVT_HANDLE hStrict = fixture.Subscribe(SUBSCRIBE_CHANNEL, NULL, hBookmark, EvtSubscribeStartAfterBookmark | EvtSubscribeStrict);
+		DWORD error = GetLastError();
+
+		if( hBookmark == NULL || hLoose == NULL || hStrict != NULL || error != ERROR_NOT_FOUND || fixture.CreateBookmark(L"<Bookmark/>") != NULL ) {
+			fprintf(report, "subscribe: FAILED, strict subscription after a missing record gave error %u\n", error);
+			result = 1;
+		}
+
+		if( hLoose != NULL )
+			fixture.Close(hLoose);
+		if( hBookmark != NULL )
+			fixture.Close(hBookmark);
+	}
+
+	// Polling against subscribing, through round trips
+	static const LPCWSTR approaches[] = { L"poll", L"subscribe" };
+	double latency[2][2];
+	DWORD64 roundTrips[2];
+
+	for( int subscribe = 0; subscribe < 2; subscribe++ ) {
+		FixtureSource timed(1);
+		std::vector<APPENDED> timedAppended;
+		std::atomic<DWORD64> timedWritten(0);
+		COLLECTOR timedCollector;
+		std::vector<std::chrono::steady_clock::time_point> timedReceived;
+
+		LoadFixtures(&timed, options, 0);
+		timedCollector.calls = 0;
+		timedCollector.refuse = 0;
+
+		LatencySource source(&timed, options->nextMs, options->perEventUs);
+		EVENT_SESSION session(&source);
+		EventCursor cursor(&session);
+		DWORD64 initial = 0;
+		DWORD64 before = timed.Append(0);
+
+		if( subscribe ? !cursor.Subscribe(SUBSCRIBE_CHANNEL, NULL, NULL, SUBSCRIBE_WAIT_MS, DEBUG_NONE) : !cursor.Start(SUBSCRIBE_CHANNEL, NULL, DEBUG_NONE) ) {
+			result = 1;
+			break;
+		}
+
+		// What the log held already is not what is being timed
+		while( ReadCollected(&cursor, &timedCollector, &timedReceived, options) == options->batch )
+			;
+		initial = timedCollector.records.size();
+
+		std::thread writer(AppendOverTime, &timed, options->events, &timedAppended, &timedWritten);
+
+		while( TRUE ) {
+			BOOL finished = timedWritten == options->events;
+			DWORD read = ReadCollected(&cursor, &timedCollector, &timedReceived, options);
+
+			if( (read == 0 && (finished || cursor.Status() != ERROR_SUCCESS)) || timedCollector.records.size() > most )
+				break;
+
+			// A poller looks again once its interval is up, unless it is behind
+			if( !subscribe && read < options->batch )
+				std::this_thread::sleep_for(std::chrono::milliseconds(SUBSCRIBE_POLL_MS));
+		}
+
+		writer.join();
+
+		AppendLatency(CollectedRecordIds(timedCollector.records), timedReceived, timedAppended, before, &latency[subscribe][0], &latency[subscribe][1]);
+		roundTrips[subscribe] = cursor.Queries();
+
+		DWORD64 channelAppended = timedCollector.records.size() - initial;
+
+		if( channelAppended == 0 || CollectedRecordIds(timedCollector.records).size() != timedCollector.records.size() ) {
+			fprintf(report, "subscribe: FAILED, %ls read nothing that was written\n", approaches[subscribe]);
+			result = 1;
+		}
+
+		cursor.Close();
+		session.publishers.Clear();
+	}
+
+	fprintf(report, "subscribe: %llu events written in bursts of %u every %u ms, %u ms per round trip\n",
+		(unsigned long long)options->events, SUBSCRIBE_BURST, SUBSCRIBE_BURST_MS, options->nextMs);
+
+	if( result == 0 ) {
+		fprintf(report, "  poll every %u ms:  %.1f ms mean, %.1f ms worst from write to read, %llu queries\n",
+			SUBSCRIBE_POLL_MS, latency[0][0], latency[0][1], (unsigned long long)roundTrips[0]);
+		fprintf(report, "  subscription:     %.1f ms mean, %.1f ms worst from write to read, %llu subscribe\n",
+			latency[1][0], latency[1][1], (unsigned long long)roundTrips[1]);
+		fprintf(report, "  restart from bookmark: %llu records read once each, in order\n", (unsigned long long)ids.size());
+	}
+
+	return result;
+}
@@ -0,0 +1,146 @@
+#include "Benchmark.h"
+#include "LatencySource.h"
+
+
+/****
+ * SkewedTemplates
+ *
+ * DESC:
+ *     Source that hands out templates the local formatter has to cope
+ *     with: one that no longer matches the messages (Application Error
+ *     1000), one inserting a value the events do not have (DNS-Client
+ *     1014) and one with an escape it does not know (Kernel-General 12)
+ */
+class SkewedTemplates : public LatencySource {
+public:
+	SkewedTemplates(EventSource *inner) : LatencySource(inner, 0) {}
+
+	BOOL GetMessageTemplate(EVT_HANDLE hMetadata, DWORD eventId, DWORD version, DWORD bufferSize, LPWSTR buffer, DWORD *bufferUsed)
+	{
+		if( !LatencySource::GetMessageTemplate(hMetadata, eventId, version, bufferSize, buffer, bufferUsed) )
+			return FALSE;
+
+		LPWSTR insert = wcschr(buffer, L'%');
+
+		if( eventId == 1000 )
+			buffer[0] = L'f';
+		else if( eventId == 1014 && insert != NULL )
+			insert[1] = L'9';
+		else if( eventId == 12 && insert != NULL )
+			insert[1] = L'z';
+
+		return TRUE;
+	}
+};
+
+
+/****
+ * BenchTemplates
+ *
+ * DESC:
+ *     Checks that messages formatted from cached templates are exactly
+ *     what the source formats, with and without verification, and that
+ *     verification catches a template that has gone stale. Then times
+ *     reading the log with every message formatted remotely against
+ *     formatting them locally, with --format-us the cost of a remote one
+ */
+int BenchTemplates(BENCH_OPTIONS *options)
+{
+	int result = 0;
+	DWORD64 events = 0;
+	EventSource *source = OpenSource(options, &events);
+
+	if( source == NULL )
+		return 1;
+
+	SkewedTemplates skewed(source);
+
+	// Remote (the reference), local, verifying every message, and on the
+	// skewed templates verifying a sample and not verifying at all
+	EVENT_SESSION *sessions[5];
+	EventSource *sources[5] = { source, source, source, &skewed, &skewed };
+	DWORD modes[5] = { MESSAGES_REMOTE, MESSAGES_LOCAL, MESSAGES_VERIFY, MESSAGES_VERIFY, MESSAGES_LOCAL };
+
+	for( int k = 0; k < 5; k++ ) {
+		sessions[k] = new EVENT_SESSION(sources[k]);
+		sessions[k]->templates.SetMode(modes[k], k == 2 ? 1 : MESSAGE_VERIFY_EVERY);
+	}
+
+	COLLECTOR collector;
+	CallbackSink sink(CollectRecord, &collector);
+	DWORD64 count = 0, mismatches = 0, stale = 0;
+
+	collector.calls = 0;
+	collector.refuse = 0;
+
+	EVT_HANDLE hResults = source->Query(NULL, NULL, EvtQueryChannelPath | EvtQueryReverseDirection);
+	EVT_HANDLE hEvents[BATCH_SIZE_MAX];
+	DWORD dwReturned;
+
+	while( source->Next(hResults, BATCH_SIZE_MAX, hEvents, INFINITE, &dwReturned) && dwReturned > 0 ) {
+		for( DWORD i = 0; i < dwReturned; i++, count++ ) {
+			collector.records.clear();
+
+			for( int k = 0; k < 5; k++ )
+				DumpEventInfo(sessions[k], hEvents[i], &sink, options->outputFormat, options->mode, DEBUG_NONE);
+
+			BOOL ok = collector.records.size() == 5;
+
+			for( int k = 1; ok && k < 4; k++ )
+				ok = collector.records[k] == collector.records[0];
+
+			if( ok && collector.records[4] != collector.records[0] )
+				stale++;
+
+			if( !ok && mismatches++ < 10 )
+				fprintf(report, "templates: MISMATCH on event %llu\n", (unsigned long long)count + 1);
+
+			source->Close(hEvents[i]);
+		}
+	}
+	source->Close(hResults);
+
+	MessageTemplates *local = &sessions[1]->templates, *verify = &sessions[2]->templates, *skew = &sessions[3]->templates;
+
+	fprintf(report, "templates: %llu events (%s, %s), %llu templates, %llu messages formatted locally, %llu remotely\n",
+		(unsigned long long)count, options->fixtures != NULL ? "fixtures" : "synthetic", (options->mode & MODE_RENDER_XML) ? "xml" : "values",
+		(unsigned long long)local->Misses(), (unsigned long long)local->Local(), (unsigned long long)local->Remote());
+	fprintf(report, "  verify: %llu checked, %llu did not match; skewed: %llu checked, %llu did not match, %llu remote, %llu records wrong without verifying\n",
+		(unsigned long long)verify->Checked(), (unsigned long long)verify->Mismatches(), (unsigned long long)skew->Checked(),
+		(unsigned long long)skew->Mismatches(), (unsigned long long)skew->Remote(), (unsigned long long)stale);
+
+	if( mismatches > 0 || count != events || verify->Checked() == 0 || verify->Mismatches() > 0
+		|| local->Local() == 0 || skew->Mismatches() == 0 || skew->Remote() == 0 || stale == 0 ) {
+		fprintf(report, "templates: FAILED, %llu mismatches, %llu of %llu events read\n",
+			(unsigned long long)mismatches, (unsigned long long)count, (unsigned long long)events);
+		result = 1;
+	}
+
+	for( int k = 0; k < 5; k++ ) {
+		sessions[k]->publishers.Clear();
+		delete sessions[k];
+	}
+
+	// Each message formatted remotely pays a round trip
+	LatencySource latency(source, 0, 0, 0, options->formatUs);
+	const char *timedNames[] = { "remote", "local", "verify" };
+	double seconds[3];
+
+	for( int t = 0; t < 3; t++ ) {
+		EVENT_SESSION session(&latency);
+
+		session.templates.SetMode(modes[t]);
+
+		if( TimeDump(&session, options->mode, &seconds[t]) != events )
+			result = 1;
+
+		fprintf(report, "  %-6s %.3f s, %.0f events/s, %llu remote messages (%.2fx the time)\n", timedNames[t], seconds[t], events / seconds[t],
+			(unsigned long long)(session.templates.Remote() + session.templates.Checked()), seconds[t] / seconds[0]);
+
+		session.publishers.Clear();
+	}
+
+	delete source;
+
+	return result;
+}
@@ -0,0 +1,380 @@
+#include <string.h>
+#include "Benchmark.h"
+#include "EventCursor.h"
+#include "Utf8Encode.h"
+
+
+/****
+ * IsValidUtf8
+ *
+ * DESC:
+ *     Checks bytes are well-formed UTF-8: no stray continuation bytes, no
+ *     overlong forms, no surrogates and nothing above U+10FFFF
+ */
+static BOOL IsValidUtf8(const char *text, size_t length)
+{
+	const unsigned char *bytes = (const unsigned char *)text;
+	size_t i = 0;
+
+	while( i < length )
+	{
+		DWORD c = bytes[i];
+		size_t more;
+		DWORD minimum;
+
+		if( c < 0x80 ) {
+			i++;
+			continue;
+		} else if( (c & 0xE0) == 0xC0 ) {
+			more = 1; minimum = 0x80; c &= 0x1F;
+		} else if( (c & 0xF0) == 0xE0 ) {
+			more = 2; minimum = 0x800; c &= 0x0F;
+		} else if( (c & 0xF8) == 0xF0 ) {
+			more = 3; minimum = 0x10000; c &= 0x07;
+		} else {
+			return FALSE;
+		}
+
+		if( i + more >= length )
+			return FALSE;
+
+		for( size_t k = 1; k <= more; k++ ) {
+			if( (bytes[i + k] & 0xC0) != 0x80 )
+				return FALSE;
+			c = (c << 6) | (bytes[i + k] & 0x3F);
+		}
+
+		if( c < minimum || c > 0x10FFFF || (c >= 0xD800 && c <= 0xDFFF) )
+			return FALSE;
+
+		i += more + 1;
+	}
+
+	return TRUE;
+}
+
+
+/****
+ * FuzzWide
+ *
+ * DESC:
+ *     Appends one to three characters for the UTF-8 fuzz: ASCII, each
+ *     length of UTF-8 sequence, surrogate pairs, lone and swapped
+ *     surrogates and, where WCHAR is 4 bytes, code points past the BMP
+ *     and values that are no code point at all
+ */
+static void FuzzWide(DWORD *state, std::vector<WCHAR> *text)
+{
+	DWORD pick = NextRandom(state) % 100;
+
+	if( pick < 50 )
+		text->push_back((WCHAR)(NextRandom(state) % 0x80));
+	else if( pick < 60 )
+		text->push_back((WCHAR)(0x80 + NextRandom(state) % 0x780));
+	else if( pick < 75 )
+		text->push_back((WCHAR)(0x800 + NextRandom(state) % 0xF800));
+	else if( pick < 85 ) {
+		text->push_back((WCHAR)(0xD800 + NextRandom(state) % 0x400));
+		text->push_back((WCHAR)(0xDC00 + NextRandom(state) % 0x400));
+	} else if( pick < 90 )
+		text->push_back((WCHAR)(0xD800 + NextRandom(state) % 0x800));
+	else if( pick < 93 ) {
+		text->push_back((WCHAR)(0xDC00 + NextRandom(state) % 0x400));
+		text->push_back((WCHAR)(0xD800 + NextRandom(state) % 0x400));
+	} else if( sizeof(WCHAR) == 4 && pick < 97 )
+		text->push_back((WCHAR)(0x10000 + NextRandom(state) % 0x100000));
+	else if( sizeof(WCHAR) == 4 )
+		text->push_back((WCHAR)(0x110000 + NextRandom(state)));
+	else
+		text->push_back((WCHAR)(0xFFF0 + NextRandom(state) % 0x10));
+}
+
+
+/****
+ * Localize
+ *
+ * DESC:
+ *     Rewrites the letters of a message in another script from 'base' on,
+ *     leaving digits, punctuation and white space, the way a translated
+ *     message reads. With 'every' above 1 only every so many letters
+ *     change, for Latin text with accents here and there
+ */
+static std::wstring Localize(const std::wstring &text, DWORD base, DWORD span, DWORD every)
+{
+	std::wstring localized(text);
+	DWORD letters = 0;
+
+	for( size_t i = 0; i < localized.size(); i++ )
+	{
+		WCHAR c = localized[i];
+
+		if( !((c >= L'a' && c <= L'z') || (c >= L'A' && c <= L'Z')) )
+			continue;
+
+		if( letters++ % every == 0 )
+			localized[i] = (WCHAR)(base + ((DWORD)c * 7) % span);
+	}
+
+	return localized;
+}
+
+
+/****
+ * TimeUtf8
+ *
+ * DESC:
+ *     Encodes a corpus over and over with one implementation (or, given
+ *     no routine, with the C library's wcstombs)
+ *
+ * RETURNS:
+ *     Millions of characters encoded per second
+ */
+static double TimeUtf8(UTF8_ENCODE_ROUTINE routine, const std::vector<std::wstring> &corpus, std::vector<char> *out)
+{
+	size_t chars = 0, written = 0;
+
+	for( size_t i = 0; i < corpus.size(); i++ )
+		chars += corpus[i].size();
+
+	// Enough passes for about 32M characters
+	size_t passes = chars > 0 ? 32 * 1024 * 1024 / chars + 1 : 1;
+
+	std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+
+	for( size_t pass = 0; pass < passes; pass++ ) {
+		for( size_t i = 0; i < corpus.size(); i++ ) {
+			if( routine != NULL )
+				written += routine(corpus[i].data(), corpus[i].size(), &(*out)[0]);
+			else
+				written += wcstombs(&(*out)[0], corpus[i].c_str(), out->size());
+		}
+	}
+
+	double elapsed = Seconds(started);
+
+	// Keep the work from being optimized away
+	if( written == 0 && chars > 0 )
+		fprintf(report, "utf8: nothing written\n");
+
+	return passes * chars / elapsed / 1e6;
+}
+
+
+/****
+ * BenchUtf8
+ *
+ * DESC:
+ *     Fuzzes every UTF-8 encoder this CPU has against the scalar
+ *     reference, checks the UTF-8 buffer sink hands over exactly the
+ *     records of the wide one, encoded, then times the encoders (and
+ *     wcstombs) on the messages and on the same messages in other scripts
+ */
+int BenchUtf8(BENCH_OPTIONS *options)
+{
+	const INT kinds[] = { UTF8_ENCODE_SCALAR, UTF8_ENCODE_SSE2, UTF8_ENCODE_AVX2 };
+	const size_t kindCount = sizeof(kinds) / sizeof(kinds[0]);
+	int result = 0;
+	DWORD state = 0x9E3779B9;
+	std::vector<WCHAR> text;
+	std::vector<char> expected, out;
+	DWORD64 cases = 0, mismatches = 0;
+
+	// Known answers first, so the reference itself is checked
+	{
+		const WCHAR input[] = { L'A', 0xE9, 0x4E2D, 0xD83D, 0xDE00, 0xDE00, L'b', 0xD83D, L'c', 0xFFFF, 0xD800 };
+		const char answer[] = "A\xC3\xA9\xE4\xB8\xAD\xF0\x9F\x98\x80\xEF\xBF\xBD" "b\xEF\xBF\xBD" "c\xEF\xBF\xBF\xEF\xBF\xBD";
+		char encoded[64];
+		size_t length = WideToUtf8Scalar(input, sizeof(input) / sizeof(input[0]), encoded);
+
+		if( std::string(encoded, length) != answer || Utf8Length(input, sizeof(input) / sizeof(input[0])) != length ) {
+			fprintf(report, "utf8: FAILED, the scalar reference is wrong\n");
+			result = 1;
+		}
+	}
+
+	for( DWORD i = 0; i < 200000; i++ )
+	{
+		// Mostly short strings, some past a few vectors, now and then a long ASCII run
+		DWORD shape = NextRandom(&state) % 10;
+		size_t length = shape < 4 ? NextRandom(&state) % 9 : shape < 9 ? NextRandom(&state) % 300 : 1000 + NextRandom(&state) % 3000;
+		size_t offset = NextRandom(&state) % 8;
+
+		text.assign(offset, L' ');
+		while( text.size() < offset + length ) {
+			if( shape == 9 && NextRandom(&state) % 64 != 0 )
+				text.push_back((WCHAR)(0x20 + NextRandom(&state) % 0x5F));
+			else
+				FuzzWide(&state, &text);
+		}
+		length = text.size() - offset;
+
+		// Start anywhere in the first vector, so loads are unaligned too
+		LPCWSTR input = length > 0 ? &text[offset] : L"";
+
+		expected.assign(length * UTF8_MAX_GROWTH + 1, 0);
+		size_t expectedLength = WideToUtf8Scalar(input, length, &expected[0]);
+
+		if( expectedLength != Utf8Length(input, length) || !IsValidUtf8(&expected[0], expectedLength) )
+			mismatches++;
+
+		for( size_t k = 1; k < kindCount; k++ )
+		{
+			UTF8_ENCODE_ROUTINE routine = GetUtf8EncodeRoutine(kinds[k]);
+
+			if( routine == NULL )
+				continue;
+
+			// Guard bytes right after the exact size catch writes past it
+			out.assign(expectedLength + 64, (char)0xFE);
+			size_t outLength = routine(input, length, &out[0]);
+			BOOL same = outLength == expectedLength && memcmp(&out[0], &expected[0], outLength) == 0;
+
+			for( size_t g = expectedLength; g < out.size(); g++ )
+				same = same && out[g] == (char)0xFE;
+
+			if( !same )
+				mismatches++;
+		}
+
+		cases++;
+	}
+
+	fprintf(report, "utf8: fuzzed %llu strings, %llu mismatches", (unsigned long long)cases, (unsigned long long)mismatches);
+	for( size_t k = 0; k < kindCount; k++ )
+		fprintf(report, "%s%s", k == 0 ? " (" : ", ", GetUtf8EncodeName(kinds[k]));
+	fprintf(report, "; default %s)\n", GetUtf8EncodeName(UTF8_ENCODE_DEFAULT));
+
+	if( mismatches > 0 )
+		result = 1;
+
+	DWORD64 events = 0;
+	EventSource *source = OpenSource(options, &events);
+	std::vector<std::wstring> messages;
+
+	if( source == NULL )
+		return 1;
+
+	if( events > options->events )
+		events = options->events;
+
+	ReadMessages(source, events, options->mode, &messages);
+
+	// The UTF-8 buffer (ReadEventsToUtf8Buffer) against the wide records,
+	// encoded one by one. The buffer starts too small and grows when told
+	{
+		COLLECTOR collector;
+		std::vector<std::string> encoded;
+		std::vector<char> buffer(16);
+		DWORD grown = 0, differ = 0;
+
+		collector.calls = 0;
+		collector.refuse = 0;
+
+		{
+			EVENT_SESSION session(source);
+			EventCursor cursor(&session);
+			CallbackSink sink(CollectRecord, &collector);
+
+			cursor.Start(NULL, NULL, DEBUG_NONE);
+			while( collector.records.size() < events && cursor.Read(options->batch, &sink, OUTPUT_FORMAT_JSON, options->mode, DEBUG_NONE) > 0 )
+				;
+
+			session.publishers.Clear();
+		}
+
+		{
+			EVENT_SESSION session(source);
+			EventCursor cursor(&session);
+
+			cursor.Start(NULL, NULL, DEBUG_NONE);
+
+			while( encoded.size() < collector.records.size() ) {
+				Utf8BufferSink sink(&buffer[0], (DWORD)buffer.size());
+				DWORD read = cursor.Read(options->batch, &sink, OUTPUT_FORMAT_JSON, options->mode, DEBUG_NONE);
+
+				for( DWORD used = 0; used < sink.Used(); ) {
+					std::string record(&buffer[used]);
+
+					encoded.push_back(record);
+					used += (DWORD)record.size() + 1;
+				}
+
+				if( cursor.Status() == ERROR_INSUFFICIENT_BUFFER ) {
+					if( read != 0 || sink.Required() <= buffer.size() )
+						break;
+
+					buffer.resize(sink.Required() * 3);
+					grown++;
+				} else if( read == 0 && cursor.Status() != ERROR_MORE_DATA ) {
+					break;
+				}
+			}
+
+			session.publishers.Clear();
+		}
+
+		for( size_t r = 0; r < collector.records.size(); r++ ) {
+			const std::wstring &record = collector.records[r];
+
+			expected.assign(record.size() * UTF8_MAX_GROWTH + 1, 0);
+			size_t length = WideToUtf8Scalar(record.data(), record.size(), &expected[0]);
+
+			if( r >= encoded.size() || encoded[r] != std::string(&expected[0], length) || !IsValidUtf8(encoded[r].data(), encoded[r].size()) )
+				differ++;
+		}
+
+		fprintf(report, "utf8: %llu records read as UTF-8, %u differ, buffer grown %u times\n",
+			(unsigned long long)collector.records.size(), differ, grown);
+
+		if( differ > 0 || grown == 0 || collector.records.empty() )
+			result = 1;
+	}
+
+	delete source;
+
+	// The same messages as other locales would have them
+	std::vector<std::wstring> latin, cyrillic, cjk;
+	size_t longest = 0;
+
+	for( size_t m = 0; m < messages.size(); m++ ) {
+		latin.push_back(Localize(messages[m], 0xE0, 0x20, 9));
+		cyrillic.push_back(Localize(messages[m], 0x430, 0x20, 1));
+		cjk.push_back(Localize(messages[m], 0x4E00, 0x5000, 1));
+		longest = messages[m].size() > longest ? messages[m].size() : longest;
+	}
+
+	const std::vector<std::wstring> *corpora[] = { &messages, &latin, &cyrillic, &cjk };
+	const char *names[] = { "ascii", "latin", "cyrillic", "cjk" };
+
+	out.assign(longest * UTF8_MAX_GROWTH + 1, 0);
+
+	fprintf(report, "utf8: %llu messages, M chars/s\n", (unsigned long long)messages.size());
+
+	for( size_t c = 0; c < sizeof(corpora) / sizeof(corpora[0]); c++ )
+	{
+		double scalar = 0;
+
+		fprintf(report, "  %-8s: wcstombs %.0f", names[c], TimeUtf8(NULL, *corpora[c], &out));
+
+		for( size_t k = 0; k < kindCount; k++ )
+		{
+			UTF8_ENCODE_ROUTINE routine = GetUtf8EncodeRoutine(kinds[k]);
+
+			if( routine == NULL )
+				continue;
+
+			double rate = TimeUtf8(routine, *corpora[c], &out);
+
+			if( k == 0 ) {
+				scalar = rate;
+				fprintf(report, ", %s %.0f", GetUtf8EncodeName(kinds[k]), rate);
+			} else {
+				fprintf(report, ", %s %.0f (%.1fx)", GetUtf8EncodeName(kinds[k]), rate, rate / scalar);
+			}
+		}
+
+		fprintf(report, "\n");
+	}
+
+	return result;
+}
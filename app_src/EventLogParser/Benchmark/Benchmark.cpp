@@ -0,0 +1,259 @@
+#include <thread>
+#include <locale.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "Benchmark.h"
+#include "HostCollector.h"
+
+
+static void Usage()
+{
+	fprintf(stderr,
+		"Usage: eventlog_bench <throughput|fetch|render|fields|parse|alloc|session|sink|escape|utf8|eventdata|identity|templates|projection|filter|subscribe|forward|catchup|collector|binary|ipfix|aggregate|mining|evtx|evtx-write> [options]\n"
+		"  --events N        synthetic events per query (default 100000)\n"
+		"  --fixtures DIR    replay captured events from DIR instead\n"
+		"  --repeat N        replay the fixtures N times (default 1000)\n"
+		"  --xml             read System fields from XML instead of values\n"
+		"  --csv             '||' output instead of JSON\n"
+		"  --next-ms N       fetch, session, subscribe, forward: cost of each round trip (default 2)\n"
+		"  --event-us N      fetch, session, forward, catchup: extra cost per event returned (default 20)\n"
+		"  --batch N         session, sink, forward, catchup, collector: events read per poll (default 100)\n"
+		"  --hosts N         collector: hosts timed (default 64)\n"
+		"  --format-us N     templates, projection: cost of each EvtFormatMessage (default 100)\n"
+		"  --file PATH       evtx, evtx-write: the .evtx file\n"
+		"  --threads N       evtx: decode threads (default one per CPU)\n"
+		"  evtx-write writes each fixture once, or --events records in total\n"
+		"  escape fuzzes the JSON escapers, then times them on --events messages (default 5000)\n"
+		"  utf8 does the same for the UTF-8 encoders, on the messages and on them in other scripts\n"
+		"  eventdata checks the event_data of each record against its XML, then times reading with it\n"
+		"  identity checks the identity of each fixture record (try --fixtures fixtures/identity), then times it\n"
+		"  templates checks locally formatted messages against the source's, then times both (default 20000 events)\n"
+		"  projection checks records read with some of their fields, then times each (default 20000 events)\n"
+		"  filter checks reading with structured filters against the fixtures (default fixtures, --repeat 1)\n"
+		"  subscribe checks subscriptions and bookmarks while --events are written (default fixtures, 2000 events)\n"
+		"  forward checks catching up oldest first in chunks, then times it on --events new ones (default fixtures, 20000 events, --batch 1000)\n"
+		"  catchup checks sharded catch-ups over several sessions, then times 1 to 8 sessions at 0, 2 and 10 ms a round trip (same defaults)\n"
+		"  collector checks many mock hosts read at once, some failing or hanging, then times --hosts of them on 1 to 64 workers (default fixtures, 2000 events, --batch 200)\n"
+		"  binary checks binary records against JSON ones, then compares the bytes and decode time of JSON, '||' and binary (default fixtures, cursor check on 2000 synthetic events)\n"
+		"  ipfix checks IPFIX records against what fileLine sent for the JSON ones, then times writing them straight away against going through JSON (same defaults)\n"
+		"  aggregate checks IPFIX flows against a plain aggregation of an hour of storms made of the fixtures, then of the fixtures and --events copies read through a cursor (default fixtures, 2000 events)\n"
+		"  mining checks message templates mined from the storms and from syslog lines, then IPFIX records with them against whole ones (same defaults)\n"
+		"  evtx checks the file against --fixtures, if given, before timing it\n");
+}
+
+
+int main(int argc, char **argv)
+{
+	BENCH_OPTIONS options;
+
+	options.events = 100000;
+	options.fixtures = NULL;
+	options.repeat = 1000;
+	options.nextMs = 2;
+	options.perEventUs = 20;
+	options.formatUs = 100;
+	options.file = NULL;
+	options.threads = 0;
+	options.batch = CURSOR_BATCH_DEFAULT;
+	options.hosts = 64;
+	options.outputFormat = OUTPUT_FORMAT_JSON;
+	options.mode = MODE_DEFAULT;
+
+	if( argc < 2 ) {
+		Usage();
+		return 2;
+	}
+
+	const char *command = argv[1];
+	BOOL eventsGiven = FALSE;
+	BOOL repeatGiven = FALSE;
+	BOOL batchGiven = FALSE;
+
+	for( int i = 2; i < argc; i++ ) {
+		BOOL hasValue = i + 1 < argc;
+
+		if( strcmp(argv[i], "--events") == 0 && hasValue ) {
+			options.events = strtoull(argv[++i], NULL, 10);
+			eventsGiven = TRUE;
+		} else if( strcmp(argv[i], "--fixtures") == 0 && hasValue ) {
+			options.fixtures = argv[++i];
+		} else if( strcmp(argv[i], "--repeat") == 0 && hasValue ) {
+			options.repeat = (DWORD)strtoul(argv[++i], NULL, 10);
+			repeatGiven = TRUE;
+		} else if( strcmp(argv[i], "--next-ms") == 0 && hasValue ) {
+			options.nextMs = (DWORD)strtoul(argv[++i], NULL, 10);
+		} else if( strcmp(argv[i], "--event-us") == 0 && hasValue ) {
+			options.perEventUs = (DWORD)strtoul(argv[++i], NULL, 10);
+		} else if( strcmp(argv[i], "--format-us") == 0 && hasValue ) {
+			options.formatUs = (DWORD)strtoul(argv[++i], NULL, 10);
+		} else if( strcmp(argv[i], "--file") == 0 && hasValue ) {
+			options.file = argv[++i];
+		} else if( strcmp(argv[i], "--threads") == 0 && hasValue ) {
+			options.threads = (DWORD)strtoul(argv[++i], NULL, 10);
+		} else if( strcmp(argv[i], "--batch") == 0 && hasValue ) {
+			options.batch = (DWORD)strtoul(argv[++i], NULL, 10);
+			batchGiven = TRUE;
+		} else if( strcmp(argv[i], "--hosts") == 0 && hasValue ) {
+			options.hosts = (DWORD)strtoul(argv[++i], NULL, 10);
+		} else if( strcmp(argv[i], "--xml") == 0 ) {
+			options.mode |= MODE_RENDER_XML;
+		} else if( strcmp(argv[i], "--csv") == 0 ) {
+			options.outputFormat = 1;
+		} else {
+			Usage();
+			return 2;
+		}
+	}
+
+	// The fetch comparison pays a round trip per event, so keep it short by default
+	if( strcmp(command, "fetch") == 0 && !eventsGiven )
+		options.events = 1000;
+
+	// Every reconnect pays round trips too
+	if( strcmp(command, "session") == 0 && !eventsGiven )
+		options.events = 10000;
+
+	// Every remote message pays --format-us
+	if( (strcmp(command, "templates") == 0 || strcmp(command, "projection") == 0) && !eventsGiven )
+		options.events = 20000;
+
+	// The escape and utf8 corpora are timed over and over; a few thousand messages do
+	if( (strcmp(command, "escape") == 0 || strcmp(command, "utf8") == 0) && !eventsGiven )
+		options.events = 5000;
+
+	// Only the fixture source applies queries, and a few passes over them do
+	if( strcmp(command, "filter") == 0 ) {
+		if( options.fixtures == NULL )
+			options.fixtures = "fixtures";
+		if( !repeatGiven )
+			options.repeat = 1;
+	}
+
+	// Only the fixture source can be written to while it is read
+	if( strcmp(command, "subscribe") == 0 ) {
+		if( options.fixtures == NULL )
+			options.fixtures = "fixtures";
+		if( !eventsGiven )
+			options.events = 2000;
+	}
+
+	// Catching up reads far more than a poll does
+	if( strcmp(command, "forward") == 0 || strcmp(command, "catchup") == 0 ) {
+		if( options.fixtures == NULL )
+			options.fixtures = "fixtures";
+		if( !eventsGiven )
+			options.events = 20000;
+		if( !batchGiven )
+			options.batch = 1000;
+	}
+
+	// Every host reads the whole backlog
+	if( strcmp(command, "collector") == 0 ) {
+		if( options.fixtures == NULL )
+			options.fixtures = "fixtures";
+		if( !eventsGiven )
+			options.events = 2000;
+		if( !batchGiven )
+			options.batch = COLLECTOR_BATCH_DEFAULT;
+	}
+
+	// Every fixture is checked; the cursor check reads synthetic events
+	if( strcmp(command, "binary") == 0 || strcmp(command, "ipfix") == 0 ) {
+		if( options.fixtures == NULL )
+			options.fixtures = "fixtures";
+		if( !eventsGiven )
+			options.events = 2000;
+	}
+
+	// The storms are made of the fixture events, and the cursor reads
+	// copies of them
+	if( strcmp(command, "aggregate") == 0 || strcmp(command, "mining") == 0 ) {
+		if( options.fixtures == NULL )
+			options.fixtures = "fixtures";
+		if( !eventsGiven )
+			options.events = 2000;
+	}
+
+	if( options.batch == 0 )
+		options.batch = CURSOR_BATCH_DEFAULT;
+
+	// Without a count, evtx-write writes the fixtures as they are
+	if( strcmp(command, "evtx-write") == 0 && !eventsGiven )
+		options.events = options.fixtures != NULL ? 0 : 100000;
+
+	if( options.threads == 0 )
+		options.threads = std::thread::hardware_concurrency() > 0 ? std::thread::hardware_concurrency() : 1;
+
+	// Event text is not all ASCII
+	if( setlocale(LC_ALL, "C.UTF-8") == NULL )
+		setlocale(LC_ALL, "");
+
+	report = fdopen(dup(fileno(stdout)), "w");
+	if( report == NULL || freopen("/dev/null", "w", stdout) == NULL ) {
+		fprintf(stderr, "Could not redirect stdout\n");
+		return 2;
+	}
+
+	int result;
+
+	if( strcmp(command, "throughput") == 0 )
+		result = BenchThroughput(&options);
+	else if( strcmp(command, "fetch") == 0 )
+		result = BenchFetch(&options);
+	else if( strcmp(command, "render") == 0 )
+		result = BenchRender(&options);
+	else if( strcmp(command, "fields") == 0 )
+		result = BenchFields(&options);
+	else if( strcmp(command, "parse") == 0 )
+		result = BenchParse(&options);
+	else if( strcmp(command, "alloc") == 0 )
+		result = BenchAlloc(&options);
+	else if( strcmp(command, "session") == 0 )
+		result = BenchSession(&options);
+	else if( strcmp(command, "sink") == 0 )
+		result = BenchSink(&options);
+	else if( strcmp(command, "escape") == 0 )
+		result = BenchEscape(&options);
+	else if( strcmp(command, "utf8") == 0 )
+		result = BenchUtf8(&options);
+	else if( strcmp(command, "eventdata") == 0 )
+		result = BenchEventData(&options);
+	else if( strcmp(command, "identity") == 0 )
+		result = BenchIdentity(&options);
+	else if( strcmp(command, "templates") == 0 )
+		result = BenchTemplates(&options);
+	else if( strcmp(command, "projection") == 0 )
+		result = BenchProjection(&options);
+	else if( strcmp(command, "filter") == 0 )
+		result = BenchFilter(&options);
+	else if( strcmp(command, "subscribe") == 0 )
+		result = BenchSubscribe(&options);
+	else if( strcmp(command, "forward") == 0 )
+		result = BenchForward(&options);
+	else if( strcmp(command, "catchup") == 0 )
+		result = BenchCatchUp(&options);
+	else if( strcmp(command, "collector") == 0 )
+		result = BenchCollector(&options);
+	else if( strcmp(command, "binary") == 0 )
+		result = BenchBinary(&options);
+	else if( strcmp(command, "ipfix") == 0 )
+		result = BenchIpfix(&options);
+	else if( strcmp(command, "aggregate") == 0 )
+		result = BenchAggregate(&options);
+	else if( strcmp(command, "mining") == 0 )
+		result = BenchMining(&options);
+	else if( strcmp(command, "evtx") == 0 )
+		result = BenchEvtx(&options);
+	else if( strcmp(command, "evtx-write") == 0 )
+		result = BenchEvtxWrite(&options);
+	else {
+		Usage();
+		result = 2;
+	}
+
+	fclose(report);
+
+	return result;
+}
@@ -0,0 +1,212 @@
+#pragma once
+
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include "ParserCore.h"
+#include "EventCursor.h"
+#include "FixtureSource.h"
+
+// Options shared by the benchmark commands
+struct BENCH_OPTIONS {
+	DWORD64 events;
+	const char *fixtures;
+	DWORD repeat;
+	DWORD nextMs;
+	DWORD perEventUs;
+	DWORD formatUs;
+	const char *file;
+	DWORD threads;
+	DWORD batch;
+	DWORD hosts;
+	INT outputFormat;
+	INT mode;
+};
+
+// Where results are written. stdout itself goes to /dev/null so that the
+// parser's output costs what it costs in production without flooding the terminal
+extern FILE *report;
+
+// AddressSanitizer and ThreadSanitizer bring malloc and friends of their
+// own, which the counting wrappers in BenchCommon.cpp would go around
+#if defined(__SANITIZE_ADDRESS__) || defined(__SANITIZE_THREAD__)
+#define SANITIZED_ALLOCATOR 1
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer) || __has_feature(thread_sanitizer) || __has_feature(memory_sanitizer)
+#define SANITIZED_ALLOCATOR 1
+#endif
+#endif
+
+#if defined(__GLIBC__) && !defined(SANITIZED_ALLOCATOR)
+#include <atomic>
+
+// Allocations are counted while "counting" is set
+#define ALLOCATION_COUNTING 1
+
+extern std::atomic<bool> counting;
+extern std::atomic<unsigned long long> allocations;
+#endif
+
+/****
+ * CollectRecord
+ *
+ * DESC:
+ *     Record callback for the callback sink. Keeps every record, and
+ *     refuses every "refuse"th call to exercise the resume path
+ */
+struct COLLECTOR {
+	std::vector<std::wstring> records;
+	DWORD calls;
+	DWORD refuse;
+};
+
+BOOL __stdcall CollectRecord(LPCWSTR record, DWORD length, LPVOID context);
+
+double Seconds(std::chrono::steady_clock::time_point started);
+EventSource *OpenSource(BENCH_OPTIONS *options, DWORD64 *events);
+BOOL LoadFixtures(FixtureSource *fixture, BENCH_OPTIONS *options, DWORD copies, DWORD64 *first = NULL);
+DWORD NextRandom(DWORD *state);
+BOOL ReadJsonString(const std::wstring &text, size_t *at, std::wstring *value);
+BOOL ReadJsonRecord(const std::wstring &record, std::map<std::wstring, std::wstring> *values);
+LPCWSTR ChildValue(rapidxml::xml_node<WCHAR> *node, LPCWSTR name);
+LPCWSTR ChildAttribute(rapidxml::xml_node<WCHAR> *node, LPCWSTR name, LPCWSTR attributeName);
+
+// BenchParse.cpp
+BOOL SameFields(SYSTEM_FIELDS *xml, SYSTEM_FIELDS *values);
+
+// BenchSession.cpp
+DWORD64 ReadAll(EventCursor *cursor, DWORD batch, BENCH_OPTIONS *options);
+
+// BenchEscape.cpp
+void ReadMessages(EventSource *source, DWORD64 events, INT mode, std::vector<std::wstring> *messages);
+
+// BenchEventData.cpp
+DWORD64 TimeDump(EVENT_SESSION *session, INT mode, double *seconds);
+
+/****
+ * PROJECTION
+ *
+ * DESC:
+ *     A set of record fields a benchmark reads with, and what it is named
+ *     in the results
+ */
+struct PROJECTION {
+	const char *name;
+	LPCWSTR fields;
+};
+
+/****
+ * FILTER_EVENT
+ *
+ * DESC:
+ *     What the filter benchmark checks an event against, read from its XML
+ */
+struct FILTER_EVENT {
+	std::wstring channel;
+	std::wstring provider;
+	SOURCE_RECORD record;
+	DWORD64 keywords;
+};
+
+// BenchFilter.cpp. The filters every filter check starts with, ahead of
+// the random ones
+#define FIXED_FILTER_COUNT 8
+
+extern const LPCWSTR fixedFilters[FIXED_FILTER_COUNT];
+
+BOOL ReadFilterEvents(EventSource *source, std::vector<FILTER_EVENT> *events);
+std::wstring RandomFilter(DWORD *state, const std::vector<FILTER_EVENT> &events);
+std::vector<DWORD64> CollectedRecordIds(const std::vector<std::wstring> &records);
+
+// The channel the catch-up and collector benchmarks read
+#define CATCHUP_CHANNEL L"Security"
+
+// Template IDs and machine ID the IPFIX benchmarks write with: EpEventLog
+// and, for merged flows, EpEventLogFlow
+#define IPFIX_CHECK_TEMPLATE 258
+#define IPFIX_CHECK_FLOW_TEMPLATE 261
+#define IPFIX_CHECK_MACHINE L"bench-0123456789abcdef0123456789abcdef"
+
+// An EpEventLog or EpEventLogFlow record taken apart, strings as UTF-8.
+// An EpEventLog record's first and last seconds are its own time
+struct IPFIX_FIELDS {
+	std::string machineId;
+	std::string logName;
+	DWORD64 seconds;
+	DWORD64 recordId;
+	DWORD64 eventId;
+	std::string source;
+	std::string message;
+	DWORD64 count;
+	DWORD64 firstSeconds;
+	DWORD64 lastSeconds;
+	DWORD64 rollable;
+	BOOL merged;
+};
+
+// BenchIpfix.cpp
+BOOL GetIpfixNumber(const BYTE **at, const BYTE *end, size_t n, DWORD64 *number);
+BOOL GetIpfixString(const BYTE **at, const BYTE *end, size_t fixed, std::string *text);
+BOOL DecodeIpfixRecord(const BYTE **at, const BYTE *end, BOOL merged, IPFIX_FIELDS *record);
+BOOL ReadIpfixSets(const BYTE *data, size_t bytes, DWORD maxSetBytes, std::vector<IPFIX_FIELDS> *records, std::vector<size_t> *sizes, DWORD *sets);
+std::string FileLineText(const std::wstring &text);
+DWORD64 FileLineSeconds(const std::wstring &text);
+BOOL CutShort(const std::string &text, const std::string &whole);
+
+// Set size of the cursor checks of the aggregate and mining benchmarks,
+// and the buffer they start with, so that a read stops on a full buffer
+// often and the buffer has to grow once
+#define AGGREGATE_CHECK_SET_BYTES 512
+#define AGGREGATE_CHECK_BUFFER 256
+
+// Storms of the hour the aggregate and mining benchmarks make up
+#define STORM_SHAPE_COUNT 3
+
+// A fixture event the storm is made of
+struct STORM_PROTO {
+	std::wstring channel;
+	std::wstring provider;
+	std::wstring message;
+	DWORD eventId;
+};
+
+// One event of the storm: which fixture event it is, when, and its message
+struct STORM_EVENT {
+	size_t proto;
+	DWORD seconds;
+	std::wstring message;
+};
+
+// BenchAggregate.cpp
+BOOL LoadStormProtos(BENCH_OPTIONS *options, std::vector<STORM_PROTO> *protos);
+void MakeStorm(const std::vector<STORM_PROTO> &protos, std::vector<STORM_EVENT> *storm, DWORD64 *shapeEvents);
+void StormFields(const STORM_PROTO &proto, const STORM_EVENT &event, DWORD64 recordId, SYSTEM_FIELDS *fields, LPWSTR recordText);
+
+// The benchmark commands, one file each (or one file a group of them)
+int BenchThroughput(BENCH_OPTIONS *options);
+int BenchFetch(BENCH_OPTIONS *options);
+int BenchRender(BENCH_OPTIONS *options);
+int BenchFields(BENCH_OPTIONS *options);
+int BenchParse(BENCH_OPTIONS *options);
+int BenchAlloc(BENCH_OPTIONS *options);
+int BenchSession(BENCH_OPTIONS *options);
+int BenchSink(BENCH_OPTIONS *options);
+int BenchEscape(BENCH_OPTIONS *options);
+int BenchUtf8(BENCH_OPTIONS *options);
+int BenchEventData(BENCH_OPTIONS *options);
+int BenchIdentity(BENCH_OPTIONS *options);
+int BenchTemplates(BENCH_OPTIONS *options);
+int BenchProjection(BENCH_OPTIONS *options);
+int BenchFilter(BENCH_OPTIONS *options);
+int BenchSubscribe(BENCH_OPTIONS *options);
+int BenchForward(BENCH_OPTIONS *options);
+int BenchCatchUp(BENCH_OPTIONS *options);
+int BenchCollector(BENCH_OPTIONS *options);
+int BenchBinary(BENCH_OPTIONS *options);
+int BenchIpfix(BENCH_OPTIONS *options);
+int BenchAggregate(BENCH_OPTIONS *options);
+int BenchMining(BENCH_OPTIONS *options);
+int BenchEvtxWrite(BENCH_OPTIONS *options);
+int BenchEvtx(BENCH_OPTIONS *options);
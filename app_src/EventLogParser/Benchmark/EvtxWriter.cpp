@@ -0,0 +1,1035 @@
+#include "EvtxWriter.h"
+#include "ParserCore.h"
+
+// BinXml tokens and value types written (see EvtxDecoder.cpp)
+#define TOKEN_OPEN_START_ELEMENT 0x01
+#define TOKEN_CLOSE_START_ELEMENT 0x02
+#define TOKEN_CLOSE_EMPTY_ELEMENT 0x03
+#define TOKEN_END_ELEMENT 0x04
+#define TOKEN_VALUE 0x05
+#define TOKEN_ATTRIBUTE 0x06
+#define TOKEN_TEMPLATE_INSTANCE 0x0C
+#define TOKEN_NORMAL_SUBSTITUTION 0x0D
+#define TOKEN_OPTIONAL_SUBSTITUTION 0x0E
+#define TOKEN_FRAGMENT_HEADER 0x0F
+#define TOKEN_MORE_DATA 0x40
+
+#define TYPE_NULL 0x00
+#define TYPE_STRING 0x01
+#define TYPE_UINT8 0x04
+#define TYPE_UINT16 0x06
+#define TYPE_UINT32 0x08
+#define TYPE_UINT64 0x0A
+#define TYPE_GUID 0x0F
+#define TYPE_FILETIME 0x11
+#define TYPE_SID 0x13
+#define TYPE_HEX_INT64 0x15
+#define TYPE_BINXML 0x21
+
+// Chunk header fields
+#define CHUNK_FIRST_RECORD_NUMBER 8
+#define CHUNK_LAST_RECORD_NUMBER 16
+#define CHUNK_FIRST_RECORD_ID 24
+#define CHUNK_LAST_RECORD_ID 32
+#define CHUNK_HEADER_SIZE 40
+#define CHUNK_LAST_RECORD_OFFSET 44
+#define CHUNK_FREE_SPACE_OFFSET 48
+#define CHUNK_RECORDS_CHECKSUM 52
+#define CHUNK_HEADER_CHECKSUM 124
+#define CHUNK_STRING_TABLE 128
+#define CHUNK_STRING_BUCKETS 64
+#define CHUNK_TEMPLATE_TABLE 384
+#define CHUNK_TEMPLATE_BUCKETS 32
+
+// File header fields
+#define FILE_LAST_CHUNK_NUMBER 16
+#define FILE_NEXT_RECORD_ID 24
+#define FILE_HEADER_SIZE 32
+#define FILE_MINOR_VERSION 36
+#define FILE_MAJOR_VERSION 38
+#define FILE_HEADER_BLOCK_SIZE 40
+#define FILE_CHUNK_COUNT 42
+#define FILE_HEADER_CHECKSUM 124
+
+static void Put16(std::vector<BYTE> &out, WORD value)
+{
+	out.push_back((BYTE)value);
+	out.push_back((BYTE)(value >> 8));
+}
+
+static void Put32(std::vector<BYTE> &out, DWORD value)
+{
+	for( int i = 0; i < 4; i++ )
+		out.push_back((BYTE)(value >> (i * 8)));
+}
+
+static void Put64(std::vector<BYTE> &out, ULONGLONG value)
+{
+	for( int i = 0; i < 8; i++ )
+		out.push_back((BYTE)(value >> (i * 8)));
+}
+
+static void Set16(BYTE *at, WORD value)
+{
+	at[0] = (BYTE)value;
+	at[1] = (BYTE)(value >> 8);
+}
+
+static void Set32(BYTE *at, DWORD value)
+{
+	for( int i = 0; i < 4; i++ )
+		at[i] = (BYTE)(value >> (i * 8));
+}
+
+static void Set64(BYTE *at, ULONGLONG value)
+{
+	for( int i = 0; i < 8; i++ )
+		at[i] = (BYTE)(value >> (i * 8));
+}
+
+static DWORD Get32(const BYTE *at)
+{
+	return (DWORD)at[0] | ((DWORD)at[1] << 8) | ((DWORD)at[2] << 16) | ((DWORD)at[3] << 24);
+}
+
+
+/****
+ * PutUtf16
+ *
+ * DESC:
+ *     Appends a wide string as little-endian UTF-16
+ *
+ * RETURNS:
+ *     The number of code units written
+ */
+static DWORD PutUtf16(std::vector<BYTE> &out, const std::wstring &text)
+{
+	DWORD units = 0;
+
+	for( size_t i = 0; i < text.size(); i++ ) {
+		DWORD cp = (DWORD)text[i];
+
+		if( cp >= 0x10000 ) {
+			cp -= 0x10000;
+			Put16(out, (WORD)(0xD800 + (cp >> 10)));
+			Put16(out, (WORD)(0xDC00 + (cp & 0x3FF)));
+			units += 2;
+		} else {
+			Put16(out, (WORD)cp);
+			units++;
+		}
+	}
+
+	return units;
+}
+
+
+// CRC-32 (IEEE), which is what both header checksums use
+static DWORD Crc32(const BYTE *data, size_t size, DWORD crc = 0)
+{
+	crc = ~crc;
+
+	for( size_t i = 0; i < size; i++ ) {
+		crc ^= data[i];
+		for( int bit = 0; bit < 8; bit++ )
+			crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+	}
+
+	return ~crc;
+}
+
+
+// Name hash stored with every name in a chunk's string table
+static WORD NameHash(const std::wstring &name)
+{
+	DWORD hash = 0;
+
+	for( size_t i = 0; i < name.size(); i++ )
+		hash = hash * 65599 + (DWORD)name[i];
+
+	return (WORD)hash;
+}
+
+
+/****
+ * ParseDecimal
+ *
+ * DESC:
+ *     Reads text that must be a plain decimal number, written the way
+ *     the decoder would write it back (no sign, no leading zeros)
+ */
+static BOOL ParseDecimal(const std::wstring &text, ULONGLONG limit, ULONGLONG *value)
+{
+	if( text.empty() || text.size() > 20 || (text.size() > 1 && text[0] == L'0') )
+		return FALSE;
+
+	ULONGLONG result = 0;
+
+	for( size_t i = 0; i < text.size(); i++ ) {
+		if( text[i] < L'0' || text[i] > L'9' )
+			return FALSE;
+
+		ULONGLONG next = result * 10 + (text[i] - L'0');
+
+		if( next / 10 != result )
+			return FALSE;
+		result = next;
+	}
+
+	if( result > limit )
+		return FALSE;
+
+	*value = result;
+	return TRUE;
+}
+
+
+static BOOL ParseHexDigits(const std::wstring &text, size_t start, size_t count, BOOL upper, ULONGLONG *value)
+{
+	ULONGLONG result = 0;
+
+	if( count == 0 || count > 16 || start + count > text.size() )
+		return FALSE;
+
+	for( size_t i = start; i < start + count; i++ ) {
+		WCHAR c = text[i];
+		DWORD digit;
+
+		if( c >= L'0' && c <= L'9' )
+			digit = c - L'0';
+		else if( upper && c >= L'A' && c <= L'F' )
+			digit = c - L'A' + 10;
+		else if( !upper && c >= L'a' && c <= L'f' )
+			digit = c - L'a' + 10;
+		else
+			return FALSE;
+
+		result = (result << 4) | digit;
+	}
+
+	*value = result;
+	return TRUE;
+}
+
+
+/****
+ * EncodeValue
+ *
+ * DESC:
+ *     Stores text as a value of the given type, if the decoder would give
+ *     back exactly that text for it
+ *
+ * RETURNS:
+ *     TRUE if the value was encoded, FALSE if the text has to stay a string
+ */
+static BOOL EncodeValue(BYTE type, const std::wstring &text, std::vector<BYTE> &data)
+{
+	ULONGLONG value;
+
+	data.clear();
+
+	switch( type ) {
+	case TYPE_UINT8:
+		if( !ParseDecimal(text, 0xFF, &value) )
+			return FALSE;
+		data.push_back((BYTE)value);
+		return TRUE;
+
+	case TYPE_UINT16:
+		if( !ParseDecimal(text, 0xFFFF, &value) )
+			return FALSE;
+		Put16(data, (WORD)value);
+		return TRUE;
+
+	case TYPE_UINT32:
+		if( !ParseDecimal(text, 0xFFFFFFFF, &value) )
+			return FALSE;
+		Put32(data, (DWORD)value);
+		return TRUE;
+
+	case TYPE_UINT64:
+		if( !ParseDecimal(text, ~0ULL, &value) )
+			return FALSE;
+		Put64(data, value);
+		return TRUE;
+
+	case TYPE_HEX_INT64:
+		// Lower case, no leading zeros
+		if( text.size() < 3 || text[0] != L'0' || text[1] != L'x' || (text.size() > 3 && text[2] == L'0')
+			|| !ParseHexDigits(text, 2, text.size() - 2, FALSE, &value) )
+			return FALSE;
+		Put64(data, value);
+		return TRUE;
+
+	case TYPE_FILETIME: {
+		ULONGLONG fileTime;
+		WCHAR formatted[32];
+
+		if( !ParseSystemTime(text.c_str(), &fileTime) || text != FormatSystemTime(fileTime, formatted) )
+			return FALSE;
+		Put64(data, fileTime);
+		return TRUE;
+	}
+
+	case TYPE_GUID: {
+		// {XXXXXXXX-XXXX-XXXX-XXXX-XXXXXXXXXXXX}, upper case
+		ULONGLONG parts[5];
+		size_t starts[] = { 1, 10, 15, 20, 25 };
+		size_t counts[] = { 8, 4, 4, 4, 12 };
+
+		if( text.size() != 38 || text[0] != L'{' || text[37] != L'}' || text[9] != L'-' || text[14] != L'-' || text[19] != L'-' || text[24] != L'-' )
+			return FALSE;
+
+		for( int i = 0; i < 5; i++ ) {
+			if( !ParseHexDigits(text, starts[i], counts[i], TRUE, &parts[i]) )
+				return FALSE;
+		}
+
+		Put32(data, (DWORD)parts[0]);
+		Put16(data, (WORD)parts[1]);
+		Put16(data, (WORD)parts[2]);
+		data.push_back((BYTE)(parts[3] >> 8));
+		data.push_back((BYTE)parts[3]);
+		for( int i = 5; i >= 0; i-- )
+			data.push_back((BYTE)(parts[4] >> (i * 8)));
+		return TRUE;
+	}
+
+	case TYPE_SID: {
+		// S-<revision>-<authority>-<sub authority>...
+		std::vector<ULONGLONG> numbers;
+		size_t start = 2;
+
+		if( text.size() < 4 || text[0] != L'S' || text[1] != L'-' )
+			return FALSE;
+
+		while( start <= text.size() ) {
+			size_t end = text.find(L'-', start);
+
+			if( end == std::wstring::npos )
+				end = text.size();
+
+			if( !ParseDecimal(text.substr(start, end - start), numbers.size() == 1 ? 0xFFFFFFFFFFFFULL : 0xFFFFFFFF, &value) )
+				return FALSE;
+
+			numbers.push_back(value);
+			start = end + 1;
+		}
+
+		if( numbers.size() < 2 || numbers.size() - 2 > 15 || numbers[0] > 0xFF )
+			return FALSE;
+
+		data.push_back((BYTE)numbers[0]);
+		data.push_back((BYTE)(numbers.size() - 2));
+		for( int i = 5; i >= 0; i-- )
+			data.push_back((BYTE)(numbers[1] >> (i * 8)));
+		for( size_t i = 2; i < numbers.size(); i++ )
+			Put32(data, (DWORD)numbers[i]);
+		return TRUE;
+	}
+	}
+
+	return FALSE;
+}
+
+
+/****
+ * SystemType
+ *
+ * DESC:
+ *     The type Windows gives a System value, by element and attribute
+ */
+static BYTE SystemType(const std::wstring &element, LPCWSTR attribute)
+{
+	static const struct { LPCWSTR element; LPCWSTR attribute; BYTE type; } types[] = {
+		{ L"Provider", L"Guid", TYPE_GUID },
+		{ L"EventID", NULL, TYPE_UINT16 },
+		{ L"EventID", L"Qualifiers", TYPE_UINT16 },
+		{ L"Version", NULL, TYPE_UINT8 },
+		{ L"Level", NULL, TYPE_UINT8 },
+		{ L"Task", NULL, TYPE_UINT16 },
+		{ L"Opcode", NULL, TYPE_UINT8 },
+		{ L"Keywords", NULL, TYPE_HEX_INT64 },
+		{ L"TimeCreated", L"SystemTime", TYPE_FILETIME },
+		{ L"EventRecordID", NULL, TYPE_UINT64 },
+		{ L"Correlation", L"ActivityID", TYPE_GUID },
+		{ L"Correlation", L"RelatedActivityID", TYPE_GUID },
+		{ L"Execution", L"ProcessID", TYPE_UINT32 },
+		{ L"Execution", L"ThreadID", TYPE_UINT32 },
+		{ L"Security", L"UserID", TYPE_SID },
+	};
+
+	for( size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++ ) {
+		if( element == types[i].element && ((attribute == NULL && types[i].attribute == NULL)
+			|| (attribute != NULL && types[i].attribute != NULL && wcscmp(attribute, types[i].attribute) == 0)) )
+			return types[i].type;
+	}
+
+	return TYPE_STRING;
+}
+
+
+/****
+ * OptionalAttributes
+ *
+ * DESC:
+ *     System attributes that every template carries, whether or not a
+ *     given event has them
+ */
+static LPCWSTR const *OptionalAttributes(const std::wstring &element)
+{
+	static LPCWSTR const provider[] = { L"Name", L"Guid", L"EventSourceName", NULL };
+	static LPCWSTR const eventId[] = { L"Qualifiers", NULL };
+	static LPCWSTR const correlation[] = { L"ActivityID", L"RelatedActivityID", NULL };
+	static LPCWSTR const execution[] = { L"ProcessID", L"ThreadID", NULL };
+	static LPCWSTR const security[] = { L"UserID", NULL };
+
+	if( element == L"Provider" ) return provider;
+	if( element == L"EventID" ) return eventId;
+	if( element == L"Correlation" ) return correlation;
+	if( element == L"Execution" ) return execution;
+	if( element == L"Security" ) return security;
+
+	return NULL;
+}
+
+
+// Builds the tokens and values for one event
+struct EVENT_DESCRIPTION {
+	std::vector<EVTX_VALUE> *values;
+	ULONGLONG recordId;
+	ULONGLONG written;
+	BOOL classic;
+	const WCHAR *parsed;
+	const std::wstring *text;
+};
+
+static void AddToken(std::vector<EVTX_TOKEN> &tokens, BYTE type, const std::wstring &text = std::wstring(), WORD id = 0, BYTE valueType = 0)
+{
+	EVTX_TOKEN token;
+
+	token.type = type;
+	token.text = text;
+	token.id = id;
+	token.valueType = valueType;
+	token.hasAttributes = FALSE;
+	tokens.push_back(token);
+}
+
+
+/****
+ * AddSubstitution
+ *
+ * DESC:
+ *     Adds a substitution for a piece of text, typed if the type survives
+ *     the round trip. Embedded BinXml has no substitutions, so there the
+ *     text is written in place instead
+ */
+static void AddSubstitution(EVENT_DESCRIPTION *event, std::vector<EVTX_TOKEN> &tokens, BYTE type, const std::wstring *text, BOOL optional, BOOL embedded)
+{
+	if( embedded ) {
+		if( text != NULL )
+			AddToken(tokens, TOKEN_VALUE, *text);
+		return;
+	}
+
+	EVTX_VALUE value;
+
+	value.type = TYPE_NULL;
+	if( text != NULL ) {
+		if( type != TYPE_STRING && EncodeValue(type, *text, value.data) ) {
+			value.type = type;
+		} else {
+			value.type = TYPE_STRING;
+			value.data.clear();
+			PutUtf16(value.data, *text);
+		}
+	}
+
+	AddToken(tokens, optional ? TOKEN_OPTIONAL_SUBSTITUTION : TOKEN_NORMAL_SUBSTITUTION, std::wstring(), (WORD)event->values->size(), type);
+	event->values->push_back(value);
+}
+
+
+static void DescribeElement(EVENT_DESCRIPTION *event, rapidxml::xml_node<WCHAR> *node, std::vector<std::wstring> &path, std::vector<EVTX_TOKEN> &tokens, BOOL embedded)
+{
+	std::wstring name(node->name(), node->name_size());
+	BOOL inSystem = path.size() == 2 && path[0] == L"Event" && path[1] == L"System";
+	size_t open = tokens.size();
+
+	AddToken(tokens, TOKEN_OPEN_START_ELEMENT, name);
+	path.push_back(name);
+
+	// Attributes. The optional System ones come first, in their usual order
+	LPCWSTR const *optional = inSystem ? OptionalAttributes(name) : NULL;
+
+	for( ; optional != NULL && *optional != NULL; optional++ ) {
+		rapidxml::xml_attribute<WCHAR> *attribute = node->first_attribute(*optional);
+		std::wstring text;
+
+		if( attribute != NULL )
+			text.assign(attribute->value(), attribute->value_size());
+
+		AddToken(tokens, TOKEN_ATTRIBUTE, *optional);
+		AddSubstitution(event, tokens, SystemType(name, *optional), attribute != NULL ? &text : NULL, TRUE, embedded);
+		tokens[open].hasAttributes = TRUE;
+	}
+
+	for( rapidxml::xml_attribute<WCHAR> *attribute = node->first_attribute(); attribute != NULL; attribute = attribute->next_attribute() ) {
+		std::wstring attributeName(attribute->name(), attribute->name_size());
+		std::wstring text(attribute->value(), attribute->value_size());
+		BOOL known = FALSE;
+
+		for( optional = inSystem ? OptionalAttributes(name) : NULL; optional != NULL && *optional != NULL; optional++ )
+			known = known || attributeName == *optional;
+
+		if( known )
+			continue;
+
+		AddToken(tokens, TOKEN_ATTRIBUTE, attributeName);
+
+		// The namespace is part of the template, not of the event
+		if( path.size() == 1 && attributeName == L"xmlns" )
+			AddToken(tokens, TOKEN_VALUE, text);
+		else
+			AddSubstitution(event, tokens, inSystem ? SystemType(name, attributeName.c_str()) : TYPE_STRING, &text, FALSE, embedded);
+
+		if( inSystem && name == L"TimeCreated" && attributeName == L"SystemTime" )
+			ParseSystemTime(text.c_str(), &event->written);
+
+		tokens[open].hasAttributes = TRUE;
+	}
+
+	if( node->first_node() == NULL ) {
+		// rapidxml has no content for both <Data/> and <Data></Data>, so
+		// look at which one the text has. Only the first is an empty element
+		size_t close = event->text->find(L'>', node->name() - event->parsed);
+
+		if( close == std::wstring::npos || close == 0 || (*event->text)[close - 1] == L'/' ) {
+			AddToken(tokens, TOKEN_CLOSE_EMPTY_ELEMENT);
+			path.pop_back();
+			return;
+		}
+
+		std::wstring empty;
+
+		AddToken(tokens, TOKEN_CLOSE_START_ELEMENT);
+		if( event->classic && !embedded && path.size() == 2 && name == L"EventData" ) {
+			EVTX_VALUE value;
+
+			value.type = TYPE_BINXML;
+			AddToken(tokens, TOKEN_NORMAL_SUBSTITUTION, std::wstring(), (WORD)event->values->size(), TYPE_BINXML);
+			event->values->push_back(value);
+		} else {
+			AddSubstitution(event, tokens, TYPE_STRING, &empty, FALSE, embedded);
+		}
+		AddToken(tokens, TOKEN_END_ELEMENT);
+		path.pop_back();
+		return;
+	}
+
+	AddToken(tokens, TOKEN_CLOSE_START_ELEMENT);
+
+	if( event->classic && !embedded && path.size() == 2 && name == L"EventData" ) {
+		// The whole content becomes one embedded BinXml value
+		EVTX_VALUE value;
+
+		value.type = TYPE_BINXML;
+		for( rapidxml::xml_node<WCHAR> *child = node->first_node(); child != NULL; child = child->next_sibling() ) {
+			if( child->type() == rapidxml::node_element )
+				DescribeElement(event, child, path, value.fragment, TRUE);
+			else
+				AddToken(value.fragment, TOKEN_VALUE, std::wstring(child->value(), child->value_size()));
+		}
+
+		AddToken(tokens, TOKEN_NORMAL_SUBSTITUTION, std::wstring(), (WORD)event->values->size(), TYPE_BINXML);
+		event->values->push_back(value);
+	} else {
+		for( rapidxml::xml_node<WCHAR> *child = node->first_node(); child != NULL; child = child->next_sibling() ) {
+			if( child->type() == rapidxml::node_element ) {
+				DescribeElement(event, child, path, tokens, embedded);
+				continue;
+			}
+
+			std::wstring text(child->value(), child->value_size());
+
+			// Renumbered copies of an event get their new record ID here
+			if( inSystem && name == L"EventRecordID" ) {
+				if( event->recordId != 0 ) {
+					WCHAR digits[24];
+					text = FormatUnsigned(event->recordId, digits);
+				} else {
+					event->recordId = _wcstoui64(text.c_str(), NULL, 10);
+				}
+			}
+
+			AddSubstitution(event, tokens, inSystem ? SystemType(name, NULL) : TYPE_STRING, &text, FALSE, embedded);
+		}
+	}
+
+	AddToken(tokens, TOKEN_END_ELEMENT);
+	path.pop_back();
+}
+
+
+EvtxWriter::EvtxWriter()
+	: file(NULL), records(0), chunks(0), lastRecordId(0)
+{
+	ResetChunk();
+}
+
+
+EvtxWriter::~EvtxWriter()
+{
+	if( file != NULL )
+		fclose(file);
+}
+
+
+/****
+ * EvtxWriter::Create
+ *
+ * DESC:
+ *     Creates the file. The header is written by Close, once the chunk
+ *     count is known
+ */
+BOOL EvtxWriter::Create(const char *path)
+{
+	file = fopen(path, "wb");
+
+	if( file == NULL ) {
+		fwprintf(stderr, L"[Error][EvtxWriter]: Could not create '%s'\n", path);
+		return FALSE;
+	}
+
+	BYTE header[EVTX_FILE_HEADER_SIZE] = { 0 };
+
+	return fwrite(header, sizeof(header), 1, file) == 1;
+}
+
+
+/****
+ * EvtxWriter::Add
+ *
+ * DESC:
+ *     Appends one event
+ *
+ * ARGS:
+ *     xml - the event, as rendered by EvtRender (no RenderingInfo)
+ *     recordId - record ID to give the event, or 0 to keep its own
+ *
+ * RETURNS:
+ *     TRUE on success, FALSE if the XML could not be parsed or the event
+ *     does not fit in a chunk
+ */
+BOOL EvtxWriter::Add(const std::wstring &xml, ULONGLONG recordId)
+{
+	std::vector<WCHAR> scratch(xml.begin(), xml.end());
+	scratch.push_back(L'\0');
+
+	rapidxml::xml_document<WCHAR> doc;
+
+	try {
+		doc.parse<0>(&scratch[0]);
+	} catch( rapidxml::parse_error & ) {
+		fwprintf(stderr, L"[Error][EvtxWriter]: Malformed event\n");
+		return FALSE;
+	}
+
+	rapidxml::xml_node<WCHAR> *nodeEvent = doc.first_node(L"Event");
+	rapidxml::xml_node<WCHAR> *nodeSystem = nodeEvent != NULL ? nodeEvent->first_node(L"System") : NULL;
+
+	if( nodeSystem == NULL )
+		return FALSE;
+
+	std::vector<EVTX_TOKEN> tokens;
+	std::vector<EVTX_VALUE> values;
+	std::vector<std::wstring> path;
+	EVENT_DESCRIPTION event;
+	rapidxml::xml_node<WCHAR> *nodeProvider = nodeSystem->first_node(L"Provider");
+
+	event.values = &values;
+	event.recordId = recordId;
+	event.written = 0;
+	event.classic = nodeProvider != NULL && nodeProvider->first_attribute(L"EventSourceName") != NULL;
+	event.parsed = &scratch[0];
+	event.text = &xml;
+
+	DescribeElement(&event, nodeEvent, path, tokens, FALSE);
+
+	std::vector<BYTE> record;
+
+	for( int attempt = 0; attempt < 2; attempt++ ) {
+		Encode(tokens, values, event.recordId, event.written, record);
+
+		if( used + record.size() <= EVTX_CHUNK_SIZE ) {
+			Commit(record, event.recordId);
+			return TRUE;
+		}
+
+		Rollback();
+
+		if( attempt > 0 || firstRecord == 0 || !FlushChunk() )
+			break;
+	}
+
+	fwprintf(stderr, L"[Error][EvtxWriter]: Event %llu does not fit in a chunk\n", (unsigned long long)event.recordId);
+	return FALSE;
+}
+
+
+/****
+ * EvtxWriter::Encode
+ *
+ * DESC:
+ *     Writes one record as it would sit at the current end of the chunk
+ */
+void EvtxWriter::Encode(const std::vector<EVTX_TOKEN> &tokens, const std::vector<EVTX_VALUE> &values, ULONGLONG recordId, ULONGLONG written, std::vector<BYTE> &out)
+{
+	DWORD base = used;
+
+	out.clear();
+	Put32(out, 0x00002A2A);
+	Put32(out, 0);
+	Put64(out, recordId);
+	Put64(out, written);
+
+	out.push_back(TOKEN_FRAGMENT_HEADER);
+	out.push_back(1);
+	out.push_back(1);
+	out.push_back(0);
+
+	// The template is known by its shape
+	std::wstring shape;
+
+	for( size_t i = 0; i < tokens.size(); i++ ) {
+		shape += (WCHAR)(tokens[i].type + 1);
+		shape += tokens[i].text;
+		shape += (WCHAR)(tokens[i].valueType + 1);
+		shape += L'|';
+	}
+
+	ULONGLONG hash = 14695981039346656037ULL;
+
+	for( size_t i = 0; i < shape.size(); i++ )
+		hash = (hash ^ (DWORD)shape[i]) * 1099511628211ULL;
+
+	std::map<std::wstring, DWORD>::iterator found = templates.find(shape);
+
+	out.push_back(TOKEN_TEMPLATE_INSTANCE);
+	out.push_back(1);
+	Put32(out, (DWORD)hash);
+
+	if( found != templates.end() ) {
+		Put32(out, found->second);
+	} else {
+		// Inline definition: next definition, GUID, data size, data
+		DWORD definition = base + (DWORD)out.size() + 4;
+
+		Put32(out, definition);
+		Put32(out, 0);
+		Put64(out, hash);
+		Put64(out, hash * 31 + shape.size());
+
+		size_t sizeAt = out.size();
+
+		Put32(out, 0);
+		out.push_back(TOKEN_FRAGMENT_HEADER);
+		out.push_back(1);
+		out.push_back(1);
+		out.push_back(0);
+		EmitTokens(tokens, out, base);
+		out.push_back(0);
+		Set32(&out[sizeAt], (DWORD)(out.size() - sizeAt - 4));
+
+		templates[shape] = definition;
+		pendingTemplates.push_back(shape);
+	}
+
+	// Values: count, descriptors, data
+	Put32(out, (DWORD)values.size());
+
+	size_t descriptors = out.size();
+
+	for( size_t i = 0; i < values.size(); i++ )
+		Put32(out, 0);
+
+	for( size_t i = 0; i < values.size(); i++ ) {
+		size_t start = out.size();
+
+		if( values[i].type == TYPE_BINXML ) {
+			out.push_back(TOKEN_FRAGMENT_HEADER);
+			out.push_back(1);
+			out.push_back(1);
+			out.push_back(0);
+			EmitTokens(values[i].fragment, out, base);
+			out.push_back(0);
+		} else {
+			out.insert(out.end(), values[i].data.begin(), values[i].data.end());
+		}
+
+		Set16(&out[descriptors + i * 4], (WORD)(out.size() - start));
+		out[descriptors + i * 4 + 2] = values[i].type;
+	}
+
+	out.push_back(0);
+
+	// The size is repeated at the end so the log can be walked backwards
+	Put32(out, (DWORD)out.size() + 4);
+	Set32(&out[4], (DWORD)out.size());
+}
+
+
+/****
+ * EvtxWriter::EmitTokens
+ *
+ * DESC:
+ *     Writes tokens as BinXml, at chunk offset base + out.size()
+ */
+void EvtxWriter::EmitTokens(const std::vector<EVTX_TOKEN> &tokens, std::vector<BYTE> &out, DWORD base)
+{
+	std::vector<size_t> elementSizes;
+	size_t attributeSize = 0;
+
+	for( size_t i = 0; i < tokens.size(); i++ ) {
+		const EVTX_TOKEN &token = tokens[i];
+
+		switch( token.type ) {
+		case TOKEN_OPEN_START_ELEMENT:
+			out.push_back(token.hasAttributes ? TOKEN_OPEN_START_ELEMENT | TOKEN_MORE_DATA : TOKEN_OPEN_START_ELEMENT);
+			Put16(out, 0xFFFF);
+			elementSizes.push_back(out.size());
+			Put32(out, 0);
+			EmitName(token.text, out, base);
+			if( token.hasAttributes ) {
+				attributeSize = out.size();
+				Put32(out, 0);
+			}
+			break;
+
+		case TOKEN_ATTRIBUTE: {
+			BOOL more = FALSE;
+
+			for( size_t j = i + 1; j < tokens.size() && !more; j++ ) {
+				if( tokens[j].type == TOKEN_CLOSE_START_ELEMENT || tokens[j].type == TOKEN_CLOSE_EMPTY_ELEMENT )
+					break;
+				more = tokens[j].type == TOKEN_ATTRIBUTE;
+			}
+
+			out.push_back(more ? TOKEN_ATTRIBUTE | TOKEN_MORE_DATA : TOKEN_ATTRIBUTE);
+			EmitName(token.text, out, base);
+			break;
+		}
+
+		case TOKEN_VALUE: {
+			out.push_back(TOKEN_VALUE);
+			out.push_back(TYPE_STRING);
+
+			size_t count = out.size();
+
+			Put16(out, 0);
+			WORD units = (WORD)PutUtf16(out, token.text);
+			Set16(&out[count], units);
+			break;
+		}
+
+		case TOKEN_NORMAL_SUBSTITUTION:
+		case TOKEN_OPTIONAL_SUBSTITUTION:
+			out.push_back(token.type);
+			Put16(out, token.id);
+			out.push_back(token.valueType);
+			break;
+
+		case TOKEN_CLOSE_START_ELEMENT:
+		case TOKEN_CLOSE_EMPTY_ELEMENT:
+		case TOKEN_END_ELEMENT:
+			if( token.type != TOKEN_END_ELEMENT && attributeSize != 0 ) {
+				Set32(&out[attributeSize], (DWORD)(out.size() - attributeSize - 4));
+				attributeSize = 0;
+			}
+
+			out.push_back(token.type);
+
+			if( token.type != TOKEN_CLOSE_START_ELEMENT ) {
+				Set32(&out[elementSizes.back()], (DWORD)(out.size() - elementSizes.back() - 4));
+				elementSizes.pop_back();
+			}
+			break;
+		}
+	}
+}
+
+
+/****
+ * EvtxWriter::EmitName
+ *
+ * DESC:
+ *     Writes a reference to a name, and the name itself the first time the
+ *     chunk uses it
+ */
+void EvtxWriter::EmitName(const std::wstring &name, std::vector<BYTE> &out, DWORD base)
+{
+	std::map<std::wstring, DWORD>::iterator found = names.find(name);
+
+	if( found != names.end() ) {
+		Put32(out, found->second);
+		return;
+	}
+
+	DWORD offset = base + (DWORD)out.size() + 4;
+
+	Put32(out, offset);
+	Put32(out, 0);
+	Put16(out, NameHash(name));
+
+	size_t count = out.size();
+
+	Put16(out, 0);
+	WORD units = (WORD)PutUtf16(out, name);
+	Set16(&out[count], units);
+	Put16(out, 0);
+
+	names[name] = offset;
+	pendingNames.push_back(name);
+}
+
+
+// Forgets the names and templates of a record that did not fit
+void EvtxWriter::Rollback()
+{
+	for( size_t i = 0; i < pendingNames.size(); i++ )
+		names.erase(pendingNames[i]);
+	for( size_t i = 0; i < pendingTemplates.size(); i++ )
+		templates.erase(pendingTemplates[i]);
+
+	pendingNames.clear();
+	pendingTemplates.clear();
+}
+
+
+/****
+ * EvtxWriter::Commit
+ *
+ * DESC:
+ *     Places a record in the chunk and links its new names and templates
+ *     into the chunk's tables
+ */
+void EvtxWriter::Commit(const std::vector<BYTE> &record, ULONGLONG recordId)
+{
+	memcpy(chunk + used, &record[0], record.size());
+
+	for( size_t i = 0; i < pendingNames.size(); i++ ) {
+		DWORD offset = names[pendingNames[i]];
+		BYTE *bucket = chunk + CHUNK_STRING_TABLE + (NameHash(pendingNames[i]) % CHUNK_STRING_BUCKETS) * 4;
+
+		Set32(chunk + offset, Get32(bucket));
+		Set32(bucket, offset);
+	}
+
+	for( size_t i = 0; i < pendingTemplates.size(); i++ ) {
+		DWORD offset = templates[pendingTemplates[i]];
+		BYTE *bucket = chunk + CHUNK_TEMPLATE_TABLE + (Get32(chunk + offset + 4) % CHUNK_TEMPLATE_BUCKETS) * 4;
+
+		Set32(chunk + offset, Get32(bucket));
+		Set32(bucket, offset);
+	}
+
+	pendingNames.clear();
+	pendingTemplates.clear();
+
+	if( firstRecord == 0 )
+		firstRecord = recordId;
+	lastRecord = recordId;
+	lastRecordOffset = used;
+	used += (DWORD)record.size();
+
+	records++;
+	lastRecordId = recordId;
+}
+
+
+void EvtxWriter::ResetChunk()
+{
+	memset(chunk, 0, sizeof(chunk));
+	used = EVTX_CHUNK_HEADER_SIZE;
+	lastRecordOffset = 0;
+	firstRecord = 0;
+	lastRecord = 0;
+	names.clear();
+	templates.clear();
+	pendingNames.clear();
+	pendingTemplates.clear();
+}
+
+
+/****
+ * EvtxWriter::FlushChunk
+ *
+ * DESC:
+ *     Completes the chunk header and writes the chunk out
+ */
+BOOL EvtxWriter::FlushChunk()
+{
+	memcpy(chunk, "ElfChnk", 8);
+	Set64(chunk + CHUNK_FIRST_RECORD_NUMBER, firstRecord);
+	Set64(chunk + CHUNK_LAST_RECORD_NUMBER, lastRecord);
+	Set64(chunk + CHUNK_FIRST_RECORD_ID, firstRecord);
+	Set64(chunk + CHUNK_LAST_RECORD_ID, lastRecord);
+	Set32(chunk + CHUNK_HEADER_SIZE, 128);
+	Set32(chunk + CHUNK_LAST_RECORD_OFFSET, lastRecordOffset);
+	Set32(chunk + CHUNK_FREE_SPACE_OFFSET, used);
+	Set32(chunk + CHUNK_RECORDS_CHECKSUM, Crc32(chunk + EVTX_CHUNK_HEADER_SIZE, used - EVTX_CHUNK_HEADER_SIZE));
+
+	// The header checksum skips its own field and the flags before it
+	DWORD crc = Crc32(chunk, 120);
+	Set32(chunk + CHUNK_HEADER_CHECKSUM, Crc32(chunk + 128, EVTX_CHUNK_HEADER_SIZE - 128, crc));
+
+	if( fwrite(chunk, sizeof(chunk), 1, file) != 1 ) {
+		fwprintf(stderr, L"[Error][EvtxWriter]: Could not write chunk %u\n", chunks);
+		return FALSE;
+	}
+
+	chunks++;
+	ResetChunk();
+
+	return TRUE;
+}
+
+
+/****
+ * EvtxWriter::Close
+ *
+ * DESC:
+ *     Writes the last chunk and the file header, and closes the file
+ */
+BOOL EvtxWriter::Close()
+{
+	if( file == NULL )
+		return FALSE;
+
+	BOOL ok = TRUE;
+
+	if( firstRecord != 0 )
+		ok = FlushChunk();
+
+	BYTE header[128] = { 0 };
+
+	memcpy(header, "ElfFile", 8);
+	Set64(header + FILE_LAST_CHUNK_NUMBER, chunks > 0 ? chunks - 1 : 0);
+	Set64(header + FILE_NEXT_RECORD_ID, lastRecordId + 1);
+	Set32(header + FILE_HEADER_SIZE, 128);
+	Set16(header + FILE_MINOR_VERSION, 1);
+	Set16(header + FILE_MAJOR_VERSION, 3);
+	Set16(header + FILE_HEADER_BLOCK_SIZE, EVTX_FILE_HEADER_SIZE);
+	Set16(header + FILE_CHUNK_COUNT, (WORD)(chunks > 0xFFFF ? 0xFFFF : chunks));
+	Set32(header + FILE_HEADER_CHECKSUM, Crc32(header, 120));
+
+	ok = ok && fseek(file, 0, SEEK_SET) == 0 && fwrite(header, sizeof(header), 1, file) == 1;
+	ok = fclose(file) == 0 && ok;
+	file = NULL;
+
+	if( !ok )
+		fwprintf(stderr, L"[Error][EvtxWriter]: Could not finish the file\n");
+
+	return ok;
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <stdio.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "EvtxDecoder.h"
+
+// One piece of BinXml, before it is placed in a chunk
+struct EVTX_TOKEN {
+	BYTE type;
+	std::wstring text;
+	WORD id;
+	BYTE valueType;
+	BOOL hasAttributes;
+};
+
+// One substitution value. Embedded BinXml is kept as tokens, as its names
+// can only be placed once its position in the chunk is known
+struct EVTX_VALUE {
+	BYTE type;
+	std::vector<BYTE> data;
+	std::vector<EVTX_TOKEN> fragment;
+};
+
+/****
+ * EvtxWriter
+ *
+ * DESC:
+ *     Writes events, given as the XML EvtRender produces for them, into an
+ *     .evtx file. Used to build the corpus and the large files the .evtx
+ *     reader is checked and benchmarked against
+ *
+ * REMARKS:
+ *     Files are laid out the way the event log service writes them: a file
+ *     header, then 64 KiB chunks with their string and template tables and
+ *     checksums. Every event is a template instance. Templates are shared
+ *     by events of the same shape, are written inline the first time a
+ *     chunk uses them and referenced after that, and so are element and
+ *     attribute names.
+ *
+ *     System values get the types Windows gives them (FILETIME, GUID, SID,
+ *     HexInt64...) as long as the text survives the round trip. Optional
+ *     System attributes (Provider Guid, EventID Qualifiers...) are part of
+ *     every template and passed as null when an event lacks them. The
+ *     EventData of classic providers is written as an embedded BinXml value,
+ *     the way some real logs carry theirs.
+ */
+class EvtxWriter {
+public:
+	EvtxWriter();
+	~EvtxWriter();
+
+	BOOL Create(const char *path);
+	BOOL Add(const std::wstring &xml, ULONGLONG recordId);
+	BOOL Close();
+
+	DWORD64 Records() const { return records; }
+
+private:
+	EvtxWriter(const EvtxWriter &);
+	EvtxWriter &operator=(const EvtxWriter &);
+
+	void Encode(const std::vector<EVTX_TOKEN> &tokens, const std::vector<EVTX_VALUE> &values, ULONGLONG recordId, ULONGLONG written, std::vector<BYTE> &out);
+	void EmitTokens(const std::vector<EVTX_TOKEN> &tokens, std::vector<BYTE> &out, DWORD base);
+	void EmitName(const std::wstring &name, std::vector<BYTE> &out, DWORD base);
+	void Rollback();
+	void Commit(const std::vector<BYTE> &record, ULONGLONG recordId);
+	void ResetChunk();
+	BOOL FlushChunk();
+
+	FILE *file;
+	DWORD64 records;
+	DWORD chunks;
+	ULONGLONG lastRecordId;
+
+	// The chunk being filled
+	BYTE chunk[EVTX_CHUNK_SIZE];
+	DWORD used;
+	DWORD lastRecordOffset;
+	ULONGLONG firstRecord;
+	ULONGLONG lastRecord;
+	std::map<std::wstring, DWORD> names;
+	std::map<std::wstring, DWORD> templates;
+	std::vector<std::wstring> pendingNames;
+	std::vector<std::wstring> pendingTemplates;
+};
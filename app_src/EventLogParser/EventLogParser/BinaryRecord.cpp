@@ -0,0 +1,186 @@
+#include "BinaryRecord.h"
+#include "Utf8Encode.h"
+#include <string.h>
+#include <wchar.h>
+
+// The string fields, in the order they are written
+#define BINARY_STRING_COUNT 4
+
+static const DWORD binaryStringFields[BINARY_STRING_COUNT] = {
+	RECORD_FIELD_LOGNAME, RECORD_FIELD_SOURCE, RECORD_FIELD_COMPUTER, RECORD_FIELD_MESSAGE
+};
+
+
+// Appends n bytes of a number, little endian first. Every target this
+// builds for is little endian, so that is the number's own layout
+static BYTE *PutNumber(BYTE *out, DWORD64 number, size_t n)
+{
+	memcpy(out, &number, n);
+
+	return out + n;
+}
+
+
+BOOL EncodeBinaryRecord(GrowBuffer *buffer, const SYSTEM_FIELDS *fields, LPCWSTR message, DWORD projection, DWORD *bytes)
+{
+	LPCWSTR strings[BINARY_STRING_COUNT] = { fields->channel, fields->provider, fields->computer, message };
+	size_t lengths[BINARY_STRING_COUNT];
+	DWORD64 recordId = 0, timeCreated = 0, eventId = 0, task = 0, level = 0;
+	DWORD present = 0;
+
+	if( (projection & RECORD_FIELD_RECORD_ID) && GetFieldNumber(fields, RECORD_FIELD_RECORD_ID, &recordId) )
+		present |= RECORD_FIELD_RECORD_ID;
+
+	if( (projection & RECORD_FIELD_TIME_CREATED) && GetFieldNumber(fields, RECORD_FIELD_TIME_CREATED, &timeCreated) )
+		present |= RECORD_FIELD_TIME_CREATED;
+
+	if( (projection & RECORD_FIELD_EVENT_ID) && GetFieldNumber(fields, RECORD_FIELD_EVENT_ID, &eventId) )
+		present |= RECORD_FIELD_EVENT_ID;
+
+	if( (projection & RECORD_FIELD_TASK) && GetFieldNumber(fields, RECORD_FIELD_TASK, &task) )
+		present |= RECORD_FIELD_TASK;
+
+	if( (projection & RECORD_FIELD_LEVEL) && GetFieldNumber(fields, RECORD_FIELD_LEVEL, &level) )
+		present |= RECORD_FIELD_LEVEL;
+
+	// Room for the worst case, so that the strings can be encoded straight in
+	DWORD64 room = BINARY_RECORD_HEADER + BINARY_RECORD_ID_BYTES + BINARY_TIME_CREATED_BYTES
+		+ BINARY_EVENT_ID_BYTES + BINARY_TASK_BYTES + BINARY_LEVEL_BYTES;
+
+	for( INT i = 0; i < BINARY_STRING_COUNT; i++ )
+	{
+		if( !(projection & binaryStringFields[i]) || strings[i] == NULL )
+			continue;
+
+		lengths[i] = wcslen(strings[i]);
+		room += BINARY_STRING_LENGTH_BYTES + (DWORD64)lengths[i] * UTF8_MAX_GROWTH;
+		present |= binaryStringFields[i];
+	}
+
+	if( room > 0xFFFFFFFF || !buffer->Reserve((DWORD)room) )
+		return FALSE;
+
+	BYTE *start = (BYTE *)buffer->Data();
+	BYTE *out = start + BINARY_RECORD_HEADER;
+
+	if( present & RECORD_FIELD_RECORD_ID )
+		out = PutNumber(out, recordId, BINARY_RECORD_ID_BYTES);
+
+	if( present & RECORD_FIELD_TIME_CREATED )
+		out = PutNumber(out, timeCreated, BINARY_TIME_CREATED_BYTES);
+
+	if( present & RECORD_FIELD_EVENT_ID )
+		out = PutNumber(out, eventId, BINARY_EVENT_ID_BYTES);
+
+	if( present & RECORD_FIELD_TASK )
+		out = PutNumber(out, task, BINARY_TASK_BYTES);
+
+	if( present & RECORD_FIELD_LEVEL )
+		out = PutNumber(out, level, BINARY_LEVEL_BYTES);
+
+	for( INT i = 0; i < BINARY_STRING_COUNT; i++ )
+	{
+		if( !(present & binaryStringFields[i]) )
+			continue;
+
+		size_t written = WideToUtf8(strings[i], lengths[i], (char *)out + BINARY_STRING_LENGTH_BYTES);
+
+		out = PutNumber(out, written, BINARY_STRING_LENGTH_BYTES) + written;
+	}
+
+	*bytes = (DWORD)(out - start);
+
+	PutNumber(start, *bytes - 4, 4);
+	PutNumber(start + 4, present, 2);
+
+	return TRUE;
+}
+
+
+/****
+ * BinaryRecordReader::BinaryRecordReader
+ *
+ * ARGS:
+ *     data - the records
+ *     bytes - size of data, in bytes
+ */
+BinaryRecordReader::BinaryRecordReader(const BYTE *data, size_t bytes)
+	: data(data), bytes(bytes), offset(0), failed(FALSE)
+{
+}
+
+
+// Takes n bytes of a number from a record, if the record has them
+static BOOL GetNumber(const BYTE **at, const BYTE *end, size_t n, DWORD64 *number)
+{
+	if( (size_t)(end - *at) < n )
+		return FALSE;
+
+	*number = 0;
+	memcpy(number, *at, n);
+	*at += n;
+
+	return TRUE;
+}
+
+
+BOOL BinaryRecordReader::Next(BINARY_RECORD *record)
+{
+	DWORD64 length = 0, present = 0;
+	const BYTE *at = data + offset;
+	const BYTE *end = data + bytes;
+
+	if( failed || offset == bytes )
+		return FALSE;
+
+	if( !GetNumber(&at, end, 4, &length) || length > (size_t)(end - at) || !GetNumber(&at, at + length, 2, &present) ) {
+		failed = TRUE;
+		return FALSE;
+	}
+
+	end = data + offset + 4 + length;
+
+	DWORD64 recordId = 0, timeCreated = 0, eventId = 0, task = 0, level = 0;
+	BINARY_STRING *strings[BINARY_STRING_COUNT] = { &record->channel, &record->provider, &record->computer, &record->message };
+
+	BOOL ok = (!(present & RECORD_FIELD_RECORD_ID) || GetNumber(&at, end, BINARY_RECORD_ID_BYTES, &recordId))
+		&& (!(present & RECORD_FIELD_TIME_CREATED) || GetNumber(&at, end, BINARY_TIME_CREATED_BYTES, &timeCreated))
+		&& (!(present & RECORD_FIELD_EVENT_ID) || GetNumber(&at, end, BINARY_EVENT_ID_BYTES, &eventId))
+		&& (!(present & RECORD_FIELD_TASK) || GetNumber(&at, end, BINARY_TASK_BYTES, &task))
+		&& (!(present & RECORD_FIELD_LEVEL) || GetNumber(&at, end, BINARY_LEVEL_BYTES, &level));
+
+	for( INT i = 0; ok && i < BINARY_STRING_COUNT; i++ )
+	{
+		DWORD64 count = 0;
+
+		strings[i]->text = "";
+		strings[i]->bytes = 0;
+
+		if( !(present & binaryStringFields[i]) )
+			continue;
+
+		ok = GetNumber(&at, end, BINARY_STRING_LENGTH_BYTES, &count) && count <= (size_t)(end - at);
+
+		if( ok ) {
+			strings[i]->text = (const char *)at;
+			strings[i]->bytes = (DWORD)count;
+			at += count;
+		}
+	}
+
+	if( !ok ) {
+		failed = TRUE;
+		return FALSE;
+	}
+
+	record->fields = (DWORD)present;
+	record->recordId = recordId;
+	record->timeCreated = timeCreated;
+	record->eventId = (WORD)eventId;
+	record->task = (WORD)task;
+	record->level = (BYTE)level;
+
+	offset = end - data;
+
+	return TRUE;
+}
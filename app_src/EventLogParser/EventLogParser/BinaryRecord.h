@@ -0,0 +1,112 @@
+#pragma once
+
+#include "Platform.h"
+#include "RenderContext.h"
+#include "SystemFields.h"
+
+// Bytes ahead of a binary record's fields: its length and the flags of
+// the fields it has
+#define BINARY_RECORD_HEADER 6
+
+// Bytes each numeric field takes, and the count ahead of each string
+#define BINARY_RECORD_ID_BYTES 8
+#define BINARY_TIME_CREATED_BYTES 8
+#define BINARY_EVENT_ID_BYTES 2
+#define BINARY_TASK_BYTES 2
+#define BINARY_LEVEL_BYTES 1
+#define BINARY_STRING_LENGTH_BYTES 4
+
+// A string field of a binary record, as UTF-8. Points into the record and
+// is not null-terminated
+struct BINARY_STRING {
+	const char *text;
+	DWORD bytes;
+};
+
+// A binary record as BinaryRecordReader reads it. fields is the
+// RECORD_FIELD_* flags of the fields it has; the others are 0, or empty
+struct BINARY_RECORD {
+	DWORD fields;
+	DWORD64 recordId;
+	ULONGLONG timeCreated;
+	WORD eventId;
+	WORD task;
+	BYTE level;
+	BINARY_STRING channel;
+	BINARY_STRING provider;
+	BINARY_STRING computer;
+	BINARY_STRING message;
+};
+
+/****
+ * EncodeBinaryRecord
+ *
+ * DESC:
+ *     Formats an event as one binary record (OUTPUT_FORMAT_BINARY): the
+ *     numeric fields as numbers and the strings as counted UTF-8, so that
+ *     a reader needs no delimiters and parses no text. All in little
+ *     endian order:
+ *
+ *         u32  bytes of the record after this count
+ *         u16  RECORD_FIELD_* flags of the fields that follow
+ *         u64  record ID                     RECORD_FIELD_RECORD_ID
+ *         u64  TimeCreated, as a FILETIME    RECORD_FIELD_TIME_CREATED
+ *         u16  event ID                      RECORD_FIELD_EVENT_ID
+ *         u16  task                          RECORD_FIELD_TASK
+ *         u8   level                         RECORD_FIELD_LEVEL
+ *         then the channel, provider, computer and message (RECORD_FIELD_
+ *         LOGNAME, _SOURCE, _COMPUTER, _MESSAGE), each a u32 count of
+ *         bytes and that many bytes of UTF-8
+ *
+ * ARGS:
+ *     buffer - where the record is built (the render context's record
+ *              buffer)
+ *     fields - System fields of the event
+ *     message - its message, or NULL if it has none
+ *     projection - RECORD_FIELD_* flags of the fields to write
+ *     bytes - receives the size of the record, count included
+ *
+ * RETURNS:
+ *     TRUE, or FALSE if the buffer could not be grown
+ *
+ * REMARKS:
+ *     A field is only there if the projection has it and the event has a
+ *     value for it, so a reader can tell an event without a message from
+ *     one whose message is empty. The numeric fields are taken from the
+ *     values path as they came, and parsed from their text after the XML
+ *     path. EventData and the identity are not written, as in the '||'
+ *     format.
+ *
+ *     Fields added later go after the message, so a reader that does not
+ *     know them skips to the end of the record.
+ */
+BOOL EncodeBinaryRecord(GrowBuffer *buffer, const SYSTEM_FIELDS *fields, LPCWSTR message, DWORD projection, DWORD *bytes);
+
+/****
+ * BinaryRecordReader
+ *
+ * DESC:
+ *     Reads the binary records packed back to back in a buffer (as
+ *     BinaryBufferSink writes them) without copying anything: the strings
+ *     of each record point into the buffer
+ *
+ * REMARKS:
+ *     Next returns FALSE at the end of the buffer, or at a record that
+ *     runs past it or whose fields run past its own count; Failed tells
+ *     the two apart. Offset is where the next record starts.
+ */
+class BinaryRecordReader {
+public:
+	BinaryRecordReader(const BYTE *data, size_t bytes);
+
+	BOOL Next(BINARY_RECORD *record);
+
+	size_t Offset() const { return offset; }
+	BOOL Failed() const { return failed; }
+
+private:
+	const BYTE *data;
+	size_t bytes;
+	size_t offset;
+	BOOL failed;
+};
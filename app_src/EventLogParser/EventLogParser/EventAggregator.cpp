@@ -0,0 +1,289 @@
+#include "EventAggregator.h"
+#include <wchar.h>
+
+// Characters of a word, as NormalizeMessage splits a message into them
+#define IS_DIGIT(c) ((c) >= L'0' && (c) <= L'9')
+#define IS_HEX(c) (IS_DIGIT(c) || ((c) >= L'a' && (c) <= L'f') || ((c) >= L'A' && (c) <= L'F'))
+#define IS_WORD(c) (IS_HEX(c) || ((c) >= L'g' && (c) <= L'z') || ((c) >= L'G' && (c) <= L'Z') || (c) == L'_')
+#define IS_SPACE(c) ((c) == L' ' || (c) == L'\t' || (c) == L'\r' || (c) == L'\n' || (c) == L'\v' || (c) == L'\f')
+
+
+// Whether a word is a number: hex digits after 0x, or hex digits with a
+// digit among them
+static BOOL IsNumberWord(LPCWSTR word, size_t length)
+{
+	BOOL digit = FALSE;
+
+	if( length > 2 && word[0] == L'0' && (word[1] == L'x' || word[1] == L'X') ) {
+		word += 2;
+		length -= 2;
+		digit = TRUE;
+	}
+
+	for( size_t i = 0; i < length; i++ ) {
+		if( !IS_HEX(word[i]) )
+			return FALSE;
+
+		digit = digit || IS_DIGIT(word[i]);
+	}
+
+	return digit;
+}
+
+
+void NormalizeMessage(LPCWSTR message, std::wstring *out)
+{
+	BOOL started = FALSE, space = FALSE;
+
+	if( message == NULL )
+		return;
+
+	for( LPCWSTR at = message; *at != L'\0'; )
+	{
+		if( IS_SPACE(*at) ) {
+			space = TRUE;
+			at++;
+			continue;
+		}
+
+		if( space && started )
+			out->push_back(L' ');
+
+		space = FALSE;
+		started = TRUE;
+
+		if( !IS_WORD(*at) ) {
+			out->push_back(*at++);
+			continue;
+		}
+
+		LPCWSTR word = at;
+
+		while( IS_WORD(*at) )
+			at++;
+
+		if( IsNumberWord(word, at - word) ) {
+			out->push_back(AGGREGATE_NUMBER_MARK);
+			continue;
+		}
+
+		// Only the digits of any other word, so that "x64" and "x86" stay
+		// apart from each other but not from "x65"
+		for( LPCWSTR c = word; c < at; ) {
+			if( !IS_DIGIT(*c) ) {
+				out->push_back(*c++);
+				continue;
+			}
+
+			out->push_back(AGGREGATE_NUMBER_MARK);
+
+			while( c < at && IS_DIGIT(*c) )
+				c++;
+		}
+	}
+}
+
+
+EventAggregator::EventAggregator()
+	: window(0), maxFlows(AGGREGATE_FLOWS_DEFAULT), latest(0), clock(0), events(0), flows(0), evicted(0)
+{
+}
+
+
+/****
+ * EventAggregator::Configure
+ *
+ * DESC:
+ *     Sets the window and the size of the table. Flows open until then are
+ *     closed, to be drained as before
+ *
+ * ARGS:
+ *     windowSeconds - seconds after a flow's first event from which no
+ *                     event joins it (0 turns aggregation off)
+ *     maxFlows - most flows open at once (at least 1)
+ */
+void EventAggregator::Configure(DWORD windowSeconds, DWORD maxFlows)
+{
+	Flush();
+
+	window = windowSeconds;
+	this->maxFlows = maxFlows > 0 ? maxFlows : 1;
+}
+
+
+/****
+ * EventAggregator::Close
+ *
+ * DESC:
+ *     Moves an open flow to those waiting to be written
+ */
+void EventAggregator::Close(std::list<FLOW>::iterator flow)
+{
+	index.erase(flow->key);
+	closed.splice(closed.end(), open, flow);
+	flows++;
+}
+
+
+/****
+ * EventAggregator::Add
+ *
+ * DESC:
+ *     Merges an event into its open flow, or opens a flow for it
+ *
+ * ARGS:
+ *     fields - System fields of the event
+ *     message - its message, or NULL if it has none
+ */
+void EventAggregator::Add(const SYSTEM_FIELDS *fields, LPCWSTR message)
+{
+	DWORD seconds = GetIpfixSeconds(fields);
+	DWORD64 eventId = 0, recordId = 0;
+	WCHAR number[24];
+
+	GetFieldNumber(fields, RECORD_FIELD_EVENT_ID, &eventId);
+	GetFieldNumber(fields, RECORD_FIELD_RECORD_ID, &recordId);
+
+	events++;
+
+	// The clock moves on with the newest event, and the flows it leaves a
+	// window behind can take no more
+	if( seconds > latest ) {
+		latest = seconds;
+
+		while( !open.empty() && (DWORD64)open.front().firstSeconds + window <= latest )
+			Close(open.begin());
+	}
+
+	key.assign(FormatUnsigned(eventId, number));
+	key.push_back(L'\0');
+	key.append(fields->channel != NULL ? fields->channel : L"");
+	key.push_back(L'\0');
+	key.append(fields->provider != NULL ? fields->provider : L"");
+	key.push_back(L'\0');
+	NormalizeMessage(message, &key);
+
+	std::unordered_map<std::wstring, std::list<FLOW>::iterator>::iterator found = index.find(key);
+
+	if( found != index.end() ) {
+		FLOW &flow = *found->second;
+		DWORD first = seconds < flow.firstSeconds ? seconds : flow.firstSeconds;
+		DWORD last = seconds > flow.lastSeconds ? seconds : flow.lastSeconds;
+
+		if( (DWORD64)(last - first) < window ) {
+			flow.count++;
+			flow.firstSeconds = first;
+			flow.lastSeconds = last;
+			return;
+		}
+
+		// Too far from the flow's first event: it is done, and this one
+		// starts the next
+		Close(found->second);
+	} else if( index.size() >= maxFlows ) {
+		// Room for the new flow
+		evicted++;
+		Close(open.begin());
+	}
+
+	open.push_back(FLOW());
+
+	FLOW &flow = open.back();
+
+	flow.key = key;
+	flow.channel = fields->channel != NULL ? fields->channel : L"";
+	flow.provider = fields->provider != NULL ? fields->provider : L"";
+	flow.message = message != NULL ? message : L"";
+	flow.recordId = recordId;
+	flow.eventId = eventId;
+	flow.count = 1;
+	flow.firstSeconds = flow.lastSeconds = seconds;
+	flow.opened = clock;
+
+	index[flow.key] = --open.end();
+}
+
+
+/****
+ * EventAggregator::Expire
+ *
+ * DESC:
+ *     Moves the aggregator's own time on, and closes the flows opened a
+ *     window or more before it. Flows opened from now on are stamped with
+ *     it
+ *
+ * ARGS:
+ *     now - the time, in Unix seconds (time(NULL) where a live log is
+ *           read)
+ *
+ * REMARKS:
+ *     This is what closes the flows of a log that has gone quiet, whose
+ *     events no longer move the clock Add keeps. It goes by when the flow
+ *     was opened here, not by its events' TimeCreated, so a host whose
+ *     clock is off does not have its flows closed early or held.
+ */
+void EventAggregator::Expire(DWORD64 now)
+{
+	clock = now;
+
+	while( !open.empty() && open.front().opened + window <= clock )
+		Close(open.begin());
+}
+
+
+/****
+ * EventAggregator::Flush
+ *
+ * DESC:
+ *     Closes every open flow, oldest first
+ */
+void EventAggregator::Flush()
+{
+	while( !open.empty() )
+		Close(open.begin());
+}
+
+
+/****
+ * EventAggregator::Drain
+ *
+ * DESC:
+ *     Writes the closed flows to a sink, oldest first, as EpEventLogFlow
+ *     records, or with their messages mined (see WriteIpfixFlow)
+ *
+ * ARGS:
+ *     sink - where the records go
+ *     buffer - where each record is built
+ *     exporter - the machine ID, the most a set may take and the IDs of
+ *                the templates
+ *     miner - the templates of the messages, if the export mines them
+ *
+ * RETURNS:
+ *     TRUE once every closed flow is written, FALSE if the sink refused
+ *     one. That one and those after it wait for the next call
+ */
+BOOL EventAggregator::Drain(OutputSink *sink, GrowBuffer *buffer, const IPFIX_EXPORT *exporter, TemplateMiner *miner)
+{
+	while( !closed.empty() )
+	{
+		FLOW &flow = closed.front();
+		IPFIX_FLOW record;
+
+		record.channel = flow.channel.c_str();
+		record.provider = flow.provider.c_str();
+		record.message = flow.message.c_str();
+		record.recordId = flow.recordId;
+		record.eventId = flow.eventId;
+		record.count = flow.count;
+		record.firstSeconds = flow.firstSeconds;
+		record.lastSeconds = flow.lastSeconds;
+		record.merged = TRUE;
+
+		if( !WriteIpfixFlow(sink, buffer, &record, exporter, miner) )
+			return FALSE;
+
+		closed.pop_front();
+	}
+
+	return TRUE;
+}
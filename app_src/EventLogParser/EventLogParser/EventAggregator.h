@@ -0,0 +1,130 @@
+#pragma once
+
+#include "Platform.h"
+#include "RenderContext.h"
+#include "SystemFields.h"
+#include "IpfixRecord.h"
+#include "OutputSink.h"
+#include <list>
+#include <string>
+#include <unordered_map>
+
+// Seconds a flow stays open after its first event, and how many flows are
+// open at once, when the caller does not say (see SetIpfixAggregation)
+#define AGGREGATE_WINDOW_DEFAULT 60
+#define AGGREGATE_FLOWS_DEFAULT 4096
+
+// Longest window, a day, and the most flows that can be open at once
+#define AGGREGATE_WINDOW_MAX 86400
+#define AGGREGATE_FLOWS_MAX 1000000
+
+// What a number in a message is left as once it is normalized
+#define AGGREGATE_NUMBER_MARK L'#'
+
+/****
+ * NormalizeMessage
+ *
+ * DESC:
+ *     Appends the form of a message that events are merged on: every run
+ *     of white space made one space, none at either end, and every number
+ *     made AGGREGATE_NUMBER_MARK. A number is a word of hex digits with a
+ *     digit among them or 0x ahead of them, or else a run of digits in a
+ *     word, so that ports, process IDs, addresses, handles and logon IDs
+ *     do not keep a storm's events apart
+ *
+ * ARGS:
+ *     message - the message (NULL is taken as empty)
+ *     out - what it is appended to
+ */
+void NormalizeMessage(LPCWSTR message, std::wstring *out);
+
+/****
+ * EventAggregator
+ *
+ * DESC:
+ *     Merges events into flows for OUTPUT_FORMAT_IPFIX, so that a storm of
+ *     the same event is one EpEventLog record with its real count rather
+ *     than a record each. Events are merged when they have the same log,
+ *     event ID, provider and normalized message (see NormalizeMessage),
+ *     and TimeCreated no more than the window apart. The machine is the
+ *     session's, the same for all of them
+ *
+ * REMARKS:
+ *     A flow is open until it can take no more events, and then closed
+ *     and waiting to be written. It is closed when:
+ *
+ *       - an event of the same key comes that is a window or more from
+ *         its first one,
+ *       - events a window or more past its first one have been added (the
+ *         newest TimeCreated added so far is the aggregator's clock, so a
+ *         log read in order closes flows as it goes),
+ *       - Expire is called a window or more after the call that was
+ *         current when it was opened, for a log that has gone quiet,
+ *       - the table is full and a new flow needs room: the oldest goes,
+ *       - or Flush is called.
+ *
+ *     So no flow spans more than the window, and at most maxFlows are
+ *     open. A flow keeps the record ID and message of its first event;
+ *     events merged into it only add to its count and widen its times.
+ *     Closed flows wait for Drain, which writes what the sink takes.
+ *
+ *     A window of 0 turns aggregation off (Enabled is FALSE); the session
+ *     then writes a record per event, as before.
+ */
+class EventAggregator {
+public:
+	EventAggregator();
+
+	void Configure(DWORD windowSeconds, DWORD maxFlows);
+	BOOL Enabled() const { return window > 0; }
+
+	void Add(const SYSTEM_FIELDS *fields, LPCWSTR message);
+	void Expire(DWORD64 now);
+	void Flush();
+	BOOL Drain(OutputSink *sink, GrowBuffer *buffer, const IPFIX_EXPORT *exporter, TemplateMiner *miner = NULL);
+
+	DWORD Window() const { return window; }
+	DWORD MaxFlows() const { return maxFlows; }
+	DWORD Open() const { return (DWORD)index.size(); }
+	DWORD Pending() const { return (DWORD)closed.size(); }
+	DWORD64 Events() const { return events; }
+	DWORD64 Flows() const { return flows; }
+	DWORD64 Evicted() const { return evicted; }
+
+private:
+	struct FLOW {
+		std::wstring key;
+		std::wstring channel;
+		std::wstring provider;
+		std::wstring message;
+		DWORD64 recordId;
+		DWORD64 eventId;
+		DWORD64 count;
+		DWORD firstSeconds;
+		DWORD lastSeconds;
+		DWORD64 opened;
+	};
+
+	void Close(std::list<FLOW>::iterator flow);
+
+	DWORD window;
+	DWORD maxFlows;
+
+	// Newest TimeCreated added, and the time of the last Expire
+	DWORD latest;
+	DWORD64 clock;
+
+	DWORD64 events;
+	DWORD64 flows;
+	DWORD64 evicted;
+
+	// Open flows, the one opened first at the front, and those closed,
+	// oldest first, waiting to be written
+	std::list<FLOW> open;
+	std::list<FLOW> closed;
+	std::unordered_map<std::wstring, std::list<FLOW>::iterator> index;
+
+	// Reused for lookups, so an event merged into a flow does not
+	// allocate a key
+	std::wstring key;
+};
@@ -0,0 +1,529 @@
+#include "EventCursor.h"
+
+/****
+ * EventCursor::EventCursor
+ *
+ * ARGS:
+ *     session - session the cursor reads through (not owned; must outlive it)
+ */
+EventCursor::EventCursor(EVENT_SESSION *session)
+	: session(session), hResults(NULL), filtered(FALSE), filterLowRecord(0), subscribed(FALSE), waitMs(0), hBookmark(NULL), started(FALSE), lastRecordId(0), queries(0), status(ERROR_SUCCESS), pendingFirst(0), pendingCount(0)
+{
+}
+
+
+EventCursor::~EventCursor()
+{
+	Close();
+}
+
+
+/****
+ * EventCursor::Start
+ *
+ * DESC:
+ *     Opens the query the cursor reads from, replacing any earlier one
+ *
+ * ARGS:
+ *     logName - event log to open (NULL for the source's default)
+ *     query - XPath query to retrieve, or NULL for everything
+ *     debug - set to 0 (none) 1 (basic) or 2 (verbose)
+ *
+ * RETURNS:
+ *     TRUE if the query was opened, FALSE otherwise (see Status)
+ */
+BOOL EventCursor::Start(LPCWSTR logName, LPCWSTR query, INT debug)
+{
+	Close();
+
+	this->logName = logName != NULL ? logName : L"";
+	this->query = query != NULL ? query : L"";
+	filtered = FALSE;
+	lastRecordId = 0;
+	status = ERROR_SUCCESS;
+
+	hResults = Open(query, FALSE, debug);
+
+	if( hResults == NULL )
+		return FALSE;
+
+	started = TRUE;
+
+	return TRUE;
+}
+
+
+/****
+ * EventCursor::StartFiltered
+ *
+ * DESC:
+ *     Opens the query compiled from a filter, replacing any earlier one
+ *
+ * ARGS:
+ *     logName - event log to open (NULL for the source's default)
+ *     filter - the events to read (copied; NULL for everything)
+ *     debug - set to 0 (none) 1 (basic) or 2 (verbose)
+ *
+ * RETURNS:
+ *     TRUE if the query was opened, FALSE otherwise (see Status)
+ */
+BOOL EventCursor::StartFiltered(LPCWSTR logName, const EventFilter *filter, INT debug)
+{
+	Close();
+
+	this->logName = logName != NULL ? logName : L"";
+	this->filter = filter != NULL ? *filter : EventFilter();
+	filtered = TRUE;
+	filterLowRecord = this->filter.LowRecord();
+	lastRecordId = 0;
+	status = ERROR_SUCCESS;
+
+	this->filter.Compile(&query);
+
+	hResults = Open(query.empty() ? NULL : query.c_str(), FALSE, debug);
+
+	if( hResults == NULL )
+		return FALSE;
+
+	started = TRUE;
+
+	return TRUE;
+}
+
+
+/****
+ * EventCursor::Subscribe
+ *
+ * DESC:
+ *     Subscribes to the events a filter selects, replacing any earlier
+ *     query or subscription
+ *
+ * ARGS:
+ *     logName - event log to subscribe to
+ *     filter - the events to read (copied; NULL for everything)
+ *     bookmark - where an earlier subscription got to (see Bookmark), or
+ *                NULL (or empty) to start with the oldest record the
+ *                filter selects
+ *     waitMs - how long a Read that finds nothing new waits for events
+ *              (0 not to wait, INFINITE to wait for as long as it takes)
+ *     debug - set to 0 (none) 1 (basic) or 2 (verbose)
+ *
+ * RETURNS:
+ *     TRUE if the subscription was made, FALSE otherwise (see Status)
+ */
+BOOL EventCursor::Subscribe(LPCWSTR logName, const EventFilter *filter, LPCWSTR bookmark, DWORD waitMs, INT debug)
+{
+	Close();
+
+	this->logName = logName != NULL ? logName : L"";
+	this->filter = filter != NULL ? *filter : EventFilter();
+	this->waitMs = waitMs;
+	filtered = TRUE;
+	subscribed = TRUE;
+	filterLowRecord = this->filter.LowRecord();
+	lastRecordId = 0;
+	status = ERROR_SUCCESS;
+
+	if( bookmark != NULL && *bookmark == L'\0' )
+		bookmark = NULL;
+
+	hBookmark = session->source->CreateBookmark(bookmark);
+
+	if( hBookmark == NULL ) {
+		status = GetLastError();
+		fwprintf(stderr, L"[Error][EventCursor]: Could not read the bookmark, error %u\n", status);
+		return FALSE;
+	}
+
+	this->filter.Compile(&query);
+
+	hResults = Open(query.empty() ? NULL : query.c_str(), bookmark != NULL, debug);
+
+	if( hResults == NULL )
+		return FALSE;
+
+	started = TRUE;
+
+	return TRUE;
+}
+
+
+/****
+ * EventCursor::Read
+ *
+ * DESC:
+ *     Writes the next events of the log to a sink, in the same format as
+ *     ProcessResults
+ *
+ * ARGS:
+ *     maxEvents - most events to write (0 for CURSOR_BATCH_DEFAULT)
+ *     sink - where the records go
+ *     outputFormat - 0 for JSON, otherwise XML
+ *     mode - MODE_DEFAULT, plus MODE_RENDER_XML, MODE_EVENT_DATA and/or
+ *            MODE_IDENTITY
+ *     debug - set to 0 (none) 1 (basic) or 2 (verbose)
+ *
+ * RETURNS:
+ *     The number of events written. 0 means there is nothing new, or that
+ *     reading failed (see Status)
+ *
+ * REMARKS:
+ *     Events are fetched in-line, at most maxEvents at a time, so a call
+ *     never holds more handles than the caller asked for and nothing is
+ *     read ahead of the next poll.
+ *
+ *     When the sink refuses a record, the read stops and Status is
+ *     ERROR_MORE_DATA (or ERROR_INSUFFICIENT_BUFFER if not even the first
+ *     record was taken). That event and the rest of its batch are kept
+ *     and written first by the next call; LastRecordId is the last record
+ *     the sink took.
+ *
+ *     When the query runs dry before anything was written, it is closed
+ *     and Rearm queries once more for newer records. When something was
+ *     written already, that is left to the next call. A subscription is
+ *     never closed; when it runs dry before anything was written, the
+ *     call waits for more, for as long as the cursor's wait allows.
+ */
+DWORD EventCursor::Read(DWORD maxEvents, OutputSink *sink, INT outputFormat, INT mode, INT debug)
+{
+	std::chrono::steady_clock::time_point since = std::chrono::steady_clock::now();
+	DWORD written = 0;
+	BOOL rearmed = FALSE;
+	BOOL full = FALSE;
+
+	if( !started ) {
+		status = ERROR_INVALID_HANDLE;
+		return 0;
+	}
+
+	if( maxEvents == 0 )
+		maxEvents = CURSOR_BATCH_DEFAULT;
+
+	status = ERROR_SUCCESS;
+
+	// Lets ReadEventFields read the fields the filter checks
+	const EventFilter *sessionFilter = session->filter;
+
+	session->filter = filtered && filter.Residual() ? &filter : NULL;
+
+	while( written < maxEvents && !full )
+	{
+		// Events a full sink refused last time go first
+		if( pendingFirst == pendingCount )
+		{
+			if( hResults == NULL ) {
+				if( rearmed || !Rearm(debug) )
+					break;
+
+				rearmed = TRUE;
+			}
+
+			DWORD wanted = maxEvents - written < CURSOR_NEXT_MAX ? maxEvents - written : CURSOR_NEXT_MAX;
+			DWORD dwReturned = 0;
+
+			if( !session->source->Next(hResults, wanted, hEvents, INFINITE, &dwReturned) )
+			{
+				DWORD dwError = GetLastError();
+
+				if( dwError != ERROR_NO_MORE_ITEMS ) {
+					status = dwError;
+					fwprintf(stderr, L"[Error][EventCursor]: Failed to fetch next batch with following error: %u\n", dwError);
+					break;
+				}
+
+				// Everything delivered so far has been read
+				if( subscribed ) {
+					if( written > 0 || !Await(since, debug) )
+						break;
+
+					continue;
+				}
+
+				// Everything the query had has been read
+				session->source->Close(hResults);
+				hResults = NULL;
+
+				if( written > 0 || rearmed )
+					break;
+
+				continue;
+			}
+
+			pendingFirst = 0;
+			pendingCount = dwReturned;
+		}
+
+		while( pendingFirst < pendingCount && written < maxEvents )
+		{
+			EVT_HANDLE hEvent = hEvents[pendingFirst];
+			SYSTEM_FIELDS fields;
+
+			if( ReadEventFields(session, hEvent, &fields, mode, debug) )
+			{
+				// Already written by an earlier query
+				if( fields.recordIdValue <= lastRecordId )
+				{
+					if( debug >= DEBUG_L2 ) {
+						wprintf(L"[EventCursor]: Skipping record %ls, already read\n", fields.recordId);
+					}
+				}
+				// Selected by the query, but not by the filter
+				else if( session->filter != NULL && !session->filter->Matches(&fields) )
+				{
+					Advance(hEvent, fields.recordIdValue);
+				}
+				else
+				{
+					if( written == 0 && OUTPUT_FORMAT_HAS_HEADER(outputFormat) ) {
+						sink->Header(CSV_HEADER);
+					}
+
+					if( !WriteEventInfo(session, hEvent, &fields, sink, outputFormat, debug) ) {
+						full = TRUE;
+						break;
+					}
+
+					Advance(hEvent, fields.recordIdValue);
+					written++;
+				}
+			}
+			else
+			{
+				fwprintf(stderr, L"[EventCursor] Failed to render results with: %u\n", GetLastError());
+			}
+
+			session->source->Close(hEvent);
+			pendingFirst++;
+		}
+	}
+
+	session->filter = sessionFilter;
+
+	if( full ) {
+		status = written > 0 ? ERROR_MORE_DATA : ERROR_INSUFFICIENT_BUFFER;
+	}
+
+	if( debug >= DEBUG_L1 ) {
+		wprintf(L"[EventCursor]: Wrote %u events, last record is %llu\n", written, (unsigned long long)lastRecordId);
+	}
+
+	return written;
+}
+
+
+/****
+ * EventCursor::Bookmark
+ *
+ * DESC:
+ *     Writes out the bookmark of a subscription: the last event read, or
+ *     passed over by the filter
+ *
+ * RETURNS:
+ *     The bookmark's XML, valid until the next call, or NULL if the
+ *     cursor is not subscribed
+ */
+LPCWSTR EventCursor::Bookmark()
+{
+	DWORD dwBufferUsed = 0;
+	DWORD dwPropertyCount = 0;
+
+	if( hBookmark == NULL ) {
+		SetLastError(ERROR_INVALID_HANDLE);
+		return NULL;
+	}
+
+	if( session->source->Render(NULL, hBookmark, EvtRenderBookmark, bookmarkText.Size(), bookmarkText.Data(), &dwBufferUsed, &dwPropertyCount) )
+		return (LPCWSTR)bookmarkText.Data();
+
+	if( GetLastError() != ERROR_INSUFFICIENT_BUFFER || !bookmarkText.Reserve(dwBufferUsed) )
+		return NULL;
+
+	if( session->source->Render(NULL, hBookmark, EvtRenderBookmark, bookmarkText.Size(), bookmarkText.Data(), &dwBufferUsed, &dwPropertyCount) )
+		return (LPCWSTR)bookmarkText.Data();
+
+	return NULL;
+}
+
+
+/****
+ * EventCursor::Close
+ *
+ * DESC:
+ *     Closes the query or subscription, its bookmark, and any events it
+ *     still held. The session is left open
+ */
+void EventCursor::Close()
+{
+	while( pendingFirst < pendingCount )
+		session->source->Close(hEvents[pendingFirst++]);
+
+	pendingFirst = pendingCount = 0;
+
+	if( hResults != NULL ) {
+		session->source->Close(hResults);
+		hResults = NULL;
+	}
+
+	if( hBookmark != NULL ) {
+		session->source->Close(hBookmark);
+		hBookmark = NULL;
+	}
+
+	subscribed = FALSE;
+	started = FALSE;
+}
+
+
+/****
+ * EventCursor::Open
+ *
+ * DESC:
+ *     Queries the cursor's log, oldest first, or subscribes to it
+ *
+ * ARGS:
+ *     query - XPath query to retrieve, or NULL for everything
+ *     afterBookmark - whether a subscription starts after the cursor's
+ *                     bookmark, rather than with the oldest record
+ *     debug - set to 0 (none) 1 (basic) or 2 (verbose)
+ *
+ * RETURNS:
+ *     The result set, or NULL if the query failed (the error is reported)
+ */
+EVT_HANDLE EventCursor::Open(LPCWSTR query, BOOL afterBookmark, INT debug)
+{
+	LPCWSTR log = logName.empty() ? NULL : logName.c_str();
+	EVT_HANDLE hQuery;
+
+	if( debug >= DEBUG_L1 ) {
+		wprintf(L"[EventCursor]: %ls '%ls' with: %ls\n", subscribed ? L"Subscribing to" : L"Querying", log != NULL ? log : L"", query != NULL ? query : L"(no query specified)");
+	}
+
+	queries++;
+
+	if( subscribed )
+		hQuery = session->source->Subscribe(log, query, afterBookmark ? hBookmark : NULL, afterBookmark ? EvtSubscribeStartAfterBookmark : EvtSubscribeStartAtOldestRecord);
+	else
+		hQuery = session->source->Query(log, query, EvtQueryChannelPath | EvtQueryForwardDirection);
+
+	if( hQuery == NULL )
+	{
+		status = GetLastError();
+
+		if( status == ERROR_EVT_CHANNEL_NOT_FOUND ) {
+			fwprintf(stderr, L"[Error][EventCursor]: Could not open the '%ls' log on this machine.\n", log != NULL ? log : L"");
+		} else if( status == ERROR_EVT_INVALID_QUERY ) {
+			fwprintf(stderr, L"[Error][EventCursor]: The specified search query is not valid.\n");
+		} else {
+			fwprintf(stderr, L"[Error][EventCursor]: Could not read event logs due to the following Windows error: %u.\n", status);
+		}
+	}
+
+	return hQuery;
+}
+
+
+/****
+ * EventCursor::Rearm
+ *
+ * DESC:
+ *     Queries again for the records written since the last one read
+ *
+ * RETURNS:
+ *     TRUE if the query was opened, FALSE otherwise (see Status)
+ *
+ * REMARKS:
+ *     The caller's query is narrowed to EventRecordID > the last record
+ *     ID. Only the shape the Perl module builds ("*[...]", or nothing) is
+ *     narrowed; anything else (e.g. a structured query) is run as it is
+ *     and the records already read are skipped by Read. A filter is
+ *     compiled again with its low record past the last record ID.
+ */
+BOOL EventCursor::Rearm(INT debug)
+{
+	WCHAR recordId[32];
+	size_t length = query.size();
+
+	if( filtered ) {
+		filter.SetLowRecord(lastRecordId >= filterLowRecord ? lastRecordId + 1 : filterLowRecord);
+		filter.Compile(&anchored);
+	} else if( lastRecordId == 0 ) {
+		anchored = query;
+	} else if( length == 0 ) {
+		FormatUnsigned(lastRecordId, recordId);
+		anchored = L"*[(System/EventRecordID > ";
+		anchored += recordId;
+		anchored += L")]";
+	} else if( length > 3 && query.compare(0, 2, L"*[") == 0 && query[length - 1] == L']' ) {
+		FormatUnsigned(lastRecordId, recordId);
+		anchored = L"*[(System/EventRecordID > ";
+		anchored += recordId;
+		anchored += L") and (";
+		anchored.append(query, 2, length - 3);
+		anchored += L")]";
+	} else {
+		anchored = query;
+	}
+
+	hResults = Open(anchored.empty() ? NULL : anchored.c_str(), FALSE, debug);
+
+	return hResults != NULL;
+}
+
+
+/****
+ * EventCursor::Await
+ *
+ * DESC:
+ *     Waits for the source to signal that the subscription has more
+ *
+ * ARGS:
+ *     since - when the Read started; it waits no longer than the
+ *             cursor's wait in all
+ *     debug - set to 0 (none) 1 (basic) or 2 (verbose)
+ *
+ * RETURNS:
+ *     TRUE if there may be more to read. FALSE once the wait is up, or if
+ *     waiting failed (see Status)
+ */
+BOOL EventCursor::Await(std::chrono::steady_clock::time_point since, INT debug)
+{
+	DWORD timeout = waitMs;
+
+	if( waitMs != INFINITE ) {
+		DWORD64 elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - since).count();
+
+		if( elapsed >= waitMs )
+			return FALSE;
+
+		timeout = (DWORD)(waitMs - elapsed);
+	}
+
+	if( session->source->WaitForEvents(hResults, timeout) )
+		return TRUE;
+
+	DWORD dwError = GetLastError();
+
+	if( dwError != ERROR_TIMEOUT ) {
+		status = dwError;
+		fwprintf(stderr, L"[Error][EventCursor]: Failed to wait for events with following error: %u\n", dwError);
+	} else if( debug >= DEBUG_L2 ) {
+		wprintf(L"[EventCursor]: No new events within %u ms\n", waitMs);
+	}
+
+	return FALSE;
+}
+
+
+/****
+ * EventCursor::Advance
+ *
+ * DESC:
+ *     Moves the cursor past an event it has read or passed over
+ */
+void EventCursor::Advance(EVT_HANDLE hEvent, DWORD64 recordId)
+{
+	lastRecordId = recordId;
+
+	if( hBookmark != NULL )
+		session->source->UpdateBookmark(hBookmark, hEvent);
+}
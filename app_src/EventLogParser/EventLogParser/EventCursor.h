@@ -0,0 +1,90 @@
+#pragma once
+
+#include "Platform.h"
+#include "ParserCore.h"
+#include <chrono>
+#include <string>
+
+// Events Read writes when the caller does not say how many
+#define CURSOR_BATCH_DEFAULT 100
+
+// Most event handles asked for in one Next call
+#define CURSOR_NEXT_MAX 256
+
+/****
+ * EventCursor
+ *
+ * DESC:
+ *     A query that stays open across polls. Each Read writes the next
+ *     events of the log, oldest first, to a sink and remembers where it
+ *     stopped
+ *
+ * REMARKS:
+ *     The cursor borrows the session, so publisher metadata and render
+ *     buffers are shared by everything read through it, and the query is
+ *     only set up once by Start.
+ *
+ *     Once the query has handed out everything it had, the next Read
+ *     queries again on the same session for records past the last one
+ *     seen (see Rearm). Records at or below the last record ID are
+ *     skipped, so nothing is written twice even by a source that ignores
+ *     the XPath query. A log that is cleared starts its record IDs over;
+ *     the cursor then has to be started again.
+ *
+ *     A cursor started with StartFiltered keeps its own copy of the
+ *     filter. Each query is compiled from it, with the low record moved
+ *     past the last one read, and records the query selects that the
+ *     filter does not are skipped (they still move LastRecordId on).
+ *
+ *     A cursor started with Subscribe reads a subscription instead, which
+ *     the source keeps feeding as events are written, so it never
+ *     queries again. A Read that finds nothing new waits (up to the
+ *     cursor's wait) for the source to signal more. Every event read,
+ *     or passed over by the filter, moves the cursor's bookmark on;
+ *     Bookmark writes it out, to subscribe again from later.
+ */
+class EventCursor {
+public:
+	EventCursor(EVENT_SESSION *session);
+	~EventCursor();
+
+	BOOL Start(LPCWSTR logName, LPCWSTR query, INT debug);
+	BOOL StartFiltered(LPCWSTR logName, const EventFilter *filter, INT debug);
+	BOOL Subscribe(LPCWSTR logName, const EventFilter *filter, LPCWSTR bookmark, DWORD waitMs, INT debug);
+	DWORD Read(DWORD maxEvents, OutputSink *sink, INT outputFormat, INT mode, INT debug);
+	void Close();
+
+	DWORD64 LastRecordId() const { return lastRecordId; }
+	DWORD Status() const { return status; }
+	DWORD64 Queries() const { return queries; }
+	LPCWSTR Bookmark();
+
+private:
+	EventCursor(const EventCursor &);
+	EventCursor &operator=(const EventCursor &);
+
+	EVT_HANDLE Open(LPCWSTR query, BOOL afterBookmark, INT debug);
+	BOOL Rearm(INT debug);
+	BOOL Await(std::chrono::steady_clock::time_point since, INT debug);
+	void Advance(EVT_HANDLE hEvent, DWORD64 recordId);
+
+	EVENT_SESSION *session;
+	EVT_HANDLE hResults;
+	std::wstring logName;
+	std::wstring query;
+	std::wstring anchored;
+	EventFilter filter;
+	BOOL filtered;
+	DWORD64 filterLowRecord;
+	BOOL subscribed;
+	DWORD waitMs;
+	EVT_HANDLE hBookmark;
+	GrowBuffer bookmarkText;
+	BOOL started;
+	DWORD64 lastRecordId;
+	DWORD64 queries;
+	DWORD status;
+	EVT_HANDLE hEvents[CURSOR_NEXT_MAX];
+	DWORD pendingFirst;
+	DWORD pendingCount;
+};
@@ -0,0 +1,195 @@
+#include "EventData.h"
+#include "SystemFields.h"
+#include <string.h>
+#include <wctype.h>
+
+/****
+ * EventDataSelection::Select
+ *
+ * DESC:
+ *     Sets which fields are wanted
+ *
+ * ARGS:
+ *     names - names separated by EVENT_DATA_SEPARATOR, e.g.
+ *             L"TargetUserName,TargetDomainName". NULL, an empty string or
+ *             EVENT_DATA_ALL selects every field
+ *
+ * REMARKS:
+ *     Blanks around each name are ignored, as are empty names and names
+ *     given twice
+ */
+void EventDataSelection::Select(LPCWSTR names)
+{
+	this->names.clear();
+	all = names == NULL || names[0] == L'\0' || wcscmp(names, EVENT_DATA_ALL) == 0;
+
+	if( all )
+		return;
+
+	LPCWSTR start = names;
+
+	while( TRUE )
+	{
+		LPCWSTR end = wcschr(start, EVENT_DATA_SEPARATOR);
+
+		if( end == NULL )
+			end = start + wcslen(start);
+
+		LPCWSTR last = end;
+
+		while( start < last && iswspace(*start) )
+			start++;
+		while( last > start && iswspace(last[-1]) )
+			last--;
+
+		if( last > start && !Wants(start, last - start) )
+			this->names.push_back(std::wstring(start, last - start));
+
+		if( *end == L'\0' )
+			break;
+
+		start = end + 1;
+	}
+
+	// Nothing but separators and blanks
+	all = this->names.empty();
+}
+
+
+BOOL EventDataSelection::Wants(LPCWSTR name, size_t length) const
+{
+	if( all )
+		return TRUE;
+
+	for( size_t i = 0; i < names.size(); i++ )
+	{
+		if( names[i].size() == length && memcmp(names[i].c_str(), name, length * sizeof(WCHAR)) == 0 )
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+
+BOOL EventDataSelection::Wants(DWORD position) const
+{
+	WCHAR text[24];
+
+	if( all )
+		return TRUE;
+
+	FormatUnsigned(position, text);
+
+	return Wants(text, wcslen(text));
+}
+
+
+// The attribute with the given name, or NULL
+static rapidxml::xml_attribute<WCHAR> *FindAttribute(rapidxml::xml_node<WCHAR> *node, LPCWSTR name, size_t length)
+{
+	for( rapidxml::xml_attribute<WCHAR> *attribute = node->first_attribute(); attribute != NULL; attribute = attribute->next_attribute() )
+	{
+		if( attribute->name_size() == length && memcmp(attribute->name(), name, length * sizeof(WCHAR)) == 0 )
+			return attribute;
+	}
+
+	return NULL;
+}
+
+
+/****
+ * ExtractEventData
+ *
+ * DESC:
+ *     Reads the EventData fields out of an event that was rendered as XML
+ *
+ * ARGS:
+ *     doc - The parsed event (all of it, not just <System>)
+ *     selection - which fields to keep
+ *     fields - Receives the fields (pointing into the document), in the
+ *              order the event has them
+ *
+ * RETURNS:
+ *     TRUE on success, FALSE if there is no <Event> at all (with
+ *     ERROR_INVALID_DATA). An event without EventData has no fields
+ *
+ * REMARKS:
+ *     Each <Data> of <EventData> is one field, named by its Name attribute.
+ *     Events that log <UserData> instead have their fields as the children
+ *     of its one element, named by element name.
+ *
+ *     The vector is cleared rather than freed, so once it has grown to
+ *     the largest event seen, extracting does not allocate
+ */
+BOOL ExtractEventData(rapidxml::xml_document<WCHAR> *doc, const EventDataSelection *selection, std::vector<EVENT_DATA_FIELD> *fields)
+{
+	rapidxml::xml_node<WCHAR> *nodeEvent = doc->first_node(L"Event");
+
+	fields->clear();
+
+	if( nodeEvent == NULL ) {
+		SetLastError(ERROR_INVALID_DATA);
+		return FALSE;
+	}
+
+	// A selection is done once every name in it has been found
+	size_t wanted = selection->All() ? (size_t)-1 : selection->Count();
+	EVENT_DATA_FIELD field;
+
+	rapidxml::xml_node<WCHAR> *nodeData = nodeEvent->first_node(L"EventData");
+
+	if( nodeData != NULL )
+	{
+		field.position = 0;
+
+		for( rapidxml::xml_node<WCHAR> *node = nodeData->first_node(); node != NULL && fields->size() < wanted; node = node->next_sibling() )
+		{
+			// <Binary> and the like are not fields
+			if( node->name_size() != 4 || memcmp(node->name(), L"Data", 4 * sizeof(WCHAR)) != 0 )
+				continue;
+
+			rapidxml::xml_attribute<WCHAR> *name = FindAttribute(node, L"Name", 4);
+
+			if( name != NULL && name->value_size() == 0 )
+				name = NULL;
+
+			field.position++;
+
+			if( name != NULL ? !selection->Wants(name->value(), name->value_size()) : !selection->Wants(field.position) )
+				continue;
+
+			field.name = name != NULL ? name->value() : NULL;
+			field.value = node->value();
+
+			fields->push_back(field);
+		}
+
+		return TRUE;
+	}
+
+	nodeData = nodeEvent->first_node(L"UserData");
+
+	// The element inside <UserData> is named after the event type
+	rapidxml::xml_node<WCHAR> *nodeUser = nodeData != NULL ? nodeData->first_node() : NULL;
+
+	while( nodeUser != NULL && nodeUser->type() != rapidxml::node_element )
+		nodeUser = nodeUser->next_sibling();
+
+	if( nodeUser != NULL )
+	{
+		field.position = 0;
+
+		for( rapidxml::xml_node<WCHAR> *node = nodeUser->first_node(); node != NULL && fields->size() < wanted; node = node->next_sibling() )
+		{
+			if( node->type() != rapidxml::node_element || !selection->Wants(node->name(), node->name_size()) )
+				continue;
+
+			field.name = node->name();
+			field.value = node->value();
+
+			fields->push_back(field);
+		}
+	}
+
+	return TRUE;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "Platform.h"
+#include "RenderContext.h"
+#include <string>
+#include <vector>
+
+// Separates the names given to EventDataSelection::Select
+#define EVENT_DATA_SEPARATOR L','
+
+// Selects every field
+#define EVENT_DATA_ALL L"*"
+
+// One field of an event's <EventData> (or <UserData>). Unnamed <Data>
+// elements have a NULL name and go by their position, counting from 1.
+// Pointers are only valid until the next event is parsed in the same
+// RenderContext
+struct EVENT_DATA_FIELD {
+	LPCWSTR name;
+	LPCWSTR value;
+	DWORD position;
+};
+
+/****
+ * EventDataSelection
+ *
+ * DESC:
+ *     The EventData fields a caller wants in its records, by name. Unnamed
+ *     fields are selected by their position ("1", "2", ...)
+ *
+ * REMARKS:
+ *     Starts out selecting every field. Lists are short (a handful of
+ *     names per event type), so Wants compares against each in turn
+ */
+class EventDataSelection {
+public:
+	EventDataSelection() : all(TRUE) {}
+
+	void Select(LPCWSTR names);
+	BOOL Wants(LPCWSTR name, size_t length) const;
+	BOOL Wants(DWORD position) const;
+
+	BOOL All() const { return all; }
+	size_t Count() const { return names.size(); }
+
+private:
+	BOOL all;
+	std::vector<std::wstring> names;
+};
+
+BOOL ExtractEventData(rapidxml::xml_document<WCHAR>*, const EventDataSelection*, std::vector<EVENT_DATA_FIELD>*);
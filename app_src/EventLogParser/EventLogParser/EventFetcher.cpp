@@ -0,0 +1,259 @@
+#include <chrono>
+#include "ParserCore.h"
+
+/****
+ * BatchSizer::BatchSizer
+ *
+ * ARGS:
+ *     initialSize - number of handles to request on the first call
+ *     targetMs - wall time we aim for per EvtNext call
+ */
+BatchSizer::BatchSizer(DWORD initialSize, DWORD targetMs)
+	: size(initialSize), targetMs(targetMs)
+{
+	if( size < BATCH_SIZE_MIN )
+		size = BATCH_SIZE_MIN;
+	if( size > BATCH_SIZE_MAX )
+		size = BATCH_SIZE_MAX;
+}
+
+
+/****
+ * BatchSizer::Update
+ *
+ * DESC:
+ *     Feeds back the outcome of one EvtNext call
+ *
+ * ARGS:
+ *     requested - number of handles asked for
+ *     returned - number of handles received
+ *     elapsedMs - time the call took
+ *
+ * RETURNS:
+ *     The batch size to request on the next call
+ */
+DWORD BatchSizer::Update(DWORD requested, DWORD returned, DWORD elapsedMs)
+{
+	if( elapsedMs > targetMs ) {
+		// Round trips are getting long. Back off so the consumer is not starved
+		size = size / 2 < BATCH_SIZE_MIN ? BATCH_SIZE_MIN : size / 2;
+	} else if( returned == requested && elapsedMs < targetMs / 2 ) {
+		// Plenty of headroom and the log still has more to give. Ask for more
+		size = size * 2 > BATCH_SIZE_MAX ? BATCH_SIZE_MAX : size * 2;
+	}
+
+	return size;
+}
+
+
+/****
+ * EventFetcher::EventFetcher
+ *
+ * ARGS:
+ *     source - Event source the result set belongs to
+ *     hResults - An open set of results (from Query)
+ *     debug - set to 0 (none) 1 (basic) or 2 (verbose)
+ *     limit - most handles to fetch in all (0 for every one there is)
+ */
+EventFetcher::EventFetcher(EventSource *source, EVT_HANDLE hResults, INT debug, DWORD limit)
+	: source(source), hResults(hResults), debug(debug), limit(limit), fetched(0), produceSlot(0), consumeSlot(0), finished(FALSE), stopping(FALSE), status(ERROR_SUCCESS)
+{
+	for( DWORD i = 0; i < BATCH_SLOTS; i++ ) {
+		slots[i].dwReturned = 0;
+		slots[i].dwRequested = 0;
+		slots[i].dwElapsedMs = 0;
+		slots[i].dwStatus = ERROR_SUCCESS;
+		filled[i] = FALSE;
+	}
+}
+
+
+EventFetcher::~EventFetcher()
+{
+	Stop();
+}
+
+
+/****
+ * EventFetcher::Start
+ *
+ * DESC:
+ *     Spawns the producer thread
+ *
+ * RETURNS:
+ *     TRUE if the thread is running, FALSE otherwise
+ */
+BOOL EventFetcher::Start()
+{
+	try {
+		producer = std::thread(&EventFetcher::Produce, this);
+	} catch( ... ) {
+		fwprintf(stderr, L"[Error][EventFetcher]: Could not start the fetch thread\n");
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+
+/****
+ * EventFetcher::NextBatch
+ *
+ * DESC:
+ *     Waits for the producer to hand over the next batch of events
+ *
+ * RETURNS:
+ *     The next batch, or NULL once there is nothing left to read
+ */
+EVENT_BATCH *EventFetcher::NextBatch()
+{
+	std::unique_lock<std::mutex> guard(lock);
+
+	changed.wait(guard, [this] { return filled[consumeSlot] != FALSE; });
+
+	EVENT_BATCH *batch = &slots[consumeSlot];
+
+	// The producer publishes an empty batch as its final one
+	if( batch->dwReturned == 0 )
+		return NULL;
+
+	if( debug >= DEBUG_L2 ) {
+		wprintf(L"[EventFetcher]: Received %u of %u events in %u ms\n", batch->dwReturned, batch->dwRequested, batch->dwElapsedMs);
+	}
+
+	return batch;
+}
+
+
+/****
+ * EventFetcher::ReleaseBatch
+ *
+ * DESC:
+ *     Hands a batch back to the producer so it can be refilled
+ *
+ * ARGS:
+ *     batch - batch previously returned by NextBatch
+ *
+ * REMARKS:
+ *     Handles that are still set in the batch are closed here
+ */
+void EventFetcher::ReleaseBatch(EVENT_BATCH *batch)
+{
+	for( DWORD i = 0; i < batch->dwReturned; i++ ) {
+		if( batch->hEvents[i] != NULL ) {
+			source->Close(batch->hEvents[i]);
+			batch->hEvents[i] = NULL;
+		}
+	}
+	batch->dwReturned = 0;
+
+	std::lock_guard<std::mutex> guard(lock);
+
+	filled[consumeSlot] = FALSE;
+	consumeSlot = (consumeSlot + 1) % BATCH_SLOTS;
+	changed.notify_all();
+}
+
+
+/****
+ * EventFetcher::Stop
+ *
+ * DESC:
+ *     Stops the producer and closes any handles that were never consumed
+ *
+ * REMARKS:
+ *     If the producer is inside Next this waits for that call to return
+ */
+void EventFetcher::Stop()
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stopping = TRUE;
+		changed.notify_all();
+	}
+
+	if( producer.joinable() )
+		producer.join();
+
+	for( DWORD i = 0; i < BATCH_SLOTS; i++ ) {
+		if( filled[i] ) {
+			for( DWORD j = 0; j < slots[i].dwReturned; j++ ) {
+				if( slots[i].hEvents[j] != NULL ) {
+					source->Close(slots[i].hEvents[j]);
+					slots[i].hEvents[j] = NULL;
+				}
+			}
+			slots[i].dwReturned = 0;
+		}
+	}
+}
+
+
+/****
+ * EventFetcher::Produce
+ *
+ * DESC:
+ *     Body of the producer thread. Keeps the free slots filled with
+ *     Next results until the result set runs dry
+ */
+void EventFetcher::Produce()
+{
+	while( TRUE ) {
+		EVENT_BATCH *batch;
+
+		{
+			std::unique_lock<std::mutex> guard(lock);
+
+			changed.wait(guard, [this] { return stopping || !filled[produceSlot]; });
+
+			if( stopping )
+				return;
+
+			batch = &slots[produceSlot];
+		}
+
+		DWORD requested = sizer.Size();
+
+		if( limit != 0 && limit - fetched < requested )
+			requested = limit - fetched;
+
+		std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+
+		// Past the limit, the stream ends without asking for more
+		BOOL ok = requested > 0 ? source->Next(hResults, requested, batch->hEvents, INFINITE, &batch->dwReturned) : TRUE;
+
+		if( requested == 0 )
+			batch->dwReturned = 0;
+
+		batch->dwRequested = requested;
+		batch->dwElapsedMs = (DWORD)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started).count();
+
+		if( ok && batch->dwReturned > 0 ) {
+			batch->dwStatus = ERROR_SUCCESS;
+			fetched += batch->dwReturned;
+			sizer.Update(requested, batch->dwReturned, batch->dwElapsedMs);
+		} else if( requested == 0 ) {
+			batch->dwStatus = ERROR_MORE_DATA;
+		} else {
+			// Either the log is exhausted (ERROR_NO_MORE_ITEMS) or the call failed.
+			// Both end the stream, as retrying a failed RPC would loop forever
+			batch->dwStatus = ok ? ERROR_NO_MORE_ITEMS : GetLastError();
+			batch->dwReturned = 0;
+		}
+
+		std::lock_guard<std::mutex> guard(lock);
+
+		filled[produceSlot] = TRUE;
+		produceSlot = (produceSlot + 1) % BATCH_SLOTS;
+
+		if( batch->dwReturned == 0 ) {
+			finished = TRUE;
+			status = batch->dwStatus;
+		}
+
+		changed.notify_all();
+
+		if( finished )
+			return;
+	}
+}
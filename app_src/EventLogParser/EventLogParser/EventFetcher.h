@@ -0,0 +1,106 @@
+#pragma once
+
+#include "Platform.h"
+#include "EventSource.h"
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+// Bounds on the number of event handles requested per EvtNext call
+#define BATCH_SIZE_MIN 16
+#define BATCH_SIZE_INITIAL 128
+#define BATCH_SIZE_MAX 512
+
+// Wall time we aim for per EvtNext round trip. Faster batches grow, slower ones shrink
+#define BATCH_TARGET_MS 250
+
+// Number of batches in flight between the producer and the consumer (double buffering)
+#define BATCH_SLOTS 2
+
+// A block of event handles fetched by a single Next call
+struct EVENT_BATCH {
+	EVT_HANDLE hEvents[BATCH_SIZE_MAX];
+	DWORD dwReturned;
+	DWORD dwRequested;
+	DWORD dwElapsedMs;
+	DWORD dwStatus;
+};
+
+/****
+ * BatchSizer
+ *
+ * DESC:
+ *     Picks the number of handles to request on the next Next call,
+ *     based on how long the previous call took
+ *
+ * REMARKS:
+ *     A full batch that came back well under BATCH_TARGET_MS doubles the
+ *     size, one that took longer than the target halves it. Anything in
+ *     between leaves the size alone. Short batches (end of the log) never
+ *     grow the size, as they tell us nothing about the round trip cost.
+ */
+class BatchSizer {
+public:
+	BatchSizer(DWORD initialSize = BATCH_SIZE_INITIAL, DWORD targetMs = BATCH_TARGET_MS);
+
+	DWORD Size() const { return size; }
+	DWORD Update(DWORD requested, DWORD returned, DWORD elapsedMs);
+
+private:
+	DWORD size;
+	DWORD targetMs;
+};
+
+/****
+ * EventFetcher
+ *
+ * DESC:
+ *     Reads an open result set on a background thread, so the next batch
+ *     is being fetched while the current one is rendered and printed
+ *
+ * REMARKS:
+ *     The producer fills one of BATCH_SLOTS batches and hands it over to
+ *     the consumer, which must give it back through ReleaseBatch. Any
+ *     handle left in a batch at that point is closed for the caller.
+ *
+ *     NextBatch returns NULL once the result set is exhausted or Next
+ *     failed; Status then holds ERROR_NO_MORE_ITEMS or the failing code.
+ *     Given a limit, it stops there too, with ERROR_MORE_DATA, so nothing
+ *     past what the consumer can take is fetched.
+ */
+class EventFetcher {
+public:
+	EventFetcher(EventSource *source, EVT_HANDLE hResults, INT debug, DWORD limit = 0);
+	~EventFetcher();
+
+	BOOL Start();
+	EVENT_BATCH *NextBatch();
+	void ReleaseBatch(EVENT_BATCH *batch);
+	void Stop();
+
+	DWORD Status() const { return status; }
+
+private:
+	void Produce();
+
+	EventSource *source;
+	EVT_HANDLE hResults;
+	INT debug;
+	BatchSizer sizer;
+
+	// Most handles to fetch (0 for no limit), and how many have been
+	DWORD limit;
+	DWORD fetched;
+
+	EVENT_BATCH slots[BATCH_SLOTS];
+	BOOL filled[BATCH_SLOTS];
+	DWORD produceSlot;
+	DWORD consumeSlot;
+	BOOL finished;
+	BOOL stopping;
+	DWORD status;
+
+	std::mutex lock;
+	std::condition_variable changed;
+	std::thread producer;
+};
@@ -0,0 +1,552 @@
+#include "EventFilter.h"
+#include <algorithm>
+#include <string.h>
+#include <wctype.h>
+
+// Drops the blanks at either end of start..end
+static void TrimBlanks(LPCWSTR *start, LPCWSTR *end)
+{
+	while( *start < *end && iswspace(**start) )
+		(*start)++;
+	while( *end > *start && iswspace((*end)[-1]) )
+		(*end)--;
+}
+
+
+/****
+ * ReadNumber
+ *
+ * DESC:
+ *     Reads a whole number, decimal or 0x hexadecimal, that fills all of
+ *     start..end
+ *
+ * RETURNS:
+ *     TRUE if it is one (that fits 64 bits)
+ */
+static BOOL ReadNumber(LPCWSTR start, LPCWSTR end, DWORD64 *value)
+{
+	DWORD base = 10;
+
+	TrimBlanks(&start, &end);
+
+	if( end - start > 2 && start[0] == L'0' && (start[1] == L'x' || start[1] == L'X') ) {
+		base = 16;
+		start += 2;
+	}
+
+	if( start == end )
+		return FALSE;
+
+	*value = 0;
+
+	for( ; start < end; start++ ) {
+		DWORD digit;
+
+		if( *start >= L'0' && *start <= L'9' )
+			digit = *start - L'0';
+		else if( base == 16 && towlower(*start) >= L'a' && towlower(*start) <= L'f' )
+			digit = towlower(*start) - L'a' + 10;
+		else
+			return FALSE;
+
+		if( *value > (~0ULL - digit) / base )
+			return FALSE;
+
+		*value = *value * base + digit;
+	}
+
+	return TRUE;
+}
+
+
+EventFilter::EventFilter()
+{
+	Clear();
+}
+
+
+void EventFilter::Clear()
+{
+	lowRecord = 0;
+	highRecord = 0;
+	eventIds.clear();
+	levels.clear();
+	keywords = 0;
+	providers.clear();
+	residualEvents = FALSE;
+	residualProviders = FALSE;
+}
+
+
+BOOL EventFilter::Empty() const
+{
+	return lowRecord == 0 && highRecord == 0 && eventIds.empty() && levels.empty() && keywords == 0 && providers.empty();
+}
+
+
+/****
+ * EventFilter::Parse
+ *
+ * DESC:
+ *     Reads a filter from text (see EventFilter)
+ *
+ * ARGS:
+ *     text - the clauses, e.g. L"records=1200-;events=4624,4634". NULL
+ *            or an empty string for a filter that selects everything
+ *
+ * RETURNS:
+ *     TRUE, or FALSE if a clause is not understood (with
+ *     ERROR_INVALID_PARAMETER, and the filter left empty)
+ *
+ * REMARKS:
+ *     Blanks around names, values and list items are ignored. A clause
+ *     given twice adds to the first, except records, which replaces it
+ */
+BOOL EventFilter::Parse(LPCWSTR text)
+{
+	Clear();
+
+	LPCWSTR start = text != NULL ? text : L"";
+
+	while( *start != L'\0' )
+	{
+		LPCWSTR end = wcschr(start, EVENT_FILTER_CLAUSE_SEPARATOR);
+
+		if( end == NULL )
+			end = start + wcslen(start);
+
+		LPCWSTR last = end;
+
+		TrimBlanks(&start, &last);
+
+		if( last > start )
+		{
+			LPCWSTR equals = start;
+
+			while( equals < last && *equals != L'=' )
+				equals++;
+
+			LPCWSTR name = start, nameEnd = equals, value = equals + 1, valueEnd = last;
+			BOOL ok = equals < last;
+
+			TrimBlanks(&name, &nameEnd);
+			TrimBlanks(&value, &valueEnd);
+
+			size_t nameLength = nameEnd - name;
+			size_t valueLength = valueEnd > value ? valueEnd - value : 0;
+
+			if( !ok ) {
+				// Not a clause at all
+			} else if( nameLength == 7 && memcmp(name, L"records", 7 * sizeof(WCHAR)) == 0 ) {
+				LPCWSTR dash = value;
+
+				while( dash < valueEnd && *dash != EVENT_FILTER_RANGE_SEPARATOR )
+					dash++;
+
+				lowRecord = highRecord = 0;
+
+				if( dash == valueEnd ) {
+					ok = ReadNumber(value, valueEnd, &lowRecord);
+					highRecord = lowRecord;
+				} else {
+					LPCWSTR lowEnd = dash, highStart = dash + 1;
+
+					TrimBlanks(&value, &lowEnd);
+					TrimBlanks(&highStart, &valueEnd);
+
+					ok = (lowEnd == value || ReadNumber(value, lowEnd, &lowRecord))
+						&& (highStart == valueEnd || ReadNumber(highStart, valueEnd, &highRecord))
+						&& (highRecord == 0 || lowRecord <= highRecord);
+				}
+			} else if( nameLength == 6 && memcmp(name, L"events", 6 * sizeof(WCHAR)) == 0 ) {
+				ok = ParseRanges(value, valueLength, 0xFFFF, &eventIds);
+			} else if( nameLength == 6 && memcmp(name, L"levels", 6 * sizeof(WCHAR)) == 0 ) {
+				ok = ParseRanges(value, valueLength, EVENT_FILTER_MAX_LEVEL, &levels);
+			} else if( nameLength == 8 && memcmp(name, L"keywords", 8 * sizeof(WCHAR)) == 0 ) {
+				DWORD64 mask = 0;
+
+				ok = ReadNumber(value, valueEnd, &mask) && mask != 0;
+				keywords |= mask;
+			} else if( nameLength == 9 && memcmp(name, L"providers", 9 * sizeof(WCHAR)) == 0 ) {
+				LPCWSTR item = value;
+
+				while( item < valueEnd )
+				{
+					LPCWSTR itemEnd = item;
+
+					while( itemEnd < valueEnd && *itemEnd != EVENT_FILTER_LIST_SEPARATOR )
+						itemEnd++;
+
+					LPCWSTR next = itemEnd < valueEnd ? itemEnd + 1 : itemEnd;
+
+					TrimBlanks(&item, &itemEnd);
+
+					if( itemEnd > item ) {
+						std::wstring provider(item, itemEnd - item);
+
+						if( std::find(providers.begin(), providers.end(), provider) == providers.end() )
+							providers.push_back(provider);
+					}
+
+					item = next;
+				}
+			} else {
+				ok = FALSE;
+			}
+
+			if( !ok ) {
+				Clear();
+				SetLastError(ERROR_INVALID_PARAMETER);
+				return FALSE;
+			}
+		}
+
+		start = *end == L'\0' ? end : end + 1;
+	}
+
+	return TRUE;
+}
+
+
+/****
+ * EventFilter::ParseRanges
+ *
+ * DESC:
+ *     Reads a list of numbers and first-last ranges, and adds them to a
+ *     set of ranges (kept sorted and merged)
+ *
+ * ARGS:
+ *     text, length - the list
+ *     max - the highest number allowed
+ *     ranges - the set to add to
+ *
+ * RETURNS:
+ *     TRUE, or FALSE if an item is not a number or range up to max
+ */
+BOOL EventFilter::ParseRanges(LPCWSTR text, size_t length, DWORD max, std::vector<RANGE> *ranges)
+{
+	LPCWSTR item = text, end = text + length;
+
+	while( item < end )
+	{
+		LPCWSTR itemEnd = item;
+
+		while( itemEnd < end && *itemEnd != EVENT_FILTER_LIST_SEPARATOR )
+			itemEnd++;
+
+		LPCWSTR next = itemEnd < end ? itemEnd + 1 : itemEnd;
+		LPCWSTR dash = item;
+
+		while( dash < itemEnd && *dash != EVENT_FILTER_RANGE_SEPARATOR )
+			dash++;
+
+		TrimBlanks(&item, &itemEnd);
+
+		if( itemEnd > item )
+		{
+			DWORD64 first, last;
+
+			if( dash >= itemEnd ) {
+				if( !ReadNumber(item, itemEnd, &first) )
+					return FALSE;
+				last = first;
+			} else if( !ReadNumber(item, dash, &first) || !ReadNumber(dash + 1, itemEnd, &last) ) {
+				return FALSE;
+			}
+
+			if( first > last || last > max )
+				return FALSE;
+
+			RANGE range = { (DWORD)first, (DWORD)last };
+
+			ranges->push_back(range);
+		}
+
+		item = next;
+	}
+
+	MergeRanges(ranges);
+
+	return TRUE;
+}
+
+
+// Sorts a set of ranges and joins the ones that overlap or touch
+void EventFilter::MergeRanges(std::vector<RANGE> *ranges)
+{
+	std::sort(ranges->begin(), ranges->end(), [](const RANGE &a, const RANGE &b) { return a.first < b.first; });
+
+	size_t kept = 0;
+
+	for( size_t i = 0; i < ranges->size(); i++ )
+	{
+		RANGE &range = (*ranges)[i];
+
+		if( kept > 0 && (DWORD64)range.first <= (DWORD64)(*ranges)[kept - 1].last + 1 ) {
+			if( range.last > (*ranges)[kept - 1].last )
+				(*ranges)[kept - 1].last = range.last;
+		} else {
+			(*ranges)[kept++] = range;
+		}
+	}
+
+	ranges->resize(kept);
+}
+
+
+// Comparisons AppendRanges makes for a set of ranges
+static DWORD RangeTerms(DWORD first, DWORD last)
+{
+	return first == last || first == 0 ? 1 : 2;
+}
+
+
+/****
+ * EventFilter::AppendRanges
+ *
+ * DESC:
+ *     Writes the XPath test for a set of ranges of one System field, e.g.
+ *     (EventID=4624 or (EventID >= 6272 and EventID <= 6279))
+ *
+ * REMARKS:
+ *     A single value is tested with =, a range with >= and <=, and a
+ *     range from 0 with <= alone
+ */
+void EventFilter::AppendRanges(std::wstring *xpath, LPCWSTR name, const std::vector<RANGE> &ranges)
+{
+	WCHAR first[24], last[24];
+
+	if( ranges.size() > 1 )
+		*xpath += L"(";
+
+	for( size_t i = 0; i < ranges.size(); i++ )
+	{
+		if( i > 0 )
+			*xpath += L" or ";
+
+		FormatUnsigned(ranges[i].first, first);
+		FormatUnsigned(ranges[i].last, last);
+
+		if( ranges[i].first == ranges[i].last ) {
+			*xpath += name;
+			*xpath += L"=";
+			*xpath += first;
+		} else if( ranges[i].first == 0 ) {
+			*xpath += name;
+			*xpath += L" <= ";
+			*xpath += last;
+		} else {
+			*xpath += L"(";
+			*xpath += name;
+			*xpath += L" >= ";
+			*xpath += first;
+			*xpath += L" and ";
+			*xpath += name;
+			*xpath += L" <= ";
+			*xpath += last;
+			*xpath += L")";
+		}
+	}
+
+	if( ranges.size() > 1 )
+		*xpath += L")";
+}
+
+
+BOOL EventFilter::InRanges(const std::vector<RANGE> &ranges, DWORD value)
+{
+	for( size_t i = 0; i < ranges.size(); i++ ) {
+		if( value >= ranges[i].first && value <= ranges[i].last )
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+
+/****
+ * EventFilter::Compile
+ *
+ * DESC:
+ *     Writes the XPath query for the filter, as *[System[...]]
+ *
+ * ARGS:
+ *     xpath - receives the query (empty if the filter selects everything)
+ *
+ * REMARKS:
+ *     Afterwards Residual says whether the query selects more than the
+ *     filter does, in which case each event read has to be checked with
+ *     Matches. Keywords are tested with band(), which is a single test
+ *     however many bits are set
+ */
+void EventFilter::Compile(std::wstring *xpath)
+{
+	std::wstring body;
+	WCHAR number[24];
+
+	residualEvents = FALSE;
+	residualProviders = FALSE;
+
+	for( size_t i = 0; i < providers.size(); i++ ) {
+		if( providers[i].find(L'\'') != std::wstring::npos && providers[i].find(L'"') != std::wstring::npos )
+			residualProviders = TRUE;
+	}
+
+	if( !providers.empty() && !residualProviders )
+	{
+		body += L"Provider[";
+
+		for( size_t i = 0; i < providers.size(); i++ )
+		{
+			LPCWSTR quote = providers[i].find(L'\'') != std::wstring::npos ? L"\"" : L"'";
+
+			if( i > 0 )
+				body += L" or ";
+
+			body += L"@Name=";
+			body += quote;
+			body += providers[i];
+			body += quote;
+		}
+
+		body += L"]";
+	}
+
+	if( !levels.empty() )
+	{
+		if( !body.empty() )
+			body += L" and ";
+
+		AppendRanges(&body, L"Level", levels);
+	}
+
+	if( !eventIds.empty() )
+	{
+		std::vector<RANGE> query = eventIds;
+		DWORD terms = 0;
+
+		for( size_t i = 0; i < query.size(); i++ )
+			terms += RangeTerms(query[i].first, query[i].last);
+
+		// Over budget, close the smallest gaps until it fits. Events in the
+		// gaps are then read, and dropped by Matches
+		while( terms > EVENT_FILTER_MAX_EVENT_TERMS && query.size() > 1 )
+		{
+			size_t closest = 0;
+
+			for( size_t i = 1; i + 1 < query.size(); i++ ) {
+				if( query[i + 1].first - query[i].last < query[closest + 1].first - query[closest].last )
+					closest = i;
+			}
+
+			terms -= RangeTerms(query[closest].first, query[closest].last) + RangeTerms(query[closest + 1].first, query[closest + 1].last);
+			query[closest].last = query[closest + 1].last;
+			query.erase(query.begin() + closest + 1);
+			terms += RangeTerms(query[closest].first, query[closest].last);
+
+			residualEvents = TRUE;
+		}
+
+		if( !body.empty() )
+			body += L" and ";
+
+		AppendRanges(&body, L"EventID", query);
+	}
+
+	if( keywords != 0 )
+	{
+		if( !body.empty() )
+			body += L" and ";
+
+		body += L"band(Keywords,";
+		body += FormatUnsigned(keywords, number);
+		body += L")";
+	}
+
+	if( lowRecord != 0 || highRecord != 0 )
+	{
+		if( !body.empty() )
+			body += L" and ";
+
+		if( lowRecord == highRecord ) {
+			body += L"EventRecordID=";
+			body += FormatUnsigned(lowRecord, number);
+		} else {
+			if( lowRecord != 0 ) {
+				body += L"EventRecordID >= ";
+				body += FormatUnsigned(lowRecord, number);
+			}
+			if( lowRecord != 0 && highRecord != 0 )
+				body += L" and ";
+			if( highRecord != 0 ) {
+				body += L"EventRecordID <= ";
+				body += FormatUnsigned(highRecord, number);
+			}
+		}
+	}
+
+	xpath->clear();
+
+	if( !body.empty() ) {
+		*xpath = L"*[System[";
+		*xpath += body;
+		*xpath += L"]]";
+	}
+}
+
+
+/****
+ * EventFilter::Wanted
+ *
+ * RETURNS:
+ *     The RECORD_FIELD_* flags of the fields Matches reads
+ */
+DWORD EventFilter::Wanted() const
+{
+	return (residualEvents ? RECORD_FIELD_EVENT_ID : 0) | (residualProviders ? RECORD_FIELD_SOURCE : 0);
+}
+
+
+/****
+ * EventFilter::Matches
+ *
+ * DESC:
+ *     Checks an event read with the compiled query against what that query
+ *     could not say (see Residual)
+ *
+ * ARGS:
+ *     fields - its System fields, with at least those Wanted names
+ *
+ * RETURNS:
+ *     TRUE if the filter selects the event
+ */
+BOOL EventFilter::Matches(const SYSTEM_FIELDS *fields) const
+{
+	if( residualEvents && !InRanges(eventIds, (DWORD)wcstoul(fields->eventId, NULL, 10)) )
+		return FALSE;
+
+	if( residualProviders && std::find(providers.begin(), providers.end(), std::wstring(fields->provider)) == providers.end() )
+		return FALSE;
+
+	return TRUE;
+}
+
+
+/****
+ * EventFilter::MatchesEvent
+ *
+ * DESC:
+ *     Checks an event against the whole filter, without any query
+ *
+ * RETURNS:
+ *     TRUE if the filter selects the event
+ */
+BOOL EventFilter::MatchesEvent(DWORD64 recordId, DWORD eventId, DWORD level, DWORD64 keywords, LPCWSTR provider) const
+{
+	return (lowRecord == 0 || recordId >= lowRecord)
+		&& (highRecord == 0 || recordId <= highRecord)
+		&& (eventIds.empty() || InRanges(eventIds, eventId))
+		&& (levels.empty() || InRanges(levels, level))
+		&& (this->keywords == 0 || (keywords & this->keywords) != 0)
+		&& (providers.empty() || std::find(providers.begin(), providers.end(), std::wstring(provider)) != providers.end());
+}
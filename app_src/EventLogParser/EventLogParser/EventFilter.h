@@ -0,0 +1,89 @@
+#pragma once
+
+#include "Platform.h"
+#include "SystemFields.h"
+#include <string>
+#include <vector>
+
+// Separates the clauses, the lists within them and the ends of a range in
+// what EventFilter::Parse reads
+#define EVENT_FILTER_CLAUSE_SEPARATOR L';'
+#define EVENT_FILTER_LIST_SEPARATOR L','
+#define EVENT_FILTER_RANGE_SEPARATOR L'-'
+
+// Most EventID comparisons a compiled query makes. The event log service
+// limits how many expressions one query may hold, and each one costs it
+// a test per record
+#define EVENT_FILTER_MAX_EVENT_TERMS 16
+
+// Highest level a filter can select
+#define EVENT_FILTER_MAX_LEVEL 31
+
+/****
+ * EventFilter
+ *
+ * DESC:
+ *     Which events a query wants, as structure rather than XPath: a
+ *     record ID range, a set of event IDs, a set of levels, keywords (any
+ *     of) and a list of providers. Compile turns it into the smallest
+ *     XPath query that selects them, and anything that query cannot say
+ *     is checked locally, on the fields of each event read (Matches)
+ *
+ * REMARKS:
+ *     Parse reads the filter from text, clauses separated by ';':
+ *
+ *         records=1200-       record IDs, as first-last, first- or -last
+ *         events=4624,4634,6272-6279
+ *         levels=1-3          0 LogAlways, 1 Critical, 2 Error, 3 Warning,
+ *                             4 Information, 5 Verbose
+ *         keywords=0x8010000000000000
+ *         providers=Microsoft-Windows-Security-Auditing,Service Control Manager
+ *
+ *     Contiguous event IDs and levels are merged into ranges. Past
+ *     EVENT_FILTER_MAX_EVENT_TERMS comparisons, the closest ranges are
+ *     merged as well, so the query selects more than was asked for and
+ *     the exact set is checked locally. So is a provider whose name has
+ *     both kinds of quote, which XPath has no way to write.
+ */
+class EventFilter {
+public:
+	EventFilter();
+
+	BOOL Parse(LPCWSTR text);
+	void Clear();
+	BOOL Empty() const;
+
+	void SetLowRecord(DWORD64 recordId) { lowRecord = recordId; }
+	DWORD64 LowRecord() const { return lowRecord; }
+	void SetHighRecord(DWORD64 recordId) { highRecord = recordId; }
+	DWORD64 HighRecord() const { return highRecord; }
+
+	void Compile(std::wstring *xpath);
+	BOOL Residual() const { return residualEvents || residualProviders; }
+	DWORD Wanted() const;
+	BOOL Matches(const SYSTEM_FIELDS *fields) const;
+	BOOL MatchesEvent(DWORD64 recordId, DWORD eventId, DWORD level, DWORD64 keywords, LPCWSTR provider) const;
+
+private:
+	// first..last, both included
+	struct RANGE {
+		DWORD first;
+		DWORD last;
+	};
+
+	static BOOL ParseRanges(LPCWSTR text, size_t length, DWORD max, std::vector<RANGE> *ranges);
+	static void MergeRanges(std::vector<RANGE> *ranges);
+	static void AppendRanges(std::wstring *xpath, LPCWSTR name, const std::vector<RANGE> &ranges);
+	static BOOL InRanges(const std::vector<RANGE> &ranges, DWORD value);
+
+	DWORD64 lowRecord;
+	DWORD64 highRecord;
+	std::vector<RANGE> eventIds;
+	std::vector<RANGE> levels;
+	DWORD64 keywords;
+	std::vector<std::wstring> providers;
+
+	// What the last compiled query left to Matches
+	BOOL residualEvents;
+	BOOL residualProviders;
+};
@@ -1,5 +1,6 @@
 #include <windows.h>
 #include <wchar.h>
+#include <time.h>
 #include "EventLogParser.h"
 
 /****
@@ -58,6 +59,1881 @@ extern "C" __declspec(dllexport) DWORD64 __stdcall ParseEventLog(LPWSTR server,
 }
 
 
+/****
+ * ParseEventLogFields
+ *
+ * DESC:
+ *     Displays event log information to STDOUT, as ParseEventLog does,
+ *     with only the fields asked for in each record
+ *
+ * ARGS:
+ *     server - IP or host to connect to
+ *     domain - domain within the host (empty string for none)
+ *     username - username within the domain
+ *     password - password for above user
+ *     logName - event log to open (default to "Application" if NULL)
+ *     query - XPath query to retrieve (see ParseEventLog)
+ *     fields - the record fields wanted, comma separated (e.g.
+ *              "record_id,event_id,time_created"). Empty, NULL or "*"
+ *              for all of them
+ *     debug - set to 0 (none) 1 (basic) or 2 (verbose)
+ *
+ * RETURNS:
+ *     As ParseEventLog, or 0 if a field name is not known
+ *
+ * REMARKS:
+ *     Work that only goes into fields that are not wanted is skipped:
+ *     without "message", the publisher metadata is not opened and no
+ *     message is formatted, which is most of the cost of an event
+ */
+extern "C" __declspec(dllexport) DWORD64 __stdcall ParseEventLogFields(LPWSTR server, LPWSTR domain, LPWSTR username, LPWSTR password, LPWSTR logName, LPWSTR query, LPWSTR fields, INT debug) 
+{
+	DWORD projection;
+
+	if( !ParseRecordFields(fields, &projection) ) {
+		fwprintf(stderr, L"[Error][ParseEventLogFields]: Unknown field in '%ls'\n", fields);
+		return 0;
+	}
+
+	return ParseEventLogInternal(server, domain, username, password, logName, query, OUTPUT_FORMAT_JSON, debug, MODE_DEFAULT, projection);
+}
+
+
+/****
+ * ParseEventLogFiltered
+ *
+ * DESC:
+ *     Displays event log information to STDOUT, as ParseEventLogFields
+ *     does, for the events a structured filter selects
+ *
+ * ARGS:
+ *     server - IP or host to connect to
+ *     domain - domain within the host (empty string for none)
+ *     username - username within the domain
+ *     password - password for above user
+ *     logName - event log to open (default to "Application" if NULL)
+ *     filter - the events wanted, as clauses separated by ';' (e.g.
+ *              "records=1200-;events=4624,4634,6272-6279"; see
+ *              EventFilter). Empty or NULL for everything
+ *     fields - the record fields wanted (see ParseEventLogFields)
+ *     debug - set to 0 (none) 1 (basic) or 2 (verbose)
+ *
+ * RETURNS:
+ *     As ParseEventLog, or 0 if the filter or a field name is not known
+ *
+ * REMARKS:
+ *     The filter is compiled into the XPath query, with ranges merged and
+ *     the number of comparisons bounded, rather than one comparison per
+ *     event ID
+ */
+extern "C" __declspec(dllexport) DWORD64 __stdcall ParseEventLogFiltered(LPWSTR server, LPWSTR domain, LPWSTR username, LPWSTR password, LPWSTR logName, LPWSTR filter, LPWSTR fields, INT debug) 
+{
+	EventFilter parsed;
+	DWORD projection;
+
+	if( !parsed.Parse(filter) ) {
+		fwprintf(stderr, L"[Error][ParseEventLogFiltered]: Could not read the filter '%ls'\n", filter);
+		return 0;
+	}
+
+	if( !ParseRecordFields(fields, &projection) ) {
+		fwprintf(stderr, L"[Error][ParseEventLogFiltered]: Unknown field in '%ls'\n", fields);
+		return 0;
+	}
+
+	return ParseEventLogInternal(server, domain, username, password, logName, NULL, OUTPUT_FORMAT_JSON, debug, MODE_DEFAULT, projection, &parsed);
+}
+
+
+/****
+ * ParseEventLogForward
+ *
+ * DESC:
+ *     Displays event log information to STDOUT, as ParseEventLogFiltered
+ *     does, oldest first, until a number of records or bytes of them has
+ *     been written
+ *
+ * ARGS:
+ *     server - IP or host to connect to
+ *     domain - domain within the host (empty string for none)
+ *     username - username within the domain
+ *     password - password for above user
+ *     logName - event log to open (default to "Application" if NULL)
+ *     filter - the events wanted (see ParseEventLogFiltered)
+ *     fields - the record fields wanted (see ParseEventLogFields)
+ *     maxEvents - most records to write (0 for no limit)
+ *     maxBytes - most bytes of records to write, counted as UTF-8 (0 for
+ *                no limit). The first record is written whatever its size
+ *     result - receives what was written, charsUsed in bytes (may be NULL)
+ *     debug - set to 0 (none) 1 (basic) or 2 (verbose)
+ *
+ * RETURNS:
+ *     The number of records written. result->status is ERROR_SUCCESS once
+ *     everything the filter selects has been written, ERROR_MORE_DATA if
+ *     the limits stopped it first, or the error that stopped the query
+ *
+ * REMARKS:
+ *     result->lastRecordId is the last record written, or passed over by
+ *     the filter. Running the filter again from the record after it picks
+ *     up exactly where this call stopped, so a log can be caught up with
+ *     in chunks without the caller looking at the record IDs itself
+ */
+extern "C" __declspec(dllexport) DWORD __stdcall ParseEventLogForward(LPWSTR server, LPWSTR domain, LPWSTR username, LPWSTR password, LPWSTR logName, LPWSTR filter, LPWSTR fields, DWORD maxEvents, DWORD maxBytes, READ_RESULT *result, INT debug) 
+{
+	EventFilter parsed;
+	DWORD projection;
+	DWORD64 status = ERROR_INVALID_PARAMETER;
+	DWORD64 lastRecordId = 0;
+	StdoutSink stdoutSink;
+	BudgetSink sink(&stdoutSink, maxEvents, maxBytes);
+
+	if( !parsed.Parse(filter) ) {
+		fwprintf(stderr, L"[Error][ParseEventLogForward]: Could not read the filter '%ls'\n", filter);
+	} else if( !ParseRecordFields(fields, &projection) ) {
+		fwprintf(stderr, L"[Error][ParseEventLogForward]: Unknown field in '%ls'\n", fields);
+	} else {
+		status = ParseEventLogInternal(server, domain, username, password, logName, NULL, OUTPUT_FORMAT_JSON, debug, MODE_FORWARD, projection, &parsed, &sink, &lastRecordId);
+
+		// Reading to the end of the results is the normal way out
+		if( status == ERROR_NO_MORE_ITEMS ) {
+			status = ERROR_SUCCESS;
+		} else if( status == 0 ) {
+			status = GetLastError() != ERROR_SUCCESS ? GetLastError() : ERROR_GEN_FAILURE;
+		}
+	}
+
+	if( result != NULL ) {
+		RtlZeroMemory(result, sizeof(READ_RESULT));
+
+		result->records = sink.Records();
+		result->charsUsed = (DWORD)sink.Used();
+		result->status = (DWORD)status;
+		result->lastRecordId = lastRecordId;
+	}
+
+	return sink.Records();
+}
+
+
+/****
+ * OpenSession
+ *
+ * DESC:
+ *     Opens a session to a remote machine that can be used for any
+ *     number of queries and polls (see StartSession)
+ *
+ * ARGS:
+ *     server - IP or host to connect to
+ *     domain - domain within the host (empty string for none)
+ *     username - username within the domain
+ *     password - password for above user
+ *     debug - set to 0 (none) 1 (basic) or 2 (verbose)
+ *
+ * RETURNS:
+ *     A session handle (close with CloseEventHandle), or NULL on failure
+ *
+ * REMARKS:
+ *     Publisher metadata and render buffers belong to the session, so they
+ *     are set up once rather than on every poll
+ */
+extern "C" __declspec(dllexport) PARSER_SESSION * __stdcall OpenSession(LPWSTR server, LPWSTR domain, LPWSTR username, LPWSTR password, INT debug)
+{
+	if( debug >= DEBUG_L1 ) {
+		wprintf(L"[OpenSession]: Attempting to connect to '%ls'...\n", server);
+	}
+
+	PARSER_SESSION *handle = new PARSER_SESSION();
+
+	// Kept for the sessions a catch-up opens to the same host
+	handle->server = server != NULL ? server : L"";
+	handle->domain = domain != NULL ? domain : L"";
+	handle->username = username != NULL ? username : L"";
+	handle->password = password != NULL ? password : L"";
+
+	// Official MSDN specs request NULL instead of an empty string
+	if( domain != NULL && wcslen(domain) == 0 )
+		domain = NULL;
+
+	EVT_HANDLE hRemote = CreateRemoteSession(server, domain, username, password);
+
+	if( hRemote == NULL ) {
+		fwprintf(stderr, L"[Error][OpenSession]: Failed to connect to remote computer. Error code is %u.\n", GetLastError());
+		SecureZeroMemory(&handle->password[0], handle->password.size() * sizeof(WCHAR));
+		delete handle;
+		return NULL;
+	}
+
+	handle->kind = PARSER_HANDLE_SESSION;
+	handle->hRemote = hRemote;
+	handle->source = new WinEvtSource(hRemote);
+	handle->session = new EVENT_SESSION(handle->source);
+	handle->mode = MODE_DEFAULT;
+	handle->cursors = 0;
+	handle->closed = FALSE;
+
+	return handle;
+}
+
+
+/****
+ * StartSession
+ *
+ * DESC:
+ *     Opens a query on a session. The query stays open, and each call to
+ *     ReadNextEvent reads on from where the previous one stopped
+ *
+ * ARGS:
+ *     handle - session from OpenSession
+ *     logName - event log to open (default to "Application" if NULL)
+ *     query - XPath query to retrieve (empty string for everything)
+ *     debug - set to 0 (none) 1 (basic) or 2 (verbose)
+ *
+ * RETURNS:
+ *     A cursor handle (close with CloseEventHandle), or NULL on failure
+ *
+ * REMARKS:
+ *     Events are read oldest first, starting with the oldest record the
+ *     query matches
+ */
+extern "C" __declspec(dllexport) PARSER_CURSOR * __stdcall StartSession(PARSER_SESSION *handle, LPWSTR logName, LPWSTR query, INT debug)
+{
+	if( handle == NULL || handle->kind != PARSER_HANDLE_SESSION || handle->closed ) {
+		fwprintf(stderr, L"[Error][StartSession]: Invalid session handle\n");
+		return NULL;
+	}
+
+	if( logName == NULL || wcslen(logName) == 0 )
+		logName = DEFAULT_LOG;
+
+	// If a blank query was supplied, assume no query (NULL)
+	if( query != NULL && wcslen(query) == 0 )
+		query = NULL;
+
+	PARSER_CURSOR *cursor = new PARSER_CURSOR();
+
+	cursor->kind = PARSER_HANDLE_CURSOR;
+	cursor->owner = handle;
+	cursor->cursor = new EventCursor(handle->session);
+
+	if( !cursor->cursor->Start(logName, query, debug) ) {
+		delete cursor->cursor;
+		delete cursor;
+		return NULL;
+	}
+
+	handle->cursors++;
+
+	return cursor;
+}
+
+
+/****
+ * StartFilteredSession
+ *
+ * DESC:
+ *     Opens a query on a session, as StartSession does, for the events a
+ *     structured filter selects
+ *
+ * ARGS:
+ *     handle - session from OpenSession
+ *     logName - event log to open (default to "Application" if NULL)
+ *     filter - the events wanted (see ParseEventLogFiltered). Empty or
+ *              NULL for everything
+ *     debug - set to 0 (none) 1 (basic) or 2 (verbose)
+ *
+ * RETURNS:
+ *     A cursor handle (close with CloseEventHandle), or NULL on failure
+ *
+ * REMARKS:
+ *     Each time the cursor queries again for newer events, the filter is
+ *     compiled again from the last record read, so the query stays as
+ *     narrow as it was
+ */
+extern "C" __declspec(dllexport) PARSER_CURSOR * __stdcall StartFilteredSession(PARSER_SESSION *handle, LPWSTR logName, LPWSTR filter, INT debug)
+{
+	EventFilter parsed;
+
+	if( handle == NULL || handle->kind != PARSER_HANDLE_SESSION || handle->closed ) {
+		fwprintf(stderr, L"[Error][StartFilteredSession]: Invalid session handle\n");
+		return NULL;
+	}
+
+	if( !parsed.Parse(filter) ) {
+		fwprintf(stderr, L"[Error][StartFilteredSession]: Could not read the filter '%ls'\n", filter);
+		return NULL;
+	}
+
+	if( logName == NULL || wcslen(logName) == 0 )
+		logName = DEFAULT_LOG;
+
+	PARSER_CURSOR *cursor = new PARSER_CURSOR();
+
+	cursor->kind = PARSER_HANDLE_CURSOR;
+	cursor->owner = handle;
+	cursor->cursor = new EventCursor(handle->session);
+
+	if( !cursor->cursor->StartFiltered(logName, &parsed, debug) ) {
+		delete cursor->cursor;
+		delete cursor;
+		return NULL;
+	}
+
+	handle->cursors++;
+
+	return cursor;
+}
+
+
+/****
+ * StartSubscription
+ *
+ * DESC:
+ *     Subscribes to the events a structured filter selects. Rather than
+ *     querying again for what is new, each read takes what the event log
+ *     service has pushed to the subscription since the last one
+ *
+ * ARGS:
+ *     handle - session from OpenSession
+ *     logName - event log to subscribe to (default to "Application" if
+ *               NULL)
+ *     filter - the events wanted (see ParseEventLogFiltered). Empty or
+ *              NULL for everything
+ *     bookmark - from GetCursorBookmark on an earlier subscription, to
+ *                carry on after the last event it read. Empty or NULL to
+ *                start with the oldest record the filter selects
+ *     waitMs - how long a read that finds nothing new waits for events
+ *              to arrive (0 not to wait)
+ *     debug - set to 0 (none) 1 (basic) or 2 (verbose)
+ *
+ * RETURNS:
+ *     A cursor handle (close with CloseEventHandle), or NULL on failure
+ *
+ * REMARKS:
+ *     The cursor is read with ReadNextEvent, ReadEventsToBuffer,
+ *     ReadEventsToUtf8Buffer or ReadEventsToCallback, like one from
+ *     StartSession. Keep the bookmark between runs rather than the last
+ *     record ID
+ */
+extern "C" __declspec(dllexport) PARSER_CURSOR * __stdcall StartSubscription(PARSER_SESSION *handle, LPWSTR logName, LPWSTR filter, LPWSTR bookmark, DWORD waitMs, INT debug)
+{
+	EventFilter parsed;
+
+	if( handle == NULL || handle->kind != PARSER_HANDLE_SESSION || handle->closed ) {
+		fwprintf(stderr, L"[Error][StartSubscription]: Invalid session handle\n");
+		return NULL;
+	}
+
+	if( !parsed.Parse(filter) ) {
+		fwprintf(stderr, L"[Error][StartSubscription]: Could not read the filter '%ls'\n", filter);
+		return NULL;
+	}
+
+	if( logName == NULL || wcslen(logName) == 0 )
+		logName = DEFAULT_LOG;
+
+	PARSER_CURSOR *cursor = new PARSER_CURSOR();
+
+	cursor->kind = PARSER_HANDLE_CURSOR;
+	cursor->owner = handle;
+	cursor->cursor = new EventCursor(handle->session);
+
+	if( !cursor->cursor->Subscribe(logName, &parsed, bookmark, waitMs, debug) ) {
+		delete cursor->cursor;
+		delete cursor;
+		return NULL;
+	}
+
+	handle->cursors++;
+
+	return cursor;
+}
+
+
+/****
+ * StartCatchUp
+ *
+ * DESC:
+ *     Opens a catch-up on a session. The backlog a structured filter
+ *     selects is split into shards of record IDs that are read over
+ *     several remote sessions at once, and handed over in record order,
+ *     as a cursor from StartFilteredSession would
+ *
+ * ARGS:
+ *     handle - session from OpenSession
+ *     logName - event log to open (default to "Application" if NULL)
+ *     filter - the events wanted (see ParseEventLogFiltered). Its record
+ *              range is the backlog; one with no end runs to the newest
+ *              record in the log
+ *     sessions - most sessions to read the host through at once (0 for
+ *                the default of 4, at most 16). With 1 the backlog is not
+ *                sharded but read as a cursor from StartFilteredSession
+ *                would, which is quicker over one session
+ *     shardRecords - record IDs each session reads at a time (0 for the
+ *                    default of 1000)
+ *     debug - set to 0 (none) 1 (basic) or 2 (verbose)
+ *
+ * RETURNS:
+ *     A cursor handle (close with CloseEventHandle), or NULL on failure
+ *
+ * REMARKS:
+ *     The sessions are opened with the credentials handle was opened
+ *     with, and set up as it is at the time (SetEventDataFields,
+ *     SetRecordFields, SetIdentityExtraction, SetMessageFormatting). They
+ *     are closed with the cursor.
+ *
+ *     The cursor is read with ReadNextEvent, ReadEventsToBuffer,
+ *     ReadEventsToUtf8Buffer or ReadEventsToCallback. The backlog goes on
+ *     being read between calls, a few shards ahead of what has been
+ *     handed over. Once it has all been handed over, the cursor reads on
+ *     like one from StartFilteredSession
+ */
+extern "C" __declspec(dllexport) PARSER_CURSOR * __stdcall StartCatchUp(PARSER_SESSION *handle, LPWSTR logName, LPWSTR filter, DWORD sessions, DWORD shardRecords, INT debug)
+{
+	EventFilter parsed;
+	std::vector<EVENT_SESSION *> readers;
+
+	if( handle == NULL || handle->kind != PARSER_HANDLE_SESSION || handle->closed ) {
+		fwprintf(stderr, L"[Error][StartCatchUp]: Invalid session handle\n");
+		return NULL;
+	}
+
+	if( !parsed.Parse(filter) ) {
+		fwprintf(stderr, L"[Error][StartCatchUp]: Could not read the filter '%ls'\n", filter);
+		return NULL;
+	}
+
+	if( logName == NULL || wcslen(logName) == 0 )
+		logName = DEFAULT_LOG;
+
+	if( sessions == 0 )
+		sessions = CATCHUP_SESSIONS_DEFAULT;
+
+	if( sessions > CATCHUP_SESSIONS_MAX )
+		sessions = CATCHUP_SESSIONS_MAX;
+
+	if( debug >= DEBUG_L1 ) {
+		wprintf(L"[StartCatchUp]: Reading '%ls' over %u sessions to '%ls'\n", logName, sessions, handle->server.c_str());
+	}
+
+	PARSER_CURSOR *cursor = new PARSER_CURSOR();
+
+	cursor->kind = PARSER_HANDLE_CURSOR;
+	cursor->owner = handle;
+
+	// Official MSDN specs request NULL instead of an empty string
+	LPWSTR domain = handle->domain.empty() ? NULL : &handle->domain[0];
+
+	for( DWORD i = 0; i < sessions; i++ ) {
+		CATCHUP_SESSION reader;
+
+		reader.hRemote = CreateRemoteSession(&handle->server[0], domain, &handle->username[0], &handle->password[0]);
+
+		if( reader.hRemote == NULL ) {
+			fwprintf(stderr, L"[Error][StartCatchUp]: Failed to connect to remote computer. Error code is %u.\n", GetLastError());
+			FreeCatchUp(cursor);
+			delete cursor;
+			return NULL;
+		}
+
+		reader.source = new WinEvtSource(reader.hRemote);
+		reader.session = new EVENT_SESSION(reader.source);
+		reader.session->projection = handle->session->projection;
+		reader.session->eventDataSelection = handle->session->eventDataSelection;
+		reader.session->templates.SetMode(handle->session->templates.Mode(), handle->session->templates.VerifyEvery());
+
+		cursor->sessions.push_back(reader);
+		readers.push_back(reader.session);
+	}
+
+	cursor->catchUp = new ShardedCatchUp(&readers[0], sessions, shardRecords);
+
+	if( !cursor->catchUp->Start(logName, &parsed, OUTPUT_FORMAT_JSON, handle->mode, debug) ) {
+		FreeCatchUp(cursor);
+		delete cursor;
+		return NULL;
+	}
+
+	handle->cursors++;
+
+	return cursor;
+}
+
+
+/****
+ * GetCursorBookmark
+ *
+ * DESC:
+ *     Writes out where a subscription has got to, as bookmark XML
+ *
+ * ARGS:
+ *     handle - session from OpenSession
+ *     cursor - subscription from StartSubscription on that session
+ *     buffer - receives the bookmark, null terminated (may be NULL)
+ *     bufferChars - size of the buffer, in characters
+ *     debug - set to 0 (none) 1 (basic) or 2 (verbose)
+ *
+ * RETURNS:
+ *     The size of the bookmark in characters, terminator included, or 0
+ *     if the cursor is not a subscription. Nothing is written unless the
+ *     buffer is at least that large
+ *
+ * REMARKS:
+ *     The bookmark is at the last event the cursor has handed over, so
+ *     ask for it after a read, once its records are safe
+ */
+extern "C" __declspec(dllexport) DWORD __stdcall GetCursorBookmark(PARSER_SESSION *handle, PARSER_CURSOR *cursor, LPWSTR buffer, DWORD bufferChars, INT debug)
+{
+	if( cursor == NULL || cursor->kind != PARSER_HANDLE_CURSOR || cursor->owner != handle ) {
+		fwprintf(stderr, L"[Error][GetCursorBookmark]: Invalid session or cursor handle\n");
+		return 0;
+	}
+
+	LPCWSTR bookmark = cursor->cursor != NULL ? cursor->cursor->Bookmark() : NULL;
+
+	if( bookmark == NULL ) {
+		fwprintf(stderr, L"[Error][GetCursorBookmark]: The cursor has no bookmark (error %u)\n", GetLastError());
+		return 0;
+	}
+
+	DWORD needed = (DWORD)wcslen(bookmark) + 1;
+
+	if( buffer != NULL && bufferChars >= needed )
+		memcpy(buffer, bookmark, needed * sizeof(WCHAR));
+
+	if( debug >= DEBUG_L2 ) {
+		wprintf(L"[GetCursorBookmark]: %ls\n", bookmark);
+	}
+
+	return needed;
+}
+
+
+/****
+ * SetEventDataFields
+ *
+ * DESC:
+ *     Has the records of a session carry the EventData fields of their
+ *     event, as an "event_data" object of name/value pairs
+ *
+ * ARGS:
+ *     handle - session from OpenSession
+ *     names - the fields wanted, comma separated (e.g.
+ *             "TargetUserName,TargetDomainName"). Empty or "*" for all of
+ *             them, NULL to stop adding them
+ *     debug - set to 0 (none) 1 (basic) or 2 (verbose)
+ *
+ * RETURNS:
+ *     TRUE, or FALSE if the handle is not a valid session
+ *
+ * REMARKS:
+ *     Applies to every query on the session, from the next read on.
+ *     Fields are taken by name from the event XML, so unlike the message
+ *     they read the same in every language and Windows version. Unnamed
+ *     fields are keyed (and selected) by position: "1", "2", ...
+ */
+extern "C" __declspec(dllexport) BOOL __stdcall SetEventDataFields(PARSER_SESSION *handle, LPWSTR names, INT debug)
+{
+	if( handle == NULL || handle->kind != PARSER_HANDLE_SESSION || handle->closed ) {
+		fwprintf(stderr, L"[Error][SetEventDataFields]: Invalid session handle\n");
+		return FALSE;
+	}
+
+	if( debug >= DEBUG_L1 ) {
+		wprintf(L"[SetEventDataFields]: Event data fields: %ls\n", names != NULL ? names : L"(none)");
+	}
+
+	if( names == NULL ) {
+		handle->mode &= ~MODE_EVENT_DATA;
+		return TRUE;
+	}
+
+	handle->session->eventDataSelection.Select(names);
+	handle->mode |= MODE_EVENT_DATA;
+
+	return TRUE;
+}
+
+
+/****
+ * SetRecordFields
+ *
+ * DESC:
+ *     Picks the fields the records of a session have
+ *
+ * ARGS:
+ *     handle - session from OpenSession
+ *     fields - the record fields wanted, comma separated (e.g.
+ *              "record_id,event_id,time_created"). Empty, NULL or "*"
+ *              for all of them
+ *     debug - set to 0 (none) 1 (basic) or 2 (verbose)
+ *
+ * RETURNS:
+ *     TRUE, or FALSE if the handle is not a valid session or a field name
+ *     is not known (the fields are then left as they were)
+ *
+ * REMARKS:
+ *     Applies to every query on the session, from the next read on. The
+ *     event_data and identity objects are picked separately (see
+ *     SetEventDataFields and SetIdentityExtraction). See
+ *     ParseEventLogFields for what is skipped
+ */
+extern "C" __declspec(dllexport) BOOL __stdcall SetRecordFields(PARSER_SESSION *handle, LPWSTR fields, INT debug)
+{
+	if( handle == NULL || handle->kind != PARSER_HANDLE_SESSION || handle->closed ) {
+		fwprintf(stderr, L"[Error][SetRecordFields]: Invalid session handle\n");
+		return FALSE;
+	}
+
+	if( debug >= DEBUG_L1 ) {
+		wprintf(L"[SetRecordFields]: Record fields: %ls\n", fields != NULL ? fields : L"(all)");
+	}
+
+	if( !ParseRecordFields(fields, &handle->session->projection) ) {
+		fwprintf(stderr, L"[Error][SetRecordFields]: Unknown field in '%ls'\n", fields);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+
+/****
+ * SetIdentityExtraction
+ *
+ * DESC:
+ *     Has the records of logon, logoff and NPS events carry who logged on
+ *     or off, as an "identity" object (see ExtractIdentity)
+ *
+ * ARGS:
+ *     handle - session from OpenSession
+ *     enable - TRUE to add it, FALSE to stop
+ *     debug - set to 0 (none) 1 (basic) or 2 (verbose)
+ *
+ * RETURNS:
+ *     TRUE, or FALSE if the handle is not a valid session
+ *
+ * REMARKS:
+ *     Applies to every query on the session, from the next read on. Other
+ *     events are read as before, without rendering their XML
+ */
+extern "C" __declspec(dllexport) BOOL __stdcall SetIdentityExtraction(PARSER_SESSION *handle, BOOL enable, INT debug)
+{
+	if( handle == NULL || handle->kind != PARSER_HANDLE_SESSION || handle->closed ) {
+		fwprintf(stderr, L"[Error][SetIdentityExtraction]: Invalid session handle\n");
+		return FALSE;
+	}
+
+	if( debug >= DEBUG_L1 ) {
+		wprintf(L"[SetIdentityExtraction]: Identity extraction %ls\n", enable ? L"on" : L"off");
+	}
+
+	if( enable )
+		handle->mode |= MODE_IDENTITY;
+	else
+		handle->mode &= ~MODE_IDENTITY;
+
+	return TRUE;
+}
+
+
+/****
+ * SetMessageFormatting
+ *
+ * DESC:
+ *     Chooses how the messages of the session's events are formatted (see
+ *     MessageTemplates)
+ *
+ * ARGS:
+ *     handle - session from OpenSession
+ *     mode - MESSAGES_REMOTE (0) to have EvtFormatMessage format each one,
+ *            MESSAGES_LOCAL (1) to fill in cached templates, or
+ *            MESSAGES_VERIFY (2) to do that and check a sample remotely
+ *     verifyEvery - in MESSAGES_VERIFY, how often a template's message is
+ *                   checked (0 for the default of 100)
+ *     debug - set to 0 (none) 1 (basic) or 2 (verbose)
+ *
+ * RETURNS:
+ *     TRUE, or FALSE if the handle is not a valid session or the mode is
+ *     unknown
+ *
+ * REMARKS:
+ *     Applies to every query on the session, from the next read on. The
+ *     templates cached so far are kept
+ */
+extern "C" __declspec(dllexport) BOOL __stdcall SetMessageFormatting(PARSER_SESSION *handle, INT mode, DWORD verifyEvery, INT debug)
+{
+	if( handle == NULL || handle->kind != PARSER_HANDLE_SESSION || handle->closed ) {
+		fwprintf(stderr, L"[Error][SetMessageFormatting]: Invalid session handle\n");
+		return FALSE;
+	}
+
+	if( mode != MESSAGES_REMOTE && mode != MESSAGES_LOCAL && mode != MESSAGES_VERIFY ) {
+		fwprintf(stderr, L"[Error][SetMessageFormatting]: Unknown mode %d\n", mode);
+		return FALSE;
+	}
+
+	if( verifyEvery == 0 )
+		verifyEvery = MESSAGE_VERIFY_EVERY;
+
+	if( debug >= DEBUG_L1 ) {
+		wprintf(L"[SetMessageFormatting]: Messages formatted %ls\n",
+			mode == MESSAGES_REMOTE ? L"remotely" : mode == MESSAGES_LOCAL ? L"locally" : L"locally, verified");
+	}
+
+	handle->session->templates.SetMode(mode, verifyEvery);
+
+	return TRUE;
+}
+
+
+/****
+ * SetIpfixExport
+ *
+ * DESC:
+ *     Sets up the session's events to be read as IPFIX data records of
+ *     the EpEventLog template (see ReadEventsToIpfixBuffer)
+ *
+ * ARGS:
+ *     handle - session from OpenSession
+ *     machineId - ipfixifymachineid for every record (at most 32 bytes of
+ *                 UTF-8; it is cut short past that)
+ *     templateId - ID the exporter gave the EpEventLog template (256 or
+ *                  more)
+ *     maxSetBytes - most bytes of each data set, header included (0 for
+ *                   the default of 1442, what fits in a datagram of 1458)
+ *     debug - set to 0 (none) 1 (basic) or 2 (verbose)
+ *
+ * RETURNS:
+ *     TRUE, or FALSE if the handle is not a valid session, the template ID
+ *     is not one a data set can have or maxSetBytes is out of range (the
+ *     export is then left as it was)
+ *
+ * REMARKS:
+ *     Applies from the next read on. The records have the fields
+ *     SetRecordFields picked; those the template has but the records do
+ *     not are sent as 0 or empty
+ */
+extern "C" __declspec(dllexport) BOOL __stdcall SetIpfixExport(PARSER_SESSION *handle, LPWSTR machineId, DWORD templateId, DWORD maxSetBytes, INT debug)
+{
+	if( handle == NULL || handle->kind != PARSER_HANDLE_SESSION || handle->closed ) {
+		fwprintf(stderr, L"[Error][SetIpfixExport]: Invalid session handle\n");
+		return FALSE;
+	}
+
+	if( maxSetBytes == 0 )
+		maxSetBytes = IPFIX_SET_BYTES_DEFAULT;
+
+	if( templateId < IPFIX_TEMPLATE_ID_MIN || templateId > 0xFFFF ) {
+		fwprintf(stderr, L"[Error][SetIpfixExport]: Template ID %u is not one a data set can have\n", templateId);
+		return FALSE;
+	}
+
+	if( maxSetBytes < IPFIX_SET_BYTES_MIN || maxSetBytes > IPFIX_SET_BYTES_MAX ) {
+		fwprintf(stderr, L"[Error][SetIpfixExport]: A set of %u bytes is out of range (%u to %u)\n", maxSetBytes, IPFIX_SET_BYTES_MIN, IPFIX_SET_BYTES_MAX);
+		return FALSE;
+	}
+
+	if( debug >= DEBUG_L1 ) {
+		wprintf(L"[SetIpfixExport]: Template %u, machine '%ls', sets of up to %u bytes\n", templateId, machineId != NULL ? machineId : L"", maxSetBytes);
+	}
+
+	SetIpfixMachineId(&handle->session->ipfix, machineId);
+	handle->session->ipfix.templateId = (WORD)templateId;
+	handle->session->ipfix.maxSetBytes = maxSetBytes;
+
+	return TRUE;
+}
+
+
+/****
+ * SetIpfixAggregation
+ *
+ * DESC:
+ *     Has the session's IPFIX records stand for flows of events rather
+ *     than one event each: events with the same log, event ID, source and
+ *     message (its numbers aside) within a window are merged into one
+ *     record with their count and first and last time (see
+ *     EventAggregator). The flows go out as records of the EpEventLogFlow
+ *     template, EpEventLog with flowStartSeconds and flowEndSeconds, so
+ *     that EpEventLog itself stays what fileLine sends
+ *
+ * ARGS:
+ *     handle - session from OpenSession
+ *     windowSeconds - how long after its first event a flow takes more (0
+ *                     turns aggregation off)
+ *     maxFlows - most flows open at once (0 for the default of 4096). Past
+ *                that, the oldest is closed to make room
+ *     flowTemplateId - ID the exporter gave the EpEventLogFlow template
+ *                      (256 or more; ignored if windowSeconds is 0)
+ *     minedFlowTemplateId - ID it gave EpEventLogMinedFlow, for flows
+ *                           whose messages are mined (see SetIpfixMining),
+ *                           or 0 to send their messages whole
+ *     debug - set to 0 (none) 1 (basic) or 2 (verbose)
+ *
+ * RETURNS:
+ *     TRUE, or FALSE if the handle is not a valid session, the window or
+ *     the number of flows is out of range, or a template ID is not one a
+ *     data set can have (nothing is changed then)
+ *
+ * REMARKS:
+ *     Flows open until now are closed, to go out with the next read or
+ *     FlushIpfixFlows. Only ReadEventsToIpfixBuffer is affected.
+ */
+extern "C" __declspec(dllexport) BOOL __stdcall SetIpfixAggregation(PARSER_SESSION *handle, DWORD windowSeconds, DWORD maxFlows, DWORD flowTemplateId, DWORD minedFlowTemplateId, INT debug)
+{
+	if( handle == NULL || handle->kind != PARSER_HANDLE_SESSION || handle->closed ) {
+		fwprintf(stderr, L"[Error][SetIpfixAggregation]: Invalid session handle\n");
+		return FALSE;
+	}
+
+	if( maxFlows == 0 )
+		maxFlows = AGGREGATE_FLOWS_DEFAULT;
+
+	if( windowSeconds > AGGREGATE_WINDOW_MAX ) {
+		fwprintf(stderr, L"[Error][SetIpfixAggregation]: A window of %u seconds is longer than %u\n", windowSeconds, AGGREGATE_WINDOW_MAX);
+		return FALSE;
+	}
+
+	if( maxFlows > AGGREGATE_FLOWS_MAX ) {
+		fwprintf(stderr, L"[Error][SetIpfixAggregation]: %u flows are more than %u\n", maxFlows, AGGREGATE_FLOWS_MAX);
+		return FALSE;
+	}
+
+	if( windowSeconds > 0 && (flowTemplateId < IPFIX_TEMPLATE_ID_MIN || flowTemplateId > 0xFFFF
+		|| (minedFlowTemplateId != 0 && (minedFlowTemplateId < IPFIX_TEMPLATE_ID_MIN || minedFlowTemplateId > 0xFFFF))) ) {
+		fwprintf(stderr, L"[Error][SetIpfixAggregation]: Template IDs %u and %u are not ones a data set can have\n", flowTemplateId, minedFlowTemplateId);
+		return FALSE;
+	}
+
+	if( debug >= DEBUG_L1 ) {
+		wprintf(L"[SetIpfixAggregation]: Window of %u seconds, up to %u flows, templates %u and %u\n", windowSeconds, maxFlows, flowTemplateId, minedFlowTemplateId);
+	}
+
+	handle->session->flows.Configure(windowSeconds, maxFlows);
+	handle->session->ipfix.flowTemplateId = windowSeconds > 0 ? (WORD)flowTemplateId : 0;
+	handle->session->ipfix.minedFlowTemplateId = windowSeconds > 0 ? (WORD)minedFlowTemplateId : 0;
+
+	return TRUE;
+}
+
+
+/****
+ * SetIpfixMining
+ *
+ * DESC:
+ *     Has the session's IPFIX records carry the template of their message
+ *     and its parameters rather than the message itself, as records of the
+ *     EpEventLogMined template, with the text of each template announced
+ *     in an oMessageTemplate options record ahead of the first record
+ *     that uses it, and again whenever it changes (see TemplateMiner and
+ *     WriteIpfixFlow)
+ *
+ * ARGS:
+ *     handle - session from OpenSession
+ *     minedTemplateId - ID the exporter gave the EpEventLogMined template
+ *                       (256 or more), or 0 to send messages whole again
+ *     announceTemplateId - ID it gave the oMessageTemplate options
+ *                          template (256 or more)
+ *     maxTemplates - most templates kept (0 for the default of 4096).
+ *                    Messages that fit none of them once there are that
+ *                    many are sent whole
+ *     debug - set to 0 (none) 1 (basic) or 2 (verbose)
+ *
+ * RETURNS:
+ *     TRUE, or FALSE if the handle is not a valid session, a template ID
+ *     is not one a data set can have, the two are the same, or
+ *     maxTemplates is out of range (nothing is changed then)
+ *
+ * REMARKS:
+ *     Applies from the next read on, and to flows as they are written.
+ *     The templates found so far are kept, with what was announced of
+ *     them; AnnounceIpfixTemplates sends them all again, for a collector
+ *     that may have missed them. A message with no template, or whose
+ *     template or parameters do not fit in a set whole, goes out in an
+ *     EpEventLog record as before.
+ */
+extern "C" __declspec(dllexport) BOOL __stdcall SetIpfixMining(PARSER_SESSION *handle, DWORD minedTemplateId, DWORD announceTemplateId, DWORD maxTemplates, INT debug)
+{
+	if( handle == NULL || handle->kind != PARSER_HANDLE_SESSION || handle->closed ) {
+		fwprintf(stderr, L"[Error][SetIpfixMining]: Invalid session handle\n");
+		return FALSE;
+	}
+
+	if( maxTemplates == 0 )
+		maxTemplates = MINER_TEMPLATES_DEFAULT;
+
+	if( minedTemplateId != 0 ) {
+		if( minedTemplateId < IPFIX_TEMPLATE_ID_MIN || minedTemplateId > 0xFFFF || announceTemplateId < IPFIX_TEMPLATE_ID_MIN || announceTemplateId > 0xFFFF ) {
+			fwprintf(stderr, L"[Error][SetIpfixMining]: Template IDs %u and %u are not both ones a data set can have\n", minedTemplateId, announceTemplateId);
+			return FALSE;
+		}
+
+		if( minedTemplateId == announceTemplateId ) {
+			fwprintf(stderr, L"[Error][SetIpfixMining]: The records and the announcements both have template ID %u\n", minedTemplateId);
+			return FALSE;
+		}
+	}
+
+	if( maxTemplates > MINER_TEMPLATES_MAX ) {
+		fwprintf(stderr, L"[Error][SetIpfixMining]: %u templates are more than %u\n", maxTemplates, MINER_TEMPLATES_MAX);
+		return FALSE;
+	}
+
+	if( debug >= DEBUG_L1 ) {
+		if( minedTemplateId != 0 )
+			wprintf(L"[SetIpfixMining]: Templates %u and %u, up to %u message templates\n", minedTemplateId, announceTemplateId, maxTemplates);
+		else
+			wprintf(L"[SetIpfixMining]: Messages sent whole\n");
+	}
+
+	handle->session->ipfix.minedTemplateId = (WORD)minedTemplateId;
+	handle->session->ipfix.announceTemplateId = minedTemplateId != 0 ? (WORD)announceTemplateId : 0;
+	handle->session->miner.Configure(maxTemplates);
+
+	return TRUE;
+}
+
+
+/****
+ * ReadNextEvent
+ *
+ * DESC:
+ *     Displays the next events of a query to STDOUT
+ *
+ * ARGS:
+ *     handle - session from OpenSession
+ *     cursor - query from StartSession on that session
+ *     maxEvents - most events to display (0 for the default of 100)
+ *     debug - set to 0 (none) 1 (basic) or 2 (verbose)
+ *
+ * RETURNS:
+ *     The number of events displayed. 0 means no new events (or an error,
+ *     which is reported on STDERR)
+ *
+ * REMARKS:
+ *     Output is the same as ParseEventLog's, one call's worth at a time.
+ *     As there, the output format is forced as JSON
+ */
+extern "C" __declspec(dllexport) DWORD __stdcall ReadNextEvent(PARSER_SESSION *handle, PARSER_CURSOR *cursor, DWORD maxEvents, INT debug)
+{
+	if( cursor == NULL || cursor->kind != PARSER_HANDLE_CURSOR || cursor->owner != handle ) {
+		fwprintf(stderr, L"[Error][ReadNextEvent]: Invalid session or cursor handle\n");
+		return 0;
+	}
+
+	StdoutSink sink;
+
+	if( cursor->catchUp != NULL )
+		return cursor->catchUp->Read(maxEvents, &sink, debug);
+
+	return cursor->cursor->Read(maxEvents, &sink, OUTPUT_FORMAT_JSON, handle->mode, debug);
+}
+
+
+/****
+ * ReadEventsToBuffer
+ *
+ * DESC:
+ *     Writes the next events of a query into the caller's buffer, one
+ *     JSON record per event, each followed by a null character
+ *
+ * ARGS:
+ *     handle - session from OpenSession
+ *     cursor - query from StartSession on that session
+ *     buffer - where the records are written
+ *     bufferChars - size of the buffer, in characters
+ *     maxEvents - most events to write (0 for the default of 100)
+ *     result - receives what was written and where the next call resumes
+ *     debug - set to 0 (none) 1 (basic) or 2 (verbose)
+ *
+ * RETURNS:
+ *     The number of records written
+ *
+ * REMARKS:
+ *     Only whole records are written. Once the buffer cannot take the next
+ *     one, the call returns with result->status set to ERROR_MORE_DATA, and
+ *     the next call starts with that record. If not even one record fits,
+ *     the status is ERROR_INSUFFICIENT_BUFFER and result->charsRequired
+ *     says how large the buffer must be.
+ */
+extern "C" __declspec(dllexport) DWORD __stdcall ReadEventsToBuffer(PARSER_SESSION *handle, PARSER_CURSOR *cursor, LPWSTR buffer, DWORD bufferChars, DWORD maxEvents, READ_RESULT *result, INT debug)
+{
+	BufferSink sink(buffer, bufferChars);
+
+	DWORD records = ReadCursorInternal(handle, cursor, &sink, maxEvents, result, debug);
+
+	if( result != NULL ) {
+		result->charsUsed = sink.Used();
+		result->charsRequired = result->status == ERROR_SUCCESS ? 0 : sink.Required();
+	}
+
+	return records;
+}
+
+
+/****
+ * ReadEventsToUtf8Buffer
+ *
+ * DESC:
+ *     As ReadEventsToBuffer, but the records are written as UTF-8
+ *
+ * ARGS:
+ *     handle - session from OpenSession
+ *     cursor - query from StartSession on that session
+ *     buffer - where the records are written
+ *     bufferBytes - size of the buffer, in bytes
+ *     maxEvents - most events to write (0 for the default of 100)
+ *     result - receives what was written and where the next call resumes.
+ *              charsUsed and charsRequired are in bytes
+ *     debug - set to 0 (none) 1 (basic) or 2 (verbose)
+ *
+ * RETURNS:
+ *     The number of records written
+ *
+ * REMARKS:
+ *     Records are encoded as they are written, so the caller gets valid
+ *     UTF-8 (invalid UTF-16 becomes U+FFFD) and need not decode anything
+ *     before handing it to a JSON parser.
+ */
+extern "C" __declspec(dllexport) DWORD __stdcall ReadEventsToUtf8Buffer(PARSER_SESSION *handle, PARSER_CURSOR *cursor, char *buffer, DWORD bufferBytes, DWORD maxEvents, READ_RESULT *result, INT debug)
+{
+	Utf8BufferSink sink(buffer, bufferBytes);
+
+	DWORD records = ReadCursorInternal(handle, cursor, &sink, maxEvents, result, debug);
+
+	if( result != NULL ) {
+		result->charsUsed = sink.Used();
+		result->charsRequired = result->status == ERROR_SUCCESS ? 0 : sink.Required();
+	}
+
+	return records;
+}
+
+
+/****
+ * ReadEventsToCallback
+ *
+ * DESC:
+ *     Hands the next events of a query to the caller's function, one JSON
+ *     record at a time
+ *
+ * ARGS:
+ *     handle - session from OpenSession
+ *     cursor - query from StartSession on that session
+ *     callback - called with every record (see EVENT_RECORD_CALLBACK)
+ *     context - passed through to the callback
+ *     maxEvents - most events to hand over (0 for the default of 100)
+ *     result - receives what was written and where the next call resumes
+ *     debug - set to 0 (none) 1 (basic) or 2 (verbose)
+ *
+ * RETURNS:
+ *     The number of records the callback took
+ *
+ * REMARKS:
+ *     The record is only valid during the callback. A callback that
+ *     returns FALSE stops the read; that record is offered again by the
+ *     next call
+ */
+extern "C" __declspec(dllexport) DWORD __stdcall ReadEventsToCallback(PARSER_SESSION *handle, PARSER_CURSOR *cursor, EVENT_RECORD_CALLBACK callback, LPVOID context, DWORD maxEvents, READ_RESULT *result, INT debug)
+{
+	CallbackSink sink(callback, context);
+
+	return ReadCursorInternal(handle, cursor, &sink, maxEvents, result, debug);
+}
+
+
+/****
+ * ReadEventsToBinaryBuffer
+ *
+ * DESC:
+ *     As ReadEventsToUtf8Buffer, but the records are binary: packed back
+ *     to back, each with its length ahead of it and its numeric fields as
+ *     numbers (see EncodeBinaryRecord for the layout)
+ *
+ * ARGS:
+ *     handle - session from OpenSession
+ *     cursor - query from StartSession on that session
+ *     buffer - where the records are written
+ *     bufferBytes - size of the buffer, in bytes
+ *     maxEvents - most events to write (0 for the default of 100)
+ *     result - receives what was written and where the next call resumes.
+ *              charsUsed and charsRequired are in bytes
+ *     debug - set to 0 (none) 1 (basic) or 2 (verbose)
+ *
+ * RETURNS:
+ *     The number of records written
+ *
+ * REMARKS:
+ *     The records have the fields SetRecordFields picked, but not the
+ *     EventData or the identity. A catch-up from StartCatchUp keeps its
+ *     records as JSON, so its cursor cannot be read this way
+ *     (ERROR_NOT_SUPPORTED).
+ */
+extern "C" __declspec(dllexport) DWORD __stdcall ReadEventsToBinaryBuffer(PARSER_SESSION *handle, PARSER_CURSOR *cursor, BYTE *buffer, DWORD bufferBytes, DWORD maxEvents, READ_RESULT *result, INT debug)
+{
+	BinaryBufferSink sink(buffer, bufferBytes);
+
+	DWORD records = ReadCursorInternal(handle, cursor, &sink, maxEvents, result, debug, OUTPUT_FORMAT_BINARY);
+
+	if( result != NULL ) {
+		result->charsUsed = sink.Used();
+		result->charsRequired = result->status == ERROR_SUCCESS ? 0 : sink.Required();
+	}
+
+	return records;
+}
+
+
+/****
+ * ReadEventsToIpfixBuffer
+ *
+ * DESC:
+ *     As ReadEventsToBinaryBuffer, but the records are IPFIX data records
+ *     of the EpEventLog template, packed into data sets ready to be sent
+ *     after a message header (see EncodeIpfixRecord and IpfixSetSink)
+ *
+ * ARGS:
+ *     handle - session from OpenSession, set up by SetIpfixExport
+ *     cursor - query from StartSession on that session
+ *     buffer - where the sets are written
+ *     bufferBytes - size of the buffer, in bytes
+ *     maxEvents - most events to write (0 for the default of 100)
+ *     result - receives what was written and where the next call resumes.
+ *              charsUsed and charsRequired are in bytes
+ *     debug - set to 0 (none) 1 (basic) or 2 (verbose)
+ *
+ * RETURNS:
+ *     The number of events read: one record each, unless the session
+ *     merges them into flows
+ *
+ * REMARKS:
+ *     Each set holds as many records as fit in the maxSetBytes given to
+ *     SetIpfixExport, so each can go in a message of its own; a caller
+ *     walks them by their lengths. A session that SetIpfixExport has not
+ *     set up reads nothing (ERROR_INVALID_STATE). A catch-up cannot be
+ *     read this way (ERROR_NOT_SUPPORTED), as for ReadEventsToBinaryBuffer.
+ *
+ *     With SetIpfixAggregation, the sets hold the flows that were closed
+ *     by this read (or waited from an earlier one), and the events still
+ *     in open flows go out with a later read or FlushIpfixFlows. Such a
+ *     read can write sets without reading an event, and ends with
+ *     ERROR_MORE_DATA while closed flows are left that did not fit.
+ *
+ *     With SetIpfixMining, records whose message has a template are of
+ *     the EpEventLogMined template instead, in sets of their own, with
+ *     the oMessageTemplate records that announce the templates' text
+ *     ahead of them. Sets of the three templates come in any order.
+ */
+extern "C" __declspec(dllexport) DWORD __stdcall ReadEventsToIpfixBuffer(PARSER_SESSION *handle, PARSER_CURSOR *cursor, BYTE *buffer, DWORD bufferBytes, DWORD maxEvents, READ_RESULT *result, INT debug)
+{
+	EVENT_SESSION *session = handle != NULL && handle->kind == PARSER_HANDLE_SESSION && !handle->closed ? handle->session : NULL;
+
+	if( session != NULL && session->ipfix.templateId == 0 ) {
+		fwprintf(stderr, L"[Error][ReadEventsToIpfixBuffer]: The session has no IPFIX template (see SetIpfixExport)\n");
+
+		if( result != NULL ) {
+			RtlZeroMemory(result, sizeof(READ_RESULT));
+			result->status = ERROR_INVALID_STATE;
+		}
+
+		return 0;
+	}
+
+	IpfixSetSink sink(buffer, bufferBytes, session != NULL ? session->ipfix.templateId : 0, session != NULL ? session->ipfix.maxSetBytes : 0);
+	READ_RESULT outcome;
+
+	// Flows of a log gone quiet since the last read are closed by the clock
+	if( session != NULL && session->flows.Enabled() )
+		session->flows.Expire(time(NULL));
+
+	DWORD records = ReadCursorInternal(handle, cursor, &sink, maxEvents, &outcome, debug, OUTPUT_FORMAT_IPFIX);
+
+	// Flows closed by the last events, or still waiting from before, go in
+	// after them. Any the buffer cannot take make it a partial read, as do
+	// flows written ahead of an event that did not fit
+	if( session != NULL && (outcome.status == ERROR_SUCCESS || outcome.status == ERROR_MORE_DATA || outcome.status == ERROR_INSUFFICIENT_BUFFER) ) {
+		BOOL drained = session->flows.Drain(&sink, &session->render.record, &session->ipfix, &session->miner);
+
+		if( !drained || outcome.status == ERROR_INSUFFICIENT_BUFFER )
+			outcome.status = sink.Used() > 0 ? ERROR_MORE_DATA : ERROR_INSUFFICIENT_BUFFER;
+	}
+
+	if( result != NULL ) {
+		*result = outcome;
+		result->charsUsed = sink.Used();
+		result->charsRequired = result->status == ERROR_SUCCESS ? 0 : sink.Required();
+	}
+
+	return records;
+}
+
+
+/****
+ * FlushIpfixFlows
+ *
+ * DESC:
+ *     Closes every flow SetIpfixAggregation has open on a session and
+ *     writes them, with any still waiting, as data sets in the same way
+ *     as ReadEventsToIpfixBuffer
+ *
+ * ARGS:
+ *     handle - session from OpenSession, set up by SetIpfixExport
+ *     buffer - where the sets are written
+ *     bufferBytes - size of the buffer, in bytes
+ *     result - receives what was written. records is the number of flows;
+ *              charsUsed and charsRequired are in bytes
+ *     debug - set to 0 (none) 1 (basic) or 2 (verbose)
+ *
+ * RETURNS:
+ *     The number of flows written
+ *
+ * REMARKS:
+ *     Flows the buffer cannot take wait for the next call, with
+ *     result->status set to ERROR_MORE_DATA (or ERROR_INSUFFICIENT_BUFFER
+ *     if not even one fit). Flows still open when the session is closed
+ *     are lost, so a caller done with a log calls this first.
+ */
+extern "C" __declspec(dllexport) DWORD __stdcall FlushIpfixFlows(PARSER_SESSION *handle, BYTE *buffer, DWORD bufferBytes, READ_RESULT *result, INT debug)
+{
+	DWORD status = ERROR_INVALID_HANDLE;
+	DWORD flows = 0;
+	EVENT_SESSION *session = handle != NULL && handle->kind == PARSER_HANDLE_SESSION && !handle->closed ? handle->session : NULL;
+	IpfixSetSink sink(buffer, bufferBytes, session != NULL ? session->ipfix.templateId : 0, session != NULL ? session->ipfix.maxSetBytes : 0);
+
+	if( session == NULL ) {
+		fwprintf(stderr, L"[Error][FlushIpfixFlows]: Invalid session handle\n");
+	} else if( session->ipfix.templateId == 0 ) {
+		fwprintf(stderr, L"[Error][FlushIpfixFlows]: The session has no IPFIX template (see SetIpfixExport)\n");
+		status = ERROR_INVALID_STATE;
+	} else {
+		session->flows.Flush();
+
+		// Announcements of templates go in among the flows, so the flows
+		// are counted by what is left of them
+		DWORD pending = session->flows.Pending();
+
+		if( session->flows.Drain(&sink, &session->render.record, &session->ipfix, &session->miner) )
+			status = ERROR_SUCCESS;
+		else
+			status = sink.Used() > 0 ? ERROR_MORE_DATA : ERROR_INSUFFICIENT_BUFFER;
+
+		flows = pending - session->flows.Pending();
+
+		if( debug >= DEBUG_L1 ) {
+			wprintf(L"[FlushIpfixFlows]: Wrote %u flows, %u waiting\n", flows, session->flows.Pending());
+		}
+	}
+
+	if( result != NULL ) {
+		RtlZeroMemory(result, sizeof(READ_RESULT));
+
+		result->records = flows;
+		result->charsUsed = sink.Used();
+		result->charsRequired = status == ERROR_SUCCESS ? 0 : sink.Required();
+		result->status = status;
+		result->lastRecordId = session != NULL ? session->lastRecordId : 0;
+	}
+
+	return flows;
+}
+
+
+/****
+ * AnnounceIpfixTemplates
+ *
+ * DESC:
+ *     Writes the text of the message templates a session has found as
+ *     oMessageTemplate records, in data sets as ReadEventsToIpfixBuffer
+ *     writes them, whether or not they were announced before
+ *
+ * ARGS:
+ *     handle - session from OpenSession, set up by SetIpfixMining
+ *     firstTemplateId - the first template to announce (0 or 1 for all)
+ *     buffer - where the sets are written
+ *     bufferBytes - size of the buffer, in bytes
+ *     result - receives what was written. records is the number of
+ *              templates, lastRecordId the last template ID gone through;
+ *              charsUsed and charsRequired are in bytes
+ *     debug - set to 0 (none) 1 (basic) or 2 (verbose)
+ *
+ * RETURNS:
+ *     The number of templates written
+ *
+ * REMARKS:
+ *     IPFIX over UDP can lose the announcement a collector needs, and a
+ *     collector that restarts has none, so call this every so often, as
+ *     options templates are sent again. Templates the buffer cannot take
+ *     are left with result->status set to ERROR_MORE_DATA (or
+ *     ERROR_INSUFFICIENT_BUFFER if not even one fit); call again from the
+ *     one after result->lastRecordId. A template whose text does not fit
+ *     in a set is left out, as its messages are sent whole.
+ */
+extern "C" __declspec(dllexport) DWORD __stdcall AnnounceIpfixTemplates(PARSER_SESSION *handle, DWORD firstTemplateId, BYTE *buffer, DWORD bufferBytes, READ_RESULT *result, INT debug)
+{
+	DWORD status = ERROR_INVALID_HANDLE;
+	DWORD announced = 0;
+	EVENT_SESSION *session = handle != NULL && handle->kind == PARSER_HANDLE_SESSION && !handle->closed ? handle->session : NULL;
+	IpfixSetSink sink(buffer, bufferBytes, session != NULL ? session->ipfix.announceTemplateId : 0, session != NULL ? session->ipfix.maxSetBytes : 0);
+
+	if( firstTemplateId == 0 )
+		firstTemplateId = 1;
+
+	DWORD last = firstTemplateId - 1;
+
+	if( session == NULL ) {
+		fwprintf(stderr, L"[Error][AnnounceIpfixTemplates]: Invalid session handle\n");
+	} else if( session->ipfix.minedTemplateId == 0 ) {
+		fwprintf(stderr, L"[Error][AnnounceIpfixTemplates]: The session does not mine messages (see SetIpfixMining)\n");
+		status = ERROR_INVALID_STATE;
+	} else {
+		status = ERROR_SUCCESS;
+
+		for( DWORD templateId = firstTemplateId; templateId <= session->miner.Templates(); templateId++ ) {
+			DWORD bytes = 0;
+
+			if( !EncodeIpfixAnnouncement(&session->render.record, templateId, session->miner.Text(templateId), &session->ipfix, &bytes) ) {
+				fwprintf(stderr, L"[Error][AnnounceIpfixTemplates]: malloc failed, template %u is not announced\n", templateId);
+			} else if( bytes != 0 ) {
+				if( !sink.WriteBinary((const BYTE *)session->render.record.Data(), bytes) ) {
+					status = sink.Used() > 0 ? ERROR_MORE_DATA : ERROR_INSUFFICIENT_BUFFER;
+					break;
+				}
+
+				session->miner.SetAnnounced(templateId, session->miner.Version(templateId));
+				announced++;
+			}
+
+			last = templateId;
+		}
+
+		if( debug >= DEBUG_L1 ) {
+			wprintf(L"[AnnounceIpfixTemplates]: Announced %u of %u templates, up to %u\n", announced, session->miner.Templates(), last);
+		}
+	}
+
+	if( result != NULL ) {
+		RtlZeroMemory(result, sizeof(READ_RESULT));
+
+		result->records = announced;
+		result->charsUsed = sink.Used();
+		result->charsRequired = status == ERROR_SUCCESS ? 0 : sink.Required();
+		result->status = status;
+		result->lastRecordId = last;
+	}
+
+	return announced;
+}
+
+
+/****
+ * OpenCollector
+ *
+ * DESC:
+ *     Sets up a collector: many hosts, each with its own channels, read at
+ *     once on a fixed pool of threads, a round at a time (CollectEvents)
+ *
+ * ARGS:
+ *     setup - session whose settings every host's session is given
+ *             (SetEventDataFields, SetRecordFields, SetIdentityExtraction,
+ *             SetMessageFormatting), as they are at the time, or NULL for
+ *             the defaults
+ *     workers - threads to read the hosts on (0 for the default of 8, at
+ *               most 64)
+ *     batch - events each turn reads from a channel (0 for the default of
+ *             200)
+ *     hostDeadlineMs - time each host may take in a round (0 for the
+ *                      default of 10 seconds)
+ *     debug - set to 0 (none) 1 (basic) or 2 (verbose)
+ *
+ * RETURNS:
+ *     A collector handle (close with CloseEventHandle), or NULL on failure
+ *
+ * REMARKS:
+ *     Add the hosts with AddCollectorHost and their channels with
+ *     AddCollectorChannel before the first CollectEvents. A host is only
+ *     connected to once its first turn comes, and again after it fails
+ */
+extern "C" __declspec(dllexport) PARSER_COLLECTOR * __stdcall OpenCollector(PARSER_SESSION *setup, DWORD workers, DWORD batch, DWORD hostDeadlineMs, INT debug)
+{
+	if( setup != NULL && (setup->kind != PARSER_HANDLE_SESSION || setup->closed) ) {
+		fwprintf(stderr, L"[Error][OpenCollector]: Invalid session handle\n");
+		return NULL;
+	}
+
+	if( debug >= DEBUG_L1 ) {
+		wprintf(L"[OpenCollector]: Collecting on %u threads\n", workers > 0 ? workers : COLLECTOR_WORKERS_DEFAULT);
+	}
+
+	PARSER_COLLECTOR *handle = new PARSER_COLLECTOR();
+
+	handle->kind = PARSER_HANDLE_COLLECTOR;
+	handle->collector = new HostCollector(&handle->connector, workers, batch, hostDeadlineMs);
+
+	if( setup != NULL ) {
+		handle->connector.projection = setup->session->projection;
+		handle->connector.eventDataSelection = setup->session->eventDataSelection;
+		handle->connector.templatesMode = setup->session->templates.Mode();
+		handle->connector.verifyEvery = setup->session->templates.VerifyEvery();
+		handle->collector->SetMode(setup->mode);
+	}
+
+	return handle;
+}
+
+
+/****
+ * AddCollectorHost
+ *
+ * DESC:
+ *     Adds a host to a collector
+ *
+ * ARGS:
+ *     handle - collector from OpenCollector
+ *     server - IP or host to connect to. Its records are tagged with it
+ *     domain - domain within the host (empty string for none)
+ *     username - username within the domain
+ *     password - password for above user
+ *     debug - set to 0 (none) 1 (basic) or 2 (verbose)
+ *
+ * RETURNS:
+ *     The host's index, for AddCollectorChannel and GetCollectorHost, or
+ *     (DWORD)-1 on failure (collecting has started)
+ */
+extern "C" __declspec(dllexport) DWORD __stdcall AddCollectorHost(PARSER_COLLECTOR *handle, LPWSTR server, LPWSTR domain, LPWSTR username, LPWSTR password, INT debug)
+{
+	if( handle == NULL || handle->kind != PARSER_HANDLE_COLLECTOR || server == NULL ) {
+		fwprintf(stderr, L"[Error][AddCollectorHost]: Invalid collector handle\n");
+		return (DWORD)-1;
+	}
+
+	COLLECTOR_HOST *host = new COLLECTOR_HOST();
+
+	host->server = server;
+	host->domain = domain != NULL ? domain : L"";
+	host->username = username != NULL ? username : L"";
+	host->password = password != NULL ? password : L"";
+
+	DWORD index = handle->collector->AddHost(server, host);
+
+	if( index == (DWORD)-1 ) {
+		fwprintf(stderr, L"[Error][AddCollectorHost]: Hosts cannot be added once collecting has started\n");
+		SecureZeroMemory(&host->password[0], host->password.size() * sizeof(WCHAR));
+		delete host;
+		return (DWORD)-1;
+	}
+
+	handle->hosts.push_back(host);
+
+	if( debug >= DEBUG_L1 ) {
+		wprintf(L"[AddCollectorHost]: Host %u is '%ls'\n", index, server);
+	}
+
+	return index;
+}
+
+
+/****
+ * AddCollectorChannel
+ *
+ * DESC:
+ *     Adds an event log for a collector to read on one of its hosts
+ *
+ * ARGS:
+ *     handle - collector from OpenCollector
+ *     host - index from AddCollectorHost
+ *     logName - event log to read (default to "Application" if NULL)
+ *     filter - the events wanted (see ParseEventLogFiltered). Its low
+ *              record is where reading starts, so pass the record after
+ *              the last one read by an earlier run
+ *     debug - set to 0 (none) 1 (basic) or 2 (verbose)
+ *
+ * RETURNS:
+ *     TRUE, or FALSE if the host or filter is not valid or collecting has
+ *     started. The host's channels are numbered in the order added
+ */
+extern "C" __declspec(dllexport) BOOL __stdcall AddCollectorChannel(PARSER_COLLECTOR *handle, DWORD host, LPWSTR logName, LPWSTR filter, INT debug)
+{
+	EventFilter parsed;
+
+	if( handle == NULL || handle->kind != PARSER_HANDLE_COLLECTOR ) {
+		fwprintf(stderr, L"[Error][AddCollectorChannel]: Invalid collector handle\n");
+		return FALSE;
+	}
+
+	if( !parsed.Parse(filter) ) {
+		fwprintf(stderr, L"[Error][AddCollectorChannel]: Could not read the filter '%ls'\n", filter);
+		return FALSE;
+	}
+
+	if( logName == NULL || wcslen(logName) == 0 )
+		logName = DEFAULT_LOG;
+
+	if( !handle->collector->AddChannel(host, logName, &parsed) ) {
+		fwprintf(stderr, L"[Error][AddCollectorChannel]: Could not add '%ls' to host %u\n", logName, host);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+
+/****
+ * CollectEvents
+ *
+ * DESC:
+ *     Runs a round of a collector: reads what is new on every host, into
+ *     a caller's buffer as UTF-8, each record tagged with its host and
+ *     channel
+ *
+ * ARGS:
+ *     handle - collector from OpenCollector
+ *     deadlineMs - longest the round may take (0 for no limit but the
+ *                  hosts' own)
+ *     buffer - where the records go, each "host TAB channel TAB record"
+ *              followed by a null byte
+ *     bufferBytes - size of the buffer, in bytes
+ *     result - receives what was written (see ReadEventsToUtf8Buffer);
+ *              lastRecordId is not used (see GetCollectorChannel)
+ *     debug - set to 0 (none) 1 (basic) or 2 (verbose)
+ *
+ * RETURNS:
+ *     The number of records written. result->status is ERROR_SUCCESS if
+ *     every host finished its round, ERROR_TIMEOUT if the deadline came
+ *     first, or ERROR_MORE_DATA (ERROR_INSUFFICIENT_BUFFER) if the buffer
+ *     filled. Call again to get the rest; records are never lost
+ *
+ * REMARKS:
+ *     How each host got on is read with GetCollectorHost. A host that
+ *     fails is tried again a few rounds later, from where it got to.
+ *     Hosts still busy at the deadline carry on, and what they read comes
+ *     out of the next call
+ */
+extern "C" __declspec(dllexport) DWORD __stdcall CollectEvents(PARSER_COLLECTOR *handle, DWORD deadlineMs, char *buffer, DWORD bufferBytes, READ_RESULT *result, INT debug)
+{
+	if( handle == NULL || handle->kind != PARSER_HANDLE_COLLECTOR ) {
+		fwprintf(stderr, L"[Error][CollectEvents]: Invalid collector handle\n");
+
+		if( result != NULL ) {
+			RtlZeroMemory(result, sizeof(READ_RESULT));
+			result->status = ERROR_INVALID_HANDLE;
+		}
+
+		return 0;
+	}
+
+	Utf8BufferSink sink(buffer, bufferBytes);
+
+	DWORD records = handle->collector->Collect(deadlineMs, &sink, debug);
+
+	if( result != NULL ) {
+		RtlZeroMemory(result, sizeof(READ_RESULT));
+
+		result->records = records;
+		result->status = handle->collector->Status();
+		result->charsUsed = sink.Used();
+		result->charsRequired = result->status == ERROR_MORE_DATA || result->status == ERROR_INSUFFICIENT_BUFFER ? sink.Required() : 0;
+	}
+
+	return records;
+}
+
+
+/****
+ * GetCollectorHost
+ *
+ * DESC:
+ *     Reads how a host got on in its last round
+ *
+ * ARGS:
+ *     handle - collector from OpenCollector
+ *     host - index from AddCollectorHost
+ *     status - receives it (see HOST_STATUS)
+ *     debug - set to 0 (none) 1 (basic) or 2 (verbose)
+ *
+ * RETURNS:
+ *     TRUE, or FALSE if there is no such host
+ */
+extern "C" __declspec(dllexport) BOOL __stdcall GetCollectorHost(PARSER_COLLECTOR *handle, DWORD host, HOST_STATUS *status, INT debug)
+{
+	if( handle == NULL || handle->kind != PARSER_HANDLE_COLLECTOR || status == NULL ) {
+		fwprintf(stderr, L"[Error][GetCollectorHost]: Invalid collector handle\n");
+		return FALSE;
+	}
+
+	return handle->collector->GetHostStatus(host, status);
+}
+
+
+/****
+ * GetCollectorChannel
+ *
+ * DESC:
+ *     Reads how far a collector has got in a channel of a host
+ *
+ * ARGS:
+ *     handle - collector from OpenCollector
+ *     host - index from AddCollectorHost
+ *     channel - the host's channels are numbered from 0 in the order
+ *               AddCollectorChannel added them
+ *     lastRecordId - receives the last record read, or passed over by the
+ *                    filter (0 if none yet)
+ *     debug - set to 0 (none) 1 (basic) or 2 (verbose)
+ *
+ * RETURNS:
+ *     TRUE, or FALSE if there is no such host or channel
+ *
+ * REMARKS:
+ *     Keep it once the records returned so far are safe; a later run
+ *     picks up from the record after it
+ */
+extern "C" __declspec(dllexport) BOOL __stdcall GetCollectorChannel(PARSER_COLLECTOR *handle, DWORD host, DWORD channel, DWORD64 *lastRecordId, INT debug)
+{
+	if( handle == NULL || handle->kind != PARSER_HANDLE_COLLECTOR || lastRecordId == NULL ) {
+		fwprintf(stderr, L"[Error][GetCollectorChannel]: Invalid collector handle\n");
+		return FALSE;
+	}
+
+	return handle->collector->GetLastRecordId(host, channel, lastRecordId);
+}
+
+
+/****
+ * OpenTemplateMiner
+ *
+ * DESC:
+ *     Sets up a template miner of its own, for messages that do not come
+ *     from a session, such as syslog lines (see MineMessage)
+ *
+ * ARGS:
+ *     maxTemplates - most templates kept (0 for the default of 4096)
+ *     debug - set to 0 (none) 1 (basic) or 2 (verbose)
+ *
+ * RETURNS:
+ *     A miner handle (close with CloseEventHandle), or NULL if
+ *     maxTemplates is out of range
+ */
+extern "C" __declspec(dllexport) PARSER_MINER * __stdcall OpenTemplateMiner(DWORD maxTemplates, INT debug)
+{
+	if( maxTemplates == 0 )
+		maxTemplates = MINER_TEMPLATES_DEFAULT;
+
+	if( maxTemplates > MINER_TEMPLATES_MAX ) {
+		fwprintf(stderr, L"[Error][OpenTemplateMiner]: %u templates are more than %u\n", maxTemplates, MINER_TEMPLATES_MAX);
+		return NULL;
+	}
+
+	if( debug >= DEBUG_L1 ) {
+		wprintf(L"[OpenTemplateMiner]: Up to %u templates\n", maxTemplates);
+	}
+
+	PARSER_MINER *handle = new PARSER_MINER();
+
+	handle->kind = PARSER_HANDLE_MINER;
+	handle->miner.Configure(maxTemplates);
+
+	return handle;
+}
+
+
+/****
+ * MineMessage
+ *
+ * DESC:
+ *     Finds the template of a message, or starts one, and the message's
+ *     parameters (see TemplateMiner::Mine)
+ *
+ * ARGS:
+ *     handle - miner from OpenTemplateMiner
+ *     message - the message
+ *     parameters - receives its parameters, null terminated, a space
+ *                  between them
+ *     parametersChars - size of parameters, in characters. One as long as
+ *                       the message, terminator included, always holds them
+ *     version - receives the version of the template's text (may be
+ *               NULL). When it is not the one last sent, send the text
+ *               again (see GetMinedTemplate)
+ *     debug - set to 0 (none) 1 (basic) or 2 (verbose)
+ *
+ * RETURNS:
+ *     The template's ID, or 0 if the message is to be sent whole: it is
+ *     empty, fits no template once there are as many as are kept, or its
+ *     parameters do not fit
+ */
+extern "C" __declspec(dllexport) DWORD __stdcall MineMessage(PARSER_MINER *handle, LPWSTR message, LPWSTR parameters, DWORD parametersChars, DWORD *version, INT debug)
+{
+	if( version != NULL )
+		*version = 0;
+
+	if( handle == NULL || handle->kind != PARSER_HANDLE_MINER ) {
+		fwprintf(stderr, L"[Error][MineMessage]: Invalid miner handle\n");
+		return 0;
+	}
+
+	LPCWSTR mined = NULL;
+	DWORD templateId = handle->miner.Mine(message, &mined);
+	DWORD needed = (DWORD)wcslen(mined) + 1;
+
+	if( templateId == 0 || parameters == NULL || parametersChars < needed )
+		return 0;
+
+	memcpy(parameters, mined, needed * sizeof(WCHAR));
+
+	if( version != NULL )
+		*version = handle->miner.Version(templateId);
+
+	if( debug >= DEBUG_L2 ) {
+		wprintf(L"[MineMessage]: Template %u (version %u): %ls\n", templateId, handle->miner.Version(templateId), mined);
+	}
+
+	return templateId;
+}
+
+
+/****
+ * GetMinedTemplate
+ *
+ * DESC:
+ *     Writes out the text of a template a miner found, each parameter in
+ *     it "<*>"
+ *
+ * ARGS:
+ *     handle - miner from OpenTemplateMiner
+ *     templateId - the template, from MineMessage
+ *     buffer - receives the text, null terminated (may be NULL)
+ *     bufferChars - size of the buffer, in characters
+ *     debug - set to 0 (none) 1 (basic) or 2 (verbose)
+ *
+ * RETURNS:
+ *     The size of the text in characters, terminator included, or 0 if
+ *     there is no such template. Nothing is written unless the buffer is
+ *     at least that large
+ */
+extern "C" __declspec(dllexport) DWORD __stdcall GetMinedTemplate(PARSER_MINER *handle, DWORD templateId, LPWSTR buffer, DWORD bufferChars, INT debug)
+{
+	if( handle == NULL || handle->kind != PARSER_HANDLE_MINER ) {
+		fwprintf(stderr, L"[Error][GetMinedTemplate]: Invalid miner handle\n");
+		return 0;
+	}
+
+	LPCWSTR text = handle->miner.Text(templateId);
+
+	if( text == NULL ) {
+		fwprintf(stderr, L"[Error][GetMinedTemplate]: There is no template %u\n", templateId);
+		return 0;
+	}
+
+	DWORD needed = (DWORD)wcslen(text) + 1;
+
+	if( buffer != NULL && bufferChars >= needed )
+		memcpy(buffer, text, needed * sizeof(WCHAR));
+
+	if( debug >= DEBUG_L2 ) {
+		wprintf(L"[GetMinedTemplate]: %u is '%ls'\n", templateId, text);
+	}
+
+	return needed;
+}
+
+
+/****
+ * CloseEventHandle
+ *
+ * DESC:
+ *     Closes a handle from OpenSession, StartSession (or the other
+ *     Start functions), OpenCollector or OpenTemplateMiner
+ *
+ * ARGS:
+ *     handle - the handle to close
+ *     debug - set to 0 (none) 1 (basic) or 2 (verbose)
+ *
+ * RETURNS:
+ *     TRUE if the handle was closed, FALSE if it was not a valid handle
+ *
+ * REMARKS:
+ *     A session with queries still open is only freed once the last of
+ *     them is closed
+ */
+extern "C" __declspec(dllexport) BOOL __stdcall CloseEventHandle(LPVOID handle, INT debug)
+{
+	if( handle == NULL ) {
+		return FALSE;
+	}
+
+	DWORD kind = *(DWORD *)handle;
+
+	if( kind == PARSER_HANDLE_CURSOR ) 
+	{
+		PARSER_CURSOR *cursor = (PARSER_CURSOR *)handle;
+		PARSER_SESSION *owner = cursor->owner;
+
+		if( debug >= DEBUG_L1 ) {
+			wprintf(L"[CloseEventHandle]: Closing query (last record %llu)\n",
+				(unsigned long long)(cursor->catchUp != NULL ? cursor->catchUp->LastRecordId() : cursor->cursor->LastRecordId()));
+		}
+
+		delete cursor->cursor;
+		FreeCatchUp(cursor);
+		cursor->kind = 0;
+		delete cursor;
+
+		owner->cursors--;
+
+		if( owner->closed && owner->cursors == 0 )
+			FreeParserSession(owner);
+
+		return TRUE;
+	}
+
+	if( kind == PARSER_HANDLE_COLLECTOR )
+	{
+		if( debug >= DEBUG_L1 ) {
+			wprintf(L"[CloseEventHandle]: Closing collector (%u hosts)\n", ((PARSER_COLLECTOR *)handle)->collector->Hosts());
+		}
+
+		FreeCollector((PARSER_COLLECTOR *)handle);
+
+		return TRUE;
+	}
+
+	if( kind == PARSER_HANDLE_MINER )
+	{
+		PARSER_MINER *miner = (PARSER_MINER *)handle;
+
+		if( debug >= DEBUG_L1 ) {
+			wprintf(L"[CloseEventHandle]: Closing miner (%u templates of %llu messages)\n", miner->miner.Templates(), (unsigned long long)miner->miner.Messages());
+		}
+
+		miner->kind = 0;
+		delete miner;
+
+		return TRUE;
+	}
+
+	if( kind == PARSER_HANDLE_SESSION ) 
+	{
+		PARSER_SESSION *session = (PARSER_SESSION *)handle;
+
+		if( session->closed )
+			return FALSE;
+
+		if( debug >= DEBUG_L1 ) {
+			wprintf(L"[CloseEventHandle]: Closing session (%u queries still open)\n", session->cursors);
+		}
+
+		session->closed = TRUE;
+
+		if( session->cursors == 0 )
+			FreeParserSession(session);
+
+		return TRUE;
+	}
+
+	fwprintf(stderr, L"[Error][CloseEventHandle]: Invalid handle\n");
+
+	return FALSE;
+}
+
+
 /****
  * ParseEventLogInternal
  *
@@ -74,6 +1950,15 @@ extern "C" __declspec(dllexport) DWORD64 __stdcall ParseEventLog(LPWSTR server,
  *     outputFormat - set to 0 (JSON) otherwise XML
  *     debug - set to 0 (none) 1 (basic) or 2 (verbose)
  *     mode - mode to run the parser (see remarks)
+ *     projection - RECORD_FIELD_* flags of the fields each record has
+ *     filter - if not NULL, compiled into the query in place of query
+ *     sink - where the records go (NULL for STDOUT)
+ *     lastRecordId - if not NULL, receives the last record read (see
+ *                    ParseEventSource)
+ *
+ * RETURNS:
+ *     As ParseEventSource, or 0 if no session could be created (with
+ *     GetLastError saying why)
  *
  * REMARKS:
  *     XPath:
@@ -91,11 +1976,14 @@ extern "C" __declspec(dllexport) DWORD64 __stdcall ParseEventLog(LPWSTR server,
  *     (i.e. the latest) event record. The latter will do the actual
  *     processing of parsing an event log record to the screen.
  *
+ *     Add MODE_RENDER_XML to read the System fields from the event XML
+ *     rather than from the (much cheaper) system values render.
+ *
  *     Note: As per previous discussions, output format is forced as
  *     JSON here. To re-allow XML, simply replace OUTPUT_FORMAT_JSON
  *     with outputFormat, in the line of code, below
  */
-DWORD64 ParseEventLogInternal(LPWSTR server, LPWSTR domain, LPWSTR username, LPWSTR password, LPWSTR logName, LPWSTR query, INT outputFormat, INT debug, INT mode) {	
+DWORD64 ParseEventLogInternal(LPWSTR server, LPWSTR domain, LPWSTR username, LPWSTR password, LPWSTR logName, LPWSTR query, INT outputFormat, INT debug, INT mode, DWORD projection, EventFilter *filter, OutputSink *sink, DWORD64 *lastRecordId) {	
 	bool getLastRecord = false;
 	DWORD64 result = 0;
 
@@ -130,6 +2018,7 @@ DWORD64 ParseEventLogInternal(LPWSTR server, LPWSTR domain, LPWSTR username, LPW
 		// An empty query means it will get ALL records, in which case we are guaranteed
 		// the latest record (i.e. the record ID we want) is the first to be retrieved
 		query = NULL;
+		filter = NULL;
 	} else {
 		if( debug >= DEBUG_L1 ) {
 			if( query == NULL ) {
@@ -148,41 +2037,12 @@ DWORD64 ParseEventLogInternal(LPWSTR server, LPWSTR domain, LPWSTR username, LPW
 		// NOTE: Reaching here does not mean the connection succeeded. It merely 
 		// means that we successfully created the remote context
 
-		if( debug >= DEBUG_L1 ) {
-			wprintf(L"[ParseEventLogInternal]: Attempting to query the EventLog...\n\n", hRemote);
-		}
-
-		// Attempt to query event log in reverse chronological order (newest to oldest)
-		EVT_HANDLE hResults = EvtQuery( hRemote, logName, query, EvtQueryChannelPath | EvtQueryReverseDirection);
-
-		// If the query was successful
-		if (hResults != NULL) 
-		{
-			// Process the first event found
-			DumpEventInfo(hRemote, hResults, outputFormat, getLastRecord ? MODE_FETCH_LAST_RECORD : 0, debug);
-
-			// Process subsequent events
-			result = ProcessResults(hRemote, hResults, outputFormat, getLastRecord ? MODE_FETCH_LAST_RECORD : 0, debug);
-		}
-		else
+		// Everything past the session (query, fetch, render, output) is done by
+		// the portable core against a winevt event source
 		{
-			// Query was not successful. Get the error code
-			DWORD dwError = GetLastError();
+			WinEvtSource source(hRemote);
 
-			if (dwError == ERROR_EVT_CHANNEL_NOT_FOUND) 
-			{
-				fwprintf(stderr, L"[Error][ParseEventLog]: Could not open the '%s' log on this machine.\n", logName);
-			}
-			else if (dwError == ERROR_EVT_INVALID_QUERY)
-			{
-				// You can call the EvtGetExtendedStatus function to try to get 
-				// additional information as to what is wrong with the query.
-				fwprintf(stderr, L"[Error][ParseEventLog]: The specified search query is not valid.\n");
-			}
-			else
-			{
-				fwprintf(stderr, L"[Error][ParseEventLog]: Could not read event logs due to the following Windows error: %lu.\n", dwError);
-			}
+			result = ParseEventSource(&source, logName, query, outputFormat, debug, (getLastRecord ? MODE_FETCH_LAST_RECORD : mode & MODE_FORWARD) | (mode & MODE_RENDER_XML), sink, projection, filter, lastRecordId);
 		}
 
 		// Close the handle to the query we opened
@@ -190,7 +2050,11 @@ DWORD64 ParseEventLogInternal(LPWSTR server, LPWSTR domain, LPWSTR username, LPW
     }
 	else 
 	{
-        fwprintf(stderr, L"[Error][ParseEventLog]: Failed to connect to remote computer. Error code is %d.\n", GetLastError());
+		DWORD dwError = GetLastError();
+
+		fwprintf(stderr, L"[Error][ParseEventLog]: Failed to connect to remote computer. Error code is %d.\n", dwError);
+
+		SetLastError(dwError);
 	}
 
 	return result;
@@ -241,551 +2105,185 @@ EVT_HANDLE CreateRemoteSession(LPWSTR server, LPWSTR domain, LPWSTR username, LP
 
 
 /****
- * ProcessResults
+ * ReadCursorInternal
  *
  * DESC:
- *     Creates a remote context 
+ *     Reads the next events of a query into a sink (see ReadEventsToBuffer)
  *
  * ARGS:
- *     hRemote - Remote session context
- *     hResults - An open set of results
- *     outputFormat - 0 for JSON, otherwise XML
- *     mode - last record vs dump results
+ *     handle - session from OpenSession
+ *     cursor - query from StartSession on that session
+ *     sink - where the records go
+ *     maxEvents - most events to write (0 for the default of 100)
+ *     result - receives the outcome (may be NULL)
  *     debug - set to 0 (none) 1 (basic) or 2 (verbose)
+ *     outputFormat - OUTPUT_FORMAT_JSON, or OUTPUT_FORMAT_BINARY or
+ *                    OUTPUT_FORMAT_IPFIX for a sink that takes binary
+ *                    records
  */
-DWORD64 ProcessResults(EVT_HANDLE hRemote, EVT_HANDLE hResults, int outputFormat, int mode, int debug)
+DWORD ReadCursorInternal(PARSER_SESSION *handle, PARSER_CURSOR *cursor, OutputSink *sink, DWORD maxEvents, READ_RESULT *result, INT debug, INT outputFormat)
 {
-    DWORD64 status = ERROR_SUCCESS;
-    EVT_HANDLE hEvents[CHUNK_SIZE + 1];
-    DWORD dwReturned = 0;
-	BOOL completed = FALSE;	
-	BOOL firstRecordCompleted = FALSE;
-
-	// Print header information for our events
-	if( outputFormat == OUTPUT_FORMAT_JSON ) {
-		// Note: Marc requested this to be removed
-		//wprintf(L"[");
+	DWORD records = 0;
+	DWORD status = ERROR_INVALID_HANDLE;
+	DWORD64 lastRecordId = 0;
+
+	if( cursor == NULL || cursor->kind != PARSER_HANDLE_CURSOR || cursor->owner != handle ) {
+		fwprintf(stderr, L"[Error][ReadEvents]: Invalid session or cursor handle\n");
+	} else if( cursor->catchUp != NULL && outputFormat != OUTPUT_FORMAT_JSON ) {
+		fwprintf(stderr, L"[Error][ReadEvents]: A catch-up can only be read as JSON\n");
+		status = ERROR_NOT_SUPPORTED;
+	} else if( cursor->catchUp != NULL ) {
+		records = cursor->catchUp->Read(maxEvents, sink, debug);
+		status = cursor->catchUp->Status();
+		lastRecordId = cursor->catchUp->LastRecordId();
 	} else {
-		wprintf(L"%s||%s||%s||%s||%s||%s||%s||%s\n\n", L"RecordID", L"EventID", L"Channel", L"Provider", L"Computer", L"TimeCreated", L"Task", L"Level");
+		records = cursor->cursor->Read(maxEvents, sink, outputFormat, handle->mode, debug);
+		status = cursor->cursor->Status();
+		lastRecordId = cursor->cursor->LastRecordId();
 	}
 
-	// Begin an infinite loop, as we want to continue reading records as long as they are available.
-	// The break-condition is a manual one at the bottom (i.e. no more records found)
-    while (TRUE)
-    {
-        // Get a block of events from the result set.
-        if (EvtNext(hResults, CHUNK_SIZE, hEvents, INFINITE, 0, &dwReturned))
-        {
-			// Cycle through all the events that we received
-			for (DWORD i = 0; i < dwReturned; i++)
-			{
-				// Only print the separator characters once the first record is completed
-				if( firstRecordCompleted )
-					wprintf(L"||");
-
-				// Extract event details and output the screen
-				DWORD64 result = DumpEventInfo(hRemote, hEvents[i], outputFormat, mode, debug);
-				
-				// Set flag indicating first record is completed so that
-				// the top of our loop knows to begin printing the separator character
-				firstRecordCompleted = TRUE;
-
-				// Close the handle to the current event, as we are done
-				EvtClose(hEvents[i]);
-
-				// Clear the event handle so our cleanup routine does not attempt to re-close
-				hEvents[i] = NULL;
-
-				// If currently in "last record" mode			
-				if( mode == MODE_FETCH_LAST_RECORD ) {
-					// We do not need to process anymore events
-					// Recall that all we were looking for was the record ID of the most recent record
-					// This should be stored in "status" as, this is the variable that's returned
-					status = result;
-
-					completed = true;
-
-					break;
-				}
-			}
-        }
-		else 
-		{
-			// Call to retrieve events failed. Get the error code
-			status = GetLastError();
-
-			// If the error was the result of not having any more records
-            if (status == ERROR_NO_MORE_ITEMS)
-            {
-				// Exit the loop. No more records to process
-				completed = TRUE;
-            }
-			else 
-			{
-				// Otherwise, notify user of the error
-                fwprintf(stderr, L"Failed to fetch next batch with following error: %lu\n", status);
-			}
-		}
+	if( result != NULL ) {
+		RtlZeroMemory(result, sizeof(READ_RESULT));
 
-		// Cycle through all records that we received
-		// Recall that dwReturned contains the number of records received
-		for (DWORD i = 0; i < dwReturned; i++)
-		{
-			// If the event isn't already closed
-			if (hEvents[i] != NULL) 
-			{
-				// Close the event record
-				EvtClose(hEvents[i]);
-			}
-		}
-
-		// Exit the loop if required (i.e. we're done)
-		if( completed )
-			break;
+		result->records = records;
+		result->status = status;
+		result->lastRecordId = lastRecordId;
 	}
 
-	// Add closing tag if this is JSON
-	if( outputFormat == OUTPUT_FORMAT_JSON ) {
-		// Marc requested this to be removed
-		// wprintf(L"]");
-	}
-
-    return status;
+	return records;
 }
 
 
 /****
- * DumpEventInfo
+ * FreeCatchUp
  *
  * DESC:
- *     This function has two purposes depending on the mode. It will
- *     either (1) Print the contents of an event (if normal mode) or
- *     (2) return the latest record ID (if "last record" mode)
- *
- * ARGS:
- *     hRemote - Remote session context
- *     hResults - An open set of results
- *     outputFormat - 0 for JSON, otherwise XML
- *     mode - last record vs print results
- *     debug - set to 0 (none) 1 (basic) or 2 (verbose)
- *
- * REMARKS:
+ *     Stops a catch-up from StartCatchUp and closes its sessions. The
+ *     cursor itself is left to the caller
  */
-DWORD64 DumpEventInfo(EVT_HANDLE hRemote, EVT_HANDLE hEvent, INT outputFormat, INT mode, INT debug)
+void FreeCatchUp(PARSER_CURSOR *cursor)
 {
-    DWORD64 dwError = ERROR_SUCCESS;
-    DWORD dwBufferSize = 0;
-    DWORD dwBufferUsed = 0;
-    DWORD dwPropertyCount = 0;
-    LPWSTR pwsBuffer = NULL;
-	rapidxml::xml_document<WCHAR> doc;
-
-	if( debug >= DEBUG_L2 ) {
-		wprintf(L"[DumpEventInfo]: Attempting to read event XML with no buffer\n" );
-	}
-
-    // Attempt to read the event as an XML string
-	//
-	// Note: We are expecting this call to fail, as we have NOT provided a buffer. Therefore
-	// the purpose of this call is to fail, and have dwBufferUsed updated with required space	
-    if (!EvtRender(NULL, hEvent, EvtRenderEventXml, dwBufferSize, pwsBuffer, &dwBufferUsed, &dwPropertyCount)) 
-	{
-		// Reading was NOT successful, as expected
-		if( debug >= DEBUG_L2 ) {
-			wprintf(L"[DumpEventInfo]: Required buffer space: %lu\n", dwBufferUsed );
-		}
-
-		// Get the error code
-		dwError = GetLastError();
-
-		if( debug >= DEBUG_L2 ) {
-			wprintf(L"[DumpEventInfo]: Raw error code is: %lu\n", dwError );
-		}
+	delete cursor->catchUp;
+	cursor->catchUp = NULL;
 
-		// If call failed due to insufficient buffer (as we should expect)
-        if (dwError == ERROR_INSUFFICIENT_BUFFER)
-        {
-			if( debug >= DEBUG_L2 ) {
-				wprintf(L"[DumpEventInfo]: Last error code is insufficient buffer (as expecteted)\n" );
-			}
+	for( size_t i = 0; i < cursor->sessions.size(); i++ ) {
+		cursor->sessions[i].session->publishers.Clear();
 
-			// Adjust the buffer size to the required amount as indicated by dwBufferUsed		
-            dwBufferSize = dwBufferUsed;
+		delete cursor->sessions[i].session;
+		delete cursor->sessions[i].source;
 
-			if( debug >= DEBUG_L2 ) {
-				wprintf(L"[DumpEventInfo]: Attempting to reallocate buffer size: %lu\n", dwBufferSize );
-			}
+		EvtClose(cursor->sessions[i].hRemote);
+	}
 
-			// Re-allocate our buffer with the required size
-            pwsBuffer = (LPWSTR)malloc(dwBufferSize);
+	cursor->sessions.clear();
+}
 
-			// If allocaton was successful
-            if (pwsBuffer)
-            {
-				if( debug >= DEBUG_L2 ) {
-					wprintf(L"[DumpEventInfo]: Allocation successful. Re-attempting to read event data\n" );
-				}
 
-				// Re-attempt to read event (as XML) now that we have appropriate buffer size
-                if( EvtRender(NULL, hEvent, EvtRenderEventXml, dwBufferSize, pwsBuffer, &dwBufferUsed, &dwPropertyCount) ) 
-				{
-					if( debug >= DEBUG_L2 ) {
-						wprintf(L"[DumpEventInfo]: Read successful. Last error code is: %lu\n", dwError );
-					}
-
-					// Reading was successful
-					dwError = GetLastError();
-
-					if( debug >= DEBUG_L2 ) {
-						wprintf( L"[DumpEventInfo]: Raw XML: %s\n", pwsBuffer );
-					}
-
-					// Parse the XML string into our XML reader
-					doc.parse<0>( pwsBuffer );
-
-					if( debug >= DEBUG_L2 ) {
-						wprintf( L"[DumpEventInfo]: XML parsing successful\n" );
-					}
-
-					// Retrieve the <Event> node
-					rapidxml::xml_node<WCHAR> *nodeEvent = doc.first_node(L"Event");
-
-					// Retrieve the <System> node
-					rapidxml::xml_node<WCHAR> *nodeSystem = nodeEvent->first_node(L"System");
-					// Children of the <System> node
-					// You will recongize these as elements when viewing the event log in your viewer
-					rapidxml::xml_node<WCHAR> *nodeEventID = nodeSystem->first_node(L"EventID");
-					rapidxml::xml_node<WCHAR> *nodeChannel = nodeSystem->first_node(L"Channel");
-					rapidxml::xml_node<WCHAR> *nodeEventRecordID = nodeSystem->first_node(L"EventRecordID");
-					rapidxml::xml_node<WCHAR> *nodeProvider = nodeSystem->first_node(L"Provider");
-					rapidxml::xml_node<WCHAR> *nodeComputer = nodeSystem->first_node(L"Computer");
-					rapidxml::xml_node<WCHAR> *nodeTimeCreated = nodeSystem->first_node(L"TimeCreated");
-					rapidxml::xml_node<WCHAR> *nodeTask = nodeSystem->first_node(L"Task");
-					rapidxml::xml_node<WCHAR> *nodeLevel = nodeSystem->first_node(L"Level");
-
-					if( debug >= DEBUG_L2 ) {
-						wprintf( L"[DumpEventInfo]: Extracting XML elements successful\n" );
-					}
-
-					// Recall there are two modes. The default mode will parse the event log XML, and the "last record" mode
-					// (called MODE_FETCH_LAST_RECORD) will fetch only the last record and exit afterwards. 
-					if( mode == MODE_FETCH_LAST_RECORD ) {
-						if( debug >= DEBUG_L2 ) {
-							wprintf( L"[DumpEventInfo]: Record ID is '%s'\n", nodeEventRecordID->value() );
-						}
-
-						DWORD64 lastRecord = _wcstoui64( nodeEventRecordID->value(), NULL, 10 );
-
-						if( debug >= DEBUG_L2 ) {
-							wprintf( L"[DumpEventInfo]: Record ID converted to 64-bit number: %I64d\n", lastRecord );
-						}
-
-						return lastRecord;
-					}
-
-					// Extract the publisher name from the <Provider> node
-					// We will need this to lookup the message string for this publisher
-					LPWSTR pwszPublisherName = nodeProvider->first_attribute(L"Name")->value();
-
-					if( debug >= DEBUG_L2 ) {
-						wprintf( L"[DumpEventInfo] Publisher is: %s\n", pwszPublisherName );
-					}
-
-					// Setup an empty string to read the message string
-					LPWSTR pwsMessage = NULL;
-
-					// Get the handle to the provider's metadata that contains the message strings.
-					EVT_HANDLE hProviderMetadata = EvtOpenPublisherMetadata(hRemote, pwszPublisherName, NULL, 0, 0);
-
-					// If a provider handle was found
-					if( hProviderMetadata != NULL ) 
-					{
-						if( debug >= DEBUG_L2 ) {
-							wprintf( L"[DumpEventInfo] Publisher metadata found. Attempting to get message string\n");
-						}
-
-						// Get the message string associated with this event type
-						pwsMessage = GetEventMessageDescription(hProviderMetadata, hEvent);
-
-						// If a message was not found, default to an empty string
-						if( pwsMessage == NULL ) {
-							// Why are we setting to empty string?
-							//pwsMessage = L"";
-
-							if( debug >= DEBUG_L2 ) {
-								wprintf( L"[DumpEventInfo] Message string not found. Assume empty\n");
-							}
-						}
-					}
-					else 
-					{
-						// Publisher/provider cannot be found. Do not display an error message. It occurs all too often when a 
-						// publisher is not found, and skews the JSON results. when it prints itself to the main screen
-						// printf("Error: EvtOpenPublisherMetadata for %s failed with %d\n", pwszPublisherName, GetLastError());						
-
-						// Default the publisher to an empty string so we can continue
-						pwszPublisherName = L"";
-
-						if( debug >= DEBUG_L2 ) {
-							wprintf( L"[DumpEventInfo] Publisher metadata not found. Assume empty\n");
-						}
-					}
-
-					// We have all the results; print them to the screen
-					if( outputFormat == OUTPUT_FORMAT_JSON ) 
-					{
-						wprintf(L"{\"record_id\":\"%s\",\"event_id\":\"%s\",\"logname\":\"%s\",\"source\":\"%s\",\"computer\":\"%s\",\"time_created\":\"%s\",\"task\":\"%s\",\"level\":\"%s\"", 
-							nodeEventRecordID->value(), 
-							nodeEventID->value(), 
-							nodeChannel->value(), 
-							nodeProvider->first_attribute(L"Name")->value(), 
-							nodeComputer->value(), 
-							nodeTimeCreated->first_attribute(L"SystemTime")->value(),
-							nodeTask->value(),
-							nodeLevel->value());
-						
-						// If a message string was found
-						if( pwsMessage != NULL ) 
-						{
-							wprintf(L",\"message\":\"%s\"}", pwsMessage);
-
-							if( debug >= DEBUG_L2 ) {
-								wprintf( L"[DumpEventInfo] Attempting to free pwsMessage\n");
-							}
-
-							free(pwsMessage);
-
-							if( debug >= DEBUG_L2 ) {
-								wprintf( L"[DumpEventInfo] pwsMessage successfully freed\n");
-							}
-						} 
-						else 
-						{
-							wprintf(L",\"message\":\"\"}");
-
-							if( debug >= DEBUG_L2 ) {
-								wprintf( L"[DumpEventInfo] No pwsMessage found to free\n");
-							}
-						}
-					} 
-					else 
-					{
-						// Note: A new line is not printed yet (see next steps)
-						wprintf(L"%s||%s||%s||%s||%s||%s||%s||%s||", 
-							nodeEventRecordID->value(), 
-							nodeEventID->value(), 
-							nodeChannel->value(), 
-							nodeProvider->first_attribute(L"Name")->value(), 
-							nodeComputer->value(), 
-							nodeTimeCreated->first_attribute(L"SystemTime")->value(),
-							nodeTask->value(),
-							nodeLevel->value());
-
-						// If a message string was found
-						if( pwsMessage != NULL ) 
-						{
-							wprintf(L"%s\n", pwsMessage);
-							free(pwsMessage);
-						} 
-						else 
-						{
-							wprintf(L"(no message provided)\n");
-						}
-					}
-				} 
-				else
-				{
-					// Reading was NOT successful
-
-					// This time we were not expecting it to fail. Get the error code
-					dwError = GetLastError();
-
-					// Print error results to the screen
-					fwprintf(stderr, L"[DumpEventInfo] Failed to render results with: %d\n", GetLastError());
-
-					// Free up our allocation
-					free(pwsBuffer);
-				}				
-            }
-            else
-            {
-				// Allocation was unsuccessful
-                fwprintf(stderr, L"[DumpEventInfo] malloc failed\n");
-                dwError = ERROR_OUTOFMEMORY;
-            }
-        }
-	}
+/****
+ * FreeCollector
+ *
+ * DESC:
+ *     Stops a collector from OpenCollector, waiting for calls still going
+ *     to return, then closes its hosts' sessions and frees it
+ */
+void FreeCollector(PARSER_COLLECTOR *handle)
+{
+	delete handle->collector;
 
-	if( debug >= DEBUG_L2 ) {
-		wprintf( L"[DumpEventInfo]: Data dump completed\n" );
+	for( size_t i = 0; i < handle->hosts.size(); i++ ) {
+		SecureZeroMemory(&handle->hosts[i]->password[0], handle->hosts[i]->password.size() * sizeof(WCHAR));
+		delete handle->hosts[i];
 	}
 
-    return dwError;
+	handle->kind = 0;
+	delete handle;
 }
 
 
 /****
- * GetEventMessageDescription
+ * RemoteConnector::Connect
  *
  * DESC:
- *     Gets the specified message string from the event. If the event does not 
- *     contain the specified message, the function returns NULL.
+ *     Opens a remote session to a collector's host, with the credentials
+ *     it was added with (context is its COLLECTOR_HOST)
  *
- * ARGS:
- *     hMetaData - Handle to open metadata for an event
- *     hEvent - Handle to open event
- *
- * RETURNS:
- *     If a message has been found, returns a string containing the message.
- *     Otherwise if no message has been found, returns NULL
- *
- *     Note: Caller is responsible for freeing the memory used by the string
+ * REMARKS:
+ *     winevt only connects once the session is first used, so a host
+ *     that cannot be reached usually fails its first query instead
  */
-LPWSTR GetEventMessageDescription(EVT_HANDLE hMetadata, EVT_HANDLE hEvent)
+EventSource *RemoteConnector::Connect(LPCWSTR host, LPVOID context)
 {
-	// The raw message string
-    LPWSTR pBuffer = NULL;	
-	// The processed message string (make it safe for JSON encoding)
-	LPWSTR done = NULL;	
-	// Size of the message string
-    DWORD dwBufferSize = 0;	
-	// Number of bytes used for message string
-    DWORD dwBufferUsed = 0;		
-	// Type of message string to retrieve from event log
-	EVT_FORMAT_MESSAGE_FLAGS flags = EvtFormatMessageEvent;
+	COLLECTOR_HOST *credentials = (COLLECTOR_HOST *)context;
 
-	// Attempt to read provider-specific message from this event
-    if (!EvtFormatMessage(hMetadata, hEvent, 0, 0, NULL, flags, dwBufferSize, pBuffer, &dwBufferUsed))
-    {
-		// An error occurred. Retrieve this error
-        DWORD dwError = GetLastError();
-
-		// If the error was due to our destination buffer being too small
-        if (dwError == ERROR_INSUFFICIENT_BUFFER)
-        {
-            if ((flags == EvtFormatMessageKeyword))
-                pBuffer[dwBufferSize-1] = L'\0';
-            else
-                dwBufferSize = dwBufferUsed;
-
-			// Re-allocate our buffer with the required size
-            pBuffer = (LPWSTR)malloc(dwBufferSize * sizeof(WCHAR));
-
-			// If the re-allocation was successful
-            if (pBuffer)
-            {
-				// Re-attempt to retrieve event message
-                EvtFormatMessage(hMetadata, hEvent, 0, 0, NULL, flags, dwBufferSize, pBuffer, &dwBufferUsed);
-
-                if ((flags == EvtFormatMessageKeyword))
-                    pBuffer[dwBufferUsed-1] = L'\0';
-
-				// Replace new lines with "\n" characters for client to handle
-				// This makes the string JSON friendly
-				done = repl_wcs(pBuffer, L"\\", L"\\\\");
-            }
-            else
-            {
-				// Allocation failed
-                fwprintf(stderr, L"[Error][GetEventMessageDescription]: malloc failed\n");
-            }
-        }
-        else if (dwError == ERROR_EVT_MESSAGE_NOT_FOUND)
-		{
-			// Message was not found. Will return NULL
-		}
-		else if (dwError == ERROR_EVT_MESSAGE_ID_NOT_FOUND) 
-		{
-			// Message ID not found. Will return NULL
-		}
-        else
-        {
-			// Unexpected error. Output to screen
-            fwprintf(stderr, L"[Error][GetEventMessageDescription]: EvtFormatMessage failed with %u\n", dwError);
-        }
-    }
+	// Official MSDN specs request NULL instead of an empty string
+	LPWSTR domain = credentials->domain.empty() ? NULL : &credentials->domain[0];
 
-	// Return the JSON-friendly string 
-    return done;
-}
+	EVT_HANDLE hRemote = CreateRemoteSession(&credentials->server[0], domain, &credentials->username[0], &credentials->password[0]);
 
-wchar_t *repl_wcs(const wchar_t *str, const wchar_t *old, const wchar_t *new_s) {
+	if( hRemote == NULL )
+		return NULL;
 
-	/* Adjust each of the below values to suit your needs. */
+	WinEvtSource *source = new WinEvtSource(hRemote);
 
-	/* Increment positions cache size initially by this number. */
-	size_t cache_sz_inc = 16;
-	/* Thereafter, each time capacity needs to be increased,
-	 * multiply the increment by this factor. */
-	const size_t cache_sz_inc_factor = 3;
-	/* But never increment capacity by more than this number. */
-	const size_t cache_sz_inc_max = 1048576;
+	std::lock_guard<std::mutex> guard(lock);
 
-	wchar_t *pret, *ret = NULL;
-	const wchar_t *pstr2, *pstr = str;
-	size_t i, count = 0;
-	ptrdiff_t *pos_cache = NULL;
-	size_t cache_sz = 0;
-	size_t cpylen, orglen, retlen, newlen, oldlen = wcslen(old);
+	remotes[source] = hRemote;
 
-	/* Find all matches and cache their positions. */
-	while ((pstr2 = wcsstr(pstr, old)) != NULL) {
-		count++;
+	return source;
+}
 
-		/* Increase the cache size when necessary. */
-		if (cache_sz < count) {
-			cache_sz += cache_sz_inc;
-			pos_cache = (ptrdiff_t*)realloc(pos_cache, sizeof(*pos_cache) * cache_sz);
-			if (pos_cache == NULL) {
-				goto end_repl_wcs;
-			}
-			cache_sz_inc *= cache_sz_inc_factor;
-			if (cache_sz_inc > cache_sz_inc_max) {
-				cache_sz_inc = cache_sz_inc_max;
-			}
-		}
 
-		pos_cache[count-1] = pstr2 - str;
-		pstr = pstr2 + oldlen;
-	}
+void RemoteConnector::Prepare(EVENT_SESSION *session)
+{
+	session->projection = projection;
+	session->eventDataSelection = eventDataSelection;
+	session->templates.SetMode(templatesMode, verifyEvery);
+}
 
-	orglen = pstr - str + wcslen(pstr);
 
-	/* Allocate memory for the post-replacement string. */
-	if (count > 0) {
-		newlen = wcslen(new_s);
-		retlen = orglen + (newlen - oldlen) * count;
-	} else	retlen = orglen;
-	ret = (wchar_t*)malloc((retlen + 1) * sizeof(wchar_t));
-	if (ret == NULL) {
-		goto end_repl_wcs;
-	}
+void RemoteConnector::Disconnect(EventSource *source)
+{
+	EVT_HANDLE hRemote = NULL;
 
-	if (count == 0) {
-		/* If no matches, then just duplicate the string. */
-		wcscpy(ret, str);
-	} else {
-		/* Otherwise, duplicate the string whilst performing
-		 * the replacements using the position cache. */
-		pret = ret;
-		wmemcpy(pret, str, pos_cache[0]);
-		pret += pos_cache[0];
-		for (i = 0; i < count; i++) {
-			wmemcpy(pret, new_s, newlen);
-			pret += newlen;
-			pstr = str + pos_cache[i] + oldlen;
-			cpylen = (i == count-1 ? orglen : pos_cache[i+1]) - pos_cache[i] - oldlen;
-			wmemcpy(pret, pstr, cpylen);
-			pret += cpylen;
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		std::map<EventSource *, EVT_HANDLE>::iterator found = remotes.find(source);
+
+		if( found != remotes.end() ) {
+			hRemote = found->second;
+			remotes.erase(found);
 		}
-		ret[retlen] = L'\0';
 	}
 
-end_repl_wcs:
-	/* Free the cache and return the post-replacement string,
-	 * which will be NULL in the event of an error. */
-	free(pos_cache);
-	return ret;
+	delete source;
+
+	if( hRemote != NULL )
+		EvtClose(hRemote);
+}
+
+
+/****
+ * FreeParserSession
+ *
+ * DESC:
+ *     Frees a session from OpenSession once nothing uses it any more
+ *
+ * REMARKS:
+ *     Publisher handles belong to the session, so they go before it
+ */
+void FreeParserSession(PARSER_SESSION *handle)
+{
+	handle->session->publishers.Clear();
+
+	delete handle->session;
+	delete handle->source;
+
+	EvtClose(handle->hRemote);
+
+	SecureZeroMemory(&handle->password[0], handle->password.size() * sizeof(WCHAR));
+
+	handle->kind = 0;
+	delete handle;
 }
 
 
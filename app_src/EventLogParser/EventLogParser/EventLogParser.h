@@ -2,41 +2,160 @@
 #include <stdio.h>
 #include <tchar.h>
 #include <winevt.h>
-#include "rapidxml.hpp"
+#include "ParserCore.h"
+#include "WinEvtSource.h"
+#include "EventCursor.h"
+#include "ShardedCatchUp.h"
+#include "HostCollector.h"
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
 
 #pragma comment(lib, "wevtapi.lib")
 
-#define CHUNK_SIZE 1
+// Tags of the handles given out by OpenSession, StartSession,
+// OpenCollector and OpenTemplateMiner
+#define PARSER_HANDLE_SESSION 0x4E535345
+#define PARSER_HANDLE_CURSOR 0x52535543
+#define PARSER_HANDLE_COLLECTOR 0x4C4C4F43
+#define PARSER_HANDLE_MINER 0x454E494D
 
-// Default log to use when no log name has been specified
-#define DEFAULT_LOG L"Application"
+// A remote session kept open across polls (OpenSession). mode is what
+// its queries are read with (see SetEventDataFields and
+// SetIdentityExtraction). Its records have the fields SetRecordFields
+// picked, and their messages are formatted as SetMessageFormatting chose.
+// The credentials are kept for the sessions StartCatchUp opens
+struct PARSER_SESSION {
+	DWORD kind;
+	EVT_HANDLE hRemote;
+	WinEvtSource *source;
+	EVENT_SESSION *session;
+	INT mode;
+	DWORD cursors;
+	BOOL closed;
+	std::wstring server;
+	std::wstring domain;
+	std::wstring username;
+	std::wstring password;
+};
 
-// Default max/min record numbers to use when none have been specified
-#define DEFAULT_MIN_RECORD 0
-#define DEFAULT_MAX_RECORD 0xFFFFFFFF
+// One of the remote sessions a catch-up reads through (StartCatchUp)
+struct CATCHUP_SESSION {
+	EVT_HANDLE hRemote;
+	WinEvtSource *source;
+	EVENT_SESSION *session;
+};
 
-// Pass to the "outputFormat" parameter of ParseLogInternal to determine  
-// the output format
-#define OUTPUT_FORMAT_JSON 0
+// A query or subscription kept open across polls (StartSession,
+// StartFilteredSession, StartSubscription), or a catch-up (StartCatchUp),
+// which has catchUp and its sessions instead of cursor
+struct PARSER_CURSOR {
+	DWORD kind;
+	PARSER_SESSION *owner;
+	EventCursor *cursor;
+	ShardedCatchUp *catchUp;
+	std::vector<CATCHUP_SESSION> sessions;
+};
 
-// Pass to the "mode" parameter for ParseLogInternal to determine how it
-// behaves
-#define MODE_DEFAULT 0
-#define MODE_FETCH_LAST_RECORD 1
+// A host added to a collector (AddCollectorHost), with the credentials
+// each of its sessions is opened with
+struct COLLECTOR_HOST {
+	std::wstring server;
+	std::wstring domain;
+	std::wstring username;
+	std::wstring password;
+};
 
-// Debugging levels accepted through the "debug" parameter
-#define DEBUG_NONE 0
-#define DEBUG_L1 1
-#define DEBUG_L2 2 
+// Opens the remote sessions of a collector's hosts, and sets each up as
+// the collector's setup session was (see OpenCollector)
+class RemoteConnector : public HostConnector {
+public:
+	RemoteConnector() : projection(RECORD_FIELDS_ALL), templatesMode(MESSAGES_REMOTE), verifyEvery(MESSAGE_VERIFY_EVERY) {}
+
+	EventSource *Connect(LPCWSTR host, LPVOID context);
+	void Prepare(EVENT_SESSION *session);
+	void Disconnect(EventSource *source);
+
+	DWORD projection;
+	EventDataSelection eventDataSelection;
+	DWORD templatesMode;
+	DWORD verifyEvery;
+
+private:
+	std::mutex lock;
+	std::map<EventSource *, EVT_HANDLE> remotes;
+};
+
+// Many hosts read at once on a pool of threads (OpenCollector)
+struct PARSER_COLLECTOR {
+	DWORD kind;
+	RemoteConnector connector;
+	HostCollector *collector;
+	std::vector<COLLECTOR_HOST *> hosts;
+};
+
+// A template miner of its own, for messages from elsewhere, such as
+// syslog (OpenTemplateMiner)
+struct PARSER_MINER {
+	DWORD kind;
+	TemplateMiner miner;
+};
+
+// Outcome of ReadEventsToBuffer, ReadEventsToUtf8Buffer,
+// ReadEventsToBinaryBuffer, ReadEventsToIpfixBuffer, FlushIpfixFlows,
+// AnnounceIpfixTemplates, ReadEventsToCallback and ParseEventLogForward. Sizes are in bytes for
+// all but ReadEventsToBuffer and ReadEventsToCallback
+struct READ_RESULT {
+	DWORD records;
+	DWORD charsUsed;
+	DWORD charsRequired;
+	DWORD status;
+	DWORD64 lastRecordId;
+};
 
 // Exports
 extern "C" __declspec(dllexport) DWORD64 __stdcall ParseEventLog(LPWSTR, LPWSTR, LPWSTR, LPWSTR, LPWSTR, LPWSTR, INT, INT);
+extern "C" __declspec(dllexport) DWORD64 __stdcall ParseEventLogFields(LPWSTR, LPWSTR, LPWSTR, LPWSTR, LPWSTR, LPWSTR, LPWSTR, INT);
+extern "C" __declspec(dllexport) DWORD64 __stdcall ParseEventLogFiltered(LPWSTR, LPWSTR, LPWSTR, LPWSTR, LPWSTR, LPWSTR, LPWSTR, INT);
+extern "C" __declspec(dllexport) DWORD __stdcall ParseEventLogForward(LPWSTR, LPWSTR, LPWSTR, LPWSTR, LPWSTR, LPWSTR, LPWSTR, DWORD, DWORD, READ_RESULT*, INT);
 extern "C" __declspec(dllexport) DWORD64 __stdcall GetLatestEventLogRecord(LPWSTR, LPWSTR, LPWSTR, LPWSTR, LPWSTR, INT);
+extern "C" __declspec(dllexport) PARSER_SESSION * __stdcall OpenSession(LPWSTR, LPWSTR, LPWSTR, LPWSTR, INT);
+extern "C" __declspec(dllexport) PARSER_CURSOR * __stdcall StartSession(PARSER_SESSION*, LPWSTR, LPWSTR, INT);
+extern "C" __declspec(dllexport) PARSER_CURSOR * __stdcall StartFilteredSession(PARSER_SESSION*, LPWSTR, LPWSTR, INT);
+extern "C" __declspec(dllexport) PARSER_CURSOR * __stdcall StartSubscription(PARSER_SESSION*, LPWSTR, LPWSTR, LPWSTR, DWORD, INT);
+extern "C" __declspec(dllexport) PARSER_CURSOR * __stdcall StartCatchUp(PARSER_SESSION*, LPWSTR, LPWSTR, DWORD, DWORD, INT);
+extern "C" __declspec(dllexport) DWORD __stdcall GetCursorBookmark(PARSER_SESSION*, PARSER_CURSOR*, LPWSTR, DWORD, INT);
+extern "C" __declspec(dllexport) BOOL __stdcall SetEventDataFields(PARSER_SESSION*, LPWSTR, INT);
+extern "C" __declspec(dllexport) BOOL __stdcall SetRecordFields(PARSER_SESSION*, LPWSTR, INT);
+extern "C" __declspec(dllexport) BOOL __stdcall SetIdentityExtraction(PARSER_SESSION*, BOOL, INT);
+extern "C" __declspec(dllexport) BOOL __stdcall SetMessageFormatting(PARSER_SESSION*, INT, DWORD, INT);
+extern "C" __declspec(dllexport) BOOL __stdcall SetIpfixExport(PARSER_SESSION*, LPWSTR, DWORD, DWORD, INT);
+extern "C" __declspec(dllexport) BOOL __stdcall SetIpfixAggregation(PARSER_SESSION*, DWORD, DWORD, DWORD, DWORD, INT);
+extern "C" __declspec(dllexport) BOOL __stdcall SetIpfixMining(PARSER_SESSION*, DWORD, DWORD, DWORD, INT);
+extern "C" __declspec(dllexport) DWORD __stdcall ReadNextEvent(PARSER_SESSION*, PARSER_CURSOR*, DWORD, INT);
+extern "C" __declspec(dllexport) DWORD __stdcall ReadEventsToBuffer(PARSER_SESSION*, PARSER_CURSOR*, LPWSTR, DWORD, DWORD, READ_RESULT*, INT);
+extern "C" __declspec(dllexport) DWORD __stdcall ReadEventsToUtf8Buffer(PARSER_SESSION*, PARSER_CURSOR*, char*, DWORD, DWORD, READ_RESULT*, INT);
+extern "C" __declspec(dllexport) DWORD __stdcall ReadEventsToBinaryBuffer(PARSER_SESSION*, PARSER_CURSOR*, BYTE*, DWORD, DWORD, READ_RESULT*, INT);
+extern "C" __declspec(dllexport) DWORD __stdcall ReadEventsToIpfixBuffer(PARSER_SESSION*, PARSER_CURSOR*, BYTE*, DWORD, DWORD, READ_RESULT*, INT);
+extern "C" __declspec(dllexport) DWORD __stdcall FlushIpfixFlows(PARSER_SESSION*, BYTE*, DWORD, READ_RESULT*, INT);
+extern "C" __declspec(dllexport) DWORD __stdcall AnnounceIpfixTemplates(PARSER_SESSION*, DWORD, BYTE*, DWORD, READ_RESULT*, INT);
+extern "C" __declspec(dllexport) DWORD __stdcall ReadEventsToCallback(PARSER_SESSION*, PARSER_CURSOR*, EVENT_RECORD_CALLBACK, LPVOID, DWORD, READ_RESULT*, INT);
+extern "C" __declspec(dllexport) PARSER_COLLECTOR * __stdcall OpenCollector(PARSER_SESSION*, DWORD, DWORD, DWORD, INT);
+extern "C" __declspec(dllexport) DWORD __stdcall AddCollectorHost(PARSER_COLLECTOR*, LPWSTR, LPWSTR, LPWSTR, LPWSTR, INT);
+extern "C" __declspec(dllexport) BOOL __stdcall AddCollectorChannel(PARSER_COLLECTOR*, DWORD, LPWSTR, LPWSTR, INT);
+extern "C" __declspec(dllexport) DWORD __stdcall CollectEvents(PARSER_COLLECTOR*, DWORD, char*, DWORD, READ_RESULT*, INT);
+extern "C" __declspec(dllexport) BOOL __stdcall GetCollectorHost(PARSER_COLLECTOR*, DWORD, HOST_STATUS*, INT);
+extern "C" __declspec(dllexport) BOOL __stdcall GetCollectorChannel(PARSER_COLLECTOR*, DWORD, DWORD, DWORD64*, INT);
+extern "C" __declspec(dllexport) PARSER_MINER * __stdcall OpenTemplateMiner(DWORD, INT);
+extern "C" __declspec(dllexport) DWORD __stdcall MineMessage(PARSER_MINER*, LPWSTR, LPWSTR, DWORD, DWORD*, INT);
+extern "C" __declspec(dllexport) DWORD __stdcall GetMinedTemplate(PARSER_MINER*, DWORD, LPWSTR, DWORD, INT);
+extern "C" __declspec(dllexport) BOOL __stdcall CloseEventHandle(LPVOID, INT);
 
 // Internal functions
-DWORD64 ParseEventLogInternal(LPWSTR, LPWSTR, LPWSTR, LPWSTR, LPWSTR, LPWSTR, INT, INT, INT);
+DWORD64 ParseEventLogInternal(LPWSTR, LPWSTR, LPWSTR, LPWSTR, LPWSTR, LPWSTR, INT, INT, INT, DWORD = RECORD_FIELDS_ALL, EventFilter* = NULL, OutputSink* = NULL, DWORD64* = NULL);
 EVT_HANDLE CreateRemoteSession(LPWSTR, LPWSTR, LPWSTR, LPWSTR);
-DWORD64 DumpEventInfo(EVT_HANDLE, EVT_HANDLE, INT, INT, INT);
-LPWSTR GetEventMessageDescription(EVT_HANDLE, EVT_HANDLE);
-DWORD64 ProcessResults(EVT_HANDLE, EVT_HANDLE, INT, INT, INT);
-wchar_t *repl_wcs(const wchar_t*, const wchar_t*, const wchar_t*);
+DWORD ReadCursorInternal(PARSER_SESSION*, PARSER_CURSOR*, OutputSink*, DWORD, READ_RESULT*, INT, INT = OUTPUT_FORMAT_JSON);
+void FreeCatchUp(PARSER_CURSOR*);
+void FreeCollector(PARSER_COLLECTOR*);
+void FreeParserSession(PARSER_SESSION*);
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "Platform.h"
+
+/****
+ * EventSource
+ *
+ * DESC:
+ *     Where the parser core gets its events from. One instance stands for
+ *     one session (e.g. one remote connection), and mirrors the winevt
+ *     calls the core makes against it
+ *
+ * REMARKS:
+ *     Every method follows the matching winevt function: handles are
+ *     EVT_HANDLEs, failures return FALSE (or NULL) and leave the reason
+ *     in GetLastError, and short buffers fail with
+ *     ERROR_INSUFFICIENT_BUFFER after reporting the size they need.
+ *
+ *     Query    - EvtQuery against the session
+ *     Next     - EvtNext
+ *     Render   - EvtRender (EvtRenderEventXml or EvtRenderEventValues)
+ *     CreateRenderContext - EvtCreateRenderContext with no value paths
+ *                (EvtRenderContextSystem, or EvtRenderContextUser for
+ *                the values a message's %1..%n insert)
+ *     OpenPublisherMetadata - EvtOpenPublisherMetadata against the session
+ *     FormatEventMessage - EvtFormatMessage with EvtFormatMessageEvent
+ *     GetMessageTemplate - EvtFormatMessage with EvtFormatMessageId, for
+ *                the message the publisher metadata lists for an event ID
+ *                and version. The inserts are left in (see
+ *                MessageTemplates)
+ *     Close    - EvtClose
+ *
+ *     Subscribe - EvtSubscribe against the session, with a signal rather
+ *                than a callback. Next reads the subscription's events
+ *                like a query's, and fails with ERROR_NO_MORE_ITEMS once
+ *                it has handed out everything delivered so far
+ *     WaitForEvents - WaitForSingleObject on the subscription's signal,
+ *                which is reset once it fires. Fails with ERROR_TIMEOUT
+ *                if nothing new arrived in time. The signal starts out
+ *                set, so the first wait returns straight away
+ *     CreateBookmark - EvtCreateBookmark (NULL for an empty bookmark).
+ *                Render with EvtRenderBookmark writes it out as XML
+ *     UpdateBookmark - EvtUpdateBookmark
+ *
+ *     Next is called from the fetch thread while the other calls are made
+ *     from the thread rendering events, so sources must allow that.
+ *     Sources that cannot subscribe leave the last four alone; they fail
+ *     with ERROR_NOT_SUPPORTED.
+ */
+class EventSource {
+public:
+	virtual ~EventSource() {}
+
+	virtual EVT_HANDLE Query(LPCWSTR logName, LPCWSTR query, DWORD flags) = 0;
+	virtual BOOL Next(EVT_HANDLE hResults, DWORD count, EVT_HANDLE *events, DWORD timeout, DWORD *returned) = 0;
+	virtual BOOL Render(EVT_HANDLE hContext, EVT_HANDLE hEvent, DWORD flags, DWORD bufferSize, PVOID buffer, DWORD *bufferUsed, DWORD *propertyCount) = 0;
+	virtual EVT_HANDLE CreateRenderContext(DWORD flags) = 0;
+	virtual EVT_HANDLE OpenPublisherMetadata(LPCWSTR publisherName) = 0;
+	virtual BOOL FormatEventMessage(EVT_HANDLE hMetadata, EVT_HANDLE hEvent, DWORD bufferSize, LPWSTR buffer, DWORD *bufferUsed) = 0;
+	virtual BOOL GetMessageTemplate(EVT_HANDLE hMetadata, DWORD eventId, DWORD version, DWORD bufferSize, LPWSTR buffer, DWORD *bufferUsed) = 0;
+	virtual BOOL Close(EVT_HANDLE hObject) = 0;
+
+	virtual EVT_HANDLE Subscribe(LPCWSTR /*logName*/, LPCWSTR /*query*/, EVT_HANDLE /*hBookmark*/, DWORD /*flags*/) { SetLastError(ERROR_NOT_SUPPORTED); return NULL; }
+	virtual BOOL WaitForEvents(EVT_HANDLE /*hSubscription*/, DWORD /*timeout*/) { SetLastError(ERROR_NOT_SUPPORTED); return FALSE; }
+	virtual EVT_HANDLE CreateBookmark(LPCWSTR /*bookmarkXml*/) { SetLastError(ERROR_NOT_SUPPORTED); return NULL; }
+	virtual BOOL UpdateBookmark(EVT_HANDLE /*hBookmark*/, EVT_HANDLE /*hEvent*/) { SetLastError(ERROR_NOT_SUPPORTED); return FALSE; }
+};
+
+// Kinds of object behind the handles handed out by the non-Windows sources.
+// Those handles point at a SOURCE_OBJECT (or derived struct), so Close can
+// tell what it is releasing
+#define SOURCE_OBJECT_QUERY 1
+#define SOURCE_OBJECT_EVENT 2
+#define SOURCE_OBJECT_PUBLISHER 3
+#define SOURCE_OBJECT_RENDER_CONTEXT 4
+#define SOURCE_OBJECT_SUBSCRIPTION 5
+#define SOURCE_OBJECT_BOOKMARK 6
+
+struct SOURCE_OBJECT {
+	DWORD kind;
+};
@@ -0,0 +1,1052 @@
+#include "EvtxDecoder.h"
+#include "SystemFields.h"
+#include <stdio.h>
+
+// BinXml tokens. Tokens with 0x40 set ("more data") are handled by their base
+#define BINXML_END_OF_STREAM 0x00
+#define BINXML_OPEN_START_ELEMENT 0x01
+#define BINXML_CLOSE_START_ELEMENT 0x02
+#define BINXML_CLOSE_EMPTY_ELEMENT 0x03
+#define BINXML_END_ELEMENT 0x04
+#define BINXML_VALUE 0x05
+#define BINXML_ATTRIBUTE 0x06
+#define BINXML_CDATA 0x07
+#define BINXML_CHAR_REF 0x08
+#define BINXML_ENTITY_REF 0x09
+#define BINXML_PI_TARGET 0x0A
+#define BINXML_PI_DATA 0x0B
+#define BINXML_TEMPLATE_INSTANCE 0x0C
+#define BINXML_NORMAL_SUBSTITUTION 0x0D
+#define BINXML_OPTIONAL_SUBSTITUTION 0x0E
+#define BINXML_FRAGMENT_HEADER 0x0F
+#define BINXML_MORE_DATA 0x40
+
+// Value types found in substitutions
+#define BINXML_TYPE_NULL 0x00
+#define BINXML_TYPE_STRING 0x01
+#define BINXML_TYPE_ANSI_STRING 0x02
+#define BINXML_TYPE_INT8 0x03
+#define BINXML_TYPE_UINT8 0x04
+#define BINXML_TYPE_INT16 0x05
+#define BINXML_TYPE_UINT16 0x06
+#define BINXML_TYPE_INT32 0x07
+#define BINXML_TYPE_UINT32 0x08
+#define BINXML_TYPE_INT64 0x09
+#define BINXML_TYPE_UINT64 0x0A
+#define BINXML_TYPE_REAL32 0x0B
+#define BINXML_TYPE_REAL64 0x0C
+#define BINXML_TYPE_BOOL 0x0D
+#define BINXML_TYPE_BINARY 0x0E
+#define BINXML_TYPE_GUID 0x0F
+#define BINXML_TYPE_SIZE_T 0x10
+#define BINXML_TYPE_FILETIME 0x11
+#define BINXML_TYPE_SYSTEMTIME 0x12
+#define BINXML_TYPE_SID 0x13
+#define BINXML_TYPE_HEX_INT32 0x14
+#define BINXML_TYPE_HEX_INT64 0x15
+#define BINXML_TYPE_BINXML 0x21
+#define BINXML_TYPE_ARRAY 0x80
+
+// Compiled template ops
+#define OP_TEXT 0
+#define OP_SUBSTITUTION 1
+#define OP_ATTRIBUTE_BEGIN 2
+#define OP_ATTRIBUTE_END 3
+#define OP_FIELD_BEGIN 4
+#define OP_FIELD_END 5
+
+// Flags of an OP_SUBSTITUTION (kept in its length)
+#define SUBSTITUTION_OPTIONAL 1
+
+// Embedded BinXml values may nest. Anything deeper than this is corrupt
+#define BINXML_MAX_DEPTH 8
+
+// A value may be substituted more than once, so a record's work can grow
+// with every level it nests. More fragments than this in one record, or
+// more characters of XML, is corrupt as well
+#define BINXML_MAX_FRAGMENTS 4096
+#define EVTX_RECORD_CHARS_MAX (16 * EVTX_CHUNK_SIZE)
+
+// Event record header: signature, size, record ID and written time
+#define EVTX_RECORD_SIGNATURE 0x00002A2A
+#define EVTX_RECORD_HEADER_SIZE 24
+
+static const size_t NO_FIELD = (size_t)-1;
+
+static inline WORD Read16(const BYTE *p)
+{
+	return (WORD)(p[0] | (p[1] << 8));
+}
+
+static inline DWORD Read32(const BYTE *p)
+{
+	return (DWORD)p[0] | ((DWORD)p[1] << 8) | ((DWORD)p[2] << 16) | ((DWORD)p[3] << 24);
+}
+
+static inline ULONGLONG Read64(const BYTE *p)
+{
+	return (ULONGLONG)Read32(p) | ((ULONGLONG)Read32(p + 4) << 32);
+}
+
+
+/****
+ * AppendUtf16
+ *
+ * DESC:
+ *     Appends little-endian UTF-16 from the file to a wide string,
+ *     optionally escaping it for XML on the way
+ *
+ * ARGS:
+ *     to - string to append to
+ *     p - the UTF-16 code units
+ *     units - number of code units
+ *     escape - TRUE to escape the five XML special characters
+ *
+ * REMARKS:
+ *     EvtRender escapes all five in text as well as in attributes
+ */
+static void AppendUtf16(std::wstring &to, const BYTE *p, DWORD units, BOOL escape)
+{
+	for( DWORD i = 0; i < units; i++, p += 2 ) {
+		DWORD unit = Read16(p);
+
+		// Pair up surrogates ourselves where WCHAR is 32 bits
+		if( sizeof(WCHAR) == 4 && unit >= 0xD800 && unit < 0xDC00 && i + 1 < units ) {
+			DWORD low = Read16(p + 2);
+
+			if( low >= 0xDC00 && low < 0xE000 ) {
+				to += (WCHAR)(0x10000 + ((unit - 0xD800) << 10) + (low - 0xDC00));
+				i++;
+				p += 2;
+				continue;
+			}
+		}
+
+		if( escape ) {
+			switch( unit ) {
+			case L'&': to += L"&amp;"; continue;
+			case L'<': to += L"&lt;"; continue;
+			case L'>': to += L"&gt;"; continue;
+			case L'\'': to += L"&apos;"; continue;
+			case L'"': to += L"&quot;"; continue;
+			}
+		}
+
+		to += (WCHAR)unit;
+	}
+}
+
+
+static void AppendUnsigned(std::wstring &to, ULONGLONG value)
+{
+	WCHAR digits[24];
+	int count = 0;
+
+	do {
+		digits[count++] = (WCHAR)(L'0' + value % 10);
+		value /= 10;
+	} while( value != 0 );
+
+	while( count > 0 )
+		to += digits[--count];
+}
+
+
+static void AppendSigned(std::wstring &to, LONGLONG value)
+{
+	if( value < 0 ) {
+		to += L'-';
+		AppendUnsigned(to, (ULONGLONG)0 - (ULONGLONG)value);
+	} else {
+		AppendUnsigned(to, (ULONGLONG)value);
+	}
+}
+
+
+static void AppendHex(std::wstring &to, ULONGLONG value, int minDigits, BOOL upper)
+{
+	LPCWSTR alphabet = upper ? L"0123456789ABCDEF" : L"0123456789abcdef";
+	WCHAR digits[16];
+	int count = 0;
+
+	do {
+		digits[count++] = alphabet[value & 0xF];
+		value >>= 4;
+	} while( value != 0 );
+
+	for( int i = count; i < minDigits; i++ )
+		to += L'0';
+
+	while( count > 0 )
+		to += digits[--count];
+}
+
+
+/****
+ * Unescape
+ *
+ * DESC:
+ *     Undoes the XML escaping of a captured field
+ */
+static void Unescape(const WCHAR *text, size_t length, std::wstring &to)
+{
+	to.clear();
+
+	for( size_t i = 0; i < length; i++ ) {
+		if( text[i] != L'&' ) {
+			to += text[i];
+			continue;
+		}
+
+		size_t end = i + 1;
+
+		while( end < length && text[end] != L';' && end - i < 10 )
+			end++;
+
+		std::wstring entity(text + i + 1, end < length ? end - i - 1 : 0);
+
+		if( end >= length || text[end] != L';' )
+			to += text[i];
+		else if( entity == L"amp" )
+			to += L'&', i = end;
+		else if( entity == L"lt" )
+			to += L'<', i = end;
+		else if( entity == L"gt" )
+			to += L'>', i = end;
+		else if( entity == L"apos" )
+			to += L'\'', i = end;
+		else if( entity == L"quot" )
+			to += L'"', i = end;
+		else if( entity.size() > 1 && entity[0] == L'#' )
+			to += (WCHAR)wcstoul(entity.c_str() + 1, NULL, entity[1] == L'x' ? 0 : 10), i = end;
+		else
+			to += text[i];
+	}
+}
+
+
+EvtxDecoder::EvtxDecoder()
+	: chunk(NULL), fragments(0)
+{
+}
+
+
+EvtxDecoder::~EvtxDecoder()
+{
+	ClearTemplates();
+}
+
+
+void EvtxDecoder::ClearTemplates()
+{
+	for( std::map<DWORD, TEMPLATE*>::iterator it = templates.begin(); it != templates.end(); ++it )
+		delete it->second;
+
+	templates.clear();
+}
+
+
+/****
+ * EvtxDecoder::DecodeChunk
+ *
+ * DESC:
+ *     Decodes every event record in a chunk
+ *
+ * ARGS:
+ *     chunk - start of the chunk (EVTX_CHUNK_SIZE bytes)
+ *     records - receives the decoded records, in file order
+ *
+ * RETURNS:
+ *     TRUE if the chunk header was valid. Records that fail to decode are
+ *     skipped, the rest of the chunk is still read
+ *
+ * REMARKS:
+ *     The chunk and record checksums are not checked: a log that was not
+ *     closed cleanly has stale ones, and a checksum does nothing against a
+ *     crafted file. Instead every offset and size read from the chunk is
+ *     bounds-checked, so any bytes at all decode or fail without reading
+ *     outside it
+ */
+BOOL EvtxDecoder::DecodeChunk(const BYTE *chunk, std::vector<EVTX_RECORD> &records)
+{
+	if( memcmp(chunk, "ElfChnk", 8) != 0 )
+		return FALSE;
+
+	this->chunk = chunk;
+
+	// Template definitions are referenced by their offset in the chunk, so
+	// what was compiled for the previous chunk means nothing here
+	ClearTemplates();
+
+	DWORD freeSpace = Read32(chunk + 48);
+
+	if( freeSpace > EVTX_CHUNK_SIZE || freeSpace < EVTX_CHUNK_HEADER_SIZE )
+		freeSpace = EVTX_CHUNK_SIZE;
+
+	DWORD offset = EVTX_CHUNK_HEADER_SIZE;
+
+	while( offset + EVTX_RECORD_HEADER_SIZE + 4 <= freeSpace ) {
+		const BYTE *header = chunk + offset;
+		DWORD size = Read32(header + 4);
+
+		if( Read32(header) != EVTX_RECORD_SIGNATURE || size < EVTX_RECORD_HEADER_SIZE + 4 || size > freeSpace - offset )
+			break;
+
+		out.clear();
+		fragments = 0;
+		for( int i = 0; i < EVTX_FIELD_COUNT; i++ )
+			fieldBegin[i] = fieldEnd[i] = NO_FIELD;
+
+		if( RenderFragment(header + EVTX_RECORD_HEADER_SIZE, header + size - 4, 0) && fragments <= BINXML_MAX_FRAGMENTS && out.size() <= EVTX_RECORD_CHARS_MAX ) {
+			records.push_back(EVTX_RECORD());
+
+			EVTX_RECORD *record = &records.back();
+
+			record->kind = SOURCE_OBJECT_EVENT;
+			record->record.recordId = Read64(header + 8);
+			record->record.timeCreated = Read64(header + 16);
+
+			FinishRecord(record);
+		}
+
+		offset += size;
+	}
+
+	// Growing the vector moved the strings, so point the records at them again
+	for( size_t i = 0; i < records.size(); i++ ) {
+		records[i].record.provider = records[i].provider.c_str();
+		records[i].record.channel = records[i].channel.c_str();
+		records[i].record.computer = records[i].computer.c_str();
+	}
+
+	return TRUE;
+}
+
+
+/****
+ * EvtxDecoder::FinishRecord
+ *
+ * DESC:
+ *     Fills in a record from what RenderFragment left behind: the XML and
+ *     the bounds of the System fields within it
+ */
+BOOL EvtxDecoder::FinishRecord(EVTX_RECORD *record)
+{
+	std::wstring text;
+
+	for( int i = 0; i < EVTX_FIELD_COUNT; i++ ) {
+		if( fieldBegin[i] == NO_FIELD || fieldEnd[i] == NO_FIELD || fieldEnd[i] < fieldBegin[i] || fieldEnd[i] > out.size() ) {
+			text.clear();
+		} else {
+			Unescape(out.data() + fieldBegin[i], fieldEnd[i] - fieldBegin[i], text);
+		}
+
+		switch( i ) {
+		case EVTX_FIELD_PROVIDER: record->provider = text; break;
+		case EVTX_FIELD_CHANNEL: record->channel = text; break;
+		case EVTX_FIELD_COMPUTER: record->computer = text; break;
+		case EVTX_FIELD_EVENT_ID: record->record.eventId = (DWORD)wcstoul(text.c_str(), NULL, 10); break;
+		case EVTX_FIELD_LEVEL: record->record.level = (DWORD)wcstoul(text.c_str(), NULL, 10); break;
+		case EVTX_FIELD_TASK: record->record.task = (DWORD)wcstoul(text.c_str(), NULL, 10); break;
+		case EVTX_FIELD_VERSION: record->record.version = (DWORD)wcstoul(text.c_str(), NULL, 10); break;
+		case EVTX_FIELD_TIME_CREATED:
+			// Keep the record header's time if the event has none
+			if( !text.empty() )
+				ParseSystemTime(text.c_str(), &record->record.timeCreated);
+			break;
+		case EVTX_FIELD_RECORD_ID:
+			if( !text.empty() )
+				record->record.recordId = _wcstoui64(text.c_str(), NULL, 10);
+			break;
+		}
+	}
+
+	record->xml = out;
+
+	return TRUE;
+}
+
+
+/****
+ * EvtxDecoder::ReadName
+ *
+ * DESC:
+ *     Reads an element, attribute or entity name. Names live in the chunk
+ *     and are referenced by offset; the first use of a name is followed
+ *     by the name itself, which is skipped over
+ *
+ * ARGS:
+ *     p - read position, just past the name offset. Advanced past an
+ *         inline name
+ *     end - end of the data being read
+ *     nameOffset - chunk offset of the name
+ *     name - receives the name
+ *
+ * REMARKS:
+ *     The offset comes from the file, so the bounds are checked without
+ *     adding to it, which could wrap
+ */
+BOOL EvtxDecoder::ReadName(const BYTE *&p, const BYTE *end, DWORD nameOffset, std::wstring &name)
+{
+	if( nameOffset > EVTX_CHUNK_SIZE - 8 )
+		return FALSE;
+
+	DWORD count = Read16(chunk + nameOffset + 6);
+
+	if( count > (EVTX_CHUNK_SIZE - 8 - nameOffset) / 2 )
+		return FALSE;
+
+	// Name structure: next offset (4), hash (2), length (2), UTF-16, NUL (2)
+	if( nameOffset == (DWORD)(p - chunk) ) {
+		if( 10 + count * 2 > (DWORD)(end - p) )
+			return FALSE;
+		p += 10 + count * 2;
+	}
+
+	name.clear();
+	AppendUtf16(name, chunk + nameOffset + 8, count, FALSE);
+
+	return TRUE;
+}
+
+
+/****
+ * EvtxDecoder::Compile
+ *
+ * DESC:
+ *     Compiles a BinXml fragment (usually a template definition) into ops
+ *
+ * ARGS:
+ *     p, end - the fragment
+ *     tpl - receives the ops
+ *
+ * RETURNS:
+ *     TRUE on success, FALSE if the fragment is malformed
+ */
+BOOL EvtxDecoder::Compile(const BYTE *p, const BYTE *end, TEMPLATE *tpl)
+{
+	std::vector<std::wstring> elements;
+	std::vector<int> captures;
+	std::wstring name;
+	BOOL inAttribute = FALSE;
+	int attributeField = -1;
+
+	tpl->ops.clear();
+	tpl->text.clear();
+
+	// Static text is merged into a single op for as long as possible
+	#define EMIT_TEXT(s) do { \
+		if( tpl->ops.empty() || tpl->ops.back().type != OP_TEXT ) { \
+			OP op = { OP_TEXT, 0, (DWORD)tpl->text.size(), 0 }; \
+			tpl->ops.push_back(op); \
+		} \
+		size_t before = tpl->text.size(); \
+		s; \
+		tpl->ops.back().length += (DWORD)(tpl->text.size() - before); \
+	} while( 0 )
+
+	#define EMIT_OP(t, i) do { OP op = { (BYTE)(t), (WORD)(i), 0, 0 }; tpl->ops.push_back(op); } while( 0 )
+
+	while( p < end ) {
+		BYTE token = (BYTE)(*p & ~BINXML_MORE_DATA);
+
+		// An attribute's value runs until the next token that is not a value
+		if( inAttribute && token != BINXML_VALUE && token != BINXML_NORMAL_SUBSTITUTION && token != BINXML_OPTIONAL_SUBSTITUTION
+			&& token != BINXML_CHAR_REF && token != BINXML_ENTITY_REF ) {
+			if( attributeField >= 0 )
+				EMIT_OP(OP_FIELD_END, attributeField);
+			EMIT_OP(OP_ATTRIBUTE_END, 0);
+			inAttribute = FALSE;
+		}
+
+		switch( token ) {
+		case BINXML_END_OF_STREAM:
+			return TRUE;
+
+		case BINXML_FRAGMENT_HEADER:
+			if( p + 4 > end )
+				return FALSE;
+
+			p += 4;
+			break;
+
+		case BINXML_OPEN_START_ELEMENT: {
+			// Token, dependency ID (2), data size (4), name offset (4)
+			if( p + 11 > end )
+				return FALSE;
+
+			BOOL hasAttributes = (*p & BINXML_MORE_DATA) != 0;
+			DWORD nameOffset = Read32(p + 7);
+
+			p += 11;
+			if( !ReadName(p, end, nameOffset, name) )
+				return FALSE;
+
+			// Attribute list size, which we have no use for
+			if( hasAttributes ) {
+				if( p + 4 > end )
+					return FALSE;
+				p += 4;
+			}
+
+			EMIT_TEXT(tpl->text += L'<'; tpl->text += name);
+			elements.push_back(name);
+
+			// Children of <Event><System> whose text is a System field
+			int field = -1;
+
+			if( elements.size() == 3 && elements[0] == L"Event" && elements[1] == L"System" ) {
+				if( name == L"EventID" ) field = EVTX_FIELD_EVENT_ID;
+				else if( name == L"Level" ) field = EVTX_FIELD_LEVEL;
+				else if( name == L"Task" ) field = EVTX_FIELD_TASK;
+				else if( name == L"EventRecordID" ) field = EVTX_FIELD_RECORD_ID;
+				else if( name == L"Channel" ) field = EVTX_FIELD_CHANNEL;
+				else if( name == L"Computer" ) field = EVTX_FIELD_COMPUTER;
+				else if( name == L"Version" ) field = EVTX_FIELD_VERSION;
+			}
+			captures.push_back(field);
+			break;
+		}
+
+		case BINXML_CLOSE_START_ELEMENT:
+			if( elements.empty() )
+				return FALSE;
+
+			EMIT_TEXT(tpl->text += L'>');
+			if( captures.back() >= 0 )
+				EMIT_OP(OP_FIELD_BEGIN, captures.back());
+			p++;
+			break;
+
+		case BINXML_CLOSE_EMPTY_ELEMENT:
+			if( elements.empty() )
+				return FALSE;
+
+			EMIT_TEXT(tpl->text += L"/>");
+			elements.pop_back();
+			captures.pop_back();
+			p++;
+			break;
+
+		case BINXML_END_ELEMENT:
+			if( elements.empty() )
+				return FALSE;
+
+			if( captures.back() >= 0 )
+				EMIT_OP(OP_FIELD_END, captures.back());
+			EMIT_TEXT(tpl->text += L"</"; tpl->text += elements.back(); tpl->text += L'>');
+			elements.pop_back();
+			captures.pop_back();
+			p++;
+			break;
+
+		case BINXML_VALUE: {
+			// Only strings show up as literal values in practice
+			if( p + 4 > end || p[1] != BINXML_TYPE_STRING )
+				return FALSE;
+
+			DWORD count = Read16(p + 2);
+
+			p += 4;
+			if( count * 2 > (DWORD)(end - p) )
+				return FALSE;
+
+			EMIT_TEXT(AppendUtf16(tpl->text, p, count, TRUE));
+			p += count * 2;
+			break;
+		}
+
+		case BINXML_ATTRIBUTE: {
+			if( p + 5 > end || elements.empty() )
+				return FALSE;
+
+			DWORD nameOffset = Read32(p + 1);
+
+			p += 5;
+			if( !ReadName(p, end, nameOffset, name) )
+				return FALSE;
+
+			OP op = { OP_ATTRIBUTE_BEGIN, 0, (DWORD)tpl->text.size(), 0 };
+			tpl->text += L' ';
+			tpl->text += name;
+			tpl->text += L"='";
+			op.length = (DWORD)(tpl->text.size() - op.text);
+			tpl->ops.push_back(op);
+
+			inAttribute = TRUE;
+			attributeField = -1;
+
+			if( elements.size() == 3 && elements[0] == L"Event" && elements[1] == L"System" ) {
+				if( elements[2] == L"Provider" && name == L"Name" )
+					attributeField = EVTX_FIELD_PROVIDER;
+				else if( elements[2] == L"TimeCreated" && name == L"SystemTime" )
+					attributeField = EVTX_FIELD_TIME_CREATED;
+			}
+			if( attributeField >= 0 )
+				EMIT_OP(OP_FIELD_BEGIN, attributeField);
+			break;
+		}
+
+		case BINXML_CDATA: {
+			if( p + 3 > end )
+				return FALSE;
+
+			DWORD count = Read16(p + 1);
+
+			p += 3;
+			if( count * 2 > (DWORD)(end - p) )
+				return FALSE;
+
+			EMIT_TEXT(tpl->text += L"<![CDATA["; AppendUtf16(tpl->text, p, count, FALSE); tpl->text += L"]]>");
+			p += count * 2;
+			break;
+		}
+
+		case BINXML_CHAR_REF:
+			if( p + 3 > end )
+				return FALSE;
+
+			EMIT_TEXT(tpl->text += L"&#"; AppendUnsigned(tpl->text, Read16(p + 1)); tpl->text += L';');
+			p += 3;
+			break;
+
+		case BINXML_ENTITY_REF:
+		case BINXML_PI_TARGET: {
+			if( p + 5 > end )
+				return FALSE;
+
+			DWORD nameOffset = Read32(p + 1);
+
+			p += 5;
+			if( !ReadName(p, end, nameOffset, name) )
+				return FALSE;
+
+			if( token == BINXML_ENTITY_REF )
+				EMIT_TEXT(tpl->text += L'&'; tpl->text += name; tpl->text += L';');
+			else
+				EMIT_TEXT(tpl->text += L"<?"; tpl->text += name);
+			break;
+		}
+
+		case BINXML_PI_DATA: {
+			if( p + 3 > end )
+				return FALSE;
+
+			DWORD count = Read16(p + 1);
+
+			p += 3;
+			if( count * 2 > (DWORD)(end - p) )
+				return FALSE;
+
+			EMIT_TEXT(tpl->text += L' '; AppendUtf16(tpl->text, p, count, FALSE); tpl->text += L"?>");
+			p += count * 2;
+			break;
+		}
+
+		case BINXML_NORMAL_SUBSTITUTION:
+		case BINXML_OPTIONAL_SUBSTITUTION: {
+			// Token, substitution ID (2), value type (1)
+			if( p + 4 > end )
+				return FALSE;
+
+			OP op = { OP_SUBSTITUTION, Read16(p + 1), 0, 0 };
+
+			if( token == BINXML_OPTIONAL_SUBSTITUTION )
+				op.length |= SUBSTITUTION_OPTIONAL;
+
+			tpl->ops.push_back(op);
+			p += 4;
+			break;
+		}
+
+		default:
+			// Includes template instances, which cannot appear inside a template
+			return FALSE;
+		}
+	}
+
+	#undef EMIT_TEXT
+	#undef EMIT_OP
+
+	return TRUE;
+}
+
+
+/****
+ * EvtxDecoder::RenderFragment
+ *
+ * DESC:
+ *     Renders a BinXml fragment (a record, or an embedded BinXml value) as
+ *     XML onto the output
+ *
+ * ARGS:
+ *     p, end - the fragment
+ *     depth - 0 for a record, deeper for embedded values
+ *
+ * RETURNS:
+ *     TRUE on success, FALSE if the fragment is malformed
+ */
+BOOL EvtxDecoder::RenderFragment(const BYTE *p, const BYTE *end, int depth)
+{
+	if( depth > BINXML_MAX_DEPTH || ++fragments > BINXML_MAX_FRAGMENTS || out.size() > EVTX_RECORD_CHARS_MAX )
+		return FALSE;
+
+	while( p < end ) {
+		BYTE token = *p;
+
+		if( token == BINXML_END_OF_STREAM )
+			return TRUE;
+
+		if( token == BINXML_FRAGMENT_HEADER ) {
+			if( p + 4 > end )
+				return FALSE;
+
+			p += 4;
+			continue;
+		}
+
+		if( token != BINXML_TEMPLATE_INSTANCE ) {
+			// Plain BinXml with nothing to substitute
+			TEMPLATE plain;
+
+			if( !Compile(p, end, &plain) )
+				return FALSE;
+
+			Render(&plain, NULL, 0, depth);
+			return TRUE;
+		}
+
+		// Token, unknown (1), template ID (4), definition offset (4)
+		if( p + 10 > end )
+			return FALSE;
+
+		DWORD definition = Read32(p + 6);
+
+		p += 10;
+
+		// Definition: next definition (4), GUID (16), data size (4), data. It
+		// follows inline the first time the template is used in the chunk.
+		// Both come from the file, so the bounds are checked without adding
+		// to them, which could wrap
+		if( definition > EVTX_CHUNK_SIZE - 24 )
+			return FALSE;
+
+		DWORD dataSize = Read32(chunk + definition + 20);
+		const BYTE *data = chunk + definition + 24;
+
+		if( dataSize > EVTX_CHUNK_SIZE - 24 - definition )
+			return FALSE;
+
+		if( definition == (DWORD)(p - chunk) ) {
+			if( 24 + dataSize > (DWORD)(end - p) )
+				return FALSE;
+			p += 24 + dataSize;
+		}
+
+		std::map<DWORD, TEMPLATE*>::iterator found = templates.find(definition);
+		TEMPLATE *tpl;
+
+		if( found != templates.end() ) {
+			tpl = found->second;
+		} else {
+			tpl = new TEMPLATE();
+
+			if( !Compile(data, data + dataSize, tpl) ) {
+				delete tpl;
+				return FALSE;
+			}
+			templates[definition] = tpl;
+		}
+
+		// Values: count (4), a descriptor per value (size (2), type (1), 0),
+		// then the value data back to back
+		if( p + 4 > end )
+			return FALSE;
+
+		DWORD count = Read32(p);
+
+		p += 4;
+		if( count > 0xFFFF || count * 4 > (DWORD)(end - p) )
+			return FALSE;
+
+		std::vector<VALUE> values(count);
+		const BYTE *data2 = p + count * 4;
+
+		for( DWORD i = 0; i < count; i++ ) {
+			values[i].size = Read16(p + i * 4);
+			values[i].type = p[i * 4 + 2];
+			values[i].data = data2;
+
+			if( values[i].size > (DWORD)(end - data2) )
+				return FALSE;
+			data2 += values[i].size;
+		}
+
+		Render(tpl, count > 0 ? &values[0] : NULL, count, depth);
+
+		p = data2;
+	}
+
+	return TRUE;
+}
+
+
+/****
+ * EvtxDecoder::Render
+ *
+ * DESC:
+ *     Runs a compiled template against a set of values
+ */
+void EvtxDecoder::Render(const TEMPLATE *tpl, const VALUE *values, DWORD count, int depth)
+{
+	size_t attributeStart = 0;
+	size_t attributeValue = 0;
+	BOOL attributeEmptyOptional = FALSE;
+
+	for( size_t i = 0; i < tpl->ops.size() && out.size() <= EVTX_RECORD_CHARS_MAX; i++ ) {
+		const OP &op = tpl->ops[i];
+
+		switch( op.type ) {
+		case OP_TEXT:
+			out.append(tpl->text, op.text, op.length);
+			break;
+
+		case OP_ATTRIBUTE_BEGIN:
+			attributeStart = out.size();
+			out.append(tpl->text, op.text, op.length);
+			attributeValue = out.size();
+			attributeEmptyOptional = FALSE;
+			break;
+
+		case OP_ATTRIBUTE_END:
+			// An attribute made of nothing but an empty optional value is left out
+			if( attributeEmptyOptional && out.size() == attributeValue ) {
+				out.resize(attributeStart);
+
+				if( depth == 0 ) {
+					for( int f = 0; f < EVTX_FIELD_COUNT; f++ ) {
+						if( fieldBegin[f] != NO_FIELD && fieldBegin[f] >= attributeStart )
+							fieldBegin[f] = fieldEnd[f] = NO_FIELD;
+					}
+				}
+			} else {
+				out += L'\'';
+			}
+			break;
+
+		case OP_SUBSTITUTION:
+			if( op.id < count && values[op.id].type != BINXML_TYPE_NULL && values[op.id].size > 0 )
+				AppendValue(values[op.id], depth);
+			else if( op.length & SUBSTITUTION_OPTIONAL )
+				attributeEmptyOptional = TRUE;
+			break;
+
+		case OP_FIELD_BEGIN:
+			if( depth == 0 )
+				fieldBegin[op.id] = out.size();
+			break;
+
+		case OP_FIELD_END:
+			if( depth == 0 )
+				fieldEnd[op.id] = out.size();
+			break;
+		}
+	}
+}
+
+
+/****
+ * EvtxDecoder::AppendValue
+ *
+ * DESC:
+ *     Formats a substitution value onto the output
+ */
+void EvtxDecoder::AppendValue(const VALUE &value, int depth)
+{
+	const BYTE *p = value.data;
+	DWORD size = value.size;
+
+	if( value.type & BINXML_TYPE_ARRAY ) {
+		BYTE type = (BYTE)(value.type & ~BINXML_TYPE_ARRAY);
+
+		if( type == BINXML_TYPE_STRING ) {
+			// NUL-terminated strings back to back
+			DWORD units = size / 2;
+			DWORD start = 0;
+			BOOL first = TRUE;
+
+			for( DWORD i = 0; i <= units; i++ ) {
+				if( i == units || Read16(p + i * 2) == 0 ) {
+					if( i > start || i < units ) {
+						if( !first )
+							out += L", ";
+						AppendUtf16(out, p + start * 2, i - start, TRUE);
+						first = FALSE;
+					}
+					start = i + 1;
+				}
+			}
+			return;
+		}
+
+		static const BYTE itemSizes[] = { 0, 0, 0, 1, 1, 2, 2, 4, 4, 8, 8, 4, 8, 4, 0, 16, 8, 8, 16, 0, 4, 8 };
+		DWORD itemSize = type < sizeof(itemSizes) ? itemSizes[type] : 0;
+
+		if( itemSize == 0 ) {
+			for( DWORD i = 0; i < size; i++ )
+				AppendHex(out, p[i], 2, TRUE);
+			return;
+		}
+
+		for( DWORD offset = 0; offset + itemSize <= size; offset += itemSize ) {
+			VALUE item = { p + offset, itemSize, type };
+
+			if( offset > 0 )
+				out += L", ";
+			AppendValue(item, depth);
+		}
+		return;
+	}
+
+	switch( value.type ) {
+	case BINXML_TYPE_STRING: {
+		DWORD units = size / 2;
+
+		while( units > 0 && Read16(p + (units - 1) * 2) == 0 )
+			units--;
+		AppendUtf16(out, p, units, TRUE);
+		break;
+	}
+
+	case BINXML_TYPE_ANSI_STRING:
+		for( DWORD i = 0; i < size && p[i] != 0; i++ ) {
+			BYTE unit[2] = { p[i], 0 };
+			AppendUtf16(out, unit, 1, TRUE);
+		}
+		break;
+
+	case BINXML_TYPE_INT8: AppendSigned(out, (signed char)p[0]); break;
+	case BINXML_TYPE_UINT8: AppendUnsigned(out, p[0]); break;
+	case BINXML_TYPE_INT16: if( size >= 2 ) AppendSigned(out, (short)Read16(p)); break;
+	case BINXML_TYPE_UINT16: if( size >= 2 ) AppendUnsigned(out, Read16(p)); break;
+	case BINXML_TYPE_INT32: if( size >= 4 ) AppendSigned(out, (INT32)Read32(p)); break;
+	case BINXML_TYPE_UINT32: if( size >= 4 ) AppendUnsigned(out, Read32(p)); break;
+	case BINXML_TYPE_INT64: if( size >= 8 ) AppendSigned(out, (LONGLONG)Read64(p)); break;
+	case BINXML_TYPE_UINT64: if( size >= 8 ) AppendUnsigned(out, Read64(p)); break;
+
+	case BINXML_TYPE_REAL32:
+	case BINXML_TYPE_REAL64: {
+		WCHAR text[32];
+		double real;
+
+		if( value.type == BINXML_TYPE_REAL32 && size >= 4 ) {
+			DWORD bits = Read32(p);
+			float single;
+			memcpy(&single, &bits, 4);
+			real = single;
+		} else if( size >= 8 ) {
+			ULONGLONG bits = Read64(p);
+			memcpy(&real, &bits, 8);
+		} else {
+			break;
+		}
+
+		swprintf(text, 32, L"%g", real);
+		out += text;
+		break;
+	}
+
+	case BINXML_TYPE_BOOL:
+		if( size >= 4 )
+			out += Read32(p) != 0 ? L"true" : L"false";
+		break;
+
+	case BINXML_TYPE_GUID:
+		if( size >= 16 ) {
+			out += L'{';
+			AppendHex(out, Read32(p), 8, TRUE);
+			out += L'-';
+			AppendHex(out, Read16(p + 4), 4, TRUE);
+			out += L'-';
+			AppendHex(out, Read16(p + 6), 4, TRUE);
+			out += L'-';
+			for( int i = 8; i < 16; i++ ) {
+				if( i == 10 )
+					out += L'-';
+				AppendHex(out, p[i], 2, TRUE);
+			}
+			out += L'}';
+		}
+		break;
+
+	case BINXML_TYPE_SIZE_T:
+		if( size >= 4 ) {
+			out += L"0x";
+			AppendHex(out, size >= 8 ? Read64(p) : Read32(p), size >= 8 ? 16 : 8, FALSE);
+		}
+		break;
+
+	case BINXML_TYPE_FILETIME:
+		if( size >= 8 ) {
+			WCHAR text[32];
+			out += FormatSystemTime(Read64(p), text);
+		}
+		break;
+
+	case BINXML_TYPE_SYSTEMTIME:
+		if( size >= 16 ) {
+			// year, month, day of week, day, hour, minute, second, milliseconds
+			WORD parts[8];
+			for( int i = 0; i < 8; i++ )
+				parts[i] = Read16(p + i * 2);
+
+			WCHAR text[40];
+			swprintf(text, 40, L"%04u-%02u-%02uT%02u:%02u:%02u.%03u000000Z", parts[0], parts[1], parts[3], parts[4], parts[5], parts[6], parts[7]);
+			out += text;
+		}
+		break;
+
+	case BINXML_TYPE_SID:
+		if( size >= 8 && size >= 8 + (DWORD)p[1] * 4 ) {
+			ULONGLONG authority = 0;
+
+			for( int i = 2; i < 8; i++ )
+				authority = (authority << 8) | p[i];
+
+			out += L"S-";
+			AppendUnsigned(out, p[0]);
+			out += L'-';
+			AppendUnsigned(out, authority);
+			for( DWORD i = 0; i < p[1]; i++ ) {
+				out += L'-';
+				AppendUnsigned(out, Read32(p + 8 + i * 4));
+			}
+		}
+		break;
+
+	case BINXML_TYPE_HEX_INT32:
+		if( size >= 4 ) {
+			out += L"0x";
+			AppendHex(out, Read32(p), 1, FALSE);
+		}
+		break;
+
+	case BINXML_TYPE_HEX_INT64:
+		if( size >= 8 ) {
+			out += L"0x";
+			AppendHex(out, Read64(p), 1, FALSE);
+		}
+		break;
+
+	case BINXML_TYPE_BINXML:
+		// Embedded XML is not escaped; it is markup
+		RenderFragment(p, p + size, depth + 1);
+		break;
+
+	case BINXML_TYPE_BINARY:
+	default:
+		for( DWORD i = 0; i < size; i++ )
+			AppendHex(out, p[i], 2, TRUE);
+		break;
+	}
+}
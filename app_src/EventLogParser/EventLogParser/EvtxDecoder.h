@@ -0,0 +1,103 @@
+#pragma once
+
+#include "Platform.h"
+#include "EventSource.h"
+#include "SourceRecord.h"
+#include <map>
+#include <string>
+#include <vector>
+
+// Layout of an .evtx file: a file header block, then fixed-size chunks that
+// each start with a chunk header (incl. the string and template tables)
+#define EVTX_FILE_HEADER_SIZE 4096
+#define EVTX_CHUNK_SIZE 65536
+#define EVTX_CHUNK_HEADER_SIZE 512
+
+// System fields picked up while a record is decoded
+#define EVTX_FIELD_PROVIDER 0
+#define EVTX_FIELD_EVENT_ID 1
+#define EVTX_FIELD_LEVEL 2
+#define EVTX_FIELD_TASK 3
+#define EVTX_FIELD_TIME_CREATED 4
+#define EVTX_FIELD_RECORD_ID 5
+#define EVTX_FIELD_CHANNEL 6
+#define EVTX_FIELD_COMPUTER 7
+#define EVTX_FIELD_VERSION 8
+#define EVTX_FIELD_COUNT 9
+
+// One decoded event record
+struct EVTX_RECORD : SOURCE_OBJECT {
+	SOURCE_RECORD record;
+	std::wstring provider;
+	std::wstring channel;
+	std::wstring computer;
+	std::wstring xml;
+	void *chunk;
+};
+
+/****
+ * EvtxDecoder
+ *
+ * DESC:
+ *     Turns the event records of one .evtx chunk into the XML EvtRender
+ *     would produce for them, plus their System properties
+ *
+ * REMARKS:
+ *     Records are BinXml. Nearly all of them are a template instance: a
+ *     reference to a template definition stored once in the chunk, and the
+ *     values to substitute into it. Each definition is compiled once per
+ *     chunk into a list of ops (static text, substitutions, attribute
+ *     bounds, System field bounds) so rendering a record is a matter of
+ *     concatenating text and formatted values.
+ *
+ *     Values are formatted the way the rest of the parser expects: decimal
+ *     integers, 0x-prefixed hex types, FormatSystemTime for FILETIMEs, and
+ *     braced upper-case GUIDs. Attributes whose only content is an empty
+ *     optional substitution are left out, as EvtRender does.
+ *
+ *     One decoder per thread. Nothing is shared between instances.
+ */
+class EvtxDecoder {
+public:
+	EvtxDecoder();
+	~EvtxDecoder();
+
+	BOOL DecodeChunk(const BYTE *chunk, std::vector<EVTX_RECORD> &records);
+
+private:
+	struct OP {
+		BYTE type;
+		WORD id;
+		DWORD text;
+		DWORD length;
+	};
+
+	struct TEMPLATE {
+		std::vector<OP> ops;
+		std::wstring text;
+	};
+
+	struct VALUE {
+		const BYTE *data;
+		DWORD size;
+		BYTE type;
+	};
+
+	EvtxDecoder(const EvtxDecoder &);
+	EvtxDecoder &operator=(const EvtxDecoder &);
+
+	void ClearTemplates();
+	BOOL ReadName(const BYTE *&p, const BYTE *end, DWORD nameOffset, std::wstring &name);
+	BOOL Compile(const BYTE *p, const BYTE *end, TEMPLATE *tpl);
+	BOOL RenderFragment(const BYTE *p, const BYTE *end, int depth);
+	void Render(const TEMPLATE *tpl, const VALUE *values, DWORD count, int depth);
+	void AppendValue(const VALUE &value, int depth);
+	BOOL FinishRecord(EVTX_RECORD *record);
+
+	const BYTE *chunk;
+	std::map<DWORD, TEMPLATE*> templates;
+	std::wstring out;
+	DWORD fragments;
+	size_t fieldBegin[EVTX_FIELD_COUNT];
+	size_t fieldEnd[EVTX_FIELD_COUNT];
+};
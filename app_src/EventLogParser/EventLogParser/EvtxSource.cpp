@@ -0,0 +1,399 @@
+#include "EvtxSource.h"
+#include <algorithm>
+#include <chrono>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Chunks decoded ahead of the consumer, per worker thread
+#define EVTX_CHUNKS_PER_WORKER 2
+
+// Offset of the first record identifier in a chunk header
+#define EVTX_CHUNK_FIRST_RECORD_ID 24
+
+/****
+ * EvtxSource::EvtxSource
+ *
+ * ARGS:
+ *     threads - number of decode threads per query (0 = one per CPU)
+ */
+EvtxSource::EvtxSource(DWORD threads)
+	: threads(threads), mapping(NULL), mappingSize(0)
+{
+	if( this->threads == 0 )
+		this->threads = std::thread::hardware_concurrency();
+	if( this->threads == 0 )
+		this->threads = 1;
+
+	renderContext.kind = SOURCE_OBJECT_RENDER_CONTEXT;
+}
+
+
+EvtxSource::~EvtxSource()
+{
+	if( mapping != NULL )
+		munmap(mapping, mappingSize);
+}
+
+
+/****
+ * EvtxSource::Open
+ *
+ * DESC:
+ *     Maps an .evtx file and indexes its chunks
+ *
+ * ARGS:
+ *     path - path of the file
+ *
+ * RETURNS:
+ *     TRUE if the file is an event log file, FALSE otherwise
+ */
+BOOL EvtxSource::Open(const char *path)
+{
+	int fd = open(path, O_RDONLY);
+
+	if( fd < 0 ) {
+		fwprintf(stderr, L"[Error][EvtxSource]: Could not open '%s'\n", path);
+		return FALSE;
+	}
+
+	struct stat info;
+
+	if( fstat(fd, &info) != 0 || (size_t)info.st_size < EVTX_FILE_HEADER_SIZE ) {
+		fwprintf(stderr, L"[Error][EvtxSource]: '%s' is too small to be an event log file\n", path);
+		close(fd);
+		return FALSE;
+	}
+
+	void *view = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if( view == MAP_FAILED ) {
+		fwprintf(stderr, L"[Error][EvtxSource]: Could not map '%s'\n", path);
+		return FALSE;
+	}
+
+	// Chunks are read front to back by the workers
+	madvise(view, (size_t)info.st_size, MADV_SEQUENTIAL);
+
+	mapping = (BYTE *)view;
+	mappingSize = (size_t)info.st_size;
+
+	if( memcmp(mapping, "ElfFile", 8) != 0 ) {
+		fwprintf(stderr, L"[Error][EvtxSource]: '%s' is not an event log file\n", path);
+		return FALSE;
+	}
+
+	// The header's chunk count is not trusted; a log that was not closed
+	// cleanly can have more. Every block with a chunk signature is used
+	for( size_t offset = EVTX_FILE_HEADER_SIZE; offset + EVTX_CHUNK_SIZE <= mappingSize; offset += EVTX_CHUNK_SIZE ) {
+		const BYTE *data = mapping + offset;
+
+		if( memcmp(data, "ElfChnk", 8) != 0 )
+			continue;
+
+		MAPPED_CHUNK chunk;
+		chunk.data = data;
+		memcpy(&chunk.firstRecord, data + EVTX_CHUNK_FIRST_RECORD_ID, sizeof(chunk.firstRecord));
+		chunks.push_back(chunk);
+	}
+
+	// Once the file has wrapped, the oldest chunk is not the first one
+	std::sort(chunks.begin(), chunks.end(), [](const MAPPED_CHUNK &a, const MAPPED_CHUNK &b) { return a.firstRecord < b.firstRecord; });
+
+	return TRUE;
+}
+
+
+EVT_HANDLE EvtxSource::Query(LPCWSTR /*logName*/, LPCWSTR /*query*/, DWORD flags)
+{
+	if( mapping == NULL ) {
+		SetLastError(ERROR_EVT_CHANNEL_NOT_FOUND);
+		return NULL;
+	}
+
+	QUERY *results = new QUERY();
+
+	results->kind = SOURCE_OBJECT_QUERY;
+	results->reverse = (flags & EvtQueryForwardDirection) ? FALSE : TRUE;
+	results->current = 0;
+	results->nextDecode = 0;
+	results->window = threads * EVTX_CHUNKS_PER_WORKER + 2;
+	results->open = 0;
+	results->stopping = FALSE;
+	results->closed = FALSE;
+	results->chunks.resize(chunks.size());
+
+	for( size_t i = 0; i < chunks.size(); i++ ) {
+		CHUNK *chunk = &results->chunks[i];
+
+		chunk->query = results;
+		chunk->data = chunks[results->reverse ? chunks.size() - 1 - i : i].data;
+		chunk->decoded = FALSE;
+		chunk->handedOut = 0;
+		chunk->open = 0;
+	}
+
+	DWORD workers = threads;
+
+	if( workers > chunks.size() )
+		workers = chunks.size() > 0 ? (DWORD)chunks.size() : 1;
+
+	try {
+		for( DWORD i = 0; i < workers; i++ )
+			results->workers.push_back(std::thread(&EvtxSource::Decode, results));
+	} catch( ... ) {
+		fwprintf(stderr, L"[Error][EvtxSource]: Could not start the decode threads\n");
+		CloseQuery(results);
+		SetLastError(ERROR_OUTOFMEMORY);
+		return NULL;
+	}
+
+	return results;
+}
+
+
+/****
+ * EvtxSource::Decode
+ *
+ * DESC:
+ *     Body of a decode thread. Takes the next chunk inside the window,
+ *     decodes it and publishes its records
+ */
+void EvtxSource::Decode(QUERY *results)
+{
+	EvtxDecoder decoder;
+
+	while( TRUE ) {
+		CHUNK *chunk;
+
+		{
+			std::unique_lock<std::mutex> guard(results->lock);
+
+			results->changed.wait(guard, [results] {
+				return results->stopping || results->nextDecode >= results->chunks.size()
+					|| results->nextDecode < results->current + results->window;
+			});
+
+			if( results->stopping || results->nextDecode >= results->chunks.size() )
+				return;
+
+			chunk = &results->chunks[results->nextDecode++];
+		}
+
+		std::vector<EVTX_RECORD> records;
+
+		records.reserve(EVTX_CHUNK_SIZE / 512);
+		decoder.DecodeChunk(chunk->data, records);
+
+		for( size_t i = 0; i < records.size(); i++ )
+			records[i].chunk = chunk;
+
+		std::lock_guard<std::mutex> guard(results->lock);
+
+		chunk->records.swap(records);
+		chunk->decoded = TRUE;
+		results->changed.notify_all();
+	}
+}
+
+
+/****
+ * EvtxSource::ReleaseChunk
+ *
+ * DESC:
+ *     Frees a chunk's records once nothing can reach them any more
+ *
+ * REMARKS:
+ *     Called with the query lock held
+ */
+void EvtxSource::ReleaseChunk(CHUNK *chunk)
+{
+	if( chunk->decoded && chunk->open == 0 && chunk->handedOut == chunk->records.size() )
+		std::vector<EVTX_RECORD>().swap(chunk->records);
+}
+
+
+BOOL EvtxSource::Next(EVT_HANDLE hResults, DWORD count, EVT_HANDLE *events, DWORD timeout, DWORD *returned)
+{
+	QUERY *results = (QUERY *)hResults;
+
+	*returned = 0;
+
+	if( results == NULL || results->kind != SOURCE_OBJECT_QUERY ) {
+		SetLastError(ERROR_INVALID_HANDLE);
+		return FALSE;
+	}
+
+	std::unique_lock<std::mutex> guard(results->lock);
+
+	while( *returned < count && results->current < results->chunks.size() ) {
+		CHUNK *chunk = &results->chunks[results->current];
+
+		if( !chunk->decoded ) {
+			// Hand back what we already have rather than wait on a worker;
+			// the caller may need to close those handles before we get more
+			if( *returned > 0 )
+				break;
+
+			auto ready = [chunk] { return chunk->decoded != FALSE; };
+
+			if( timeout == INFINITE ) {
+				results->changed.wait(guard, ready);
+			} else if( !results->changed.wait_for(guard, std::chrono::milliseconds(timeout), ready) ) {
+				SetLastError(ERROR_TIMEOUT);
+				return FALSE;
+			}
+		}
+
+		while( *returned < count && chunk->handedOut < chunk->records.size() ) {
+			size_t next = chunk->handedOut++;
+
+			// Records are in file order; newest first means back to front
+			events[(*returned)++] = &chunk->records[results->reverse ? chunk->records.size() - 1 - next : next];
+			chunk->open++;
+			results->open++;
+		}
+
+		if( chunk->handedOut == chunk->records.size() ) {
+			ReleaseChunk(chunk);
+			results->current++;
+			results->changed.notify_all();
+		}
+	}
+
+	if( *returned == 0 ) {
+		SetLastError(ERROR_NO_MORE_ITEMS);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+
+BOOL EvtxSource::Render(EVT_HANDLE hContext, EVT_HANDLE hEvent, DWORD flags, DWORD bufferSize, PVOID buffer, DWORD *bufferUsed, DWORD *propertyCount)
+{
+	EVTX_RECORD *record = (EVTX_RECORD *)hEvent;
+
+	if( record == NULL || record->kind != SOURCE_OBJECT_EVENT ) {
+		SetLastError(ERROR_INVALID_HANDLE);
+		return FALSE;
+	}
+
+	if( flags == EvtRenderEventXml ) {
+		*propertyCount = 0;
+		return CopyRenderedText(record->xml.c_str(), record->xml.size(), bufferSize, buffer, bufferUsed);
+	}
+
+	if( flags == EvtRenderEventValues && hContext == &renderContext )
+		return RenderRecordValues(&record->record, bufferSize, buffer, bufferUsed, propertyCount);
+
+	SetLastError(ERROR_INVALID_PARAMETER);
+	return FALSE;
+}
+
+
+EVT_HANDLE EvtxSource::CreateRenderContext(DWORD flags)
+{
+	if( flags != EvtRenderContextSystem ) {
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return NULL;
+	}
+
+	return &renderContext;
+}
+
+
+EVT_HANDLE EvtxSource::OpenPublisherMetadata(LPCWSTR /*publisherName*/)
+{
+	SetLastError(ERROR_EVT_PUBLISHER_METADATA_NOT_FOUND);
+	return NULL;
+}
+
+
+BOOL EvtxSource::FormatEventMessage(EVT_HANDLE hMetadata, EVT_HANDLE /*hEvent*/, DWORD /*bufferSize*/, LPWSTR /*buffer*/, DWORD * /*bufferUsed*/)
+{
+	SetLastError(hMetadata == NULL ? ERROR_INVALID_HANDLE : ERROR_EVT_MESSAGE_NOT_FOUND);
+	return FALSE;
+}
+
+
+BOOL EvtxSource::GetMessageTemplate(EVT_HANDLE hMetadata, DWORD /*eventId*/, DWORD /*version*/, DWORD /*bufferSize*/, LPWSTR /*buffer*/, DWORD * /*bufferUsed*/)
+{
+	SetLastError(hMetadata == NULL ? ERROR_INVALID_HANDLE : ERROR_EVT_MESSAGE_NOT_FOUND);
+	return FALSE;
+}
+
+
+/****
+ * EvtxSource::CloseQuery
+ *
+ * DESC:
+ *     Stops the decode threads. The query itself goes away once the last
+ *     of its event handles is closed
+ */
+void EvtxSource::CloseQuery(QUERY *results)
+{
+	{
+		std::lock_guard<std::mutex> guard(results->lock);
+		results->stopping = TRUE;
+		results->changed.notify_all();
+	}
+
+	for( size_t i = 0; i < results->workers.size(); i++ ) {
+		if( results->workers[i].joinable() )
+			results->workers[i].join();
+	}
+
+	BOOL last;
+
+	{
+		std::lock_guard<std::mutex> guard(results->lock);
+		results->closed = TRUE;
+		last = results->open == 0;
+	}
+
+	if( last )
+		delete results;
+}
+
+
+void EvtxSource::CloseEvent(EVTX_RECORD *record)
+{
+	CHUNK *chunk = (CHUNK *)record->chunk;
+	QUERY *results = chunk->query;
+	BOOL last;
+
+	{
+		std::lock_guard<std::mutex> guard(results->lock);
+
+		chunk->open--;
+		results->open--;
+		ReleaseChunk(chunk);
+
+		last = results->closed && results->open == 0;
+	}
+
+	if( last )
+		delete results;
+}
+
+
+BOOL EvtxSource::Close(EVT_HANDLE hObject)
+{
+	SOURCE_OBJECT *object = (SOURCE_OBJECT *)hObject;
+
+	if( object == NULL ) {
+		SetLastError(ERROR_INVALID_HANDLE);
+		return FALSE;
+	}
+
+	if( object->kind == SOURCE_OBJECT_QUERY )
+		CloseQuery((QUERY *)object);
+	else if( object->kind == SOURCE_OBJECT_EVENT )
+		CloseEvent((EVTX_RECORD *)object);
+
+	return TRUE;
+}
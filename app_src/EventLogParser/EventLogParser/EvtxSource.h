@@ -0,0 +1,93 @@
+#pragma once
+
+#include "Platform.h"
+#include "EventSource.h"
+#include "EvtxDecoder.h"
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/****
+ * EvtxSource
+ *
+ * DESC:
+ *     Event source that reads an exported or archived .evtx file directly,
+ *     without winevt. Open maps the file; every query walks its chunks
+ *     and decodes them on a pool of worker threads
+ *
+ * REMARKS:
+ *     The file is the log, so the channel passed to Query is not applied
+ *     (nor is the XPath query). Chunks are handed out newest first unless
+ *     asked for EvtQueryForwardDirection.
+ *
+ *     Decoding runs at most a few chunks ahead of the consumer, so memory
+ *     stays bounded however large the file is. A chunk's records are freed
+ *     once they have all been handed out and their handles closed.
+ *
+ *     A file carries no message tables, so there is no publisher metadata:
+ *     OpenPublisherMetadata always fails with
+ *     ERROR_EVT_PUBLISHER_METADATA_NOT_FOUND and events have no description.
+ */
+class EvtxSource : public EventSource {
+public:
+	EvtxSource(DWORD threads = 0);
+	~EvtxSource();
+
+	BOOL Open(const char *path);
+	DWORD Chunks() const { return (DWORD)chunks.size(); }
+
+	EVT_HANDLE Query(LPCWSTR logName, LPCWSTR query, DWORD flags);
+	BOOL Next(EVT_HANDLE hResults, DWORD count, EVT_HANDLE *events, DWORD timeout, DWORD *returned);
+	BOOL Render(EVT_HANDLE hContext, EVT_HANDLE hEvent, DWORD flags, DWORD bufferSize, PVOID buffer, DWORD *bufferUsed, DWORD *propertyCount);
+	EVT_HANDLE CreateRenderContext(DWORD flags);
+	EVT_HANDLE OpenPublisherMetadata(LPCWSTR publisherName);
+	BOOL FormatEventMessage(EVT_HANDLE hMetadata, EVT_HANDLE hEvent, DWORD bufferSize, LPWSTR buffer, DWORD *bufferUsed);
+	BOOL GetMessageTemplate(EVT_HANDLE hMetadata, DWORD eventId, DWORD version, DWORD bufferSize, LPWSTR buffer, DWORD *bufferUsed);
+	BOOL Close(EVT_HANDLE hObject);
+
+private:
+	struct QUERY;
+
+	struct CHUNK {
+		QUERY *query;
+		const BYTE *data;
+		std::vector<EVTX_RECORD> records;
+		BOOL decoded;
+		size_t handedOut;
+		size_t open;
+	};
+
+	struct QUERY : SOURCE_OBJECT {
+		std::vector<CHUNK> chunks;
+		BOOL reverse;
+		size_t current;
+		size_t nextDecode;
+		size_t window;
+		size_t open;
+		BOOL stopping;
+		BOOL closed;
+		std::mutex lock;
+		std::condition_variable changed;
+		std::vector<std::thread> workers;
+	};
+
+	struct MAPPED_CHUNK {
+		const BYTE *data;
+		ULONGLONG firstRecord;
+	};
+
+	EvtxSource(const EvtxSource &);
+	EvtxSource &operator=(const EvtxSource &);
+
+	static void Decode(QUERY *results);
+	static void ReleaseChunk(CHUNK *chunk);
+	void CloseQuery(QUERY *results);
+	void CloseEvent(EVTX_RECORD *record);
+
+	DWORD threads;
+	BYTE *mapping;
+	size_t mappingSize;
+	std::vector<MAPPED_CHUNK> chunks;
+	SOURCE_OBJECT renderContext;
+};
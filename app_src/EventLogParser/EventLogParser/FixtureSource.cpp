@@ -0,0 +1,938 @@
+#include "FixtureSource.h"
+#include "SystemFields.h"
+#include <algorithm>
+#include <chrono>
+#include <dirent.h>
+#include <stdio.h>
+#include <wctype.h>
+
+/****
+ * AppendCodePoint
+ *
+ * DESC:
+ *     Appends a Unicode code point to a wide string, as a surrogate pair
+ *     where WCHAR is 16 bits
+ */
+static void AppendCodePoint(std::wstring &out, DWORD cp)
+{
+	if( sizeof(WCHAR) == 2 && cp >= 0x10000 ) {
+		cp -= 0x10000;
+		out += (WCHAR)(0xD800 + (cp >> 10));
+		out += (WCHAR)(0xDC00 + (cp & 0x3FF));
+	} else {
+		out += (WCHAR)cp;
+	}
+}
+
+
+/****
+ * DecodeFixtureText
+ *
+ * DESC:
+ *     Turns the raw bytes of a fixture file into a wide string
+ *
+ * ARGS:
+ *     bytes - file contents
+ *     out - receives the text
+ *
+ * REMARKS:
+ *     A UTF-16LE BOM selects UTF-16LE, anything else is read as UTF-8.
+ *     Malformed sequences become U+FFFD
+ */
+static void DecodeFixtureText(const std::string &bytes, std::wstring &out)
+{
+	const unsigned char *p = (const unsigned char *)bytes.data();
+	size_t size = bytes.size();
+
+	out.clear();
+	out.reserve(size);
+
+	if( size >= 2 && p[0] == 0xFF && p[1] == 0xFE ) {
+		for( size_t i = 2; i + 1 < size; i += 2 ) {
+			DWORD unit = p[i] | (p[i + 1] << 8);
+
+			// Pair up surrogates ourselves where WCHAR is 32 bits
+			if( sizeof(WCHAR) == 4 && unit >= 0xD800 && unit < 0xDC00 && i + 3 < size ) {
+				DWORD low = p[i + 2] | (p[i + 3] << 8);
+
+				if( low >= 0xDC00 && low < 0xE000 ) {
+					AppendCodePoint(out, 0x10000 + ((unit - 0xD800) << 10) + (low - 0xDC00));
+					i += 2;
+					continue;
+				}
+			}
+			out += (WCHAR)unit;
+		}
+		return;
+	}
+
+	size_t i = 0;
+
+	if( size >= 3 && p[0] == 0xEF && p[1] == 0xBB && p[2] == 0xBF )
+		i = 3;
+
+	while( i < size ) {
+		DWORD cp = p[i];
+		DWORD extra = cp < 0x80 ? 0 : cp >= 0xF0 ? 3 : cp >= 0xE0 ? 2 : cp >= 0xC0 ? 1 : 4;
+
+		// Stray continuation byte
+		if( extra == 4 ) {
+			AppendCodePoint(out, 0xFFFD);
+			i++;
+			continue;
+		}
+
+		if( extra > 0 )
+			cp &= 0x3F >> extra;
+
+		BOOL valid = TRUE;
+
+		for( DWORD k = 1; k <= extra; k++ ) {
+			if( i + k >= size || (p[i + k] & 0xC0) != 0x80 ) {
+				valid = FALSE;
+				break;
+			}
+			cp = (cp << 6) | (p[i + k] & 0x3F);
+		}
+
+		if( !valid ) {
+			AppendCodePoint(out, 0xFFFD);
+			i++;
+			continue;
+		}
+
+		AppendCodePoint(out, cp);
+		i += extra + 1;
+	}
+}
+
+
+/****
+ * ChildValue
+ *
+ * DESC:
+ *     Null-safe lookup of a child element's value (or an attribute of it)
+ */
+static LPCWSTR ChildValue(rapidxml::xml_node<WCHAR> *parent, LPCWSTR name, LPCWSTR attribute = NULL)
+{
+	rapidxml::xml_node<WCHAR> *node = parent != NULL ? parent->first_node(name) : NULL;
+
+	if( node == NULL )
+		return L"";
+
+	if( attribute == NULL )
+		return node->value();
+
+	rapidxml::xml_attribute<WCHAR> *attr = node->first_attribute(attribute);
+
+	return attr != NULL ? attr->value() : L"";
+}
+
+
+/****
+ * SameText
+ *
+ * DESC:
+ *     Case-insensitive comparison, as channel names are matched by winevt
+ */
+static BOOL SameText(LPCWSTR a, LPCWSTR b)
+{
+	for( ; *a != L'\0' && *b != L'\0'; a++, b++ ) {
+		if( towlower(*a) != towlower(*b) )
+			return FALSE;
+	}
+
+	return *a == *b;
+}
+
+
+/****
+ * FixtureSource::FixtureSource
+ *
+ * ARGS:
+ *     repeat - number of times each query replays its events
+ */
+FixtureSource::FixtureSource(DWORD repeat)
+	: repeat(repeat > 0 ? repeat : 1), appended(0), highRecord(0)
+{
+	renderContext.kind = SOURCE_OBJECT_RENDER_CONTEXT;
+	userContext.kind = SOURCE_OBJECT_RENDER_CONTEXT;
+}
+
+
+FixtureSource::~FixtureSource()
+{
+	for( size_t i = 0; i < events.size(); i++ )
+		delete events[i];
+
+	for( std::map<std::wstring, PUBLISHER*>::iterator it = publishers.begin(); it != publishers.end(); ++it )
+		delete it->second;
+
+	for( size_t i = 0; i < subscriptions.size(); i++ )
+		delete subscriptions[i];
+}
+
+
+/****
+ * FixtureSource::Load
+ *
+ * DESC:
+ *     Reads every *.xml file in a directory
+ *
+ * ARGS:
+ *     directory - path of the fixture directory
+ *
+ * RETURNS:
+ *     TRUE if the directory was read and held at least one event
+ */
+BOOL FixtureSource::Load(const char *directory)
+{
+	DIR *dir = opendir(directory);
+
+	if( dir == NULL ) {
+		fwprintf(stderr, L"[Error][FixtureSource]: Could not open fixture directory '%s'\n", directory);
+		return FALSE;
+	}
+
+	std::vector<std::string> files;
+	struct dirent *entry;
+
+	while( (entry = readdir(dir)) != NULL ) {
+		std::string name = entry->d_name;
+
+		if( name.size() > 4 && name.compare(name.size() - 4, 4, ".xml") == 0 )
+			files.push_back(std::string(directory) + "/" + name);
+	}
+	closedir(dir);
+
+	// Load in a fixed order so record IDs that collide resolve the same way every run
+	std::sort(files.begin(), files.end());
+
+	for( size_t i = 0; i < files.size(); i++ ) {
+		if( !LoadFile(files[i]) )
+			return FALSE;
+	}
+
+	// Newest first, the same as a reverse-direction query
+	std::stable_sort(events.begin(), events.end(), [](const EVENT *a, const EVENT *b) { return a->record.recordId > b->record.recordId; });
+
+	corpus.assign(events.rbegin(), events.rend());
+	highRecord = events.empty() ? 0 : events[0]->record.recordId;
+
+	return events.empty() ? FALSE : TRUE;
+}
+
+
+/****
+ * FixtureSource::LoadFile
+ *
+ * DESC:
+ *     Splits one fixture file into its <Event> and <provider> elements
+ */
+BOOL FixtureSource::LoadFile(const std::string &path)
+{
+	FILE *file = fopen(path.c_str(), "rb");
+
+	if( file == NULL ) {
+		fwprintf(stderr, L"[Error][FixtureSource]: Could not open '%s'\n", path.c_str());
+		return FALSE;
+	}
+
+	std::string bytes;
+	char chunk[64 * 1024];
+	size_t got;
+
+	while( (got = fread(chunk, 1, sizeof(chunk), file)) > 0 )
+		bytes.append(chunk, got);
+	fclose(file);
+
+	std::wstring text;
+	DecodeFixtureText(bytes, text);
+
+	// <Event> may be followed by a space (attributes) or '>'. <EventData>
+	// and <EventID> share the prefix, so check the next character
+	size_t start = 0;
+
+	while( (start = text.find(L"<Event", start)) != std::wstring::npos ) {
+		WCHAR next = start + 6 < text.size() ? text[start + 6] : L'\0';
+
+		if( next != L' ' && next != L'>' && next != L'\t' && next != L'\r' && next != L'\n' ) {
+			start += 6;
+			continue;
+		}
+
+		size_t end = text.find(L"</Event>", start);
+
+		if( end == std::wstring::npos ) {
+			fwprintf(stderr, L"[Error][FixtureSource]: Unterminated <Event> in '%s'\n", path.c_str());
+			return FALSE;
+		}
+		end += 8;
+
+		if( !AddEvent(text.substr(start, end - start)) ) {
+			fwprintf(stderr, L"[Error][FixtureSource]: Malformed <Event> in '%s'\n", path.c_str());
+			return FALSE;
+		}
+
+		start = end;
+	}
+
+	// wevtutil gp writes <provider name=...>, which <providers> shares
+	// the prefix with
+	start = 0;
+
+	while( (start = text.find(L"<provider", start)) != std::wstring::npos ) {
+		WCHAR next = start + 9 < text.size() ? text[start + 9] : L'\0';
+
+		if( next != L' ' && next != L'>' && next != L'\t' && next != L'\r' && next != L'\n' ) {
+			start += 9;
+			continue;
+		}
+
+		size_t end = text.find(L"</provider>", start);
+
+		if( end == std::wstring::npos ) {
+			fwprintf(stderr, L"[Error][FixtureSource]: Unterminated <provider> in '%s'\n", path.c_str());
+			return FALSE;
+		}
+		end += 11;
+
+		if( !AddPublisher(text.substr(start, end - start)) ) {
+			fwprintf(stderr, L"[Error][FixtureSource]: Malformed <provider> in '%s'\n", path.c_str());
+			return FALSE;
+		}
+
+		start = end;
+	}
+
+	return TRUE;
+}
+
+
+/****
+ * FixtureSource::AddEvent
+ *
+ * DESC:
+ *     Decodes one <Event> element into a replayable event
+ */
+BOOL FixtureSource::AddEvent(const std::wstring &text)
+{
+	// rapidxml parses in-situ, so work on a copy
+	std::vector<WCHAR> scratch(text.begin(), text.end());
+	scratch.push_back(L'\0');
+
+	rapidxml::xml_document<WCHAR> doc;
+
+	try {
+		doc.parse<0>(&scratch[0]);
+	} catch( rapidxml::parse_error & ) {
+		return FALSE;
+	}
+
+	rapidxml::xml_node<WCHAR> *nodeEvent = doc.first_node(L"Event");
+	rapidxml::xml_node<WCHAR> *nodeSystem = nodeEvent != NULL ? nodeEvent->first_node(L"System") : NULL;
+
+	if( nodeSystem == NULL )
+		return FALSE;
+
+	EVENT *event = new EVENT();
+
+	event->kind = SOURCE_OBJECT_EVENT;
+	event->provider = ChildValue(nodeSystem, L"Provider", L"Name");
+	event->channel = ChildValue(nodeSystem, L"Channel");
+	event->computer = ChildValue(nodeSystem, L"Computer");
+	event->record.eventId = (DWORD)wcstoul(ChildValue(nodeSystem, L"EventID"), NULL, 10);
+	event->record.task = (DWORD)wcstoul(ChildValue(nodeSystem, L"Task"), NULL, 10);
+	event->record.level = (DWORD)wcstoul(ChildValue(nodeSystem, L"Level"), NULL, 10);
+	event->record.version = (DWORD)wcstoul(ChildValue(nodeSystem, L"Version"), NULL, 10);
+	event->record.recordId = _wcstoui64(ChildValue(nodeSystem, L"EventRecordID"), NULL, 10);
+	event->keywords = _wcstoui64(ChildValue(nodeSystem, L"Keywords"), NULL, 16);
+	event->record.timeCreated = 0;
+	ParseSystemTime(ChildValue(nodeSystem, L"TimeCreated", L"SystemTime"), &event->record.timeCreated);
+
+	rapidxml::xml_node<WCHAR> *nodeMessage = nodeEvent->first_node(L"RenderingInfo");
+	nodeMessage = nodeMessage != NULL ? nodeMessage->first_node(L"Message") : NULL;
+
+	event->hasMessage = nodeMessage != NULL ? TRUE : FALSE;
+	if( nodeMessage != NULL )
+		event->message.assign(nodeMessage->value(), nodeMessage->value_size());
+
+	// The values a template inserts: the <Data> of EventData, or whatever
+	// the provider's own element under UserData holds
+	rapidxml::xml_node<WCHAR> *nodeData = nodeEvent->first_node(L"EventData");
+	LPCWSTR dataName = L"Data";
+
+	if( nodeData == NULL ) {
+		nodeData = nodeEvent->first_node(L"UserData");
+		nodeData = nodeData != NULL ? nodeData->first_node() : NULL;
+		dataName = NULL;
+	}
+
+	for( rapidxml::xml_node<WCHAR> *node = nodeData != NULL ? nodeData->first_node(dataName) : NULL; node != NULL; node = node->next_sibling(dataName) ) {
+		if( node->type() == rapidxml::node_element )
+			event->data.push_back(std::wstring(node->value(), node->value_size()));
+	}
+
+	// What EvtRender returns never carries the rendering info
+	event->xml = text;
+
+	size_t infoStart = event->xml.find(L"<RenderingInfo");
+	size_t infoEnd = event->xml.find(L"</RenderingInfo>");
+
+	if( infoStart != std::wstring::npos && infoEnd != std::wstring::npos && infoEnd > infoStart )
+		event->xml.erase(infoStart, infoEnd + 16 - infoStart);
+
+	event->record.provider = event->provider.c_str();
+	event->record.channel = event->channel.c_str();
+	event->record.computer = event->computer.c_str();
+	PointValues(event);
+
+	events.push_back(event);
+
+	if( event->hasMessage )
+		Publisher(event->provider);
+
+	return TRUE;
+}
+
+
+/****
+ * FixtureSource::PointValues
+ *
+ * DESC:
+ *     Points an event's user values at its own copy of their text, once
+ *     it is loaded or copied
+ */
+void FixtureSource::PointValues(EVENT *event)
+{
+	event->values.resize(event->data.size());
+
+	for( size_t i = 0; i < event->data.size(); i++ ) {
+		memset(&event->values[i], 0, sizeof(EVT_VARIANT));
+		event->values[i].StringVal = event->data[i].c_str();
+		event->values[i].Type = EvtVarTypeString;
+	}
+}
+
+
+/****
+ * FixtureSource::AddPublisher
+ *
+ * DESC:
+ *     Decodes one <provider> element into its provider's message templates
+ */
+BOOL FixtureSource::AddPublisher(const std::wstring &text)
+{
+	std::vector<WCHAR> scratch(text.begin(), text.end());
+	scratch.push_back(L'\0');
+
+	rapidxml::xml_document<WCHAR> doc;
+
+	try {
+		doc.parse<0>(&scratch[0]);
+	} catch( rapidxml::parse_error & ) {
+		return FALSE;
+	}
+
+	rapidxml::xml_node<WCHAR> *nodeProvider = doc.first_node(L"provider");
+	rapidxml::xml_attribute<WCHAR> *name = nodeProvider != NULL ? nodeProvider->first_attribute(L"name") : NULL;
+
+	if( name == NULL )
+		return FALSE;
+
+	PUBLISHER *publisher = Publisher(name->value());
+	rapidxml::xml_node<WCHAR> *nodeEvents = nodeProvider->first_node(L"events");
+
+	for( rapidxml::xml_node<WCHAR> *node = nodeEvents != NULL ? nodeEvents->first_node(L"event") : NULL; node != NULL; node = node->next_sibling(L"event") ) {
+		rapidxml::xml_attribute<WCHAR> *value = node->first_attribute(L"value");
+		rapidxml::xml_attribute<WCHAR> *version = node->first_attribute(L"version");
+		rapidxml::xml_attribute<WCHAR> *message = node->first_attribute(L"message");
+
+		if( value == NULL || message == NULL )
+			continue;
+
+		std::pair<DWORD, DWORD> key((DWORD)wcstoul(value->value(), NULL, 10), version != NULL ? (DWORD)wcstoul(version->value(), NULL, 10) : 0);
+
+		publisher->templates[key].assign(message->value(), message->value_size());
+	}
+
+	return TRUE;
+}
+
+
+/****
+ * FixtureSource::Publisher
+ *
+ * DESC:
+ *     Finds the metadata of a provider, creating it the first time
+ */
+FixtureSource::PUBLISHER *FixtureSource::Publisher(const std::wstring &name)
+{
+	std::map<std::wstring, PUBLISHER*>::iterator found = publishers.find(name);
+
+	if( found != publishers.end() )
+		return found->second;
+
+	PUBLISHER *publisher = new PUBLISHER();
+	publisher->kind = SOURCE_OBJECT_PUBLISHER;
+	publishers[name] = publisher;
+
+	return publisher;
+}
+
+
+EVT_HANDLE FixtureSource::Query(LPCWSTR logName, LPCWSTR query, DWORD flags)
+{
+	XPathQuery selection;
+
+	if( !selection.Parse(query) )
+		return NULL;
+
+	std::lock_guard<std::mutex> guard(lock);
+
+	QUERY *results = new QUERY();
+	BOOL channelFound = FALSE;
+
+	results->kind = SOURCE_OBJECT_QUERY;
+	results->position = 0;
+
+	for( size_t i = 0; i < events.size(); i++ ) {
+		if( logName != NULL && !SameText(events[i]->channel.c_str(), logName) )
+			continue;
+
+		channelFound = TRUE;
+
+		if( selection.Matches(&events[i]->record, events[i]->keywords) )
+			results->matches.push_back(events[i]);
+	}
+
+	if( !channelFound ) {
+		delete results;
+		SetLastError(ERROR_EVT_CHANNEL_NOT_FOUND);
+		return NULL;
+	}
+
+	if( flags & EvtQueryForwardDirection )
+		std::reverse(results->matches.begin(), results->matches.end());
+
+	results->end = results->matches.size() * repeat;
+
+	return results;
+}
+
+
+BOOL FixtureSource::Next(EVT_HANDLE hResults, DWORD count, EVT_HANDLE *events, DWORD /*timeout*/, DWORD *returned)
+{
+	QUERY *results = (QUERY *)hResults;
+
+	*returned = 0;
+
+	if( results != NULL && results->kind == SOURCE_OBJECT_SUBSCRIPTION )
+		return NextSubscribed((SUBSCRIPTION *)hResults, count, events, returned);
+
+	if( results == NULL || results->kind != SOURCE_OBJECT_QUERY ) {
+		SetLastError(ERROR_INVALID_HANDLE);
+		return FALSE;
+	}
+
+	if( results->position >= results->end ) {
+		SetLastError(ERROR_NO_MORE_ITEMS);
+		return FALSE;
+	}
+
+	while( *returned < count && results->position < results->end ) {
+		events[(*returned)++] = results->matches[results->position % results->matches.size()];
+		results->position++;
+	}
+
+	return TRUE;
+}
+
+
+BOOL FixtureSource::Render(EVT_HANDLE hContext, EVT_HANDLE hEvent, DWORD flags, DWORD bufferSize, PVOID buffer, DWORD *bufferUsed, DWORD *propertyCount)
+{
+	EVENT *event = (EVENT *)hEvent;
+	BOOKMARK *bookmark = (BOOKMARK *)hEvent;
+
+	if( flags == EvtRenderBookmark && bookmark != NULL && bookmark->kind == SOURCE_OBJECT_BOOKMARK ) {
+		std::wstring xml = L"<BookmarkList>\r\n";
+		WCHAR recordId[32];
+
+		if( bookmark->recordId != 0 ) {
+			FormatUnsigned(bookmark->recordId, recordId);
+			xml += L"  <Bookmark Channel='";
+			xml += bookmark->channel;
+			xml += L"' RecordId='";
+			xml += recordId;
+			xml += L"' IsCurrent='true'/>\r\n";
+		}
+
+		xml += L"</BookmarkList>";
+		*propertyCount = 0;
+
+		return CopyRenderedText(xml.c_str(), xml.size(), bufferSize, buffer, bufferUsed);
+	}
+
+	if( event == NULL || event->kind != SOURCE_OBJECT_EVENT ) {
+		SetLastError(ERROR_INVALID_HANDLE);
+		return FALSE;
+	}
+
+	if( flags == EvtRenderEventXml ) {
+		*propertyCount = 0;
+		return CopyRenderedText(event->xml.c_str(), event->xml.size(), bufferSize, buffer, bufferUsed);
+	}
+
+	if( flags == EvtRenderEventValues && hContext == &renderContext )
+		return RenderRecordValues(&event->record, bufferSize, buffer, bufferUsed, propertyCount);
+
+	if( flags == EvtRenderEventValues && hContext == &userContext )
+		return RenderUserValues(event->values.data(), (DWORD)event->values.size(), bufferSize, buffer, bufferUsed, propertyCount);
+
+	SetLastError(ERROR_INVALID_PARAMETER);
+	return FALSE;
+}
+
+
+EVT_HANDLE FixtureSource::CreateRenderContext(DWORD flags)
+{
+	if( flags == EvtRenderContextSystem )
+		return &renderContext;
+
+	if( flags == EvtRenderContextUser )
+		return &userContext;
+
+	SetLastError(ERROR_INVALID_PARAMETER);
+	return NULL;
+}
+
+
+EVT_HANDLE FixtureSource::OpenPublisherMetadata(LPCWSTR publisherName)
+{
+	std::map<std::wstring, PUBLISHER*>::iterator found = publishers.find(publisherName);
+
+	if( found == publishers.end() ) {
+		SetLastError(ERROR_EVT_PUBLISHER_METADATA_NOT_FOUND);
+		return NULL;
+	}
+
+	return found->second;
+}
+
+
+BOOL FixtureSource::FormatEventMessage(EVT_HANDLE hMetadata, EVT_HANDLE hEvent, DWORD bufferSize, LPWSTR buffer, DWORD *bufferUsed)
+{
+	EVENT *event = (EVENT *)hEvent;
+
+	if( hMetadata == NULL || event == NULL || event->kind != SOURCE_OBJECT_EVENT ) {
+		SetLastError(ERROR_INVALID_HANDLE);
+		return FALSE;
+	}
+
+	if( !event->hasMessage ) {
+		SetLastError(ERROR_EVT_MESSAGE_NOT_FOUND);
+		return FALSE;
+	}
+
+	return CopyMessageText(event->message.c_str(), event->message.size(), bufferSize, buffer, bufferUsed);
+}
+
+
+BOOL FixtureSource::GetMessageTemplate(EVT_HANDLE hMetadata, DWORD eventId, DWORD version, DWORD bufferSize, LPWSTR buffer, DWORD *bufferUsed)
+{
+	PUBLISHER *publisher = (PUBLISHER *)hMetadata;
+
+	if( publisher == NULL || publisher->kind != SOURCE_OBJECT_PUBLISHER ) {
+		SetLastError(ERROR_INVALID_HANDLE);
+		return FALSE;
+	}
+
+	std::map<std::pair<DWORD, DWORD>, std::wstring>::iterator found = publisher->templates.find(std::make_pair(eventId, version));
+
+	if( found == publisher->templates.end() ) {
+		SetLastError(ERROR_EVT_MESSAGE_NOT_FOUND);
+		return FALSE;
+	}
+
+	return CopyMessageText(found->second.c_str(), found->second.size(), bufferSize, buffer, bufferUsed);
+}
+
+
+BOOL FixtureSource::Close(EVT_HANDLE hObject)
+{
+	SOURCE_OBJECT *object = (SOURCE_OBJECT *)hObject;
+
+	if( object == NULL ) {
+		SetLastError(ERROR_INVALID_HANDLE);
+		return FALSE;
+	}
+
+	// Events, publishers and the render context live as long as the source
+	switch( object->kind ) {
+	case SOURCE_OBJECT_QUERY:
+		delete (QUERY *)object;
+		break;
+	case SOURCE_OBJECT_BOOKMARK:
+		delete (BOOKMARK *)object;
+		break;
+	case SOURCE_OBJECT_SUBSCRIPTION: {
+		std::lock_guard<std::mutex> guard(lock);
+
+		subscriptions.erase(std::remove(subscriptions.begin(), subscriptions.end(), (SUBSCRIPTION *)object), subscriptions.end());
+		delete (SUBSCRIPTION *)object;
+		break;
+	}
+	default:
+		break;
+	}
+
+	return TRUE;
+}
+
+
+/****
+ * FixtureSource::Subscribe
+ *
+ * DESC:
+ *     Subscribes to the events of one channel that an XPath query selects
+ *     (see XPathQuery), from the origin the flags pick
+ *
+ * RETURNS:
+ *     The subscription, or NULL with ERROR_EVT_INVALID_QUERY,
+ *     ERROR_EVT_CHANNEL_NOT_FOUND, or ERROR_NOT_FOUND for a strict
+ *     subscription whose bookmarked record is not in the log
+ */
+EVT_HANDLE FixtureSource::Subscribe(LPCWSTR logName, LPCWSTR query, EVT_HANDLE hBookmark, DWORD flags)
+{
+	BOOKMARK *bookmark = (BOOKMARK *)hBookmark;
+	DWORD origin = flags & EvtSubscribeOriginMask;
+
+	if( logName == NULL || (origin == EvtSubscribeStartAfterBookmark && (bookmark == NULL || bookmark->kind != SOURCE_OBJECT_BOOKMARK)) ) {
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return NULL;
+	}
+
+	SUBSCRIPTION *subscription = new SUBSCRIPTION();
+
+	if( !subscription->selection.Parse(query) ) {
+		delete subscription;
+		return NULL;
+	}
+
+	subscription->kind = SOURCE_OBJECT_SUBSCRIPTION;
+	subscription->channel = logName;
+	subscription->after = 0;
+	subscription->pending = TRUE;
+
+	std::lock_guard<std::mutex> guard(lock);
+	BOOL channelFound = FALSE;
+	BOOL bookmarkFound = FALSE;
+
+	for( size_t i = 0; i < events.size(); i++ ) {
+		if( !SameText(events[i]->channel.c_str(), logName) )
+			continue;
+
+		channelFound = TRUE;
+
+		if( origin == EvtSubscribeStartAfterBookmark && events[i]->record.recordId == bookmark->recordId && SameText(bookmark->channel.c_str(), logName) )
+			bookmarkFound = TRUE;
+	}
+
+	if( !channelFound ) {
+		delete subscription;
+		SetLastError(ERROR_EVT_CHANNEL_NOT_FOUND);
+		return NULL;
+	}
+
+	if( origin == EvtSubscribeStartAfterBookmark && !bookmarkFound && (flags & EvtSubscribeStrict) ) {
+		delete subscription;
+		SetLastError(ERROR_NOT_FOUND);
+		return NULL;
+	}
+
+	if( origin == EvtSubscribeToFutureEvents )
+		subscription->after = highRecord;
+	else if( origin == EvtSubscribeStartAfterBookmark )
+		subscription->after = bookmark->recordId;
+
+	subscriptions.push_back(subscription);
+
+	return subscription;
+}
+
+
+/****
+ * FixtureSource::NextSubscribed
+ *
+ * DESC:
+ *     Next for a subscription: the events appended since the last call,
+ *     oldest first
+ */
+BOOL FixtureSource::NextSubscribed(SUBSCRIPTION *subscription, DWORD count, EVT_HANDLE *handles, DWORD *returned)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	size_t newer = 0;
+
+	// Newest first, so whatever is past the subscription is at the front
+	while( newer < events.size() && events[newer]->record.recordId > subscription->after )
+		newer++;
+
+	for( size_t i = newer; i > 0 && *returned < count; i-- ) {
+		EVENT *event = events[i - 1];
+
+		subscription->after = event->record.recordId;
+
+		if( SameText(event->channel.c_str(), subscription->channel.c_str()) && subscription->selection.Matches(&event->record, event->keywords) )
+			handles[(*returned)++] = event;
+	}
+
+	if( *returned == 0 ) {
+		SetLastError(ERROR_NO_MORE_ITEMS);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+
+BOOL FixtureSource::WaitForEvents(EVT_HANDLE hSubscription, DWORD timeout)
+{
+	SUBSCRIPTION *subscription = (SUBSCRIPTION *)hSubscription;
+
+	if( subscription == NULL || subscription->kind != SOURCE_OBJECT_SUBSCRIPTION ) {
+		SetLastError(ERROR_INVALID_HANDLE);
+		return FALSE;
+	}
+
+	std::unique_lock<std::mutex> guard(lock);
+
+	if( timeout == INFINITE ) {
+		arrived.wait(guard, [subscription] { return subscription->pending; });
+	} else if( !arrived.wait_for(guard, std::chrono::milliseconds(timeout), [subscription] { return subscription->pending; }) ) {
+		SetLastError(ERROR_TIMEOUT);
+		return FALSE;
+	}
+
+	subscription->pending = FALSE;
+
+	return TRUE;
+}
+
+
+/****
+ * FixtureSource::CreateBookmark
+ *
+ * ARGS:
+ *     bookmarkXml - a bookmark as rendered by Render, or NULL (or empty)
+ *                   for one that points nowhere yet
+ *
+ * RETURNS:
+ *     The bookmark, or NULL with ERROR_INVALID_PARAMETER if the XML is
+ *     not a bookmark
+ */
+EVT_HANDLE FixtureSource::CreateBookmark(LPCWSTR bookmarkXml)
+{
+	BOOKMARK *bookmark = new BOOKMARK();
+
+	bookmark->kind = SOURCE_OBJECT_BOOKMARK;
+	bookmark->recordId = 0;
+
+	if( bookmarkXml == NULL || *bookmarkXml == L'\0' )
+		return bookmark;
+
+	std::vector<WCHAR> scratch(bookmarkXml, bookmarkXml + wcslen(bookmarkXml) + 1);
+	rapidxml::xml_document<WCHAR> doc;
+	rapidxml::xml_node<WCHAR> *nodeList = NULL;
+
+	try {
+		doc.parse<0>(&scratch[0]);
+		nodeList = doc.first_node(L"BookmarkList");
+	} catch( rapidxml::parse_error & ) {
+	}
+
+	if( nodeList == NULL ) {
+		delete bookmark;
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return NULL;
+	}
+
+	// A list without bookmarks is one that never moved
+	if( nodeList->first_node(L"Bookmark") != NULL ) {
+		bookmark->channel = ChildValue(nodeList, L"Bookmark", L"Channel");
+		bookmark->recordId = _wcstoui64(ChildValue(nodeList, L"Bookmark", L"RecordId"), NULL, 10);
+	}
+
+	return bookmark;
+}
+
+
+BOOL FixtureSource::UpdateBookmark(EVT_HANDLE hBookmark, EVT_HANDLE hEvent)
+{
+	BOOKMARK *bookmark = (BOOKMARK *)hBookmark;
+	EVENT *event = (EVENT *)hEvent;
+
+	if( bookmark == NULL || bookmark->kind != SOURCE_OBJECT_BOOKMARK || event == NULL || event->kind != SOURCE_OBJECT_EVENT ) {
+		SetLastError(ERROR_INVALID_HANDLE);
+		return FALSE;
+	}
+
+	bookmark->channel = event->channel;
+	bookmark->recordId = event->record.recordId;
+
+	return TRUE;
+}
+
+
+/****
+ * FixtureSource::Append
+ *
+ * DESC:
+ *     Writes events to the logs, as copies of the loaded ones
+ *
+ * ARGS:
+ *     count - number of events to write
+ *
+ * RETURNS:
+ *     The record ID of the last event written
+ */
+DWORD64 FixtureSource::Append(DWORD count)
+{
+	std::vector<EVENT*> written;
+	WCHAR recordId[32];
+
+	std::lock_guard<std::mutex> guard(lock);
+
+	for( DWORD i = 0; i < count && !corpus.empty(); i++ ) {
+		EVENT *event = new EVENT(*corpus[appended++ % corpus.size()]);
+
+		event->record.recordId = ++highRecord;
+		event->record.provider = event->provider.c_str();
+		event->record.channel = event->channel.c_str();
+		event->record.computer = event->computer.c_str();
+		PointValues(event);
+
+		size_t start = event->xml.find(L"<EventRecordID>");
+		size_t end = event->xml.find(L"</EventRecordID>");
+
+		if( start != std::wstring::npos && end != std::wstring::npos && end > start ) {
+			FormatUnsigned(highRecord, recordId);
+			event->xml.replace(start + 15, end - start - 15, recordId);
+		}
+
+		written.push_back(event);
+	}
+
+	// Newest first, ahead of everything older
+	events.insert(events.begin(), written.rbegin(), written.rend());
+
+	for( size_t i = 0; i < subscriptions.size(); i++ ) {
+		for( size_t k = 0; k < written.size() && !subscriptions[i]->pending; k++ ) {
+			if( SameText(written[k]->channel.c_str(), subscriptions[i]->channel.c_str()) )
+				subscriptions[i]->pending = TRUE;
+		}
+	}
+
+	arrived.notify_all();
+
+	return highRecord;
+}
@@ -0,0 +1,148 @@
+#pragma once
+
+#include "Platform.h"
+#include "EventSource.h"
+#include "SourceRecord.h"
+#include "XPathQuery.h"
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/****
+ * FixtureSource
+ *
+ * DESC:
+ *     Event source that replays events captured from a real machine. Load
+ *     reads every *.xml file in a directory, each holding one or more
+ *     <Event> elements as written by "wevtutil qe <log> /f:RenderedXml"
+ *     or <provider> elements as written by "wevtutil gp <provider> /ge
+ *     /gm:true /f:xml" (UTF-8, or UTF-16LE with a BOM)
+ *
+ * REMARKS:
+ *     The <RenderingInfo> of each event is removed from the XML the source
+ *     renders, and its <Message> becomes what FormatEventMessage returns.
+ *     A provider has metadata if any of its events came with a message or
+ *     a <provider> element names it. GetMessageTemplate returns the
+ *     message attribute of the provider's <event> with the event's ID and
+ *     version.
+ *
+ *     A user render context renders an event's EventData <Data> values
+ *     (or the elements under its UserData), in order, as strings. The
+ *     XML does not record what type a value was logged as, so templates
+ *     belong with the fixtures only where the service formats each insert
+ *     as that same text: not the Security log's, whose SIDs it formats as
+ *     account names.
+ *
+ *     Query selects the events of one channel that its XPath query selects
+ *     (see XPathQuery), newest first unless asked for
+ *     EvtQueryForwardDirection. Each query replays them "repeat" times,
+ *     which gives the benchmarks a corpus of any size.
+ *
+ *     Append stands in for a log being written to: it adds copies of the
+ *     loaded events, oldest first and round and round, numbered on from
+ *     the highest record ID, and sets the signal of every subscription to
+ *     their channel. Subscriptions hand out their channel's events past
+ *     where they started, oldest first, as far as has been appended. One
+ *     started after a bookmark whose record is gone starts after its
+ *     record ID all the same, unless it asked for EvtSubscribeStrict.
+ *     Bookmarks render as the service writes them:
+ *
+ *         <BookmarkList>
+ *           <Bookmark Channel='Security' RecordId='1234' IsCurrent='true'/>
+ *         </BookmarkList>
+ *
+ *     Append may be called from any thread while the source is read.
+ */
+class FixtureSource : public EventSource {
+public:
+	FixtureSource(DWORD repeat = 1);
+	~FixtureSource();
+
+	BOOL Load(const char *directory);
+	DWORD Count() const { return (DWORD)events.size(); }
+
+	EVT_HANDLE Query(LPCWSTR logName, LPCWSTR query, DWORD flags);
+	BOOL Next(EVT_HANDLE hResults, DWORD count, EVT_HANDLE *events, DWORD timeout, DWORD *returned);
+	BOOL Render(EVT_HANDLE hContext, EVT_HANDLE hEvent, DWORD flags, DWORD bufferSize, PVOID buffer, DWORD *bufferUsed, DWORD *propertyCount);
+	EVT_HANDLE CreateRenderContext(DWORD flags);
+	EVT_HANDLE OpenPublisherMetadata(LPCWSTR publisherName);
+	BOOL FormatEventMessage(EVT_HANDLE hMetadata, EVT_HANDLE hEvent, DWORD bufferSize, LPWSTR buffer, DWORD *bufferUsed);
+	BOOL GetMessageTemplate(EVT_HANDLE hMetadata, DWORD eventId, DWORD version, DWORD bufferSize, LPWSTR buffer, DWORD *bufferUsed);
+	BOOL Close(EVT_HANDLE hObject);
+
+	EVT_HANDLE Subscribe(LPCWSTR logName, LPCWSTR query, EVT_HANDLE hBookmark, DWORD flags);
+	BOOL WaitForEvents(EVT_HANDLE hSubscription, DWORD timeout);
+	EVT_HANDLE CreateBookmark(LPCWSTR bookmarkXml);
+	BOOL UpdateBookmark(EVT_HANDLE hBookmark, EVT_HANDLE hEvent);
+
+	DWORD64 Append(DWORD count);
+
+private:
+	struct EVENT : SOURCE_OBJECT {
+		SOURCE_RECORD record;
+		std::wstring provider;
+		std::wstring channel;
+		std::wstring computer;
+		std::wstring xml;
+		std::wstring message;
+		BOOL hasMessage;
+		DWORD64 keywords;
+
+		// The user values, as EvtVarTypeString variants over data
+		std::vector<std::wstring> data;
+		std::vector<EVT_VARIANT> values;
+	};
+
+	struct QUERY : SOURCE_OBJECT {
+		std::vector<EVENT*> matches;
+		size_t position;
+		size_t end;
+	};
+
+	// after is the record ID of the last event handed out (or passed
+	// over), and pending the subscription's signal
+	struct SUBSCRIPTION : SOURCE_OBJECT {
+		std::wstring channel;
+		XPathQuery selection;
+		DWORD64 after;
+		BOOL pending;
+	};
+
+	// Message templates by event ID and version
+	struct PUBLISHER : SOURCE_OBJECT {
+		std::map<std::pair<DWORD, DWORD>, std::wstring> templates;
+	};
+
+	struct BOOKMARK : SOURCE_OBJECT {
+		std::wstring channel;
+		DWORD64 recordId;
+	};
+
+	FixtureSource(const FixtureSource &);
+	FixtureSource &operator=(const FixtureSource &);
+
+	BOOL LoadFile(const std::string &path);
+	BOOL AddEvent(const std::wstring &text);
+	BOOL AddPublisher(const std::wstring &text);
+	static void PointValues(EVENT *event);
+	PUBLISHER *Publisher(const std::wstring &name);
+	BOOL NextSubscribed(SUBSCRIPTION *subscription, DWORD count, EVT_HANDLE *handles, DWORD *returned);
+
+	DWORD repeat;
+	std::vector<EVENT*> events;
+	std::map<std::wstring, PUBLISHER*> publishers;
+	SOURCE_OBJECT renderContext;
+	SOURCE_OBJECT userContext;
+
+	// The events as loaded, oldest first, which Append copies
+	std::vector<EVENT*> corpus;
+	DWORD64 appended;
+	DWORD64 highRecord;
+
+	// Guards events, and the subscriptions' positions and signals
+	std::mutex lock;
+	std::condition_variable arrived;
+	std::vector<SUBSCRIPTION*> subscriptions;
+};
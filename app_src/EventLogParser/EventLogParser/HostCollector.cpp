@@ -0,0 +1,579 @@
+#include "HostCollector.h"
+
+/****
+ * HostCollector::HostCollector
+ *
+ * ARGS:
+ *     connector - opens the hosts' sources (not owned)
+ *     workers - threads the hosts are read on (0 for
+ *               COLLECTOR_WORKERS_DEFAULT, at most COLLECTOR_WORKERS_MAX)
+ *     batch - events a turn reads from a channel (0 for
+ *             COLLECTOR_BATCH_DEFAULT)
+ *     hostDeadlineMs - time a host may take in one round (0 for
+ *                      COLLECTOR_HOST_DEADLINE_MS)
+ *
+ * REMARKS:
+ *     The workers are started by the first Collect.
+ */
+HostCollector::HostCollector(HostConnector *connector, DWORD workers, DWORD batch, DWORD hostDeadlineMs)
+	: connector(connector), workerCount(workers > 0 ? workers : COLLECTOR_WORKERS_DEFAULT), batch(batch > 0 ? batch : COLLECTOR_BATCH_DEFAULT),
+	hostDeadlineMs(hostDeadlineMs > 0 ? hostDeadlineMs : COLLECTOR_HOST_DEADLINE_MS), mode(MODE_DEFAULT), debug(DEBUG_NONE), status(ERROR_SUCCESS),
+	round(0), open(FALSE), remaining(0), held(0), stopping(FALSE)
+{
+	if( workerCount > COLLECTOR_WORKERS_MAX )
+		workerCount = COLLECTOR_WORKERS_MAX;
+}
+
+
+/****
+ * HostCollector::~HostCollector
+ *
+ * DESC:
+ *     Waits for calls still going to return, then disconnects every host
+ *     and drops the records not yet written
+ */
+HostCollector::~HostCollector()
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+
+		stopping = TRUE;
+	}
+
+	changed.notify_all();
+
+	for( size_t i = 0; i < workers.size(); i++ )
+		workers[i].join();
+
+	for( size_t i = 0; i < batches.size(); i++ )
+		delete batches[i];
+
+	for( size_t i = 0; i < hosts.size(); i++ ) {
+		Disconnect(hosts[i]);
+		delete hosts[i];
+	}
+}
+
+
+/****
+ * HostCollector::AddHost
+ *
+ * ARGS:
+ *     name - the host, as the connector knows it and as its records are
+ *            tagged
+ *     context - handed to the connector with the name (not owned)
+ *
+ * RETURNS:
+ *     The host's index, or (DWORD)-1 once collecting has started
+ */
+DWORD HostCollector::AddHost(LPCWSTR name, LPVOID context)
+{
+	if( !workers.empty() )
+		return (DWORD)-1;
+
+	HOST *host = new HOST();
+
+	host->name = name != NULL ? name : L"";
+	host->context = context;
+	host->source = NULL;
+	host->session = NULL;
+	host->next = 0;
+	host->working = FALSE;
+	host->round = 0;
+	host->retryRound = 0;
+	host->status = HOST_STATUS();
+	hosts.push_back(host);
+
+	return (DWORD)hosts.size() - 1;
+}
+
+
+/****
+ * HostCollector::AddChannel
+ *
+ * ARGS:
+ *     host - index AddHost returned
+ *     logName - event log to read
+ *     filter - the events to read (copied; NULL for everything). Its low
+ *              record is where reading starts
+ *
+ * RETURNS:
+ *     TRUE, or FALSE if there is no such host or collecting has started
+ */
+BOOL HostCollector::AddChannel(DWORD host, LPCWSTR logName, const EventFilter *filter)
+{
+	if( !workers.empty() || host >= hosts.size() || logName == NULL )
+		return FALSE;
+
+	CHANNEL channel;
+
+	channel.logName = logName;
+	channel.filter = filter != NULL ? *filter : EventFilter();
+	channel.cursor = NULL;
+	channel.lastRecordId = 0;
+	channel.dry = FALSE;
+	hosts[host]->channels.push_back(channel);
+
+	return TRUE;
+}
+
+
+/****
+ * HostCollector::Collect
+ *
+ * DESC:
+ *     Runs a round (see HostCollector), writing records to a sink as the
+ *     workers read them
+ *
+ * ARGS:
+ *     deadlineMs - longest the round may take (0 for no limit but the
+ *                  hosts' own)
+ *     sink - where the records go, framed as the class remarks say
+ *     debug - set to 0 (none) 1 (basic) or 2 (verbose)
+ *
+ * RETURNS:
+ *     The number of records written. Status is then ERROR_SUCCESS if
+ *     every host finished its round, ERROR_TIMEOUT if the deadline came
+ *     first, or ERROR_MORE_DATA (ERROR_INSUFFICIENT_BUFFER if nothing was
+ *     written) if the sink filled, in which case no new round was started
+ *     or the round was ended there
+ *
+ * REMARKS:
+ *     Records left over from the last call are written first. If the sink
+ *     will not take them all, no round is run.
+ */
+DWORD HostCollector::Collect(DWORD deadlineMs, OutputSink *sink, INT debug)
+{
+	std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(deadlineMs);
+	DWORD written = 0;
+	DWORD late = 0;
+	BOOL full = FALSE;
+
+	this->debug = debug;
+
+	if( workers.empty() ) {
+		for( DWORD i = 0; i < workerCount; i++ )
+			workers.push_back(std::thread(&HostCollector::Work, this));
+	}
+
+	// Records the sink refused last time, and those read since it returned
+	full = !Drain(sink, &written);
+
+	if( !full )
+	{
+		std::unique_lock<std::mutex> guard(lock);
+
+		round++;
+		remaining = 0;
+
+		for( size_t i = 0; i < hosts.size(); i++ ) {
+			HOST *host = hosts[i];
+
+			host->status.busy = host->working;
+
+			if( host->working || host->retryRound > round )
+				continue;
+
+			for( size_t c = 0; c < host->channels.size(); c++ )
+				host->channels[c].dry = FALSE;
+
+			host->round = round;
+			host->started = std::chrono::steady_clock::now();
+			host->status.status = ERROR_SUCCESS;
+			host->status.records = 0;
+			host->status.turns = 0;
+			host->status.elapsedMs = 0;
+			ready.push_back(host);
+			remaining++;
+		}
+
+		open = TRUE;
+		changed.notify_all();
+
+		while( TRUE )
+		{
+			if( !batches.empty() ) {
+				guard.unlock();
+				full = !Drain(sink, &written);
+				guard.lock();
+
+				if( full )
+					break;
+
+				continue;
+			}
+
+			if( remaining == 0 )
+				break;
+
+			if( deadlineMs == 0 ) {
+				changed.wait(guard);
+			} else if( changed.wait_until(guard, deadline) == std::cv_status::timeout ) {
+				break;
+			}
+		}
+
+		// Hosts still waiting for a turn are done for this round
+		open = FALSE;
+
+		for( size_t i = 0; i < ready.size(); i++ )
+			ready[i]->status.status = full ? ERROR_MORE_DATA : ERROR_TIMEOUT;
+
+		remaining -= (DWORD)ready.size();
+		ready.clear();
+		late = remaining;
+
+		// What the hosts done by now have read
+		if( !full ) {
+			guard.unlock();
+			full = !Drain(sink, &written);
+		}
+	}
+
+	if( full ) {
+		status = written > 0 ? ERROR_MORE_DATA : ERROR_INSUFFICIENT_BUFFER;
+	} else {
+		status = late > 0 ? ERROR_TIMEOUT : ERROR_SUCCESS;
+	}
+
+	if( debug >= DEBUG_L1 ) {
+		wprintf(L"[HostCollector]: Round %llu wrote %u records from %u hosts, %u still busy, status %u\n",
+			(unsigned long long)round, written, (DWORD)hosts.size(), late, status);
+	}
+
+	return written;
+}
+
+
+/****
+ * HostCollector::Drain
+ *
+ * DESC:
+ *     Writes out the records the workers have read, oldest turn first
+ *
+ * RETURNS:
+ *     TRUE, or FALSE if the sink refused a record, which is then the first
+ *     one the next call writes
+ */
+BOOL HostCollector::Drain(OutputSink *sink, DWORD *written)
+{
+	while( TRUE )
+	{
+		BATCH *next;
+
+		{
+			std::lock_guard<std::mutex> guard(lock);
+
+			if( batches.empty() )
+				return TRUE;
+
+			// Only this thread takes batches off, so it stays at the front
+			next = batches.front();
+		}
+
+		const std::wstring &logName = next->host->channels[next->channel].logName;
+
+		while( next->written < next->ends.size() )
+		{
+			size_t begin = next->written > 0 ? next->ends[next->written - 1] + 1 : 0;
+
+			frame.assign(next->host->name);
+			frame += COLLECTOR_SEPARATOR;
+			frame += logName;
+			frame += COLLECTOR_SEPARATOR;
+			frame.append(&next->text[begin], next->ends[next->written] - begin);
+
+			if( !sink->Write(frame.c_str(), (DWORD)frame.size()) )
+				return FALSE;
+
+			next->written++;
+			(*written)++;
+		}
+
+		{
+			std::lock_guard<std::mutex> guard(lock);
+
+			batches.pop_front();
+			held -= next->ends.size();
+		}
+
+		changed.notify_all();
+		delete next;
+	}
+}
+
+
+/****
+ * HostCollector::Work
+ *
+ * DESC:
+ *     What each worker thread does: takes the host at the front of the
+ *     queue, reads one batch from it, and queues it again if it has more
+ */
+void HostCollector::Work()
+{
+	std::unique_lock<std::mutex> guard(lock);
+
+	while( TRUE )
+	{
+		while( !stopping && (ready.empty() || held >= COLLECTOR_HELD_MAX) )
+			changed.wait(guard);
+
+		if( stopping )
+			break;
+
+		HOST *host = ready.front();
+		BATCH *turn = new BATCH();
+
+		ready.pop_front();
+		host->working = TRUE;
+		turn->host = host;
+		turn->channel = 0;
+		turn->written = 0;
+		turn->lastRecordId = 0;
+		turn->status = ERROR_SUCCESS;
+
+		guard.unlock();
+
+		BOOL more = Turn(host, turn);
+
+		guard.lock();
+
+		Finish(host, turn, more);
+		changed.notify_all();
+	}
+}
+
+
+/****
+ * HostCollector::Finish
+ *
+ * DESC:
+ *     Takes in how a turn went, with the lock held: queues its records,
+ *     and the host again if it has more to read and time to read it in
+ */
+void HostCollector::Finish(HOST *host, BATCH *turn, BOOL more)
+{
+	DWORD elapsedMs = (DWORD)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - host->started).count();
+	BOOL current = open && host->round == round;
+
+	host->working = FALSE;
+	host->status.busy = FALSE;
+	host->status.turns++;
+	host->status.records += (DWORD)turn->ends.size();
+	host->status.elapsedMs = elapsedMs;
+	host->status.connected = host->session != NULL;
+
+	if( turn->lastRecordId > host->channels[turn->channel].lastRecordId )
+		host->channels[turn->channel].lastRecordId = turn->lastRecordId;
+
+	if( turn->status != ERROR_SUCCESS ) {
+		DWORD wait = host->status.failures < 16 ? 1 << host->status.failures : COLLECTOR_RETRY_ROUNDS_MAX;
+
+		host->status.status = turn->status;
+		host->status.failures++;
+		host->retryRound = round + 1 + (wait < COLLECTOR_RETRY_ROUNDS_MAX ? wait : COLLECTOR_RETRY_ROUNDS_MAX);
+	} else if( host->session != NULL ) {
+		host->status.failures = 0;
+	}
+
+	if( !turn->ends.empty() ) {
+		batches.push_back(turn);
+		held += turn->ends.size();
+	} else {
+		delete turn;
+	}
+
+	if( more && current && elapsedMs < hostDeadlineMs ) {
+		ready.push_back(host);
+		return;
+	}
+
+	if( more && host->status.status == ERROR_SUCCESS )
+		host->status.status = ERROR_TIMEOUT;
+
+	// A host whose round has been ended by Collect was counted off then
+	if( current )
+		remaining--;
+}
+
+
+/****
+ * HostCollector::Turn
+ *
+ * DESC:
+ *     Reads the next batch from the next channel of a host that has not
+ *     run dry this round, connecting first if need be. Runs without the
+ *     lock, on the one worker that has the host
+ *
+ * RETURNS:
+ *     TRUE if the host may have more to read this round, FALSE if every
+ *     channel has run dry or the host failed (turn->status says so)
+ */
+BOOL HostCollector::Turn(HOST *host, BATCH *turn)
+{
+	if( host->channels.empty() )
+		return FALSE;
+
+	if( host->session == NULL && !Connect(host, turn) )
+		return FALSE;
+
+	while( host->channels[host->next].dry )
+		host->next = (host->next + 1) % host->channels.size();
+
+	CHANNEL *channel = &host->channels[host->next];
+
+	turn->channel = (DWORD)host->next;
+	host->next = (host->next + 1) % host->channels.size();
+
+	// A new cursor, or one after a failure, starts past what was read
+	if( channel->cursor == NULL ) {
+		EventFilter after = channel->filter;
+
+		if( channel->lastRecordId != 0 && channel->lastRecordId + 1 > after.LowRecord() )
+			after.SetLowRecord(channel->lastRecordId + 1);
+
+		channel->cursor = new EventCursor(host->session);
+
+		if( !channel->cursor->StartFiltered(channel->logName.c_str(), &after, debug) ) {
+			turn->status = channel->cursor->Status();
+			fwprintf(stderr, L"[Error][HostCollector]: Could not query '%ls' on %ls, error %u\n", channel->logName.c_str(), host->name.c_str(), turn->status);
+			Disconnect(host);
+			return FALSE;
+		}
+	}
+
+	MemorySink sink(&turn->text, &turn->ends);
+	DWORD written = channel->cursor->Read(batch, &sink, OUTPUT_FORMAT_JSON, mode, debug);
+	DWORD error = channel->cursor->Status();
+
+	turn->lastRecordId = channel->cursor->LastRecordId();
+
+	if( error != ERROR_SUCCESS && error != ERROR_MORE_DATA ) {
+		turn->status = error;
+		fwprintf(stderr, L"[Error][HostCollector]: Could not read '%ls' on %ls, error %u\n", channel->logName.c_str(), host->name.c_str(), error);
+		Disconnect(host);
+		return FALSE;
+	}
+
+	if( written < batch )
+		channel->dry = TRUE;
+
+	if( debug >= DEBUG_L2 ) {
+		wprintf(L"[HostCollector]: Read %u records of '%ls' on %ls, last record is %llu\n",
+			written, channel->logName.c_str(), host->name.c_str(), (unsigned long long)turn->lastRecordId);
+	}
+
+	for( size_t c = 0; c < host->channels.size(); c++ ) {
+		if( !host->channels[c].dry )
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+
+/****
+ * HostCollector::Connect
+ *
+ * DESC:
+ *     Gets a source for a host from the connector, and a session over it
+ *
+ * RETURNS:
+ *     TRUE, or FALSE with turn->status set
+ */
+BOOL HostCollector::Connect(HOST *host, BATCH *turn)
+{
+	SetLastError(ERROR_SUCCESS);
+
+	EventSource *source = connector->Connect(host->name.c_str(), host->context);
+
+	if( source == NULL ) {
+		turn->status = GetLastError() != ERROR_SUCCESS ? GetLastError() : ERROR_NOT_FOUND;
+		fwprintf(stderr, L"[Error][HostCollector]: Could not connect to %ls, error %u\n", host->name.c_str(), turn->status);
+		return FALSE;
+	}
+
+	host->source = source;
+	host->session = new EVENT_SESSION(source);
+	connector->Prepare(host->session);
+
+	if( debug >= DEBUG_L1 ) {
+		wprintf(L"[HostCollector]: Connected to %ls\n", host->name.c_str());
+	}
+
+	return TRUE;
+}
+
+
+/****
+ * HostCollector::Disconnect
+ *
+ * DESC:
+ *     Closes a host's cursors and session and gives its source back. The
+ *     channels keep their last record IDs, to start again from
+ */
+void HostCollector::Disconnect(HOST *host)
+{
+	for( size_t c = 0; c < host->channels.size(); c++ ) {
+		delete host->channels[c].cursor;
+		host->channels[c].cursor = NULL;
+	}
+
+	if( host->session != NULL ) {
+		host->session->publishers.Clear();
+		delete host->session;
+		host->session = NULL;
+	}
+
+	if( host->source != NULL ) {
+		connector->Disconnect(host->source);
+		host->source = NULL;
+	}
+}
+
+
+/****
+ * HostCollector::GetHostStatus
+ *
+ * DESC:
+ *     Copies out what a host did in its last round (see HOST_STATUS)
+ *
+ * RETURNS:
+ *     TRUE, or FALSE if there is no such host
+ */
+BOOL HostCollector::GetHostStatus(DWORD host, HOST_STATUS *status)
+{
+	if( host >= hosts.size() )
+		return FALSE;
+
+	std::lock_guard<std::mutex> guard(lock);
+
+	*status = hosts[host]->status;
+
+	return TRUE;
+}
+
+
+/****
+ * HostCollector::GetLastRecordId
+ *
+ * DESC:
+ *     The record ID of the last event read from a channel of a host, or
+ *     passed over by its filter: where it would be read from again if
+ *     collecting started over
+ *
+ * RETURNS:
+ *     TRUE, or FALSE if there is no such host or channel
+ */
+BOOL HostCollector::GetLastRecordId(DWORD host, DWORD channel, DWORD64 *recordId)
+{
+	if( host >= hosts.size() || channel >= hosts[host]->channels.size() )
+		return FALSE;
+
+	std::lock_guard<std::mutex> guard(lock);
+
+	*recordId = hosts[host]->channels[channel].lastRecordId;
+
+	return TRUE;
+}
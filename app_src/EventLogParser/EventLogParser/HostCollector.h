@@ -0,0 +1,206 @@
+#pragma once
+
+#include "Platform.h"
+#include "ParserCore.h"
+#include "EventCursor.h"
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Workers a collector reads its hosts with, when the caller does not say,
+// and the most it may have
+#define COLLECTOR_WORKERS_DEFAULT 8
+#define COLLECTOR_WORKERS_MAX 64
+
+// Events one turn reads from a channel, when the caller does not say
+#define COLLECTOR_BATCH_DEFAULT 200
+
+// Time a host may take in one round, in ms, when the caller does not say
+#define COLLECTOR_HOST_DEADLINE_MS 10000
+
+// Most rounds a host that failed sits out before it is tried again. It
+// sits out 1, 2, 4... rounds as it goes on failing
+#define COLLECTOR_RETRY_ROUNDS_MAX 16
+
+// Records read but not yet written out past which workers wait for
+// Collect before taking another turn
+#define COLLECTOR_HELD_MAX 20000
+
+// Separates the host, the channel and the record in what Collect writes
+#define COLLECTOR_SEPARATOR L'\t'
+
+/****
+ * HostConnector
+ *
+ * DESC:
+ *     How a HostCollector gets an event source for a host. The DLL opens
+ *     remote winevt sessions; the benchmarks hand out fixture sources
+ *     with round trips and failures of their own
+ *
+ * REMARKS:
+ *     Connect returns NULL, with the last error set, if the host cannot be
+ *     reached. context is what the host was added with. Prepare sets up
+ *     each session made over a source (projection, EventData selection,
+ *     message formatting), so that every host's records come out alike.
+ *     Disconnect is given back each source Connect returned, once nothing
+ *     uses it. Each is called on a worker thread, for different hosts at
+ *     once.
+ */
+class HostConnector {
+public:
+	virtual ~HostConnector() {}
+
+	virtual EventSource *Connect(LPCWSTR host, LPVOID context) = 0;
+	virtual void Prepare(EVENT_SESSION * /*session*/) {}
+	virtual void Disconnect(EventSource *source) = 0;
+};
+
+// What one host did in its last round (HostCollector::GetHostStatus).
+// status is ERROR_SUCCESS if it read everything it had, ERROR_TIMEOUT if
+// a deadline cut it short, ERROR_MORE_DATA if the sink filled first, or
+// the error it failed with. A host that failed sits its next rounds out
+// and keeps that status meanwhile. busy is set while a call made in an
+// earlier round is still going
+struct HOST_STATUS {
+	DWORD status;
+	DWORD records;
+	DWORD turns;
+	DWORD elapsedMs;
+	DWORD failures;
+	DWORD connected;
+	DWORD busy;
+};
+
+/****
+ * HostCollector
+ *
+ * DESC:
+ *     Reads the event logs of many hosts at once, on a fixed pool of
+ *     worker threads. Each Collect is a round: every host gets its turns,
+ *     and the records read are written out tagged with their host and
+ *     channel, each as
+ *
+ *         <host> TAB <channel> TAB <record>
+ *
+ * REMARKS:
+ *     Every channel of a host is read through one session, by an
+ *     EventCursor started with the channel's filter, so a round reads
+ *     what a poll of each cursor would and a host's records come out in
+ *     record order, channel by channel. Hosts and channels are added
+ *     before the first Collect.
+ *
+ *     A turn is one batch from one channel of one host. A host that has
+ *     more to read goes to the back of the queue after its turn, so a
+ *     host with a big backlog takes turns with the rest instead of ahead
+ *     of them, and no host is read by two workers at once. A host's round
+ *     ends when a turn finds nothing more in any of its channels, or when
+ *     it has been at it for its deadline (checked between turns).
+ *
+ *     The round ends when every host is done or at Collect's deadline,
+ *     whichever comes first. Hosts still in a call then carry on, and
+ *     what they read is written by the next Collect, ahead of its round;
+ *     they sit that round out if still busy. Records the sink refuses are
+ *     kept the same way.
+ *
+ *     A host that fails (cannot connect, or a query or fetch fails) is
+ *     disconnected, and sits out rounds before connecting again: twice as
+ *     many each time it fails in a row, up to COLLECTOR_RETRY_ROUNDS_MAX.
+ *     Its cursors start again from the record after the last one read,
+ *     so nothing is written twice or missed. What was read before the
+ *     failure is kept.
+ *
+ *     Records are JSON, which never holds a raw tab, so the separators
+ *     are unambiguous as long as host and channel names have none.
+ */
+class HostCollector {
+public:
+	HostCollector(HostConnector *connector, DWORD workers = COLLECTOR_WORKERS_DEFAULT, DWORD batch = COLLECTOR_BATCH_DEFAULT, DWORD hostDeadlineMs = COLLECTOR_HOST_DEADLINE_MS);
+	~HostCollector();
+
+	DWORD AddHost(LPCWSTR name, LPVOID context);
+	BOOL AddChannel(DWORD host, LPCWSTR logName, const EventFilter *filter);
+	void SetMode(INT mode) { this->mode = mode; }
+
+	DWORD Collect(DWORD deadlineMs, OutputSink *sink, INT debug);
+
+	DWORD Status() const { return status; }
+	DWORD Hosts() const { return (DWORD)hosts.size(); }
+	DWORD64 Rounds() const { return round; }
+	BOOL GetHostStatus(DWORD host, HOST_STATUS *status);
+	BOOL GetLastRecordId(DWORD host, DWORD channel, DWORD64 *recordId);
+
+private:
+	HostCollector(const HostCollector &);
+	HostCollector &operator=(const HostCollector &);
+
+	// dry is set once a turn of this round has found nothing more
+	struct CHANNEL {
+		std::wstring logName;
+		EventFilter filter;
+		EventCursor *cursor;
+		DWORD64 lastRecordId;
+		BOOL dry;
+	};
+
+	// Everything but working, status, round and retryRound is only
+	// touched by the worker taking the host's turn, or between rounds
+	struct HOST {
+		std::wstring name;
+		LPVOID context;
+		std::vector<CHANNEL> channels;
+		EventSource *source;
+		EVENT_SESSION *session;
+		size_t next;
+		BOOL working;
+		DWORD64 round;
+		DWORD64 retryRound;
+		std::chrono::steady_clock::time_point started;
+		HOST_STATUS status;
+	};
+
+	// The records of one turn, each followed by a null character, until
+	// Collect has written them all, and how the turn went
+	struct BATCH {
+		HOST *host;
+		DWORD channel;
+		std::vector<WCHAR> text;
+		std::vector<size_t> ends;
+		size_t written;
+		DWORD64 lastRecordId;
+		DWORD status;
+	};
+
+	void Work();
+	BOOL Turn(HOST *host, BATCH *batch);
+	void Finish(HOST *host, BATCH *batch, BOOL more);
+	BOOL Connect(HOST *host, BATCH *batch);
+	void Disconnect(HOST *host);
+	BOOL Drain(OutputSink *sink, DWORD *written);
+
+	HostConnector *connector;
+	DWORD workerCount;
+	DWORD batch;
+	DWORD hostDeadlineMs;
+	INT mode;
+	INT debug;
+	DWORD status;
+	std::vector<HOST *> hosts;
+
+	// The round being collected, while open. Hosts waiting for a turn are
+	// queued in ready; remaining counts the round's hosts not yet done
+	DWORD64 round;
+	BOOL open;
+	DWORD remaining;
+	std::deque<HOST *> ready;
+	std::deque<BATCH *> batches;
+	size_t held;
+	BOOL stopping;
+	std::mutex lock;
+	std::condition_variable changed;
+	std::vector<std::thread> workers;
+	std::wstring frame;
+};
@@ -0,0 +1,185 @@
+#include "Identity.h"
+#include <string.h>
+
+// IDENTITY_RECORD fields, in the order IDENTITY_EVENT lists them
+#define IDENTITY_SLOT_USER 0
+#define IDENTITY_SLOT_DOMAIN 1
+#define IDENTITY_SLOT_LOGON_ID 2
+#define IDENTITY_SLOT_LOGON_TYPE 3
+#define IDENTITY_SLOT_SOURCE 4
+#define IDENTITY_SLOT_WORKSTATION 5
+#define IDENTITY_SLOT_COUNT 6
+
+// Logon type of an event that has none, and source address of a logoff
+#define IDENTITY_NO_LOGON_TYPE L"255"
+#define IDENTITY_LOGOFF_SOURCE L"0.0.0.255"
+
+/****
+ * IDENTITY_EVENT
+ *
+ * DESC:
+ *     Where one event ID keeps each identity field: the EventData name it
+ *     comes from, or NULL and the value it always has
+ *
+ * REMARKS:
+ *     radius - the logon type is the RADIUS AuthenticationType, sent as
+ *              the number in radiusTypes
+ */
+struct IDENTITY_EVENT {
+	LPCWSTR eventId;
+	LPCWSTR names[IDENTITY_SLOT_COUNT];
+	LPCWSTR defaults[IDENTITY_SLOT_COUNT];
+	DWORD state;
+	BOOL radius;
+};
+
+// 6279 (NPS locked the account) is collected along with these, but has
+// never been sent as a login state, so it has no identity
+static const IDENTITY_EVENT identityEvents[] = {
+	{ L"4624", { L"TargetUserName", L"TargetDomainName", L"TargetLogonId", L"LogonType", L"IpAddress", L"WorkstationName" },
+		{ L"", L"", L"", L"", L"", L"" }, IDENTITY_STATE_LOGON, FALSE },
+	{ L"4634", { L"TargetUserName", L"TargetDomainName", L"TargetLogonId", L"LogonType", NULL, NULL },
+		{ L"", L"", L"", L"", IDENTITY_LOGOFF_SOURCE, L"" }, IDENTITY_STATE_LOGOFF, FALSE },
+	{ L"4647", { L"TargetUserName", L"TargetDomainName", L"TargetLogonId", NULL, NULL, NULL },
+		{ L"", L"", L"", IDENTITY_NO_LOGON_TYPE, IDENTITY_LOGOFF_SOURCE, L"" }, IDENTITY_STATE_LOGOFF, FALSE },
+	{ L"6272", { L"SubjectUserName", L"SubjectDomainName", L"AccountSessionIdentifier", L"AuthenticationType", L"CallingStationID", NULL },
+		{ L"", L"", L"", IDENTITY_NO_LOGON_TYPE, L"", L"" }, IDENTITY_STATE_LOGON, TRUE },
+	{ L"6273", { L"SubjectUserName", L"SubjectDomainName", L"AccountSessionIdentifier", L"AuthenticationType", L"CallingStationID", NULL },
+		{ L"", L"", L"", IDENTITY_NO_LOGON_TYPE, L"", L"" }, IDENTITY_STATE_DENIED, TRUE },
+	{ L"6274", { L"SubjectUserName", L"SubjectDomainName", L"AccountSessionIdentifier", L"AuthenticationType", L"CallingStationID", NULL },
+		{ L"", L"", L"", IDENTITY_NO_LOGON_TYPE, L"", L"" }, IDENTITY_STATE_DISCARDED, TRUE },
+	{ L"6278", { L"SubjectUserName", L"SubjectDomainName", L"AccountSessionIdentifier", L"AuthenticationType", L"CallingStationID", NULL },
+		{ L"", L"", L"", IDENTITY_NO_LOGON_TYPE, L"", L"" }, IDENTITY_STATE_HEALTHY, TRUE },
+};
+
+#define IDENTITY_EVENT_COUNT (sizeof(identityEvents) / sizeof(identityEvents[0]))
+
+// RADIUS authentication types, as Scrutinizer knows them
+static const struct {
+	LPCWSTR name;
+	LPCWSTR logonType;
+} radiusTypes[] = {
+	{ L"PEAP", L"200" },
+	{ L"MS-CHAPv2", L"201" },
+	{ L"EAP", L"202" },
+	{ L"unauthenticated", L"203" },
+};
+
+
+static const IDENTITY_EVENT *FindIdentityEvent(LPCWSTR eventId)
+{
+	if( eventId == NULL )
+		return NULL;
+
+	for( size_t i = 0; i < IDENTITY_EVENT_COUNT; i++ )
+	{
+		if( wcscmp(identityEvents[i].eventId, eventId) == 0 )
+			return &identityEvents[i];
+	}
+
+	return NULL;
+}
+
+
+BOOL IsIdentityEvent(LPCWSTR eventId)
+{
+	return FindIdentityEvent(eventId) != NULL;
+}
+
+
+// The slot a <Data Name=...> fills for this event, or -1
+static INT IdentitySlot(const IDENTITY_EVENT *event, LPCWSTR name, size_t length)
+{
+	for( INT slot = 0; slot < IDENTITY_SLOT_COUNT; slot++ )
+	{
+		LPCWSTR wanted = event->names[slot];
+
+		if( wanted != NULL && wcslen(wanted) == length && memcmp(wanted, name, length * sizeof(WCHAR)) == 0 )
+			return slot;
+	}
+
+	return -1;
+}
+
+
+/****
+ * ExtractIdentity
+ *
+ * DESC:
+ *     Reads the user identity out of a logon, logoff or NPS event that was
+ *     rendered as XML
+ *
+ * ARGS:
+ *     doc - The parsed event (all of it, not just <System>)
+ *     eventId - its event ID (see IsIdentityEvent)
+ *     identity - Receives the identity (pointing into the document)
+ *
+ * RETURNS:
+ *     TRUE if the event is one of the identity events and has EventData,
+ *     FALSE otherwise
+ *
+ * REMARKS:
+ *     Every field comes from EventData by name (see identityEvents), so
+ *     the result is the same whatever language the event is rendered in
+ *     and whichever Windows version laid out its message. The fields are
+ *     the ones userNameFlow used to cut out of the message.
+ */
+BOOL ExtractIdentity(rapidxml::xml_document<WCHAR> *doc, LPCWSTR eventId, IDENTITY_RECORD *identity)
+{
+	const IDENTITY_EVENT *event = FindIdentityEvent(eventId);
+	rapidxml::xml_node<WCHAR> *nodeEvent = doc->first_node(L"Event");
+	rapidxml::xml_node<WCHAR> *nodeData = nodeEvent != NULL ? nodeEvent->first_node(L"EventData") : NULL;
+
+	if( event == NULL || nodeData == NULL )
+		return FALSE;
+
+	LPCWSTR *slots[IDENTITY_SLOT_COUNT] = {
+		&identity->user, &identity->domain, &identity->logonId,
+		&identity->logonType, &identity->sourceAddress, &identity->workstation
+	};
+	DWORD wanted = 0, filled = 0;
+
+	for( INT slot = 0; slot < IDENTITY_SLOT_COUNT; slot++ ) {
+		*slots[slot] = NULL;
+
+		if( event->names[slot] != NULL )
+			wanted++;
+	}
+
+	for( rapidxml::xml_node<WCHAR> *node = nodeData->first_node(); node != NULL && filled < wanted; node = node->next_sibling() )
+	{
+		rapidxml::xml_attribute<WCHAR> *name = node->first_attribute(L"Name", 4);
+
+		if( name == NULL )
+			continue;
+
+		INT slot = IdentitySlot(event, name->value(), name->value_size());
+
+		// The first of each name wins, as with ExtractSystemFields
+		if( slot < 0 || *slots[slot] != NULL )
+			continue;
+
+		*slots[slot] = node->value();
+		filled++;
+	}
+
+	if( event->radius && identity->logonType != NULL ) {
+		LPCWSTR type = identity->logonType;
+
+		identity->logonType = NULL;
+
+		for( size_t i = 0; i < sizeof(radiusTypes) / sizeof(radiusTypes[0]); i++ ) {
+			if( wcscmp(radiusTypes[i].name, type) == 0 )
+				identity->logonType = radiusTypes[i].logonType;
+		}
+	}
+
+	for( INT slot = 0; slot < IDENTITY_SLOT_COUNT; slot++ ) {
+		if( *slots[slot] == NULL )
+			*slots[slot] = event->defaults[slot];
+	}
+
+	identity->state = event->state;
+
+	return TRUE;
+}
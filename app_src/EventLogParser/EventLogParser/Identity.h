@@ -0,0 +1,27 @@
+#pragma once
+
+#include "Platform.h"
+#include "RenderContext.h"
+
+// IDENTITY_RECORD.state, the login state userNameFlow has always sent
+#define IDENTITY_STATE_LOGON 0
+#define IDENTITY_STATE_HEALTHY 1
+#define IDENTITY_STATE_LOGOFF 2
+#define IDENTITY_STATE_DENIED 3
+#define IDENTITY_STATE_DISCARDED 4
+
+// Who logged on or off, and from where, as the logon and NPS events say
+// it. Fields the event does not have are empty strings. Pointers are only
+// valid until the next event is parsed in the same RenderContext
+struct IDENTITY_RECORD {
+	LPCWSTR user;
+	LPCWSTR domain;
+	LPCWSTR logonId;
+	LPCWSTR logonType;
+	LPCWSTR sourceAddress;
+	LPCWSTR workstation;
+	DWORD state;
+};
+
+BOOL IsIdentityEvent(LPCWSTR eventId);
+BOOL ExtractIdentity(rapidxml::xml_document<WCHAR>*, LPCWSTR, IDENTITY_RECORD*);
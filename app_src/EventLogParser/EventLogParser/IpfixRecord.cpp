@@ -0,0 +1,391 @@
+#include "IpfixRecord.h"
+#include "Utf8Encode.h"
+#include <stdio.h>
+#include <string.h>
+#include <wchar.h>
+
+// Bytes a variable-length field of n bytes takes, its length included
+#define IPFIX_FIELD_BYTES(n) ((n) <= IPFIX_SHORT_LENGTH_MAX ? 1 + (n) : IPFIX_LONG_LENGTH_BYTES + (n))
+
+
+// Appends the low n bytes of a number, most significant first
+static BYTE *PutNetwork(BYTE *out, DWORD64 number, size_t n)
+{
+	for( size_t i = n; i > 0; i-- ) {
+		out[i - 1] = (BYTE)number;
+		number >>= 8;
+	}
+
+	return out + n;
+}
+
+
+// Where UTF-8 text has to be cut to keep at most most bytes of it, without
+// splitting a character
+static size_t Utf8Cut(const BYTE *text, size_t bytes, size_t most)
+{
+	if( bytes <= most )
+		return bytes;
+
+	while( most > 0 && (text[most] & 0xC0) == 0x80 )
+		most--;
+
+	return most;
+}
+
+
+// The most bytes of text a variable-length field can have in room bytes
+static size_t FitString(DWORD64 room)
+{
+	if( room <= 1 )
+		return 0;
+
+	if( room - 1 <= IPFIX_SHORT_LENGTH_MAX )
+		return (size_t)(room - 1);
+
+	DWORD64 most = room - IPFIX_LONG_LENGTH_BYTES;
+
+	return most < IPFIX_SHORT_LENGTH_MAX ? IPFIX_SHORT_LENGTH_MAX : most > IPFIX_STRING_MAX ? IPFIX_STRING_MAX : (size_t)most;
+}
+
+
+/****
+ * PutString
+ *
+ * DESC:
+ *     Appends a string as a variable-length field: at most most bytes of
+ *     it as UTF-8, with carriage returns and line feeds made spaces
+ *
+ * ARGS:
+ *     out - where the field goes. Must have room for its length and
+ *           length * UTF8_MAX_GROWTH bytes
+ *     text - the string
+ *     length - characters of it to take (those past most bytes are left
+ *              out anyway)
+ *     most - most bytes of UTF-8 to keep (at most IPFIX_STRING_MAX)
+ *
+ * RETURNS:
+ *     Where the field ends
+ */
+static BYTE *PutString(BYTE *out, LPCWSTR text, size_t length, size_t most)
+{
+	// Every character is at least one byte, so the ones past most bytes
+	// need not be encoded
+	if( length > most )
+		length = most;
+
+	// Encoded where the long form of the length would leave it, unless it
+	// is sure to be short
+	BOOL shortForm = length * UTF8_MAX_GROWTH <= IPFIX_SHORT_LENGTH_MAX;
+	BYTE *start = out + (shortForm ? 1 : IPFIX_LONG_LENGTH_BYTES);
+	size_t written = Utf8Cut(start, WideToUtf8(text, length, (char *)start), most);
+
+	for( size_t i = 0; i < written; i++ ) {
+		if( start[i] == '\r' || start[i] == '\n' )
+			start[i] = ' ';
+	}
+
+	if( !shortForm && written <= IPFIX_SHORT_LENGTH_MAX ) {
+		memmove(out + 1, start, written);
+		shortForm = TRUE;
+	}
+
+	if( shortForm ) {
+		*out = (BYTE)written;
+		return out + 1 + written;
+	}
+
+	*out = IPFIX_LONG_LENGTH;
+	PutNetwork(out + 1, written, 2);
+
+	return out + IPFIX_LONG_LENGTH_BYTES + written;
+}
+
+
+void SetIpfixMachineId(IPFIX_EXPORT *exporter, LPCWSTR machineId)
+{
+	memset(exporter->machineId, 0, sizeof(exporter->machineId));
+
+	if( machineId == NULL )
+		return;
+
+	size_t length = wcslen(machineId);
+
+	if( length > IPFIX_MACHINE_ID_BYTES )
+		length = IPFIX_MACHINE_ID_BYTES;
+
+	BYTE encoded[IPFIX_MACHINE_ID_BYTES * UTF8_MAX_GROWTH];
+	size_t written = Utf8Cut(encoded, WideToUtf8(machineId, length, (char *)encoded), IPFIX_MACHINE_ID_BYTES);
+
+	memcpy(exporter->machineId, encoded, written);
+}
+
+
+DWORD GetIpfixSeconds(const SYSTEM_FIELDS *fields)
+{
+	DWORD64 timeCreated = 0;
+
+	if( !GetFieldNumber(fields, RECORD_FIELD_TIME_CREATED, &timeCreated) )
+		return 0;
+
+	DWORD64 unixSeconds = timeCreated / FILETIME_TICKS_PER_SECOND;
+	DWORD64 epoch = (DWORD64)FILETIME_EPOCH_DAYS * 86400;
+
+	if( unixSeconds < epoch || unixSeconds - epoch > 0xFFFFFFFF )
+		return 0;
+
+	return (DWORD)(unixSeconds - epoch);
+}
+
+
+void GetIpfixFlow(const SYSTEM_FIELDS *fields, LPCWSTR message, IPFIX_FLOW *flow)
+{
+	flow->channel = fields->channel;
+	flow->provider = fields->provider;
+	flow->message = message;
+	flow->recordId = 0;
+	flow->eventId = 0;
+	flow->count = IPFIX_MESSAGE_COUNT;
+	flow->firstSeconds = flow->lastSeconds = GetIpfixSeconds(fields);
+	flow->merged = FALSE;
+
+	GetFieldNumber(fields, RECORD_FIELD_RECORD_ID, &flow->recordId);
+	GetFieldNumber(fields, RECORD_FIELD_EVENT_ID, &flow->eventId);
+}
+
+
+BOOL EncodeIpfixRecord(GrowBuffer *buffer, const SYSTEM_FIELDS *fields, LPCWSTR message, const IPFIX_EXPORT *exporter, DWORD *bytes)
+{
+	IPFIX_FLOW flow;
+
+	GetIpfixFlow(fields, message, &flow);
+
+	return EncodeIpfixFlow(buffer, &flow, exporter, bytes);
+}
+
+
+BOOL EncodeIpfixFlow(GrowBuffer *buffer, const IPFIX_FLOW *flow, const IPFIX_EXPORT *exporter, DWORD *bytes)
+{
+	LPCWSTR channel = flow->channel != NULL ? flow->channel : L"";
+	LPCWSTR provider = flow->provider != NULL ? flow->provider : L"";
+	LPCWSTR message = flow->message != NULL ? flow->message : L"";
+
+	size_t channelLength = wcslen(channel);
+	size_t providerLength = wcslen(provider);
+	size_t messageLength = wcslen(message);
+
+	DWORD fixed = IPFIX_RECORD_FIXED_BYTES + (flow->merged ? IPFIX_FLOW_TIMES_BYTES : 0);
+
+	// What the strings have to share once the fixed fields are in
+	DWORD64 left = exporter->maxSetBytes - IPFIX_SET_HEADER - fixed;
+
+	// The channel and the provider are short, so their UTF-8 is measured
+	// up front and the message gets the rest. Only if the two do not fit
+	// with an empty message are they cut, the provider first
+	size_t channelMost = Utf8Length(channel, channelLength);
+	size_t providerMost = Utf8Length(provider, providerLength);
+
+	channelMost = channelMost < IPFIX_STRING_MAX ? channelMost : IPFIX_STRING_MAX;
+	providerMost = providerMost < IPFIX_STRING_MAX ? providerMost : IPFIX_STRING_MAX;
+
+	if( IPFIX_FIELD_BYTES(channelMost) + IPFIX_FIELD_BYTES(providerMost) + 1 > left ) {
+		if( IPFIX_FIELD_BYTES(channelMost) + 2 > left ) {
+			channelMost = FitString(left - 2);
+			providerMost = 0;
+		} else {
+			providerMost = FitString(left - IPFIX_FIELD_BYTES(channelMost) - 1);
+		}
+	}
+
+	size_t messageMost = FitString(left - IPFIX_FIELD_BYTES(channelMost) - IPFIX_FIELD_BYTES(providerMost));
+
+	// Room for the worst case, so that the strings can be encoded straight in
+	size_t longest[] = { channelLength < channelMost ? channelLength : channelMost,
+		providerLength < providerMost ? providerLength : providerMost,
+		messageLength < messageMost ? messageLength : messageMost };
+	DWORD64 room = fixed;
+
+	for( size_t i = 0; i < sizeof(longest) / sizeof(longest[0]); i++ )
+		room += IPFIX_LONG_LENGTH_BYTES + (DWORD64)longest[i] * UTF8_MAX_GROWTH;
+
+	if( room > 0xFFFFFFFF || !buffer->Reserve((DWORD)room) )
+		return FALSE;
+
+	BYTE *start = (BYTE *)buffer->Data();
+	BYTE *out = start;
+
+	memcpy(out, exporter->machineId, IPFIX_MACHINE_ID_BYTES);
+	out += IPFIX_MACHINE_ID_BYTES;
+
+	out = PutString(out, channel, channelLength, channelMost);
+	out = PutNetwork(out, flow->firstSeconds, 4);
+	out = PutNetwork(out, flow->recordId, 8);
+	out = PutNetwork(out, flow->eventId, 8);
+	out = PutString(out, provider, providerLength, providerMost);
+	out = PutString(out, message, messageLength, messageMost);
+	out = PutNetwork(out, flow->count, 8);
+	if( flow->merged ) {
+		out = PutNetwork(out, flow->firstSeconds, 4);
+		out = PutNetwork(out, flow->lastSeconds, 4);
+	}
+	out = PutNetwork(out, IPFIX_ROLLABLE, 1);
+
+	*bytes = (DWORD)(out - start);
+
+	return TRUE;
+}
+
+
+// UTF-8 bytes of a string that is sent whole, adding the bytes of its
+// field to *room. FALSE if it is longer than a field can be
+static BOOL MeasureWhole(LPCWSTR text, size_t length, DWORD64 *room)
+{
+	size_t encoded = Utf8Length(text, length);
+
+	if( encoded > IPFIX_STRING_MAX )
+		return FALSE;
+
+	*room += IPFIX_FIELD_BYTES(encoded);
+
+	return TRUE;
+}
+
+
+BOOL EncodeIpfixMined(GrowBuffer *buffer, const IPFIX_FLOW *flow, DWORD templateId, LPCWSTR parameters, const IPFIX_EXPORT *exporter, DWORD *bytes)
+{
+	LPCWSTR channel = flow->channel != NULL ? flow->channel : L"";
+	LPCWSTR provider = flow->provider != NULL ? flow->provider : L"";
+
+	if( parameters == NULL )
+		parameters = L"";
+
+	size_t channelLength = wcslen(channel);
+	size_t providerLength = wcslen(provider);
+	size_t parametersLength = wcslen(parameters);
+	DWORD64 needed = IPFIX_MINED_FIXED_BYTES + (flow->merged ? IPFIX_FLOW_TIMES_BYTES : 0);
+
+	*bytes = 0;
+
+	if( !MeasureWhole(channel, channelLength, &needed) || !MeasureWhole(provider, providerLength, &needed)
+		|| !MeasureWhole(parameters, parametersLength, &needed) || needed > exporter->maxSetBytes - IPFIX_SET_HEADER )
+		return TRUE;
+
+	// Room for the worst case, as the strings are encoded straight in
+	if( !buffer->Reserve((DWORD)needed + (DWORD)(channelLength + providerLength + parametersLength) * UTF8_MAX_GROWTH + 3 * IPFIX_LONG_LENGTH_BYTES) )
+		return FALSE;
+
+	BYTE *start = (BYTE *)buffer->Data();
+	BYTE *out = start;
+
+	memcpy(out, exporter->machineId, IPFIX_MACHINE_ID_BYTES);
+	out += IPFIX_MACHINE_ID_BYTES;
+
+	out = PutString(out, channel, channelLength, IPFIX_STRING_MAX);
+	out = PutNetwork(out, flow->firstSeconds, 4);
+	out = PutNetwork(out, flow->recordId, 8);
+	out = PutNetwork(out, flow->eventId, 8);
+	out = PutString(out, provider, providerLength, IPFIX_STRING_MAX);
+	out = PutNetwork(out, templateId, 4);
+	out = PutString(out, parameters, parametersLength, IPFIX_STRING_MAX);
+	out = PutNetwork(out, flow->count, 8);
+	if( flow->merged ) {
+		out = PutNetwork(out, flow->firstSeconds, 4);
+		out = PutNetwork(out, flow->lastSeconds, 4);
+	}
+	out = PutNetwork(out, IPFIX_ROLLABLE, 1);
+
+	*bytes = (DWORD)(out - start);
+
+	return TRUE;
+}
+
+
+BOOL EncodeIpfixAnnouncement(GrowBuffer *buffer, DWORD templateId, LPCWSTR text, const IPFIX_EXPORT *exporter, DWORD *bytes)
+{
+	if( text == NULL )
+		text = L"";
+
+	size_t textLength = wcslen(text);
+	DWORD64 needed = IPFIX_ANNOUNCE_FIXED_BYTES;
+
+	*bytes = 0;
+
+	if( !MeasureWhole(text, textLength, &needed) || needed > exporter->maxSetBytes - IPFIX_SET_HEADER )
+		return TRUE;
+
+	if( !buffer->Reserve((DWORD)needed + (DWORD)textLength * UTF8_MAX_GROWTH + IPFIX_LONG_LENGTH_BYTES) )
+		return FALSE;
+
+	BYTE *start = (BYTE *)buffer->Data();
+	BYTE *out = start;
+
+	memcpy(out, exporter->machineId, IPFIX_MACHINE_ID_BYTES);
+	out += IPFIX_MACHINE_ID_BYTES;
+
+	out = PutNetwork(out, templateId, 4);
+	out = PutString(out, text, textLength, IPFIX_STRING_MAX);
+
+	*bytes = (DWORD)(out - start);
+
+	return TRUE;
+}
+
+
+BOOL WriteIpfixFlow(OutputSink *sink, GrowBuffer *buffer, const IPFIX_FLOW *flow, const IPFIX_EXPORT *exporter, TemplateMiner *miner)
+{
+	DWORD bytes = 0;
+	DWORD setId = flow->merged ? exporter->flowTemplateId : exporter->templateId;
+	DWORD minedId = flow->merged ? exporter->minedFlowTemplateId : exporter->minedTemplateId;
+	DWORD found = 0;
+	BOOL mining = exporter->minedTemplateId != 0 && minedId != 0 && miner != NULL;
+	BOOL whole = TRUE;
+
+	if( mining ) {
+		LPCWSTR parameters = NULL;
+
+		// A flow the sink refuses is mined again when it is offered again,
+		// so it is only counted once it has gone out
+		DWORD templateId = found = miner->Mine(flow->message, &parameters, FALSE);
+
+		// The collector has to know the template's text before the first
+		// record that uses it. Text too long for a set leaves the message whole
+		if( templateId != 0 && miner->Announced(templateId) != miner->Version(templateId) ) {
+			if( !EncodeIpfixAnnouncement(buffer, templateId, miner->Text(templateId), exporter, &bytes) ) {
+				fwprintf(stderr, L"[Error][WriteIpfixFlow]: malloc failed\n");
+				return TRUE;
+			}
+
+			if( bytes == 0 )
+				templateId = 0;
+			else if( !sink->WriteIpfix(exporter->announceTemplateId, (const BYTE *)buffer->Data(), bytes) )
+				return FALSE;
+			else
+				miner->SetAnnounced(templateId, miner->Version(templateId));
+		}
+
+		if( templateId != 0 ) {
+			if( !EncodeIpfixMined(buffer, flow, templateId, parameters, exporter, &bytes) ) {
+				fwprintf(stderr, L"[Error][WriteIpfixFlow]: malloc failed\n");
+				return TRUE;
+			}
+
+			if( bytes != 0 ) {
+				setId = minedId;
+				whole = FALSE;
+			}
+		}
+	}
+
+	if( whole && !EncodeIpfixFlow(buffer, flow, exporter, &bytes) ) {
+		fwprintf(stderr, L"[Error][WriteIpfixFlow]: malloc failed\n");
+		return TRUE;
+	}
+
+	if( !sink->WriteIpfix(setId, (const BYTE *)buffer->Data(), bytes) )
+		return FALSE;
+
+	if( mining )
+		miner->Count(found);
+
+	return TRUE;
+}
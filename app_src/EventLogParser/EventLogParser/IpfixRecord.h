@@ -0,0 +1,309 @@
+#pragma once
+
+#include "Platform.h"
+#include "RenderContext.h"
+#include "SystemFields.h"
+#include "OutputSink.h"
+#include "TemplateMiner.h"
+#include <string.h>
+
+// Least ID a data set may have: a template's ID is 256 or more, and the
+// set of its records has that ID (RFC 7011, 3.3.2)
+#define IPFIX_TEMPLATE_ID_MIN 256
+
+// Bytes of the header of a set (its ID and length), and of the message
+// header ahead of the sets
+#define IPFIX_SET_HEADER 4
+#define IPFIX_MESSAGE_HEADER 16
+
+// Most bytes of a set, header included, when the caller does not say: what
+// still fits in one datagram as FDI sends them (its max_pack_len, 1500 less
+// 42 bytes of Ethernet, IP and UDP headers) after the message header. A
+// set cannot be larger than IPFIX_SET_BYTES_MAX, as a message's length is
+// 16 bits, nor smaller than IPFIX_SET_BYTES_MIN, which always holds one
+// record with its strings cut short
+#define IPFIX_SET_BYTES_DEFAULT (1458 - IPFIX_MESSAGE_HEADER)
+#define IPFIX_SET_BYTES_MAX (0xFFFF - IPFIX_MESSAGE_HEADER)
+#define IPFIX_SET_BYTES_MIN 128
+
+// Bytes of ipfixifymachineid, a fixed-length string
+#define IPFIX_MACHINE_ID_BYTES 32
+
+// Bytes of the fixed-length fields of an EpEventLog record: machine ID,
+// observationTimeSeconds, record ID, event ID, message count and rollable
+#define IPFIX_RECORD_FIXED_BYTES (IPFIX_MACHINE_ID_BYTES + 4 + 8 + 8 + 8 + 1)
+
+// Bytes of the fixed-length fields of an EpEventLogMined record: those of
+// EpEventLog and the message's template ID; and of an oMessageTemplate
+// record: the machine ID and the template ID
+#define IPFIX_MINED_FIXED_BYTES (IPFIX_RECORD_FIXED_BYTES + 4)
+#define IPFIX_ANNOUNCE_FIXED_BYTES (IPFIX_MACHINE_ID_BYTES + 4)
+
+// What a merged flow adds to either: flowStartSeconds and flowEndSeconds
+#define IPFIX_FLOW_TIMES_BYTES (4 + 4)
+
+// A variable-length field's length is one byte up to IPFIX_SHORT_LENGTH_MAX;
+// a longer one is IPFIX_LONG_LENGTH and then two bytes of length, up to
+// IPFIX_STRING_MAX (RFC 7011, 7)
+#define IPFIX_SHORT_LENGTH_MAX 254
+#define IPFIX_LONG_LENGTH 0xFF
+#define IPFIX_LONG_LENGTH_BYTES 3
+#define IPFIX_STRING_MAX 0xFFFF
+
+// What an EpEventLog record of one event has in its
+// ipfixifydeltamessagecount, and what every record has in rollable, as
+// ipfixify::parse::fileLine writes them
+#define IPFIX_MESSAGE_COUNT 1
+#define IPFIX_ROLLABLE 1
+
+// How a session's events are written as IPFIX (see SetIpfixExport).
+// templateId is the ID the EpEventLog template was given by the exporter,
+// 0 until it is set. machineId is ipfixifymachineid as UTF-8, padded with
+// nulls. maxSetBytes bounds each data set, header included.
+// minedTemplateId and announceTemplateId are the IDs of the
+// EpEventLogMined and oMessageTemplate templates when messages are sent
+// as their templates and parameters (see WriteIpfixFlow), and 0 when they
+// are sent whole. flowTemplateId and minedFlowTemplateId are those of
+// EpEventLogFlow and EpEventLogMinedFlow, which merged flows go out as
+// (see SetIpfixAggregation); a merged flow is not mined while
+// minedFlowTemplateId is 0
+struct IPFIX_EXPORT {
+	WORD templateId;
+	WORD minedTemplateId;
+	WORD announceTemplateId;
+	WORD flowTemplateId;
+	WORD minedFlowTemplateId;
+	DWORD maxSetBytes;
+	BYTE machineId[IPFIX_MACHINE_ID_BYTES];
+
+	IPFIX_EXPORT() : templateId(0), minedTemplateId(0), announceTemplateId(0), flowTemplateId(0), minedFlowTemplateId(0), maxSetBytes(IPFIX_SET_BYTES_DEFAULT) { memset(machineId, 0, sizeof(machineId)); }
+};
+
+// What one record says: an event, or the events an EventAggregator
+// merged into a flow. The strings, record ID and message are those of its
+// first event; count is how many events it stands for, and firstSeconds
+// and lastSeconds the earliest and latest of their TimeCreated, in Unix
+// seconds. A merged flow goes out with its start and end, in an
+// EpEventLogFlow record; an event in an EpEventLog record, which has
+// neither. NULL strings are sent empty
+struct IPFIX_FLOW {
+	LPCWSTR channel;
+	LPCWSTR provider;
+	LPCWSTR message;
+	DWORD64 recordId;
+	DWORD64 eventId;
+	DWORD64 count;
+	DWORD firstSeconds;
+	DWORD lastSeconds;
+	BOOL merged;
+};
+
+/****
+ * SetIpfixMachineId
+ *
+ * DESC:
+ *     Sets the ipfixifymachineid of an export: the ID as UTF-8, cut short
+ *     at a whole character if it is longer than IPFIX_MACHINE_ID_BYTES,
+ *     and padded with nulls if shorter
+ */
+void SetIpfixMachineId(IPFIX_EXPORT *exporter, LPCWSTR machineId);
+
+/****
+ * GetIpfixSeconds
+ *
+ * DESC:
+ *     TimeCreated of an event in whole Unix seconds, as fileLine's timegm
+ *     has it
+ *
+ * RETURNS:
+ *     The seconds, or 0 if the event has no TimeCreated or it is outside
+ *     what 32 bits of Unix seconds hold
+ */
+DWORD GetIpfixSeconds(const SYSTEM_FIELDS *fields);
+
+/****
+ * GetIpfixFlow
+ *
+ * DESC:
+ *     What the EpEventLog record of one event says: a flow of that event
+ *     alone, not merged, with a count of IPFIX_MESSAGE_COUNT and
+ *     TimeCreated as its start and end
+ *
+ * ARGS:
+ *     fields - System fields of the event
+ *     message - its message, or NULL if it has none
+ *     flow - receives the flow. Its strings are those of fields
+ */
+void GetIpfixFlow(const SYSTEM_FIELDS *fields, LPCWSTR message, IPFIX_FLOW *flow);
+
+/****
+ * EncodeIpfixRecord
+ *
+ * DESC:
+ *     Formats an event as one IPFIX data record of the EpEventLog template
+ *     (OUTPUT_FORMAT_IPFIX), the one ipfixify::definitions::tempSelect has
+ *     for flow caches 1 to 3, the fields fileLine joins for the spool file
+ *     (see GetIpfixFlow and EncodeIpfixFlow)
+ *
+ * ARGS:
+ *     buffer - where the record is built (the render context's record
+ *              buffer)
+ *     fields - System fields of the event
+ *     message - its message, or NULL if it has none
+ *     exporter - the machine ID and the most a set may take
+ *     bytes - receives the size of the record
+ *
+ * RETURNS:
+ *     TRUE, or FALSE if the buffer could not be grown
+ *
+ * REMARKS:
+ *     The fields are what fileLine would have sent for the event: carriage
+ *     returns and line feeds in the strings become spaces, and a field the
+ *     event (or the session's projection) does not have is 0 or empty.
+ *     Unlike FDD::IPFIX, which cuts strings at 254 bytes, a string is
+ *     only cut short, at a whole character, where it would not fit in the
+ *     16-bit length or the record in one set: the message first, then the
+ *     provider, then the channel.
+ */
+BOOL EncodeIpfixRecord(GrowBuffer *buffer, const SYSTEM_FIELDS *fields, LPCWSTR message, const IPFIX_EXPORT *exporter, DWORD *bytes);
+
+/****
+ * EncodeIpfixFlow
+ *
+ * DESC:
+ *     Formats a flow as one IPFIX data record of the EpEventLog template,
+ *     or of EpEventLogFlow (flow cache 30) if it is merged. In network
+ *     byte order:
+ *
+ *         32   ipfixifymachineid          the export's machine ID
+ *         var  ipfixifylogname            the channel
+ *         u32  observationTimeSeconds     firstSeconds
+ *         u64  ipfixifyeventrecordid      record ID
+ *         i64  ipfixifyeventid            event ID
+ *         var  ipfixifylogsource          provider
+ *         var  ipfixifymessage            message
+ *         u64  ipfixifydeltamessagecount  count
+ *         u32  flowStartSeconds           firstSeconds (merged only)
+ *         u32  flowEndSeconds             lastSeconds (merged only)
+ *         u8   rollable                   IPFIX_ROLLABLE
+ *
+ *     Each variable-length (var) string is UTF-8 with its length ahead of
+ *     it, in one byte or in three (see IPFIX_SHORT_LENGTH_MAX)
+ *
+ * ARGS:
+ *     buffer - where the record is built
+ *     flow - what the record says
+ *     exporter - the machine ID and the most a set may take
+ *     bytes - receives the size of the record
+ *
+ * RETURNS:
+ *     TRUE, or FALSE if the buffer could not be grown
+ *
+ * REMARKS:
+ *     Strings are cut as EncodeIpfixRecord says.
+ */
+BOOL EncodeIpfixFlow(GrowBuffer *buffer, const IPFIX_FLOW *flow, const IPFIX_EXPORT *exporter, DWORD *bytes);
+
+/****
+ * EncodeIpfixMined
+ *
+ * DESC:
+ *     Formats a flow as one IPFIX data record of the EpEventLogMined
+ *     template, or of EpEventLogMinedFlow (flow cache 31) if it is merged:
+ *     the record EncodeIpfixFlow writes with its message sent as the ID
+ *     of its template and its parameters (see TemplateMiner::Mine). In
+ *     network byte order:
+ *
+ *         32   ipfixifymachineid           the export's machine ID
+ *         var  ipfixifylogname             the channel
+ *         u32  observationTimeSeconds      firstSeconds
+ *         u64  ipfixifyeventrecordid       record ID
+ *         i64  ipfixifyeventid             event ID
+ *         var  ipfixifylogsource           provider
+ *         u32  ipfixifymessagetemplateid   templateId
+ *         var  ipfixifymessageparameters   parameters
+ *         u64  ipfixifydeltamessagecount   count
+ *         u32  flowStartSeconds            firstSeconds (merged only)
+ *         u32  flowEndSeconds              lastSeconds (merged only)
+ *         u8   rollable                    IPFIX_ROLLABLE
+ *
+ * ARGS:
+ *     buffer - where the record is built
+ *     flow - what the record says (its message is left out)
+ *     templateId - ID of the message's template
+ *     parameters - the message's parameters
+ *     exporter - the machine ID and the most a set may take
+ *     bytes - receives the size of the record, or 0 if it does not fit in
+ *             a set with none of its strings cut short
+ *
+ * RETURNS:
+ *     TRUE, or FALSE if the buffer could not be grown
+ *
+ * REMARKS:
+ *     A cut parameter would not give the message back, so a record that
+ *     does not fit whole is not written; the flow then goes out as an
+ *     EpEventLog or EpEventLogFlow record, which can be cut.
+ */
+BOOL EncodeIpfixMined(GrowBuffer *buffer, const IPFIX_FLOW *flow, DWORD templateId, LPCWSTR parameters, const IPFIX_EXPORT *exporter, DWORD *bytes);
+
+/****
+ * EncodeIpfixAnnouncement
+ *
+ * DESC:
+ *     Formats the text of a message template as one IPFIX data record of
+ *     the oMessageTemplate options template, scoped by the machine and the
+ *     template's ID. In network byte order:
+ *
+ *         32   ipfixifymachineid           the export's machine ID
+ *         u32  ipfixifymessagetemplateid   templateId
+ *         var  ipfixifymessagetemplate     text
+ *
+ * ARGS:
+ *     buffer - where the record is built
+ *     templateId - ID of the template
+ *     text - its text (see TemplateMiner::Text)
+ *     exporter - the machine ID and the most a set may take
+ *     bytes - receives the size of the record, or 0 if the text does not
+ *             fit in a set whole
+ *
+ * RETURNS:
+ *     TRUE, or FALSE if the buffer could not be grown
+ *
+ * REMARKS:
+ *     Carriage returns and line feeds in the text become spaces, as they
+ *     do in the message of an EpEventLog record, so the text expanded
+ *     with a message's parameters is what that record would have said.
+ */
+BOOL EncodeIpfixAnnouncement(GrowBuffer *buffer, DWORD templateId, LPCWSTR text, const IPFIX_EXPORT *exporter, DWORD *bytes);
+
+/****
+ * WriteIpfixFlow
+ *
+ * DESC:
+ *     Writes a flow to a sink: as an EpEventLogMined record if the export
+ *     mines messages and the message has a template, with the template's
+ *     text announced ahead of it if this version of it has not been, or
+ *     else as an EpEventLog record. A merged flow goes out as
+ *     EpEventLogMinedFlow or EpEventLogFlow instead, and is only mined if
+ *     the export has an ID for the former
+ *
+ * ARGS:
+ *     sink - where the records go, each in a set of its template's ID
+ *     buffer - where each record is built
+ *     flow - what the record says
+ *     exporter - the machine ID, the most a set may take and the IDs of
+ *                the templates
+ *     miner - the session's templates (see IPFIX_EXPORT)
+ *
+ * RETURNS:
+ *     TRUE once the flow is written (or could not be formatted, which is
+ *     reported), FALSE if the sink refused it. An announcement the sink
+ *     took stays announced, and the flow is written after it next time
+ *
+ * REMARKS:
+ *     A message with no template (see TemplateMiner::Mine), or whose
+ *     template's text or parameters do not fit in a set whole, goes out
+ *     whole. The miner counts the message once the sink has taken its
+ *     record, so a flow offered again counts once.
+ */
+BOOL WriteIpfixFlow(OutputSink *sink, GrowBuffer *buffer, const IPFIX_FLOW *flow, const IPFIX_EXPORT *exporter, TemplateMiner *miner);
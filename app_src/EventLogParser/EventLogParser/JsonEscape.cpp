@@ -0,0 +1,257 @@
+#include "JsonEscape.h"
+#include "Simd.h"
+#include <string.h>
+
+static const WCHAR hexDigits[] = L"0123456789abcdef";
+
+static inline BOOL NeedsEscape(WCHAR c)
+{
+	return c == L'"' || c == L'\\' || (DWORD)c < 0x20;
+}
+
+
+/****
+ * EscapeChar
+ *
+ * DESC:
+ *     Writes the escape sequence for one character that NeedsEscape
+ *
+ * RETURNS:
+ *     The number of characters written
+ */
+static inline size_t EscapeChar(WCHAR c, LPWSTR out)
+{
+	out[0] = L'\\';
+
+	switch( c )
+	{
+	case L'"': out[1] = L'"'; return 2;
+	case L'\\': out[1] = L'\\'; return 2;
+	case L'\b': out[1] = L'b'; return 2;
+	case L'\f': out[1] = L'f'; return 2;
+	case L'\n': out[1] = L'n'; return 2;
+	case L'\r': out[1] = L'r'; return 2;
+	case L'\t': out[1] = L't'; return 2;
+	}
+
+	out[1] = L'u';
+	out[2] = L'0';
+	out[3] = L'0';
+	out[4] = hexDigits[(c >> 4) & 0xF];
+	out[5] = hexDigits[c & 0xF];
+
+	return 6;
+}
+
+
+static inline size_t EscapeChars(LPCWSTR text, size_t length, LPWSTR out)
+{
+	LPWSTR start = out;
+
+	for( size_t i = 0; i < length; i++ )
+	{
+		if( NeedsEscape(text[i]) )
+			out += EscapeChar(text[i], out);
+		else
+			*out++ = text[i];
+	}
+
+	return out - start;
+}
+
+
+size_t EscapeJsonScalar(LPCWSTR text, size_t length, LPWSTR out)
+{
+	return EscapeChars(text, length, out);
+}
+
+
+#ifdef PARSER_SIMD
+
+/****
+ * EscapeBlock
+ *
+ * DESC:
+ *     Escapes one vector's worth of characters, given the movemask of its
+ *     special lanes (sizeof(WCHAR) bits per lane)
+ *
+ * RETURNS:
+ *     The number of characters written
+ */
+static inline size_t EscapeBlock(LPCWSTR text, size_t lanes, DWORD mask, LPWSTR out)
+{
+	const DWORD laneBits = (1 << sizeof(WCHAR)) - 1;
+	LPWSTR start = out;
+	size_t done = 0;
+
+	while( mask != 0 )
+	{
+		size_t special = CountTrailingZeros(mask) / sizeof(WCHAR);
+
+		while( done < special )
+			*out++ = text[done++];
+
+		out += EscapeChar(text[special], out);
+		done = special + 1;
+		mask &= ~(laneBits << (special * sizeof(WCHAR)));
+	}
+
+	while( done < lanes )
+		*out++ = text[done++];
+
+	return out - start;
+}
+
+
+// Lanes that are '"', '\' or below 0x20. WCHAR is 2 bytes on Windows
+// and 4 elsewhere; the unused branch is compiled out
+static inline __m128i SpecialsSse2(__m128i v)
+{
+	if( sizeof(WCHAR) == 2 )
+	{
+		// Unsigned v <= 0x1F is v - 0x1F saturating to 0
+		__m128i control = _mm_cmpeq_epi16(_mm_subs_epu16(v, _mm_set1_epi16(0x1F)), _mm_setzero_si128());
+		__m128i quote = _mm_cmpeq_epi16(v, _mm_set1_epi16(L'"'));
+		__m128i backslash = _mm_cmpeq_epi16(v, _mm_set1_epi16(L'\\'));
+
+		return _mm_or_si128(control, _mm_or_si128(quote, backslash));
+	}
+
+	// No unsigned 32-bit compare in SSE2; flip the sign bit and compare signed
+	__m128i biased = _mm_xor_si128(v, _mm_set1_epi32((INT)0x80000000));
+	__m128i control = _mm_cmplt_epi32(biased, _mm_set1_epi32((INT)0x80000020));
+	__m128i quote = _mm_cmpeq_epi32(v, _mm_set1_epi32(L'"'));
+	__m128i backslash = _mm_cmpeq_epi32(v, _mm_set1_epi32(L'\\'));
+
+	return _mm_or_si128(control, _mm_or_si128(quote, backslash));
+}
+
+
+// Inline, so that the AVX2 path's tail is VEX-encoded along with it;
+// calling legacy SSE code with dirty upper halves stalls some CPUs
+static inline size_t EscapeVectorsSse2(LPCWSTR text, size_t length, LPWSTR out)
+{
+	const size_t lanes = sizeof(__m128i) / sizeof(WCHAR);
+	LPWSTR start = out;
+	size_t i = 0;
+
+	for( ; i + lanes <= length; i += lanes )
+	{
+		__m128i v = _mm_loadu_si128((const __m128i *)(text + i));
+		DWORD mask = (DWORD)_mm_movemask_epi8(SpecialsSse2(v));
+
+		// Clean runs are stored as they were loaded
+		if( mask == 0 ) {
+			_mm_storeu_si128((__m128i *)out, v);
+			out += lanes;
+		} else {
+			out += EscapeBlock(text + i, lanes, mask, out);
+		}
+	}
+
+	return (out - start) + EscapeChars(text + i, length - i, out);
+}
+
+
+static size_t EscapeJsonSse2(LPCWSTR text, size_t length, LPWSTR out)
+{
+	return EscapeVectorsSse2(text, length, out);
+}
+
+
+PARSER_TARGET_AVX2 static inline __m256i SpecialsAvx2(__m256i v)
+{
+	if( sizeof(WCHAR) == 2 )
+	{
+		__m256i control = _mm256_cmpeq_epi16(_mm256_subs_epu16(v, _mm256_set1_epi16(0x1F)), _mm256_setzero_si256());
+		__m256i quote = _mm256_cmpeq_epi16(v, _mm256_set1_epi16(L'"'));
+		__m256i backslash = _mm256_cmpeq_epi16(v, _mm256_set1_epi16(L'\\'));
+
+		return _mm256_or_si256(control, _mm256_or_si256(quote, backslash));
+	}
+
+	// 0x20 > v, signed, once the sign bit is flipped
+	__m256i biased = _mm256_xor_si256(v, _mm256_set1_epi32((INT)0x80000000));
+	__m256i control = _mm256_cmpgt_epi32(_mm256_set1_epi32((INT)0x80000020), biased);
+	__m256i quote = _mm256_cmpeq_epi32(v, _mm256_set1_epi32(L'"'));
+	__m256i backslash = _mm256_cmpeq_epi32(v, _mm256_set1_epi32(L'\\'));
+
+	return _mm256_or_si256(control, _mm256_or_si256(quote, backslash));
+}
+
+
+PARSER_TARGET_AVX2 static size_t EscapeJsonAvx2(LPCWSTR text, size_t length, LPWSTR out)
+{
+	const size_t lanes = sizeof(__m256i) / sizeof(WCHAR);
+	LPWSTR start = out;
+	size_t i = 0;
+
+	for( ; i + lanes <= length; i += lanes )
+	{
+		__m256i v = _mm256_loadu_si256((const __m256i *)(text + i));
+		DWORD mask = (DWORD)_mm256_movemask_epi8(SpecialsAvx2(v));
+
+		if( mask == 0 ) {
+			_mm256_storeu_si256((__m256i *)out, v);
+			out += lanes;
+		} else {
+			out += EscapeBlock(text + i, lanes, mask, out);
+		}
+	}
+
+	// The tail is shorter than one AVX2 vector, but may fill an SSE2 one
+	return (out - start) + EscapeVectorsSse2(text + i, length - i, out);
+}
+
+#endif
+
+
+JSON_ESCAPE_ROUTINE GetJsonEscapeRoutine(INT kind)
+{
+	switch( kind )
+	{
+	case JSON_ESCAPE_DEFAULT:
+#ifdef PARSER_SIMD
+		return CpuHasAvx2() ? EscapeJsonAvx2 : EscapeJsonSse2;
+#else
+		return EscapeJsonScalar;
+#endif
+#ifdef PARSER_SIMD
+	case JSON_ESCAPE_AVX2:
+		return CpuHasAvx2() ? EscapeJsonAvx2 : NULL;
+	case JSON_ESCAPE_SSE2:
+		return EscapeJsonSse2;
+#endif
+	case JSON_ESCAPE_SCALAR:
+		return EscapeJsonScalar;
+	}
+
+	return NULL;
+}
+
+
+const char *GetJsonEscapeName(INT kind)
+{
+	JSON_ESCAPE_ROUTINE routine = GetJsonEscapeRoutine(kind);
+
+	if( routine == NULL )
+		return "unavailable";
+
+#ifdef PARSER_SIMD
+	if( routine == EscapeJsonAvx2 )
+		return "avx2";
+	if( routine == EscapeJsonSse2 )
+		return "sse2";
+#endif
+
+	return "scalar";
+}
+
+
+size_t EscapeJson(LPCWSTR text, size_t length, LPWSTR out)
+{
+	// Picked once; the CPU does not change under us
+	static const JSON_ESCAPE_ROUTINE routine = GetJsonEscapeRoutine(JSON_ESCAPE_DEFAULT);
+
+	return routine(text, length, out);
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "Platform.h"
+
+// Most characters one input character escapes to (a control character
+// becomes \u00XX)
+#define JSON_ESCAPE_MAX_GROWTH 6
+
+// Escape implementations, fastest first. JSON_ESCAPE_DEFAULT picks the
+// fastest one this CPU supports
+#define JSON_ESCAPE_DEFAULT 0
+#define JSON_ESCAPE_AVX2 1
+#define JSON_ESCAPE_SSE2 2
+#define JSON_ESCAPE_SCALAR 3
+
+typedef size_t (*JSON_ESCAPE_ROUTINE)(LPCWSTR text, size_t length, LPWSTR out);
+
+/****
+ * EscapeJson
+ *
+ * DESC:
+ *     Escapes text for use inside a JSON string, in one pass: '"' and '\'
+ *     get a backslash, control characters become \b \f \n \r \t or \u00XX.
+ *     Everything else, including non-ASCII characters, is copied as it is
+ *
+ * ARGS:
+ *     text - characters to escape (need not be null-terminated)
+ *     length - number of characters in text
+ *     out - where the escaped text goes. Must have room for
+ *           length * JSON_ESCAPE_MAX_GROWTH characters
+ *
+ * RETURNS:
+ *     The number of characters written to out. Nothing is null-terminated
+ *
+ * REMARKS:
+ *     On x86 runs of clean characters are found 16 or 32 bytes at a time
+ *     (SSE2, or AVX2 where the CPU has it) and copied in one go; only the
+ *     characters that need escaping go through the scalar path.
+ *     EscapeJsonScalar is the plain reference the vector versions must
+ *     match exactly (see the escape bench).
+ */
+size_t EscapeJson(LPCWSTR text, size_t length, LPWSTR out);
+size_t EscapeJsonScalar(LPCWSTR text, size_t length, LPWSTR out);
+
+// The routine for one implementation, or NULL if this build or CPU
+// does not have it
+JSON_ESCAPE_ROUTINE GetJsonEscapeRoutine(INT kind);
+const char *GetJsonEscapeName(INT kind);
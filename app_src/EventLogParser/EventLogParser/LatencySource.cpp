@@ -0,0 +1,120 @@
+#include "LatencySource.h"
+#include <chrono>
+#include <thread>
+
+/****
+ * LatencySource::LatencySource
+ *
+ * ARGS:
+ *     inner - the source doing the actual work (not owned)
+ *     nextMs, perEventUs, publisherMs, formatUs - see the class remarks
+ */
+LatencySource::LatencySource(EventSource *inner, DWORD nextMs, DWORD perEventUs, DWORD publisherMs, DWORD formatUs)
+	: inner(inner), nextMs(nextMs), perEventUs(perEventUs), publisherMs(publisherMs), formatUs(formatUs)
+{
+}
+
+
+EVT_HANDLE LatencySource::Query(LPCWSTR logName, LPCWSTR query, DWORD flags)
+{
+	std::this_thread::sleep_for(std::chrono::milliseconds(nextMs));
+
+	return inner->Query(logName, query, flags);
+}
+
+
+BOOL LatencySource::Next(EVT_HANDLE hResults, DWORD count, EVT_HANDLE *events, DWORD timeout, DWORD *returned)
+{
+	BOOL ok = inner->Next(hResults, count, events, timeout, returned);
+	DWORD error = GetLastError();
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(nextMs) + std::chrono::microseconds((ok ? *returned : 0) * (DWORD64)perEventUs));
+
+	// The sleep must not disturb the error the caller is about to read
+	SetLastError(error);
+
+	return ok;
+}
+
+
+BOOL LatencySource::Render(EVT_HANDLE hContext, EVT_HANDLE hEvent, DWORD flags, DWORD bufferSize, PVOID buffer, DWORD *bufferUsed, DWORD *propertyCount)
+{
+	// Events are already local once Next has returned them
+	return inner->Render(hContext, hEvent, flags, bufferSize, buffer, bufferUsed, propertyCount);
+}
+
+
+EVT_HANDLE LatencySource::CreateRenderContext(DWORD flags)
+{
+	return inner->CreateRenderContext(flags);
+}
+
+
+EVT_HANDLE LatencySource::OpenPublisherMetadata(LPCWSTR publisherName)
+{
+	EVT_HANDLE hMetadata = inner->OpenPublisherMetadata(publisherName);
+	DWORD error = GetLastError();
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(publisherMs));
+	SetLastError(error);
+
+	return hMetadata;
+}
+
+
+BOOL LatencySource::FormatEventMessage(EVT_HANDLE hMetadata, EVT_HANDLE hEvent, DWORD bufferSize, LPWSTR buffer, DWORD *bufferUsed)
+{
+	BOOL ok = inner->FormatEventMessage(hMetadata, hEvent, bufferSize, buffer, bufferUsed);
+	DWORD error = GetLastError();
+
+	if( formatUs > 0 )
+		std::this_thread::sleep_for(std::chrono::microseconds(formatUs));
+	SetLastError(error);
+
+	return ok;
+}
+
+
+BOOL LatencySource::GetMessageTemplate(EVT_HANDLE hMetadata, DWORD eventId, DWORD version, DWORD bufferSize, LPWSTR buffer, DWORD *bufferUsed)
+{
+	BOOL ok = inner->GetMessageTemplate(hMetadata, eventId, version, bufferSize, buffer, bufferUsed);
+	DWORD error = GetLastError();
+
+	if( formatUs > 0 )
+		std::this_thread::sleep_for(std::chrono::microseconds(formatUs));
+	SetLastError(error);
+
+	return ok;
+}
+
+
+BOOL LatencySource::Close(EVT_HANDLE hObject)
+{
+	return inner->Close(hObject);
+}
+
+
+EVT_HANDLE LatencySource::Subscribe(LPCWSTR logName, LPCWSTR query, EVT_HANDLE hBookmark, DWORD flags)
+{
+	std::this_thread::sleep_for(std::chrono::milliseconds(nextMs));
+
+	return inner->Subscribe(logName, query, hBookmark, flags);
+}
+
+
+BOOL LatencySource::WaitForEvents(EVT_HANDLE hSubscription, DWORD timeout)
+{
+	return inner->WaitForEvents(hSubscription, timeout);
+}
+
+
+EVT_HANDLE LatencySource::CreateBookmark(LPCWSTR bookmarkXml)
+{
+	return inner->CreateBookmark(bookmarkXml);
+}
+
+
+BOOL LatencySource::UpdateBookmark(EVT_HANDLE hBookmark, EVT_HANDLE hEvent)
+{
+	return inner->UpdateBookmark(hBookmark, hEvent);
+}
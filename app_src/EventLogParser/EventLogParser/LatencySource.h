@@ -0,0 +1,48 @@
+#pragma once
+
+#include "Platform.h"
+#include "EventSource.h"
+
+/****
+ * LatencySource
+ *
+ * DESC:
+ *     Wraps another event source and makes its calls slow, the way a
+ *     remote winevt session is. Used to measure how the fetch pipeline
+ *     and the publisher cache hold up against round trips
+ *
+ * REMARKS:
+ *     nextMs - cost of every Next call (one round trip)
+ *     perEventUs - extra cost per event Next returns (transfer)
+ *     publisherMs - cost of OpenPublisherMetadata
+ *     formatUs - cost of FormatEventMessage (and of GetMessageTemplate)
+ *
+ *     Subscribe costs a round trip, as Query does. Waiting for events and
+ *     bookmarks cost nothing extra: the service pushes the signal, and
+ *     bookmarks are kept locally
+ */
+class LatencySource : public EventSource {
+public:
+	LatencySource(EventSource *inner, DWORD nextMs, DWORD perEventUs = 0, DWORD publisherMs = 0, DWORD formatUs = 0);
+
+	EVT_HANDLE Query(LPCWSTR logName, LPCWSTR query, DWORD flags);
+	BOOL Next(EVT_HANDLE hResults, DWORD count, EVT_HANDLE *events, DWORD timeout, DWORD *returned);
+	BOOL Render(EVT_HANDLE hContext, EVT_HANDLE hEvent, DWORD flags, DWORD bufferSize, PVOID buffer, DWORD *bufferUsed, DWORD *propertyCount);
+	EVT_HANDLE CreateRenderContext(DWORD flags);
+	EVT_HANDLE OpenPublisherMetadata(LPCWSTR publisherName);
+	BOOL FormatEventMessage(EVT_HANDLE hMetadata, EVT_HANDLE hEvent, DWORD bufferSize, LPWSTR buffer, DWORD *bufferUsed);
+	BOOL GetMessageTemplate(EVT_HANDLE hMetadata, DWORD eventId, DWORD version, DWORD bufferSize, LPWSTR buffer, DWORD *bufferUsed);
+	BOOL Close(EVT_HANDLE hObject);
+
+	EVT_HANDLE Subscribe(LPCWSTR logName, LPCWSTR query, EVT_HANDLE hBookmark, DWORD flags);
+	BOOL WaitForEvents(EVT_HANDLE hSubscription, DWORD timeout);
+	EVT_HANDLE CreateBookmark(LPCWSTR bookmarkXml);
+	BOOL UpdateBookmark(EVT_HANDLE hBookmark, EVT_HANDLE hEvent);
+
+private:
+	EventSource *inner;
+	DWORD nextMs;
+	DWORD perEventUs;
+	DWORD publisherMs;
+	DWORD formatUs;
+};
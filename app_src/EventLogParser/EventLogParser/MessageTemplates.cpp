@@ -0,0 +1,449 @@
+#include "ParserCore.h"
+
+/****
+ * MessageTemplates::MessageTemplates
+ *
+ * ARGS:
+ *     source - Event source (session) the templates are fetched from
+ *     capacity - maximum number of templates to remember
+ *
+ * REMARKS:
+ *     Starts out in MESSAGES_REMOTE, where every message comes from
+ *     EvtFormatMessage as before
+ */
+MessageTemplates::MessageTemplates(EventSource *source, DWORD capacity)
+	: source(source), capacity(capacity > 0 ? capacity : 1), mode(MESSAGES_REMOTE), verifyEvery(MESSAGE_VERIFY_EVERY),
+	  locale(MESSAGE_LOCALE_DEFAULT), hits(0), misses(0), local(0), remote(0), checked(0), mismatches(0), last(NULL)
+{
+}
+
+
+/****
+ * MessageTemplates::SetMode
+ *
+ * ARGS:
+ *     mode - MESSAGES_REMOTE, MESSAGES_LOCAL or MESSAGES_VERIFY
+ *     verifyEvery - in MESSAGES_VERIFY, check every Nth message formatted
+ *                   from each template (1 checks them all)
+ */
+void MessageTemplates::SetMode(DWORD mode, DWORD verifyEvery)
+{
+	this->mode = mode <= MESSAGES_VERIFY ? mode : MESSAGES_REMOTE;
+	this->verifyEvery = verifyEvery > 0 ? verifyEvery : 1;
+}
+
+
+/****
+ * MessageTemplates::Format
+ *
+ * DESC:
+ *     Formats the message of an event from its cached template, fetching
+ *     the template on a miss
+ *
+ * ARGS:
+ *     render - Session render context (renders the event's values)
+ *     hMetadata - metadata handle of the event's provider
+ *     hEvent - Handle to open event
+ *     fields - its System fields (provider, event ID and version)
+ *     verify - set to TRUE if this message is to be checked against
+ *              EvtFormatMessage, and the result passed to Verified
+ *
+ * RETURNS:
+ *     The message (valid until the next call), or NULL if it has to be
+ *     formatted remotely
+ */
+LPCWSTR MessageTemplates::Format(RenderContext *render, EVT_HANDLE hMetadata, EVT_HANDLE hEvent, const SYSTEM_FIELDS *fields, BOOL *verify)
+{
+	*verify = FALSE;
+	last = NULL;
+
+	if( mode == MESSAGES_REMOTE ) {
+		remote++;
+		return NULL;
+	}
+
+	ENTRY *entry = Lookup(hMetadata, fields->provider, (DWORD)wcstoul(fields->eventId, NULL, 10), (DWORD)wcstoul(fields->version, NULL, 10));
+	DWORD count = 0;
+	PEVT_VARIANT values = entry != NULL && entry->usable ? render->RenderUserValues(hEvent, &count) : NULL;
+
+	if( values == NULL ) {
+		remote++;
+		return NULL;
+	}
+
+	DWORD used = 0;
+
+	for( size_t i = 0; i < entry->segments.size(); i++ )
+	{
+		const SEGMENT &segment = entry->segments[i];
+		BOOL ok;
+
+		if( segment.insert == 0 )
+			ok = Append(entry->literal.c_str() + segment.start, segment.length, &used);
+		else
+			ok = segment.insert <= count && AppendValue(&values[segment.insert - 1], &used);
+
+		if( !ok ) {
+			remote++;
+			return NULL;
+		}
+	}
+
+	if( !Append(L"", 0, &used) ) {
+		remote++;
+		return NULL;
+	}
+
+	local++;
+	last = entry;
+
+	*verify = mode == MESSAGES_VERIFY && entry->uses % verifyEvery == 0;
+	entry->uses++;
+
+	return (LPCWSTR)output.Data();
+}
+
+
+/****
+ * MessageTemplates::Verified
+ *
+ * DESC:
+ *     Takes the result of checking the last message Format returned. A
+ *     template that did not match is not used again
+ */
+void MessageTemplates::Verified(BOOL matched)
+{
+	checked++;
+
+	if( matched || last == NULL )
+		return;
+
+	mismatches++;
+	last->usable = FALSE;
+}
+
+
+/****
+ * MessageTemplates::Clear
+ *
+ * DESC:
+ *     Forgets every template, e.g. once the provider may have changed them
+ */
+void MessageTemplates::Clear()
+{
+	entries.clear();
+	index.clear();
+	last = NULL;
+}
+
+
+/****
+ * MessageTemplates::Lookup
+ *
+ * DESC:
+ *     Finds the template of an event, fetching and compiling it on a miss
+ *
+ * RETURNS:
+ *     The entry (which may hold an unusable template), or NULL if the
+ *     template could not be fetched this time
+ *
+ * REMARKS:
+ *     The key is the provider name followed by the event ID, version and
+ *     locale, each packed into characters. Event IDs are 16 bits and
+ *     versions 8, so each fits in one
+ */
+MessageTemplates::ENTRY *MessageTemplates::Lookup(EVT_HANDLE hMetadata, LPCWSTR provider, DWORD eventId, DWORD version)
+{
+	key.assign(provider);
+	key += L'\0';
+	key += (WCHAR)(eventId & 0xFFFF);
+	key += (WCHAR)(version & 0xFF);
+	key += (WCHAR)(locale & 0xFFFF);
+	key += (WCHAR)(locale >> 16);
+
+	std::unordered_map<std::wstring, std::list<ENTRY>::iterator>::iterator found = index.find(key);
+
+	if( found != index.end() ) {
+		hits++;
+
+		// Move to the front so it is the last to be evicted
+		entries.splice(entries.begin(), entries, found->second);
+
+		return &*found->second;
+	}
+
+	misses++;
+
+	LPCWSTR text = NULL;
+
+	if( !Fetch(hMetadata, eventId, version, &text) ) {
+		DWORD dwError = GetLastError();
+
+		// Only a template that is genuinely missing is worth remembering
+		if( dwError != ERROR_EVT_MESSAGE_NOT_FOUND && dwError != ERROR_EVT_MESSAGE_ID_NOT_FOUND )
+			return NULL;
+	}
+
+	// Make room for the new entry
+	if( entries.size() >= capacity ) {
+		index.erase(entries.back().key);
+		entries.pop_back();
+	}
+
+	entries.push_front(ENTRY());
+
+	ENTRY *entry = &entries.front();
+
+	entry->key = key;
+	entry->uses = 0;
+	entry->usable = text != NULL && Compile(text, entry);
+
+	index[key] = entries.begin();
+
+	return entry;
+}
+
+
+/****
+ * MessageTemplates::Fetch
+ *
+ * DESC:
+ *     Gets the raw template of an event from the source
+ *
+ * ARGS:
+ *     text - receives the template (valid until the next fetch)
+ *
+ * RETURNS:
+ *     TRUE on success, FALSE otherwise (see GetLastError)
+ */
+BOOL MessageTemplates::Fetch(EVT_HANDLE hMetadata, DWORD eventId, DWORD version, LPCWSTR *text)
+{
+	DWORD dwBufferUsed = 0;
+
+	if( fetched.Size() == 0 && !fetched.Reserve(RENDER_BUFFER_INITIAL) ) {
+		SetLastError(ERROR_OUTOFMEMORY);
+		return FALSE;
+	}
+
+	if( !source->GetMessageTemplate(hMetadata, eventId, version, fetched.Size() / sizeof(WCHAR), (LPWSTR)fetched.Data(), &dwBufferUsed) )
+	{
+		if( GetLastError() != ERROR_INSUFFICIENT_BUFFER )
+			return FALSE;
+
+		if( !fetched.Reserve(dwBufferUsed * sizeof(WCHAR)) ) {
+			SetLastError(ERROR_OUTOFMEMORY);
+			return FALSE;
+		}
+
+		if( !source->GetMessageTemplate(hMetadata, eventId, version, fetched.Size() / sizeof(WCHAR), (LPWSTR)fetched.Data(), &dwBufferUsed) )
+			return FALSE;
+	}
+
+	*text = (LPCWSTR)fetched.Data();
+
+	return TRUE;
+}
+
+
+/****
+ * MessageTemplates::Compile
+ *
+ * DESC:
+ *     Splits a template into literal text and inserts, resolving the
+ *     escapes on the way
+ *
+ * ARGS:
+ *     text - the raw template
+ *     entry - receives the literal text and segments
+ *
+ * RETURNS:
+ *     TRUE if every part of the template can be formatted locally
+ */
+BOOL MessageTemplates::Compile(LPCWSTR text, ENTRY *entry)
+{
+	SEGMENT segment;
+
+	entry->literal.clear();
+	entry->segments.clear();
+
+	segment.insert = 0;
+	segment.start = 0;
+
+	for( LPCWSTR p = text; *p != L'\0'; p++ )
+	{
+		if( *p != L'%' ) {
+			entry->literal += *p;
+			continue;
+		}
+
+		p++;
+
+		// %0 ends the message there
+		if( *p == L'0' )
+			break;
+
+		if( *p >= L'1' && *p <= L'9' )
+		{
+			DWORD insert = *p - L'0';
+
+			if( p[1] >= L'0' && p[1] <= L'9' )
+				insert = insert * 10 + (*++p - L'0');
+
+			// A printf-style format; only plain strings come out as they are
+			if( p[1] == L'!' ) {
+				if( p[2] != L's' || p[3] != L'!' )
+					return FALSE;
+				p += 3;
+			}
+
+			segment.length = (DWORD)entry->literal.size() - segment.start;
+			if( segment.length > 0 )
+				entry->segments.push_back(segment);
+
+			SEGMENT value = { insert, 0, 0 };
+			entry->segments.push_back(value);
+
+			segment.start = (DWORD)entry->literal.size();
+			continue;
+		}
+
+		switch( *p )
+		{
+		case L'%':
+			// %%1833 inserts a parameter message, which only the source has
+			if( p[1] >= L'0' && p[1] <= L'9' )
+				return FALSE;
+			entry->literal += L'%';
+			break;
+		case L'n':
+			entry->literal += L"\r\n";
+			break;
+		case L't':
+			entry->literal += L'\t';
+			break;
+		case L'r':
+			entry->literal += L'\r';
+			break;
+		case L'b':
+			entry->literal += L' ';
+			break;
+		case L'.':
+		case L'!':
+			entry->literal += *p;
+			break;
+		default:
+			return FALSE;
+		}
+	}
+
+	segment.length = (DWORD)entry->literal.size() - segment.start;
+	if( segment.length > 0 )
+		entry->segments.push_back(segment);
+
+	return TRUE;
+}
+
+
+// Appends text to the message being formatted, growing its buffer as needed
+BOOL MessageTemplates::Append(LPCWSTR text, size_t length, DWORD *used)
+{
+	DWORD needed = (DWORD)((*used + length + 1) * sizeof(WCHAR));
+
+	if( needed > output.Size() && !output.Reserve(needed < RENDER_BUFFER_INITIAL ? RENDER_BUFFER_INITIAL : needed) )
+		return FALSE;
+
+	LPWSTR out = (LPWSTR)output.Data() + *used;
+
+	memcpy(out, text, length * sizeof(WCHAR));
+	out[length] = L'\0';
+	*used += (DWORD)length;
+
+	return TRUE;
+}
+
+
+/****
+ * MessageTemplates::AppendValue
+ *
+ * DESC:
+ *     Appends one inserted value, as EvtFormatMessage would write it
+ *
+ * RETURNS:
+ *     TRUE if it was appended, FALSE if the value is of a kind that is
+ *     only formatted remotely (or the buffer could not be grown)
+ */
+BOOL MessageTemplates::AppendValue(const EVT_VARIANT *value, DWORD *used)
+{
+	WCHAR digits[24];
+	LONGLONG number;
+
+	switch( value->Type )
+	{
+	case EvtVarTypeNull:
+		return TRUE;
+
+	case EvtVarTypeString:
+		if( value->StringVal == NULL )
+			return TRUE;
+
+		// A parameter reference is expanded by the source
+		if( wcsstr(value->StringVal, L"%%") != NULL )
+			return FALSE;
+		return Append(value->StringVal, wcslen(value->StringVal), used);
+
+	case EvtVarTypeByte:
+		return Append(digits, wcslen(FormatUnsigned(value->ByteVal, digits)), used);
+	case EvtVarTypeUInt16:
+		return Append(digits, wcslen(FormatUnsigned(value->UInt16Val, digits)), used);
+	case EvtVarTypeUInt32:
+		return Append(digits, wcslen(FormatUnsigned(value->UInt32Val, digits)), used);
+	case EvtVarTypeUInt64:
+		return Append(digits, wcslen(FormatUnsigned(value->UInt64Val, digits)), used);
+	case EvtVarTypeSizeT:
+		return Append(digits, wcslen(FormatUnsigned(value->SizeTVal, digits)), used);
+
+	case EvtVarTypeSByte:
+		number = value->SByteVal;
+		break;
+	case EvtVarTypeInt16:
+		number = value->Int16Val;
+		break;
+	case EvtVarTypeInt32:
+		number = value->Int32Val;
+		break;
+	case EvtVarTypeInt64:
+		number = value->Int64Val;
+		break;
+
+	case EvtVarTypeHexInt32:
+	case EvtVarTypeHexInt64:
+	{
+		DWORD64 hex = value->Type == EvtVarTypeHexInt32 ? value->UInt32Val : value->UInt64Val;
+		WCHAR *p = digits + 23;
+
+		*p = L'\0';
+		do {
+			*--p = L"0123456789ABCDEF"[hex & 0xF];
+			hex >>= 4;
+		} while( hex != 0 );
+
+		*--p = L'x';
+		*--p = L'0';
+
+		return Append(p, digits + 23 - p, used);
+	}
+
+	default:
+		return FALSE;
+	}
+
+	// Signed integers
+	if( number < 0 ) {
+		digits[0] = L'-';
+		FormatUnsigned(0 - (DWORD64)number, digits + 1);
+	} else {
+		FormatUnsigned((DWORD64)number, digits);
+	}
+
+	return Append(digits, wcslen(digits), used);
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include "Platform.h"
+#include "EventSource.h"
+#include "RenderContext.h"
+#include "SystemFields.h"
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// How a session formats event messages (see MessageTemplates::SetMode)
+#define MESSAGES_REMOTE 0
+#define MESSAGES_LOCAL 1
+#define MESSAGES_VERIFY 2
+
+// Number of message templates kept per session
+#define MESSAGE_TEMPLATE_CACHE_SIZE 1024
+
+// In MESSAGES_VERIFY, every Nth message formatted from a template (and the
+// first) is checked against EvtFormatMessage
+#define MESSAGE_VERIFY_EVERY 100
+
+// Locale the templates are in. Publisher metadata is opened in the default
+// locale of the machine that logged the events (see OpenPublisherMetadata)
+#define MESSAGE_LOCALE_DEFAULT 0
+
+/****
+ * MessageTemplates
+ *
+ * DESC:
+ *     Bounded LRU cache of message templates, keyed by provider, event ID,
+ *     version and locale. Each session owns one, so the raw template of a
+ *     message is fetched once and every event after that has its message
+ *     filled in locally from its own values, rather than costing an
+ *     EvtFormatMessage round trip each
+ *
+ * REMARKS:
+ *     Templates are compiled on the way in. Only the FormatMessage inserts
+ *     and escapes whose output is known are handled: %1..%99 (optionally
+ *     with !s!), %%, %n, %t, %r, %b, %., %! and %0. A template with
+ *     anything else, such as %%1833 (a parameter message), is remembered
+ *     as one that cannot be used, as are events without a template.
+ *
+ *     Values are inserted as EvtFormatMessage inserts them: strings as
+ *     they are, integers in decimal and hex integers as 0x followed by
+ *     upper case digits. An event whose template needs any other value
+ *     (SIDs, times, GUIDs, arrays, or a string holding a %% parameter
+ *     reference) has its message formatted remotely instead, as does any
+ *     event whose values cannot be rendered.
+ *
+ *     MESSAGES_VERIFY checks a sample of the local messages against
+ *     EvtFormatMessage. A template that gives a different message is not
+ *     used again; the remote message is the one that is output.
+ */
+class MessageTemplates {
+public:
+	MessageTemplates(EventSource *source, DWORD capacity = MESSAGE_TEMPLATE_CACHE_SIZE);
+
+	void SetMode(DWORD mode, DWORD verifyEvery = MESSAGE_VERIFY_EVERY);
+	DWORD Mode() const { return mode; }
+	DWORD VerifyEvery() const { return verifyEvery; }
+
+	LPCWSTR Format(RenderContext *render, EVT_HANDLE hMetadata, EVT_HANDLE hEvent, const SYSTEM_FIELDS *fields, BOOL *verify);
+	void Verified(BOOL matched);
+	void Clear();
+
+	DWORD64 Hits() const { return hits; }
+	DWORD64 Misses() const { return misses; }
+	DWORD64 Local() const { return local; }
+	DWORD64 Remote() const { return remote; }
+	DWORD64 Checked() const { return checked; }
+	DWORD64 Mismatches() const { return mismatches; }
+
+private:
+	// A run of literal text (insert 0), or the value a %n inserts
+	struct SEGMENT {
+		DWORD insert;
+		DWORD start;
+		DWORD length;
+	};
+
+	struct ENTRY {
+		std::wstring key;
+		std::wstring literal;
+		std::vector<SEGMENT> segments;
+		BOOL usable;
+		DWORD64 uses;
+	};
+
+	MessageTemplates(const MessageTemplates &);
+	MessageTemplates &operator=(const MessageTemplates &);
+
+	ENTRY *Lookup(EVT_HANDLE hMetadata, LPCWSTR provider, DWORD eventId, DWORD version);
+	BOOL Fetch(EVT_HANDLE hMetadata, DWORD eventId, DWORD version, LPCWSTR *text);
+	BOOL Append(LPCWSTR text, size_t length, DWORD *used);
+	BOOL AppendValue(const EVT_VARIANT *value, DWORD *used);
+
+	static BOOL Compile(LPCWSTR text, ENTRY *entry);
+
+	EventSource *source;
+	DWORD capacity;
+	DWORD mode;
+	DWORD verifyEvery;
+	DWORD locale;
+
+	DWORD64 hits;
+	DWORD64 misses;
+	DWORD64 local;
+	DWORD64 remote;
+	DWORD64 checked;
+	DWORD64 mismatches;
+
+	// Most recently used entry at the front
+	std::list<ENTRY> entries;
+	std::unordered_map<std::wstring, std::list<ENTRY>::iterator> index;
+
+	// Reused for lookups, so a hit does not allocate a key
+	std::wstring key;
+
+	// The template being fetched, and the message being formatted
+	GrowBuffer fetched;
+	GrowBuffer output;
+
+	// The entry of the last message formatted, for Verified
+	ENTRY *last;
+};
@@ -0,0 +1,329 @@
+#include "OutputSink.h"
+#include "Utf8Encode.h"
+#include "IpfixRecord.h"
+#include <stdio.h>
+#include <string.h>
+
+BOOL OutputSink::WriteBinary(const BYTE * /*record*/, DWORD /*bytes*/)
+{
+	fwprintf(stderr, L"[Error][OutputSink]: Binary records cannot be written to this sink\n");
+
+	return TRUE;
+}
+
+
+void StdoutSink::Header(LPCWSTR header)
+{
+	wprintf(L"%ls", header);
+}
+
+
+BOOL StdoutSink::Write(LPCWSTR record, DWORD length)
+{
+	// Only print the separator characters once the first record is completed
+	if( records > 0 )
+		wprintf(L"||");
+
+	wprintf(L"%.*ls", (int)length, record);
+	records++;
+
+	return TRUE;
+}
+
+
+/****
+ * BufferSink::BufferSink
+ *
+ * ARGS:
+ *     buffer - where records are written
+ *     bufferChars - size of the buffer, in characters
+ */
+BufferSink::BufferSink(LPWSTR buffer, DWORD bufferChars)
+	: buffer(buffer), bufferChars(bufferChars), used(0), required(0)
+{
+}
+
+
+BOOL BufferSink::Write(LPCWSTR record, DWORD length)
+{
+	if( buffer == NULL || length + 1 > bufferChars - used ) {
+		required = length + 1;
+		return FALSE;
+	}
+
+	memcpy(buffer + used, record, length * sizeof(WCHAR));
+	used += length;
+	buffer[used++] = L'\0';
+	records++;
+
+	return TRUE;
+}
+
+
+/****
+ * Utf8BufferSink::Utf8BufferSink
+ *
+ * ARGS:
+ *     buffer - where records are written
+ *     bufferBytes - size of the buffer, in bytes
+ */
+Utf8BufferSink::Utf8BufferSink(char *buffer, DWORD bufferBytes)
+	: buffer(buffer), bufferBytes(bufferBytes), used(0), required(0)
+{
+}
+
+
+BOOL Utf8BufferSink::Write(LPCWSTR record, DWORD length)
+{
+	DWORD room = buffer != NULL ? bufferBytes - used : 0;
+
+	if( (DWORD64)length * UTF8_MAX_GROWTH + 1 > room )
+	{
+		DWORD64 bytes = Utf8Length(record, length);
+
+		if( bytes + 1 > room ) {
+			required = (DWORD)(bytes + 1);
+			return FALSE;
+		}
+	}
+
+	used += (DWORD)WideToUtf8(record, length, buffer + used);
+	buffer[used++] = '\0';
+	records++;
+
+	return TRUE;
+}
+
+
+/****
+ * BinaryBufferSink::BinaryBufferSink
+ *
+ * ARGS:
+ *     buffer - where records are written
+ *     bufferBytes - size of the buffer, in bytes
+ */
+BinaryBufferSink::BinaryBufferSink(BYTE *buffer, DWORD bufferBytes)
+	: buffer(buffer), bufferBytes(bufferBytes), used(0), required(0)
+{
+}
+
+
+BOOL BinaryBufferSink::Write(LPCWSTR /*record*/, DWORD /*length*/)
+{
+	fwprintf(stderr, L"[Error][BinaryBufferSink]: Text records cannot be written to this sink\n");
+
+	return TRUE;
+}
+
+
+BOOL BinaryBufferSink::WriteBinary(const BYTE *record, DWORD bytes)
+{
+	if( buffer == NULL || bytes > bufferBytes - used ) {
+		required = bytes;
+		return FALSE;
+	}
+
+	memcpy(buffer + used, record, bytes);
+	used += bytes;
+	records++;
+
+	return TRUE;
+}
+
+
+/****
+ * IpfixSetSink::IpfixSetSink
+ *
+ * ARGS:
+ *     buffer - where the sets are written
+ *     bufferBytes - size of the buffer, in bytes
+ *     templateId - ID of the records' template, the ID of every set
+ *     maxSetBytes - most bytes of a set, header included
+ */
+IpfixSetSink::IpfixSetSink(BYTE *buffer, DWORD bufferBytes, WORD templateId, DWORD maxSetBytes)
+	: buffer(buffer), bufferBytes(bufferBytes), templateId(templateId), maxSetBytes(maxSetBytes), used(0), required(0), sets(0), setStart(0), setId(0)
+{
+}
+
+
+BOOL IpfixSetSink::Write(LPCWSTR /*record*/, DWORD /*length*/)
+{
+	fwprintf(stderr, L"[Error][IpfixSetSink]: Text records cannot be written to this sink\n");
+
+	return TRUE;
+}
+
+
+BOOL IpfixSetSink::WriteBinary(const BYTE *record, DWORD bytes)
+{
+	return WriteIpfix(templateId, record, bytes);
+}
+
+
+BOOL IpfixSetSink::WriteIpfix(WORD templateId, const BYTE *record, DWORD bytes)
+{
+	// Into the open set if it is of the same template and has room, or
+	// else into a new one
+	BOOL join = sets > 0 && templateId == setId && bytes <= maxSetBytes - (used - setStart);
+	DWORD needed = join ? bytes : IPFIX_SET_HEADER + bytes;
+
+	if( buffer == NULL || needed > bufferBytes - used ) {
+		required = IPFIX_SET_HEADER + bytes;
+		return FALSE;
+	}
+
+	if( !join ) {
+		setStart = used;
+		setId = templateId;
+		buffer[used++] = (BYTE)(templateId >> 8);
+		buffer[used++] = (BYTE)templateId;
+		used += 2;
+		sets++;
+	}
+
+	memcpy(buffer + used, record, bytes);
+	used += bytes;
+	records++;
+
+	DWORD setBytes = used - setStart;
+
+	buffer[setStart + 2] = (BYTE)(setBytes >> 8);
+	buffer[setStart + 3] = (BYTE)setBytes;
+
+	return TRUE;
+}
+
+
+/****
+ * CallbackSink::CallbackSink
+ *
+ * ARGS:
+ *     callback - called with every record
+ *     context - passed through to the callback
+ */
+CallbackSink::CallbackSink(EVENT_RECORD_CALLBACK callback, LPVOID context)
+	: callback(callback), context(context)
+{
+}
+
+
+BOOL CallbackSink::Write(LPCWSTR record, DWORD length)
+{
+	if( callback == NULL || !callback(record, length, context) )
+		return FALSE;
+
+	records++;
+
+	return TRUE;
+}
+
+
+/****
+ * BudgetSink::BudgetSink
+ *
+ * ARGS:
+ *     sink - where the records go
+ *     maxRecords - most records to pass on (0 for no limit)
+ *     maxBytes - most bytes of records to pass on (0 for no limit)
+ */
+BudgetSink::BudgetSink(OutputSink *sink, DWORD maxRecords, DWORD maxBytes)
+	: sink(sink), maxRecords(maxRecords), maxBytes(maxBytes), used(0)
+{
+}
+
+
+void BudgetSink::Header(LPCWSTR header)
+{
+	sink->Header(header);
+}
+
+
+DWORD BudgetSink::Room() const
+{
+	DWORD room = sink->Room();
+
+	if( maxRecords == 0 || records >= maxRecords )
+		return room;
+
+	return room == 0 || maxRecords - records < room ? maxRecords - records : room;
+}
+
+
+BOOL BudgetSink::Write(LPCWSTR record, DWORD length)
+{
+	DWORD64 bytes = Utf8Length(record, length);
+
+	if( maxRecords != 0 && records >= maxRecords )
+		return FALSE;
+
+	if( maxBytes != 0 && records > 0 && used + bytes > maxBytes )
+		return FALSE;
+
+	if( !sink->Write(record, length) )
+		return FALSE;
+
+	used += bytes;
+	records++;
+
+	return TRUE;
+}
+
+
+BOOL BudgetSink::WriteBinary(const BYTE *record, DWORD bytes)
+{
+	if( maxRecords != 0 && records >= maxRecords )
+		return FALSE;
+
+	if( maxBytes != 0 && records > 0 && used + bytes > maxBytes )
+		return FALSE;
+
+	if( !sink->WriteBinary(record, bytes) )
+		return FALSE;
+
+	used += bytes;
+	records++;
+
+	return TRUE;
+}
+
+
+BOOL BudgetSink::WriteIpfix(WORD templateId, const BYTE *record, DWORD bytes)
+{
+	if( maxRecords != 0 && records >= maxRecords )
+		return FALSE;
+
+	if( maxBytes != 0 && records > 0 && used + bytes > maxBytes )
+		return FALSE;
+
+	if( !sink->WriteIpfix(templateId, record, bytes) )
+		return FALSE;
+
+	used += bytes;
+	records++;
+
+	return TRUE;
+}
+
+
+/****
+ * MemorySink::MemorySink
+ *
+ * ARGS:
+ *     text - where the records go, each followed by a null character
+ *     ends - where the index of each record's null character goes
+ */
+MemorySink::MemorySink(std::vector<WCHAR> *text, std::vector<size_t> *ends)
+	: text(text), ends(ends)
+{
+}
+
+
+BOOL MemorySink::Write(LPCWSTR record, DWORD length)
+{
+	text->insert(text->end(), record, record + length);
+	text->push_back(L'\0');
+	ends->push_back(text->size() - 1);
+	records++;
+
+	return TRUE;
+}
@@ -0,0 +1,264 @@
+#pragma once
+
+#include "Platform.h"
+#include <vector>
+
+// Called with every record written to a CallbackSink. Return FALSE to
+// refuse the record; it is then offered again by the next read
+typedef BOOL (__stdcall *EVENT_RECORD_CALLBACK)(LPCWSTR record, DWORD length, LPVOID context);
+
+/****
+ * OutputSink
+ *
+ * DESC:
+ *     Where formatted event records go. The parser hands over one whole
+ *     record at a time; the sink decides how records are framed
+ *
+ * REMARKS:
+ *     Write returns FALSE when the sink cannot take the record (it is
+ *     full, or the caller wants no more for now). The record is then not
+ *     written at all, and the caller stops and keeps it for later.
+ *
+ *     Header is the CSV column header. Only STDOUT prints it; the other
+ *     sinks hand records over individually.
+ *
+ *     WriteBinary takes a binary record (OUTPUT_FORMAT_BINARY), which
+ *     carries its own length, or an IPFIX data record (OUTPUT_FORMAT_
+ *     IPFIX). Sinks that only take text report it and drop the record.
+ *     WriteIpfix takes an IPFIX data record with the ID of its template,
+ *     for sinks that put records of several templates in sets of their
+ *     own; to the others it is WriteBinary.
+ *
+ *     Room is the most records the sink will still take, so that no more
+ *     events than that are fetched for it, or 0 if there is no telling.
+ */
+class OutputSink {
+public:
+	OutputSink() : records(0) {}
+	virtual ~OutputSink() {}
+
+	virtual void Header(LPCWSTR /*header*/) {}
+	virtual BOOL Write(LPCWSTR record, DWORD length) = 0;
+	virtual BOOL WriteBinary(const BYTE *record, DWORD bytes);
+	virtual BOOL WriteIpfix(WORD /*templateId*/, const BYTE *record, DWORD bytes) { return WriteBinary(record, bytes); }
+	virtual DWORD Room() const { return 0; }
+
+	DWORD Records() const { return records; }
+
+protected:
+	DWORD records;
+};
+
+/****
+ * StdoutSink
+ *
+ * DESC:
+ *     Prints records to STDOUT separated by "||", which is what
+ *     ParseEventLog has always produced. Never refuses a record
+ */
+class StdoutSink : public OutputSink {
+public:
+	void Header(LPCWSTR header);
+	BOOL Write(LPCWSTR record, DWORD length);
+};
+
+/****
+ * BufferSink
+ *
+ * DESC:
+ *     Packs records into a caller's buffer, each followed by a null
+ *     character
+ *
+ * REMARKS:
+ *     A record that does not fit is refused. Required then gives the room
+ *     (in characters, with its terminator) it would have needed, so that a
+ *     caller whose buffer cannot take even one record knows what to pass.
+ */
+class BufferSink : public OutputSink {
+public:
+	BufferSink(LPWSTR buffer, DWORD bufferChars);
+
+	BOOL Write(LPCWSTR record, DWORD length);
+
+	DWORD Used() const { return used; }
+	DWORD Required() const { return required; }
+
+private:
+	LPWSTR buffer;
+	DWORD bufferChars;
+	DWORD used;
+	DWORD required;
+};
+
+/****
+ * Utf8BufferSink
+ *
+ * DESC:
+ *     As BufferSink, but records are encoded as UTF-8 on the way in (see
+ *     WideToUtf8), so the caller gets valid UTF-8 and has no decoding of
+ *     its own to do
+ *
+ * REMARKS:
+ *     Sizes are in bytes. A record is encoded straight into the buffer
+ *     when its worst case fits; otherwise its exact size is worked out
+ *     first.
+ */
+class Utf8BufferSink : public OutputSink {
+public:
+	Utf8BufferSink(char *buffer, DWORD bufferBytes);
+
+	BOOL Write(LPCWSTR record, DWORD length);
+
+	DWORD Used() const { return used; }
+	DWORD Required() const { return required; }
+
+private:
+	char *buffer;
+	DWORD bufferBytes;
+	DWORD used;
+	DWORD required;
+};
+
+/****
+ * BinaryBufferSink
+ *
+ * DESC:
+ *     Packs binary records into a caller's buffer back to back, as they
+ *     are (each starts with its own length; see BinaryRecordReader)
+ *
+ * REMARKS:
+ *     A record that does not fit is refused, as by BufferSink; Required
+ *     then gives its size in bytes. Text records are not taken.
+ */
+class BinaryBufferSink : public OutputSink {
+public:
+	BinaryBufferSink(BYTE *buffer, DWORD bufferBytes);
+
+	BOOL Write(LPCWSTR record, DWORD length);
+	BOOL WriteBinary(const BYTE *record, DWORD bytes);
+
+	DWORD Used() const { return used; }
+	DWORD Required() const { return required; }
+
+private:
+	BYTE *buffer;
+	DWORD bufferBytes;
+	DWORD used;
+	DWORD required;
+};
+
+/****
+ * IpfixSetSink
+ *
+ * DESC:
+ *     Packs IPFIX data records (OUTPUT_FORMAT_IPFIX) into data sets in a
+ *     caller's buffer, ready to go out after a message header. Each set is
+ *     its header (the template ID and the set's length, in network byte
+ *     order) and then as many whole records of that template as fit in
+ *     maxSetBytes; the next record starts another set, as does one of
+ *     another template
+ *
+ * REMARKS:
+ *     Records from WriteBinary are of the template the sink was made
+ *     with; WriteIpfix says whose each is. The sets are back to back and
+ *     not padded. A record that does not fit is refused, as by
+ *     BufferSink; Required then gives the room it would have needed, set
+ *     header included. Text records are not taken.
+ */
+class IpfixSetSink : public OutputSink {
+public:
+	IpfixSetSink(BYTE *buffer, DWORD bufferBytes, WORD templateId, DWORD maxSetBytes);
+
+	BOOL Write(LPCWSTR record, DWORD length);
+	BOOL WriteBinary(const BYTE *record, DWORD bytes);
+	BOOL WriteIpfix(WORD templateId, const BYTE *record, DWORD bytes);
+
+	DWORD Used() const { return used; }
+	DWORD Required() const { return required; }
+	DWORD Sets() const { return sets; }
+
+private:
+	BYTE *buffer;
+	DWORD bufferBytes;
+	WORD templateId;
+	DWORD maxSetBytes;
+	DWORD used;
+	DWORD required;
+	DWORD sets;
+	DWORD setStart;
+	WORD setId;
+};
+
+/****
+ * CallbackSink
+ *
+ * DESC:
+ *     Hands every record to a caller's function, which can refuse it to
+ *     stop the read (see EVENT_RECORD_CALLBACK)
+ */
+class CallbackSink : public OutputSink {
+public:
+	CallbackSink(EVENT_RECORD_CALLBACK callback, LPVOID context);
+
+	BOOL Write(LPCWSTR record, DWORD length);
+
+private:
+	EVENT_RECORD_CALLBACK callback;
+	LPVOID context;
+};
+
+/****
+ * BudgetSink
+ *
+ * DESC:
+ *     Passes records on to another sink until a number of records, or of
+ *     bytes, has been written. The record that would go past either is
+ *     refused, so a read stops there and can resume with it
+ *
+ * REMARKS:
+ *     Bytes are those of the records as UTF-8 (as Utf8BufferSink writes
+ *     them), without separators, or of binary records as they are. A limit of 0 is no limit. The first
+ *     record is always let through, so a budget smaller than one record
+ *     still gets somewhere.
+ */
+class BudgetSink : public OutputSink {
+public:
+	BudgetSink(OutputSink *sink, DWORD maxRecords, DWORD maxBytes);
+
+	void Header(LPCWSTR header);
+	BOOL Write(LPCWSTR record, DWORD length);
+	BOOL WriteBinary(const BYTE *record, DWORD bytes);
+	BOOL WriteIpfix(WORD templateId, const BYTE *record, DWORD bytes);
+	DWORD Room() const;
+
+	DWORD64 Used() const { return used; }
+
+private:
+	OutputSink *sink;
+	DWORD maxRecords;
+	DWORD maxBytes;
+	DWORD64 used;
+};
+
+/****
+ * MemorySink
+ *
+ * DESC:
+ *     Keeps records in memory, each followed by a null character, for a
+ *     reader on another thread to write out later. Never refuses a record
+ *
+ * REMARKS:
+ *     text and ends are the caller's: each record ends at the null
+ *     character its entry of ends points to, and starts after the one
+ *     before.
+ */
+class MemorySink : public OutputSink {
+public:
+	MemorySink(std::vector<WCHAR> *text, std::vector<size_t> *ends);
+
+	BOOL Write(LPCWSTR record, DWORD length);
+
+private:
+	std::vector<WCHAR> *text;
+	std::vector<size_t> *ends;
+};
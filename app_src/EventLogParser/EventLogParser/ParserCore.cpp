@@ -0,0 +1,939 @@
+#include "ParserCore.h"
+
+/****
+ * ParseEventSource
+ *
+ * DESC:
+ *     Queries an event source and dumps the results (or, in "last record"
+ *     mode, looks up the latest record ID)
+ *
+ * ARGS:
+ *     source - Event source to read from (one session)
+ *     logName - event log to open
+ *     query - XPath query to retrieve, or NULL for everything
+ *     outputFormat - set to 0 (JSON) otherwise XML
+ *     debug - set to 0 (none) 1 (basic) or 2 (verbose)
+ *     mode - MODE_DEFAULT or MODE_FETCH_LAST_RECORD, plus MODE_RENDER_XML,
+ *            MODE_EVENT_DATA and MODE_IDENTITY. MODE_FORWARD reads oldest
+ *            first
+ *     sink - where the records go (NULL for STDOUT)
+ *     projection - RECORD_FIELD_* flags of the fields each record has
+ *                  (see ParseRecordFields)
+ *     filter - if not NULL, compiled into the query that is run in place
+ *              of query (see EventFilter::Compile)
+ *     lastRecordId - if not NULL, receives the record ID of the last event
+ *                    written or passed over by the filter (0 for none)
+ *
+ * RETURNS:
+ *     Whatever ProcessResults returns, or 0 if the query failed (with
+ *     GetLastError saying why)
+ *
+ * REMARKS:
+ *     This is everything ParseEventLogInternal does once it has a session,
+ *     so the same code runs against the fixture and synthetic sources on
+ *     platforms without winevt.
+ *
+ *     Read forward, a sink that stops taking records leaves the query
+ *     at a point it can be run again from: lastRecordId + 1 onwards is
+ *     exactly what was not read. Newest first, what was not read is older
+ *     than what was, so there is no such point
+ */
+DWORD64 ParseEventSource(EventSource *source, LPCWSTR logName, LPCWSTR query, INT outputFormat, INT debug, INT mode, OutputSink *sink, DWORD projection, EventFilter *filter, DWORD64 *lastRecordId)
+{
+	DWORD64 result = 0;
+	DWORD queryError = ERROR_SUCCESS;
+	StdoutSink stdoutSink;
+	std::wstring compiled;
+
+	if( sink == NULL )
+		sink = &stdoutSink;
+
+	if( debug >= DEBUG_L1 ) {
+		wprintf(L"[ParseEventSource]: Attempting to query the EventLog...\n\n");
+	}
+
+	// Caches tied to this session (e.g. publisher metadata handles)
+	EVENT_SESSION session(source);
+
+	session.projection = projection;
+
+	if( filter != NULL ) {
+		filter->Compile(&compiled);
+		query = compiled.empty() ? NULL : compiled.c_str();
+
+		if( filter->Residual() )
+			session.filter = filter;
+
+		if( debug >= DEBUG_L1 ) {
+			wprintf(L"[ParseEventSource]: Filter compiled to: %ls%ls\n\n", query != NULL ? query : L"(everything)", filter->Residual() ? L" (checked locally as well)" : L"");
+		}
+	}
+
+	// Query the event log in reverse chronological order (newest to oldest),
+	// unless asked for the oldest first. The latest record is always the
+	// first one of a reverse query
+	BOOL forward = (mode & MODE_FORWARD) && !(mode & MODE_FETCH_LAST_RECORD);
+
+	EVT_HANDLE hResults = source->Query(logName, query, EvtQueryChannelPath | (forward ? EvtQueryForwardDirection : EvtQueryReverseDirection));
+
+	// If the query was successful
+	if (hResults != NULL) 
+	{
+		result = ProcessResults(&session, hResults, sink, outputFormat, mode, debug);
+
+		source->Close(hResults);
+	}
+	else
+	{
+		// Query was not successful. Get the error code
+		DWORD dwError = queryError = GetLastError();
+
+		if (dwError == ERROR_EVT_CHANNEL_NOT_FOUND) 
+		{
+			fwprintf(stderr, L"[Error][ParseEventLog]: Could not open the '%ls' log on this machine.\n", logName);
+		}
+		else if (dwError == ERROR_EVT_INVALID_QUERY)
+		{
+			// You can call the EvtGetExtendedStatus function to try to get 
+			// additional information as to what is wrong with the query.
+			fwprintf(stderr, L"[Error][ParseEventLog]: The specified search query is not valid.\n");
+		}
+		else
+		{
+			fwprintf(stderr, L"[Error][ParseEventLog]: Could not read event logs due to the following Windows error: %u.\n", dwError);
+		}
+	}
+
+	if( debug >= DEBUG_L1 ) {
+		wprintf(L"[ParseEventSource]: Publisher cache: %llu hits, %llu misses\n", (unsigned long long)session.publishers.Hits(), (unsigned long long)session.publishers.Misses());
+		wprintf(L"[ParseEventSource]: Message templates: %llu hits, %llu misses, %llu local, %llu remote, %llu of %llu checked did not match\n",
+			(unsigned long long)session.templates.Hits(), (unsigned long long)session.templates.Misses(), (unsigned long long)session.templates.Local(),
+			(unsigned long long)session.templates.Remote(), (unsigned long long)session.templates.Mismatches(), (unsigned long long)session.templates.Checked());
+	}
+
+	if( lastRecordId != NULL )
+		*lastRecordId = session.lastRecordId;
+
+	// Publisher handles belong to the session, so they must go before it
+	session.publishers.Clear();
+
+	if( hResults == NULL )
+		SetLastError(queryError);
+
+	return result;
+}
+
+
+/****
+ * ProcessResults
+ *
+ * DESC:
+ *     Walks an open result set and dumps every event in it
+ *
+ * ARGS:
+ *     session - Remote session context and its caches
+ *     hResults - An open set of results
+ *     sink - where the records go
+ *     outputFormat - 0 for JSON, otherwise XML
+ *     mode - last record vs dump results
+ *     debug - set to 0 (none) 1 (basic) or 2 (verbose)
+ *
+ * REMARKS:
+ *     Events are fetched in batches by an EventFetcher running on its own
+ *     thread, so the next EvtNext round trip overlaps with rendering the
+ *     current batch. The batch size adapts to how long each call takes
+ *     (see BatchSizer).
+ *
+ *     In "last record" mode only the topmost record is needed, so a single
+ *     handle is fetched in-line instead.
+ *
+ *     If the sink refuses a record, reading stops there and the result is
+ *     ERROR_MORE_DATA. A one-off query cannot be resumed; callers that
+ *     need to pick up where a full sink left off use an EventCursor, or
+ *     read forward and query again past session->lastRecordId. A sink
+ *     with a limit (see OutputSink::Room) has no more events fetched than
+ *     it can take, and reading stops with ERROR_MORE_DATA once they have
+ *     all been read.
+ */
+DWORD64 ProcessResults(EVENT_SESSION *session, EVT_HANDLE hResults, OutputSink *sink, int outputFormat, int mode, int debug)
+{
+    DWORD64 status = ERROR_SUCCESS;
+	BOOL full = FALSE;
+
+	// Print header information for our events
+	if( outputFormat == OUTPUT_FORMAT_JSON ) {
+		// Note: Marc requested this to be removed
+		//wprintf(L"[");
+	} else if( OUTPUT_FORMAT_HAS_HEADER(outputFormat) ) {
+		sink->Header(CSV_HEADER);
+	}
+
+	if( mode & MODE_FETCH_LAST_RECORD ) {
+		EVT_HANDLE hEvent = NULL;
+		DWORD dwReturned = 0;
+
+		if( session->source->Next(hResults, 1, &hEvent, INFINITE, &dwReturned) && dwReturned > 0 ) {
+			// Recall that all we were looking for was the record ID of the most recent record
+			status = DumpEventInfo(session, hEvent, sink, outputFormat, mode, debug);
+
+			session->source->Close(hEvent);
+		} else {
+			status = GetLastError();
+
+			if( status != ERROR_NO_MORE_ITEMS ) {
+				fwprintf(stderr, L"Failed to fetch next batch with following error: %u\n", (DWORD)status);
+			}
+		}
+
+		return status;
+	}
+
+	// No more events are fetched than the sink can take
+	EventFetcher fetcher(session->source, hResults, debug, sink->Room());
+
+	if( !fetcher.Start() ) {
+		return ERROR_OUTOFMEMORY;
+	}
+
+	// Keep reading batches as long as the fetcher has them. It returns NULL
+	// once the result set is exhausted (or fetching failed)
+	EVENT_BATCH *batch;
+
+	while( (batch = fetcher.NextBatch()) != NULL )
+	{
+		// Cycle through all the events that we received
+		for (DWORD i = 0; i < batch->dwReturned; i++)
+		{
+			// Extract event details and hand them to the sink. Once it is full,
+			// the remaining handles are only closed
+			if( !full && DumpEventInfo(session, batch->hEvents[i], sink, outputFormat, mode, debug) == ERROR_MORE_DATA ) {
+				full = TRUE;
+			}
+
+			// Close the handle to the current event, as we are done
+			session->source->Close(batch->hEvents[i]);
+
+			// Clear the event handle so our cleanup routine does not attempt to re-close
+			batch->hEvents[i] = NULL;
+		}
+
+		// Give the batch back so the fetcher can refill it
+		fetcher.ReleaseBatch(batch);
+
+		if( full ) {
+			return ERROR_MORE_DATA;
+		}
+	}
+
+	status = fetcher.Status();
+
+	// Running out of records, or of room, is the normal way out. Anything else is worth reporting
+	if( status != ERROR_NO_MORE_ITEMS && status != ERROR_MORE_DATA ) {
+		fwprintf(stderr, L"Failed to fetch next batch with following error: %u\n", (DWORD)status);
+	}
+
+	// Add closing tag if this is JSON
+	if( outputFormat == OUTPUT_FORMAT_JSON ) {
+		// Marc requested this to be removed
+		// wprintf(L"]");
+	}
+
+    return status;
+}
+
+
+/****
+ * DumpEventInfo
+ *
+ * DESC:
+ *     This function has two purposes depending on the mode. It will
+ *     either (1) Print the contents of an event (if normal mode) or
+ *     (2) return the latest record ID (if "last record" mode)
+ *
+ * ARGS:
+ *     session - Remote session context and its caches
+ *     hEvent - The event to dump
+ *     sink - where the record goes
+ *     outputFormat - 0 for JSON, otherwise XML
+ *     mode - last record vs print results (plus MODE_RENDER_XML)
+ *     debug - set to 0 (none) 1 (basic) or 2 (verbose)
+ *
+ * RETURNS:
+ *     In "last record" mode the record ID. Otherwise ERROR_SUCCESS,
+ *     ERROR_MORE_DATA if the sink refused the record, or the error that
+ *     kept the event from being read
+ *
+ * REMARKS:
+ *     All buffers (the rendered XML, the parsed document, the message
+ *     string and the output record) belong to the session's RenderContext
+ *     and are reused from one event to the next.
+ */
+DWORD64 DumpEventInfo(EVENT_SESSION *session, EVT_HANDLE hEvent, OutputSink *sink, INT outputFormat, INT mode, INT debug)
+{
+    DWORD64 dwError = ERROR_SUCCESS;
+
+	SYSTEM_FIELDS fields;
+
+	if( ReadEventFields(session, hEvent, &fields, mode, debug) ) 
+	{
+		// Recall there are two modes. The default mode will parse the event log XML, and the "last record" mode
+		// (called MODE_FETCH_LAST_RECORD) will fetch only the last record and exit afterwards. 
+		if( mode & MODE_FETCH_LAST_RECORD ) {
+			if( debug >= DEBUG_L2 ) {
+				wprintf( L"[DumpEventInfo]: Record ID is '%ls'\n", fields.recordId );
+			}
+
+			return fields.recordIdValue;
+		}
+
+		// Selected by the query, but not by the filter it was compiled from
+		if( session->filter != NULL && !session->filter->Matches(&fields) ) {
+			if( debug >= DEBUG_L2 ) {
+				wprintf( L"[DumpEventInfo]: Record %ls filtered out\n", fields.recordId );
+			}
+
+			session->lastRecordId = fields.recordIdValue;
+
+			return ERROR_SUCCESS;
+		}
+
+		if( WriteEventInfo(session, hEvent, &fields, sink, outputFormat, debug) ) {
+			session->lastRecordId = fields.recordIdValue;
+		} else {
+			dwError = ERROR_MORE_DATA;
+		}
+	} 
+	else
+	{
+		// Reading was NOT successful. Get the error code
+		dwError = GetLastError();
+
+		// Print error results to the screen
+		fwprintf(stderr, L"[DumpEventInfo] Failed to render results with: %u\n", (DWORD)dwError);
+	}
+
+	if( debug >= DEBUG_L2 ) {
+		wprintf( L"[DumpEventInfo]: Data dump completed\n" );
+	}
+
+    return dwError;
+}
+
+
+/****
+ * ReadFieldsWanted
+ *
+ * DESC:
+ *     Works out which System fields ReadEventFields has to fill in for a
+ *     projection
+ *
+ * RETURNS:
+ *     RECORD_FIELD_* flags
+ *
+ * REMARKS:
+ *     The record ID is always read: last record mode returns it and
+ *     cursors resume from it. The message is looked up by provider, and
+ *     its template by event ID and version, and identities go by event ID.
+ *     A filter adds the fields it checks. In last record mode nothing else
+ *     is needed
+ */
+static DWORD ReadFieldsWanted(DWORD projection, const EventFilter *filter, INT mode)
+{
+	if( mode & MODE_FETCH_LAST_RECORD )
+		return RECORD_FIELD_RECORD_ID;
+
+	DWORD wanted = projection | RECORD_FIELD_RECORD_ID;
+
+	if( filter != NULL )
+		wanted |= filter->Wanted();
+
+	if( projection & RECORD_FIELD_MESSAGE )
+		wanted |= RECORD_FIELD_SOURCE | RECORD_FIELD_EVENT_ID | RECORD_FIELD_VERSION;
+
+	if( mode & MODE_IDENTITY )
+		wanted |= RECORD_FIELD_EVENT_ID;
+
+	return wanted;
+}
+
+
+/****
+ * ReadEventFields
+ *
+ * DESC:
+ *     Reads the System fields of an event, and its EventData fields or
+ *     identity if asked for them
+ *
+ * ARGS:
+ *     session - Remote session context and its caches
+ *     hEvent - The event to read
+ *     fields - receives the fields (they point into the session buffers)
+ *     mode - MODE_RENDER_XML to read them from the event XML, plus
+ *            MODE_EVENT_DATA for the EventData fields the session's
+ *            eventDataSelection names, and MODE_IDENTITY for who logged
+ *            on or off (see ExtractIdentity)
+ *     debug - set to 0 (none) 1 (basic) or 2 (verbose)
+ *
+ * RETURNS:
+ *     TRUE if the fields were read, FALSE otherwise (see GetLastError)
+ *
+ * REMARKS:
+ *     The System fields are read with a system render context unless
+ *     MODE_RENDER_XML is set, in which case the event is rendered as XML
+ *     and parsed up to </System> (RenderContext::ParseSystem).
+ *
+ *     Only the fields the session's projection has, and the ones needed
+ *     to work out the rest, are filled in (see ReadFieldsWanted). The
+ *     others are left empty.
+ *
+ *     EventData only comes as XML, so MODE_EVENT_DATA has the whole event
+ *     parsed. On the values path that is on top of reading the values,
+ *     which still beats reading the System fields out of the XML. There
+ *     the event ID is known first, so MODE_IDENTITY alone only renders
+ *     the XML of the identity events.
+ */
+BOOL ReadEventFields(EVENT_SESSION *session, EVT_HANDLE hEvent, SYSTEM_FIELDS *fields, INT mode, INT debug)
+{
+	BOOL rendered = FALSE;
+	rapidxml::xml_document<WCHAR> *doc = NULL;
+	DWORD wanted = ReadFieldsWanted(session->projection, session->filter, mode);
+
+	// The System fields can be read as typed values, which skips rendering and
+	// parsing the whole event as XML. XML is only used when asked for
+	if( (mode & MODE_RENDER_XML) || session->render.hSystemContext == NULL ) 
+	{
+		if( debug >= DEBUG_L2 ) {
+			wprintf(L"[ReadEventFields]: Attempting to read event XML\n" );
+		}
+
+		// Read the event as an XML string into the session's render buffer
+		LPWSTR pwsBuffer = session->render.RenderXml(hEvent, debug);
+
+		if( pwsBuffer != NULL ) 
+		{
+			if( debug >= DEBUG_L2 ) {
+				wprintf( L"[ReadEventFields]: Raw XML: %ls\n", pwsBuffer );
+			}
+
+			// Parse the XML string into our XML reader, up to </System> unless
+			// the event data is read too
+			if( mode & (MODE_EVENT_DATA | MODE_IDENTITY) )
+				doc = session->render.Parse( pwsBuffer );
+			else
+				doc = session->render.ParseSystem( pwsBuffer );
+
+			if( debug >= DEBUG_L2 ) {
+				wprintf( L"[ReadEventFields]: XML parsing successful\n" );
+			}
+
+			rendered = ExtractSystemFields(doc, fields, wanted);
+		}
+	}
+	else
+	{
+		if( debug >= DEBUG_L2 ) {
+			wprintf(L"[ReadEventFields]: Attempting to read event system values\n" );
+		}
+
+		rendered = RenderSystemFields(&session->render, hEvent, fields, wanted);
+	}
+
+	if( !rendered ) {
+		return FALSE;
+	}
+
+	if( debug >= DEBUG_L2 ) {
+		wprintf( L"[ReadEventFields]: Extracting system fields successful\n" );
+	}
+
+	BOOL identity = (mode & MODE_IDENTITY) && IsIdentityEvent(fields->eventId);
+
+	// On the values path the XML is only rendered now, if anything needs it.
+	// The values live in their own buffer, so the fields are left alone
+	if( doc == NULL && ((mode & MODE_EVENT_DATA) || identity) ) 
+	{
+		LPWSTR pwsBuffer = session->render.RenderXml(hEvent, debug);
+
+		if( pwsBuffer == NULL ) {
+			return FALSE;
+		}
+
+		doc = session->render.Parse( pwsBuffer );
+	}
+
+	if( mode & MODE_EVENT_DATA ) 
+	{
+		if( !ExtractEventData(doc, &session->eventDataSelection, &session->eventData) ) {
+			return FALSE;
+		}
+
+		fields->eventData = &session->eventData;
+
+		if( debug >= DEBUG_L2 ) {
+			wprintf( L"[ReadEventFields]: Extracted %u event data fields\n", (DWORD)session->eventData.size() );
+		}
+	}
+
+	if( identity && ExtractIdentity(doc, fields->eventId, &session->identity) ) 
+	{
+		fields->identity = &session->identity;
+
+		if( debug >= DEBUG_L2 ) {
+			wprintf( L"[ReadEventFields]: Identity is '%ls\\%ls'\n", session->identity.domain, session->identity.user );
+		}
+	}
+
+	return TRUE;
+}
+
+
+/****
+ * WriteEventInfo
+ *
+ * DESC:
+ *     Looks up the message of an event, formats the event as one record
+ *     and hands it to the sink
+ *
+ * ARGS:
+ *     session - Remote session context and its caches
+ *     hEvent - The event to write
+ *     fields - its System fields (see ReadEventFields)
+ *     sink - where the record goes
+ *     outputFormat - 0 for JSON, OUTPUT_FORMAT_BINARY for a binary record
+ *                    (see EncodeBinaryRecord), OUTPUT_FORMAT_IPFIX for an
+ *                    IPFIX data record (see WriteIpfixFlow, or the
+ *                    session's EventAggregator if it is enabled),
+ *                    otherwise XML
+ *     debug - set to 0 (none) 1 (basic) or 2 (verbose)
+ *
+ * RETURNS:
+ *     TRUE if the record was written (or could not be formatted, which is
+ *     reported), or the event was added to a flow, FALSE if the sink
+ *     refused it
+ *
+ * REMARKS:
+ *     If the session's projection leaves out the message, the publisher
+ *     metadata is not opened and no message is formatted
+ */
+BOOL WriteEventInfo(EVENT_SESSION *session, EVT_HANDLE hEvent, SYSTEM_FIELDS *fields, OutputSink *sink, INT outputFormat, INT debug)
+{
+	// Extract the publisher name from the <Provider> node
+	// We will need this to lookup the message string for this publisher
+	LPCWSTR pwszPublisherName = fields->provider;
+
+	if( debug >= DEBUG_L2 ) {
+		wprintf( L"[WriteEventInfo] Publisher is: %ls\n", pwszPublisherName );
+	}
+
+	// Setup an empty string to read the message string
+	LPCWSTR pwsMessage = NULL;
+
+	// Get the handle to the provider's metadata that contains the message strings.
+	// The handle is owned by the session cache, so it is not closed here. It is
+	// only needed for the message, so without one it is not looked up at all
+	EVT_HANDLE hProviderMetadata = NULL;
+
+	if( session->projection & RECORD_FIELD_MESSAGE )
+		hProviderMetadata = session->publishers.Open(pwszPublisherName);
+
+	// If a provider handle was found
+	if( hProviderMetadata != NULL ) 
+	{
+		if( debug >= DEBUG_L2 ) {
+			wprintf( L"[WriteEventInfo] Publisher metadata found. Attempting to get message string\n");
+		}
+
+		// Get the message string associated with this event type
+		// Note: The string lives in the session's buffers. Do not free it
+		pwsMessage = GetEventMessage(session, hProviderMetadata, hEvent, fields, debug);
+
+		// If a message was not found, default to an empty string
+		if( pwsMessage == NULL ) {
+			// Why are we setting to empty string?
+			//pwsMessage = L"";
+
+			if( debug >= DEBUG_L2 ) {
+				wprintf( L"[WriteEventInfo] Message string not found. Assume empty\n");
+			}
+		}
+	}
+	else if( session->projection & RECORD_FIELD_MESSAGE )
+	{
+		// Publisher/provider cannot be found. Do not display an error message. It occurs all too often when a 
+		// publisher is not found, and skews the JSON results. when it prints itself to the main screen
+		// printf("Error: EvtOpenPublisherMetadata for %ls failed with %d\n", pwszPublisherName, GetLastError());						
+
+		// Default the publisher to an empty string so we can continue
+		pwszPublisherName = L"";
+
+		if( debug >= DEBUG_L2 ) {
+			wprintf( L"[WriteEventInfo] Publisher metadata not found. Assume empty\n");
+		}
+	}
+
+	DWORD length = 0;
+
+	if( outputFormat == OUTPUT_FORMAT_BINARY ) 
+	{
+		if( !EncodeBinaryRecord(&session->render.record, fields, pwsMessage, session->projection, &length) ) {
+			fwprintf(stderr, L"[Error][WriteEventInfo]: malloc failed\n");
+			return TRUE;
+		}
+
+		return sink->WriteBinary((const BYTE *)session->render.record.Data(), length);
+	}
+
+	// Flows closed earlier go out first. If the sink will not take them,
+	// the event is refused before it is counted, to be offered again
+	if( outputFormat == OUTPUT_FORMAT_IPFIX && session->flows.Enabled() ) 
+	{
+		if( !session->flows.Drain(sink, &session->render.record, &session->ipfix, &session->miner) )
+			return FALSE;
+
+		session->flows.Add(fields, pwsMessage);
+
+		// Whatever this closed waits for the next event, or the end of the
+		// read, if the sink is full now
+		session->flows.Drain(sink, &session->render.record, &session->ipfix, &session->miner);
+
+		return TRUE;
+	}
+
+	if( outputFormat == OUTPUT_FORMAT_IPFIX ) 
+	{
+		IPFIX_FLOW flow;
+
+		GetIpfixFlow(fields, pwsMessage, &flow);
+
+		return WriteIpfixFlow(sink, &session->render.record, &flow, &session->ipfix, &session->miner);
+	}
+
+	LPCWSTR record = FormatEventInfo(&session->render, fields, pwsMessage, outputFormat, &length, session->projection);
+
+	if( record == NULL ) {
+		fwprintf(stderr, L"[Error][WriteEventInfo]: malloc failed\n");
+		return TRUE;
+	}
+
+	return sink->Write(record, length);
+}
+
+
+/****
+ * AppendText
+ *
+ * DESC:
+ *     Appends a string to the record being built in a render buffer
+ *
+ * RETURNS:
+ *     FALSE if the buffer could not be grown
+ */
+static BOOL AppendText(GrowBuffer *buffer, DWORD *used, LPCWSTR text)
+{
+	DWORD length = (DWORD)wcslen(text);
+
+	if( !buffer->Reserve((*used + length + 1) * sizeof(WCHAR)) )
+		return FALSE;
+
+	memcpy((LPWSTR)buffer->Data() + *used, text, length * sizeof(WCHAR));
+	*used += length;
+
+	return TRUE;
+}
+
+
+/****
+ * AppendEscaped
+ *
+ * DESC:
+ *     Appends a string to the record being built in a render buffer,
+ *     escaped for use inside a JSON string (see EscapeJson)
+ *
+ * RETURNS:
+ *     FALSE if the buffer could not be grown
+ */
+static BOOL AppendEscaped(GrowBuffer *buffer, DWORD *used, LPCWSTR text)
+{
+	size_t length = wcslen(text);
+
+	if( !buffer->Reserve((DWORD)((*used + length * JSON_ESCAPE_MAX_GROWTH + 1) * sizeof(WCHAR))) )
+		return FALSE;
+
+	*used += (DWORD)EscapeJson(text, length, (LPWSTR)buffer->Data() + *used);
+
+	return TRUE;
+}
+
+
+/****
+ * AppendField
+ *
+ * DESC:
+ *     Appends one "name":"value" pair to a JSON record, with the value
+ *     escaped (see AppendEscaped). Every pair but the first, which comes
+ *     straight after the opening brace, is preceded by a comma
+ *
+ * RETURNS:
+ *     FALSE if the buffer could not be grown
+ */
+static BOOL AppendField(GrowBuffer *buffer, DWORD *used, LPCWSTR name, LPCWSTR value)
+{
+	return AppendText(buffer, used, *used > 1 ? L",\"" : L"\"") && AppendText(buffer, used, name)
+		&& AppendText(buffer, used, L"\":\"") && AppendEscaped(buffer, used, value)
+		&& AppendText(buffer, used, L"\"");
+}
+
+
+/****
+ * AppendEventData
+ *
+ * DESC:
+ *     Appends the EventData fields of an event to a JSON record, as
+ *     ,"event_data":{"name":"value",...}. Unnamed fields are keyed by
+ *     their position
+ *
+ * RETURNS:
+ *     FALSE if the buffer could not be grown
+ */
+static BOOL AppendEventData(GrowBuffer *buffer, DWORD *used, const std::vector<EVENT_DATA_FIELD> *eventData)
+{
+	WCHAR position[24];
+
+	if( !AppendText(buffer, used, L",\"event_data\":{") )
+		return FALSE;
+
+	for( size_t i = 0; i < eventData->size(); i++ )
+	{
+		const EVENT_DATA_FIELD &field = (*eventData)[i];
+		LPCWSTR name = field.name != NULL ? field.name : FormatUnsigned(field.position, position);
+
+		if( !AppendText(buffer, used, i == 0 ? L"\"" : L",\"") || !AppendEscaped(buffer, used, name)
+			|| !AppendText(buffer, used, L"\":\"") || !AppendEscaped(buffer, used, field.value)
+			|| !AppendText(buffer, used, L"\"") )
+			return FALSE;
+	}
+
+	return AppendText(buffer, used, L"}");
+}
+
+
+/****
+ * AppendIdentity
+ *
+ * DESC:
+ *     Appends the identity of a logon, logoff or NPS event to a JSON
+ *     record, as ,"identity":{"user":"...",...,"state":"0"}
+ *
+ * RETURNS:
+ *     FALSE if the buffer could not be grown
+ */
+static BOOL AppendIdentity(GrowBuffer *buffer, DWORD *used, const IDENTITY_RECORD *identity)
+{
+	WCHAR state[24];
+
+	return AppendText(buffer, used, L",\"identity\":{\"user\":\"") && AppendEscaped(buffer, used, identity->user)
+		&& AppendText(buffer, used, L"\",\"domain\":\"") && AppendEscaped(buffer, used, identity->domain)
+		&& AppendText(buffer, used, L"\",\"logon_id\":\"") && AppendEscaped(buffer, used, identity->logonId)
+		&& AppendText(buffer, used, L"\",\"logon_type\":\"") && AppendEscaped(buffer, used, identity->logonType)
+		&& AppendText(buffer, used, L"\",\"source\":\"") && AppendEscaped(buffer, used, identity->sourceAddress)
+		&& AppendText(buffer, used, L"\",\"workstation\":\"") && AppendEscaped(buffer, used, identity->workstation)
+		&& AppendText(buffer, used, L"\",\"state\":\"") && AppendText(buffer, used, FormatUnsigned(identity->state, state))
+		&& AppendText(buffer, used, L"\"}");
+}
+
+
+/****
+ * FormatEventInfo
+ *
+ * DESC:
+ *     Formats an event as one output record: a JSON object, or a line of
+ *     '||'-separated values. JSON values are escaped on the way in, so
+ *     the record is valid JSON whatever the message holds
+ *
+ *     EventData fields and the identity, if the event was read with them,
+ *     are added to JSON records as an "event_data" and an "identity"
+ *     object (see AppendEventData and AppendIdentity). The '||' format
+ *     has no room for them
+ *
+ *     Fields the projection leaves out are left out of JSON records, and
+ *     left empty in '||' ones, so their columns stay where they are
+ *
+ * ARGS:
+ *     render - Session render context; the record is built in its buffer
+ *     fields - System fields of the event
+ *     message - its message, or NULL if it has none
+ *     outputFormat - 0 for JSON, otherwise XML
+ *     length - receives the length of the record, in characters
+ *     projection - RECORD_FIELD_* flags of the fields to write (at least
+ *                  one of them)
+ *
+ * RETURNS:
+ *     The record (null terminated, valid until the next one is formatted),
+ *     or NULL if the buffer could not be grown
+ */
+LPCWSTR FormatEventInfo(RenderContext *render, SYSTEM_FIELDS *fields, LPCWSTR message, INT outputFormat, DWORD *length, DWORD projection)
+{
+	GrowBuffer *buffer = &render->record;
+	DWORD used = 0;
+	BOOL ok;
+
+	if( outputFormat == OUTPUT_FORMAT_JSON ) 
+	{
+		ok = AppendText(buffer, &used, L"{")
+			&& (!(projection & RECORD_FIELD_RECORD_ID) || AppendField(buffer, &used, L"record_id", fields->recordId))
+			&& (!(projection & RECORD_FIELD_EVENT_ID) || AppendField(buffer, &used, L"event_id", fields->eventId))
+			&& (!(projection & RECORD_FIELD_LOGNAME) || AppendField(buffer, &used, L"logname", fields->channel))
+			&& (!(projection & RECORD_FIELD_SOURCE) || AppendField(buffer, &used, L"source", fields->provider))
+			&& (!(projection & RECORD_FIELD_COMPUTER) || AppendField(buffer, &used, L"computer", fields->computer))
+			&& (!(projection & RECORD_FIELD_TIME_CREATED) || AppendField(buffer, &used, L"time_created", fields->timeCreated))
+			&& (!(projection & RECORD_FIELD_TASK) || AppendField(buffer, &used, L"task", fields->task))
+			&& (!(projection & RECORD_FIELD_LEVEL) || AppendField(buffer, &used, L"level", fields->level))
+			&& (!(projection & RECORD_FIELD_MESSAGE) || AppendField(buffer, &used, L"message", message != NULL ? message : L""))
+			&& (fields->eventData == NULL || AppendEventData(buffer, &used, fields->eventData))
+			&& (fields->identity == NULL || AppendIdentity(buffer, &used, fields->identity))
+			&& AppendText(buffer, &used, L"}");
+	} 
+	else 
+	{
+		ok = AppendText(buffer, &used, (projection & RECORD_FIELD_RECORD_ID) ? fields->recordId : L"") && AppendText(buffer, &used, L"||")
+			&& AppendText(buffer, &used, (projection & RECORD_FIELD_EVENT_ID) ? fields->eventId : L"") && AppendText(buffer, &used, L"||")
+			&& AppendText(buffer, &used, (projection & RECORD_FIELD_LOGNAME) ? fields->channel : L"") && AppendText(buffer, &used, L"||")
+			&& AppendText(buffer, &used, (projection & RECORD_FIELD_SOURCE) ? fields->provider : L"") && AppendText(buffer, &used, L"||")
+			&& AppendText(buffer, &used, (projection & RECORD_FIELD_COMPUTER) ? fields->computer : L"") && AppendText(buffer, &used, L"||")
+			&& AppendText(buffer, &used, (projection & RECORD_FIELD_TIME_CREATED) ? fields->timeCreated : L"") && AppendText(buffer, &used, L"||")
+			&& AppendText(buffer, &used, (projection & RECORD_FIELD_TASK) ? fields->task : L"") && AppendText(buffer, &used, L"||")
+			&& AppendText(buffer, &used, (projection & RECORD_FIELD_LEVEL) ? fields->level : L"") && AppendText(buffer, &used, L"||")
+			&& AppendText(buffer, &used, !(projection & RECORD_FIELD_MESSAGE) ? L"" : message != NULL ? message : L"(no message provided)")
+			&& AppendText(buffer, &used, L"\n");
+	}
+
+	if( !ok )
+		return NULL;
+
+	((LPWSTR)buffer->Data())[used] = L'\0';
+	*length = used;
+
+	return (LPCWSTR)buffer->Data();
+}
+
+
+/****
+ * GetEventMessage
+ *
+ * DESC:
+ *     Gets the message of an event, from its cached template if the
+ *     session formats messages locally, otherwise (or if the template
+ *     cannot be used for this event) from the source
+ *
+ * ARGS:
+ *     session - Remote session context and its caches
+ *     hMetadata - Handle to open metadata for the event's provider
+ *     hEvent - Handle to open event
+ *     fields - its System fields (see ReadEventFields)
+ *     debug - set to 0 (none) 1 (basic) or 2 (verbose)
+ *
+ * RETURNS:
+ *     The message, or NULL if the event has none. It lives in the session
+ *     and is overwritten by the next call
+ *
+ * REMARKS:
+ *     When a local message is picked for verification, the remote one is
+ *     fetched as well and is what gets returned; a template that gives a
+ *     different message is dropped (see MessageTemplates::Verified)
+ */
+LPCWSTR GetEventMessage(EVENT_SESSION *session, EVT_HANDLE hMetadata, EVT_HANDLE hEvent, SYSTEM_FIELDS *fields, INT debug)
+{
+	BOOL verify = FALSE;
+	LPCWSTR local = session->templates.Format(&session->render, hMetadata, hEvent, fields, &verify);
+
+	if( local != NULL && !verify )
+		return local;
+
+	LPWSTR message = GetEventMessageDescription(session, hMetadata, hEvent);
+
+	if( local != NULL ) 
+	{
+		BOOL matched = message != NULL && wcscmp(local, message) == 0;
+
+		session->templates.Verified(matched);
+
+		if( !matched && debug >= DEBUG_L1 ) {
+			wprintf( L"[GetEventMessage] Template of %ls event %ls (version %ls) does not match EvtFormatMessage; no longer used\n", fields->provider, fields->eventId, fields->version );
+		}
+	}
+
+	return message;
+}
+
+
+/****
+ * GetEventMessageDescription
+ *
+ * DESC:
+ *     Gets the specified message string from the event. If the event does not 
+ *     contain the specified message, the function returns NULL.
+ *
+ * ARGS:
+ *     render - Session render context that holds the message buffers
+ *     hMetaData - Handle to open metadata for an event
+ *     hEvent - Handle to open event
+ *
+ * RETURNS:
+ *     If a message has been found, returns a string containing the message.
+ *     Otherwise if no message has been found, returns NULL
+ *
+ *     Note: The string lives in the render context and is overwritten by the
+ *     next call. The caller must not free it
+ */
+LPWSTR GetEventMessageDescription(EVENT_SESSION *session, EVT_HANDLE hMetadata, EVT_HANDLE hEvent)
+{
+	RenderContext *render = &session->render;
+
+	// Number of characters used for message string
+    DWORD dwBufferUsed = 0;		
+
+	// Attempt to read provider-specific message straight into our message buffer. Only
+	// if that buffer is too small do we grow it and ask again
+    if (!session->source->FormatEventMessage(hMetadata, hEvent, render->message.Size() / sizeof(WCHAR), (LPWSTR)render->message.Data(), &dwBufferUsed))
+    {
+		// An error occurred. Retrieve this error
+        DWORD dwError = GetLastError();
+
+		// If the error was due to our destination buffer being too small
+        if (dwError == ERROR_INSUFFICIENT_BUFFER)
+        {
+			// Grow our buffer to the required size
+            if (!render->message.Reserve(dwBufferUsed * sizeof(WCHAR)))
+            {
+				// Allocation failed
+                fwprintf(stderr, L"[Error][GetEventMessageDescription]: malloc failed\n");
+				return NULL;
+            }
+
+			// Re-attempt to retrieve event message
+            if (!session->source->FormatEventMessage(hMetadata, hEvent, render->message.Size() / sizeof(WCHAR), (LPWSTR)render->message.Data(), &dwBufferUsed))
+			{
+				return NULL;
+			}
+        }
+        else if (dwError == ERROR_EVT_MESSAGE_NOT_FOUND)
+		{
+			// Message was not found. Will return NULL
+			return NULL;
+		}
+		else if (dwError == ERROR_EVT_MESSAGE_ID_NOT_FOUND) 
+		{
+			// Message ID not found. Will return NULL
+			return NULL;
+		}
+        else
+        {
+			// Unexpected error. Output to screen
+            fwprintf(stderr, L"[Error][GetEventMessageDescription]: EvtFormatMessage failed with %u\n", dwError);
+			return NULL;
+        }
+    }
+
+	// Returned raw; JSON output escapes it as the record is formatted
+	return (LPWSTR)render->message.Data();
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include "Platform.h"
+#include <stdio.h>
+#include "EventSource.h"
+#include "RenderContext.h"
+#include "EventFetcher.h"
+#include "PublisherCache.h"
+#include "MessageTemplates.h"
+#include "SystemFields.h"
+#include "EventFilter.h"
+#include "EventData.h"
+#include "Identity.h"
+#include "OutputSink.h"
+#include "JsonEscape.h"
+#include "BinaryRecord.h"
+#include "IpfixRecord.h"
+#include "EventAggregator.h"
+#include "TemplateMiner.h"
+
+// Default log to use when no log name has been specified
+#define DEFAULT_LOG L"Application"
+
+// Default max/min record numbers to use when none have been specified
+#define DEFAULT_MIN_RECORD 0
+#define DEFAULT_MAX_RECORD 0xFFFFFFFF
+
+// Pass to the "outputFormat" parameter of ParseLogInternal to determine  
+// the output format. Anything else is the '||' format. Binary and IPFIX
+// records only go to sinks that take them (see OutputSink::WriteBinary)
+#define OUTPUT_FORMAT_JSON 0
+#define OUTPUT_FORMAT_BINARY 2
+#define OUTPUT_FORMAT_IPFIX 3
+
+// Whether a format has the CSV column header printed ahead of it
+#define OUTPUT_FORMAT_HAS_HEADER(format) ((format) != OUTPUT_FORMAT_JSON && (format) != OUTPUT_FORMAT_BINARY && (format) != OUTPUT_FORMAT_IPFIX)
+
+// Column header printed ahead of the records in the '||' format
+#define CSV_HEADER L"RecordID||EventID||Channel||Provider||Computer||TimeCreated||Task||Level\n\n"
+
+// Pass to the "mode" parameter for ParseLogInternal to determine how it
+// behaves. MODE_RENDER_XML, MODE_EVENT_DATA and MODE_IDENTITY may be
+// combined with either of the others. MODE_FORWARD has ParseEventSource
+// read oldest first rather than newest first (cursors always do)
+#define MODE_DEFAULT 0
+#define MODE_FETCH_LAST_RECORD 1
+#define MODE_RENDER_XML 2
+#define MODE_EVENT_DATA 4
+#define MODE_IDENTITY 8
+#define MODE_FORWARD 16
+
+// Debugging levels accepted through the "debug" parameter
+#define DEBUG_NONE 0
+#define DEBUG_L1 1
+#define DEBUG_L2 2 
+
+// State that lives as long as one session with an event source.
+// eventDataSelection is what MODE_EVENT_DATA adds to each record, and
+// eventData holds the current event's share of it. identity is what
+// MODE_IDENTITY read from the current event. templates decides how
+// messages are formatted (see GetEventMessage). projection is the
+// RECORD_FIELD_* flags of the fields written to each record. filter, if
+// set, has each event checked against what its compiled query could not
+// say (see EventFilter::Matches). lastRecordId is the record ID of the
+// last event ProcessResults wrote or passed over. ipfix is how events are
+// written as IPFIX records (OUTPUT_FORMAT_IPFIX), flows merges them
+// into one record per storm when it is enabled, and miner finds the
+// templates of their messages when ipfix sends those instead
+struct EVENT_SESSION {
+	EventSource *source;
+	DWORD projection;
+	const EventFilter *filter;
+	PublisherCache publishers;
+	MessageTemplates templates;
+	RenderContext render;
+	EventDataSelection eventDataSelection;
+	std::vector<EVENT_DATA_FIELD> eventData;
+	IDENTITY_RECORD identity;
+	DWORD64 lastRecordId;
+	IPFIX_EXPORT ipfix;
+	EventAggregator flows;
+	TemplateMiner miner;
+
+	EVENT_SESSION(EventSource *source) : source(source), projection(RECORD_FIELDS_ALL), filter(NULL), publishers(source), templates(source), render(source), lastRecordId(0) {}
+};
+
+// Portable parser core (see ParserCore.cpp)
+DWORD64 ParseEventSource(EventSource*, LPCWSTR, LPCWSTR, INT, INT, INT, OutputSink* = NULL, DWORD = RECORD_FIELDS_ALL, EventFilter* = NULL, DWORD64* = NULL);
+DWORD64 ProcessResults(EVENT_SESSION*, EVT_HANDLE, OutputSink*, INT, INT, INT);
+DWORD64 DumpEventInfo(EVENT_SESSION*, EVT_HANDLE, OutputSink*, INT, INT, INT);
+BOOL ReadEventFields(EVENT_SESSION*, EVT_HANDLE, SYSTEM_FIELDS*, INT, INT);
+BOOL WriteEventInfo(EVENT_SESSION*, EVT_HANDLE, SYSTEM_FIELDS*, OutputSink*, INT, INT);
+LPCWSTR FormatEventInfo(RenderContext*, SYSTEM_FIELDS*, LPCWSTR, INT, DWORD*, DWORD = RECORD_FIELDS_ALL);
+LPCWSTR GetEventMessage(EVENT_SESSION*, EVT_HANDLE, EVT_HANDLE, SYSTEM_FIELDS*, INT);
+LPWSTR GetEventMessageDescription(EVENT_SESSION*, EVT_HANDLE, EVT_HANDLE);
@@ -0,0 +1,209 @@
+#pragma once
+
+// The parser core only needs a handful of Win32 and winevt types. On Windows
+// they come from the SDK; everywhere else the subset used by the core and the
+// non-Windows event sources is defined here, with the same names and values.
+
+#ifdef _WIN32
+
+#include <windows.h>
+#include <winevt.h>
+
+#else
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+
+typedef uint8_t BYTE;
+typedef uint16_t USHORT;
+typedef uint16_t WORD;
+typedef uint32_t DWORD;
+typedef uint64_t DWORD64;
+typedef uint64_t ULONGLONG;
+typedef int64_t LONGLONG;
+typedef int BOOL;
+typedef int INT;
+typedef int8_t INT8;
+typedef int16_t INT16;
+typedef int32_t INT32;
+typedef int64_t INT64;
+typedef uint8_t UINT8;
+typedef uint16_t UINT16;
+typedef uint32_t UINT32;
+typedef uint64_t UINT64;
+typedef wchar_t WCHAR;
+typedef wchar_t *LPWSTR;
+typedef const wchar_t *LPCWSTR;
+typedef void *PVOID;
+typedef void *LPVOID;
+typedef void *HANDLE;
+typedef HANDLE EVT_HANDLE;
+
+typedef struct _GUID {
+	DWORD Data1;
+	WORD Data2;
+	WORD Data3;
+	BYTE Data4[8];
+} GUID;
+
+#ifndef TRUE
+#define TRUE 1
+#define FALSE 0
+#endif
+
+#define INFINITE 0xFFFFFFFF
+
+#define __stdcall
+#define __declspec(x)
+
+#define _wcstoui64 wcstoull
+
+// Win32 error codes
+#define ERROR_SUCCESS 0
+#define ERROR_FILE_NOT_FOUND 2
+#define ERROR_INVALID_HANDLE 6
+#define ERROR_INVALID_DATA 13
+#define ERROR_OUTOFMEMORY 14
+#define ERROR_NOT_SUPPORTED 50
+#define ERROR_INVALID_PARAMETER 87
+#define ERROR_INSUFFICIENT_BUFFER 122
+#define ERROR_MORE_DATA 234
+#define ERROR_NO_MORE_ITEMS 259
+#define ERROR_NOT_FOUND 1168
+#define ERROR_TIMEOUT 1460
+#define RPC_S_SERVER_UNAVAILABLE 1722
+
+// winevt error codes
+#define ERROR_EVT_INVALID_QUERY 15001
+#define ERROR_EVT_PUBLISHER_METADATA_NOT_FOUND 15002
+#define ERROR_EVT_CHANNEL_NOT_FOUND 15007
+#define ERROR_EVT_MESSAGE_NOT_FOUND 15027
+#define ERROR_EVT_MESSAGE_ID_NOT_FOUND 15028
+
+// EvtQuery flags
+#define EvtQueryChannelPath 0x1
+#define EvtQueryFilePath 0x2
+#define EvtQueryForwardDirection 0x100
+#define EvtQueryReverseDirection 0x200
+
+// EvtSubscribe flags. The origin is one of the first three
+#define EvtSubscribeToFutureEvents 1
+#define EvtSubscribeStartAtOldestRecord 2
+#define EvtSubscribeStartAfterBookmark 3
+#define EvtSubscribeOriginMask 0x3
+#define EvtSubscribeStrict 0x10000
+
+typedef enum _EVT_RENDER_CONTEXT_FLAGS {
+	EvtRenderContextValues = 0,
+	EvtRenderContextSystem,
+	EvtRenderContextUser
+} EVT_RENDER_CONTEXT_FLAGS;
+
+typedef enum _EVT_RENDER_FLAGS {
+	EvtRenderEventValues = 0,
+	EvtRenderEventXml,
+	EvtRenderBookmark
+} EVT_RENDER_FLAGS;
+
+typedef enum _EVT_FORMAT_MESSAGE_FLAGS {
+	EvtFormatMessageEvent = 1,
+	EvtFormatMessageLevel,
+	EvtFormatMessageTask,
+	EvtFormatMessageOpcode,
+	EvtFormatMessageKeyword,
+	EvtFormatMessageChannel,
+	EvtFormatMessageProvider,
+	EvtFormatMessageId,
+	EvtFormatMessageXml
+} EVT_FORMAT_MESSAGE_FLAGS;
+
+typedef enum _EVT_SYSTEM_PROPERTY_ID {
+	EvtSystemProviderName = 0,
+	EvtSystemProviderGuid,
+	EvtSystemEventID,
+	EvtSystemQualifiers,
+	EvtSystemLevel,
+	EvtSystemTask,
+	EvtSystemOpcode,
+	EvtSystemKeywords,
+	EvtSystemTimeCreated,
+	EvtSystemEventRecordId,
+	EvtSystemActivityID,
+	EvtSystemRelatedActivityID,
+	EvtSystemProcessID,
+	EvtSystemThreadID,
+	EvtSystemChannel,
+	EvtSystemComputer,
+	EvtSystemUserID,
+	EvtSystemVersion,
+	EvtSystemPropertyIdEND
+} EVT_SYSTEM_PROPERTY_ID;
+
+typedef enum _EVT_VARIANT_TYPE {
+	EvtVarTypeNull = 0,
+	EvtVarTypeString = 1,
+	EvtVarTypeAnsiString = 2,
+	EvtVarTypeSByte = 3,
+	EvtVarTypeByte = 4,
+	EvtVarTypeInt16 = 5,
+	EvtVarTypeUInt16 = 6,
+	EvtVarTypeInt32 = 7,
+	EvtVarTypeUInt32 = 8,
+	EvtVarTypeInt64 = 9,
+	EvtVarTypeUInt64 = 10,
+	EvtVarTypeSingle = 11,
+	EvtVarTypeDouble = 12,
+	EvtVarTypeBoolean = 13,
+	EvtVarTypeBinary = 14,
+	EvtVarTypeGuid = 15,
+	EvtVarTypeSizeT = 16,
+	EvtVarTypeFileTime = 17,
+	EvtVarTypeSysTime = 18,
+	EvtVarTypeSid = 19,
+	EvtVarTypeHexInt32 = 20,
+	EvtVarTypeHexInt64 = 21,
+	EvtVarTypeEvtHandle = 32,
+	EvtVarTypeEvtXml = 35
+} EVT_VARIANT_TYPE;
+
+typedef struct _EVT_VARIANT {
+	union {
+		BOOL BooleanVal;
+		INT8 SByteVal;
+		INT16 Int16Val;
+		INT32 Int32Val;
+		INT64 Int64Val;
+		UINT8 ByteVal;
+		UINT16 UInt16Val;
+		UINT32 UInt32Val;
+		UINT64 UInt64Val;
+		float SingleVal;
+		double DoubleVal;
+		ULONGLONG FileTimeVal;
+		GUID *GuidVal;
+		LPCWSTR StringVal;
+		const char *AnsiStringVal;
+		BYTE *BinaryVal;
+		PVOID SidVal;
+		size_t SizeTVal;
+		EVT_HANDLE EvtHandleVal;
+		LPCWSTR XmlVal;
+	};
+	DWORD Count;
+	DWORD Type;
+} EVT_VARIANT, *PEVT_VARIANT;
+
+// Thread-local last error, mirroring the Win32 calls of the same name
+inline DWORD &LastErrorSlot()
+{
+	static thread_local DWORD error = ERROR_SUCCESS;
+	return error;
+}
+
+inline DWORD GetLastError() { return LastErrorSlot(); }
+inline void SetLastError(DWORD error) { LastErrorSlot() = error; }
+
+#endif
@@ -0,0 +1,98 @@
+#include "ParserCore.h"
+
+/****
+ * PublisherCache::PublisherCache
+ *
+ * ARGS:
+ *     source - Event source (session) the metadata is opened against
+ *     capacity - maximum number of providers to remember
+ */
+PublisherCache::PublisherCache(EventSource *source, DWORD capacity)
+	: source(source), capacity(capacity > 0 ? capacity : 1), hits(0), misses(0)
+{
+}
+
+
+PublisherCache::~PublisherCache()
+{
+	Clear();
+}
+
+
+/****
+ * PublisherCache::Open
+ *
+ * DESC:
+ *     Returns the metadata handle for a provider, opening it on a miss
+ *
+ * ARGS:
+ *     publisherName - provider name, as found in <Provider Name="...">
+ *
+ * RETURNS:
+ *     The metadata handle, or NULL if the provider could not be opened
+ */
+EVT_HANDLE PublisherCache::Open(LPCWSTR publisherName)
+{
+	key.assign(publisherName);
+
+	std::unordered_map<std::wstring, std::list<ENTRY>::iterator>::iterator found = index.find(key);
+
+	if( found != index.end() ) {
+		hits++;
+
+		// Move to the front so it is the last to be evicted
+		entries.splice(entries.begin(), entries, found->second);
+
+		return found->second->hMetadata;
+	}
+
+	misses++;
+
+	EVT_HANDLE hMetadata = source->OpenPublisherMetadata(publisherName);
+
+	if( hMetadata == NULL ) {
+		DWORD dwError = GetLastError();
+
+		// Only a provider that is genuinely missing is worth remembering
+		if( dwError != ERROR_EVT_PUBLISHER_METADATA_NOT_FOUND && dwError != ERROR_FILE_NOT_FOUND )
+			return NULL;
+	}
+
+	// Make room for the new entry
+	if( entries.size() >= capacity ) {
+		ENTRY &oldest = entries.back();
+
+		if( oldest.hMetadata != NULL )
+			source->Close(oldest.hMetadata);
+
+		index.erase(oldest.name);
+		entries.pop_back();
+	}
+
+	ENTRY entry;
+	entry.name = key;
+	entry.hMetadata = hMetadata;
+
+	entries.push_front(entry);
+	index[key] = entries.begin();
+
+	return hMetadata;
+}
+
+
+/****
+ * PublisherCache::Clear
+ *
+ * DESC:
+ *     Closes every cached handle. Must run before the session is closed
+ */
+void PublisherCache::Clear()
+{
+	for( std::list<ENTRY>::iterator it = entries.begin(); it != entries.end(); ++it ) {
+		if( it->hMetadata != NULL )
+			source->Close(it->hMetadata);
+	}
+
+	entries.clear();
+	index.clear();
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "Platform.h"
+#include "EventSource.h"
+#include <list>
+#include <string>
+#include <unordered_map>
+
+// Number of publisher metadata handles kept open per session
+#define PUBLISHER_CACHE_SIZE 64
+
+/****
+ * PublisherCache
+ *
+ * DESC:
+ *     Bounded LRU cache of publisher metadata handles, keyed by provider
+ *     name. Each session owns one, so OpenPublisherMetadata (a remote
+ *     call on a winevt session) runs once per provider rather than once
+ *     per event
+ *
+ * REMARKS:
+ *     Providers that do not exist on the remote machine are remembered as
+ *     a NULL handle, as that lookup fails for the same providers over and
+ *     over. Other failures (e.g. RPC errors) are not cached.
+ *
+ *     Handles returned by Open belong to the cache. Do not close them, and
+ *     do not hold on to them past the next call to Open.
+ */
+class PublisherCache {
+public:
+	PublisherCache(EventSource *source, DWORD capacity = PUBLISHER_CACHE_SIZE);
+	~PublisherCache();
+
+	EVT_HANDLE Open(LPCWSTR publisherName);
+	void Clear();
+
+	DWORD64 Hits() const { return hits; }
+	DWORD64 Misses() const { return misses; }
+
+private:
+	struct ENTRY {
+		std::wstring name;
+		EVT_HANDLE hMetadata;
+	};
+
+	EventSource *source;
+	DWORD capacity;
+	DWORD64 hits;
+	DWORD64 misses;
+
+	// Most recently used entry at the front
+	std::list<ENTRY> entries;
+	std::unordered_map<std::wstring, std::list<ENTRY>::iterator> index;
+
+	// Reused for lookups, so a hit does not allocate a key
+	std::wstring key;
+};
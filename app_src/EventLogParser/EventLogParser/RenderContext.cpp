@@ -0,0 +1,240 @@
+#include "ParserCore.h"
+
+/****
+ * GrowBuffer::Reserve
+ *
+ * DESC:
+ *     Makes sure the buffer holds at least the given number of bytes
+ *
+ * ARGS:
+ *     bytes - required size
+ *
+ * RETURNS:
+ *     TRUE on success, FALSE if the allocation failed (the old contents
+ *     are kept in that case)
+ */
+BOOL GrowBuffer::Reserve(DWORD bytes)
+{
+	if( bytes <= size )
+		return TRUE;
+
+	// Grow geometrically so a run of slightly larger events does not
+	// reallocate on every one of them
+	DWORD newSize = size * 2 > bytes ? size * 2 : bytes;
+
+	void *newData = realloc(data, newSize);
+
+	if( newData == NULL )
+		return FALSE;
+
+	data = newData;
+	size = newSize;
+
+	return TRUE;
+}
+
+
+/****
+ * RenderContext::RenderContext
+ *
+ * ARGS:
+ *     source - Event source the rendered events come from
+ */
+RenderContext::RenderContext(EventSource *source)
+	: source(source)
+{
+	xml.Reserve(RENDER_BUFFER_INITIAL);
+	values.Reserve(RENDER_BUFFER_INITIAL);
+	message.Reserve(RENDER_BUFFER_INITIAL);
+	inserts.Reserve(RENDER_BUFFER_INITIAL);
+
+	// Created locally (no session needed). If this fails we fall back to XML
+	hSystemContext = source->CreateRenderContext(EvtRenderContextSystem);
+
+	// Only needed to fill in message templates locally (see MessageTemplates)
+	hUserContext = source->CreateRenderContext(EvtRenderContextUser);
+
+	doc = new rapidxml::xml_document<WCHAR>();
+}
+
+
+RenderContext::~RenderContext()
+{
+	if( hSystemContext != NULL )
+		source->Close(hSystemContext);
+	if( hUserContext != NULL )
+		source->Close(hUserContext);
+
+	delete doc;
+}
+
+
+/****
+ * RenderContext::RenderXml
+ *
+ * DESC:
+ *     Renders an event as XML into the session's render buffer
+ *
+ * ARGS:
+ *     hEvent - Handle to open event
+ *     debug - set to 0 (none) 1 (basic) or 2 (verbose)
+ *
+ * RETURNS:
+ *     The XML string, or NULL on failure (see GetLastError). The string
+ *     is only valid until the next call
+ *
+ * REMARKS:
+ *     The render is attempted straight into the existing buffer. Only if
+ *     that is too small is it grown and the render repeated
+ */
+LPWSTR RenderContext::RenderXml(EVT_HANDLE hEvent, INT debug)
+{
+	DWORD dwBufferUsed = 0;
+	DWORD dwPropertyCount = 0;
+
+	if( source->Render(NULL, hEvent, EvtRenderEventXml, xml.Size(), xml.Data(), &dwBufferUsed, &dwPropertyCount) )
+		return (LPWSTR)xml.Data();
+
+	if( GetLastError() != ERROR_INSUFFICIENT_BUFFER )
+		return NULL;
+
+	if( debug >= DEBUG_L2 ) {
+		wprintf(L"[RenderXml]: Growing render buffer from %u to %u bytes\n", xml.Size(), dwBufferUsed);
+	}
+
+	if( !xml.Reserve(dwBufferUsed) ) {
+		SetLastError(ERROR_OUTOFMEMORY);
+		return NULL;
+	}
+
+	if( source->Render(NULL, hEvent, EvtRenderEventXml, xml.Size(), xml.Data(), &dwBufferUsed, &dwPropertyCount) )
+		return (LPWSTR)xml.Data();
+
+	return NULL;
+}
+
+
+/****
+ * RenderContext::RenderSystemValues
+ *
+ * DESC:
+ *     Renders the System properties of an event as typed values, using
+ *     the system render context
+ *
+ * ARGS:
+ *     hEvent - Handle to open event
+ *
+ * RETURNS:
+ *     An array indexed by EVT_SYSTEM_PROPERTY_ID, or NULL on failure (see
+ *     GetLastError). Only valid until the next call
+ */
+PEVT_VARIANT RenderContext::RenderSystemValues(EVT_HANDLE hEvent)
+{
+	DWORD dwPropertyCount = 0;
+
+	return RenderValues(hSystemContext, &values, hEvent, &dwPropertyCount);
+}
+
+
+/****
+ * RenderContext::RenderUserValues
+ *
+ * DESC:
+ *     Renders the event's own values (what its message inserts as %1..%n)
+ *     using the user render context
+ *
+ * ARGS:
+ *     hEvent - Handle to open event
+ *     count - receives the number of values
+ *
+ * RETURNS:
+ *     The values in EventData order, or NULL on failure (see
+ *     GetLastError). Only valid until the next call. The System values
+ *     are left alone
+ */
+PEVT_VARIANT RenderContext::RenderUserValues(EVT_HANDLE hEvent, DWORD *count)
+{
+	if( hUserContext == NULL ) {
+		SetLastError(ERROR_INVALID_HANDLE);
+		return NULL;
+	}
+
+	return RenderValues(hUserContext, &inserts, hEvent, count);
+}
+
+
+// Renders values into a buffer, growing it once if the event does not fit
+PEVT_VARIANT RenderContext::RenderValues(EVT_HANDLE hContext, GrowBuffer *buffer, EVT_HANDLE hEvent, DWORD *count)
+{
+	DWORD dwBufferUsed = 0;
+
+	if( source->Render(hContext, hEvent, EvtRenderEventValues, buffer->Size(), buffer->Data(), &dwBufferUsed, count) )
+		return (PEVT_VARIANT)buffer->Data();
+
+	if( GetLastError() != ERROR_INSUFFICIENT_BUFFER )
+		return NULL;
+
+	if( !buffer->Reserve(dwBufferUsed) ) {
+		SetLastError(ERROR_OUTOFMEMORY);
+		return NULL;
+	}
+
+	if( source->Render(hContext, hEvent, EvtRenderEventValues, buffer->Size(), buffer->Data(), &dwBufferUsed, count) )
+		return (PEVT_VARIANT)buffer->Data();
+
+	return NULL;
+}
+
+
+/****
+ * RenderContext::Parse
+ *
+ * DESC:
+ *     Parses an event's XML (in-situ) into the session's document
+ *
+ * ARGS:
+ *     xml - XML string, usually the result of RenderXml
+ *
+ * RETURNS:
+ *     The parsed document
+ *
+ * REMARKS:
+ *     The document's memory pool is reset first, so the nodes of the
+ *     previous event are recycled rather than freed and allocated again
+ */
+rapidxml::xml_document<WCHAR> *RenderContext::Parse(LPWSTR xml)
+{
+	doc->clear();
+	doc->parse<0>(xml);
+
+	return doc;
+}
+
+
+/****
+ * RenderContext::ParseSystem
+ *
+ * DESC:
+ *     Parses only as much of an event's XML as the System fields need:
+ *     <Event> and its first child, <System>. Everything after </System>
+ *     (the EventData or UserData, however large) is neither parsed nor
+ *     scanned for entities
+ *
+ * ARGS:
+ *     xml - XML string, usually the result of RenderXml
+ *
+ * RETURNS:
+ *     The parsed document, holding <Event><System>...</System></Event>
+ *
+ * REMARKS:
+ *     Like Parse, the document's memory pool is reset first. Event XML
+ *     always has <System> first; if some other element came first, that
+ *     is what the document would hold and ExtractSystemFields would fail
+ */
+rapidxml::xml_document<WCHAR> *RenderContext::ParseSystem(LPWSTR xml)
+{
+	doc->clear();
+	doc->parse<rapidxml::parse_first_child_only>(xml);
+
+	return doc;
+}
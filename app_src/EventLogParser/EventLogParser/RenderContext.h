@@ -0,0 +1,93 @@
+#pragma once
+
+#include "Platform.h"
+#include "EventSource.h"
+
+// Room for the nodes of a large event, so parsing one does not make the
+// XML parser allocate (see RenderContext)
+#ifndef RAPIDXML_STATIC_POOL_SIZE
+#define RAPIDXML_STATIC_POOL_SIZE (256 * 1024)
+#endif
+
+#include "rapidxml.hpp"
+
+// Starting size of each render buffer. Most events fit, so even the first
+// one skips the "how big is it" probe call
+#define RENDER_BUFFER_INITIAL (16 * 1024)
+
+/****
+ * GrowBuffer
+ *
+ * DESC:
+ *     A heap buffer that only ever grows. Once it has reached the size of
+ *     the largest event seen, it stops allocating
+ */
+class GrowBuffer {
+public:
+	GrowBuffer() : data(NULL), size(0) {}
+	~GrowBuffer() { free(data); }
+
+	BOOL Reserve(DWORD bytes);
+
+	void *Data() const { return data; }
+	DWORD Size() const { return size; }
+
+private:
+	GrowBuffer(const GrowBuffer &);
+	GrowBuffer &operator=(const GrowBuffer &);
+
+	void *data;
+	DWORD size;
+};
+
+/****
+ * RenderContext
+ *
+ * DESC:
+ *     Per-session scratch space for rendering events, so that dumping an
+ *     event does not touch the heap once the session has warmed up
+ *
+ * REMARKS:
+ *     xml - the event rendered by EvtRender. Parsed in-situ, so node
+ *           values point into it until the next event is rendered
+ *     values - the System properties rendered as EVT_VARIANTs
+ *     inserts - the event's own values (its EventData), rendered as
+ *               EVT_VARIANTs for a message template to insert
+ *     message - raw output of EvtFormatMessage
+ *     record - the event formatted for output (see FormatEventInfo)
+ *     hSystemContext - render context selecting the System properties
+ *     hUserContext - render context selecting the event's own values, or
+ *                    NULL if the source cannot render them
+ *     doc - parsed event (all of it, or just <System>; see ParseSystem).
+ *           Its memory pool is reset before every parse
+ */
+class RenderContext {
+public:
+	RenderContext(EventSource *source);
+	~RenderContext();
+
+	LPWSTR RenderXml(EVT_HANDLE hEvent, INT debug);
+	PEVT_VARIANT RenderSystemValues(EVT_HANDLE hEvent);
+	PEVT_VARIANT RenderUserValues(EVT_HANDLE hEvent, DWORD *count);
+	rapidxml::xml_document<WCHAR> *Parse(LPWSTR xml);
+	rapidxml::xml_document<WCHAR> *ParseSystem(LPWSTR xml);
+
+	GrowBuffer xml;
+	GrowBuffer values;
+	GrowBuffer inserts;
+	GrowBuffer message;
+	GrowBuffer record;
+
+	EVT_HANDLE hSystemContext;
+	EVT_HANDLE hUserContext;
+
+private:
+	EventSource *source;
+
+	PEVT_VARIANT RenderValues(EVT_HANDLE hContext, GrowBuffer *buffer, EVT_HANDLE hEvent, DWORD *count);
+
+	RenderContext(const RenderContext &);
+	RenderContext &operator=(const RenderContext &);
+
+	rapidxml::xml_document<WCHAR> *doc;
+};
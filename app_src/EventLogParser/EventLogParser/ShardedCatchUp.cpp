@@ -0,0 +1,534 @@
+#include "ShardedCatchUp.h"
+
+/****
+ * ShardedCatchUp::ShardedCatchUp
+ *
+ * ARGS:
+ *     sessions - sessions the shards are read through, at most one query
+ *                each at a time (not owned; see the class remarks)
+ *     count - how many there are (at least one)
+ *     shardRecords - record IDs per shard (0 for CATCHUP_SHARD_RECORDS)
+ */
+ShardedCatchUp::ShardedCatchUp(EVENT_SESSION **sessions, DWORD count, DWORD shardRecords)
+	: sessions(sessions, sessions + count), shardRecords(shardRecords > 0 ? shardRecords : CATCHUP_SHARD_RECORDS), outputFormat(OUTPUT_FORMAT_JSON), mode(MODE_DEFAULT), debug(DEBUG_NONE),
+	firstRecord(0), lastRecord(0), started(FALSE), failed(FALSE), lastRecordId(0), status(ERROR_SUCCESS),
+	shardCount(0), claimed(0), merging(0), held(0), mostHeld(0), queries(0), stopping(false), tail(NULL)
+{
+}
+
+
+ShardedCatchUp::~ShardedCatchUp()
+{
+	Close();
+}
+
+
+/****
+ * ShardedCatchUp::Start
+ *
+ * DESC:
+ *     Works out the backlog a filter selects and starts reading it,
+ *     replacing any earlier catch-up
+ *
+ * ARGS:
+ *     logName - event log to read (NULL for the source's default)
+ *     filter - the events to read (copied; NULL for everything). Its
+ *              record range is the backlog
+ *     outputFormat - 0 for JSON, otherwise XML
+ *     mode - MODE_DEFAULT, plus MODE_RENDER_XML, MODE_EVENT_DATA and/or
+ *            MODE_IDENTITY
+ *     debug - set to 0 (none) 1 (basic) or 2 (verbose)
+ *
+ * RETURNS:
+ *     TRUE if reading started, FALSE if the ends of the log could not be
+ *     read, or with one session the log could not be queried (see Status)
+ *
+ * REMARKS:
+ *     Records come out formatted as they are read, ahead of Read, which
+ *     is why the format and mode are given here.
+ */
+BOOL ShardedCatchUp::Start(LPCWSTR logName, const EventFilter *filter, INT outputFormat, INT mode, INT debug)
+{
+	DWORD64 oldest = 0;
+	DWORD64 newest = 0;
+
+	Close();
+
+	this->logName = logName != NULL ? logName : L"";
+	this->filter = filter != NULL ? *filter : EventFilter();
+	this->outputFormat = outputFormat;
+	this->mode = mode;
+	this->debug = debug;
+	failed = FALSE;
+	lastRecordId = 0;
+	status = ERROR_SUCCESS;
+	queries = 0;
+	held = mostHeld = 0;
+
+	if( sessions.empty() ) {
+		status = ERROR_INVALID_PARAMETER;
+		return FALSE;
+	}
+
+	firstRecord = lastRecord = 0;
+	shardCount = claimed = merging = 0;
+	stopping = false;
+
+	// One session reads the log as a cursor would, and Read goes straight
+	// to it
+	if( sessions.size() < CATCHUP_SESSIONS_SHARDED ) {
+		if( debug >= DEBUG_L1 ) {
+			wprintf(L"[ShardedCatchUp]: Reading '%ls' with one cursor, not sharded over one session\n", this->logName.c_str());
+		}
+
+		tail = new EventCursor(sessions[0]);
+
+		if( !tail->StartFiltered(this->logName.empty() ? NULL : this->logName.c_str(), &this->filter, debug) ) {
+			status = tail->Status();
+			delete tail;
+			tail = NULL;
+			return FALSE;
+		}
+
+		started = TRUE;
+
+		return TRUE;
+	}
+
+	if( !FindBounds(&oldest, &newest, debug) )
+		return FALSE;
+
+	// Records below the oldest one are gone, and querying for them would
+	// only cost round trips
+	firstRecord = this->filter.LowRecord() > oldest ? this->filter.LowRecord() : oldest;
+	lastRecord = this->filter.HighRecord() != 0 && this->filter.HighRecord() < newest ? this->filter.HighRecord() : newest;
+
+	shardCount = oldest != 0 && lastRecord >= firstRecord ? (DWORD)((lastRecord - firstRecord) / shardRecords + 1) : 0;
+
+	if( debug >= DEBUG_L1 ) {
+		wprintf(L"[ShardedCatchUp]: Records %llu to %llu of '%ls' in %u shards over %u sessions\n",
+			(unsigned long long)firstRecord, (unsigned long long)lastRecord, this->logName.c_str(), shardCount, (DWORD)sessions.size());
+	}
+
+	for( size_t i = 0; i < sessions.size() && i < shardCount; i++ )
+		workers.push_back(std::thread(&ShardedCatchUp::Work, this, sessions[i]));
+
+	started = TRUE;
+
+	return TRUE;
+}
+
+
+/****
+ * ShardedCatchUp::Read
+ *
+ * DESC:
+ *     Writes the next records of the backlog to a sink, oldest first, then
+ *     those written to the log since
+ *
+ * ARGS:
+ *     maxEvents - most events to write (0 for CURSOR_BATCH_DEFAULT)
+ *     sink - where the records go
+ *     debug - set to 0 (none) 1 (basic) or 2 (verbose)
+ *
+ * RETURNS:
+ *     The number of events written. 0 means there is nothing new, or that
+ *     reading failed (see Status)
+ *
+ * REMARKS:
+ *     Waits for the shard being written to have been read. The shards
+ *     after it are read meanwhile, and go on being read after the call
+ *     returns. As EventCursor::Read, a call that wrote something returns
+ *     before querying for records past the backlog.
+ */
+DWORD ShardedCatchUp::Read(DWORD maxEvents, OutputSink *sink, INT debug)
+{
+	DWORD written = 0;
+	BOOL full = FALSE;
+
+	if( !started || failed ) {
+		status = started ? status : ERROR_INVALID_HANDLE;
+		return 0;
+	}
+
+	if( maxEvents == 0 )
+		maxEvents = CURSOR_BATCH_DEFAULT;
+
+	status = ERROR_SUCCESS;
+
+	while( merging < shardCount && written < maxEvents && !full )
+	{
+		SHARD *shard;
+
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			std::map<DWORD, SHARD *>::iterator found;
+
+			while( (found = shards.find(merging)) == shards.end() || !found->second->done )
+				changed.wait(guard);
+
+			shard = found->second;
+		}
+
+		if( shard->status != ERROR_SUCCESS ) {
+			status = shard->status;
+			failed = TRUE;
+			break;
+		}
+
+		while( shard->written < shard->recordIds.size() && written < maxEvents )
+		{
+			size_t begin = shard->written > 0 ? shard->ends[shard->written - 1] + 1 : 0;
+
+			if( written == 0 && OUTPUT_FORMAT_HAS_HEADER(outputFormat) ) {
+				sink->Header(CSV_HEADER);
+			}
+
+			if( !sink->Write(&shard->text[begin], (DWORD)(shard->ends[shard->written] - begin)) ) {
+				full = TRUE;
+				break;
+			}
+
+			lastRecordId = shard->recordIds[shard->written++];
+			written++;
+		}
+
+		if( shard->written < shard->recordIds.size() )
+			break;
+
+		// Records the filter passed over at the end of the shard
+		if( shard->passed > lastRecordId )
+			lastRecordId = shard->passed;
+
+		{
+			std::lock_guard<std::mutex> guard(lock);
+
+			shards.erase(merging);
+			held -= shard->recordIds.size();
+			merging++;
+		}
+
+		changed.notify_all();
+		delete shard;
+	}
+
+	if( full ) {
+		status = written > 0 ? ERROR_MORE_DATA : ERROR_INSUFFICIENT_BUFFER;
+	}
+
+	if( merging == shardCount && written == 0 && !full && !failed )
+		return ReadTail(maxEvents, sink, debug);
+
+	if( debug >= DEBUG_L1 ) {
+		wprintf(L"[ShardedCatchUp]: Wrote %u events, last record is %llu, %u of %u shards written\n", written, (unsigned long long)lastRecordId, merging, shardCount);
+	}
+
+	return written;
+}
+
+
+/****
+ * ShardedCatchUp::ReadTail
+ *
+ * DESC:
+ *     Reads on past the backlog, through a cursor on the first session
+ *     started from the record after it
+ */
+DWORD ShardedCatchUp::ReadTail(DWORD maxEvents, OutputSink *sink, INT debug)
+{
+	if( tail == NULL )
+	{
+		// Everything the filter asked for was in the backlog
+		if( filter.HighRecord() != 0 && lastRecord >= filter.HighRecord() ) {
+			status = ERROR_SUCCESS;
+			return 0;
+		}
+
+		EventFilter after = filter;
+
+		if( lastRecord + 1 > after.LowRecord() )
+			after.SetLowRecord(lastRecord + 1);
+
+		tail = new EventCursor(sessions[0]);
+
+		if( !tail->StartFiltered(logName.empty() ? NULL : logName.c_str(), &after, debug) ) {
+			status = tail->Status();
+			delete tail;
+			tail = NULL;
+			return 0;
+		}
+	}
+
+	DWORD written = tail->Read(maxEvents, sink, outputFormat, mode, debug);
+
+	status = tail->Status();
+
+	if( tail->LastRecordId() > lastRecordId )
+		lastRecordId = tail->LastRecordId();
+
+	return written;
+}
+
+
+/****
+ * ShardedCatchUp::Close
+ *
+ * DESC:
+ *     Stops the threads and drops the records read but not written. The
+ *     sessions are left open
+ */
+void ShardedCatchUp::Close()
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+
+		stopping = true;
+	}
+
+	changed.notify_all();
+
+	for( size_t i = 0; i < workers.size(); i++ )
+		workers[i].join();
+
+	workers.clear();
+
+	for( std::map<DWORD, SHARD *>::iterator shard = shards.begin(); shard != shards.end(); ++shard )
+		delete shard->second;
+
+	shards.clear();
+
+	if( tail != NULL ) {
+		queries += tail->Queries();
+		delete tail;
+		tail = NULL;
+	}
+
+	started = FALSE;
+}
+
+
+/****
+ * ShardedCatchUp::Queries
+ *
+ * RETURNS:
+ *     How many queries the catch-up has made: two for the ends of the log,
+ *     one per shard read, and those of the cursor past the backlog (only
+ *     the cursor's over one session)
+ */
+DWORD64 ShardedCatchUp::Queries() const
+{
+	return queries + (tail != NULL ? tail->Queries() : 0);
+}
+
+
+/****
+ * ShardedCatchUp::FindBounds
+ *
+ * DESC:
+ *     Reads the record IDs of the oldest and the newest event in the log
+ *
+ * RETURNS:
+ *     TRUE, with both 0 if the log is empty, or FALSE if it could not be
+ *     queried (see Status)
+ */
+BOOL ShardedCatchUp::FindBounds(DWORD64 *oldest, DWORD64 *newest, INT debug)
+{
+	*oldest = EndRecord(sessions[0], EvtQueryForwardDirection, debug);
+
+	if( status == ERROR_SUCCESS && *oldest != 0 )
+		*newest = EndRecord(sessions[0], EvtQueryReverseDirection, debug);
+
+	return status == ERROR_SUCCESS;
+}
+
+
+/****
+ * ShardedCatchUp::EndRecord
+ *
+ * DESC:
+ *     Reads the record ID of the first event a query for the whole log
+ *     returns, oldest or newest first
+ *
+ * RETURNS:
+ *     The record ID, or 0 if the log is empty or could not be read (Status
+ *     says which)
+ */
+DWORD64 ShardedCatchUp::EndRecord(EVENT_SESSION *session, DWORD flags, INT debug)
+{
+	DWORD64 recordId = 0;
+	EVT_HANDLE hEvent = NULL;
+	DWORD dwReturned = 0;
+
+	EVT_HANDLE hResults = session->source->Query(logName.empty() ? NULL : logName.c_str(), NULL, EvtQueryChannelPath | flags);
+
+	queries++;
+
+	if( hResults == NULL ) {
+		status = GetLastError();
+		fwprintf(stderr, L"[Error][ShardedCatchUp]: Could not query the '%ls' log, error %u\n", logName.c_str(), status);
+		return 0;
+	}
+
+	if( session->source->Next(hResults, 1, &hEvent, INFINITE, &dwReturned) )
+	{
+		SYSTEM_FIELDS fields;
+
+		if( ReadEventFields(session, hEvent, &fields, MODE_FETCH_LAST_RECORD, debug) ) {
+			recordId = fields.recordIdValue;
+		} else {
+			status = GetLastError();
+		}
+
+		session->source->Close(hEvent);
+	}
+	else if( GetLastError() != ERROR_NO_MORE_ITEMS )
+	{
+		status = GetLastError();
+	}
+
+	session->source->Close(hResults);
+
+	if( status != ERROR_SUCCESS ) {
+		fwprintf(stderr, L"[Error][ShardedCatchUp]: Could not read the ends of the '%ls' log, error %u\n", logName.c_str(), status);
+	}
+
+	return recordId;
+}
+
+
+/****
+ * ShardedCatchUp::Work
+ *
+ * DESC:
+ *     What each session's thread does: takes the next shard, as long as
+ *     it is not too far ahead of the one being written, and reads it
+ */
+void ShardedCatchUp::Work(EVENT_SESSION *session)
+{
+	DWORD ahead = (DWORD)sessions.size() * CATCHUP_SHARDS_AHEAD;
+	std::unique_lock<std::mutex> guard(lock);
+
+	while( TRUE )
+	{
+		while( !stopping && claimed < shardCount && claimed >= merging + ahead )
+			changed.wait(guard);
+
+		if( stopping || claimed >= shardCount )
+			break;
+
+		SHARD *shard = new SHARD();
+
+		shard->first = firstRecord + (DWORD64)claimed * shardRecords;
+		shard->last = lastRecord - shard->first >= shardRecords ? shard->first + shardRecords - 1 : lastRecord;
+		shard->passed = 0;
+		shard->written = 0;
+		shard->status = ERROR_SUCCESS;
+		shard->done = FALSE;
+		shards[claimed++] = shard;
+
+		guard.unlock();
+
+		ReadShard(session, shard);
+
+		guard.lock();
+
+		shard->done = TRUE;
+		queries++;
+		held += shard->recordIds.size();
+		mostHeld = held > mostHeld ? held : mostHeld;
+
+		changed.notify_all();
+	}
+}
+
+
+/****
+ * ShardedCatchUp::ReadShard
+ *
+ * DESC:
+ *     Reads the records of one shard into memory, with a forward query
+ *     for its record IDs
+ *
+ * REMARKS:
+ *     Records the query returns outside the shard, or out of order, are
+ *     left out, so a source that ignores the record range cannot have a
+ *     record written twice. Records the filter passes over still move
+ *     the shard's passed on, as they do a cursor's LastRecordId
+ */
+void ShardedCatchUp::ReadShard(EVENT_SESSION *session, SHARD *shard)
+{
+	EventFilter bounded = filter;
+	MemorySink sink(&shard->text, &shard->ends);
+	std::wstring query;
+	EVT_HANDLE hEvents[CURSOR_NEXT_MAX];
+	DWORD dwReturned = 0;
+
+	bounded.SetLowRecord(shard->first);
+	bounded.SetHighRecord(shard->last);
+	bounded.Compile(&query);
+
+	// Lets ReadEventFields read the fields the filter checks
+	const EventFilter *sessionFilter = session->filter;
+
+	session->filter = bounded.Residual() ? &bounded : NULL;
+
+	if( debug >= DEBUG_L2 ) {
+		wprintf(L"[ShardedCatchUp]: Querying records %llu to %llu with: %ls\n", (unsigned long long)shard->first, (unsigned long long)shard->last, query.c_str());
+	}
+
+	EVT_HANDLE hResults = session->source->Query(logName.empty() ? NULL : logName.c_str(), query.empty() ? NULL : query.c_str(), EvtQueryChannelPath | EvtQueryForwardDirection);
+
+	if( hResults == NULL ) {
+		shard->status = GetLastError();
+		fwprintf(stderr, L"[Error][ShardedCatchUp]: Could not query records %llu to %llu, error %u\n", (unsigned long long)shard->first, (unsigned long long)shard->last, shard->status);
+	}
+
+	// A shard that has got to its last record is done, without the round
+	// trip it takes to hear there is nothing more
+	while( hResults != NULL && !stopping && shard->passed < shard->last )
+	{
+		if( !session->source->Next(hResults, CURSOR_NEXT_MAX, hEvents, INFINITE, &dwReturned) )
+		{
+			DWORD dwError = GetLastError();
+
+			if( dwError != ERROR_NO_MORE_ITEMS ) {
+				shard->status = dwError;
+				fwprintf(stderr, L"[Error][ShardedCatchUp]: Failed to fetch next batch with following error: %u\n", dwError);
+			}
+
+			break;
+		}
+
+		for( DWORD i = 0; i < dwReturned; i++ )
+		{
+			SYSTEM_FIELDS fields;
+
+			if( ReadEventFields(session, hEvents[i], &fields, mode, debug) )
+			{
+				DWORD64 recordId = fields.recordIdValue;
+
+				if( recordId < shard->first || recordId > shard->last || recordId <= shard->passed ) {
+					if( debug >= DEBUG_L2 ) {
+						wprintf(L"[ShardedCatchUp]: Skipping record %ls, not in order in its shard\n", fields.recordId);
+					}
+				} else {
+					if( (session->filter == NULL || session->filter->Matches(&fields)) && WriteEventInfo(session, hEvents[i], &fields, &sink, outputFormat, debug) )
+						shard->recordIds.push_back(recordId);
+
+					shard->passed = recordId;
+				}
+			}
+			else
+			{
+				fwprintf(stderr, L"[ShardedCatchUp] Failed to render results with: %u\n", GetLastError());
+			}
+
+			session->source->Close(hEvents[i]);
+		}
+	}
+
+	if( hResults != NULL )
+		session->source->Close(hResults);
+
+	session->filter = sessionFilter;
+}
@@ -0,0 +1,138 @@
+#pragma once
+
+#include "Platform.h"
+#include "ParserCore.h"
+#include "EventCursor.h"
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Record IDs each shard of a catch-up covers, when the caller does not say
+#define CATCHUP_SHARD_RECORDS 1000
+
+// Sessions a catch-up reads one host through, when the caller does not
+// say, and the most it may
+#define CATCHUP_SESSIONS_DEFAULT 4
+#define CATCHUP_SESSIONS_MAX 16
+
+// Fewest sessions the backlog is split into shards over. With one, the
+// shards only add round trips, and the catch-up reads as one cursor
+#define CATCHUP_SESSIONS_SHARDED 2
+
+// Shards each session may have read ahead of the one being written
+#define CATCHUP_SHARDS_AHEAD 2
+
+/****
+ * ShardedCatchUp
+ *
+ * DESC:
+ *     Reads a backlog over several sessions at once. The record IDs still
+ *     to be read are split into shards, each read by its own forward
+ *     query, and Read writes the records out in record order, as an
+ *     EventCursor started with the same filter would
+ *
+ * REMARKS:
+ *     Start works out the backlog: from the filter's low record, or the
+ *     oldest record in the log if that is later, up to the filter's high
+ *     record, or the newest record in the log at the time. A thread per
+ *     session takes the next shard and reads it into memory; Read writes
+ *     the shards out in order as they complete. No session reads more
+ *     than CATCHUP_SHARDS_AHEAD shards ahead of the one being written, so
+ *     what is held stays bounded while a slow shard holds up the rest.
+ *
+ *     The sessions are the concurrency cap: each has at most one query
+ *     open at a time. They are borrowed and must outlive the catch-up,
+ *     and each needs a source of its own (for winevt, its own remote
+ *     session). Set them up alike (projection, EventData selection,
+ *     message formatting), or records will depend on the shard they came
+ *     from. The threads keep reading between calls to Read, so nothing
+ *     else may use the sessions until Close.
+ *
+ *     When the sink refuses a record, the read stops as EventCursor's
+ *     does: Status is ERROR_MORE_DATA (or ERROR_INSUFFICIENT_BUFFER) and
+ *     that record is written first by the next call. A shard that fails
+ *     ends the catch-up with its error in Status; LastRecordId is where
+ *     it got to, so it can be started again from the record after.
+ *
+ *     Once the backlog has been written, Read carries on like a cursor
+ *     started with the filter from the record past it, on the first
+ *     session, so a catch-up can be read from for as long as a cursor.
+ *     Given fewer than CATCHUP_SESSIONS_SHARDED sessions, that cursor
+ *     reads the backlog too, from Start on: the query per shard and the
+ *     two for the ends of the log cost a session more than they save.
+ */
+class ShardedCatchUp {
+public:
+	ShardedCatchUp(EVENT_SESSION **sessions, DWORD count, DWORD shardRecords = CATCHUP_SHARD_RECORDS);
+	~ShardedCatchUp();
+
+	BOOL Start(LPCWSTR logName, const EventFilter *filter, INT outputFormat, INT mode, INT debug);
+	DWORD Read(DWORD maxEvents, OutputSink *sink, INT debug);
+	void Close();
+
+	DWORD64 LastRecordId() const { return lastRecordId; }
+	DWORD Status() const { return status; }
+	DWORD Shards() const { return shardCount; }
+	DWORD64 Queries() const;
+	size_t MostHeld() const { return mostHeld; }
+
+private:
+	ShardedCatchUp(const ShardedCatchUp &);
+	ShardedCatchUp &operator=(const ShardedCatchUp &);
+
+	// The records of one shard, each followed by a null character, until
+	// Read has written them all. passed is the last record read or passed
+	// over by the filter
+	struct SHARD {
+		DWORD64 first;
+		DWORD64 last;
+		std::vector<WCHAR> text;
+		std::vector<size_t> ends;
+		std::vector<DWORD64> recordIds;
+		DWORD64 passed;
+		size_t written;
+		DWORD status;
+		BOOL done;
+	};
+
+	BOOL FindBounds(DWORD64 *oldest, DWORD64 *newest, INT debug);
+	DWORD64 EndRecord(EVENT_SESSION *session, DWORD flags, INT debug);
+	void Work(EVENT_SESSION *session);
+	void ReadShard(EVENT_SESSION *session, SHARD *shard);
+	DWORD ReadTail(DWORD maxEvents, OutputSink *sink, INT debug);
+
+	std::vector<EVENT_SESSION *> sessions;
+	DWORD shardRecords;
+	std::wstring logName;
+	EventFilter filter;
+	INT outputFormat;
+	INT mode;
+	INT debug;
+	DWORD64 firstRecord;
+	DWORD64 lastRecord;
+	BOOL started;
+	BOOL failed;
+	DWORD64 lastRecordId;
+	DWORD status;
+
+	// Shards are numbered from firstRecord. Workers take them in order;
+	// those not yet written are kept in shards
+	DWORD shardCount;
+	DWORD claimed;
+	DWORD merging;
+	std::map<DWORD, SHARD *> shards;
+	size_t held;
+	size_t mostHeld;
+	DWORD64 queries;
+	std::atomic<bool> stopping;
+	std::mutex lock;
+	std::condition_variable changed;
+	std::vector<std::thread> workers;
+
+	// Reads on past the backlog once it has been written
+	EventCursor *tail;
+};
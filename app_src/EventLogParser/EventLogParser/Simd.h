@@ -0,0 +1,57 @@
+#pragma once
+
+#include "Platform.h"
+
+// x86 vector support shared by the SIMD text routines (JsonEscape.cpp,
+// Utf8Encode.cpp). SSE2 is part of x64; AVX2 code is compiled in
+// regardless and only run when CpuHasAvx2 says so. Elsewhere PARSER_SIMD
+// is not defined and the scalar routines are used
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PARSER_SIMD
+#include <immintrin.h>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#define PARSER_TARGET_AVX2
+#else
+#define PARSER_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+static inline DWORD CountTrailingZeros(DWORD mask)
+{
+#ifdef _MSC_VER
+	unsigned long index;
+	_BitScanForward(&index, mask);
+	return index;
+#else
+	return __builtin_ctz(mask);
+#endif
+}
+
+
+static inline BOOL CpuHasAvx2()
+{
+#ifdef _MSC_VER
+	int info[4];
+
+	// AVX2 needs the OS to save YMM registers (OSXSAVE, then XCR0 bits 1-2)
+	__cpuid(info, 0);
+	if( info[0] < 7 )
+		return FALSE;
+
+	__cpuid(info, 1);
+	if( (info[2] & (1 << 27)) == 0 || (info[2] & (1 << 28)) == 0 )
+		return FALSE;
+
+	if( (_xgetbv(0) & 6) != 6 )
+		return FALSE;
+
+	__cpuidex(info, 7, 0);
+
+	return (info[1] & (1 << 5)) != 0;
+#else
+	return __builtin_cpu_supports("avx2") ? TRUE : FALSE;
+#endif
+}
+
+#endif
@@ -0,0 +1,196 @@
+#include "SourceRecord.h"
+
+/****
+ * RenderRecordValues
+ *
+ * DESC:
+ *     Lays out a record's System properties the way EvtRender does for a
+ *     system render context: an EVT_VARIANT per EVT_SYSTEM_PROPERTY_ID,
+ *     followed by the strings they point at, all in the caller's buffer
+ *
+ * ARGS:
+ *     record - The record to render
+ *     bufferSize - size of buffer in bytes
+ *     buffer - receives the values
+ *     bufferUsed - receives the number of bytes used (or needed)
+ *     propertyCount - receives the number of values
+ *
+ * RETURNS:
+ *     TRUE on success. FALSE with ERROR_INSUFFICIENT_BUFFER if the buffer
+ *     is too small
+ */
+BOOL RenderRecordValues(const SOURCE_RECORD *record, DWORD bufferSize, PVOID buffer, DWORD *bufferUsed, DWORD *propertyCount)
+{
+	LPCWSTR strings[] = { record->provider, record->channel, record->computer };
+	size_t lengths[3];
+	DWORD needed = EvtSystemPropertyIdEND * sizeof(EVT_VARIANT);
+
+	for( int i = 0; i < 3; i++ ) {
+		lengths[i] = wcslen(strings[i]) + 1;
+		needed += (DWORD)(lengths[i] * sizeof(WCHAR));
+	}
+
+	*bufferUsed = needed;
+	*propertyCount = EvtSystemPropertyIdEND;
+
+	if( buffer == NULL || bufferSize < needed ) {
+		SetLastError(ERROR_INSUFFICIENT_BUFFER);
+		return FALSE;
+	}
+
+	PEVT_VARIANT values = (PEVT_VARIANT)buffer;
+
+	memset(values, 0, EvtSystemPropertyIdEND * sizeof(EVT_VARIANT));
+	for( DWORD i = 0; i < EvtSystemPropertyIdEND; i++ )
+		values[i].Type = EvtVarTypeNull;
+
+	// Strings follow the array, as they do with EvtRender
+	LPWSTR text = (LPWSTR)(values + EvtSystemPropertyIdEND);
+	EVT_SYSTEM_PROPERTY_ID ids[] = { EvtSystemProviderName, EvtSystemChannel, EvtSystemComputer };
+
+	for( int i = 0; i < 3; i++ ) {
+		memcpy(text, strings[i], lengths[i] * sizeof(WCHAR));
+		values[ids[i]].StringVal = text;
+		values[ids[i]].Type = EvtVarTypeString;
+		text += lengths[i];
+	}
+
+	values[EvtSystemEventID].UInt16Val = (UINT16)record->eventId;
+	values[EvtSystemEventID].Type = EvtVarTypeUInt16;
+	values[EvtSystemTask].UInt16Val = (UINT16)record->task;
+	values[EvtSystemTask].Type = EvtVarTypeUInt16;
+	values[EvtSystemLevel].ByteVal = (UINT8)record->level;
+	values[EvtSystemLevel].Type = EvtVarTypeByte;
+	values[EvtSystemVersion].ByteVal = (UINT8)record->version;
+	values[EvtSystemVersion].Type = EvtVarTypeByte;
+	values[EvtSystemTimeCreated].FileTimeVal = record->timeCreated;
+	values[EvtSystemTimeCreated].Type = EvtVarTypeFileTime;
+	values[EvtSystemEventRecordId].UInt64Val = record->recordId;
+	values[EvtSystemEventRecordId].Type = EvtVarTypeUInt64;
+
+	return TRUE;
+}
+
+
+/****
+ * RenderUserValues
+ *
+ * DESC:
+ *     Lays out an event's own values the way EvtRender does for a user
+ *     render context: one EVT_VARIANT per value, in EventData order,
+ *     followed by the strings they point at
+ *
+ * ARGS:
+ *     user - the values (strings may point anywhere; they are copied)
+ *     count - number of values
+ *     bufferSize - size of buffer in bytes
+ *     buffer - receives the values
+ *     bufferUsed - receives the number of bytes used (or needed)
+ *     propertyCount - receives the number of values
+ *
+ * RETURNS:
+ *     TRUE on success. FALSE with ERROR_INSUFFICIENT_BUFFER if the buffer
+ *     is too small
+ */
+BOOL RenderUserValues(const EVT_VARIANT *user, DWORD count, DWORD bufferSize, PVOID buffer, DWORD *bufferUsed, DWORD *propertyCount)
+{
+	DWORD needed = count * sizeof(EVT_VARIANT);
+
+	for( DWORD i = 0; i < count; i++ ) {
+		if( user[i].Type == EvtVarTypeString )
+			needed += (DWORD)((wcslen(user[i].StringVal) + 1) * sizeof(WCHAR));
+	}
+
+	*bufferUsed = needed;
+	*propertyCount = count;
+
+	if( buffer == NULL || bufferSize < needed ) {
+		SetLastError(ERROR_INSUFFICIENT_BUFFER);
+		return FALSE;
+	}
+
+	PEVT_VARIANT values = (PEVT_VARIANT)buffer;
+	LPWSTR text = (LPWSTR)(values + count);
+
+	memcpy(values, user, count * sizeof(EVT_VARIANT));
+
+	for( DWORD i = 0; i < count; i++ ) {
+		if( user[i].Type != EvtVarTypeString )
+			continue;
+
+		size_t length = wcslen(user[i].StringVal) + 1;
+
+		memcpy(text, user[i].StringVal, length * sizeof(WCHAR));
+		values[i].StringVal = text;
+		text += length;
+	}
+
+	return TRUE;
+}
+
+
+/****
+ * CopyRenderedText
+ *
+ * DESC:
+ *     Copies rendered XML out the way EvtRender does
+ *
+ * ARGS:
+ *     text - the text to copy
+ *     length - its length in characters, not counting the terminator
+ *     bufferSize - size of buffer in bytes
+ *     buffer - receives the text
+ *     bufferUsed - receives the number of bytes used (or needed)
+ *
+ * RETURNS:
+ *     TRUE on success. FALSE with ERROR_INSUFFICIENT_BUFFER if the buffer
+ *     is too small
+ */
+BOOL CopyRenderedText(LPCWSTR text, size_t length, DWORD bufferSize, PVOID buffer, DWORD *bufferUsed)
+{
+	DWORD needed = (DWORD)((length + 1) * sizeof(WCHAR));
+
+	*bufferUsed = needed;
+
+	if( buffer == NULL || bufferSize < needed ) {
+		SetLastError(ERROR_INSUFFICIENT_BUFFER);
+		return FALSE;
+	}
+
+	memcpy(buffer, text, needed);
+
+	return TRUE;
+}
+
+
+/****
+ * CopyMessageText
+ *
+ * DESC:
+ *     Copies a message out the way EvtFormatMessage does, where sizes are
+ *     counted in characters rather than bytes
+ *
+ * ARGS:
+ *     text - the message
+ *     length - its length in characters, not counting the terminator
+ *     bufferSize - size of buffer in characters
+ *     buffer - receives the message
+ *     bufferUsed - receives the number of characters used (or needed)
+ *
+ * RETURNS:
+ *     TRUE on success. FALSE with ERROR_INSUFFICIENT_BUFFER if the buffer
+ *     is too small
+ */
+BOOL CopyMessageText(LPCWSTR text, size_t length, DWORD bufferSize, LPWSTR buffer, DWORD *bufferUsed)
+{
+	*bufferUsed = (DWORD)(length + 1);
+
+	if( buffer == NULL || bufferSize < length + 1 ) {
+		SetLastError(ERROR_INSUFFICIENT_BUFFER);
+		return FALSE;
+	}
+
+	memcpy(buffer, text, (length + 1) * sizeof(WCHAR));
+
+	return TRUE;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include "Platform.h"
+
+/****
+ * SOURCE_RECORD
+ *
+ * DESC:
+ *     The System properties of one event, as held by the non-Windows
+ *     event sources. Strings belong to the source
+ */
+struct SOURCE_RECORD {
+	LPCWSTR provider;
+	LPCWSTR channel;
+	LPCWSTR computer;
+	DWORD eventId;
+	DWORD task;
+	DWORD level;
+	DWORD version;
+	ULONGLONG timeCreated;
+	DWORD64 recordId;
+};
+
+BOOL RenderRecordValues(const SOURCE_RECORD*, DWORD, PVOID, DWORD*, DWORD*);
+BOOL RenderUserValues(const EVT_VARIANT*, DWORD, DWORD, PVOID, DWORD*, DWORD*);
+BOOL CopyRenderedText(LPCWSTR, size_t, DWORD, PVOID, DWORD*);
+BOOL CopyMessageText(LPCWSTR, size_t, DWORD, LPWSTR, DWORD*);
@@ -0,0 +1,425 @@
+#include "SyntheticSource.h"
+#include "SystemFields.h"
+#include <stdio.h>
+
+// FILETIME of the first synthetic event (2014-03-07T18:22:10Z)
+#define SYNTHETIC_EPOCH 130386313300000000ULL
+
+struct SYNTHETIC_PROVIDER {
+	LPCWSTR name;
+	LPCWSTR channel;
+	BOOL hasMetadata;
+	DWORD eventId;
+	DWORD version;
+	DWORD task;
+	DWORD level;
+	DWORD weight;
+	LPCWSTR message;
+};
+
+// Every event has the same EventData (see SYNTHETIC_DATA), and message
+// templates insert it as %1..%7. MsiInstaller logs 11707 in two versions,
+// each with its own message
+static const SYNTHETIC_PROVIDER PROVIDERS[] = {
+	{ L"Microsoft-Windows-Security-Auditing", L"Security", TRUE, 4624, 0, 12544, 0, 6,
+		L"An account was successfully logged on.\r\n\r\nSubject:\r\n\tSecurity ID:\t\t%1\r\n\tAccount Name:\t\t%6$\r\n\tAccount Domain:\t\tCORP\r\n\tLogon ID:\t\t0x3E7\r\n\r\n"
+		L"Logon Type:\t\t\t3\r\n\r\nNew Logon:\r\n\tSecurity ID:\t\tS-1-5-21-3623811015-3361044348-30300820-%7\r\n\tAccount Name:\t\t%2\r\n\tAccount Domain:\t\tCORP\r\n\tLogon ID:\t\t%3\r\n\r\n"
+		L"Process Information:\r\n\tProcess Name:\t\t%5\r\n\r\nNetwork Information:\r\n\tWorkstation Name:\t\"WS-01\"\r\n\tSource Network Address:\t%4\r\n\tSource Port:\t\t49152" },
+	{ L"Microsoft-Windows-Security-Auditing", L"Security", TRUE, 4634, 0, 12545, 0, 4,
+		L"An account was logged off.\r\n\r\nSubject:\r\n\tSecurity ID:\t\tS-1-5-21-3623811015-3361044348-30300820-%7\r\n\tAccount Name:\t\t%2\r\n\tAccount Domain:\t\tCORP\r\n\tLogon ID:\t\t%3\r\n\r\nLogon Type:\t\t\t3" },
+	{ L"Microsoft-Windows-Security-Auditing", L"Security", TRUE, 4688, 0, 13312, 0, 3,
+		L"A new process has been created.\r\n\r\nSubject:\r\n\tAccount Name:\t\t%2\r\n\tAccount Domain:\t\tCORP\r\n\r\nProcess Information:\r\n\tNew Process ID:\t\t%7\r\n"
+		L"\tNew Process Name:\tC:\\Program Files\\Contoso\\agent.exe\r\n\tCommand Line:\t\t\"C:\\Program Files\\Contoso\\agent.exe\" --session %3" },
+	{ L"Service Control Manager", L"System", TRUE, 7036, 0, 0, 4, 3,
+		L"The Windows Update service entered the running state. (%2 on %6, pass %7, id %3)" },
+	{ L"Microsoft-Windows-DNS-Client", L"System", TRUE, 1014, 0, 1014, 3, 1,
+		L"Name resolution for the name %2.corp.example.com timed out after none of the configured DNS servers responded. (%6, %7, %3)" },
+	{ L"Microsoft-Windows-Kernel-General", L"System", TRUE, 12, 0, 0, 4, 1,
+		L"The operating system started at system time \u200E2014\u200E-\u200E03\u200E-\u200E07T18:22:10 on %2 (%6, boot %7, %3)." },
+	{ L"Application Error", L"Application", TRUE, 1000, 0, 100, 2, 1,
+		L"Faulting application name: agent.exe (%2 on %6), version: 2.1.%7.0\r\nFaulting module path: C:\\Windows\\SYSTEM32\\ntdll.dll\r\nReport Id: %3" },
+	{ L"MsiInstaller", L"Application", TRUE, 11707, 0, 0, 4, 1,
+		L"Product: \"Contoso Agent\" -- Installation completed successfully. (%2, %6, build %7, %3)" },
+	{ L"MsiInstaller", L"Application", TRUE, 11707, 1, 0, 4, 1,
+		L"Product: \"Contoso Agent\" -- Installation completed successfully by %2 on %6. (build %7, %3)" },
+	{ L"VSS", L"Application", FALSE, 8224, 0, 0, 4, 1, NULL },
+	{ L"Contoso-LegacyAgent", L"Application", FALSE, 3001, 0, 2, 3, 1, NULL },
+};
+
+#define PROVIDER_COUNT (sizeof(PROVIDERS) / sizeof(PROVIDERS[0]))
+
+static LPCWSTR COMPUTERS[] = { L"DC01.corp.example.com", L"WS-01.corp.example.com", L"FS02.corp.example.com", L"WS-M\u00dcLLER.corp.example.com" };
+static LPCWSTR USERS[] = { L"alice", L"bob", L"carol.o'brien", L"svc_backup", L"J\u00fcrgen" };
+
+// Names of the EventData every synthetic event has, in order
+#define SYNTHETIC_DATA_COUNT 7
+
+static LPCWSTR DATA_NAMES[SYNTHETIC_DATA_COUNT] = {
+	L"SubjectUserSid", L"TargetUserName", L"TargetLogonId", L"IpAddress", L"ProcessName", L"WorkstationName", L"Sequence"
+};
+
+
+/****
+ * DescribeData
+ *
+ * DESC:
+ *     Works out the EventData of a record, as the typed values a user
+ *     render context returns
+ *
+ * ARGS:
+ *     record - the record (see SyntheticSource::Describe)
+ *     values - receives SYNTHETIC_DATA_COUNT values
+ *     address - receives the text of the IpAddress value (16 characters)
+ */
+static void DescribeData(const SOURCE_RECORD *record, EVT_VARIANT *values, LPWSTR address)
+{
+	swprintf(address, 16, L"10.%u.%u.%u", (DWORD)(record->recordId >> 16) & 0xFF, (DWORD)(record->recordId >> 8) & 0xFF, (DWORD)record->recordId & 0xFF);
+
+	LPCWSTR strings[SYNTHETIC_DATA_COUNT] = {
+		L"S-1-5-18", USERS[record->recordId % 5], NULL, address, L"C:\\Windows\\System32\\lsass.exe", record->computer, NULL
+	};
+
+	for( DWORD i = 0; i < SYNTHETIC_DATA_COUNT; i++ ) {
+		values[i].StringVal = strings[i];
+		values[i].Count = 0;
+		values[i].Type = EvtVarTypeString;
+	}
+
+	values[2].UInt64Val = record->recordId * 40503 + 0x3E7;
+	values[2].Type = EvtVarTypeHexInt64;
+
+	// A number whose meaning depends on the event: the RID of the user's
+	// SID, a process ID or a counter
+	switch( record->eventId ) {
+	case 4624:
+	case 4634:
+		values[6].UInt32Val = (DWORD)(1000 + record->recordId % 500);
+		break;
+	case 4688:
+		values[6].UInt32Val = (DWORD)(record->recordId % 65536) * 4;
+		break;
+	default:
+		values[6].UInt32Val = (DWORD)(record->recordId % 1000);
+		break;
+	}
+	values[6].Type = EvtVarTypeUInt32;
+}
+
+
+/****
+ * FormatDataValue
+ *
+ * DESC:
+ *     Writes one value of DescribeData as text: the way the event XML has
+ *     it, or the way EvtFormatMessage inserts it (hex in upper case)
+ *
+ * RETURNS:
+ *     The number of characters written
+ */
+static int FormatDataValue(const EVT_VARIANT *value, BOOL message, LPWSTR out, size_t size)
+{
+	switch( value->Type ) {
+	case EvtVarTypeHexInt64:
+		return swprintf(out, size, message ? L"0x%llX" : L"0x%llx", (unsigned long long)value->UInt64Val);
+	case EvtVarTypeUInt32:
+		return swprintf(out, size, L"%u", value->UInt32Val);
+	default:
+		return swprintf(out, size, L"%ls", value->StringVal);
+	}
+}
+
+
+/****
+ * SyntheticSource::SyntheticSource
+ *
+ * ARGS:
+ *     count - number of events each query returns (record IDs 1 to count)
+ */
+SyntheticSource::SyntheticSource(DWORD64 count)
+	: count(count)
+{
+	renderContext.kind = SOURCE_OBJECT_RENDER_CONTEXT;
+	userContext.kind = SOURCE_OBJECT_RENDER_CONTEXT;
+
+	publishers = new SOURCE_OBJECT[PROVIDER_COUNT];
+	for( DWORD i = 0; i < PROVIDER_COUNT; i++ )
+		publishers[i].kind = SOURCE_OBJECT_PUBLISHER;
+}
+
+
+SyntheticSource::~SyntheticSource()
+{
+	delete [] publishers;
+}
+
+
+DWORD SyntheticSource::ProviderCount() const
+{
+	return PROVIDER_COUNT;
+}
+
+
+/****
+ * SyntheticSource::Append
+ *
+ * DESC:
+ *     Writes more events to the log. Only queries opened afterwards see
+ *     them, as only those count them
+ *
+ * ARGS:
+ *     events - number of events to add (they take the next record IDs)
+ */
+void SyntheticSource::Append(DWORD64 events)
+{
+	count += events;
+}
+
+
+/****
+ * SyntheticSource::Describe
+ *
+ * DESC:
+ *     Works out the System properties of a record from its ID alone
+ *
+ * ARGS:
+ *     recordId - the record
+ *     record - receives the properties
+ *     provider - receives the index into the provider table
+ */
+void SyntheticSource::Describe(DWORD64 recordId, SOURCE_RECORD *record, DWORD *provider) const
+{
+	// Weighted pick of the provider, scrambled so neighbours differ
+	DWORD totalWeight = 0;
+
+	for( DWORD i = 0; i < PROVIDER_COUNT; i++ )
+		totalWeight += PROVIDERS[i].weight;
+
+	DWORD pick = (DWORD)((recordId * 2654435761ULL) >> 7) % totalWeight;
+	DWORD index = 0;
+
+	while( pick >= PROVIDERS[index].weight ) {
+		pick -= PROVIDERS[index].weight;
+		index++;
+	}
+
+	*provider = index;
+
+	record->provider = PROVIDERS[index].name;
+	record->channel = PROVIDERS[index].channel;
+	record->computer = COMPUTERS[recordId % 4];
+	record->eventId = PROVIDERS[index].eventId;
+	record->task = PROVIDERS[index].task;
+	record->level = PROVIDERS[index].level;
+	record->version = PROVIDERS[index].version;
+	record->recordId = recordId;
+
+	// Roughly 1.5 events a second, with sub-second jitter
+	record->timeCreated = SYNTHETIC_EPOCH + recordId * 15000000ULL + (recordId * 7919) % 10000000ULL;
+}
+
+
+EVT_HANDLE SyntheticSource::Query(LPCWSTR /*logName*/, LPCWSTR /*query*/, DWORD flags)
+{
+	QUERY *results = new QUERY();
+
+	results->kind = SOURCE_OBJECT_QUERY;
+	results->forward = (flags & EvtQueryForwardDirection) ? TRUE : FALSE;
+	results->next = results->forward ? 1 : count;
+	results->remaining = count;
+
+	return results;
+}
+
+
+BOOL SyntheticSource::Next(EVT_HANDLE hResults, DWORD count, EVT_HANDLE *events, DWORD /*timeout*/, DWORD *returned)
+{
+	QUERY *results = (QUERY *)hResults;
+
+	*returned = 0;
+
+	if( results == NULL || IsEventHandle(hResults) || results->kind != SOURCE_OBJECT_QUERY ) {
+		SetLastError(ERROR_INVALID_HANDLE);
+		return FALSE;
+	}
+
+	if( results->remaining == 0 ) {
+		SetLastError(ERROR_NO_MORE_ITEMS);
+		return FALSE;
+	}
+
+	while( *returned < count && results->remaining > 0 ) {
+		events[(*returned)++] = EventHandle(results->next);
+		results->next = results->forward ? results->next + 1 : results->next - 1;
+		results->remaining--;
+	}
+
+	return TRUE;
+}
+
+
+BOOL SyntheticSource::Render(EVT_HANDLE hContext, EVT_HANDLE hEvent, DWORD flags, DWORD bufferSize, PVOID buffer, DWORD *bufferUsed, DWORD *propertyCount)
+{
+	if( !IsEventHandle(hEvent) ) {
+		SetLastError(ERROR_INVALID_HANDLE);
+		return FALSE;
+	}
+
+	SOURCE_RECORD record;
+	DWORD provider;
+	EVT_VARIANT data[SYNTHETIC_DATA_COUNT];
+	WCHAR address[16];
+
+	Describe(RecordId(hEvent), &record, &provider);
+
+	if( flags == EvtRenderEventValues && hContext == &renderContext )
+		return RenderRecordValues(&record, bufferSize, buffer, bufferUsed, propertyCount);
+
+	DescribeData(&record, data, address);
+
+	if( flags == EvtRenderEventValues && hContext == &userContext )
+		return RenderUserValues(data, SYNTHETIC_DATA_COUNT, bufferSize, buffer, bufferUsed, propertyCount);
+
+	if( flags != EvtRenderEventXml ) {
+		SetLastError(ERROR_INVALID_PARAMETER);
+		return FALSE;
+	}
+
+	WCHAR systemTime[32];
+	FormatSystemTime(record.timeCreated, systemTime);
+
+	int length = swprintf(text, SYNTHETIC_TEXT_SIZE,
+		L"<Event xmlns='http://schemas.microsoft.com/win/2004/08/events/event'><System>"
+		L"<Provider Name='%ls' Guid='{54849625-5478-4994-A5BA-3E3B0328C30D}'/><EventID>%u</EventID><Version>%u</Version>"
+		L"<Level>%u</Level><Task>%u</Task><Opcode>0</Opcode><Keywords>0x8020000000000000</Keywords>"
+		L"<TimeCreated SystemTime='%ls'/><EventRecordID>%llu</EventRecordID><Correlation/>"
+		L"<Execution ProcessID='%u' ThreadID='%u'/><Channel>%ls</Channel><Computer>%ls</Computer><Security/></System>"
+		L"<EventData>",
+		record.provider, record.eventId, record.version, record.level, record.task, systemTime, (unsigned long long)record.recordId,
+		(DWORD)(record.recordId % 4096) * 4, (DWORD)(record.recordId % 8192) * 4, record.channel, record.computer);
+
+	for( DWORD i = 0; i < SYNTHETIC_DATA_COUNT; i++ ) {
+		length += swprintf(text + length, SYNTHETIC_TEXT_SIZE - length, L"<Data Name='%ls'>", DATA_NAMES[i]);
+		length += FormatDataValue(&data[i], FALSE, text + length, SYNTHETIC_TEXT_SIZE - length);
+		length += swprintf(text + length, SYNTHETIC_TEXT_SIZE - length, L"</Data>");
+	}
+
+	length += swprintf(text + length, SYNTHETIC_TEXT_SIZE - length, L"</EventData></Event>");
+
+	*propertyCount = 0;
+
+	return CopyRenderedText(text, length, bufferSize, buffer, bufferUsed);
+}
+
+
+EVT_HANDLE SyntheticSource::CreateRenderContext(DWORD flags)
+{
+	if( flags == EvtRenderContextSystem )
+		return &renderContext;
+
+	if( flags == EvtRenderContextUser )
+		return &userContext;
+
+	SetLastError(ERROR_INVALID_PARAMETER);
+	return NULL;
+}
+
+
+EVT_HANDLE SyntheticSource::OpenPublisherMetadata(LPCWSTR publisherName)
+{
+	for( DWORD i = 0; i < PROVIDER_COUNT; i++ ) {
+		if( PROVIDERS[i].hasMetadata && wcscmp(PROVIDERS[i].name, publisherName) == 0 )
+			return &publishers[i];
+	}
+
+	SetLastError(ERROR_EVT_PUBLISHER_METADATA_NOT_FOUND);
+	return NULL;
+}
+
+
+/****
+ * SyntheticSource::FormatEventMessage
+ *
+ * DESC:
+ *     Fills the event's message template in with its EventData, the way
+ *     EvtFormatMessage does on the machine that logged it
+ */
+BOOL SyntheticSource::FormatEventMessage(EVT_HANDLE hMetadata, EVT_HANDLE hEvent, DWORD bufferSize, LPWSTR buffer, DWORD *bufferUsed)
+{
+	if( hMetadata == NULL || !IsEventHandle(hEvent) ) {
+		SetLastError(ERROR_INVALID_HANDLE);
+		return FALSE;
+	}
+
+	SOURCE_RECORD record;
+	DWORD provider;
+	EVT_VARIANT data[SYNTHETIC_DATA_COUNT];
+	WCHAR address[16];
+
+	Describe(RecordId(hEvent), &record, &provider);
+
+	if( PROVIDERS[provider].message == NULL ) {
+		SetLastError(ERROR_EVT_MESSAGE_NOT_FOUND);
+		return FALSE;
+	}
+
+	DescribeData(&record, data, address);
+
+	// Templates only hold single-digit inserts
+	LPCWSTR in = PROVIDERS[provider].message;
+	int length = 0;
+
+	for( ; *in != L'\0' && length < SYNTHETIC_TEXT_SIZE - 1; in++ ) {
+		if( in[0] == L'%' && in[1] >= L'1' && in[1] < L'1' + SYNTHETIC_DATA_COUNT ) {
+			length += FormatDataValue(&data[in[1] - L'1'], TRUE, text + length, SYNTHETIC_TEXT_SIZE - length);
+			in++;
+		} else {
+			text[length++] = *in;
+		}
+	}
+	text[length] = L'\0';
+
+	return CopyMessageText(text, length, bufferSize, buffer, bufferUsed);
+}
+
+
+/****
+ * SyntheticSource::GetMessageTemplate
+ *
+ * DESC:
+ *     Looks the template up among the rows of the provider the metadata
+ *     handle was opened for
+ */
+BOOL SyntheticSource::GetMessageTemplate(EVT_HANDLE hMetadata, DWORD eventId, DWORD version, DWORD bufferSize, LPWSTR buffer, DWORD *bufferUsed)
+{
+	SOURCE_OBJECT *publisher = (SOURCE_OBJECT *)hMetadata;
+
+	if( publisher < publishers || publisher >= publishers + PROVIDER_COUNT ) {
+		SetLastError(ERROR_INVALID_HANDLE);
+		return FALSE;
+	}
+
+	LPCWSTR name = PROVIDERS[publisher - publishers].name;
+
+	for( DWORD i = 0; i < PROVIDER_COUNT; i++ ) {
+		if( PROVIDERS[i].message != NULL && PROVIDERS[i].eventId == eventId && PROVIDERS[i].version == version && wcscmp(PROVIDERS[i].name, name) == 0 )
+			return CopyMessageText(PROVIDERS[i].message, wcslen(PROVIDERS[i].message), bufferSize, buffer, bufferUsed);
+	}
+
+	SetLastError(ERROR_EVT_MESSAGE_NOT_FOUND);
+	return FALSE;
+}
+
+
+BOOL SyntheticSource::Close(EVT_HANDLE hObject)
+{
+	if( hObject == NULL ) {
+		SetLastError(ERROR_INVALID_HANDLE);
+		return FALSE;
+	}
+
+	// Events are record numbers; publishers and the render context live as long as the source
+	if( !IsEventHandle(hObject) && ((SOURCE_OBJECT *)hObject)->kind == SOURCE_OBJECT_QUERY )
+		delete (QUERY *)hObject;
+
+	return TRUE;
+}
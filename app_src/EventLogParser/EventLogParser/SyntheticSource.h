@@ -0,0 +1,72 @@
+#pragma once
+
+#include "Platform.h"
+#include "EventSource.h"
+#include "SourceRecord.h"
+
+// Size of the scratch buffers a synthetic event is generated into
+#define SYNTHETIC_TEXT_SIZE 8192
+
+/****
+ * SyntheticSource
+ *
+ * DESC:
+ *     Event source that makes up a fixed number of events on the fly.
+ *     Record N always renders the same way, so runs are repeatable and a
+ *     corpus of any size costs no memory
+ *
+ * REMARKS:
+ *     Events come from a small table of providers covering the Security,
+ *     System and Application logs. Some providers have no metadata (as
+ *     with software that has been uninstalled), and the messages carry
+ *     the tabs, line breaks, quotes and backslashes found in real ones.
+ *     Every event has the same EventData fields, which its provider's
+ *     message template inserts; both render contexts are supported.
+ *
+ *     Every query returns all events regardless of the channel or XPath
+ *     asked for; each event reports the channel of its provider. Append
+ *     grows the log, for queries opened after it.
+ *
+ *     Event handles are tagged record numbers rather than pointers, so
+ *     handing them out does not allocate and Close has nothing to free.
+ */
+class SyntheticSource : public EventSource {
+public:
+	SyntheticSource(DWORD64 count);
+	~SyntheticSource();
+
+	EVT_HANDLE Query(LPCWSTR logName, LPCWSTR query, DWORD flags);
+	BOOL Next(EVT_HANDLE hResults, DWORD count, EVT_HANDLE *events, DWORD timeout, DWORD *returned);
+	BOOL Render(EVT_HANDLE hContext, EVT_HANDLE hEvent, DWORD flags, DWORD bufferSize, PVOID buffer, DWORD *bufferUsed, DWORD *propertyCount);
+	EVT_HANDLE CreateRenderContext(DWORD flags);
+	EVT_HANDLE OpenPublisherMetadata(LPCWSTR publisherName);
+	BOOL FormatEventMessage(EVT_HANDLE hMetadata, EVT_HANDLE hEvent, DWORD bufferSize, LPWSTR buffer, DWORD *bufferUsed);
+	BOOL GetMessageTemplate(EVT_HANDLE hMetadata, DWORD eventId, DWORD version, DWORD bufferSize, LPWSTR buffer, DWORD *bufferUsed);
+	BOOL Close(EVT_HANDLE hObject);
+
+	static EVT_HANDLE EventHandle(DWORD64 recordId) { return (EVT_HANDLE)(size_t)((recordId << 1) | 1); }
+	static DWORD64 RecordId(EVT_HANDLE hEvent) { return (DWORD64)(size_t)hEvent >> 1; }
+	static BOOL IsEventHandle(EVT_HANDLE hObject) { return ((size_t)hObject & 1) != 0; }
+
+	DWORD ProviderCount() const;
+	void Append(DWORD64 events);
+
+private:
+	struct QUERY : SOURCE_OBJECT {
+		DWORD64 next;
+		DWORD64 remaining;
+		BOOL forward;
+	};
+
+	SyntheticSource(const SyntheticSource &);
+	SyntheticSource &operator=(const SyntheticSource &);
+
+	void Describe(DWORD64 recordId, SOURCE_RECORD *record, DWORD *provider) const;
+
+	DWORD64 count;
+	SOURCE_OBJECT renderContext;
+	SOURCE_OBJECT userContext;
+	SOURCE_OBJECT *publishers;
+
+	WCHAR text[SYNTHETIC_TEXT_SIZE];
+};
@@ -0,0 +1,544 @@
+#include "ParserCore.h"
+#include <string.h>
+#include <wctype.h>
+
+static LPCWSTR EMPTY_FIELD = L"";
+
+/****
+ * RenderSystemFields
+ *
+ * DESC:
+ *     Reads the System fields of an event as typed values, without
+ *     rendering or parsing any XML
+ *
+ * ARGS:
+ *     render - Session render context (owns the system render context
+ *              and the values buffer)
+ *     hEvent - Handle to open event
+ *     fields - Receives the field strings
+ *     wanted - RECORD_FIELD_* flags of the fields to fill in
+ *
+ * RETURNS:
+ *     TRUE on success, FALSE otherwise (see GetLastError)
+ *
+ * REMARKS:
+ *     Missing values come back as empty strings (and a record ID of 0),
+ *     as do the fields that are not wanted. Those are not turned into
+ *     text, which for TimeCreated is most of the work
+ */
+BOOL RenderSystemFields(RenderContext *render, EVT_HANDLE hEvent, SYSTEM_FIELDS *fields, DWORD wanted)
+{
+	PEVT_VARIANT values = render->RenderSystemValues(hEvent);
+
+	if( values == NULL )
+		return FALSE;
+
+	fields->recordIdValue = values[EvtSystemEventRecordId].Type == EvtVarTypeNull ? 0 : values[EvtSystemEventRecordId].UInt64Val;
+	fields->recordId = !(wanted & RECORD_FIELD_RECORD_ID) ? EMPTY_FIELD : FormatUnsigned(fields->recordIdValue, fields->recordIdText);
+
+	fields->values = 0;
+
+	if( (wanted & RECORD_FIELD_EVENT_ID) && values[EvtSystemEventID].Type != EvtVarTypeNull ) {
+		fields->eventIdValue = values[EvtSystemEventID].UInt16Val;
+		fields->values |= RECORD_FIELD_EVENT_ID;
+	}
+
+	if( (wanted & RECORD_FIELD_TASK) && values[EvtSystemTask].Type != EvtVarTypeNull ) {
+		fields->taskValue = values[EvtSystemTask].UInt16Val;
+		fields->values |= RECORD_FIELD_TASK;
+	}
+
+	if( (wanted & RECORD_FIELD_LEVEL) && values[EvtSystemLevel].Type != EvtVarTypeNull ) {
+		fields->levelValue = values[EvtSystemLevel].ByteVal;
+		fields->values |= RECORD_FIELD_LEVEL;
+	}
+
+	if( (wanted & RECORD_FIELD_TIME_CREATED) && values[EvtSystemTimeCreated].Type != EvtVarTypeNull ) {
+		fields->timeCreatedValue = values[EvtSystemTimeCreated].FileTimeVal;
+		fields->values |= RECORD_FIELD_TIME_CREATED;
+	}
+
+	fields->eventId = !(wanted & RECORD_FIELD_EVENT_ID) || values[EvtSystemEventID].Type == EvtVarTypeNull ? EMPTY_FIELD : FormatUnsigned(values[EvtSystemEventID].UInt16Val, fields->eventIdText);
+	fields->task = !(wanted & RECORD_FIELD_TASK) || values[EvtSystemTask].Type == EvtVarTypeNull ? EMPTY_FIELD : FormatUnsigned(values[EvtSystemTask].UInt16Val, fields->taskText);
+	fields->level = !(wanted & RECORD_FIELD_LEVEL) || values[EvtSystemLevel].Type == EvtVarTypeNull ? EMPTY_FIELD : FormatUnsigned(values[EvtSystemLevel].ByteVal, fields->levelText);
+	fields->version = !(wanted & RECORD_FIELD_VERSION) || values[EvtSystemVersion].Type == EvtVarTypeNull ? EMPTY_FIELD : FormatUnsigned(values[EvtSystemVersion].ByteVal, fields->versionText);
+	fields->timeCreated = !(wanted & RECORD_FIELD_TIME_CREATED) || values[EvtSystemTimeCreated].Type == EvtVarTypeNull ? EMPTY_FIELD : FormatSystemTime(values[EvtSystemTimeCreated].FileTimeVal, fields->timeCreatedText);
+
+	fields->channel = !(wanted & RECORD_FIELD_LOGNAME) || values[EvtSystemChannel].Type == EvtVarTypeNull ? EMPTY_FIELD : values[EvtSystemChannel].StringVal;
+	fields->provider = !(wanted & RECORD_FIELD_SOURCE) || values[EvtSystemProviderName].Type == EvtVarTypeNull ? EMPTY_FIELD : values[EvtSystemProviderName].StringVal;
+	fields->computer = !(wanted & RECORD_FIELD_COMPUTER) || values[EvtSystemComputer].Type == EvtVarTypeNull ? EMPTY_FIELD : values[EvtSystemComputer].StringVal;
+
+	fields->eventData = NULL;
+	fields->identity = NULL;
+
+	return TRUE;
+}
+
+
+// The <System> children ExtractSystemFields keeps, in slot order
+#define SYSTEM_SLOT_NONE -1
+#define SYSTEM_SLOT_EVENT_ID 0
+#define SYSTEM_SLOT_CHANNEL 1
+#define SYSTEM_SLOT_RECORD_ID 2
+#define SYSTEM_SLOT_PROVIDER 3
+#define SYSTEM_SLOT_COMPUTER 4
+#define SYSTEM_SLOT_TIME_CREATED 5
+#define SYSTEM_SLOT_TASK 6
+#define SYSTEM_SLOT_LEVEL 7
+#define SYSTEM_SLOT_VERSION 8
+#define SYSTEM_SLOT_COUNT 9
+
+static const LPCWSTR systemSlotNames[SYSTEM_SLOT_COUNT] = {
+	L"EventID", L"Channel", L"EventRecordID", L"Provider",
+	L"Computer", L"TimeCreated", L"Task", L"Level", L"Version"
+};
+
+// The RECORD_FIELD_* flag of each slot
+static const DWORD systemSlotFields[SYSTEM_SLOT_COUNT] = {
+	RECORD_FIELD_EVENT_ID, RECORD_FIELD_LOGNAME, RECORD_FIELD_RECORD_ID, RECORD_FIELD_SOURCE,
+	RECORD_FIELD_COMPUTER, RECORD_FIELD_TIME_CREATED, RECORD_FIELD_TASK, RECORD_FIELD_LEVEL, RECORD_FIELD_VERSION
+};
+
+/****
+ * SystemSlot
+ *
+ * DESC:
+ *     Works out which slot a <System> child fills from the length and
+ *     first character of its name, then checks the rest of the name
+ *
+ * RETURNS:
+ *     The slot, or SYSTEM_SLOT_NONE for children we do not output
+ */
+static INT SystemSlot(const WCHAR *name, size_t length)
+{
+	INT slot = SYSTEM_SLOT_NONE;
+
+	switch( length )
+	{
+	case 4:
+		slot = name[0] == L'T' ? SYSTEM_SLOT_TASK : SYSTEM_SLOT_NONE;
+		break;
+	case 5:
+		slot = name[0] == L'L' ? SYSTEM_SLOT_LEVEL : SYSTEM_SLOT_NONE;
+		break;
+	case 7:
+		slot = name[0] == L'E' ? SYSTEM_SLOT_EVENT_ID : name[0] == L'C' ? SYSTEM_SLOT_CHANNEL : name[0] == L'V' ? SYSTEM_SLOT_VERSION : SYSTEM_SLOT_NONE;
+		break;
+	case 8:
+		slot = name[0] == L'P' ? SYSTEM_SLOT_PROVIDER : name[0] == L'C' ? SYSTEM_SLOT_COMPUTER : SYSTEM_SLOT_NONE;
+		break;
+	case 11:
+		slot = name[0] == L'T' ? SYSTEM_SLOT_TIME_CREATED : SYSTEM_SLOT_NONE;
+		break;
+	case 13:
+		slot = name[0] == L'E' ? SYSTEM_SLOT_RECORD_ID : SYSTEM_SLOT_NONE;
+		break;
+	}
+
+	// Opcode, Keywords, Security and the rest share some lengths
+	if( slot != SYSTEM_SLOT_NONE && memcmp(name, systemSlotNames[slot], length * sizeof(WCHAR)) != 0 )
+		return SYSTEM_SLOT_NONE;
+
+	return slot;
+}
+
+
+// The value of the attribute with the given name, or NULL
+static LPCWSTR AttributeValue(rapidxml::xml_node<WCHAR> *node, LPCWSTR name, size_t length)
+{
+	for( rapidxml::xml_attribute<WCHAR> *attribute = node->first_attribute(); attribute != NULL; attribute = attribute->next_attribute() )
+	{
+		if( attribute->name_size() == length && memcmp(attribute->name(), name, length * sizeof(WCHAR)) == 0 )
+			return attribute->value();
+	}
+
+	return NULL;
+}
+
+
+/****
+ * ExtractSystemFields
+ *
+ * DESC:
+ *     Reads the System fields out of an event that was rendered as XML
+ *
+ * ARGS:
+ *     doc - The parsed event
+ *     fields - Receives the field strings (pointing into the document)
+ *     wanted - RECORD_FIELD_* flags of the fields to fill in
+ *
+ * RETURNS:
+ *     TRUE on success, FALSE if there is no <Event><System> at all (with
+ *     ERROR_INVALID_DATA)
+ *
+ * REMARKS:
+ *     The children of <System> are walked once, each going to its slot
+ *     by SystemSlot; the first of each name wins, as with first_node.
+ *     The walk stops once every wanted slot is filled. Missing children
+ *     or attributes come back as empty strings, as on the values path,
+ *     and so do the fields that are not wanted
+ */
+BOOL ExtractSystemFields(rapidxml::xml_document<WCHAR> *doc, SYSTEM_FIELDS *fields, DWORD wanted)
+{
+	rapidxml::xml_node<WCHAR> *nodeEvent = doc->first_node(L"Event");
+	rapidxml::xml_node<WCHAR> *nodeSystem = nodeEvent != NULL ? nodeEvent->first_node(L"System") : NULL;
+
+	if( nodeSystem == NULL ) {
+		SetLastError(ERROR_INVALID_DATA);
+		return FALSE;
+	}
+
+	LPCWSTR *slots[SYSTEM_SLOT_COUNT] = {
+		&fields->eventId, &fields->channel, &fields->recordId, &fields->provider,
+		&fields->computer, &fields->timeCreated, &fields->task, &fields->level, &fields->version
+	};
+	DWORD filled = 0, count = 0;
+
+	for( INT slot = 0; slot < SYSTEM_SLOT_COUNT; slot++ ) {
+		*slots[slot] = NULL;
+
+		if( wanted & systemSlotFields[slot] )
+			count++;
+	}
+
+	for( rapidxml::xml_node<WCHAR> *node = nodeSystem->first_node(); node != NULL && filled < count; node = node->next_sibling() )
+	{
+		INT slot = SystemSlot(node->name(), node->name_size());
+
+		if( slot == SYSTEM_SLOT_NONE || *slots[slot] != NULL || !(wanted & systemSlotFields[slot]) )
+			continue;
+
+		// Provider and TimeCreated carry their field as an attribute
+		if( slot == SYSTEM_SLOT_PROVIDER )
+			*slots[slot] = AttributeValue(node, L"Name", 4);
+		else if( slot == SYSTEM_SLOT_TIME_CREATED )
+			*slots[slot] = AttributeValue(node, L"SystemTime", 10);
+		else
+			*slots[slot] = node->value();
+
+		if( *slots[slot] == NULL )
+			*slots[slot] = EMPTY_FIELD;
+
+		filled++;
+	}
+
+	for( INT slot = 0; slot < SYSTEM_SLOT_COUNT; slot++ ) {
+		if( *slots[slot] == NULL )
+			*slots[slot] = EMPTY_FIELD;
+	}
+
+	fields->recordIdValue = (wanted & RECORD_FIELD_RECORD_ID) ? _wcstoui64(fields->recordId, NULL, 10) : 0;
+	fields->values = 0;
+	fields->eventData = NULL;
+	fields->identity = NULL;
+
+	return TRUE;
+}
+
+
+// Names of the record fields, as the JSON records key them
+static const struct {
+	LPCWSTR name;
+	DWORD field;
+} recordFieldNames[] = {
+	{ L"record_id", RECORD_FIELD_RECORD_ID },
+	{ L"event_id", RECORD_FIELD_EVENT_ID },
+	{ L"logname", RECORD_FIELD_LOGNAME },
+	{ L"source", RECORD_FIELD_SOURCE },
+	{ L"computer", RECORD_FIELD_COMPUTER },
+	{ L"time_created", RECORD_FIELD_TIME_CREATED },
+	{ L"task", RECORD_FIELD_TASK },
+	{ L"level", RECORD_FIELD_LEVEL },
+	{ L"message", RECORD_FIELD_MESSAGE },
+};
+
+/****
+ * ParseRecordFields
+ *
+ * DESC:
+ *     Works out which record fields a list of names asks for
+ *
+ * ARGS:
+ *     names - JSON keys separated by EVENT_DATA_SEPARATOR, e.g.
+ *             L"record_id,event_id,time_created". NULL, an empty string
+ *             or EVENT_DATA_ALL asks for every field
+ *     fields - Receives the RECORD_FIELD_* flags
+ *
+ * RETURNS:
+ *     TRUE, or FALSE if a name is not one of the record fields (with
+ *     ERROR_INVALID_PARAMETER, and fields left alone)
+ *
+ * REMARKS:
+ *     Blanks around each name are ignored, as are empty names. A list of
+ *     nothing but those asks for every field, as with EventDataSelection
+ */
+BOOL ParseRecordFields(LPCWSTR names, DWORD *fields)
+{
+	DWORD selected = 0;
+
+	if( names != NULL && wcscmp(names, EVENT_DATA_ALL) != 0 )
+	{
+		LPCWSTR start = names;
+
+		while( *start != L'\0' )
+		{
+			LPCWSTR end = wcschr(start, EVENT_DATA_SEPARATOR);
+
+			if( end == NULL )
+				end = start + wcslen(start);
+
+			LPCWSTR last = end;
+
+			while( start < last && iswspace(*start) )
+				start++;
+			while( last > start && iswspace(last[-1]) )
+				last--;
+
+			if( last > start ) 
+			{
+				size_t length = last - start;
+				DWORD field = 0;
+
+				for( size_t i = 0; i < sizeof(recordFieldNames) / sizeof(recordFieldNames[0]); i++ ) {
+					if( wcslen(recordFieldNames[i].name) == length && memcmp(recordFieldNames[i].name, start, length * sizeof(WCHAR)) == 0 )
+						field = recordFieldNames[i].field;
+				}
+
+				if( field == 0 ) {
+					SetLastError(ERROR_INVALID_PARAMETER);
+					return FALSE;
+				}
+
+				selected |= field;
+			}
+
+			start = *end == L'\0' ? end : end + 1;
+		}
+	}
+
+	*fields = selected != 0 ? selected : RECORD_FIELDS_ALL;
+
+	return TRUE;
+}
+
+
+/****
+ * FormatUnsigned
+ *
+ * DESC:
+ *     Writes a number as decimal text
+ *
+ * ARGS:
+ *     value - the number
+ *     buffer - receives the text (at least 21 characters)
+ *
+ * RETURNS:
+ *     buffer
+ */
+LPWSTR FormatUnsigned(DWORD64 value, LPWSTR buffer)
+{
+	WCHAR digits[20];
+	int count = 0;
+
+	do {
+		digits[count++] = (WCHAR)(L'0' + value % 10);
+		value /= 10;
+	} while( value != 0 );
+
+	LPWSTR out = buffer;
+
+	while( count > 0 )
+		*out++ = digits[--count];
+	*out = L'\0';
+
+	return buffer;
+}
+
+
+/****
+ * FormatSystemTime
+ *
+ * DESC:
+ *     Writes a FILETIME the same way the event XML presents SystemTime,
+ *     e.g. 2014-03-07T18:22:10.480125600Z
+ *
+ * ARGS:
+ *     fileTime - 100ns ticks since 1601-01-01 (UTC)
+ *     buffer - receives the text (at least 31 characters)
+ *
+ * RETURNS:
+ *     buffer
+ */
+LPWSTR FormatSystemTime(ULONGLONG fileTime, LPWSTR buffer)
+{
+	ULONGLONG seconds = fileTime / FILETIME_TICKS_PER_SECOND;
+	DWORD ticks = (DWORD)(fileTime % FILETIME_TICKS_PER_SECOND);
+	DWORD secondOfDay = (DWORD)(seconds % 86400);
+
+	// Civil date from a day count (days since 1970-01-01), see
+	// http://howardhinnant.github.io/date_algorithms.html
+	LONGLONG days = (LONGLONG)(seconds / 86400) - FILETIME_EPOCH_DAYS + 719468;
+	LONGLONG era = (days >= 0 ? days : days - 146096) / 146097;
+	DWORD dayOfEra = (DWORD)(days - era * 146097);
+	DWORD yearOfEra = (dayOfEra - dayOfEra / 1460 + dayOfEra / 36524 - dayOfEra / 146096) / 365;
+	DWORD dayOfYear = dayOfEra - (365 * yearOfEra + yearOfEra / 4 - yearOfEra / 100);
+	DWORD mp = (5 * dayOfYear + 2) / 153;
+	DWORD day = dayOfYear - (153 * mp + 2) / 5 + 1;
+	DWORD month = mp < 10 ? mp + 3 : mp - 9;
+	LONGLONG year = (LONGLONG)yearOfEra + era * 400 + (month <= 2 ? 1 : 0);
+
+	DWORD parts[] = { (DWORD)year, month, day, secondOfDay / 3600, secondOfDay / 60 % 60, secondOfDay % 60 };
+	DWORD widths[] = { 4, 2, 2, 2, 2, 2 };
+	WCHAR separators[] = { L'-', L'-', L'T', L':', L':', L'.' };
+
+	LPWSTR out = buffer;
+
+	for( int i = 0; i < 6; i++ ) {
+		for( DWORD w = widths[i], v = parts[i]; w > 0; w-- ) {
+			out[w - 1] = (WCHAR)(L'0' + v % 10);
+			v /= 10;
+		}
+		out += widths[i];
+		*out++ = separators[i];
+	}
+
+	// Ticks are 100ns; the XML form has nanosecond precision
+	for( int w = 7; w > 0; w-- ) {
+		out[w - 1] = (WCHAR)(L'0' + ticks % 10);
+		ticks /= 10;
+	}
+	out += 7;
+	*out++ = L'0';
+	*out++ = L'0';
+	*out++ = L'Z';
+	*out = L'\0';
+
+	return buffer;
+}
+
+
+/****
+ * ParseSystemTime
+ *
+ * DESC:
+ *     Reads a SystemTime string (as written by FormatSystemTime, with any
+ *     number of fractional digits) back into a FILETIME
+ *
+ * ARGS:
+ *     text - e.g. 2014-03-07T18:22:10.480125600Z
+ *     fileTime - receives 100ns ticks since 1601-01-01 (UTC)
+ *
+ * RETURNS:
+ *     TRUE if the string was understood
+ */
+BOOL ParseSystemTime(LPCWSTR text, ULONGLONG *fileTime)
+{
+	DWORD parts[6];
+	DWORD widths[] = { 4, 2, 2, 2, 2, 2 };
+	WCHAR separators[] = { L'-', L'-', L'T', L':', L':', 0 };
+
+	for( int i = 0; i < 6; i++ ) {
+		parts[i] = 0;
+		for( DWORD w = 0; w < widths[i]; w++, text++ ) {
+			if( *text < L'0' || *text > L'9' )
+				return FALSE;
+			parts[i] = parts[i] * 10 + (*text - L'0');
+		}
+		if( separators[i] != 0 && *text++ != separators[i] )
+			return FALSE;
+	}
+
+	// Fractional seconds, truncated to 100ns ticks
+	DWORD ticks = 0;
+	DWORD digits = 0;
+
+	if( *text == L'.' ) {
+		for( text++; *text >= L'0' && *text <= L'9'; text++ ) {
+			if( digits < 7 ) {
+				ticks = ticks * 10 + (*text - L'0');
+				digits++;
+			}
+		}
+	}
+	for( ; digits < 7; digits++ )
+		ticks *= 10;
+
+	// Day count from a civil date, see FormatSystemTime
+	LONGLONG year = parts[0];
+	DWORD month = parts[1];
+	DWORD day = parts[2];
+
+	if( month < 1 || month > 12 || day < 1 || day > 31 )
+		return FALSE;
+
+	year -= month <= 2 ? 1 : 0;
+	LONGLONG era = (year >= 0 ? year : year - 399) / 400;
+	DWORD yearOfEra = (DWORD)(year - era * 400);
+	DWORD dayOfYear = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+	DWORD dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+	LONGLONG days = era * 146097 + (LONGLONG)dayOfEra - 719468 + FILETIME_EPOCH_DAYS;
+
+	if( days < 0 )
+		return FALSE;
+
+	ULONGLONG seconds = (ULONGLONG)days * 86400 + parts[3] * 3600 + parts[4] * 60 + parts[5];
+
+	*fileTime = seconds * FILETIME_TICKS_PER_SECOND + ticks;
+
+	return TRUE;
+}
+
+
+/****
+ * GetFieldNumber
+ *
+ * DESC:
+ *     Gets one of the numeric fields of an event (record ID, event ID,
+ *     task, level or TimeCreated, as a FILETIME): as it came on the values
+ *     path, or else parsed from its text
+ *
+ * ARGS:
+ *     fields - System fields of the event
+ *     field - the RECORD_FIELD_* flag of the field
+ *     number - receives its value
+ *
+ * RETURNS:
+ *     FALSE if the event has no value for it
+ */
+BOOL GetFieldNumber(const SYSTEM_FIELDS *fields, DWORD field, DWORD64 *number)
+{
+	LPCWSTR text = NULL;
+	DWORD64 value = 0;
+
+	switch( field ) {
+	case RECORD_FIELD_RECORD_ID:
+		// Always a number by now, on either path
+		if( fields->recordId == NULL || fields->recordId[0] == L'\0' )
+			return FALSE;
+		*number = fields->recordIdValue;
+		return TRUE;
+	case RECORD_FIELD_EVENT_ID: text = fields->eventId; value = fields->eventIdValue; break;
+	case RECORD_FIELD_TASK: text = fields->task; value = fields->taskValue; break;
+	case RECORD_FIELD_LEVEL: text = fields->level; value = fields->levelValue; break;
+	case RECORD_FIELD_TIME_CREATED: text = fields->timeCreated; value = fields->timeCreatedValue; break;
+	default:
+		return FALSE;
+	}
+
+	if( fields->values & field ) {
+		*number = value;
+		return TRUE;
+	}
+
+	if( text == NULL || text[0] == L'\0' )
+		return FALSE;
+
+	if( field == RECORD_FIELD_TIME_CREATED )
+		return ParseSystemTime(text, number);
+
+	LPWSTR end = NULL;
+
+	*number = _wcstoui64(text, &end, 10);
+
+	return end != text;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "Platform.h"
+#include "RenderContext.h"
+#include "EventData.h"
+#include "Identity.h"
+
+// The fields of an output record, for picking which ones a caller wants
+// (see ParseRecordFields). RECORD_FIELD_VERSION is never output, but the
+// message templates are keyed by it
+#define RECORD_FIELD_RECORD_ID 0x0001
+#define RECORD_FIELD_EVENT_ID 0x0002
+#define RECORD_FIELD_LOGNAME 0x0004
+#define RECORD_FIELD_SOURCE 0x0008
+#define RECORD_FIELD_COMPUTER 0x0010
+#define RECORD_FIELD_TIME_CREATED 0x0020
+#define RECORD_FIELD_TASK 0x0040
+#define RECORD_FIELD_LEVEL 0x0080
+#define RECORD_FIELD_MESSAGE 0x0100
+#define RECORD_FIELD_VERSION 0x0200
+#define RECORD_FIELDS_ALL 0x01FF
+
+// Number of 100ns FILETIME ticks per second, and the number of days between
+// the FILETIME epoch (1601-01-01) and the Unix epoch (1970-01-01)
+#define FILETIME_TICKS_PER_SECOND 10000000ULL
+#define FILETIME_EPOCH_DAYS 134774
+
+// The <System> fields we output for every event, as strings. Pointers are
+// only valid until the next event is rendered in the same RenderContext
+struct SYSTEM_FIELDS {
+	LPCWSTR recordId;
+	LPCWSTR eventId;
+	LPCWSTR channel;
+	LPCWSTR provider;
+	LPCWSTR computer;
+	LPCWSTR timeCreated;
+	LPCWSTR task;
+	LPCWSTR level;
+	LPCWSTR version;
+
+	DWORD64 recordIdValue;
+
+	// The fields that arrive as numbers, as they came. values is the
+	// RECORD_FIELD_* flags of those filled in (the values path fills in
+	// the ones it was asked for and found; the XML path none of them)
+	DWORD values;
+	WORD eventIdValue;
+	WORD taskValue;
+	BYTE levelValue;
+	ULONGLONG timeCreatedValue;
+
+	// The EventData fields, if MODE_EVENT_DATA asked for them (NULL if not)
+	const std::vector<EVENT_DATA_FIELD> *eventData;
+
+	// Who logged on or off, if MODE_IDENTITY asked and this is a logon,
+	// logoff or NPS event (NULL if not)
+	const IDENTITY_RECORD *identity;
+
+	// Text for the fields that arrive as numbers on the values path
+	WCHAR recordIdText[24];
+	WCHAR eventIdText[8];
+	WCHAR taskText[8];
+	WCHAR levelText[8];
+	WCHAR versionText[8];
+	WCHAR timeCreatedText[32];
+};
+
+BOOL RenderSystemFields(RenderContext*, EVT_HANDLE, SYSTEM_FIELDS*, DWORD = RECORD_FIELDS_ALL | RECORD_FIELD_VERSION);
+BOOL ExtractSystemFields(rapidxml::xml_document<WCHAR>*, SYSTEM_FIELDS*, DWORD = RECORD_FIELDS_ALL | RECORD_FIELD_VERSION);
+BOOL ParseRecordFields(LPCWSTR, DWORD*);
+LPWSTR FormatUnsigned(DWORD64, LPWSTR);
+LPWSTR FormatSystemTime(ULONGLONG, LPWSTR);
+BOOL ParseSystemTime(LPCWSTR, ULONGLONG*);
+BOOL GetFieldNumber(const SYSTEM_FIELDS*, DWORD, DWORD64*);
@@ -0,0 +1,475 @@
+#include "TemplateMiner.h"
+#include <wchar.h>
+
+// White space, where a message is split into words
+#define IS_SPACE(c) ((c) == L' ' || (c) == L'\t' || (c) == L'\r' || (c) == L'\n' || (c) == L'\v' || (c) == L'\f')
+
+// What ends each gap in the key of a message's shape. Gaps are white space
+// only, so it cannot be part of one
+#define SHAPE_SEPARATOR L'|'
+
+// Root of the tree
+#define ROOT_NODE 0
+
+// Not a node: the message's way down the tree has not been made yet
+#define NO_NODE ((DWORD)-1)
+
+
+BOOL ExpandTemplate(LPCWSTR text, LPCWSTR parameters, std::wstring *out)
+{
+	out->clear();
+
+	if( text == NULL )
+		return FALSE;
+
+	LPCWSTR next = parameters != NULL ? parameters : L"";
+
+	for( LPCWSTR at = text; *at != L'\0'; ) {
+		if( wcsncmp(at, MINER_PARAMETER, MINER_PARAMETER_LENGTH) != 0 ) {
+			out->push_back(*at++);
+			continue;
+		}
+
+		if( *next == L'\0' )
+			return FALSE;
+
+		LPCWSTR end = wcschr(next, MINER_PARAMETER_SEPARATOR);
+
+		if( end == NULL )
+			end = next + wcslen(next);
+
+		out->append(next, end - next);
+		next = *end != L'\0' ? end + 1 : end;
+		at += MINER_PARAMETER_LENGTH;
+	}
+
+	return *next == L'\0';
+}
+
+
+TemplateMiner::TemplateMiner()
+	: maxTemplates(MINER_TEMPLATES_DEFAULT), depth(MINER_DEPTH_DEFAULT), similarity(MINER_SIMILARITY_DEFAULT), messages(0), unmined(0), changes(0),
+	wildcard(MINER_PARAMETER)
+{
+	nodes.resize(1);
+}
+
+
+/****
+ * TemplateMiner::Configure
+ *
+ * DESC:
+ *     Sets how many templates are kept, and how messages are matched to
+ *     them
+ *
+ * ARGS:
+ *     maxTemplates - most templates kept (at least 1). Fewer than there
+ *                    already are keeps those, but finds no more
+ *     depth - levels of the tree (see MINER_DEPTH_DEFAULT)
+ *     similarity - percent of a template's words a message must match
+ *
+ * REMARKS:
+ *     A new depth or similarity would put messages with other templates,
+ *     so it starts the miner over (see Clear).
+ */
+void TemplateMiner::Configure(DWORD maxTemplates, DWORD depth, DWORD similarity)
+{
+	if( depth < MINER_DEPTH_MIN )
+		depth = MINER_DEPTH_MIN;
+	if( depth > MINER_DEPTH_MAX )
+		depth = MINER_DEPTH_MAX;
+	if( similarity > 100 )
+		similarity = 100;
+
+	if( depth != this->depth || similarity != this->similarity ) {
+		this->depth = depth;
+		this->similarity = similarity;
+		Clear();
+	}
+
+	this->maxTemplates = maxTemplates > 0 ? maxTemplates : 1;
+}
+
+
+/****
+ * TemplateMiner::Clear
+ *
+ * DESC:
+ *     Forgets every template. IDs start from 1 again, so whoever was told
+ *     of the old ones must be told they are gone
+ */
+void TemplateMiner::Clear()
+{
+	nodes.clear();
+	nodes.resize(1);
+	templates.clear();
+}
+
+
+/****
+ * TemplateMiner::Split
+ *
+ * DESC:
+ *     Splits a message into its words, and builds the key of its shape:
+ *     the white space ahead of each word and after the last, each followed
+ *     by SHAPE_SEPARATOR
+ */
+void TemplateMiner::Split(LPCWSTR message)
+{
+	size_t at = 0;
+
+	words.clear();
+	key.clear();
+
+	for( ;; ) {
+		while( IS_SPACE(message[at]) )
+			key.push_back(message[at++]);
+
+		key.push_back(SHAPE_SEPARATOR);
+
+		if( message[at] == L'\0' )
+			break;
+
+		WORD_SPAN word;
+
+		word.start = at;
+		word.parameter = FALSE;
+
+		// MINER_PARAMETER anywhere in a word would be read back as a place
+		// for a parameter, so such a word is one
+		while( message[at] != L'\0' && !IS_SPACE(message[at]) ) {
+			word.parameter = word.parameter || (message[at] >= L'0' && message[at] <= L'9')
+				|| wcsncmp(message + at, MINER_PARAMETER, MINER_PARAMETER_LENGTH) == 0;
+			at++;
+		}
+
+		word.length = at - word.start;
+
+		words.push_back(word);
+	}
+}
+
+
+/****
+ * TemplateMiner::Child
+ *
+ * DESC:
+ *     Finds the child of a node a word goes down to: its own, or else the
+ *     MINER_PARAMETER one once the node tells apart MINER_CHILDREN_MAX
+ *     words
+ *
+ * ARGS:
+ *     node - the node
+ *     word - the word (MINER_PARAMETER for a parameter), or at the root
+ *            the key of the message's shape
+ *     create - whether to add the child if there is none yet
+ *
+ * RETURNS:
+ *     The child, or NO_NODE if there is none and create is FALSE
+ */
+DWORD TemplateMiner::Child(DWORD node, const std::wstring &word, BOOL create)
+{
+	std::unordered_map<std::wstring, DWORD>::iterator found = nodes[node].children.find(word);
+
+	if( found != nodes[node].children.end() )
+		return found->second;
+
+	if( node != ROOT_NODE && nodes[node].children.size() >= MINER_CHILDREN_MAX && word != wildcard )
+		return Child(node, wildcard, create);
+
+	if( !create )
+		return NO_NODE;
+
+	DWORD child = (DWORD)nodes.size();
+
+	nodes[node].children[word] = child;
+	nodes.resize(child + 1);
+
+	return child;
+}
+
+
+/****
+ * TemplateMiner::Path
+ *
+ * DESC:
+ *     Goes down the tree with the message Split last took apart: by its
+ *     shape, then by its first words, as many as the depth allows
+ *
+ * ARGS:
+ *     message - the message
+ *     create - whether to make the way down if it is not there yet
+ *
+ * RETURNS:
+ *     The leaf it gets to, or NO_NODE if there is none and create is
+ *     FALSE
+ */
+DWORD TemplateMiner::Path(LPCWSTR message, BOOL create)
+{
+	DWORD node = Child(ROOT_NODE, key, create);
+	size_t levels = depth - 2 < words.size() ? depth - 2 : words.size();
+
+	for( size_t level = 0; node != NO_NODE && level < levels; level++ ) {
+		if( words[level].parameter )
+			node = Child(node, wildcard, create);
+		else
+			node = Child(node, lookup.assign(message + words[level].start, words[level].length), create);
+	}
+
+	return node;
+}
+
+
+/****
+ * TemplateMiner::Similar
+ *
+ * DESC:
+ *     Finds the template of a leaf most like the message Split last took
+ *     apart: the one with the most words the same as the message's (its
+ *     parameters count as the same), if that is enough of them. The first
+ *     found wins a tie
+ *
+ * RETURNS:
+ *     Its ID, or 0 if none is similar enough
+ */
+DWORD TemplateMiner::Similar(const std::vector<DWORD> &candidates, LPCWSTR message)
+{
+	DWORD best = 0;
+	size_t bestScore = 0;
+
+	for( size_t c = 0; c < candidates.size(); c++ ) {
+		const TEMPLATE &candidate = templates[candidates[c] - 1];
+		size_t score = 0;
+
+		for( size_t i = 0; i < words.size(); i++ ) {
+			const std::wstring &word = candidate.words[i];
+
+			if( word == wildcard
+				|| (!words[i].parameter && word.size() == words[i].length && wmemcmp(word.data(), message + words[i].start, words[i].length) == 0) )
+				score++;
+		}
+
+		if( score * 100 >= (size_t)similarity * words.size() && (best == 0 || score > bestScore) ) {
+			best = candidates[c];
+			bestScore = score;
+		}
+	}
+
+	return best;
+}
+
+
+/****
+ * TemplateMiner::Build
+ *
+ * DESC:
+ *     Writes out the text of a template from its words and gaps
+ */
+void TemplateMiner::Build(TEMPLATE *found)
+{
+	found->text.clear();
+
+	for( size_t i = 0; i < found->words.size(); i++ ) {
+		found->text += found->gaps[i];
+		found->text += found->words[i];
+	}
+
+	found->text += found->gaps[found->words.size()];
+}
+
+
+/****
+ * TemplateMiner::Merge
+ *
+ * DESC:
+ *     Makes a parameter of every word of a template that the message Split
+ *     last took apart has different, and moves its version on if there
+ *     was one
+ */
+void TemplateMiner::Merge(TEMPLATE *found, LPCWSTR message)
+{
+	BOOL changed = FALSE;
+
+	for( size_t i = 0; i < words.size(); i++ ) {
+		std::wstring &word = found->words[i];
+
+		if( word == wildcard )
+			continue;
+
+		if( !words[i].parameter && word.size() == words[i].length && wmemcmp(word.data(), message + words[i].start, words[i].length) == 0 )
+			continue;
+
+		word = MINER_PARAMETER;
+		changed = TRUE;
+	}
+
+	if( changed ) {
+		found->version++;
+		changes++;
+		Build(found);
+	}
+}
+
+
+/****
+ * TemplateMiner::Add
+ *
+ * DESC:
+ *     Starts a template of the message Split last took apart, in a leaf
+ *
+ * RETURNS:
+ *     Its ID
+ */
+DWORD TemplateMiner::Add(DWORD leaf, LPCWSTR message)
+{
+	templates.resize(templates.size() + 1);
+
+	TEMPLATE &added = templates.back();
+	size_t at = 0;
+
+	added.version = 1;
+	added.announced = 0;
+
+	for( size_t i = 0; i < words.size(); i++ ) {
+		added.gaps.push_back(std::wstring(message + at, words[i].start - at));
+		added.words.push_back(words[i].parameter ? std::wstring(MINER_PARAMETER) : std::wstring(message + words[i].start, words[i].length));
+		at = words[i].start + words[i].length;
+	}
+
+	added.gaps.push_back(std::wstring(message + at));
+
+	Build(&added);
+
+	nodes[leaf].templates.push_back((DWORD)templates.size());
+
+	return (DWORD)templates.size();
+}
+
+
+/****
+ * TemplateMiner::Mine
+ *
+ * DESC:
+ *     Finds the template of a message, or starts one, and the message's
+ *     parameters
+ *
+ * ARGS:
+ *     message - the message
+ *     parameters - receives its parameters, MINER_PARAMETER_SEPARATOR
+ *                  between them (see ExpandTemplate). They live in the
+ *                  miner until the next call
+ *     count - FALSE to leave the message out of Messages and Unmined, for
+ *             a caller that counts it once it has gone out (see Count)
+ *
+ * RETURNS:
+ *     The template's ID, or 0 if the message is empty or white space, or
+ *     fits no template and no more are kept. It then goes out whole
+ *
+ * REMARKS:
+ *     Mining a message again once it has its template changes nothing,
+ *     so one that could not go out can be mined again when it is offered
+ *     again.
+ */
+DWORD TemplateMiner::Mine(LPCWSTR message, LPCWSTR *parameters, BOOL count)
+{
+	*parameters = L"";
+
+	if( message == NULL )
+		return 0;
+
+	if( count )
+		messages++;
+
+	Split(message);
+
+	if( words.empty() ) {
+		if( count )
+			unmined++;
+		return 0;
+	}
+
+	// A message that does not get to a leaf has no template yet
+	DWORD leaf = Path(message, FALSE);
+	DWORD found = leaf != NO_NODE ? Similar(nodes[leaf].templates, message) : 0;
+
+	if( found != 0 ) {
+		Merge(&templates[found - 1], message);
+	} else if( templates.size() >= maxTemplates ) {
+		if( count )
+			unmined++;
+		return 0;
+	} else {
+		found = Add(Path(message, TRUE), message);
+	}
+
+	const TEMPLATE &mined = templates[found - 1];
+
+	this->parameters.clear();
+
+	for( size_t i = 0; i < words.size(); i++ ) {
+		if( mined.words[i] != wildcard )
+			continue;
+
+		if( !this->parameters.empty() )
+			this->parameters.push_back(MINER_PARAMETER_SEPARATOR);
+
+		this->parameters.append(message + words[i].start, words[i].length);
+	}
+
+	*parameters = this->parameters.c_str();
+
+	return found;
+}
+
+
+/****
+ * TemplateMiner::Count
+ *
+ * DESC:
+ *     Counts a message Mine was told not to count, once it has gone out
+ *
+ * ARGS:
+ *     templateId - what Mine returned for it: 0 counts it as unmined
+ */
+void TemplateMiner::Count(DWORD templateId)
+{
+	messages++;
+
+	if( templateId == 0 )
+		unmined++;
+}
+
+
+LPCWSTR TemplateMiner::Text(DWORD templateId) const
+{
+	if( templateId == 0 || templateId > templates.size() )
+		return NULL;
+
+	return templates[templateId - 1].text.c_str();
+}
+
+
+DWORD TemplateMiner::Version(DWORD templateId) const
+{
+	if( templateId == 0 || templateId > templates.size() )
+		return 0;
+
+	return templates[templateId - 1].version;
+}
+
+
+// Which version of a template's text was last announced (0 for none)
+DWORD TemplateMiner::Announced(DWORD templateId) const
+{
+	if( templateId == 0 || templateId > templates.size() )
+		return 0;
+
+	return templates[templateId - 1].announced;
+}
+
+
+void TemplateMiner::SetAnnounced(DWORD templateId, DWORD version)
+{
+	if( templateId != 0 && templateId <= templates.size() )
+		templates[templateId - 1].announced = version;
+}
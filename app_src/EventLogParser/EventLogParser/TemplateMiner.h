@@ -0,0 +1,156 @@
+#pragma once
+
+#include "Platform.h"
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Levels of the parse tree, the root and the level of message shapes
+// included: with 4, a message is routed by its shape and then by its first
+// two words (Drain's depth)
+#define MINER_DEPTH_DEFAULT 4
+#define MINER_DEPTH_MIN 3
+#define MINER_DEPTH_MAX 16
+
+// Percent of a template's words a message must match (its parameters
+// match any word) to be taken as one of its messages
+#define MINER_SIMILARITY_DEFAULT 50
+
+// Most words a node of the tree tells apart; the rest go down its
+// MINER_PARAMETER branch
+#define MINER_CHILDREN_MAX 100
+
+// Templates a miner keeps when the caller does not say, and the most it can
+#define MINER_TEMPLATES_DEFAULT 4096
+#define MINER_TEMPLATES_MAX 1000000
+
+// What stands for a parameter in the text of a template
+#define MINER_PARAMETER L"<*>"
+#define MINER_PARAMETER_LENGTH 3
+
+// What separates the parameters of a message. A parameter is a word, and
+// words never hold white space
+#define MINER_PARAMETER_SEPARATOR L' '
+
+/****
+ * ExpandTemplate
+ *
+ * DESC:
+ *     Puts a message back together from the text of its template and its
+ *     parameters, as TemplateMiner::Mine gave them: each MINER_PARAMETER
+ *     in the text is replaced by the next parameter
+ *
+ * ARGS:
+ *     text - the template's text
+ *     parameters - the parameters, MINER_PARAMETER_SEPARATOR between them
+ *     out - receives the message
+ *
+ * RETURNS:
+ *     FALSE if there are not as many parameters as the text has places
+ */
+BOOL ExpandTemplate(LPCWSTR text, LPCWSTR parameters, std::wstring *out);
+
+/****
+ * TemplateMiner
+ *
+ * DESC:
+ *     Finds the templates of messages as they come, as Drain does: each
+ *     message is split into words at white space and goes down a tree of
+ *     fixed depth, first by its shape (how many words, and the white space
+ *     between them), then by its first words, to a leaf of templates of
+ *     that shape. It joins the most similar of those (see
+ *     MINER_SIMILARITY_DEFAULT), or else starts one of its own. The words
+ *     where it differs from its template become parameters of it
+ *
+ * REMARKS:
+ *     A word with a digit in it is taken as a parameter from the start,
+ *     so that numbers, addresses, ports and IDs do not make templates of
+ *     their own, and so is a word with MINER_PARAMETER in it. Both are
+ *     routed down the MINER_PARAMETER branch of the tree.
+ *
+ *     A template's ID is its place in the order templates were found,
+ *     from 1, and never changes. Its text can: once a word of it is made
+ *     a parameter, its version goes up, and the text has to be announced
+ *     again before the first message that uses it. Expanding the text with
+ *     a message's parameters gives the message back exactly, white space
+ *     and all.
+ *
+ *     Once the most templates are kept, messages that fit none of them
+ *     are not mined (Mine returns 0), and go out whole.
+ */
+class TemplateMiner {
+public:
+	TemplateMiner();
+
+	void Configure(DWORD maxTemplates, DWORD depth = MINER_DEPTH_DEFAULT, DWORD similarity = MINER_SIMILARITY_DEFAULT);
+	void Clear();
+
+	DWORD Mine(LPCWSTR message, LPCWSTR *parameters, BOOL count = TRUE);
+	void Count(DWORD templateId);
+
+	LPCWSTR Text(DWORD templateId) const;
+	DWORD Version(DWORD templateId) const;
+	DWORD Announced(DWORD templateId) const;
+	void SetAnnounced(DWORD templateId, DWORD version);
+
+	DWORD MaxTemplates() const { return maxTemplates; }
+	DWORD Templates() const { return (DWORD)templates.size(); }
+	DWORD64 Messages() const { return messages; }
+	DWORD64 Unmined() const { return unmined; }
+	DWORD64 Changes() const { return changes; }
+
+private:
+	// A word of the message being mined, where it is in the message
+	struct WORD_SPAN {
+		size_t start;
+		size_t length;
+		BOOL parameter;
+	};
+
+	// A node of the tree: its children by word (or by shape, at the root),
+	// and at the bottom the IDs of the templates of its leaf
+	struct NODE {
+		std::unordered_map<std::wstring, DWORD> children;
+		std::vector<DWORD> templates;
+	};
+
+	// A template: its words (MINER_PARAMETER for a parameter), the white
+	// space around them, its text, and which version of it was announced
+	struct TEMPLATE {
+		std::vector<std::wstring> words;
+		std::vector<std::wstring> gaps;
+		std::wstring text;
+		DWORD version;
+		DWORD announced;
+	};
+
+	void Split(LPCWSTR message);
+	DWORD Child(DWORD node, const std::wstring &word, BOOL create);
+	DWORD Path(LPCWSTR message, BOOL create);
+	DWORD Similar(const std::vector<DWORD> &candidates, LPCWSTR message);
+	DWORD Add(DWORD leaf, LPCWSTR message);
+	void Merge(TEMPLATE *found, LPCWSTR message);
+	void Build(TEMPLATE *found);
+
+	DWORD maxTemplates;
+	DWORD depth;
+	DWORD similarity;
+
+	DWORD64 messages;
+	DWORD64 unmined;
+	DWORD64 changes;
+
+	// The tree, the root first, and the templates by ID less one
+	std::vector<NODE> nodes;
+	std::vector<TEMPLATE> templates;
+
+	// Reused from message to message, so that one that matches a template
+	// allocates nothing
+	std::vector<WORD_SPAN> words;
+	std::wstring key;
+	std::wstring lookup;
+	std::wstring parameters;
+
+	// MINER_PARAMETER, as the key of the branch parameters go down
+	const std::wstring wildcard;
+};
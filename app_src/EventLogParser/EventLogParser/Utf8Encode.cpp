@@ -0,0 +1,418 @@
+#include "Utf8Encode.h"
+#include "Simd.h"
+#include <string.h>
+
+#define REPLACEMENT_CHARACTER 0xFFFD
+
+/****
+ * NextCodePoint
+ *
+ * DESC:
+ *     Reads the code point at text[*at], joining a surrogate pair, and
+ *     moves past it
+ *
+ * RETURNS:
+ *     The code point, or U+FFFD if there is no valid one there
+ */
+static inline DWORD NextCodePoint(LPCWSTR text, size_t length, size_t *at)
+{
+	DWORD c = (DWORD)text[(*at)++];
+
+	if( c < 0xD800 )
+		return c;
+
+	if( c <= 0xDBFF )
+	{
+		if( *at < length && (DWORD)text[*at] >= 0xDC00 && (DWORD)text[*at] <= 0xDFFF )
+			return 0x10000 + ((c - 0xD800) << 10) + ((DWORD)text[(*at)++] - 0xDC00);
+
+		return REPLACEMENT_CHARACTER;
+	}
+
+	if( c <= 0xDFFF || c > 0x10FFFF )
+		return REPLACEMENT_CHARACTER;
+
+	return c;
+}
+
+
+static inline size_t EncodeCodePoint(DWORD c, char *out)
+{
+	if( c < 0x80 ) {
+		out[0] = (char)c;
+		return 1;
+	}
+
+	if( c < 0x800 ) {
+		out[0] = (char)(0xC0 | (c >> 6));
+		out[1] = (char)(0x80 | (c & 0x3F));
+		return 2;
+	}
+
+	if( c < 0x10000 ) {
+		out[0] = (char)(0xE0 | (c >> 12));
+		out[1] = (char)(0x80 | ((c >> 6) & 0x3F));
+		out[2] = (char)(0x80 | (c & 0x3F));
+		return 3;
+	}
+
+	out[0] = (char)(0xF0 | (c >> 18));
+	out[1] = (char)(0x80 | ((c >> 12) & 0x3F));
+	out[2] = (char)(0x80 | ((c >> 6) & 0x3F));
+	out[3] = (char)(0x80 | (c & 0x3F));
+	return 4;
+}
+
+
+/****
+ * EncodeUntil
+ *
+ * DESC:
+ *     Encodes characters from text[*at] until *at reaches end. A surrogate
+ *     pair that starts just before end is read whole, so *at can end up
+ *     one past it
+ *
+ * RETURNS:
+ *     The number of bytes written
+ */
+static inline size_t EncodeUntil(LPCWSTR text, size_t length, size_t *at, size_t end, char *out)
+{
+	char *start = out;
+
+	while( *at < end )
+	{
+		DWORD c = (DWORD)text[*at];
+
+		if( c < 0x80 ) {
+			*out++ = (char)c;
+			(*at)++;
+		} else {
+			out += EncodeCodePoint(NextCodePoint(text, length, at), out);
+		}
+	}
+
+	return out - start;
+}
+
+
+size_t WideToUtf8Scalar(LPCWSTR text, size_t length, char *out)
+{
+	size_t at = 0;
+
+	return EncodeUntil(text, length, &at, length, out);
+}
+
+
+size_t Utf8Length(LPCWSTR text, size_t length)
+{
+	size_t bytes = 0;
+	size_t at = 0;
+
+	while( at < length )
+	{
+		DWORD c = NextCodePoint(text, length, &at);
+
+		bytes += c < 0x80 ? 1 : c < 0x800 ? 2 : c < 0x10000 ? 3 : 4;
+	}
+
+	return bytes;
+}
+
+
+#ifdef PARSER_SIMD
+
+/****
+ * NarrowAsciiSse2
+ *
+ * DESC:
+ *     Writes 16 characters as bytes, up to the first that is not ASCII
+ *
+ * RETURNS:
+ *     How many leading characters were ASCII (16 if all of them). Bytes
+ *     for the rest are written too but are garbage; they are overwritten
+ *     later, and never run past the output since every character left
+ *     encodes to at least a byte
+ */
+static inline size_t NarrowAsciiSse2(LPCWSTR text, char *out)
+{
+	__m128i ascii, bytes;
+
+	if( sizeof(WCHAR) == 2 )
+	{
+		__m128i a = _mm_loadu_si128((const __m128i *)text);
+		__m128i b = _mm_loadu_si128((const __m128i *)(text + 8));
+		__m128i high = _mm_set1_epi16((short)0xFF80);
+
+		ascii = _mm_packs_epi16(_mm_cmpeq_epi16(_mm_and_si128(a, high), _mm_setzero_si128()),
+			_mm_cmpeq_epi16(_mm_and_si128(b, high), _mm_setzero_si128()));
+		bytes = _mm_packus_epi16(a, b);
+	}
+	else
+	{
+		__m128i a = _mm_loadu_si128((const __m128i *)text);
+		__m128i b = _mm_loadu_si128((const __m128i *)(text + 4));
+		__m128i c = _mm_loadu_si128((const __m128i *)(text + 8));
+		__m128i d = _mm_loadu_si128((const __m128i *)(text + 12));
+		__m128i high = _mm_set1_epi32(~0x7F);
+		__m128i zero = _mm_setzero_si128();
+
+		// Compare results are 0 or -1, which packing keeps as they are
+		ascii = _mm_packs_epi16(
+			_mm_packs_epi32(_mm_cmpeq_epi32(_mm_and_si128(a, high), zero), _mm_cmpeq_epi32(_mm_and_si128(b, high), zero)),
+			_mm_packs_epi32(_mm_cmpeq_epi32(_mm_and_si128(c, high), zero), _mm_cmpeq_epi32(_mm_and_si128(d, high), zero)));
+		bytes = _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+	}
+
+	_mm_storeu_si128((__m128i *)out, bytes);
+
+	DWORD other = ~(DWORD)_mm_movemask_epi8(ascii) & 0xFFFF;
+
+	return other == 0 ? 16 : CountTrailingZeros(other);
+}
+
+
+// Inline, so that the AVX2 path's tail is VEX-encoded along with it
+static inline size_t EncodeVectorsSse2(LPCWSTR text, size_t length, char *out)
+{
+	char *start = out;
+	size_t at = 0;
+
+	while( at + 16 <= length )
+	{
+		size_t window = at + 16;
+		size_t ascii = NarrowAsciiSse2(text + at, out);
+
+		// The ASCII run is kept; the rest of the window goes scalar
+		at += ascii;
+		out += ascii;
+
+		if( ascii < 16 )
+			out += EncodeUntil(text, length, &at, window, out);
+	}
+
+	return (out - start) + EncodeUntil(text, length, &at, length, out);
+}
+
+
+static size_t WideToUtf8Sse2(LPCWSTR text, size_t length, char *out)
+{
+	return EncodeVectorsSse2(text, length, out);
+}
+
+
+/****
+ * BuildPackTable
+ *
+ * DESC:
+ *     Fills the shuffles EncodeBlockAvx2 uses to squeeze four 32-bit lanes,
+ *     each holding a 1 to 3 byte sequence, down to the bytes in use. The
+ *     key has a bit per lane that is 2 bytes or more (bits 0-3) and one
+ *     per lane that is 3 bytes (bits 4-7)
+ */
+static unsigned char packShuffle[256][16];
+static unsigned char packLength[256];
+
+static BOOL BuildPackTable()
+{
+	for( DWORD key = 0; key < 256; key++ )
+	{
+		DWORD used = 0;
+
+		memset(packShuffle[key], 0x80, sizeof(packShuffle[key]));
+
+		for( DWORD lane = 0; lane < 4; lane++ ) {
+			DWORD bytes = 1 + ((key >> lane) & 1) + ((key >> (lane + 4)) & 1);
+
+			for( DWORD b = 0; b < bytes; b++ )
+				packShuffle[key][used++] = (unsigned char)(lane * 4 + b);
+		}
+
+		packLength[key] = (unsigned char)used;
+	}
+
+	return TRUE;
+}
+
+static const BOOL packTableBuilt = BuildPackTable();
+
+
+/****
+ * EncodeBlockAvx2
+ *
+ * DESC:
+ *     Encodes 8 characters of the Basic Multilingual Plane, any mix of 1,
+ *     2 and 3 byte sequences: each character's sequence is worked out in
+ *     its own 32-bit lane, then each half is packed down with a shuffle
+ *     from the pack table
+ *
+ * RETURNS:
+ *     The number of bytes written, or 0 (writing nothing) if any of them
+ *     is a surrogate or above U+FFFF, for the scalar encoder to handle.
+ *     Up to 12 bytes past that are written as well, so callers must have
+ *     12 characters or more left after the block
+ */
+PARSER_TARGET_AVX2 static inline size_t EncodeBlockAvx2(LPCWSTR text, char *out)
+{
+	__m256i c;
+
+	if( sizeof(WCHAR) == 2 )
+		c = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)text));
+	else
+		c = _mm256_loadu_si256((const __m256i *)text);
+
+	if( !_mm256_testz_si256(c, _mm256_set1_epi32((INT)0xFFFF0000)) )
+		return 0;
+
+	__m256i surrogate = _mm256_cmpeq_epi32(_mm256_and_si256(c, _mm256_set1_epi32(0xF800)), _mm256_set1_epi32(0xD800));
+
+	if( !_mm256_testz_si256(surrogate, surrogate) )
+		return 0;
+
+	// 110xxxxx 10xxxxxx and 1110xxxx 10xxxxxx 10xxxxxx, first byte lowest
+	__m256i low6 = _mm256_and_si256(c, _mm256_set1_epi32(0x3F));
+	__m256i two = _mm256_or_si256(_mm256_or_si256(_mm256_srli_epi32(c, 6), _mm256_slli_epi32(low6, 8)),
+		_mm256_set1_epi32(0x80C0));
+	__m256i three = _mm256_or_si256(
+		_mm256_or_si256(_mm256_srli_epi32(c, 12), _mm256_slli_epi32(_mm256_and_si256(_mm256_srli_epi32(c, 6), _mm256_set1_epi32(0x3F)), 8)),
+		_mm256_or_si256(_mm256_slli_epi32(low6, 16), _mm256_set1_epi32(0x8080E0)));
+
+	__m256i wide = _mm256_cmpgt_epi32(c, _mm256_set1_epi32(0x7F));
+	__m256i wider = _mm256_cmpgt_epi32(c, _mm256_set1_epi32(0x7FF));
+	__m256i bytes = _mm256_blendv_epi8(_mm256_blendv_epi8(c, two, wide), three, wider);
+
+	DWORD m2 = (DWORD)_mm256_movemask_ps(_mm256_castsi256_ps(wide));
+	DWORD m3 = (DWORD)_mm256_movemask_ps(_mm256_castsi256_ps(wider));
+	DWORD lowKey = (m2 & 0xF) | ((m3 & 0xF) << 4);
+	DWORD highKey = (m2 >> 4) | ((m3 >> 4) << 4);
+
+	__m128i low = _mm_shuffle_epi8(_mm256_castsi256_si128(bytes), _mm_loadu_si128((const __m128i *)packShuffle[lowKey]));
+	__m128i high = _mm_shuffle_epi8(_mm256_extracti128_si256(bytes, 1), _mm_loadu_si128((const __m128i *)packShuffle[highKey]));
+
+	_mm_storeu_si128((__m128i *)out, low);
+	_mm_storeu_si128((__m128i *)(out + packLength[lowKey]), high);
+
+	return packLength[lowKey] + packLength[highKey];
+}
+
+
+// As NarrowAsciiSse2, 32 characters at a time and all or nothing
+PARSER_TARGET_AVX2 static inline BOOL NarrowAsciiAvx2(LPCWSTR text, char *out)
+{
+	__m256i bytes;
+
+	if( sizeof(WCHAR) == 2 )
+	{
+		__m256i a = _mm256_loadu_si256((const __m256i *)text);
+		__m256i b = _mm256_loadu_si256((const __m256i *)(text + 16));
+
+		if( !_mm256_testz_si256(_mm256_or_si256(a, b), _mm256_set1_epi16((short)0xFF80)) )
+			return FALSE;
+
+		// Packing works within 128-bit lanes; put the quarters back in order
+		bytes = _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xD8);
+	}
+	else
+	{
+		__m256i a = _mm256_loadu_si256((const __m256i *)text);
+		__m256i b = _mm256_loadu_si256((const __m256i *)(text + 8));
+		__m256i c = _mm256_loadu_si256((const __m256i *)(text + 16));
+		__m256i d = _mm256_loadu_si256((const __m256i *)(text + 24));
+
+		if( !_mm256_testz_si256(_mm256_or_si256(_mm256_or_si256(a, b), _mm256_or_si256(c, d)), _mm256_set1_epi32(~0x7F)) )
+			return FALSE;
+
+		bytes = _mm256_packus_epi16(_mm256_packs_epi32(a, b), _mm256_packs_epi32(c, d));
+		bytes = _mm256_permutevar8x32_epi32(bytes, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+	}
+
+	_mm256_storeu_si256((__m256i *)out, bytes);
+
+	return TRUE;
+}
+
+
+PARSER_TARGET_AVX2 static size_t WideToUtf8Avx2(LPCWSTR text, size_t length, char *out)
+{
+	char *start = out;
+	size_t at = 0;
+
+	while( at + 32 <= length )
+	{
+		if( NarrowAsciiAvx2(text + at, out) ) {
+			at += 32;
+			out += 32;
+			continue;
+		}
+
+		// Not all ASCII: take the next 32 characters 8 at a time, falling
+		// back to scalar for blocks with surrogates in them
+		size_t spanEnd = at + 32;
+
+		while( at < spanEnd )
+		{
+			size_t written = at + 8 + 12 <= length ? EncodeBlockAvx2(text + at, out) : 0;
+
+			if( written > 0 ) {
+				at += 8;
+				out += written;
+			} else {
+				out += EncodeUntil(text, length, &at, at + 8 < spanEnd ? at + 8 : spanEnd, out);
+			}
+		}
+	}
+
+	return (out - start) + EncodeVectorsSse2(text + at, length - at, out);
+}
+
+#endif
+
+
+UTF8_ENCODE_ROUTINE GetUtf8EncodeRoutine(INT kind)
+{
+	switch( kind )
+	{
+	case UTF8_ENCODE_DEFAULT:
+#ifdef PARSER_SIMD
+		return CpuHasAvx2() ? WideToUtf8Avx2 : WideToUtf8Sse2;
+#else
+		return WideToUtf8Scalar;
+#endif
+#ifdef PARSER_SIMD
+	case UTF8_ENCODE_AVX2:
+		return CpuHasAvx2() ? WideToUtf8Avx2 : NULL;
+	case UTF8_ENCODE_SSE2:
+		return WideToUtf8Sse2;
+#endif
+	case UTF8_ENCODE_SCALAR:
+		return WideToUtf8Scalar;
+	}
+
+	return NULL;
+}
+
+
+const char *GetUtf8EncodeName(INT kind)
+{
+	UTF8_ENCODE_ROUTINE routine = GetUtf8EncodeRoutine(kind);
+
+	if( routine == NULL )
+		return "unavailable";
+
+#ifdef PARSER_SIMD
+	if( routine == WideToUtf8Avx2 )
+		return "avx2";
+	if( routine == WideToUtf8Sse2 )
+		return "sse2";
+#endif
+
+	return "scalar";
+}
+
+
+size_t WideToUtf8(LPCWSTR text, size_t length, char *out)
+{
+	// Picked once; the CPU does not change under us
+	static const UTF8_ENCODE_ROUTINE routine = GetUtf8EncodeRoutine(UTF8_ENCODE_DEFAULT);
+
+	return routine(text, length, out);
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "Platform.h"
+
+// Most bytes one input character encodes to (a code point above the BMP
+// in a 4-byte WCHAR; a UTF-16 surrogate pair is 4 bytes for 2 characters)
+#define UTF8_MAX_GROWTH 4
+
+// Encoder implementations, fastest first. UTF8_ENCODE_DEFAULT picks the
+// fastest one this CPU supports
+#define UTF8_ENCODE_DEFAULT 0
+#define UTF8_ENCODE_AVX2 1
+#define UTF8_ENCODE_SSE2 2
+#define UTF8_ENCODE_SCALAR 3
+
+typedef size_t (*UTF8_ENCODE_ROUTINE)(LPCWSTR text, size_t length, char *out);
+
+/****
+ * WideToUtf8
+ *
+ * DESC:
+ *     Encodes wide text as UTF-8. Surrogate pairs are joined into one code
+ *     point; a surrogate without its other half, or anything above
+ *     U+10FFFF, becomes U+FFFD, so the output is always valid UTF-8
+ *
+ * ARGS:
+ *     text - characters to encode (need not be null-terminated). UTF-16
+ *            on Windows; UTF-32, or UTF-16 units widened, elsewhere
+ *     length - number of characters in text
+ *     out - where the UTF-8 goes. Must have room for Utf8Length bytes
+ *           (at most length * UTF8_MAX_GROWTH); nothing is written past
+ *           them
+ *
+ * RETURNS:
+ *     The number of bytes written. Nothing is null-terminated
+ *
+ * REMARKS:
+ *     On x86 blocks of 16 or 32 ASCII characters are narrowed to bytes at
+ *     once (SSE2, or AVX2 where the CPU has it); anything else goes
+ *     through the scalar encoder a block at a time. WideToUtf8Scalar is
+ *     the reference the vector versions must match exactly (see the utf8
+ *     bench).
+ */
+size_t WideToUtf8(LPCWSTR text, size_t length, char *out);
+size_t WideToUtf8Scalar(LPCWSTR text, size_t length, char *out);
+
+// Bytes WideToUtf8 would write for text, without writing them
+size_t Utf8Length(LPCWSTR text, size_t length);
+
+// The routine for one implementation, or NULL if this build or CPU
+// does not have it
+UTF8_ENCODE_ROUTINE GetUtf8EncodeRoutine(INT kind);
+const char *GetUtf8EncodeName(INT kind);
@@ -0,0 +1,206 @@
+#include "WinEvtSource.h"
+
+/****
+ * WinEvtSource::WinEvtSource
+ *
+ * ARGS:
+ *     hSession - remote session handle, or NULL for the local machine
+ */
+WinEvtSource::WinEvtSource(EVT_HANDLE hSession)
+	: hSession(hSession)
+{
+}
+
+
+EVT_HANDLE WinEvtSource::Query(LPCWSTR logName, LPCWSTR query, DWORD flags)
+{
+	return EvtQuery(hSession, logName, query, flags);
+}
+
+
+BOOL WinEvtSource::Next(EVT_HANDLE hResults, DWORD count, EVT_HANDLE *events, DWORD timeout, DWORD *returned)
+{
+	return EvtNext(hResults, count, events, timeout, 0, returned);
+}
+
+
+BOOL WinEvtSource::Render(EVT_HANDLE hContext, EVT_HANDLE hEvent, DWORD flags, DWORD bufferSize, PVOID buffer, DWORD *bufferUsed, DWORD *propertyCount)
+{
+	return EvtRender(hContext, hEvent, flags, bufferSize, buffer, bufferUsed, propertyCount);
+}
+
+
+EVT_HANDLE WinEvtSource::CreateRenderContext(DWORD flags)
+{
+	return EvtCreateRenderContext(0, NULL, flags);
+}
+
+
+EVT_HANDLE WinEvtSource::OpenPublisherMetadata(LPCWSTR publisherName)
+{
+	// Use the default locale (0) when opening the metadata
+	return EvtOpenPublisherMetadata(hSession, publisherName, NULL, 0, 0);
+}
+
+
+BOOL WinEvtSource::FormatEventMessage(EVT_HANDLE hMetadata, EVT_HANDLE hEvent, DWORD bufferSize, LPWSTR buffer, DWORD *bufferUsed)
+{
+	return EvtFormatMessage(hMetadata, hEvent, 0, 0, NULL, EvtFormatMessageEvent, bufferSize, buffer, bufferUsed);
+}
+
+
+/****
+ * WinEvtSource::GetMessageTemplate
+ *
+ * DESC:
+ *     Looks the event up in the publisher's event metadata and formats its
+ *     message ID without any values, which leaves the %1..%n inserts in
+ *
+ * REMARKS:
+ *     EvtFormatMessage reports the inserts it could not fill as
+ *     ERROR_EVT_UNRESOLVED_VALUE_INSERT, having written the message all
+ *     the same; that is the template. Classic providers have no event
+ *     metadata, so their events have no template
+ */
+BOOL WinEvtSource::GetMessageTemplate(EVT_HANDLE hMetadata, DWORD eventId, DWORD version, DWORD bufferSize, LPWSTR buffer, DWORD *bufferUsed)
+{
+	EVT_HANDLE hEnum = EvtOpenEventMetadataEnum(hMetadata, 0);
+
+	if( hEnum == NULL )
+		return FALSE;
+
+	// An event without a message lists -1 as its message ID
+	DWORD messageId = (DWORD)-1;
+	EVT_HANDLE hEvent;
+
+	while( (hEvent = EvtNextEventMetadata(hEnum, 0)) != NULL )
+	{
+		EVT_VARIANT id, eventVersion, message;
+		DWORD used;
+
+		BOOL found = EvtGetEventMetadataProperty(hEvent, EventMetadataEventID, 0, sizeof(id), &id, &used)
+			&& EvtGetEventMetadataProperty(hEvent, EventMetadataEventVersion, 0, sizeof(eventVersion), &eventVersion, &used)
+			&& id.UInt32Val == eventId && eventVersion.UInt32Val == version
+			&& EvtGetEventMetadataProperty(hEvent, EventMetadataEventMessageID, 0, sizeof(message), &message, &used);
+
+		EvtClose(hEvent);
+
+		if( found ) {
+			messageId = message.UInt32Val;
+			break;
+		}
+	}
+
+	EvtClose(hEnum);
+
+	if( messageId == (DWORD)-1 ) {
+		SetLastError(ERROR_EVT_MESSAGE_NOT_FOUND);
+		return FALSE;
+	}
+
+	if( EvtFormatMessage(hMetadata, NULL, messageId, 0, NULL, EvtFormatMessageId, bufferSize, buffer, bufferUsed) )
+		return TRUE;
+
+	return GetLastError() == ERROR_EVT_UNRESOLVED_VALUE_INSERT && buffer != NULL && *bufferUsed <= bufferSize;
+}
+
+
+BOOL WinEvtSource::Close(EVT_HANDLE hObject)
+{
+	if( !EvtClose(hObject) )
+		return FALSE;
+
+	std::lock_guard<std::mutex> guard(lock);
+	std::map<EVT_HANDLE, HANDLE>::iterator found = signals.find(hObject);
+
+	if( found != signals.end() ) {
+		CloseHandle(found->second);
+		signals.erase(found);
+	}
+
+	return TRUE;
+}
+
+
+/****
+ * WinEvtSource::Subscribe
+ *
+ * DESC:
+ *     Subscribes to a log in pull mode: the service sets the signal when
+ *     events arrive, and they are read with EvtNext
+ *
+ * REMARKS:
+ *     The signal starts out set, so that events already there by the
+ *     time of the subscription (e.g. those after a bookmark) are read
+ *     without waiting
+ */
+EVT_HANDLE WinEvtSource::Subscribe(LPCWSTR logName, LPCWSTR query, EVT_HANDLE hBookmark, DWORD flags)
+{
+	HANDLE hSignal = CreateEvent(NULL, TRUE, TRUE, NULL);
+
+	if( hSignal == NULL )
+		return NULL;
+
+	EVT_HANDLE hSubscription = EvtSubscribe(hSession, hSignal, logName, query, hBookmark, NULL, NULL, flags);
+
+	if( hSubscription == NULL ) {
+		DWORD error = GetLastError();
+
+		CloseHandle(hSignal);
+		SetLastError(error);
+
+		return NULL;
+	}
+
+	std::lock_guard<std::mutex> guard(lock);
+
+	signals[hSubscription] = hSignal;
+
+	return hSubscription;
+}
+
+
+BOOL WinEvtSource::WaitForEvents(EVT_HANDLE hSubscription, DWORD timeout)
+{
+	HANDLE hSignal = NULL;
+
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		std::map<EVT_HANDLE, HANDLE>::iterator found = signals.find(hSubscription);
+
+		if( found != signals.end() )
+			hSignal = found->second;
+	}
+
+	if( hSignal == NULL ) {
+		SetLastError(ERROR_INVALID_HANDLE);
+		return FALSE;
+	}
+
+	DWORD wait = WaitForSingleObject(hSignal, timeout);
+
+	if( wait == WAIT_TIMEOUT ) {
+		SetLastError(ERROR_TIMEOUT);
+		return FALSE;
+	}
+
+	if( wait != WAIT_OBJECT_0 )
+		return FALSE;
+
+	// Reset before reading, so events that arrive meanwhile set it again
+	ResetEvent(hSignal);
+
+	return TRUE;
+}
+
+
+EVT_HANDLE WinEvtSource::CreateBookmark(LPCWSTR bookmarkXml)
+{
+	return EvtCreateBookmark(bookmarkXml);
+}
+
+
+BOOL WinEvtSource::UpdateBookmark(EVT_HANDLE hBookmark, EVT_HANDLE hEvent)
+{
+	return EvtUpdateBookmark(hBookmark, hEvent);
+}
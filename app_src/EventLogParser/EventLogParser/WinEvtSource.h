@@ -0,0 +1,47 @@
+#pragma once
+
+#include <windows.h>
+#include <winevt.h>
+#include "EventSource.h"
+#include <map>
+#include <mutex>
+
+/****
+ * WinEvtSource
+ *
+ * DESC:
+ *     Event source backed by the real winevt API, against one session
+ *     (from CreateRemoteSession, or NULL for the local machine)
+ *
+ * REMARKS:
+ *     Does not own the session handle. The caller closes it once the
+ *     source is gone.
+ *
+ *     Each subscription gets its own manual-reset event as its signal,
+ *     closed along with it
+ */
+class WinEvtSource : public EventSource {
+public:
+	WinEvtSource(EVT_HANDLE hSession);
+
+	EVT_HANDLE Query(LPCWSTR logName, LPCWSTR query, DWORD flags);
+	BOOL Next(EVT_HANDLE hResults, DWORD count, EVT_HANDLE *events, DWORD timeout, DWORD *returned);
+	BOOL Render(EVT_HANDLE hContext, EVT_HANDLE hEvent, DWORD flags, DWORD bufferSize, PVOID buffer, DWORD *bufferUsed, DWORD *propertyCount);
+	EVT_HANDLE CreateRenderContext(DWORD flags);
+	EVT_HANDLE OpenPublisherMetadata(LPCWSTR publisherName);
+	BOOL FormatEventMessage(EVT_HANDLE hMetadata, EVT_HANDLE hEvent, DWORD bufferSize, LPWSTR buffer, DWORD *bufferUsed);
+	BOOL GetMessageTemplate(EVT_HANDLE hMetadata, DWORD eventId, DWORD version, DWORD bufferSize, LPWSTR buffer, DWORD *bufferUsed);
+	BOOL Close(EVT_HANDLE hObject);
+
+	EVT_HANDLE Subscribe(LPCWSTR logName, LPCWSTR query, EVT_HANDLE hBookmark, DWORD flags);
+	BOOL WaitForEvents(EVT_HANDLE hSubscription, DWORD timeout);
+	EVT_HANDLE CreateBookmark(LPCWSTR bookmarkXml);
+	BOOL UpdateBookmark(EVT_HANDLE hBookmark, EVT_HANDLE hEvent);
+
+private:
+	EVT_HANDLE hSession;
+
+	// Signal of each open subscription
+	std::mutex lock;
+	std::map<EVT_HANDLE, HANDLE> signals;
+};
@@ -0,0 +1,390 @@
+#include "XPathQuery.h"
+#include <string.h>
+#include <wctype.h>
+
+// Whether a character can be part of a name
+static BOOL IsNameChar(WCHAR c)
+{
+	return iswalnum(c) || c == L'_' || c == L'@';
+}
+
+
+// The System fields a query can compare, by name
+static const struct {
+	LPCWSTR name;
+	int field;
+} queryFields[] = {
+	{ L"EventID", 0 },
+	{ L"EventRecordID", 1 },
+	{ L"Level", 2 },
+	{ L"Task", 3 },
+	{ L"Version", 4 },
+};
+
+
+XPathQuery::XPathQuery()
+	: at(NULL)
+{
+}
+
+
+/****
+ * XPathQuery::Parse
+ *
+ * DESC:
+ *     Compiles a query (see XPathQuery)
+ *
+ * ARGS:
+ *     query - the query. NULL or an empty string selects all events
+ *
+ * RETURNS:
+ *     TRUE, or FALSE with ERROR_EVT_INVALID_QUERY if the query is not one
+ *     this class understands. Matches must not be used after a failure
+ */
+BOOL XPathQuery::Parse(LPCWSTR query)
+{
+	nodes.clear();
+	at = query != NULL ? query : L"";
+
+	SkipBlanks();
+
+	if( *at == L'\0' )
+		return TRUE;
+
+	BOOL ok = Accept(L"*");
+
+	SkipBlanks();
+
+	if( ok && *at != L'\0' )
+		ok = Accept(L"[") && ParseOr(SCOPE_EVENT) >= 0 && Accept(L"]");
+
+	SkipBlanks();
+
+	if( !ok || *at != L'\0' ) {
+		nodes.clear();
+		at = NULL;
+		SetLastError(ERROR_EVT_INVALID_QUERY);
+		return FALSE;
+	}
+
+	at = NULL;
+
+	return TRUE;
+}
+
+
+int XPathQuery::ParseOr(SCOPE scope)
+{
+	int left = ParseAnd(scope);
+
+	while( left >= 0 && Accept(L"or") ) {
+		int right = ParseAnd(scope);
+
+		left = right >= 0 ? AddNode(NODE_OR, left, right) : -1;
+	}
+
+	return left;
+}
+
+
+int XPathQuery::ParseAnd(SCOPE scope)
+{
+	int left = ParseTest(scope);
+
+	while( left >= 0 && Accept(L"and") ) {
+		int right = ParseTest(scope);
+
+		left = right >= 0 ? AddNode(NODE_AND, left, right) : -1;
+	}
+
+	return left;
+}
+
+
+/****
+ * XPathQuery::ParseTest
+ *
+ * DESC:
+ *     Compiles one test, or a parenthesised expression
+ *
+ * ARGS:
+ *     scope - the element the test is written in: the event (fields are
+ *             System/Name), System (fields are bare names) or Provider
+ *             (only @Name)
+ *
+ * RETURNS:
+ *     Index of the test's node, or -1 if it is not understood
+ */
+int XPathQuery::ParseTest(SCOPE scope)
+{
+	std::wstring name;
+
+	if( Accept(L"(") ) {
+		int node = ParseOr(scope);
+
+		return node >= 0 && Accept(L")") ? node : -1;
+	}
+
+	if( scope == SCOPE_EVENT ) {
+		if( !Accept(L"System") )
+			return -1;
+
+		if( Accept(L"[") ) {
+			int node = ParseOr(SCOPE_SYSTEM);
+
+			return node >= 0 && Accept(L"]") ? node : -1;
+		}
+
+		if( !Accept(L"/") )
+			return -1;
+
+		scope = SCOPE_SYSTEM;
+	}
+
+	if( scope == SCOPE_PROVIDER ) {
+		NODE node = NODE();
+		OPERATOR op;
+
+		if( !Accept(L"@Name") || !ReadOperator(&op) || (op != OP_EQUAL && op != OP_NOT_EQUAL) || !ReadString(&node.name) )
+			return -1;
+
+		node.kind = NODE_PROVIDER;
+		node.op = op;
+		nodes.push_back(node);
+
+		return (int)nodes.size() - 1;
+	}
+
+	if( Accept(L"Provider") ) {
+		if( !Accept(L"[") )
+			return -1;
+
+		int node = ParseOr(SCOPE_PROVIDER);
+
+		return node >= 0 && Accept(L"]") ? node : -1;
+	}
+
+	if( Accept(L"band") ) {
+		NODE node = NODE();
+
+		if( !Accept(L"(") || !Accept(L"Keywords") || !Accept(L",") || !ReadNumber(&node.value) || !Accept(L")") )
+			return -1;
+
+		node.kind = NODE_BAND;
+		nodes.push_back(node);
+
+		return (int)nodes.size() - 1;
+	}
+
+	if( !ReadName(&name) )
+		return -1;
+
+	for( size_t i = 0; i < sizeof(queryFields) / sizeof(queryFields[0]); i++ ) {
+		if( name == queryFields[i].name )
+			return ParseCompare((FIELD)queryFields[i].field);
+	}
+
+	return -1;
+}
+
+
+int XPathQuery::ParseCompare(FIELD field)
+{
+	NODE node = NODE();
+
+	if( !ReadOperator(&node.op) || !ReadNumber(&node.value) )
+		return -1;
+
+	node.kind = NODE_COMPARE;
+	node.field = field;
+	nodes.push_back(node);
+
+	return (int)nodes.size() - 1;
+}
+
+
+int XPathQuery::AddNode(NODE_KIND kind, size_t left, size_t right)
+{
+	NODE node = NODE();
+
+	node.kind = kind;
+	node.left = left;
+	node.right = right;
+	nodes.push_back(node);
+
+	return (int)nodes.size() - 1;
+}
+
+
+/****
+ * XPathQuery::Accept
+ *
+ * DESC:
+ *     Moves past a token if it comes next. A word only matches a whole
+ *     name, so "or" does not match the start of "order"
+ */
+BOOL XPathQuery::Accept(LPCWSTR token)
+{
+	size_t length = wcslen(token);
+
+	SkipBlanks();
+
+	if( wcsncmp(at, token, length) != 0 )
+		return FALSE;
+
+	if( IsNameChar(token[length - 1]) && IsNameChar(at[length]) )
+		return FALSE;
+
+	at += length;
+
+	return TRUE;
+}
+
+
+BOOL XPathQuery::ReadName(std::wstring *name)
+{
+	LPCWSTR start;
+
+	SkipBlanks();
+
+	for( start = at; IsNameChar(*at); at++ )
+		;
+
+	name->assign(start, at - start);
+
+	return at > start;
+}
+
+
+BOOL XPathQuery::ReadNumber(DWORD64 *value)
+{
+	DWORD base = 10;
+	LPCWSTR start;
+
+	SkipBlanks();
+
+	if( at[0] == L'0' && (at[1] == L'x' || at[1] == L'X') ) {
+		base = 16;
+		at += 2;
+	}
+
+	*value = 0;
+
+	for( start = at; iswxdigit(*at) && (base == 16 || iswdigit(*at)); at++ ) {
+		DWORD digit = iswdigit(*at) ? *at - L'0' : towlower(*at) - L'a' + 10;
+
+		if( *value > (~0ULL - digit) / base )
+			return FALSE;
+
+		*value = *value * base + digit;
+	}
+
+	return at > start && !IsNameChar(*at);
+}
+
+
+BOOL XPathQuery::ReadString(std::wstring *value)
+{
+	SkipBlanks();
+
+	WCHAR quote = *at;
+
+	if( quote != L'\'' && quote != L'"' )
+		return FALSE;
+
+	LPCWSTR end = wcschr(at + 1, quote);
+
+	if( end == NULL )
+		return FALSE;
+
+	value->assign(at + 1, end - at - 1);
+	at = end + 1;
+
+	return TRUE;
+}
+
+
+BOOL XPathQuery::ReadOperator(OPERATOR *op)
+{
+	if( Accept(L"!=") )
+		*op = OP_NOT_EQUAL;
+	else if( Accept(L"<=") )
+		*op = OP_LESS_EQUAL;
+	else if( Accept(L">=") )
+		*op = OP_GREATER_EQUAL;
+	else if( Accept(L"=") )
+		*op = OP_EQUAL;
+	else if( Accept(L"<") )
+		*op = OP_LESS;
+	else if( Accept(L">") )
+		*op = OP_GREATER;
+	else
+		return FALSE;
+
+	return TRUE;
+}
+
+
+void XPathQuery::SkipBlanks()
+{
+	while( iswspace(*at) )
+		at++;
+}
+
+
+/****
+ * XPathQuery::Matches
+ *
+ * DESC:
+ *     Tests an event against the compiled query
+ *
+ * ARGS:
+ *     record - its System fields
+ *     keywords - its keywords, which SOURCE_RECORD does not carry
+ *
+ * RETURNS:
+ *     TRUE if the query selects the event
+ */
+BOOL XPathQuery::Matches(const SOURCE_RECORD *record, DWORD64 keywords) const
+{
+	return nodes.empty() || Evaluate(nodes.size() - 1, record, keywords);
+}
+
+
+BOOL XPathQuery::Evaluate(size_t index, const SOURCE_RECORD *record, DWORD64 keywords) const
+{
+	const NODE &node = nodes[index];
+	DWORD64 value = 0;
+
+	switch( node.kind ) {
+	case NODE_AND:
+		return Evaluate(node.left, record, keywords) && Evaluate(node.right, record, keywords);
+	case NODE_OR:
+		return Evaluate(node.left, record, keywords) || Evaluate(node.right, record, keywords);
+	case NODE_BAND:
+		return (keywords & node.value) != 0;
+	case NODE_PROVIDER:
+		return (node.name == record->provider) == (node.op == OP_EQUAL);
+	case NODE_COMPARE:
+		break;
+	}
+
+	switch( node.field ) {
+	case FIELD_EVENT_ID: value = record->eventId; break;
+	case FIELD_RECORD_ID: value = record->recordId; break;
+	case FIELD_LEVEL: value = record->level; break;
+	case FIELD_TASK: value = record->task; break;
+	case FIELD_VERSION: value = record->version; break;
+	}
+
+	switch( node.op ) {
+	case OP_EQUAL: return value == node.value;
+	case OP_NOT_EQUAL: return value != node.value;
+	case OP_LESS: return value < node.value;
+	case OP_LESS_EQUAL: return value <= node.value;
+	case OP_GREATER: return value > node.value;
+	case OP_GREATER_EQUAL: return value >= node.value;
+	}
+
+	return FALSE;
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include "Platform.h"
+#include "SourceRecord.h"
+#include <string>
+#include <vector>
+
+/****
+ * XPathQuery
+ *
+ * DESC:
+ *     The part of the event log's XPath query language that tests System
+ *     fields, so the non-Windows sources can select events the way
+ *     EvtQuery does. Parse compiles a query once; Matches tests an event
+ *
+ * REMARKS:
+ *     A query is "*", or "*[...]" holding tests joined by and, or and
+ *     parentheses:
+ *
+ *         System/EventID = 4624       (also EventRecordID, Level, Task and
+ *                                      Version, with = != < <= > >=)
+ *         System[EventID = 4624 and Level <= 3]
+ *         System[Provider[@Name='A' or @Name="B"]]
+ *         System[band(Keywords,9007199254740992)]
+ *
+ *     That covers the queries the Perl module writes, the ones EventCursor
+ *     narrows them to and those EventFilter compiles. Anything else fails
+ *     with ERROR_EVT_INVALID_QUERY rather than selecting the wrong events.
+ *     Provider names are compared as they are, and "<" must not be written
+ *     as "&lt;".
+ */
+class XPathQuery {
+public:
+	XPathQuery();
+
+	BOOL Parse(LPCWSTR query);
+	BOOL All() const { return nodes.empty(); }
+	BOOL Matches(const SOURCE_RECORD *record, DWORD64 keywords) const;
+
+private:
+	enum NODE_KIND {
+		NODE_AND,
+		NODE_OR,
+		NODE_COMPARE,
+		NODE_BAND,
+		NODE_PROVIDER
+	};
+
+	enum FIELD {
+		FIELD_EVENT_ID,
+		FIELD_RECORD_ID,
+		FIELD_LEVEL,
+		FIELD_TASK,
+		FIELD_VERSION
+	};
+
+	enum OPERATOR {
+		OP_EQUAL,
+		OP_NOT_EQUAL,
+		OP_LESS,
+		OP_LESS_EQUAL,
+		OP_GREATER,
+		OP_GREATER_EQUAL
+	};
+
+	// Where a test is written, which decides how it names a field
+	enum SCOPE {
+		SCOPE_EVENT,
+		SCOPE_SYSTEM,
+		SCOPE_PROVIDER
+	};
+
+	struct NODE {
+		NODE_KIND kind;
+		FIELD field;
+		OPERATOR op;
+		DWORD64 value;
+		std::wstring name;
+		size_t left;
+		size_t right;
+	};
+
+	int ParseOr(SCOPE scope);
+	int ParseAnd(SCOPE scope);
+	int ParseTest(SCOPE scope);
+	int ParseCompare(FIELD field);
+	int AddNode(NODE_KIND kind, size_t left, size_t right);
+
+	BOOL Accept(LPCWSTR token);
+	BOOL ReadName(std::wstring *name);
+	BOOL ReadNumber(DWORD64 *value);
+	BOOL ReadString(std::wstring *value);
+	BOOL ReadOperator(OPERATOR *op);
+	void SkipBlanks();
+
+	BOOL Evaluate(size_t node, const SOURCE_RECORD *record, DWORD64 keywords) const;
+
+	// Compiled tests, the root last (none for a query that selects all)
+	std::vector<NODE> nodes;
+
+	// Where Parse is up to in the query
+	LPCWSTR at;
+};
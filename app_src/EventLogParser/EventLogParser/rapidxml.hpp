@@ -246,6 +246,14 @@ namespace rapidxml
     //! See xml_document::parse() function.
     const int parse_normalize_whitespace = 0x800;
 
+    //! Parse flag instructing the parser to stop as soon as the first child element of the root element is closed.
+    //! The root element then holds only that child, and the text after it is neither parsed nor modified
+    //! (no entity translation, whitespace handling or zero terminators happen there).
+    //! Can be combined with other flags by use of | operator.
+    //! <br><br>
+    //! See xml_document::parse() function.
+    const int parse_first_child_only = 0x1000;
+
     // Compound flags
     
     //! Parse flags which represent default behaviour of the parser. 
@@ -315,6 +323,14 @@ namespace rapidxml
             return tmp - p;
         }
 
+        // The lookup tables cover single bytes. A wider character (e.g. a
+        // wchar_t above 255) must not be looked up by its low byte alone
+        template<class Ch>
+        inline bool is_wide(Ch ch)
+        {
+            return sizeof(Ch) > 1 && static_cast<unsigned long>(ch) > 255;
+        }
+
         // Compare strings for equality
         template<class Ch>
         inline bool compare(const Ch *p1, std::size_t size1, const Ch *p2, std::size_t size2, bool case_sensitive)
@@ -330,7 +346,7 @@ namespace rapidxml
             else
             {
                 for (const Ch *end = p1 + size1; p1 < end; ++p1, ++p2)
-                    if (lookup_tables<0>::lookup_upcase[static_cast<unsigned char>(*p1)] != lookup_tables<0>::lookup_upcase[static_cast<unsigned char>(*p2)])
+                    if (is_wide(*p1) || is_wide(*p2) ? *p1 != *p2 : lookup_tables<0>::lookup_upcase[static_cast<unsigned char>(*p1)] != lookup_tables<0>::lookup_upcase[static_cast<unsigned char>(*p2)])
                         return false;
             }
             return true;
@@ -1363,6 +1379,8 @@ namespace rapidxml
         //! Constructs empty XML document
         xml_document()
             : xml_node<Ch>(node_document)
+            , m_depth(0)
+            , m_stopped(false)
         {
         }
 
@@ -1385,6 +1403,8 @@ namespace rapidxml
             // Remove current contents
             this->remove_all_nodes();
             this->remove_all_attributes();
+            m_depth = 0;
+            m_stopped = false;
             
             // Parse BOM, if any
             parse_bom<Flags>(text);
@@ -1403,6 +1423,8 @@ namespace rapidxml
                     ++text;     // Skip '<'
                     if (xml_node<Ch> *node = parse_node<Flags>(text))
                         this->append_node(node);
+                    if ((Flags & parse_first_child_only) && m_stopped)
+                        break;
                 }
                 else
                     RAPIDXML_PARSE_ERROR("expected <", text);
@@ -1429,7 +1451,7 @@ namespace rapidxml
         {
             static unsigned char test(Ch ch)
             {
-                return internal::lookup_tables<0>::lookup_whitespace[static_cast<unsigned char>(ch)];
+                return internal::is_wide(ch) ? 0 : internal::lookup_tables<0>::lookup_whitespace[static_cast<unsigned char>(ch)];
             }
         };
 
@@ -1438,7 +1460,7 @@ namespace rapidxml
         {
             static unsigned char test(Ch ch)
             {
-                return internal::lookup_tables<0>::lookup_node_name[static_cast<unsigned char>(ch)];
+                return internal::is_wide(ch) ? 1 : internal::lookup_tables<0>::lookup_node_name[static_cast<unsigned char>(ch)];
             }
         };
 
@@ -1447,7 +1469,7 @@ namespace rapidxml
         {
             static unsigned char test(Ch ch)
             {
-                return internal::lookup_tables<0>::lookup_attribute_name[static_cast<unsigned char>(ch)];
+                return internal::is_wide(ch) ? 1 : internal::lookup_tables<0>::lookup_attribute_name[static_cast<unsigned char>(ch)];
             }
         };
 
@@ -1456,7 +1478,7 @@ namespace rapidxml
         {
             static unsigned char test(Ch ch)
             {
-                return internal::lookup_tables<0>::lookup_text[static_cast<unsigned char>(ch)];
+                return internal::is_wide(ch) ? 1 : internal::lookup_tables<0>::lookup_text[static_cast<unsigned char>(ch)];
             }
         };
 
@@ -1465,7 +1487,7 @@ namespace rapidxml
         {
             static unsigned char test(Ch ch)
             {
-                return internal::lookup_tables<0>::lookup_text_pure_no_ws[static_cast<unsigned char>(ch)];
+                return internal::is_wide(ch) ? 1 : internal::lookup_tables<0>::lookup_text_pure_no_ws[static_cast<unsigned char>(ch)];
             }
         };
 
@@ -1474,7 +1496,7 @@ namespace rapidxml
         {
             static unsigned char test(Ch ch)
             {
-                return internal::lookup_tables<0>::lookup_text_pure_with_ws[static_cast<unsigned char>(ch)];
+                return internal::is_wide(ch) ? 1 : internal::lookup_tables<0>::lookup_text_pure_with_ws[static_cast<unsigned char>(ch)];
             }
         };
 
@@ -1485,9 +1507,9 @@ namespace rapidxml
             static unsigned char test(Ch ch)
             {
                 if (Quote == Ch('\''))
-                    return internal::lookup_tables<0>::lookup_attribute_data_1[static_cast<unsigned char>(ch)];
+                    return internal::is_wide(ch) ? 1 : internal::lookup_tables<0>::lookup_attribute_data_1[static_cast<unsigned char>(ch)];
                 if (Quote == Ch('\"'))
-                    return internal::lookup_tables<0>::lookup_attribute_data_2[static_cast<unsigned char>(ch)];
+                    return internal::is_wide(ch) ? 1 : internal::lookup_tables<0>::lookup_attribute_data_2[static_cast<unsigned char>(ch)];
                 return 0;       // Should never be executed, to avoid warnings on Comeau
             }
         };
@@ -1499,9 +1521,9 @@ namespace rapidxml
             static unsigned char test(Ch ch)
             {
                 if (Quote == Ch('\''))
-                    return internal::lookup_tables<0>::lookup_attribute_data_1_pure[static_cast<unsigned char>(ch)];
+                    return internal::is_wide(ch) ? 1 : internal::lookup_tables<0>::lookup_attribute_data_1_pure[static_cast<unsigned char>(ch)];
                 if (Quote == Ch('\"'))
-                    return internal::lookup_tables<0>::lookup_attribute_data_2_pure[static_cast<unsigned char>(ch)];
+                    return internal::is_wide(ch) ? 1 : internal::lookup_tables<0>::lookup_attribute_data_2_pure[static_cast<unsigned char>(ch)];
                 return 0;       // Should never be executed, to avoid warnings on Comeau
             }
         };
@@ -1654,7 +1676,7 @@ namespace rapidxml
                                 src += 3;   // Skip &#x
                                 while (1)
                                 {
-                                    unsigned char digit = internal::lookup_tables<0>::lookup_digits[static_cast<unsigned char>(*src)];
+                                    unsigned char digit = internal::is_wide(*src) ? 0xFF : internal::lookup_tables<0>::lookup_digits[static_cast<unsigned char>(*src)];
                                     if (digit == 0xFF)
                                         break;
                                     code = code * 16 + digit;
@@ -1668,7 +1690,7 @@ namespace rapidxml
                                 src += 2;   // Skip &#
                                 while (1)
                                 {
-                                    unsigned char digit = internal::lookup_tables<0>::lookup_digits[static_cast<unsigned char>(*src)];
+                                    unsigned char digit = internal::is_wide(*src) ? 0xFF : internal::lookup_tables<0>::lookup_digits[static_cast<unsigned char>(*src)];
                                     if (digit == 0xFF)
                                         break;
                                     code = code * 10 + digit;
@@ -2056,7 +2078,11 @@ namespace rapidxml
             if (*text == Ch('>'))
             {
                 ++text;
+                if (Flags & parse_first_child_only)
+                    ++m_depth;
                 parse_node_contents<Flags>(text, element);
+                if (Flags & parse_first_child_only)
+                    --m_depth;
             }
             else if (*text == Ch('/'))
             {
@@ -2215,7 +2241,16 @@ namespace rapidxml
                         // Child node
                         ++text;     // Skip '<'
                         if (xml_node<Ch> *child = parse_node<Flags>(text))
+                        {
                             node->append_node(child);
+
+                            // First child element of the root closed: stop here
+                            if ((Flags & parse_first_child_only) && m_depth == 1 && child->type() == node_element)
+                            {
+                                m_stopped = true;
+                                return;
+                            }
+                        }
                     }
                     break;
 
@@ -2297,6 +2332,9 @@ namespace rapidxml
             }
         }
 
+        int m_depth;        // Elements open while parsing with rapidxml::parse_first_child_only
+        bool m_stopped;     // Set once rapidxml::parse_first_child_only has what it wanted
+
     };
 
     //! \cond internal
@@ -4,6 +4,34 @@ use strict;
 use feature qw( say );
 use Carp;
 use Data::Dumper;
+use Encode;
+
+# Win32 error codes returned by ReadEventsToUtf8Buffer
+use constant ERROR_INSUFFICIENT_BUFFER => 122;
+use constant ERROR_MORE_DATA => 234;
+
+# Bytes in the buffer read_events starts out with
+use constant READ_BUFFER_BYTES => 512 * 1024;
+
+# Events read_events asks for per call when not given a maximum
+use constant READ_BATCH => 1000;
+
+# Characters of room for a bookmark, to start with
+use constant BOOKMARK_CHARS => 1024;
+
+# RECORD_FIELD_* flags of a binary record, and the keys its fields get,
+# in the order they are written (see EncodeBinaryRecord)
+use constant BINARY_FIELDS => (
+	[ 0x0001, 'record_id', 'Q<' ],
+	[ 0x0020, 'time_created', 'Q<' ],
+	[ 0x0002, 'event_id', 'v' ],
+	[ 0x0040, 'task', 'v' ],
+	[ 0x0080, 'level', 'C' ],
+	[ 0x0004, 'logname', 'V/a' ],
+	[ 0x0008, 'source', 'V/a' ],
+	[ 0x0010, 'computer', 'V/a' ],
+	[ 0x0100, 'message', 'V/a' ],
+);
 
 sub new {
 	# Verify required number of arguments
@@ -63,6 +91,10 @@ sub get_last_record_id {
 	return $result;
 }
 
+# Prints the events of a log to STDOUT, newest first. With forward they
+# come oldest first instead, at most max of them (or maxbytes bytes), and
+# it returns the last record ID read and whether there are more; starting
+# the next call after that record carries on where this one stopped
 sub parse {
 	my $self = shift;						# This object
 	my (%args) = @_;						# Remaining arguments
@@ -71,6 +103,10 @@ sub parse {
 	my $startRec = $args{startrec} || 0;	# Record to start reading from
 	my $endRec = $args{endrec} || 0;		# Record to stop reading at
 	my $events = $args{eventfilter};		# Array of events IDs to filter		
+	my $fields = $args{fields};				# Record fields wanted, if not all
+	my $forward = $args{forward};			# 1=oldest first, within max and maxbytes
+	my $max = $args{max} || 0;				# Most events to print, 0 for all
+	my $maxBytes = $args{maxbytes} || 0;	# Most bytes of them, 0 for no limit
 
 	croak "endRec must be >= 0" 
 		if $endRec < 0;
@@ -84,7 +120,10 @@ sub parse {
 		events => $events
 	};
 
-	$self->_parse_event_log( $logName, $useCsv, $filters );
+	return $self->_parse_event_log_forward( $logName, $filters, $fields, $max, $maxBytes )
+		if $forward;
+
+	$self->_parse_event_log( $logName, $useCsv, $filters, $fields );
 }
 
 sub open_session {
@@ -93,7 +132,7 @@ sub open_session {
 	my $openSession = Win32::API::More->new(
 		'EventLogParser', 
 		'OpenSession', 
-		'PPPI', 
+		'PPPPI', 
 		'N'
 	);
 	
@@ -126,23 +165,546 @@ sub close_handle {
 	return $result;
 }
 
+# Prints up to $max_events (default 100) new events of the query opened
+# by start_session and returns how many were printed (0 when none are new)
 sub read_next_event {
-	my ($self, $remote_handle, $event_handle) = @_;
+	my ($self, $remote_handle, $event_handle, $max_events) = @_;
 	
 	my $fn = Win32::API::More->new(
 		'EventLogParser', 
 		'ReadNextEvent', 
-		'PPI', 
+		'NNII', 
+		'N'
+	);
+	
+	croak "Error: $^E" if !$fn;	
+
+	my $result = $fn->Call( $remote_handle, $event_handle, $max_events || 0, $self->{debug} );
+	
+	return $result;
+}
+
+# Has the records of a session carry the EventData fields of their event,
+# by name, as an "event_data" object. Takes a list of names (or one string
+# of them, comma separated), '*' or an empty list for all of them, or undef
+# to stop adding them
+sub set_event_data {
+	my ($self, $handle, $names) = @_;
+
+	my $fn = Win32::API::More->new(
+		'EventLogParser', 
+		'SetEventDataFields', 
+		'NPI', 
+		'N'
+	);
+	
+	croak "Error: $^E" if !$fn;	
+
+	# NULL turns them off, an empty string selects all of them
+	my $list = defined $names ? $self->_to_wchar( ref $names ? join(',', @$names) : $names ) : undef;
+
+	my $result = $fn->Call( $handle, $list, $self->{debug} );
+	
+	return $result;
+}
+
+# Has the records of a session carry only the fields named (record_id,
+# event_id, logname, source, computer, time_created, task, level and
+# message), as a list or one comma separated string. undef or an empty
+# list for all of them. Without message, no message is formatted
+sub set_record_fields {
+	my ($self, $handle, $fields) = @_;
+
+	my $fn = Win32::API::More->new(
+		'EventLogParser', 
+		'SetRecordFields', 
+		'NPI', 
+		'N'
+	);
+	
+	croak "Error: $^E" if !$fn;	
+
+	my $list = defined $fields ? $self->_to_wchar( ref $fields ? join(',', @$fields) : $fields ) : undef;
+
+	my $result = $fn->Call( $handle, $list, $self->{debug} );
+
+	croak "Unknown record field in '$fields'" if !$result;
+	
+	return $result;
+}
+
+# Has the records of logon, logoff and NPS events (4624, 4634, 4647 and
+# 6272-6278) carry who logged on or off, as an "identity" object with
+# user, domain, logon_id, logon_type, source, workstation and state
+sub set_identity {
+	my ($self, $handle, $enable) = @_;
+
+	my $fn = Win32::API::More->new(
+		'EventLogParser', 
+		'SetIdentityExtraction', 
+		'NII', 
+		'N'
+	);
+	
+	croak "Error: $^E" if !$fn;	
+
+	my $result = $fn->Call( $handle, $enable ? 1 : 0, $self->{debug} );
+	
+	return $result;
+}
+
+# Has a session's events read as IPFIX data records of the EpEventLog
+# template (see read_events), with the machine ID every record carries,
+# the ID the exporter gave the template and the most bytes of each data
+# set (0 or undef for 1442, what fits in a datagram after the message
+# header)
+sub set_ipfix {
+	my ($self, $handle, $machineId, $templateId, $setBytes) = @_;
+
+	my $fn = Win32::API::More->new(
+		'EventLogParser', 
+		'SetIpfixExport', 
+		'NPNNI', 
 		'N'
 	);
 	
 	croak "Error: $^E" if !$fn;	
 
-	my $result = $fn->Call( $remote_handle, $event_handle, $self->{debug} );
+	my $result = $fn->Call( $handle, $self->_to_wchar($machineId // ''), $templateId, $setBytes || 0, $self->{debug} );
 	
 	return $result;
 }
 
+# Has the events of a session read as IPFIX merged into flows: those of
+# the same log, event ID, source and message (numbers aside) no more than
+# window seconds apart go out as one record with their count. A window
+# of 0 or undef writes a record per event again. flows is the most kept
+# open at once (0 or undef for 4096). The flows go out as the template
+# flowId (EpEventLogFlow, flow cache 30), or as minedFlowId
+# (EpEventLogMinedFlow, 31) when their messages are mined
+sub set_ipfix_aggregation {
+	my ($self, $handle, $window, $flows, $flowId, $minedFlowId) = @_;
+
+	my $fn = Win32::API::More->new(
+		'EventLogParser', 
+		'SetIpfixAggregation', 
+		'NNNNNI', 
+		'N'
+	);
+	
+	croak "Error: $^E" if !$fn;	
+
+	my $result = $fn->Call( $handle, $window || 0, $flows || 0, $flowId || 0, $minedFlowId || 0, $self->{debug} );
+	
+	return $result;
+}
+
+# Has the messages of a session's IPFIX records sent as the ID of their
+# template and their parameters, as records of the EpEventLogMined
+# template, with each template's text sent ahead of them in an
+# oMessageTemplate options record, and again when it changes. minedId and
+# announceId are the IDs the exporter gave those templates; a minedId of
+# 0 or undef sends messages whole again. templates is the most kept (0
+# or undef for 4096); messages that fit none once there are that many go
+# out whole
+sub set_ipfix_mining {
+	my ($self, $handle, $minedId, $announceId, $templates) = @_;
+
+	my $fn = Win32::API::More->new(
+		'EventLogParser', 
+		'SetIpfixMining', 
+		'NNNNI', 
+		'N'
+	);
+	
+	croak "Error: $^E" if !$fn;	
+
+	my $result = $fn->Call( $handle, $minedId || 0, $announceId || 0, $templates || 0, $self->{debug} );
+	
+	return $result;
+}
+
+# How the messages of a session's events are formatted: 'remote' (by
+# EvtFormatMessage, one call each), 'local' (from cached templates) or
+# 'verify' (local, with every Nth message checked remotely)
+sub set_messages {
+	my ($self, $handle, $mode, $verifyEvery) = @_;
+
+	my %modes = ( remote => 0, local => 1, verify => 2 );
+
+	croak "Unknown message formatting '$mode'"
+		if !exists $modes{$mode};
+
+	my $fn = Win32::API::More->new(
+		'EventLogParser', 
+		'SetMessageFormatting', 
+		'NINI', 
+		'N'
+	);
+	
+	croak "Error: $^E" if !$fn;	
+
+	my $result = $fn->Call( $handle, $modes{$mode}, $verifyEvery || 0, $self->{debug} );
+	
+	return $result;
+}
+
+# Reads the new events of a log straight into memory, through a session
+# and query that stay open between calls. Returns the last record ID read
+# (where the next call should start) and the records, as UTF-8 JSON,
+# oldest first. max and maxbytes bound how many records, and how many
+# bytes of them (each counted with the null it ends with), one call reads.
+#
+# The query is started over, from startrec, whenever startrec is not
+# where the previous call left off. With eventdata (see set_event_data)
+# each record also has the named EventData fields of its event, and with
+# identity (see set_identity) the identity of its logon or logoff.
+# messages picks how their messages are formatted (see set_messages) and
+# fields which fields they have (see set_record_fields).
+#
+# Given a bookmark (empty for none yet), the events come from a
+# subscription instead, which the event log service keeps feeding, so
+# later calls never query again. It carries on after the bookmark, or
+# starts at startrec without one. With wait, a call that finds nothing
+# new waits that many milliseconds for events. get_bookmark says where
+# it got to, to pass in next time
+#
+# With catchup, a query started over reads the backlog from startrec to
+# the newest record over that many sessions to the host at once (see
+# start_catch_up), then reads on as any other
+#
+# With binary, the parser writes binary records instead, and they come
+# back already decoded (see decode_binary_records); maxbytes then counts
+# their bytes. A catch-up cannot be read that way
+#
+# With ipfix, a hash of machineid, templateid and setbytes (see
+# set_ipfix), what comes back is IPFIX data sets of the EpEventLog
+# template instead, each ready to go out after a message header, and
+# none of the records is decoded. max still counts records; maxbytes
+# counts the bytes of the sets. A catch-up cannot be read that way either.
+# With window and flowtemplateid (and flows and minedflowtemplateid) in
+# the hash too, the events are merged into flows (see
+# set_ipfix_aggregation): the sets hold the flows that have closed, as
+# EpEventLogFlow records, and max counts the events read. flush_ipfix
+# writes the rest.
+# With minedtemplateid and announcetemplateid (and templates) too, the
+# messages go out as their templates and parameters (see
+# set_ipfix_mining), in sets of those two templates among the others.
+# announce_ipfix sends the text of every template again
+sub read_events {
+	my $self = shift;						# This object
+	my (%args) = @_;						# Remaining arguments
+	my $logName = $args{eventlog};			# Log name (e.g. Application)
+	my $startRec = $args{startrec} || 0;	# Record to start reading from
+	my $max = $args{max} || 0;				# Most events to read, 0 for all
+	my $maxBytes = $args{maxbytes} || 0;	# Most bytes of them, 0 for no limit
+	my $events = $args{eventfilter};		# Array of events IDs to filter
+	my $eventData = $args{eventdata};		# EventData fields to add, if any
+	my $identity = $args{identity} ? 1 : 0;	# 1=add identities
+	my $messages = $args{messages} || 'remote';	# remote, local or verify
+	my $fields = $args{fields};				# Record fields wanted, if not all
+	my $subscribe = exists $args{bookmark};	# 1=read from a subscription
+	my $bookmark = $args{bookmark} // '';	# Where it carries on from
+	my $wait = $args{wait} || 0;			# ms to wait for new events
+	my $catchUp = $args{catchup} || 0;		# Sessions to catch up over, if more than 1
+	my $binary = $args{binary} ? 1 : 0;		# 1=read binary records
+	my $ipfix = $args{ipfix};				# How to read IPFIX data sets, if so
+	my @records;
+	my $count = 0;
+
+	croak "A catch-up cannot be read as binary records"
+		if ($binary || $ipfix) && $catchUp > 1;
+
+	croak "Records are read as binary or as IPFIX, not both"
+		if $binary && $ipfix;
+
+	my $cursor = $self->{cursors}{$logName};
+
+	# A subscription is kept for as long as it is asked to go on from
+	# where it is
+	my $restart = $subscribe
+		? !$cursor || !$cursor->{subscribed} || ($bookmark ne '' && $bookmark ne $cursor->{bookmark})
+		: !$cursor || $cursor->{subscribed} || $cursor->{last} != $startRec;
+
+	if( $restart ) {
+		$self->_close_cursor($logName);
+
+		$self->{session} ||= $self->open_session();
+		croak "Could not open a session to $self->{server}"
+			if !$self->{session};
+
+		my %start = (
+			handle => $self->{session},
+			eventlog => $logName,
+			startrec => $startRec,
+			eventfilter => $events
+		);
+
+		my $handle = $subscribe
+			? $self->start_subscription( %start, bookmark => $bookmark, wait => $wait )
+			: $catchUp > 1
+			? $self->start_catch_up( %start, sessions => $catchUp )
+			: $self->start_session( %start );
+		croak "Could not query the $logName log on $self->{server}"
+			if !$handle;
+
+		$cursor = $self->{cursors}{$logName} = {
+			handle => $handle,
+			last => $startRec,
+			subscribed => $subscribe,
+			bookmark => $bookmark
+		};
+	}
+
+	# The fields belong to the session, so it is only told when they change
+	my $eventDataNames = defined $eventData ? ( ref $eventData ? join(',', @$eventData) : $eventData ) : undef;
+
+	if( ($eventDataNames // "\0") ne ($self->{event_data} // "\0") ) {
+		$self->set_event_data( $self->{session}, $eventDataNames );
+		$self->{event_data} = $eventDataNames;
+	}
+
+	if( $identity != ($self->{identity} || 0) ) {
+		$self->set_identity( $self->{session}, $identity );
+		$self->{identity} = $identity;
+	}
+
+	my $fieldNames = defined $fields ? ( ref $fields ? join(',', @$fields) : $fields ) : '';
+
+	if( $fieldNames ne ($self->{record_fields} // '') ) {
+		$self->set_record_fields( $self->{session}, $fieldNames );
+		$self->{record_fields} = $fieldNames;
+	}
+
+	if( $messages ne ($self->{messages} || 'remote') ) {
+		$self->set_messages( $self->{session}, $messages );
+		$self->{messages} = $messages;
+	}
+
+	my $ipfixSetup = $ipfix ? join( "\0", map { $ipfix->{$_} // '' } qw( machineid templateid setbytes ) ) : '';
+
+	if( $ipfix && $ipfixSetup ne ($self->{ipfix} // '') ) {
+		$self->set_ipfix( $self->{session}, @{$ipfix}{qw( machineid templateid setbytes )} )
+			or croak "Could not set up IPFIX template $ipfix->{templateid}";
+		$self->{ipfix} = $ipfixSetup;
+	}
+
+	my $flowSetup = $ipfix ? join( "\0", map { $ipfix->{$_} || 0 } qw( window flows flowtemplateid minedflowtemplateid ) ) : '';
+
+	if( $ipfix && $flowSetup ne ($self->{ipfix_flows} // join( "\0", 0, 0, 0, 0 )) ) {
+		$self->set_ipfix_aggregation( $self->{session}, @{$ipfix}{qw( window flows flowtemplateid minedflowtemplateid )} )
+			or croak "Could not merge IPFIX records over $ipfix->{window} seconds";
+		$self->{ipfix_flows} = $flowSetup;
+	}
+
+	my $miningSetup = $ipfix ? join( "\0", map { $ipfix->{$_} || 0 } qw( minedtemplateid announcetemplateid templates ) ) : '';
+
+	if( $ipfix && $miningSetup ne ($self->{ipfix_mining} // join( "\0", 0, 0, 0 )) ) {
+		$self->set_ipfix_mining( $self->{session}, @{$ipfix}{qw( minedtemplateid announcetemplateid templates )} )
+			or croak "Could not mine IPFIX messages into templates $ipfix->{minedtemplateid} and $ipfix->{announcetemplateid}";
+		$self->{ipfix_mining} = $miningSetup;
+	}
+
+	my $fn = Win32::API::More->new(
+		'EventLogParser', 
+		$ipfix ? 'ReadEventsToIpfixBuffer' : $binary ? 'ReadEventsToBinaryBuffer' : 'ReadEventsToUtf8Buffer', 
+		'NNPIIPI', 
+		'N'
+	);
+	
+	croak "Error: $^E" if !$fn;	
+
+	$self->{buffer_bytes} ||= READ_BUFFER_BYTES;
+
+	my $bytes = 0;
+
+	while( (!$max || $count < $max) && (!$maxBytes || $bytes < $maxBytes) ) {
+		my $wanted = $max ? $max - $count : READ_BATCH;
+
+		# The buffer is no larger than what is left of the byte budget, so
+		# the parser stops at it
+		my $room = $maxBytes && $maxBytes - $bytes < $self->{buffer_bytes} ? $maxBytes - $bytes : $self->{buffer_bytes};
+		my $buffer = "\0" x $room;
+		my $result = "\0" x 24;
+
+		my $written = $fn->Call( $self->{session}, $cursor->{handle}, $buffer, $room, $wanted, $result, $self->{debug} );
+		my ($read, $used, $required, $status, $last) = unpack('LLLLQ', $result);
+
+		if( $status == ERROR_INSUFFICIENT_BUFFER ) {
+			# The budget is spent, short of the next record
+			last if $room < $self->{buffer_bytes} && $count;
+
+			# Not even one record fit. Make room for it and ask again; a
+			# budget smaller than one record still reads that record
+			$self->{buffer_bytes} = $required * 2 if $required > $self->{buffer_bytes};
+			$maxBytes = $required if $maxBytes && $maxBytes < $required;
+			next;
+		}
+
+		croak "Reading the $logName log failed with error $status"
+			if $status && $status != ERROR_MORE_DATA;
+
+		# Records are null terminated UTF-8, back to back, already encoded
+		# by the parser, or binary records that carry their own length, or
+		# IPFIX data sets that carry theirs
+		push( @records, $ipfix
+			? Plixer::EventLog->split_ipfix_sets( substr($buffer, 0, $used) )
+			: $binary
+			? Plixer::EventLog->decode_binary_records( substr($buffer, 0, $used) )
+			: split( /\0/, substr($buffer, 0, $used) ) );
+
+		$count += $read;
+		$bytes += $used;
+		$cursor->{last} = $last if $written;
+
+		# Everything there is for now has been read
+		last if $status != ERROR_MORE_DATA && $written < $wanted;
+	}
+
+	$cursor->{bookmark} = $self->_get_bookmark( $cursor->{handle} ) // $cursor->{bookmark}
+		if $cursor->{subscribed};
+
+	return ($cursor->{last}, @records);
+}
+
+# Writes the flows read_events still has open, for every log, as IPFIX
+# data sets, and returns them. What was read with window merges no more
+# events until the next read_events; call this before close_all, which
+# loses the flows still open
+sub flush_ipfix {
+	my $self = shift;
+	my @sets;
+
+	return @sets if !$self->{session} || !$self->{ipfix};
+
+	my $fn = Win32::API::More->new(
+		'EventLogParser', 
+		'FlushIpfixFlows', 
+		'NPNPI', 
+		'N'
+	);
+	
+	croak "Error: $^E" if !$fn;	
+
+	$self->{buffer_bytes} ||= READ_BUFFER_BYTES;
+
+	while( 1 ) {
+		my $buffer = "\0" x $self->{buffer_bytes};
+		my $result = "\0" x 24;
+
+		$fn->Call( $self->{session}, $buffer, $self->{buffer_bytes}, $result, $self->{debug} );
+		my ($flows, $used, $required, $status) = unpack('LLLL', $result);
+
+		if( $status == ERROR_INSUFFICIENT_BUFFER ) {
+			$self->{buffer_bytes} = $required * 2;
+			next;
+		}
+
+		croak "Writing the IPFIX flows failed with error $status"
+			if $status && $status != ERROR_MORE_DATA;
+
+		push( @sets, Plixer::EventLog->split_ipfix_sets( substr($buffer, 0, $used) ) );
+
+		last if $status != ERROR_MORE_DATA;
+	}
+
+	return @sets;
+}
+
+# Writes the text of every message template read_events has found, as
+# oMessageTemplate records in IPFIX data sets, and returns them. Send
+# them every so often, as options templates are, for a collector that
+# lost them or started after they were first sent. Nothing when the
+# messages are not mined (see set_ipfix_mining)
+sub announce_ipfix {
+	my $self = shift;
+	my @sets;
+	my ($minedId) = split( /\0/, $self->{ipfix_mining} // '' );
+
+	return @sets if !$self->{session} || !$minedId;
+
+	my $fn = Win32::API::More->new(
+		'EventLogParser', 
+		'AnnounceIpfixTemplates', 
+		'NNPNPI', 
+		'N'
+	);
+	
+	croak "Error: $^E" if !$fn;	
+
+	$self->{buffer_bytes} ||= READ_BUFFER_BYTES;
+
+	my $first = 1;
+
+	while( 1 ) {
+		my $buffer = "\0" x $self->{buffer_bytes};
+		my $result = "\0" x 24;
+
+		$fn->Call( $self->{session}, $first, $buffer, $self->{buffer_bytes}, $result, $self->{debug} );
+		my ($templates, $used, $required, $status, $last) = unpack('LLLLQ', $result);
+
+		if( $status == ERROR_INSUFFICIENT_BUFFER ) {
+			$self->{buffer_bytes} = $required * 2;
+			next;
+		}
+
+		croak "Announcing the message templates failed with error $status"
+			if $status && $status != ERROR_MORE_DATA;
+
+		push( @sets, Plixer::EventLog->split_ipfix_sets( substr($buffer, 0, $used) ) );
+
+		last if $status != ERROR_MORE_DATA;
+
+		# The rest, from the first that did not fit
+		$first = $last + 1;
+	}
+
+	return @sets;
+}
+
+# Where the subscription read_events reads a log from got to, as XML
+# to pass back as its bookmark (undef if the log is not read that way)
+sub get_bookmark {
+	my ($self, $logName) = @_;
+
+	my $cursor = $self->{cursors}{$logName};
+
+	return $cursor && $cursor->{subscribed} ? $cursor->{bookmark} : undef;
+}
+
+# Closes the sessions and queries read_events opened
+sub close_all {
+	my $self = shift;
+
+	$self->_close_cursor($_) foreach keys %{$self->{cursors} || {}};
+
+	if( $self->{session} ) {
+		$self->close_handle($self->{session});
+		delete $self->{session};
+		delete $self->{event_data};
+		delete $self->{identity};
+		delete $self->{messages};
+		delete $self->{record_fields};
+		delete $self->{ipfix};
+		delete $self->{ipfix_flows};
+		delete $self->{ipfix_mining};
+	}
+}
+
+sub DESTROY {
+	my $self = shift;
+
+	$self->close_all() if $self->{session};
+}
+
+sub _close_cursor {
+	my ($self, $logName) = @_;
+
+	my $cursor = delete $self->{cursors}{$logName};
+
+	$self->close_handle($cursor->{handle}) if $cursor;
+}
+
 sub start_session {
 	my $self = shift;						# This object
 	my (%args) = @_;						# Remaining arguments
@@ -164,9 +726,479 @@ sub start_session {
 			events => $events
 		};
 		
-		say "Handle: $handle, logName: $logName, useCsv: $useCsv";
+		say "Handle: $handle, logName: $logName, useCsv: $useCsv"
+			if $self->{debug};
 		
-		$self->_start_session( $handle, $logName, $useCsv, $filters );
+		return $self->_start_session( $handle, $logName, $useCsv, $filters );
+	}
+}
+
+sub start_subscription {
+	my $self = shift;						# This object
+	my (%args) = @_;						# Remaining arguments
+	my $handle = $args{handle};				# Handle to remote session opened
+	my $logName = $args{eventlog};			# Log name (e.g. Application)
+	my $startRec = $args{startrec} || 0;	# Record to start at, without a bookmark
+	my $events = $args{eventfilter};		# Array of events IDs to filter
+	my $bookmark = $args{bookmark} // '';	# Bookmark to carry on after
+	my $wait = $args{wait} || 0;			# ms a read waits for new events
+
+	if( !$handle ) {
+		say "No valid handle was supplied";
+		return;
+	}
+
+	my $fn = Win32::API::More->new(
+		'EventLogParser', 
+		'StartSubscription', 
+		'NPPPNI', 
+		'N'
+	);
+	
+	die "Error: $^E" if !$fn;	
+
+	my $filters = {
+		lowRecord => $startRec,
+		events => $events
+	};
+
+	say "Handle: $handle, logName: $logName, subscribing"
+		if $self->{debug};
+
+	my $result = $fn->Call(
+		$handle,
+		$self->_to_wchar($logName),
+		$self->_to_wchar( $self->_get_filter( $filters ) ),
+		$self->_to_wchar($bookmark),
+		$wait,
+		$self->{debug}
+	);
+	
+	return $result;
+}
+
+# Starts reading the backlog of a log from startrec to the newest record
+# over several sessions to the host at once, each reading a shard of
+# shardrecords record IDs at a time; the records still come back in
+# order. sessions is the most that are opened (the parser's default if 0);
+# with 1 the backlog is read as start_session would, which is quicker.
+# Read it as one from start_session; past the backlog it reads on the same
+# way. The sessions are set up as the handle's is when it starts
+sub start_catch_up {
+	my $self = shift;						# This object
+	my (%args) = @_;						# Remaining arguments
+	my $handle = $args{handle};				# Handle to remote session opened
+	my $logName = $args{eventlog};			# Log name (e.g. Application)
+	my $startRec = $args{startrec} || 0;	# Record to start reading from
+	my $events = $args{eventfilter};		# Array of events IDs to filter
+	my $sessions = $args{sessions} || 0;	# Most sessions to read over at once
+	my $shardRecords = $args{shardrecords} || 0;	# Record IDs per shard
+
+	if( !$handle ) {
+		say "No valid handle was supplied";
+		return;
+	}
+
+	my $fn = Win32::API::More->new(
+		'EventLogParser', 
+		'StartCatchUp', 
+		'NPPNNI', 
+		'N'
+	);
+	
+	die "Error: $^E" if !$fn;	
+
+	my $filters = {
+		lowRecord => $startRec,
+		events => $events
+	};
+
+	say "Handle: $handle, logName: $logName, catching up over $sessions sessions"
+		if $self->{debug};
+
+	my $result = $fn->Call(
+		$handle,
+		$self->_to_wchar($logName),
+		$self->_to_wchar( $self->_get_filter( $filters ) ),
+		$sessions,
+		$shardRecords,
+		$self->{debug}
+	);
+	
+	return $result;
+}
+
+# Opens a collector: the logs of many hosts read at once on the parser's
+# own threads, a round at a time (see collect_events). hosts is a list of
+# [ Plixer::EventLog object, { log name => { startrec, eventfilter } } ]
+# pairs; each host is connected to with that object's server and
+# credentials, and each of its logs read from startrec on with the event
+# IDs given, as read_events would. workers is how many hosts are read at
+# once, batch how many events a host's turn reads, and hostdeadline how
+# many ms a host may take in a round (the parser's defaults if 0). With a
+# session (from open_session), every host's records have its fields,
+# EventData and identities and its messages are formatted the same way
+sub open_collector {
+	my $class = shift;							# This package
+	my (%args) = @_;							# Remaining arguments
+	my $hosts = $args{hosts};					# Hosts and their logs
+	my $workers = $args{workers} || 0;			# Hosts read at once
+	my $batch = $args{batch} || 0;				# Events per turn
+	my $hostDeadline = $args{hostdeadline} || 0;	# ms per host per round
+	my $session = $args{session} || 0;			# Session to set up hosts as
+	my $debug = $args{debug} || 0;
+
+	my $open = Win32::API::More->new(
+		'EventLogParser', 
+		'OpenCollector', 
+		'NNNNI', 
+		'N'
+	);
+	my $addHost = Win32::API::More->new(
+		'EventLogParser', 
+		'AddCollectorHost', 
+		'NPPPPI', 
+		'N'
+	);
+	my $addChannel = Win32::API::More->new(
+		'EventLogParser', 
+		'AddCollectorChannel', 
+		'NNPPI', 
+		'I'
+	);
+
+	croak "Error: $^E" if !$open || !$addHost || !$addChannel;
+
+	my $handle = $open->Call( $session, $workers, $batch, $hostDeadline, $debug );
+	croak "Could not open a collector" if !$handle;
+
+	my $collector = {
+		handle => $handle,
+		hosts => [],
+		debug => $debug
+	};
+
+	foreach my $host (@$hosts) {
+		my ($log, $channels) = @$host;
+
+		my $index = $addHost->Call(
+			$handle,
+			$log->_to_wchar($log->{server}),
+			$log->_to_wchar($log->{domain}),
+			$log->_to_wchar($log->{username}),
+			$log->_to_wchar($log->{password}),
+			$debug
+		);
+		croak "Could not add $log->{server} to the collector"
+			if $index == 0xFFFFFFFF;
+
+		# The parser numbers a host's logs in the order they are added
+		my @logNames = sort keys %$channels;
+
+		foreach my $logName (@logNames) {
+			my $filters = {
+				lowRecord => $channels->{$logName}{startrec},
+				events => $channels->{$logName}{eventfilter}
+			};
+
+			$addChannel->Call( $handle, $index, $log->_to_wchar($logName), $log->_to_wchar( $log->_get_filter( $filters ) ), $debug )
+				or croak "Could not add the $logName log of $log->{server} to the collector";
+		}
+
+		push @{$collector->{hosts}}, { server => $log->{server}, eventlogs => \@logNames };
+	}
+
+	return $collector;
+}
+
+# Runs a round of a collector from open_collector: reads what is new on
+# every host, for at most deadline ms (0 for no limit but each host's).
+# Returns where each log got to, as { server => { log name => last record
+# ID } } to start from next time, and the records as [ server, log name,
+# JSON record ] triples. A host still busy at the deadline, or one that
+# failed, is caught up with in a later round
+sub collect_events {
+	my ($class, $collector, %args) = @_;
+	my $deadline = $args{deadline} || 0;		# ms the round may take
+	my @records;
+
+	my $fn = Win32::API::More->new(
+		'EventLogParser', 
+		'CollectEvents', 
+		'NNPNPI', 
+		'N'
+	);
+	my $position = Win32::API::More->new(
+		'EventLogParser', 
+		'GetCollectorChannel', 
+		'NNNPI', 
+		'I'
+	);
+
+	croak "Error: $^E" if !$fn || !$position;
+
+	$collector->{buffer_bytes} ||= READ_BUFFER_BYTES;
+
+	while( 1 ) {
+		my $buffer = "\0" x $collector->{buffer_bytes};
+		my $result = "\0" x 24;
+
+		$fn->Call( $collector->{handle}, $deadline, $buffer, $collector->{buffer_bytes}, $result, $collector->{debug} );
+		my ($read, $used, $required, $status) = unpack('LLLLQ', $result);
+
+		# Not even one record fit. Make room for it and ask again
+		if( $status == ERROR_INSUFFICIENT_BUFFER ) {
+			$collector->{buffer_bytes} = $required * 2;
+			next;
+		}
+
+		# Each record is tagged with its host and log, tab separated
+		push( @records, map { [ split( /\t/, $_, 3 ) ] } split( /\0/, substr($buffer, 0, $used) ) );
+
+		# The rest is written out by the next call
+		last if $status != ERROR_MORE_DATA;
+	}
+
+	my %last;
+
+	for( my $host = 0; $host < @{$collector->{hosts}}; $host++ ) {
+		my $logNames = $collector->{hosts}[$host]{eventlogs};
+
+		for( my $channel = 0; $channel < @$logNames; $channel++ ) {
+			my $recordId = "\0" x 8;
+
+			$position->Call( $collector->{handle}, $host, $channel, $recordId, $collector->{debug} );
+			$last{$collector->{hosts}[$host]{server}}{$logNames->[$channel]} = unpack('Q', $recordId);
+		}
+	}
+
+	return (\%last, @records);
+}
+
+# How each host of a collector got on in its last round, as { server =>
+# { status, records, turns, elapsed, failures, connected, busy } }. status
+# is 0 if it read all it had, 1460 if a deadline cut it short, or the
+# error it failed with
+sub collector_status {
+	my ($class, $collector) = @_;
+	my %status;
+
+	my $fn = Win32::API::More->new(
+		'EventLogParser', 
+		'GetCollectorHost', 
+		'NNPI', 
+		'I'
+	);
+
+	croak "Error: $^E" if !$fn;
+
+	for( my $host = 0; $host < @{$collector->{hosts}}; $host++ ) {
+		my $result = "\0" x 28;
+		my %host;
+
+		$fn->Call( $collector->{handle}, $host, $result, $collector->{debug} );
+		@host{qw( status records turns elapsed failures connected busy )} = unpack('L7', $result);
+
+		$status{$collector->{hosts}[$host]{server}} = \%host;
+	}
+
+	return \%status;
+}
+
+# Closes a collector from open_collector, once calls still going return
+sub close_collector {
+	my ($class, $collector) = @_;
+
+	my $fn = Win32::API::More->new(
+		'EventLogParser', 
+		'CloseEventHandle', 
+		'NI', 
+		'N'
+	);
+
+	croak "Error: $^E" if !$fn;
+
+	return $fn->Call( $collector->{handle}, $collector->{debug} );
+}
+
+# Sets up a miner of message templates of its own, for messages that do
+# not come from read_events, such as the msg of syslog lines (see
+# mine_message). templates is the most it keeps (0 or undef for 4096).
+# Returns the miner, or undef if it could not be set up
+sub open_template_miner {
+	my $class = shift;							# This package
+	my (%args) = @_;							# Remaining arguments
+	my $templates = $args{templates} || 0;		# Most templates kept
+	my $debug = $args{debug} || 0;
+
+	my $fn = Win32::API::More->new(
+		'EventLogParser', 
+		'OpenTemplateMiner', 
+		'NI', 
+		'N'
+	);
+
+	croak "Error: $^E" if !$fn;
+
+	my $handle = $fn->Call( $templates, $debug );
+
+	return undef if !$handle;
+
+	return { handle => $handle, debug => $debug, sent => {} };
+}
+
+# Mines a message with a miner from open_template_miner. Returns the ID of
+# its template and its parameters, a space between them, and the text of
+# the template too when this miner has not returned that version of it
+# before (send it ahead of the message, as an oMessageTemplate record
+# would be). Returns nothing when the message is to be sent whole
+sub mine_message {
+	my ($class, $miner, $message) = @_;
+
+	my $mine = Win32::API::More->new(
+		'EventLogParser', 
+		'MineMessage', 
+		'NPPNPI', 
+		'N'
+	);
+	my $getText = Win32::API::More->new(
+		'EventLogParser', 
+		'GetMinedTemplate', 
+		'NNPNI', 
+		'N'
+	);
+
+	croak "Error: $^E" if !$mine || !$getText;
+
+	# The parameters are never longer than the message
+	my $wide = encode( 'UTF-16LE', $message // '' ) . "\0\0";
+	my $chars = length($wide) / 2;
+	my $parameters = "\0" x length $wide;
+	my $version = "\0" x 4;
+
+	my $id = $mine->Call( $miner->{handle}, $wide, $parameters, $chars, $version, $miner->{debug} );
+
+	return () if !$id;
+
+	$version = unpack( 'L', $version );
+	$parameters = decode( 'UTF-16LE', $parameters );
+	$parameters =~ s/\0.*//s;
+
+	return ($id, $parameters) if ($miner->{sent}{$id} // 0) == $version;
+
+	my $needed = $getText->Call( $miner->{handle}, $id, undef, 0, $miner->{debug} );
+	my $text = "\0" x ($needed * 2);
+
+	$getText->Call( $miner->{handle}, $id, $text, $needed, $miner->{debug} );
+	$miner->{sent}{$id} = $version;
+
+	return ($id, $parameters, decode( 'UTF-16LE', substr($text, 0, ($needed - 1) * 2) ));
+}
+
+# Closes a miner from open_template_miner
+sub close_template_miner {
+	my ($class, $miner) = @_;
+
+	my $fn = Win32::API::More->new(
+		'EventLogParser', 
+		'CloseEventHandle', 
+		'NI', 
+		'N'
+	);
+
+	croak "Error: $^E" if !$fn;
+
+	return $fn->Call( $miner->{handle}, $miner->{debug} );
+}
+
+# Decodes binary records, back to back, into hashes keyed as the JSON
+# records are. A record only has the fields it was written with, and
+# time_created is left a FILETIME (100ns ticks since 1601-01-01 UTC)
+sub decode_binary_records {
+	my ($class, $bytes) = @_;
+	my (@records, %templates);
+	my $at = 0;
+
+	while( $at < length $bytes ) {
+		croak "Binary record cut short at byte $at"
+			if length($bytes) - $at < 6;
+
+		my ($length, $fields) = unpack( "x$at V v", $bytes );
+
+		croak "Binary record at byte $at runs past the end"
+			if $length > length($bytes) - $at - 4;
+
+		# The layout only depends on which fields are there
+		my $layout = $templates{$fields} ||= do {
+			my @present = grep { $fields & $_->[0] } BINARY_FIELDS;
+			[ [ map { $_->[1] } @present ], join(' ', map { $_->[2] } @present) ];
+		};
+
+		my %record;
+		@record{ @{$layout->[0]} } = unpack( "x6 $layout->[1]", substr($bytes, $at, 4 + $length) );
+
+		for my $key ( qw( logname source computer message ) ) {
+			$record{$key} = decode( 'UTF-8', $record{$key} ) if defined $record{$key};
+		}
+
+		push( @records, \%record );
+		$at += 4 + $length;
+	}
+
+	return @records;
+}
+
+# Splits the data sets ReadEventsToIpfixBuffer wrote, back to back, into
+# one string each (set header included)
+sub split_ipfix_sets {
+	my ($class, $bytes) = @_;
+	my @sets;
+	my $at = 0;
+
+	while( $at < length $bytes ) {
+		croak "IPFIX set cut short at byte $at"
+			if length($bytes) - $at < 4;
+
+		my (undef, $length) = unpack( "x$at n n", $bytes );
+
+		croak "IPFIX set at byte $at runs past the end"
+			if $length < 4 || $length > length($bytes) - $at;
+
+		push( @sets, substr($bytes, $at, $length) );
+		$at += $length;
+	}
+
+	return @sets;
+}
+
+# The bookmark of a subscription (from start_subscription), as XML
+sub _get_bookmark {
+	my ($self, $handle) = @_;
+
+	my $fn = Win32::API::More->new(
+		'EventLogParser', 
+		'GetCursorBookmark', 
+		'NNPNI', 
+		'N'
+	);
+	
+	croak "Error: $^E" if !$fn;	
+
+	my $chars = BOOKMARK_CHARS;
+
+	while( 1 ) {
+		my $buffer = "\0" x ($chars * 2);
+		my $needed = $fn->Call( $self->{session}, $handle, $buffer, $chars, $self->{debug} );
+
+		return undef if !$needed;
+
+		# Did not fit; try again with room for it
+		if( $needed > $chars ) {
+			$chars = $needed;
+			next;
+		}
+
+		return decode( 'UTF-16LE', substr($buffer, 0, ($needed - 1) * 2) );
 	}
 }
 
@@ -175,7 +1207,7 @@ sub _start_session {
 	
 	my $fn = Win32::API::More->new(
 		'EventLogParser', 
-		'StartSession', 
+		'StartFilteredSession', 
 		'NPPI', 
 		'N'
 	);
@@ -185,17 +1217,16 @@ sub _start_session {
 	# Windows Event Log API requires wide char
 	my $logName = $self->_to_wchar($logName);
 	
-	# Generate an XPath query based on supplied filters
-	my $xpathQuery = $self->_get_xpath_query( $filters );
-	my $xpathQueryWide = $self->_to_wchar( $xpathQuery );	
+	# The DLL compiles the filter into its XPath query
+	my $filterWide = $self->_to_wchar( $self->_get_filter( $filters ) );
 
-	my $result = $fn->Call( $handle, $logName, $xpathQueryWide, $self->{debug} );
+	my $result = $fn->Call( $handle, $logName, $filterWide, $self->{debug} );
 	
 	return $result;
 }
 
 sub _parse_event_log {
-	my ($self, $logName, $useCsv, $filters) = @_;
+	my ($self, $logName, $useCsv, $filters, $fields) = @_;
 
 	# Windows Event Log API requires wide char
 	my $server = $self->_to_wchar($self->{server});
@@ -204,15 +1235,17 @@ sub _parse_event_log {
 	my $password = $self->_to_wchar($self->{password});
 	my $logName = $self->_to_wchar($logName);
 	
-	# Generate an XPath query based on supplied filters
-	my $xpathQuery = $self->_get_xpath_query( $filters );
-	my $xpathQueryWide = $self->_to_wchar( $xpathQuery );
+	# The DLL compiles the filter into its XPath query
+	my $filterWide = $self->_to_wchar( $self->_get_filter( $filters ) );
 	
+	# With a list of fields, only those are read (see set_record_fields)
+	my $fieldsWide = defined $fields ? $self->_to_wchar( ref $fields ? join(',', @$fields) : $fields ) : undef;
+
 	# Import the Event Log Parsing function
 	my $parseEventLog = Win32::API::More->new(
 		'EventLogParser', 
-		'ParseEventLog', 
-		'PPPPPPII', 
+		'ParseEventLogFiltered', 
+		'PPPPPPPI', 
 		'I'
 	);
 	
@@ -221,43 +1254,67 @@ sub _parse_event_log {
 	
 	# Parse the event log
 	# Change the last parameter to 1 to enable verbose logging
-	$parseEventLog->Call($server, $domain, $username, $password, $logName, $xpathQueryWide, $useCsv, $self->{debug});	
+	$parseEventLog->Call($server, $domain, $username, $password, $logName, $filterWide, $fieldsWide, $self->{debug});	
 }
 
-sub _get_xpath_query {	
-	my ($self, $filters) = @_;
+# Prints the events the filters select oldest first, as _parse_event_log
+# does, stopping at max records or maxBytes bytes of them (as UTF-8; the
+# first record is printed whatever its size). Returns the last record ID
+# read, to start the next call after, and whether it stopped short of the
+# end
+sub _parse_event_log_forward {
+	my ($self, $logName, $filters, $fields, $max, $maxBytes) = @_;
 
-	my $recordClause;
-	my $eventClause;
-	my $query = "";
-	
-	# Build record filtering clause
-	$recordClause .= "(System/EventRecordID >= $filters->{lowRecord})" 
-		if $filters->{lowRecord};				
-	if( $filters->{highRecord} ) {
-		$recordClause .= " and " if( $filters->{lowRecord} );
-		$recordClause .= "(System/EventRecordID <= $filters->{highRecord})"; 
-	}
+	# Windows Event Log API requires wide char
+	my $server = $self->_to_wchar($self->{server});
+	my $domain = $self->_to_wchar($self->{domain});
+	my $username = $self->_to_wchar($self->{username});
+	my $password = $self->_to_wchar($self->{password});
+	my $logNameWide = $self->_to_wchar($logName);
+	my $filterWide = $self->_to_wchar( $self->_get_filter( $filters ) );
+	my $fieldsWide = defined $fields ? $self->_to_wchar( ref $fields ? join(',', @$fields) : $fields ) : undef;
 
-	# Build event ID filtering clause
-	if( $filters->{events} ) {
-		my $eventListLength = scalar @{$filters->{events}};
-		for( my $i=0; $i < $eventListLength; $i++ ) {
-			$eventClause .= "(System/EventID = $filters->{events}[$i])";
-			$eventClause .= " or " if $i < ($eventListLength - 1);
-		}
-	}
+	my $fn = Win32::API::More->new(
+		'EventLogParser', 
+		'ParseEventLogForward', 
+		'PPPPPPPNNPI', 
+		'N'
+	);
 	
-	# Build header/footer portions of query
-	if ($recordClause or $eventClause) {
-		$query .= "*[";
-		$query .= "($recordClause)" if $recordClause;
-		$query .= " and " if ($recordClause && $eventClause);
-		$query .= "($eventClause)" if $eventClause;
-		$query .= "]";
-	}
+	croak "Error: $^E" if !$fn;	
+
+	my $result = "\0" x 24;
+
+	$fn->Call($server, $domain, $username, $password, $logNameWide, $filterWide, $fieldsWide, $max, $maxBytes, $result, $self->{debug});
+
+	my ($read, $used, $required, $status, $last) = unpack('LLLLQ', $result);
+
+	croak "Reading the $logName log failed with error $status"
+		if $status && $status != ERROR_MORE_DATA;
+
+	# Nothing past startrec was read, so the next call starts there again
+	$last ||= ($filters->{lowRecord} || 1) - 1;
+
+	return ($last, $status == ERROR_MORE_DATA ? 1 : 0);
+}
+
+# Writes the filters as the clauses ParseEventLogFiltered and
+# StartFilteredSession read, e.g. "records=1200-;events=4624,4634". Runs of
+# event IDs are merged into ranges there, so the query makes a comparison
+# per range rather than one per ID
+sub _get_filter {
+	my ($self, $filters) = @_;
+
+	my @clauses;
+
+	# Record range; either end may be left open
+	push @clauses, "records=" . ($filters->{lowRecord} || '') . "-" . ($filters->{highRecord} || '')
+		if $filters->{lowRecord} || $filters->{highRecord};
+
+	push @clauses, "events=" . join(',', @{$filters->{events}})
+		if $filters->{events} && @{$filters->{events}};
 
-	return $query;
+	return join(';', @clauses);
 }
 
 # Converts a string to a wide-character string (wchar_t in C)
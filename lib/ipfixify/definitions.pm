@@ -415,6 +415,66 @@ sub tempSelect {
 					packettotalcount_rev(29305/86)<unsigned64>
 					rollable(13745/5000)<unsigned8>{agg:max}',
 			);
+	} elsif ($arg{flowCache} == 29) {
+		%cfg =
+			(
+			 'columnCount'	=> 10,
+			 'id' 					=> 'EpEventLogMined',
+			 'name' 				=> 'IPFIXify: Endpoint Microsoft Eventlogs (Message Templates)',
+			 'originator'		=> 'ipfixifymachineid',
+			 'columns' 			=> '
+					ipfixifymachineid(13745/3030)<string>[32]
+					ipfixifylogname(13745/3038)<string>
+					observationtimeseconds(322)<dateTimeSeconds>
+					ipfixifyeventrecordid(13745/3001)<unsigned64>
+					ipfixifyeventid(13745/3003)<signed64>
+					ipfixifylogsource(13745/3004)<string>
+					ipfixifymessagetemplateid(13745/3039)<unsigned32>
+					ipfixifymessageparameters(13745/3040)<string>
+					ipfixifydeltamessagecount(13745/3006)<unsigned64>
+					rollable(13745/5000)<unsigned8>{agg:max}',
+			);
+	} elsif ($arg{flowCache} == 30) {
+		%cfg =
+			(
+			 'columnCount'	=> 11,
+			 'id' 					=> 'EpEventLogFlow',
+			 'name' 				=> 'IPFIXify: Endpoint Microsoft Eventlogs (Merged)',
+			 'originator'		=> 'ipfixifymachineid',
+			 'columns' 			=> '
+					ipfixifymachineid(13745/3030)<string>[32]
+					ipfixifylogname(13745/3038)<string>
+					observationtimeseconds(322)<dateTimeSeconds>
+					ipfixifyeventrecordid(13745/3001)<unsigned64>
+					ipfixifyeventid(13745/3003)<signed64>
+					ipfixifylogsource(13745/3004)<string>
+					ipfixifymessage(13745/3005)<string>
+					ipfixifydeltamessagecount(13745/3006)<unsigned64>
+					flowstartseconds(150)<dateTimeSeconds>
+					flowendseconds(151)<dateTimeSeconds>
+					rollable(13745/5000)<unsigned8>{agg:max}',
+			);
+	} elsif ($arg{flowCache} == 31) {
+		%cfg =
+			(
+			 'columnCount'	=> 12,
+			 'id' 					=> 'EpEventLogMinedFlow',
+			 'name' 				=> 'IPFIXify: Endpoint Microsoft Eventlogs (Merged, Message Templates)',
+			 'originator'		=> 'ipfixifymachineid',
+			 'columns' 			=> '
+					ipfixifymachineid(13745/3030)<string>[32]
+					ipfixifylogname(13745/3038)<string>
+					observationtimeseconds(322)<dateTimeSeconds>
+					ipfixifyeventrecordid(13745/3001)<unsigned64>
+					ipfixifyeventid(13745/3003)<signed64>
+					ipfixifylogsource(13745/3004)<string>
+					ipfixifymessagetemplateid(13745/3039)<unsigned32>
+					ipfixifymessageparameters(13745/3040)<string>
+					ipfixifydeltamessagecount(13745/3006)<unsigned64>
+					flowstartseconds(150)<dateTimeSeconds>
+					flowendseconds(151)<dateTimeSeconds>
+					rollable(13745/5000)<unsigned8>{agg:max}',
+			);
 	} elsif ($arg{flowCache} == 107) {
 		%cfg =
 			(
@@ -512,6 +572,17 @@ sub tempSelect {
 					ipfixifylatitude(13745/3035)<string>
 					ipfixifylongitude(13745/3036)<string>'
 			);
+	} elsif ($arg{flowCache} == 115) {
+		%cfg =
+			(
+			 'columnCount'	=> 3,
+			 'id'						=> 'oMessageTemplate',
+			 'name' 				=> 'Options: Message Templates',
+			 'columns' 			=> '
+					ipfixifymachineid(13745/3030)<string>[32]{scope}
+					ipfixifymessagetemplateid(13745/3039)<unsigned32>{scope}
+					ipfixifymessagetemplate(13745/3041)<string>',
+			);
 	}
 
 	$cfg{columns} =~ s/\t//ig;
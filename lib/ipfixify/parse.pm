@@ -385,6 +385,22 @@ sub cfgCheck {
 			$cfg{'chunking'} = $ini->val('options', 'chunking');
 		}
 
+		if ($ini->val('options', 'chunkbytes')) {
+			$cfg{'chunkbytes'} = $ini->val('options', 'chunkbytes');
+		}
+
+		if ($ini->val('options', 'catchup')) {
+			$cfg{'catchup'} = $ini->val('options', 'catchup');
+		}
+
+		if ($ini->val('options', 'messages')) {
+			$cfg{'messages'} = $ini->val('options', 'messages');
+		}
+
+		if ($ini->val('options', 'subscribe')) {
+			$cfg{'subscribe'} = $ini->val('options', 'subscribe');
+		}
+
 		if ($ini->val('options', 'member')) {
 			@members = $ini->val('options', 'member');
 
@@ -872,6 +888,11 @@ included in the flow.
 a reference to the existing flowCache for originators to reference
 cached host names
 
+=item * utf8
+
+set when an event log line came from the parser as UTF-8 (see
+eventLogGrab), so its text is used as it is
+
 =back
 
 =cut
@@ -954,6 +975,12 @@ sub fileLine {
 		@hash_key = (qw{message computer source});
 
 		for ( @{ $arg{line} }{@hash_key} ) {
+			# Records read as UTF-8 by the parser need no fixing
+			if ($arg{'utf8'}) {
+				tr/\r\n\0/ /;
+				next;
+			}
+
 			# FIX UTF-8 *BEFORE* other substitutions
 			##########################################################
 			# Always use Encode::LEAVE_SRC with Encode::decode and
@@ -1015,7 +1042,9 @@ sub fileLine {
 				'source',
 				'message',
 			},
-		   1,    # Placeholder: ipfixifyMessageCount
+		   1,    # One event: ipfixifyMessageCount. Storms are only
+		         # merged when read_events writes IPFIX with a window,
+		         # which sysmetrics does not do yet
 		   1     # Placeholder: rollable
 		  );
 	} elsif ($cfg->{'mode'} eq 'filefollow') {
@@ -1575,6 +1604,8 @@ This function assembles a user name flow.
 
 	($user, $userFlow, $tmplUsed) = &ipfixify::parse::userNameFlow(
 		'record'		=> $record,
+		'identity'		=> $identity,
+		'eventData'		=> $eventData,
 		'computer'		=> $arg{'computer'},
 		'originator'	=> $arg{'originator'},
 		'machineID'		=> $arg{'machineID'}
@@ -1590,6 +1621,19 @@ The currently supported parameters are:
 
 the data to examine for userNameFlow
 
+=item * identity
+
+who logged on or off, as the parser worked it out from the EventData
+(the identity of the record: user, domain, logon_id, logon_type, source,
+workstation and state). Used before anything else
+
+=item * eventData
+
+the EventData fields of the event by name, if the parser was asked for
+them (the event_data of the record). They are used instead of the
+message, which reads differently in every language and version of
+Windows
+
 =item * computer
 
 the computer this data came from
@@ -1623,7 +1667,49 @@ sub userNameFlow {
 	   'unauthenticated' => 203
 	  );
 
-	if ($arg{'record'}->[0] eq '4624') {
+	if ($arg{'identity'} && %{$arg{'identity'}}) {
+		# Worked out by the parser, from the EventData (see Identity.cpp)
+		my $identity = $arg{'identity'};
+
+		$user		= $identity->{'user'};
+		$domain		= $identity->{'domain'};
+		$loginID	= $identity->{'logon_id'};
+		$loginType	= $identity->{'logon_type'};
+		$srcAddr	= $identity->{'source'};
+		$wsName		= $identity->{'workstation'};
+		$loginState = $identity->{'state'};
+	} elsif ($arg{'eventData'} && %{$arg{'eventData'}}) {
+		my $data = $arg{'eventData'};
+		my $eventId = $arg{'record'}->[0];
+
+		if ($eventId eq '4624') {
+			$user		= $data->{'TargetUserName'};
+			$domain		= $data->{'TargetDomainName'};
+			$loginID	= $data->{'TargetLogonId'};
+			$loginType	= $data->{'LogonType'};
+			$srcAddr	= $data->{'IpAddress'};
+			$wsName		= $data->{'WorkstationName'};
+			$loginState = '0';
+		} elsif ($eventId eq '4634' || $eventId eq '4647') {
+			$user		= $data->{'TargetUserName'};
+			$domain		= $data->{'TargetDomainName'};
+			$loginID	= $data->{'TargetLogonId'};
+			$loginType	= $eventId eq '4634' ? $data->{'LogonType'} : '255';
+			$srcAddr	= '0.0.0.255';
+			$loginState = 2;
+		} elsif ($eventId =~ m/^627[2348]$/) {
+			# Bug 18445 (Radius): granted, denied, discarded, or granted
+			# full access
+			my %npsState = ('6272' => '0', '6273' => 3, '6274' => 4, '6278' => 1);
+
+			$user		= $data->{'SubjectUserName'};
+			$domain		= $data->{'SubjectDomainName'};
+			$loginID	= $data->{'AccountSessionIdentifier'};
+			$loginType	= $radius{$data->{'AuthenticationType'}} || 255;
+			$srcAddr	= $data->{'CallingStationID'};
+			$loginState = $npsState{$eventId};
+		}
+	} elsif ($arg{'record'}->[0] eq '4624') {
 		# For Log ins: Event ID 4624
 		if ($arg{'record'}->[15] eq 'Security ID') {
 			$user		= $arg{'record'}->[18];
@@ -1703,9 +1789,7 @@ sub userNameFlow {
 		if ($wsName eq 'Workstation Name') {
 			$wsName = "";
 		}
-	}
-
-	if ($arg{'record'}->[0] eq '4634' || $arg{'record'}->[0] eq '4647') {
+	} elsif ($arg{'record'}->[0] eq '4634' || $arg{'record'}->[0] eq '4647') {
 		# For Log offs: Windows 2008 has Event ID 4634 and 4647. Event
 		# ID 4647 might help grab some of those log offs not recorded
 		# as part of 4634 (reference bug 10984)
@@ -1724,9 +1808,7 @@ sub userNameFlow {
 
 		$srcAddr	= '0.0.0.255';
 		$loginState = 2;
-	}
-
-	if ($arg{'record'}->[0] eq '6272') {
+	} elsif ($arg{'record'}->[0] eq '6272') {
 		# Bug 18445 (Radius)
 		# Network Policy Server granted access to a user.
 
@@ -1736,9 +1818,7 @@ sub userNameFlow {
 		$loginType	= $radius{$arg{'record'}->[49]} || 255,
 		$srcAddr	= $arg{'record'}->[22];
 		$loginState = '0';
-	}
-
-	if ($arg{'record'}->[0] eq '6273') {
+	} elsif ($arg{'record'}->[0] eq '6273') {
 		# Bug 18445 (Radius)
 		# Network Policy Server denied access to a user.
 
@@ -1748,9 +1828,7 @@ sub userNameFlow {
 		$loginType	= $radius{$arg{'record'}->[50]} || 255,
 		$srcAddr	= $arg{'record'}->[23];
 		$loginState = 3;
-	}
-
-	if ($arg{'record'}->[0] eq '6274') {
+	} elsif ($arg{'record'}->[0] eq '6274') {
 		# Bug 18445 (Radius)
 		# Network Policy Server discarded the request for a user.
 
@@ -1760,9 +1838,7 @@ sub userNameFlow {
 		$loginType	= $radius{$arg{'record'}->[50]} || 255,
 		$srcAddr	= $arg{'record'}->[23];
 		$loginState = 4;
-	}
-
-	if ($arg{'record'}->[0] eq '6278') {
+	} elsif ($arg{'record'}->[0] eq '6278') {
 		# Bug 18445 (Radius)
 		# Network Policy Server granted full access to a user
 		# because the host met the defined health policy.
@@ -22,6 +22,7 @@ $VERSION = '1';
 
 @EXPORT = qw(
 	&createDb
+	&eventLogBookmark
 	&eventLogConnect
 	&eventLogGrab
 	&eventLogLastID
@@ -62,6 +63,8 @@ ipfixify::sysmetrics
 		tid			=> $arg{'tid'},
 		eventfilter => [4634] || '',
 		startrec	=> $recordNumber,
+		subscribe	=> 1 || 0,
+		bookmark	=> $bookmark,
 		verbose		=> 1 || 0
 	);
 
@@ -202,8 +205,6 @@ sub createDb {
 
 	%arg = (@_);
 
-	return if (-e "$ENV{'TMPDIR'}/sysmetrics.db");
-
 	$dbh = DBI->connect
 	  (
 	   "dbi:SQLite:dbname=$ENV{'TMPDIR'}/sysmetrics.db",
@@ -234,6 +235,19 @@ sub createDb {
 
 	$dbh->do($query);
 
+	# Where each eventlog subscription got to (see eventLogBookmark).
+	# Added after the others, so it may be missing from an existing file
+	$query = qq {
+		CREATE TABLE IF NOT EXISTS `eventbookmarks` (
+			id INTEGER PRIMARY KEY AUTOINCREMENT,
+			computer,
+			flowcacheid INTEGER,
+			bookmark TEXT
+		);
+	};
+
+	$dbh->do($query);
+
 	$dbh->disconnect() if ($dbh);
 
 	return;
@@ -317,6 +331,8 @@ This grabs a list of eventlogs and returns them for processing.
 		tid			=> $arg{'tid'},
 		eventfilter => [4634] || '',
 		startrec	=> $recordNumber,
+		subscribe	=> 1 || 0,
+		bookmark	=> $bookmark,
 		verbose		=> 1 || 0
 	);
 
@@ -347,6 +363,17 @@ gathered. otherwise all events will be gathered
 
 which record do we begin when gathering events
 
+=item * subscribe
+
+when enabled, events are read through a subscription rather than a
+query. It carries on after bookmark, or starts at startrec when there
+is none yet. Ask the eventlog handle for the bookmark to keep
+afterwards (get_bookmark)
+
+=item * bookmark
+
+where the last subscription to this eventlog got to
+
 =item * verbose
 
 when enabled, debug will be printed out to the screen
@@ -361,8 +388,8 @@ an array of hashes that contain the records to process.
 
 sub eventLogGrab {
 	my (%arg);
-	my ($json, $stdout, $stderr);
-	my (@eventfilter, @records, @userIdentityEvents);
+	my ($json, $lastrec);
+	my (@eventfilter, @raw, @records, @userIdentityEvents);
 
 	%arg = (@_);
 
@@ -384,67 +411,59 @@ sub eventLogGrab {
 		@eventfilter = ();
 	}
 
-	if ($arg{'cfg'}->{'chunking'}) {
-		my $endrec = $arg{startrec} + $arg{'cfg'}->{'chunking'};
-
-		($stdout, $stderr) = eval {
-			capture {
-				$arg{'elh'}->parse
-				  (
-				   eventlog => $arg{'eventlog'},
-				   eventfilter => \@eventfilter,
-				   startrec => $arg{'startrec'},
-				   endrec	=> $endrec
-				  );
-			};
-		};
-	} else {
-		($stdout, $stderr) = eval {
-			capture {
-				$arg{'elh'}->parse
-				  (
-				   eventlog => $arg{'eventlog'},
-				   eventfilter => \@eventfilter,
-				   startrec => $arg{'startrec'},
-				  );
-			};
-		};
-	}
-
-	if ($stdout =~ m/error: 5/) {
-		print "[Error]: Invalid Login Credentials\n"
-		  if ($arg{'verbose'});
+	# Records arrive one by one, straight from the parser, so there is no
+	# output to capture and split. They come oldest first, with the record
+	# ID to carry on from, so nothing has to look for the highest one.
+	# With chunking (and chunkbytes), only that many (bytes) are read.
+	# With catchup, a backlog left from being offline is read over that
+	# many sessions to the host at once, still handed over in order.
+	# The parser works out who logged on or off from the EventData, so the
+	# identity does not depend on how the message is laid out or translated.
+	# The messages option has them filled in from cached templates
+	($lastrec, @raw) = eval {
+		$arg{'elh'}->read_events
+		  (
+		   eventlog => $arg{'eventlog'},
+		   eventfilter => \@eventfilter,
+		   startrec => $arg{'startrec'},
+		   max => $arg{'cfg'}->{'chunking'} || 0,
+		   maxbytes => $arg{'cfg'}->{'chunkbytes'} || 0,
+		   catchup => $arg{'cfg'}->{'catchup'} || 0,
+		   identity => 1,
+		   messages => $arg{'cfg'}->{'messages'} || 'remote',
+		   ($arg{'subscribe'} ? (bookmark => $arg{'bookmark'} // '') : ())
+		  );
+	};
 
-		return ($arg{'startrec'}, @records);
-	} elsif ($stderr) {
-		print "$stderr\n" if ($arg{'verbose'});
-		return ($arg{'startrec'}, @records);
-	} elsif ($@) {
+	if ($@) {
 		print "[Error]: $@\n" if ($arg{'verbose'});
 		return ($arg{'startrec'}, @records);
 	}
 
-	$json = JSON::XS->new->utf8;
+	# The parser hands over valid UTF-8. Decoding without ->utf8 leaves
+	# the values as those bytes, ready for the spool file as they are
+	$json = JSON::XS->new;
 
-	foreach (split (/\|\|/, $stdout)) {
+	foreach (@raw) {
 		eval {
-			my (@userMeta);
+			my (@userMeta, $text);
+
+			# Records are escaped by the parser, so they decode as they are
+			my $obj = $json->decode($_);
 
-			$_ =~ s/\r|\n|\0|\t/:::/ig;
-			$_ =~ s/"/'/ig;
-			$_ =~ s/':'/":"/ig;
-			$_ =~ s/\\/\\\\/ig;
-			$_ =~ s/','/","/ig;
-			$_ =~ s/'\}$/"\}/;
-			$_ =~ s/\{'/\{"/;
+			# user_meta is the message cut at every line break and tab.
+			# Slice 0 stands for the fields ahead of the message, as when
+			# the whole record was cut up; it is replaced below
+			($text = "{$obj->{'message'}") =~ s/\r|\n|\t/:::/g;
 
-			foreach my $slice (split (/:::/, $_)) {
+			foreach my $slice (split (/:::/, $text)) {
 				$slice =~ s/^://;
 				push (@userMeta, $slice) if ($slice);
 			}
 
-			$_ =~ s/:::/\ /ig;
-			my $obj = $json->decode($_);
+			# Exported on one line, as before
+			$obj->{'message'} =~ s/\r|\n|\t/ /g;
+
 			$userMeta[0] = $obj->{'event_id'};
 			$userMeta[1] = $obj->{'message'} =~ m/an account was successfully logged on/i ? '0' : '1';
 			$obj->{'logname'} = uc($obj->{'logname'});
@@ -456,7 +475,6 @@ sub eventLogGrab {
 
 			#print Dumper $obj if ($arg{'verbose'} > 1);
 			push (@records, $obj);
-			$arg{'startrec'} = $arg{'startrec'} < $obj->{'record_id'} ? $obj->{'record_id'} : $arg{'startrec'};
 		};
 
 		if ($@) {
@@ -467,7 +485,9 @@ sub eventLogGrab {
 		}
 	}
 
-	return ($arg{'startrec'}, @records);
+	# Carry on from where the parser stopped, even past records that
+	# could not be decoded, so the next call continues the same query
+	return ($lastrec, @records);
 }
 
 #####################################################################
@@ -585,6 +605,103 @@ sub eventLogLastID {
 
 =pod
 
+=head2 eventLogBookmark
+
+this function keeps the bookmark of an eventlog subscription, so the
+next one carries on after the last event read
+
+=over 2
+
+	$bookmark = &ipfixify::sysmetrics::eventLogBookmark(
+		flowcacheid		=> $arg{'flowcacheid'},
+		computer		=> $arg{'computer'},
+		action			=> [SET|GET],
+		bookmark		=> $bookmark
+	);
+
+=back
+
+The currently supported parameters are:
+
+=over 2
+
+=item * flowcacheid
+
+which flowcache are we tracking a bookmark for
+
+=item * computer
+
+the computer that we're tracking bookmarks
+
+=item * action
+
+an action of GET retreives the bookmark. An action of SET will store
+it for the next poll.
+
+=item * bookmark
+
+This is the bookmark XML to store when the action is SET
+
+=back
+
+What is returned is the bookmark. New entries will return UNDEF
+
+=cut
+
+sub eventLogBookmark {
+	my (%arg);
+	my ($bookmark, $dbh, $ref);
+
+	%arg = (@_);
+
+	$dbh = DBI->connect
+	  (
+	   "dbi:SQLite:dbname=$ENV{'TMPDIR'}/sysmetrics.db",
+	   "",
+	   "",
+	   { RaiseError => 1, AutoCommit => 1}
+	  );
+
+	# Bookmarks are XML with quotes in, so they go in as placeholders
+	if ($arg{'action'} =~ m/GET/) {
+		$ref = $dbh->selectrow_hashref
+		  (
+		   "SELECT bookmark FROM eventbookmarks WHERE computer = ? AND flowcacheid = ?",
+		   undef,
+		   $arg{'computer'},
+		   $arg{'flowcacheid'}
+		  );
+
+		$bookmark = $ref ? $ref->{'bookmark'} : undef;
+	} elsif ($arg{'action'} =~ m/SET/) {
+		$dbh->do
+		  (
+		   "DELETE FROM eventbookmarks WHERE computer = ? AND flowcacheid = ?",
+		   undef,
+		   $arg{'computer'},
+		   $arg{'flowcacheid'}
+		  );
+
+		$dbh->do
+		  (
+		   "INSERT INTO eventbookmarks (computer, flowcacheid, bookmark) VALUES (?, ?, ?)",
+		   undef,
+		   $arg{'computer'},
+		   $arg{'flowcacheid'},
+		   $arg{'bookmark'}
+		  );
+
+		$bookmark = $arg{'bookmark'};
+	}
+
+	$dbh->disconnect() if ($dbh);
+	return $bookmark;
+}
+
+#####################################################################
+
+=pod
+
 =head2 eventLogParse
 
 This function takes all the gathered eventlogs and parses them in ways
@@ -656,6 +773,11 @@ if true, enables verbose mode
 
 =back
 
+With the subscribe option, events are read through a subscription
+that carries on after the bookmark the last poll stored, rather than
+a query from the last record ID. The first poll starts at the last
+record, as before.
+
 The returned value is a high resolution time of how long it took to
 parse the data.
 
@@ -664,7 +786,7 @@ parse the data.
 sub eventLogParse {
 	my (%arg);
 	my (@eventfilter, @records);
-	my ($stopwatch, $lastrec);
+	my ($stopwatch, $lastrec, $subscribe, $bookmark);
 
 	%arg = (@_);
 
@@ -696,6 +818,19 @@ sub eventLogParse {
 		}
 	}
 
+	# A subscription picks up after the last event read, wherever the
+	# log is at, without querying for it
+	$subscribe = $arg{'cfg'}->{'subscribe'} && ! $arg{'lastX'};
+
+	if ($subscribe) {
+		$bookmark = &ipfixify::sysmetrics::eventLogBookmark
+		  (
+		   flowcacheid	=> $arg{'flowcacheid'},
+		   computer		=> $arg{'computer'},
+		   action		=> 'GET'
+		  );
+	}
+
 	($lastrec, @records) = &ipfixify::sysmetrics::eventLogGrab
 	  (
 	   eventlog	=> $arg{'eventlog'},
@@ -703,9 +838,23 @@ sub eventLogParse {
 	   cfg		=> $arg{'cfg'},
 	   tid		=> $arg{'tid'},
 	   startrec	=> $lastrec,
+	   subscribe	=> $subscribe,
+	   bookmark	=> $bookmark,
 	   verbose	=> $arg{'verbose'}
 	  );
 
+	if ($subscribe) {
+		$bookmark = $arg{'elh'}->get_bookmark($arg{'eventlog'});
+
+		&ipfixify::sysmetrics::eventLogBookmark
+		  (
+		   flowcacheid	=> $arg{'flowcacheid'},
+		   computer		=> $arg{'computer'},
+		   action		=> 'SET',
+		   bookmark		=> $bookmark
+		  ) if ($bookmark);
+	}
+
 	foreach (@records) {
 		my ($elFlow, $userFlow, $user, $record, $flow, $tmplUsed);
 
@@ -716,6 +865,7 @@ sub eventLogParse {
 		($user, $userFlow, $tmplUsed) = &ipfixify::parse::userNameFlow
 		  (
 		   'record'		=> $_->{user_meta},
+		   'identity'	=> $_->{identity},
 		   'computer'	=> $arg{'computer'},
 		   'originator'	=> $arg{'originator'},
 		   'machineID'	=> $arg{'machineID'}
@@ -739,10 +889,9 @@ sub eventLogParse {
 			'originator'	=> $arg{'originator'},
 			'machineID'		=> $arg{'machineID'},
 			'verbose'		=> $arg{'verbose'},
+			'utf8'			=> 1,
 		   )
 		  ) if ($arg{'cfg'}->{'eventlogs'});
-
-		$lastrec = $lastrec < $record->{'record_id'} ? $record->{'record_id'} : $lastrec;
 	}
 
 	if (! $arg{'lastX'}) {
@@ -1859,22 +2008,22 @@ sub sampling {
 				  );
 			}
 
-			tr/\r\n\0/ /;
-
 			eval {
-				$_ =~ s/\r|\n|\0|\t/:::/ig;
+				my $obj = $json->decode($_);
+				my $text;
 
-				foreach my $slice (split (/:::/, $_)) {
+				# Only tabs cut the message here; line breaks are spaces
+				($text = "{$obj->{'message'}") =~ tr/\r\n/ /;
+				$text =~ s/\t/:::/g;
+
+				foreach my $slice (split (/:::/, $text)) {
 					$slice =~ s/^://;
 					if ($slice) {
-						push (@userMeta, "$sliceNumber : $slice");
+						push (@userMeta, "$sliceNumber : " . encode('UTF-8', $slice));
 						$sliceNumber++;
 					}
 				}
 
-				$_ =~ s/:::/\ /ig;
-
-				my $obj = $json->decode($_);
 				$userMeta[0] = "0 : $obj->{'event_id'}";
 				$obj->{'logname'} = uc($obj->{'logname'});
 